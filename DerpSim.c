@@ -0,0 +1,1191 @@
+#define WIN32_LEAN_AND_MEAN
+#define _CRT_SECURE_NO_DEPRECATE
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DERPNET_USE_PLAIN_HTTP 1
+#define DERPNET_STATIC
+#include "external/derpnet.h"
+
+#include <timeapi.h>
+
+#pragma comment (lib, "kernel32")
+#pragma comment (lib, "winmm")
+
+//
+// DerpSim - local stand-in for DERP relay with simulated network conditions
+//
+// usage: DerpSim.exe [-port 80] [-profile hotel.txt] [-seed 1] [-csv metrics.csv] [-mesh 8002 ...] [-meshlatency 0]
+//
+// ScreenBuddy built with DERPNET_USE_PLAIN_HTTP=1 connects to it on localhost, or to relays listed in DerpMapFile
+// from its ini ("build.cmd derpsim" builds both DerpSim.exe and ScreenBuddyLocal.exe). "build.cmd simrun" runs
+// relay with profile together with sharing & viewing ScreenBuddyLocal and collects csv files, see sim\run.cmd.
+// Relay speaks plain HTTP DERP protocol with fast start, forwards packets between connected clients by public key,
+// reports PeerGone for unknown destinations, and answers pings.
+//
+// With -mesh relay connects to other DerpSim on that port as mesh peer, same as derper does with other servers of
+// its region. It sends WatchConns, tracks which clients are present there, and forwards packets for them with
+// ForwardPacket after -meshlatency msec of one way inter-relay delay. Two relays that mesh with each other stand in
+// for two regions, so viewer with DerpMesh=1 can use its own region. Any client that sends WatchConns gets
+// PeerPresent & PeerGone for all clients, mesh key is not checked.
+//
+// Every frame relay sends to client goes through simulated link of that client - bottleneck bandwidth, one way
+// latency, random jitter, and stalls that look like TCP retransmit timeout after loss. Delivery order is kept, as
+// it would be with TCP. Data relay reads from client is limited by per-client token bucket, like derper does with
+// its rate limit, extra data waits in client's socket buffer. Random decisions come from generator seeded with
+// -seed and connection index, so same profile with clients connecting in same order gives same run.
+//
+// profile is text file with one setting per line, applied at given second since start, # starts comment:
+//   <sec> bandwidth <kbit/s>   from relay to each client, 0 = unlimited
+//   <sec> latency <msec>       one way delay
+//   <sec> jitter <msec>        uniformly random extra delay, 0..jitter
+//   <sec> stall <probability>  per frame, of stall
+//   <sec> stallms <msec>       how long stall lasts
+//   <sec> ratelimit <kbit/s>   data accepted from each client, 0 = unlimited
+//   <sec> burst <bytes>        token bucket size for ratelimit
+//   <sec> queue <frames>       frames waiting for each client, extra frames are dropped like derper does, 0 = unlimited
+//   <sec> outage <0|1>         1 = relay delivers nothing, clients stay connected & what they send is dropped, like
+//                              relay that lost its upstream, 0 = relay works again
+//   <sec> disconnect 1         closes connection of every client once, they can connect again right away, mesh
+//                              connections stay
+//
+// metrics are printed & written to csv file every second, one line per client:
+//   time in msec, connection index, first bytes of public key, bytes received from client, bytes sent to client,
+//   frames sent to client, frames dropped, stalls, largest delay of frame in relay in msec
+//
+
+enum
+{
+	SIM_MAX_CLIENTS		= 64,
+	SIM_MAX_FRAME		= 1 << 17,
+	SIM_MAX_STEPS		= 256,
+	SIM_REPORT_INTERVAL	= 1000,		// msec
+	SIM_DEFAULT_PORT	= 80,		// DerpNet with DERPNET_USE_PLAIN_HTTP connects to this port when none is given
+	SIM_MAX_MESH		= 4,
+	SIM_MESH_RETRY		= 1000,		// msec, between connection attempts to mesh peer
+};
+
+typedef enum
+{
+	SIM_BANDWIDTH,
+	SIM_LATENCY,
+	SIM_JITTER,
+	SIM_STALL,
+	SIM_STALL_MS,
+	SIM_RATE_LIMIT,
+	SIM_BURST,
+	SIM_QUEUE,
+	SIM_OUTAGE,
+	SIM_DISCONNECT,
+	SIM_SETTING_COUNT,
+}
+Sim_Setting;
+
+static const char* Sim_SettingNames[SIM_SETTING_COUNT] =
+{
+	"bandwidth",
+	"latency",
+	"jitter",
+	"stall",
+	"stallms",
+	"ratelimit",
+	"burst",
+	"queue",
+	"outage",
+	"disconnect",
+};
+
+typedef struct
+{
+	uint32_t Time;		// msec since start
+	Sim_Setting Setting;
+	double Value;
+	bool Done;			// disconnect was done
+}
+Sim_Step;
+
+typedef struct Sim_Frame
+{
+	struct Sim_Frame* Next;
+	uint64_t Time;		// usec, when frame can be written to client socket
+	uint64_t Queued;	// usec, when frame entered relay
+	uint32_t Size;
+	uint8_t* Data;
+}
+Sim_Frame;
+
+typedef struct
+{
+	bool Used;
+	bool Ready;				// handshake finished, PublicKey is valid
+	bool Closing;
+	bool Watcher;			// sent WatchConns, gets PeerPresent & PeerGone for every client
+	SOCKET Socket;
+	uint32_t Index;			// connection number since start
+	uint8_t PublicKey[32];
+	HANDLE Reader;
+	HANDLE Writer;
+
+	// frames for client, protected by Lock
+	SRWLOCK Lock;
+	CONDITION_VARIABLE Wake;
+	Sim_Frame* Head;
+	Sim_Frame* Tail;
+	uint32_t Count;
+	uint64_t LinkFree;		// usec, when simulated link has sent all queued frames
+	uint64_t LastTime;		// usec, delivery time of last queued frame
+	uint64_t Random;
+
+	// rate limit of data from client, used only by reader thread
+	double Tokens;
+	uint64_t TokenTime;		// usec
+
+	// metrics since last report
+	volatile LONG64 BytesIn;
+	volatile LONG64 BytesOut;
+	volatile LONG64 FramesOut;
+	volatile LONG64 Drops;
+	volatile LONG64 Stalls;
+	volatile LONG64 MaxDelay;	// usec
+}
+Sim_Client;
+
+// connection to other relay, packets for clients present there are forwarded over it
+typedef struct
+{
+	uint16_t Port;
+	HANDLE Reader;			// connects & receives presence updates, reconnects when connection is lost
+	HANDLE Writer;			// sends queued packets once inter-relay latency has passed
+	SRWLOCK SendLock;		// Writer sends while holding it, Reader opens & closes connection
+	DerpNet Net;
+
+	// protected by Lock
+	SRWLOCK Lock;
+	CONDITION_VARIABLE Wake;
+	bool Connected;
+	uint32_t KeyCount;
+	uint8_t Keys[SIM_MAX_CLIENTS][32];
+	Sim_Frame* Head;		// frame data is source key, target key & sealed packet
+	Sim_Frame* Tail;
+	uint64_t LastTime;		// usec, delivery time of last queued frame
+
+	// metrics since last report
+	volatile LONG64 BytesOut;
+	volatile LONG64 FramesOut;
+}
+Sim_Mesh;
+
+static struct
+{
+	uint64_t Freq;
+	uint64_t Start;			// QPC
+	uint64_t Seed;
+	uint32_t StepCount;
+	Sim_Step Steps[SIM_MAX_STEPS];
+	uint8_t PrivateKey[32];
+	uint8_t PublicKey[32];
+
+	SRWLOCK Lock;			// protects client slots, exclusive only when slot is taken or freed
+	uint32_t NextIndex;
+	Sim_Client Clients[SIM_MAX_CLIENTS];
+
+	uint32_t MeshLatency;	// msec
+	uint32_t MeshCount;
+	Sim_Mesh Mesh[SIM_MAX_MESH];
+}
+Sim;
+
+//
+// helpers
+//
+
+// usec since start
+static uint64_t Sim_GetTime(void)
+{
+	LARGE_INTEGER Now;
+	QueryPerformanceCounter(&Now);
+	return (uint64_t)(Now.QuadPart - Sim.Start) * 1000000 / Sim.Freq;
+}
+
+// splitmix64
+static uint64_t Sim_Random(uint64_t* State)
+{
+	uint64_t Result = (*State += 0x9e3779b97f4a7c15ULL);
+	Result = (Result ^ (Result >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	Result = (Result ^ (Result >> 27)) * 0x94d049bb133111ebULL;
+	return Result ^ (Result >> 31);
+}
+
+// uniform in [0, 1)
+static double Sim_Random01(uint64_t* State)
+{
+	return (double)(Sim_Random(State) >> 11) / (double)(1ULL << 53);
+}
+
+static void Sim_AtomicMax(volatile LONG64* Target, LONG64 Value)
+{
+	LONG64 Current = *Target;
+	while (Value > Current)
+	{
+		LONG64 Previous = InterlockedCompareExchange64(Target, Value, Current);
+		if (Previous == Current)
+		{
+			break;
+		}
+		Current = Previous;
+	}
+}
+
+static bool Sim_RecvAll(SOCKET Socket, void* Buffer, uint32_t Size)
+{
+	char* Data = Buffer;
+	while (Size != 0)
+	{
+		int Read = recv(Socket, Data, (int)Size, 0);
+		if (Read <= 0)
+		{
+			return false;
+		}
+		Data += Read;
+		Size -= Read;
+	}
+	return true;
+}
+
+static bool Sim_SendAll(SOCKET Socket, const void* Buffer, uint32_t Size)
+{
+	const char* Data = Buffer;
+	while (Size != 0)
+	{
+		int Sent = send(Socket, Data, (int)Size, 0);
+		if (Sent <= 0)
+		{
+			return false;
+		}
+		Data += Sent;
+		Size -= Sent;
+	}
+	return true;
+}
+
+//
+// profile
+//
+
+static bool Sim_LoadProfile(const char* Path)
+{
+	FILE* File = fopen(Path, "r");
+	if (File == NULL)
+	{
+		fprintf(stderr, "cannot open profile '%s'\n", Path);
+		return false;
+	}
+
+	char Line[256];
+	uint32_t LineNumber = 0;
+	while (fgets(Line, sizeof(Line), File))
+	{
+		LineNumber++;
+
+		char* Comment = strchr(Line, '#');
+		if (Comment)
+		{
+			*Comment = 0;
+		}
+
+		double Time;
+		char Name[64];
+		double Value;
+		int Count = sscanf(Line, "%lf %63s %lf", &Time, Name, &Value);
+		if (Count <= 0)
+		{
+			continue;
+		}
+
+		int Setting = -1;
+		for (int Index = 0; Count == 3 && Index < SIM_SETTING_COUNT; Index++)
+		{
+			if (strcmp(Name, Sim_SettingNames[Index]) == 0)
+			{
+				Setting = Index;
+			}
+		}
+
+		if (Setting < 0 || Time < 0 || Value < 0 || Sim.StepCount == SIM_MAX_STEPS)
+		{
+			fprintf(stderr, "%s(%u): invalid line\n", Path, LineNumber);
+			fclose(File);
+			return false;
+		}
+
+		Sim.Steps[Sim.StepCount++] = (Sim_Step)
+		{
+			.Time = (uint32_t)(Time * 1000.0),
+			.Setting = (Sim_Setting)Setting,
+			.Value = Value,
+		};
+	}
+
+	fclose(File);
+	return true;
+}
+
+// settings in effect at Time, steps are applied in file order
+static void Sim_GetSettings(uint64_t Time, double Settings[SIM_SETTING_COUNT])
+{
+	ZeroMemory(Settings, SIM_SETTING_COUNT * sizeof(Settings[0]));
+	Settings[SIM_BURST] = 64 * 1024;
+
+	for (uint32_t Index = 0; Index < Sim.StepCount; Index++)
+	{
+		Sim_Step* Step = &Sim.Steps[Index];
+		if ((uint64_t)Step->Time * 1000 <= Time)
+		{
+			Settings[Step->Setting] = Step->Value;
+		}
+	}
+}
+
+//
+// clients
+//
+
+// frame goes through simulated link of client, called with shared Sim.Lock held
+static void Sim_Deliver(Sim_Client* Client, uint8_t FrameType, const void* Data1, uint32_t Size1, const void* Data2, uint32_t Size2)
+{
+	uint32_t Size = 1 + 4 + Size1 + Size2;
+
+	Sim_Frame* Frame = malloc(sizeof(*Frame) + Size);
+	if (Frame == NULL)
+	{
+		return;
+	}
+
+	Frame->Next = NULL;
+	Frame->Size = Size;
+	Frame->Data = (uint8_t*)(Frame + 1);
+	Frame->Data[0] = FrameType;
+	Set32BE(Frame->Data + 1, Size1 + Size2);
+	memcpy(Frame->Data + 1 + 4, Data1, Size1);
+	memcpy(Frame->Data + 1 + 4 + Size1, Data2, Size2);
+
+	uint64_t Now = Sim_GetTime();
+
+	double Settings[SIM_SETTING_COUNT];
+	Sim_GetSettings(Now, Settings);
+
+	AcquireSRWLockExclusive(&Client->Lock);
+
+	if (Client->Closing || Settings[SIM_OUTAGE] != 0 || (Settings[SIM_QUEUE] != 0 && Client->Count >= Settings[SIM_QUEUE]))
+	{
+		ReleaseSRWLockExclusive(&Client->Lock);
+		InterlockedIncrement64(&Client->Drops);
+		free(Frame);
+		return;
+	}
+
+	// serialization on bottleneck link, then propagation
+	uint64_t Start = max(Now, Client->LinkFree);
+	uint64_t Transmit = Settings[SIM_BANDWIDTH] == 0 ? 0 : (uint64_t)(Size * 8 * 1000.0 / Settings[SIM_BANDWIDTH]);
+	Client->LinkFree = Start + Transmit;
+
+	uint64_t Time = Client->LinkFree + (uint64_t)(Settings[SIM_LATENCY] * 1000.0);
+	Time += (uint64_t)(Sim_Random01(&Client->Random) * Settings[SIM_JITTER] * 1000.0);
+
+	// lost segment holds up everything behind it until retransmit
+	if (Sim_Random01(&Client->Random) < Settings[SIM_STALL])
+	{
+		Time += (uint64_t)(Settings[SIM_STALL_MS] * 1000.0);
+		InterlockedIncrement64(&Client->Stalls);
+	}
+
+	Time = max(Time, Client->LastTime);
+	Client->LastTime = Time;
+
+	Frame->Time = Time;
+	Frame->Queued = Now;
+
+	if (Client->Tail)
+	{
+		Client->Tail->Next = Frame;
+	}
+	else
+	{
+		Client->Head = Frame;
+	}
+	Client->Tail = Frame;
+	Client->Count++;
+
+	ReleaseSRWLockExclusive(&Client->Lock);
+	WakeConditionVariable(&Client->Wake);
+}
+
+// called with shared Sim.Lock held
+static Sim_Client* Sim_FindClient(const uint8_t PublicKey[32])
+{
+	for (uint32_t Index = 0; Index < SIM_MAX_CLIENTS; Index++)
+	{
+		Sim_Client* Client = &Sim.Clients[Index];
+		if (Client->Used && Client->Ready && !Client->Closing && memcmp(Client->PublicKey, PublicKey, 32) == 0)
+		{
+			return Client;
+		}
+	}
+	return NULL;
+}
+
+// tells watching relays that client has connected or is gone, called with Sim.Lock held
+static void Sim_NotifyWatchers(const uint8_t PublicKey[32], bool Present)
+{
+	for (uint32_t Index = 0; Index < SIM_MAX_CLIENTS; Index++)
+	{
+		Sim_Client* Watcher = &Sim.Clients[Index];
+		if (Watcher->Used && Watcher->Ready && Watcher->Watcher && !Watcher->Closing)
+		{
+			uint8_t Reason = 0;
+			Sim_Deliver(Watcher, Present ? 9 : 8, PublicKey, 32, &Reason, Present ? 0 : sizeof(Reason)); // PeerPresent, PeerGone
+		}
+	}
+}
+
+// called with Mesh->Lock held
+static int Sim_MeshFindKey(Sim_Mesh* Mesh, const uint8_t PublicKey[32])
+{
+	for (uint32_t Index = 0; Index < Mesh->KeyCount; Index++)
+	{
+		if (memcmp(Mesh->Keys[Index], PublicKey, 32) == 0)
+		{
+			return (int)Index;
+		}
+	}
+	return -1;
+}
+
+// queues packet for other relay where target is present, returns false if target is not known to any of them
+static bool Sim_MeshForward(const uint8_t Source[32], const uint8_t Target[32], const uint8_t* Data, uint32_t Size)
+{
+	for (uint32_t MeshIndex = 0; MeshIndex < Sim.MeshCount; MeshIndex++)
+	{
+		Sim_Mesh* Mesh = &Sim.Mesh[MeshIndex];
+
+		AcquireSRWLockExclusive(&Mesh->Lock);
+		if (!Mesh->Connected || Sim_MeshFindKey(Mesh, Target) < 0)
+		{
+			ReleaseSRWLockExclusive(&Mesh->Lock);
+			continue;
+		}
+
+		Sim_Frame* Frame = malloc(sizeof(*Frame) + 64 + Size);
+		if (Frame)
+		{
+			uint64_t Now = Sim_GetTime();
+
+			Frame->Next = NULL;
+			Frame->Size = 64 + Size;
+			Frame->Data = (uint8_t*)(Frame + 1);
+			memcpy(Frame->Data, Source, 32);
+			memcpy(Frame->Data + 32, Target, 32);
+			memcpy(Frame->Data + 64, Data, Size);
+
+			// inter-relay link keeps order, same as TCP
+			Frame->Queued = Now;
+			Frame->Time = max(Now + Sim.MeshLatency * 1000ULL, Mesh->LastTime);
+			Mesh->LastTime = Frame->Time;
+
+			if (Mesh->Tail)
+			{
+				Mesh->Tail->Next = Frame;
+			}
+			else
+			{
+				Mesh->Head = Frame;
+			}
+			Mesh->Tail = Frame;
+		}
+		ReleaseSRWLockExclusive(&Mesh->Lock);
+		WakeConditionVariable(&Mesh->Wake);
+		return true;
+	}
+	return false;
+}
+
+// packets from mesh peer are delivered only locally, they are never forwarded again or answered with PeerGone
+static void Sim_Forward(Sim_Client* Client, const uint8_t Source[32], const uint8_t Target[32], const uint8_t* Data, uint32_t Size, bool FromMesh)
+{
+	AcquireSRWLockShared(&Sim.Lock);
+
+	Sim_Client* Peer = Sim_FindClient(Target);
+	if (Peer)
+	{
+		Sim_Deliver(Peer, 5, Source, 32, Data, Size); // RecvPacket
+	}
+	else if (!FromMesh && !Sim_MeshForward(Source, Target, Data, Size))
+	{
+		uint8_t Reason = 0;
+		Sim_Deliver(Client, 8, Target, 32, &Reason, sizeof(Reason)); // PeerGone
+	}
+
+	ReleaseSRWLockShared(&Sim.Lock);
+}
+
+static DWORD WINAPI Sim_WriterThread(LPVOID Arg)
+{
+	Sim_Client* Client = Arg;
+
+	AcquireSRWLockExclusive(&Client->Lock);
+	for (;;)
+	{
+		if (Client->Closing)
+		{
+			break;
+		}
+
+		Sim_Frame* Frame = Client->Head;
+		if (Frame == NULL)
+		{
+			SleepConditionVariableSRW(&Client->Wake, &Client->Lock, INFINITE, 0);
+			continue;
+		}
+
+		uint64_t Now = Sim_GetTime();
+		if (Frame->Time > Now)
+		{
+			DWORD Wait = (DWORD)((Frame->Time - Now + 999) / 1000);
+			SleepConditionVariableSRW(&Client->Wake, &Client->Lock, Wait, 0);
+			continue;
+		}
+
+		Client->Head = Frame->Next;
+		if (Client->Head == NULL)
+		{
+			Client->Tail = NULL;
+		}
+		Client->Count--;
+		ReleaseSRWLockExclusive(&Client->Lock);
+
+		bool Ok = Sim_SendAll(Client->Socket, Frame->Data, Frame->Size);
+
+		InterlockedAdd64(&Client->BytesOut, Frame->Size);
+		InterlockedIncrement64(&Client->FramesOut);
+		Sim_AtomicMax(&Client->MaxDelay, (LONG64)(Now - Frame->Queued));
+		free(Frame);
+
+		if (!Ok)
+		{
+			shutdown(Client->Socket, SD_BOTH);
+			return 0;
+		}
+
+		AcquireSRWLockExclusive(&Client->Lock);
+	}
+	ReleaseSRWLockExclusive(&Client->Lock);
+
+	return 0;
+}
+
+// waits until token bucket allows to read more from client
+static void Sim_RateLimit(Sim_Client* Client, uint32_t Size)
+{
+	uint64_t Now = Sim_GetTime();
+
+	double Settings[SIM_SETTING_COUNT];
+	Sim_GetSettings(Now, Settings);
+
+	double Rate = Settings[SIM_RATE_LIMIT] * 1000.0 / 8.0 / 1000000.0; // bytes per usec
+	if (Rate == 0)
+	{
+		Client->Tokens = Settings[SIM_BURST];
+		Client->TokenTime = Now;
+		return;
+	}
+
+	Client->Tokens = min(Client->Tokens + (Now - Client->TokenTime) * Rate, Settings[SIM_BURST]);
+	Client->TokenTime = Now;
+	Client->Tokens -= Size;
+
+	if (Client->Tokens < 0)
+	{
+		Sleep((DWORD)(-Client->Tokens / Rate / 1000.0) + 1);
+	}
+}
+
+static bool Sim_Handshake(Sim_Client* Client, uint8_t* Buffer)
+{
+	// HTTP upgrade request, with fast start there is no HTTP response
+	uint32_t RequestSize = 0;
+	for (;;)
+	{
+		if (RequestSize == 4096 || !Sim_RecvAll(Client->Socket, Buffer + RequestSize, 1))
+		{
+			return false;
+		}
+		RequestSize++;
+
+		if (RequestSize >= 4 && memcmp(Buffer + RequestSize - 4, "\r\n\r\n", 4) == 0)
+		{
+			break;
+		}
+	}
+
+	if (RequestSize < 10 || memcmp(Buffer, "GET /derp ", 10) != 0)
+	{
+		return false;
+	}
+
+	// ServerKey
+	{
+		static const uint8_t DerpMagic[8] = { 0x44, 0x45, 0x52, 0x50, 0xf0, 0x9f, 0x94, 0x91 };
+
+		uint8_t Frame[1 + 4 + 8 + 32];
+		Frame[0] = 1;
+		Set32BE(Frame + 1, 8 + 32);
+		memcpy(Frame + 1 + 4, DerpMagic, sizeof(DerpMagic));
+		memcpy(Frame + 1 + 4 + 8, Sim.PublicKey, sizeof(Sim.PublicKey));
+
+		if (!Sim_SendAll(Client->Socket, Frame, sizeof(Frame)))
+		{
+			return false;
+		}
+	}
+
+	// ClientInfo, contents are not needed
+	{
+		uint8_t Header[1 + 4];
+		if (!Sim_RecvAll(Client->Socket, Header, sizeof(Header)))
+		{
+			return false;
+		}
+
+		uint32_t Size = Get32BE(Header + 1);
+		if (Header[0] != 2 || Size < 32 + 24 + 16 || Size > SIM_MAX_FRAME || !Sim_RecvAll(Client->Socket, Buffer, Size))
+		{
+			return false;
+		}
+	}
+
+	// ServerInfo
+	{
+		static const char ServerInfo[] = "{}";
+
+		uint8_t Frame[1 + 4 + 24 + 16 + sizeof(ServerInfo) - 1];
+		Frame[0] = 3;
+		Set32BE(Frame + 1, (uint32_t)sizeof(Frame) - (1 + 4));
+		DerpNet__BoxSeal(Frame + 1 + 4, Frame + 1 + 4 + 24, Frame + 1 + 4 + 24 + 16, (const uint8_t*)ServerInfo, sizeof(ServerInfo) - 1, Sim.PrivateKey, Buffer);
+
+		if (!Sim_SendAll(Client->Socket, Frame, sizeof(Frame)))
+		{
+			return false;
+		}
+	}
+
+	// newer connection with same key replaces older one, like real relay does
+	AcquireSRWLockExclusive(&Sim.Lock);
+	{
+		Sim_Client* Older = Sim_FindClient(Buffer);
+		if (Older)
+		{
+			shutdown(Older->Socket, SD_BOTH);
+		}
+
+		memcpy(Client->PublicKey, Buffer, sizeof(Client->PublicKey));
+		Client->Ready = true;
+		Sim_NotifyWatchers(Client->PublicKey, true);
+	}
+	ReleaseSRWLockExclusive(&Sim.Lock);
+
+	return true;
+}
+
+static DWORD WINAPI Sim_ReaderThread(LPVOID Arg)
+{
+	Sim_Client* Client = Arg;
+
+	uint8_t* Buffer = malloc(SIM_MAX_FRAME);
+	if (Buffer && Sim_Handshake(Client, Buffer))
+	{
+		printf("client %u connected\n", Client->Index);
+
+		Client->Writer = CreateThread(NULL, 0, &Sim_WriterThread, Client, 0, NULL);
+		Client->TokenTime = Sim_GetTime();
+
+		for (;;)
+		{
+			uint8_t Header[1 + 4];
+			if (!Sim_RecvAll(Client->Socket, Header, sizeof(Header)))
+			{
+				break;
+			}
+
+			uint8_t FrameType = Header[0];
+			uint32_t Size = Get32BE(Header + 1);
+			if (Size > SIM_MAX_FRAME || !Sim_RecvAll(Client->Socket, Buffer, Size))
+			{
+				break;
+			}
+
+			InterlockedAdd64(&Client->BytesIn, sizeof(Header) + Size);
+			Sim_RateLimit(Client, (uint32_t)sizeof(Header) + Size);
+
+			if (FrameType == 4 && Size >= 32) // SendPacket
+			{
+				Sim_Forward(Client, Client->PublicKey, Buffer, Buffer + 32, Size - 32, false);
+			}
+			else if (FrameType == 0x0a && Size >= 64) // ForwardPacket
+			{
+				Sim_Forward(Client, Buffer, Buffer + 32, Buffer + 64, Size - 64, true);
+			}
+			else if (FrameType == 0x10) // WatchConns
+			{
+				AcquireSRWLockExclusive(&Sim.Lock);
+				Client->Watcher = true;
+				for (uint32_t Index = 0; Index < SIM_MAX_CLIENTS; Index++)
+				{
+					Sim_Client* Other = &Sim.Clients[Index];
+					if (Other != Client && Other->Used && Other->Ready && !Other->Closing)
+					{
+						Sim_Deliver(Client, 9, Other->PublicKey, 32, NULL, 0); // PeerPresent
+					}
+				}
+				ReleaseSRWLockExclusive(&Sim.Lock);
+			}
+			else if (FrameType == 0x12 && Size == 8) // Ping
+			{
+				AcquireSRWLockShared(&Sim.Lock);
+				Sim_Deliver(Client, 0x13, Buffer, Size, NULL, 0); // Pong
+				ReleaseSRWLockShared(&Sim.Lock);
+			}
+		}
+
+		printf("client %u disconnected\n", Client->Index);
+	}
+
+	AcquireSRWLockExclusive(&Client->Lock);
+	Client->Closing = true;
+	ReleaseSRWLockExclusive(&Client->Lock);
+	WakeConditionVariable(&Client->Wake);
+
+	// key stays present when newer connection has replaced this one
+	AcquireSRWLockShared(&Sim.Lock);
+	if (Client->Ready && Sim_FindClient(Client->PublicKey) == NULL)
+	{
+		Sim_NotifyWatchers(Client->PublicKey, false);
+	}
+	ReleaseSRWLockShared(&Sim.Lock);
+
+	if (Client->Writer)
+	{
+		WaitForSingleObject(Client->Writer, INFINITE);
+		CloseHandle(Client->Writer);
+	}
+
+	closesocket(Client->Socket);
+	free(Buffer);
+
+	AcquireSRWLockExclusive(&Sim.Lock);
+	{
+		while (Client->Head)
+		{
+			Sim_Frame* Frame = Client->Head;
+			Client->Head = Frame->Next;
+			free(Frame);
+		}
+		CloseHandle(Client->Reader);
+		Client->Used = false;
+	}
+	ReleaseSRWLockExclusive(&Sim.Lock);
+
+	return 0;
+}
+
+// disconnect steps happen once, readers of closed connections clean up after them
+static void Sim_Disconnect(uint64_t Time)
+{
+	for (uint32_t StepIndex = 0; StepIndex < Sim.StepCount; StepIndex++)
+	{
+		Sim_Step* Step = &Sim.Steps[StepIndex];
+		if (Step->Setting != SIM_DISCONNECT || Step->Done || Step->Value == 0 || (uint64_t)Step->Time * 1000 > Time)
+		{
+			continue;
+		}
+		Step->Done = true;
+
+		AcquireSRWLockShared(&Sim.Lock);
+		for (uint32_t Index = 0; Index < SIM_MAX_CLIENTS; Index++)
+		{
+			Sim_Client* Client = &Sim.Clients[Index];
+			if (Client->Used && Client->Ready && !Client->Watcher && !Client->Closing)
+			{
+				printf("closing client %u\n", Client->Index);
+				shutdown(Client->Socket, SD_BOTH);
+			}
+		}
+		ReleaseSRWLockShared(&Sim.Lock);
+	}
+}
+
+static void Sim_Accept(SOCKET Socket)
+{
+	BOOL NoDelay = TRUE;
+	setsockopt(Socket, IPPROTO_TCP, TCP_NODELAY, (const char*)&NoDelay, sizeof(NoDelay));
+
+	AcquireSRWLockExclusive(&Sim.Lock);
+
+	Sim_Client* Client = NULL;
+	for (uint32_t Index = 0; Index < SIM_MAX_CLIENTS; Index++)
+	{
+		if (!Sim.Clients[Index].Used)
+		{
+			Client = &Sim.Clients[Index];
+			break;
+		}
+	}
+
+	if (Client)
+	{
+		uint32_t Index = Sim.NextIndex++;
+
+		ZeroMemory(Client, sizeof(*Client));
+		Client->Used = true;
+		Client->Socket = Socket;
+		Client->Index = Index;
+		Client->Random = Sim.Seed ^ (Index * 0xd1b54a32d192ed03ULL);
+		InitializeSRWLock(&Client->Lock);
+		InitializeConditionVariable(&Client->Wake);
+		Client->Reader = CreateThread(NULL, 0, &Sim_ReaderThread, Client, 0, NULL);
+	}
+	else
+	{
+		closesocket(Socket);
+	}
+
+	ReleaseSRWLockExclusive(&Sim.Lock);
+}
+
+//
+// mesh
+//
+
+static void Sim_MeshPeer(const DerpKey* PeerKey, bool Present, void* UserData)
+{
+	Sim_Mesh* Mesh = UserData;
+
+	AcquireSRWLockExclusive(&Mesh->Lock);
+	int Index = Sim_MeshFindKey(Mesh, PeerKey->Bytes);
+	if (Present && Index < 0 && Mesh->KeyCount < SIM_MAX_CLIENTS)
+	{
+		memcpy(Mesh->Keys[Mesh->KeyCount++], PeerKey->Bytes, 32);
+	}
+	else if (!Present && Index >= 0)
+	{
+		memcpy(Mesh->Keys[Index], Mesh->Keys[--Mesh->KeyCount], 32);
+	}
+	ReleaseSRWLockExclusive(&Mesh->Lock);
+}
+
+static DWORD WINAPI Sim_MeshWriter(LPVOID Arg)
+{
+	Sim_Mesh* Mesh = Arg;
+
+	AcquireSRWLockExclusive(&Mesh->Lock);
+	for (;;)
+	{
+		Sim_Frame* Frame = Mesh->Head;
+		if (Frame == NULL)
+		{
+			SleepConditionVariableSRW(&Mesh->Wake, &Mesh->Lock, INFINITE, 0);
+			continue;
+		}
+
+		uint64_t Now = Sim_GetTime();
+		if (Frame->Time > Now)
+		{
+			DWORD Wait = (DWORD)((Frame->Time - Now + 999) / 1000);
+			SleepConditionVariableSRW(&Mesh->Wake, &Mesh->Lock, Wait, 0);
+			continue;
+		}
+
+		Mesh->Head = Frame->Next;
+		if (Mesh->Head == NULL)
+		{
+			Mesh->Tail = NULL;
+		}
+		ReleaseSRWLockExclusive(&Mesh->Lock);
+
+		// Reader clears Connected before it closes connection, which it does only while holding SendLock
+		AcquireSRWLockExclusive(&Mesh->SendLock);
+		AcquireSRWLockShared(&Mesh->Lock);
+		bool Connected = Mesh->Connected;
+		ReleaseSRWLockShared(&Mesh->Lock);
+
+		if (Connected)
+		{
+			DerpNet_ForwardPacket(&Mesh->Net, (const DerpKey*)Frame->Data, (const DerpKey*)(Frame->Data + 32), Frame->Data + 64, Frame->Size - 64);
+		}
+		ReleaseSRWLockExclusive(&Mesh->SendLock);
+
+		InterlockedAdd64(&Mesh->BytesOut, Frame->Size);
+		InterlockedIncrement64(&Mesh->FramesOut);
+		free(Frame);
+
+		AcquireSRWLockExclusive(&Mesh->Lock);
+	}
+}
+
+static DWORD WINAPI Sim_MeshReader(LPVOID Arg)
+{
+	Sim_Mesh* Mesh = Arg;
+
+	static const char* Addresses[] = { "127.0.0.1" };
+
+	DerpKey PrivateKey;
+	DerpNet_CreateNewKey(&PrivateKey);
+
+	Mesh->Net.PeerCallback = &Sim_MeshPeer;
+	Mesh->Net.PeerUserData = Mesh;
+
+	for (;;)
+	{
+		// other relay may not be started yet
+		AcquireSRWLockExclusive(&Mesh->SendLock);
+		bool Opened = DerpNet_OpenEx(&Mesh->Net, Addresses[0], Mesh->Port, Addresses, 1, &PrivateKey);
+		bool Ok = Opened && DerpNet_WatchConns(&Mesh->Net);
+		ReleaseSRWLockExclusive(&Mesh->SendLock);
+
+		if (Ok)
+		{
+			printf("mesh peer on port %u connected\n", Mesh->Port);
+
+			AcquireSRWLockExclusive(&Mesh->Lock);
+			Mesh->Connected = true;
+			ReleaseSRWLockExclusive(&Mesh->Lock);
+
+			// presence updates arrive through Sim_MeshPeer, packets sent to mesh key itself are ignored
+			DerpKey Key;
+			uint8_t* Data;
+			uint32_t Size;
+			while (DerpNet_Recv(&Mesh->Net, &Key, &Data, &Size, true) >= 0)
+			{
+			}
+
+			printf("mesh peer on port %u disconnected\n", Mesh->Port);
+		}
+
+		AcquireSRWLockExclusive(&Mesh->Lock);
+		Mesh->Connected = false;
+		Mesh->KeyCount = 0;
+		while (Mesh->Head)
+		{
+			Sim_Frame* Frame = Mesh->Head;
+			Mesh->Head = Frame->Next;
+			free(Frame);
+		}
+		Mesh->Tail = NULL;
+		ReleaseSRWLockExclusive(&Mesh->Lock);
+
+		if (Opened)
+		{
+			AcquireSRWLockExclusive(&Mesh->SendLock);
+			DerpNet_Close(&Mesh->Net);
+			ReleaseSRWLockExclusive(&Mesh->SendLock);
+		}
+
+		Sleep(SIM_MESH_RETRY);
+	}
+}
+
+static void Sim_StartMesh(uint16_t Port)
+{
+	Sim_Mesh* Mesh = &Sim.Mesh[Sim.MeshCount++];
+
+	Mesh->Port = Port;
+	InitializeSRWLock(&Mesh->SendLock);
+	InitializeSRWLock(&Mesh->Lock);
+	InitializeConditionVariable(&Mesh->Wake);
+	Mesh->Writer = CreateThread(NULL, 0, &Sim_MeshWriter, Mesh, 0, NULL);
+	Mesh->Reader = CreateThread(NULL, 0, &Sim_MeshReader, Mesh, 0, NULL);
+}
+
+static void Sim_Report(FILE* Csv)
+{
+	uint64_t Time = Sim_GetTime() / 1000;
+
+	AcquireSRWLockShared(&Sim.Lock);
+	for (uint32_t Index = 0; Index < SIM_MAX_CLIENTS; Index++)
+	{
+		Sim_Client* Client = &Sim.Clients[Index];
+		if (!Client->Used || !Client->Ready)
+		{
+			continue;
+		}
+
+		LONG64 BytesIn = InterlockedExchange64(&Client->BytesIn, 0);
+		LONG64 BytesOut = InterlockedExchange64(&Client->BytesOut, 0);
+		LONG64 FramesOut = InterlockedExchange64(&Client->FramesOut, 0);
+		LONG64 Drops = InterlockedExchange64(&Client->Drops, 0);
+		LONG64 Stalls = InterlockedExchange64(&Client->Stalls, 0);
+		LONG64 MaxDelay = InterlockedExchange64(&Client->MaxDelay, 0);
+
+		char Key[9];
+		snprintf(Key, sizeof(Key), "%02x%02x%02x%02x", Client->PublicKey[0], Client->PublicKey[1], Client->PublicKey[2], Client->PublicKey[3]);
+
+		printf("%8llu ms  client %u (%s): in %.f KB/s, out %.f KB/s, %lld frames, %lld dropped, %lld stalls, max delay %lld ms\n",
+			Time, Client->Index, Key, BytesIn / 1024.0, BytesOut / 1024.0, FramesOut, Drops, Stalls, MaxDelay / 1000);
+
+		if (Csv)
+		{
+			fprintf(Csv, "%llu,%u,%s,%lld,%lld,%lld,%lld,%lld,%lld\n", Time, Client->Index, Key, BytesIn, BytesOut, FramesOut, Drops, Stalls, MaxDelay / 1000);
+			fflush(Csv);
+		}
+	}
+	ReleaseSRWLockShared(&Sim.Lock);
+
+	for (uint32_t Index = 0; Index < Sim.MeshCount; Index++)
+	{
+		Sim_Mesh* Mesh = &Sim.Mesh[Index];
+
+		AcquireSRWLockShared(&Mesh->Lock);
+		bool Connected = Mesh->Connected;
+		uint32_t KeyCount = Mesh->KeyCount;
+		ReleaseSRWLockShared(&Mesh->Lock);
+
+		LONG64 BytesOut = InterlockedExchange64(&Mesh->BytesOut, 0);
+		LONG64 FramesOut = InterlockedExchange64(&Mesh->FramesOut, 0);
+
+		printf("%8llu ms  mesh %u: %s, %u peers, out %.f KB/s, %lld frames\n",
+			Time, Mesh->Port, Connected ? "connected" : "connecting", KeyCount, BytesOut / 1024.0, FramesOut);
+	}
+}
+
+int main(int ArgCount, char** Args)
+{
+	uint16_t Port = SIM_DEFAULT_PORT;
+	const char* CsvPath = NULL;
+	uint16_t MeshPorts[SIM_MAX_MESH];
+	uint32_t MeshCount = 0;
+	Sim.Seed = 1;
+
+	for (int ArgIndex = 1; ArgIndex < ArgCount; ArgIndex++)
+	{
+		const char* Arg = Args[ArgIndex];
+		const char* Value = ArgIndex + 1 < ArgCount ? Args[ArgIndex + 1] : NULL;
+
+		if (Value && strcmp(Arg, "-port") == 0)
+		{
+			Port = (uint16_t)atoi(Value);
+		}
+		else if (Value && strcmp(Arg, "-profile") == 0)
+		{
+			if (!Sim_LoadProfile(Value))
+			{
+				return 1;
+			}
+		}
+		else if (Value && strcmp(Arg, "-seed") == 0)
+		{
+			Sim.Seed = _strtoui64(Value, NULL, 10);
+		}
+		else if (Value && strcmp(Arg, "-csv") == 0)
+		{
+			CsvPath = Value;
+		}
+		else if (Value && strcmp(Arg, "-mesh") == 0 && MeshCount < SIM_MAX_MESH)
+		{
+			MeshPorts[MeshCount++] = (uint16_t)atoi(Value);
+		}
+		else if (Value && strcmp(Arg, "-meshlatency") == 0)
+		{
+			Sim.MeshLatency = (uint32_t)atoi(Value);
+		}
+		else
+		{
+			fprintf(stderr, "usage: %s [-port 80] [-profile file.txt] [-seed 1] [-csv metrics.csv] [-mesh port ...] [-meshlatency msec]\n", Args[0]);
+			return 1;
+		}
+		ArgIndex++;
+	}
+
+	FILE* Csv = NULL;
+	if (CsvPath)
+	{
+		Csv = fopen(CsvPath, "w");
+		if (Csv == NULL)
+		{
+			fprintf(stderr, "cannot create '%s'\n", CsvPath);
+			return 1;
+		}
+		fprintf(Csv, "time,client,key,bytes_in,bytes_out,frames_out,drops,stalls,max_delay_ms\n");
+	}
+
+	// sleeps & condition variable timeouts need 1 msec resolution for latency & bandwidth simulation
+	timeBeginPeriod(1);
+
+	WSADATA SocketData;
+	if (WSAStartup(MAKEWORD(2, 2), &SocketData) != 0)
+	{
+		return 1;
+	}
+
+	LARGE_INTEGER Freq, Start;
+	QueryPerformanceFrequency(&Freq);
+	QueryPerformanceCounter(&Start);
+	Sim.Freq = Freq.QuadPart;
+	Sim.Start = Start.QuadPart;
+	InitializeSRWLock(&Sim.Lock);
+
+	DerpKey PrivateKey, PublicKey;
+	DerpNet_CreateNewKey(&PrivateKey);
+	DerpNet_GetPublicKey(&PrivateKey, &PublicKey);
+	memcpy(Sim.PrivateKey, PrivateKey.Bytes, sizeof(Sim.PrivateKey));
+	memcpy(Sim.PublicKey, PublicKey.Bytes, sizeof(Sim.PublicKey));
+
+	// before any client can connect, mesh peers are read without lock
+	for (uint32_t Index = 0; Index < MeshCount; Index++)
+	{
+		Sim_StartMesh(MeshPorts[Index]);
+	}
+
+	SOCKET Listen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	SOCKADDR_IN Address = { .sin_family = AF_INET, .sin_port = htons(Port) };
+	Address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (Listen == INVALID_SOCKET || bind(Listen, (SOCKADDR*)&Address, sizeof(Address)) != 0 || listen(Listen, SOMAXCONN) != 0)
+	{
+		fprintf(stderr, "cannot listen on port %u\n", Port);
+		return 1;
+	}
+
+	printf("DerpSim listening on 127.0.0.1:%u, seed %llu, %u profile steps, %u mesh peers with %u ms latency\n",
+		Port, Sim.Seed, Sim.StepCount, Sim.MeshCount, Sim.MeshLatency);
+
+	uint64_t ReportTime = 0;
+	for (;;)
+	{
+		fd_set ReadSet;
+		FD_ZERO(&ReadSet);
+		FD_SET(Listen, &ReadSet);
+
+		struct timeval TimeVal = { 0, 100 * 1000 };
+		if (select(0, &ReadSet, NULL, NULL, &TimeVal) > 0)
+		{
+			SOCKET Socket = accept(Listen, NULL, NULL);
+			if (Socket != INVALID_SOCKET)
+			{
+				Sim_Accept(Socket);
+			}
+		}
+
+		Sim_Disconnect(Sim_GetTime());
+
+		uint64_t Now = Sim_GetTime() / 1000;
+		if (Now - ReportTime >= SIM_REPORT_INTERVAL)
+		{
+			Sim_Report(Csv);
+			ReportTime = Now;
+		}
+	}
+}
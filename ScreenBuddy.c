@@ -8,6 +8,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <limits.h>
+#include <math.h>
 
 #include <initguid.h>
 
@@ -19,11 +20,20 @@
 #	define HR(hr) do { HRESULT _hr = (hr); } while (0)
 #endif
 
+#ifndef DERPNET_USE_PLAIN_HTTP
 #define DERPNET_USE_PLAIN_HTTP 0
+#endif
 #define DERPNET_STATIC
 #include "external/derpnet.h"
 #include "external/wcap_screen_capture.h"
-#include "external/WindowsJson.h"
+#include "external/JsonStream.h"
+#include "external/DerpMap.h"
+#include "external/H264Parse.h"
+#include "external/PixelKernels.h"
+#include "external/TileHash.h"
+#include "external/TileOverlay.h"
+#include "external/ScrollDetect.h"
+#include "external/ViewSize.h"
 
 #include <d3d11_4.h>
 #include <dxgi1_2.h>
@@ -41,6 +51,8 @@
 #include <shellapi.h>
 #include <commdlg.h>
 #include <shlwapi.h>
+#include <iphlpapi.h>
+#include <mstcpip.h>
 
 #include "ScreenBuddyVS.h"
 #include "ScreenBuddyPS.h"
@@ -58,6 +70,8 @@
 #pragma comment (lib, "d3d11")
 #pragma comment (lib, "pathcch")
 #pragma comment (lib, "shlwapi")
+#pragma comment (lib, "shell32")
+#pragma comment (lib, "iphlpapi")
 #pragma comment (lib, "OneCore")
 #pragma comment (lib, "CoreMessaging")
 
@@ -80,20 +94,112 @@ enum
 	BUDDY_ENCODE_FRAMERATE	= 30,
 	BUDDY_ENCODE_BITRATE	= 4 * 1000 * 1000,
 	BUDDY_ENCODE_QUEUE_SIZE = 8,
-
-	// DerpMap limits
-	BUDDY_MAX_REGION_COUNT = 256,
-	BUDDY_MAX_HOST_LENGTH  = 128,
+	BUDDY_ENCODE_CHUNK_SIZE	= 65000,	// bytes per DERP packet, including header
+	BUDDY_ENCODE_CHUNKS		= 32,		// DERP packets sealed together
+	BUDDY_DECODE_MAX_FRAME	= 64 << 20,	// bytes, larger frame size in BUDDY_PACKET_VIDEO header is treated as corrupted
+
+	// first packet viewer sends over DERP, sharer answers other versions with BUDDY_PACKET_VERSION & ignores them
+	BUDDY_PROTOCOL_VERSION	= 1,
+
+	// region probing
+	BUDDY_PROBE_TIMEOUT			= 2000,			// msec, for DNS, connect & ping
+	BUDDY_PROBE_TCP_SAMPLES		= 5,
+	BUDDY_PROBE_DERP_REGIONS	= 3,			// how many best regions by TCP connect time get DERP pings
+	BUDDY_PROBE_DERP_SAMPLES	= 5,
+	BUDDY_PROBE_RANKING_TTL		= 6 * 60 * 60,	// seconds
+
+	// direct UDP path
+	BUDDY_UDP_TICK				= 20,		// msec, timer for hole punching, keepalives & retransmit requests
+	BUDDY_UDP_PUNCH_TIMEOUT		= 10000,	// msec, how long to send pings to candidates before staying on DERP
+	BUDDY_UDP_PUNCH_INTERVAL	= 100,		// msec, between pings to all candidates
+	BUDDY_UDP_STUN_INTERVAL		= 500,		// msec, STUN request retry
+	BUDDY_UDP_KEEPALIVE			= 1000,		// msec
+	BUDDY_UDP_PATH_TIMEOUT		= 3000,		// msec, if nothing arrives from peer, switch back to DERP
+	BUDDY_UDP_NACK_INTERVAL		= 40,		// msec, between retransmit requests for same frame
+	BUDDY_UDP_FRAME_TIMEOUT		= 500,		// msec, frame that cannot be completed is skipped
+	BUDDY_UDP_MAX_CANDIDATES	= 16,
+	BUDDY_UDP_FRAGMENT_SIZE		= 1200,		// video bytes per datagram, fits in common MTU with all headers
+	BUDDY_UDP_MAX_FRAGMENTS		= 1024,		// larger frames are sent over DERP
+	BUDDY_UDP_MAX_PAYLOAD		= 1 + 12 + BUDDY_UDP_FRAGMENT_SIZE,
+	BUDDY_UDP_HISTORY			= 16,		// frames kept for retransmits on sender, and for reassembly on receiver
+	BUDDY_UDP_MAGIC				= 0xb5,		// first byte of datagram, STUN messages always start with 0 or 1
+
+	// session migration to another DERP region
+	BUDDY_NET_TICK					= 250,		// msec, timer for keepalives & migration
+	BUDDY_NET_KEEPALIVE				= 1000,		// msec, between keepalive packets over DERP
+	BUDDY_NET_TIMEOUT				= 5000,		// msec, if nothing arrives from peer over DERP, relay is considered broken, NetTimeout in config
+	BUDDY_MIGRATE_REGION_TIMEOUT	= 5000,		// msec, how long to wait for peer in each failover region
+	BUDDY_MIGRATE_RESEND			= 500,		// msec, between migration announcements in new region
+	BUDDY_MIGRATE_RETRY				= 1000,		// msec, before reconnecting again to same region if connection failed
+	BUDDY_MAX_FAILOVER_REGIONS		= 4,
+
+	// network I/O thread
+	BUDDY_NET_RING_SIZE				= 16,		// received packets waiting for UI thread, power of 2
+
+	// relay striping
+	BUDDY_MAX_STRIPES				= 4,		// relay connections per session, including main one
+	BUDDY_STRIPE_HEADER				= 1 + 4 + 1,	// packet type, sequence number, flags
+	BUDDY_STRIPE_FRAME_START		= 1,		// flag for first chunk of frame
+	BUDDY_STRIPE_REORDER			= 64,		// chunks buffered on receiver while waiting for missing one, power of 2
+	BUDDY_STRIPE_GAP_TIMEOUT		= 500,		// msec, missing chunk is skipped after this
+	BUDDY_STRIPE_RETRY				= 5000,		// msec, before opening failed extra connection again
+
+	// video pacing over DERP
+	BUDDY_PACE_RATE_FACTOR			= 4,		// minimum pacing rate, times encoder bitrate
+	BUDDY_PACE_BURST				= 2 * BUDDY_ENCODE_CHUNK_SIZE,	// bytes, sent at once after idle period
+	BUDDY_PACE_QUEUE_SIZE			= 8,		// frames, when full everything is sent without waiting
+
+	// keyframe recovery
+	BUDDY_KEYFRAME_RETRY			= 1000,		// msec, viewer asks again if keyframe did not arrive
+	BUDDY_KEYFRAME_INTERVAL			= 500,		// msec, sharer forces requested keyframes at most this often
+	BUDDY_KEYFRAME_SOFT_QP			= 36,		// minimum QP until requested keyframe is out, with SoftKeyFrames=1
+
+	// encode size from viewer's window
+	BUDDY_VIEW_SETTLE				= 500,		// msec, window size must stay same before viewer reports it
+	BUDDY_VIEW_INTERVAL				= 2000,		// msec, sharer recreates encoder at most this often
+	BUDDY_VIEW_GROW					= 5,		// percent, encode width increases only when window is wider by more than this
+	BUDDY_VIEW_SHRINK				= 25,		// percent, encode width decreases only when window is narrower by more than this
+
+	// viewport streaming
+	BUDDY_THUMB_MAX_SIZE			= 256,		// pixels, thumbnail is largest mip level of captured frame that fits
+	BUDDY_THUMB_INTERVAL			= 1000,		// msec, between thumbnail updates
+	BUDDY_THUMB_COLOR_MASK			= 0xf0f0f0,	// color bits kept in thumbnail, so noise does not resend tiles
+	BUDDY_THUMB_HEADER				= 1 + 4 * 2,	// packet type, desktop size, thumbnail size
+	BUDDY_THUMB_RECORD				= 2 + 1 + 2,	// tile index, tile type, data size
+	BUDDY_THUMB_MARGIN				= 8,		// pixels, between minimap & window corner
+
+	// capture reconfiguration
+	BUDDY_CAPTURE_MAX_MONITORS		= 16,		// monitors cycled from sharer's dialog menu
+
+	// change detection
+	BUDDY_CHANGE_TILE				= TILEHASH_SIZE,	// pixels, width & height of hashed tile
+	BUDDY_CHANGE_MAX_RECTS			= 32,
+	BUDDY_CHANGE_SETTLE_FRAMES		= 30,		// frames still encoded after last change, so encoder refines quality of static image
+	BUDDY_CHANGE_ROI_AREA			= 25,		// percent of frame, smaller changed region is encoded with better quality
+	BUDDY_CHANGE_ROI_QP				= 4,		// QP decrease for changed region
+	BUDDY_CHANGE_AUTO				= 2,		// ChangeDetect default, on only when frames are read back for software conversion
+
+	// relay mesh
+	BUDDY_MESH_TIMEOUT				= 2000,		// msec, how long viewer waits for sharer through its own region before using sharer's region
 
 	// windows message notifications
 	BUDDY_WM_BEST_REGION = WM_USER + 1,
 	BUDDY_WM_MEDIA_EVENT = WM_USER + 2,
 	BUDDY_WM_NET_EVENT =   WM_USER + 3,
+	BUDDY_WM_NET_OPEN =    WM_USER + 4,
+	BUDDY_WM_UDP_EVENT =   WM_USER + 5,
+	BUDDY_WM_STRIPE_OPEN = WM_USER + 6,
+	BUDDY_WM_PACE_EVENT =  WM_USER + 7,
+	BUDDY_WM_CAPTURE_CLOSED = WM_USER + 8,
+	BUDDY_WM_FIRST_REGION = WM_USER + 9,
 
 	// timer ids
 	BUDDY_DISCONNECT_TIMER		= 111,
 	BUDDY_UPDATE_TITLE_TIMER	= 222,
 	BUDDY_FILE_TIMER			= 333,
+	BUDDY_UDP_TIMER				= 444,
+	BUDDY_NET_TIMER				= 555,
+	BUDDY_MESH_TIMER			= 666,
 
 	// dialog controls
 	BUDDY_ID_SHARE_ICON			= 100,
@@ -106,6 +212,11 @@ enum
 	BUDDY_ID_CONNECT_PASTE		= 220,
 	BUDDY_ID_CONNECT_BUTTON		= 230,
 
+	// system menus, low 4 bits must be zero
+	BUDDY_ID_VIEWPORT			= 0x100,	// viewer window
+	BUDDY_ID_CAPTURE_MONITOR	= 0x110,	// sharer dialog
+	BUDDY_ID_CAPTURE_WINDOW		= 0x120,
+
 	// dialog layout
 	BUDDY_DIALOG_PADDING		= 4,
 	BUDDY_DIALOG_ITEM_HEIGHT	= 14,
@@ -125,6 +236,27 @@ enum
 	BUDDY_PACKET_FILE_ACCEPT	= 6,
 	BUDDY_PACKET_FILE_REJECT	= 7,
 	BUDDY_PACKET_FILE_DATA		= 8,
+	BUDDY_PACKET_CANDIDATES		= 9,
+	BUDDY_PACKET_DIRECT_CLOSED	= 10,
+	BUDDY_PACKET_FAILOVER		= 11,
+	BUDDY_PACKET_KEEPALIVE		= 12,
+	BUDDY_PACKET_MIGRATE		= 13,
+	BUDDY_PACKET_MIGRATED		= 14,
+	BUDDY_PACKET_STRIPES		= 15,
+	BUDDY_PACKET_STRIPE			= 16,
+	BUDDY_PACKET_VERSION		= 17,
+	BUDDY_PACKET_LATENCY		= 18,
+	BUDDY_PACKET_KEYFRAME		= 19,
+	BUDDY_PACKET_VIEW_SIZE		= 20,
+	BUDDY_PACKET_VIEWPORT		= 21,
+	BUDDY_PACKET_THUMBNAIL		= 22,
+
+	// direct UDP datagrams, type is first byte of encrypted payload
+	BUDDY_UDP_PING				= 0,
+	BUDDY_UDP_PONG				= 1,
+	BUDDY_UDP_FRAGMENT			= 2,
+	BUDDY_UDP_NACK				= 3,
+	BUDDY_UDP_PACKET			= 4,
 };
 
 typedef enum
@@ -138,13 +270,174 @@ typedef enum
 }
 BuddyState;
 
+typedef struct
+{
+	wchar_t ETag[128];
+	wchar_t LastModified[64];
+	DerpMapRegion Regions[DERPMAP_MAX_REGION_COUNT];
+}
+Buddy_DerpMap;
+
+typedef struct
+{
+	uint32_t Region;
+	uint32_t Median; // usec
+	uint32_t Jitter; // usec
+	bool DerpVerified;
+}
+Buddy_RegionRank;
+
+typedef struct
+{
+	uint8_t* Data;
+	uint32_t Capacity;
+	uint32_t Id;
+	uint32_t Size;
+	uint32_t Count;		// fragments
+	uint32_t Received;
+	uint64_t Time;		// msec, when sent or when last fragment arrived
+	bool Active;
+	uint64_t Mask[BUDDY_UDP_MAX_FRAGMENTS / 64];
+}
+Buddy_UdpFrame;
+
+typedef struct
+{
+	IMFMediaBuffer* Buffer;
+	uint32_t Id;
+	uint32_t Size;
+	uint32_t Offset;	// bytes already sent
+	uint64_t Time;		// QPC, when frame came out of encoder
+	H264Info Info;
+}
+Buddy_PaceFrame;
+
+typedef enum
+{
+	BUDDY_NET_MESSAGE_PACKET,
+	BUDDY_NET_MESSAGE_PEER_GONE,
+	BUDDY_NET_MESSAGE_CLOSED,
+}
+Buddy_NetMessageType;
+
+typedef struct
+{
+	Buddy_NetMessageType Type;
+	DerpKey Key;
+	uint32_t Size;
+	uint8_t* Data;				// Buffer, or DerpNet receive buffer when UI thread receives itself
+	uint64_t Time;				// QueryPerformanceCounter when socket was signaled before packet was received
+	uint8_t Buffer[1 << 16];
+}
+Buddy_NetMessage;
+
+typedef struct
+{
+	DerpNet* Net;
+	HWND Window;
+	WPARAM Index;				// passed with BUDDY_WM_NET_EVENT, 0 for main connection
+	HANDLE Thread;
+	HANDLE StopEvent;
+	HANDLE SpaceEvent;			// ring has free slot
+	Buddy_NetMessage* Slots;
+	volatile LONG Write;		// written only by I/O thread
+	volatile LONG Read;			// written only by UI thread
+	volatile LONG Notified;		// BUDDY_WM_NET_EVENT is posted, but not handled yet
+	bool Held;					// UI thread is using message at Read
+	bool PeerGone;				// used only by receiving thread
+	DerpKey PeerGoneKey;		// used only by receiving thread
+	uint64_t SignalTime;		// QueryPerformanceCounter when socket was last signaled
+
+	// NetThread=0 from config, UI thread receives & decrypts itself same as before I/O thread existed
+	bool Inline;
+	bool InlinePending;			// packet in Slots[1] goes to UI thread after peer gone message in Slots[0]
+	PTP_WAIT Wait;
+
+	// reported as metrics by UI thread every second, in QueryPerformanceCounter ticks
+	uint64_t DelaySum;			// from socket signal until UI thread gets packet
+	uint64_t DelayMax;
+	uint32_t DelayCount;
+	uint64_t RecvTime;			// UI thread time spent getting packets
+}
+Buddy_NetRing;
+
+// extra relay connection that carries only video chunks
+typedef struct
+{
+	DerpNet Net;
+	Buddy_NetRing Ring;
+	DerpKey PrivateKey;
+	DerpKey PublicKey;
+	DerpKey RemoteKey;			// peer's connection with same index
+	uint32_t Region;
+	uint64_t RetryTime;			// msec
+	bool Opening;
+	bool Open;
+	bool RemoteOpen;
+}
+Buddy_Stripe;
+
+typedef struct
+{
+	bool Used;
+	uint32_t Seq;
+	uint32_t Size;
+	uint8_t Data[BUDDY_ENCODE_CHUNK_SIZE];
+}
+Buddy_StripeSlot;
+
+typedef struct
+{
+	uint32_t Width;
+	uint32_t Height;
+	uint32_t TilesX;
+	uint32_t TilesY;
+	uint32_t DirtyPitch;		// bitmap words per tile row
+	uint64_t* Hashes;			// tiles of previous frame
+	uint32_t* Dirty;			// one bit per tile
+	uint32_t* RowDirty;			// dirty tiles in each tile row
+	volatile LONG* RowDone;		// task flags
+	uint64_t Secret[TILEHASH_SECRET_COUNT];
+	bool Valid;					// Hashes are from previous frame
+	uint32_t DirtyCount;
+	RECT Bounds;
+	RECT Rects[BUDDY_CHANGE_MAX_RECTS];
+	uint32_t RectCount;
+	const uint8_t* Pixels;		// frame being processed
+	uint32_t Pitch;
+}
+Buddy_Changes;
+
+typedef struct
+{
+	ScrollDetect Detect;
+	uint32_t Count;				// scrolls found, since last stats update
+	volatile LONG* RowDone;		// task flags
+	ScrollChanges Changes;		// frame being processed
+	const uint8_t* Frame;
+	uint32_t FramePitch;
+}
+Buddy_Scroll;
+
 typedef struct
 {
 	wchar_t ConfigPath[BUDDY_CONFIG_MAXPATH];
+	wchar_t DerpMapPath[BUDDY_CONFIG_MAXPATH];
+	wchar_t DerpMapFile[BUDDY_CONFIG_MAXPATH];		// fixed DerpMap json instead of downloaded one, for local relays
+
+	// command line automation for sim\run.cmd
+	wchar_t AutoSharePath[MAX_PATH];	// -share, code is written here once sharing has started
+	wchar_t AutoConnectPath[MAX_PATH];	// -connect, code is read from here
+	HANDLE MetricsFile;					// -metrics, "time_ms,name,value" csv rows
+	uint64_t MetricsStart;
 	
 	// loaded from config
 	uint32_t DerpRegion;
-	wchar_t DerpRegions[BUDDY_MAX_REGION_COUNT][BUDDY_MAX_HOST_LENGTH];
+	bool DerpMesh;		// relays forward packets between regions, so viewer can use its own nearest region
+	Buddy_DerpMap DerpMap;
+	uint32_t DerpRankingCount;
+	Buddy_RegionRank DerpRanking[DERPMAP_MAX_REGION_COUNT];
+	uint64_t DerpRankingTime;
 	DerpKey MyPrivateKey;
 	DerpKey MyPublicKey;
 
@@ -164,8 +457,80 @@ typedef struct
 	// derp stuff
 	HANDLE DerpRegionThread;
 	DerpKey RemoteKey;
-	PTP_WAIT WaitCallback;
 	size_t LastReceived;
+	size_t LastRecords;		// TLS records & send calls of main connection at previous metrics
+	size_t LastSends;
+	uint32_t NetRegion;
+	uint32_t PeerRegion;	// region from share key
+	DerpKey NetPrivateKey;
+	bool NetOpening;
+	bool NetOpen;
+	bool NetPeerGone;		// server reported that remote peer is not connected to it
+	bool NetPeerKeepAlive;	// peer sends keepalives, so silence from it means broken relay
+	uint64_t NetRecvTime;	// msec, last packet from peer over DERP
+	uint64_t NetSendTime;	// msec, last keepalive
+	uint64_t NetLatencyTime;	// msec, when viewer sent last BUDDY_PACKET_LATENCY
+	uint32_t NetLatency;	// msec, round trip between peers through relays, 0 until first echo
+	uint32_t NetLatencyInterval;	// msec, from config, between BUDDY_PACKET_LATENCY probes
+	uint32_t NetTimeout;	// msec, from config, silence from peer before failover
+	bool NetCorking;		// from config, without it every message is sent in its own TLS record
+
+	// network I/O thread, receives & decrypts packets into ring that UI thread reads
+	bool NetThreadEnabled;		// from config
+	Buddy_NetRing NetRing;
+
+	// relay striping, video chunks are spread over extra connections to same region
+	uint32_t StripeCount;		// from config, total connections including main one
+	bool StripesStarted;
+	Buddy_Stripe* Stripes;		// StripeCount - 1 entries
+	uint32_t StripeSendSeq;
+	uint32_t StripeNext;		// round-robin position
+	bool StripeRecvStarted;
+	bool StripeResync;			// chunks are dropped until first chunk of next frame
+	uint32_t StripeRecvSeq;		// next chunk to deliver
+	uint32_t StripeBuffered;	// chunks waiting in reorder buffer
+	uint64_t StripeGapTime;		// msec, when chunk after missing one arrived, 0 if nothing is missing
+	Buddy_StripeSlot* StripeSlots;
+
+	// session migration
+	uint32_t FailoverCount;
+	uint8_t FailoverRegions[BUDDY_MAX_FAILOVER_REGIONS];
+	bool NetMigrating;
+	uint32_t MigrateIndex;
+	uint32_t MigrateFromRegion;
+	uint64_t MigrateDeadline;	// msec, when to give up on current region
+	uint64_t MigrateRetryTime;	// msec, when to reconnect to current region, 0 if not waiting
+	uint64_t MigrateSendTime;	// msec
+	uint64_t FailoverStart;		// QPC, for time to first frame after failover
+	bool FailoverWaitFrame;
+	uint32_t FailoverTime;		// msec, shown in window title
+
+	// direct UDP path
+	bool UdpLocalCandidates;	// from config, off to test public candidates through NAT simulator
+	bool UdpStarted;
+	bool UdpDirect;
+	SOCKET UdpSocket;
+	HANDLE UdpEvent;
+	PTP_WAIT UdpWaitCallback;
+	uint8_t UdpSharedKey[32];
+	uint8_t UdpSendPrefix[16];	// nonce prefix, kept with counter while shared key is same
+	uint64_t UdpSendCounter;
+	DerpNet_Replay UdpReplay;	// nonces of peer's datagrams
+	SOCKADDR_IN UdpPeer;
+	SOCKADDR_IN UdpStunServer;
+	uint8_t UdpStunTransaction[12];
+	uint32_t UdpLocalCount;
+	SOCKADDR_IN UdpLocal[BUDDY_UDP_MAX_CANDIDATES];
+	uint32_t UdpRemoteCount;
+	SOCKADDR_IN UdpRemote[BUDDY_UDP_MAX_CANDIDATES];
+	uint64_t UdpPunchTime;
+	uint64_t UdpStunTime;
+	uint64_t UdpPingTime;
+	uint64_t UdpRecvTime;
+	uint64_t UdpNackTime;
+	uint64_t UdpStallTime;
+	uint32_t UdpStallId;
+	Buddy_UdpFrame UdpFrames[BUDDY_UDP_HISTORY];
 
 	// graphics stuff
 	ID3D11Device* Device;
@@ -182,6 +547,29 @@ typedef struct
 	int OutputWidth;
 	int OutputHeight;
 
+	// software presentation, used when Converter is NULL on viewer
+	bool PresentSoftware;		// from config
+	int PresentFilter;			// from config
+	bool PresentReady;			// PresentFrame has decoded image
+	bool PresentDirty;			// PresentTexture needs update
+	ID3D11Texture2D* PresentReadback;	// NV12, staging
+	uint8_t* PresentFrame;				// NV12, rows padded for SIMD kernels
+	uint32_t PresentPitch;
+	ID3D11Texture2D* PresentTexture;	// BGRA, dynamic
+	ID3D11ShaderResourceView* PresentView;
+	uint32_t PresentWidth;
+	uint32_t PresentHeight;
+	PixelYuvMatrix PresentMatrix;
+	PixelScaleFilter PresentFilterX;
+	PixelScaleFilter PresentFilterY;
+	uint8_t* PresentRow;				// converted source row
+	int16_t* PresentRing;				// horizontally filtered source rows
+	const int16_t** PresentRows;		// vertical filter input
+	uint8_t* PresentOutput;				// output row
+	Pixel_YuvToBgraProc* PresentYuvToBgra;
+	Pixel_ScaleRowProc* PresentScaleRow;
+	Pixel_ScaleColumnsProc* PresentScaleColumns;
+
 	// media stuff
 	IMFTransform* Converter;
 	IMFTransform* Codec;
@@ -196,9 +584,121 @@ typedef struct
 	uint32_t EncodeQueueRead;
 	uint32_t EncodeQueueWrite;
 	IMFVideoSampleAllocatorEx* EncodeSampleAllocator;
+	uint32_t EncodeFrameId;
+	uint32_t EncodeWidth;		// smaller than captured frame when viewer's window is smaller
+	uint32_t EncodeHeight;
+	RECT EncodeCrop;			// part of captured frame that is encoded, whole frame unless viewport is active
+
+	// software color conversion, used when Converter is NULL
+	bool ConvertSoftware;		// from config
+	bool ConvertBt709;			// from config
+	bool ConvertFullRange;		// from config
+	PixelColorMatrix ConvertMatrix;
+	Pixel_ConvertRowsProc* ConvertRows;
+	ID3D11Texture2D* ConvertUpload;		// NV12, staging
+	PixelScaleFilter ConvertFilterX;	// only when encode size is smaller than captured frame
+	PixelScaleFilter ConvertFilterY;
+	int16_t* ConvertRing;				// horizontally filtered source rows
+	const int16_t** ConvertRingRows;	// vertical filter input
+	uint8_t* ConvertScaled;				// BGRA, in encode size
+	uint32_t ConvertScaledPitch;
+	Pixel_ScaleRowProc* ConvertScaleRow;
+	Pixel_ScaleColumnsProc* ConvertScaleColumns;
+
+	// captured frame in memory, for software conversion & change detection
+	ID3D11Texture2D* CaptureReadback;	// BGRA, staging
+
+	// change detection
+	uint32_t ChangeConfig;		// from config, 0, 1 or BUDDY_CHANGE_AUTO
+	bool ChangeDetect;			// for current encoder, decided by ChangeConfig & converter
+	bool ChangeRoi;				// encoder accepts ROI rectangle on input samples
+	Buddy_Changes Changes;
+	uint32_t ChangeStatic;		// frames without changes
+	uint32_t ChangeSkipped;		// static frames not encoded, since last stats update
+
+	// scroll detection, used with change detection
+	bool ScrollDetect;			// from config
+	Buddy_Scroll Scroll;
+
+	// lossless overlay on sharer, used with change detection
+	bool OverlayEnabled;		// from config
+	OverlaySharer OverlayTiles;
+
+	// lossless overlay on viewer
+	OverlayLayer OverlayLayer;
+	ID3D11Texture2D* OverlayTexture;	// BGRA, copied over decoded frame, only with Converter
+
+	// video pacing
+	bool PaceEnabled;			// from config
+	Buddy_PaceFrame PaceQueue[BUDDY_PACE_QUEUE_SIZE];
+	uint32_t PaceRead;
+	uint32_t PaceWrite;
+	uint64_t PaceQueued;		// bytes not sent yet
+	uint64_t PaceRate;			// bytes per second
+	int64_t PaceTokens;			// bytes, negative after chunk larger than remaining tokens
+	uint64_t PaceTime;			// QPC, last refill
+	HANDLE PaceTimer;
+	PTP_WAIT PaceWait;
+	uint64_t PaceStatsTime;		// msec
+	uint64_t PaceStatsBytes;	// since last stats update
+	uint64_t PaceMaxBurst;		// bytes written to relay at once, since last stats update
+	uint32_t PaceMaxDelay;		// msec, from encoder output to last chunk sent, since last stats update
+	uint32_t PaceDropped;		// frames, since last stats update
+
+	// keyframe recovery
+	bool KeySoft;				// from config, requested keyframes are coarse & refined by next frames, instead of one large burst
+	bool KeySoftActive;			// encoder minimum QP is raised until keyframe comes out
+	bool KeyPending;			// sharer got request while rate limited
+	uint64_t KeyForceTime;		// msec, last forced keyframe
+	bool KeyWaiting;			// viewer drops frames until keyframe arrives
+	bool KeyMeasure;			// recovery time is measured when keyframe is decoded
+	uint64_t KeyRequestTime;	// msec, last request sent
+	uint64_t KeyLossTime;		// QPC, when frames were lost, 0 at start of connection
+	uint32_t KeyRecoverTime;	// msec, from loss to decoded keyframe, shown in window title
+
+	// encode size from viewer's window
+	bool ViewScale;				// from config
+	uint32_t ViewWidth;			// viewer: last reported size, sharer: last received size, 0 if not known
+	uint32_t ViewHeight;
+	uint32_t ViewNextWidth;		// viewer, window size waiting to settle
+	uint32_t ViewNextHeight;
+	uint64_t ViewChangeTime;	// msec, viewer: when window size changed, sharer: when encoder was recreated
+
+	// viewport streaming
+	bool ViewZoom;				// only part of desktop is streamed at native resolution
+	uint16_t ViewCenterX;		// viewport center, in 1/65536 of desktop size
+	uint16_t ViewCenterY;
+	uint32_t ViewZoomWidth;		// sharer, requested viewport size
+	uint32_t ViewZoomHeight;
+	bool ViewRefresh;			// sharer, moved viewport waits for frame rate limit
+	bool ViewDrag;				// viewer, panning with mouse in minimap
+	uint32_t ThumbWidth;
+	uint32_t ThumbHeight;
+	uint32_t ThumbLevel;		// sharer, mip level of captured frame
+	ID3D11Texture2D* ThumbMips;			// sharer, BGRA, captured frame with mip chain
+	ID3D11ShaderResourceView* ThumbMipsView;
+	ID3D11Texture2D* ThumbReadback;		// sharer, BGRA, staging
+	bool ThumbCurrent;			// sharer, first mip level has latest captured frame inside EncodeCrop, rest is from last thumbnail
+	uint32_t* ThumbHashes;		// sharer, per tile, 0 if not sent
+	uint8_t* ThumbPacket;		// sharer
+	uint64_t ThumbTime;			// sharer, msec, last thumbnail update
+	uint32_t DesktopWidth;		// viewer, from thumbnail
+	uint32_t DesktopHeight;
+	uint8_t* ThumbPixels;		// viewer, BGRA, decoded thumbnail
+	uint8_t* ThumbFrame;		// viewer, BGRA, thumbnail with viewport rectangle
+	bool ThumbDirty;			// viewer, texture needs update
+	ID3D11Texture2D* ThumbTexture;
+	ID3D11ShaderResourceView* ThumbView;
+
+	// capture reconfiguration
+	uint64_t DecodeFrameTime;	// QPC, viewer, last decoded frame, 0 before first one
+	bool FormatMeasure;			// viewer, decoder switched to new size, gap is measured on its first frame
+	uint32_t FormatGapTime;		// msec, from last frame of old size to first frame of new one, shown in window title, written once as format_ms
 
 	// decoder stuff
 	uint32_t DecodeInputExpected;
+	uint32_t DecodeInputFrameId;
+	uint32_t DecodeFrameId;	// next frame to decode, older frames are dropped
 	IMFMediaBuffer* DecodeInputBuffer;
 	IMFSample* DecodeOutputSample;
 
@@ -223,1837 +723,7431 @@ Buddy_MousePacket;
 
 //
 
-static size_t Buddy_DownloadDerpMap(HINTERNET HttpSession, uint8_t* Buffer, size_t BufferMaxSize)
+typedef struct
 {
-	size_t BufferSize = 0;
-
-	HINTERNET HttpConnection = WinHttpConnect(HttpSession, L"login.tailscale.com", INTERNET_DEFAULT_HTTPS_PORT, 0);
-	if (HttpConnection)
-	{
-		HINTERNET HttpRequest = WinHttpOpenRequest(HttpConnection, L"GET", L"/derpmap/default", NULL, NULL, NULL, WINHTTP_FLAG_SECURE);
-		if (HttpRequest)
-		{
-			if (WinHttpSendRequest(HttpRequest, WINHTTP_NO_ADDITIONAL_HEADERS, 0, WINHTTP_NO_REQUEST_DATA, 0, 0, 0) && WinHttpReceiveResponse(HttpRequest, NULL))
-			{
-				DWORD Status = 0;
-				DWORD StatusSize = sizeof(Status);
-
-				WinHttpQueryHeaders(
-					HttpRequest,
-					WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
-					WINHTTP_HEADER_NAME_BY_INDEX,
-					&Status,
-					&StatusSize,
-					WINHTTP_NO_HEADER_INDEX);
-
-				if (Status == HTTP_STATUS_OK)
-				{
-					while (BufferSize < BufferMaxSize)
-					{
-						DWORD Read;
-						if (!WinHttpReadData(HttpRequest, Buffer + BufferSize, (DWORD)(BufferMaxSize - BufferSize), &Read) || Read == 0)
-						{
-							break;
-						}
-						BufferSize += Read;
-					}
-				}
-			}
-			WinHttpCloseHandle(HttpRequest);
-		}
-		WinHttpCloseHandle(HttpConnection);
-	}
+	ScreenBuddy* Buddy;
+	Buddy_DerpMap DerpMap;
+	uint32_t RankingCount;
+	Buddy_RegionRank Ranking[DERPMAP_MAX_REGION_COUNT];
+
+	SOCKADDR_STORAGE Addresses[DERPMAP_MAX_REGION_COUNT];
+	int AddressLengths[DERPMAP_MAX_REGION_COUNT];
+	uint32_t TcpSampleCount[DERPMAP_MAX_REGION_COUNT];
+	uint32_t TcpSamples[DERPMAP_MAX_REGION_COUNT][BUDDY_PROBE_TCP_SAMPLES];
+	DerpNet Net;
 
-	return BufferSize;
+	// without region yet, first region that accepts connection is posted with BUDDY_WM_FIRST_REGION
+	bool FirstRun;
+	bool FirstPosted;
+
+	// msec since start, when each step finished
+	uint64_t StartTime;
+	uint32_t FirstTime;
+	uint32_t MapTime;
+	uint32_t ResolveTime;
+	uint32_t TcpTime;
+	uint32_t DerpTime;
 }
+Buddy_RegionProbe;
 
-static DWORD CALLBACK Buddy_GetBestDerpRegionThread(LPVOID Arg)
+static uint64_t Buddy_GetUnixTime(void)
 {
-	ScreenBuddy* Buddy = Arg;
-
-	uint8_t Buffer[64 * 1024];
-	size_t BufferSize = Buddy_DownloadDerpMap(Buddy->HttpSession, Buffer, sizeof(Buffer));
+	FILETIME Time;
+	GetSystemTimeAsFileTime(&Time);
+	return ((((uint64_t)Time.dwHighDateTime << 32) | Time.dwLowDateTime) - 116444736000000000ULL) / 10000000;
+}
 
-	JsonObject* Json = BufferSize ? JsonObject_Parse((char*)Buffer, (int)BufferSize) : NULL;
-	JsonObject* Regions = JsonObject_GetObject(Json, JsonCSTR("Regions"));
-	JsonIterator* Iterator = JsonObject_GetIterator(Regions);
-	if (Iterator)
+static void Buddy_GetSampleStats(uint32_t* Samples, uint32_t Count, uint32_t* Median, uint32_t* Jitter)
+{
+	// insertion sort, there are only few samples
+	for (uint32_t Index = 1; Index < Count; Index++)
 	{
-		do
+		uint32_t Value = Samples[Index];
+		uint32_t Insert = Index;
+		while (Insert > 0 && Samples[Insert - 1] > Value)
 		{
-			JsonObject* Region = JsonIterator_GetValue(Iterator);
-			uint32_t RegionId = (uint32_t)JsonObject_GetNumber(Region, JsonCSTR("RegionID"));
-			if (RegionId < BUDDY_MAX_REGION_COUNT)
-			{
-				JsonArray* Nodes = JsonObject_GetArray(Region, JsonCSTR("Nodes"));
-				JsonObject* Node = JsonArray_GetObject(Nodes, 0);
-				HSTRING NodeHost = JsonObject_GetString(Node, JsonCSTR("HostName"));
-				if (NodeHost)
-				{
-					LPCWSTR HostName = WindowsGetStringRawBuffer(NodeHost, NULL);
-					lstrcpynW(Buddy->DerpRegions[RegionId], HostName, ARRAYSIZE(Buddy->DerpRegions[RegionId]));
-					WindowsDeleteString(NodeHost);
-				}
-				JsonRelease(Node);
-				JsonRelease(Nodes);
-			}
-			JsonRelease(Region);
+			Samples[Insert] = Samples[Insert - 1];
+			Insert--;
 		}
-		while (JsonIterator_Next(Iterator));
-		JsonRelease(Iterator);
+		Samples[Insert] = Value;
 	}
-	JsonRelease(Regions);
-	JsonRelease(Json);
-
-	ADDRINFOEXW AddressHints =
-	{
-		.ai_family = AF_UNSPEC,
-		.ai_socktype = SOCK_STREAM,
-		.ai_protocol = IPPROTO_TCP,
-	};
-
-	// resolve all hostnames
-	PADDRINFOEXW Addresses[BUDDY_MAX_REGION_COUNT] = { 0 };
-	for (size_t RegionIndex = 0; RegionIndex != BUDDY_MAX_REGION_COUNT; RegionIndex++)
-	{
-		if (Buddy->DerpRegions[RegionIndex][0] == 0)
-		{
-			continue;
-		}
 
-		GetAddrInfoExW(Buddy->DerpRegions[RegionIndex], L"443", NS_ALL, NULL, &AddressHints, &Addresses[RegionIndex], NULL, NULL, NULL, NULL);
-	}
+	uint32_t Middle = Count % 2 ? Samples[Count / 2] : (Samples[Count / 2 - 1] + Samples[Count / 2]) / 2;
 
-	// create nonblocking sockets
-	SOCKET Sockets[BUDDY_MAX_REGION_COUNT] = { 0 };
-	for (size_t RegionIndex = 0; RegionIndex != BUDDY_MAX_REGION_COUNT; RegionIndex++)
+	// jitter is mean absolute deviation from median
+	uint64_t Deviation = 0;
+	for (uint32_t Index = 0; Index < Count; Index++)
 	{
-		PADDRINFOEXW Address = Addresses[RegionIndex];
-		if (Address == NULL)
-		{
-			continue;
-		}
-
-		SOCKET Socket = socket(Address->ai_family, Address->ai_socktype, Address->ai_protocol);
-		Assert(Socket != INVALID_SOCKET);
-
-		u_long NonBlocking = 1;
-		int NonBlockingOk = ioctlsocket(Socket, FIONBIO, &NonBlocking);
-		Assert(NonBlockingOk == 0);
-
-		Sockets[RegionIndex] = Socket;
+		Deviation += Samples[Index] > Middle ? Samples[Index] - Middle : Middle - Samples[Index];
 	}
 
-	uint32_t BestRegion = 0;
-
-	// start connections
-	for (size_t RegionIndex = 0; RegionIndex != BUDDY_MAX_REGION_COUNT; RegionIndex++)
-	{
-		SOCKET Socket = Sockets[RegionIndex];
-		if (Socket == 0)
-		{
-			continue;
-		}
-
-		PADDRINFOEXW Address = Addresses[RegionIndex];
-		int Connected = connect(Socket, Address->ai_addr, (int)Address->ai_addrlen);
-		if (Connected == 0)
-		{
-			BestRegion = (uint32_t)RegionIndex;
-			break;
-		}
-		else if (Connected == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK)
-		{
-			// pending
-		}
-		else
-		{
-			Sockets[RegionIndex] = 0;
-			closesocket(Socket);
-		}
-	}
+	*Median = Middle;
+	*Jitter = (uint32_t)(Deviation / Count);
+}
 
-	// wait for first connnection to finish
-	if (BestRegion == 0)
+static void Buddy_SortRanking(Buddy_RegionRank* Ranking, uint32_t Count)
+{
+	// regions that answered DERP ping go first, then ordered by median + jitter
+	for (uint32_t Index = 1; Index < Count; Index++)
 	{
-		uint32_t PollRegion[BUDDY_MAX_REGION_COUNT];
-		WSAPOLLFD Poll[BUDDY_MAX_REGION_COUNT];
-		ULONG PollCount = 0;
-		for (size_t RegionIndex = 0; RegionIndex != BUDDY_MAX_REGION_COUNT; RegionIndex++)
-		{
-			if (Sockets[RegionIndex] != 0)
-			{
-				Poll[PollCount].fd = Sockets[RegionIndex];
-				Poll[PollCount].events = POLLOUT;
-				PollRegion[PollCount] = (uint32_t)RegionIndex;
-				PollCount++;
-			}
-		}
+		Buddy_RegionRank Rank = Ranking[Index];
+		uint64_t Score = (uint64_t)Rank.Median + Rank.Jitter;
 
-		if (PollCount && WSAPoll(Poll, PollCount, INFINITE) > 0)
+		uint32_t Insert = Index;
+		while (Insert > 0)
 		{
-			for (size_t Index = 0; Index != BUDDY_MAX_REGION_COUNT; Index++)
+			Buddy_RegionRank* Other = &Ranking[Insert - 1];
+			uint64_t OtherScore = (uint64_t)Other->Median + Other->Jitter;
+			if (Other->DerpVerified > Rank.DerpVerified || (Other->DerpVerified == Rank.DerpVerified && OtherScore <= Score))
 			{
-				if (Poll[Index].revents & POLLOUT)
-				{
-					BestRegion = (uint32_t)PollRegion[Index];
-					break;
-				}
+				break;
 			}
+			Ranking[Insert] = *Other;
+			Insert--;
 		}
+		Ranking[Insert] = Rank;
 	}
+}
 
-	// done!
-	for (size_t RegionIndex = 0; RegionIndex != BUDDY_MAX_REGION_COUNT; RegionIndex++)
+// returns first node that can be used as DERP relay
+static DerpMapNode* Buddy_GetDerpNode(DerpMapRegion* Region)
+{
+	for (uint32_t NodeIndex = 0; NodeIndex < Region->NodeCount; NodeIndex++)
 	{
-		if (Sockets[RegionIndex])
+		if (!Region->Nodes[NodeIndex].StunOnly)
 		{
-			closesocket(Sockets[RegionIndex]);
-		}
-		if (Addresses[RegionIndex])
-		{
-			FreeAddrInfoExW(Addresses[RegionIndex]);
+			return &Region->Nodes[NodeIndex];
 		}
 	}
-
-	PostMessageW(Buddy->DialogWindow, BUDDY_WM_BEST_REGION, BestRegion, 0);
-
-	return 0;
+	return NULL;
 }
 
-static void Buddy_LoadConfig(ScreenBuddy* Buddy)
+// prefers IPv4 address, as IPv6 is often not routable
+static bool Buddy_GetNodeAddress(DerpMapNode* Node, SOCKADDR_STORAGE* Address, int* AddressLength)
 {
-	DWORD ExePathOk = GetModuleFileNameW(NULL, Buddy->ConfigPath, ARRAYSIZE(Buddy->ConfigPath));
-	Assert(ExePathOk != 0);
-
-	HR(PathCchRenameExtension(Buddy->ConfigPath, ARRAYSIZE(Buddy->ConfigPath), L".ini"));
-
-	Buddy->DerpRegion = GetPrivateProfileIntW(BUDDY_CONFIG, L"DerpRegion", 0, Buddy->ConfigPath);
+	ZeroMemory(Address, sizeof(*Address));
 
-	for (int RegionIndex = 0; RegionIndex < BUDDY_MAX_REGION_COUNT; RegionIndex++)
+	if (Node->HasIPv4)
 	{
-		wchar_t DerpRegionName[128];
-		StrFormat(DerpRegionName, L"DerpRegion%d", RegionIndex);
-
-		GetPrivateProfileStringW(BUDDY_CONFIG, DerpRegionName, L"", Buddy->DerpRegions[RegionIndex], ARRAYSIZE(Buddy->DerpRegions[RegionIndex]), Buddy->ConfigPath);
+		SOCKADDR_IN* Address4 = (SOCKADDR_IN*)Address;
+		Address4->sin_family = AF_INET;
+		Address4->sin_port = htons(Node->DerpPort);
+		CopyMemory(&Address4->sin_addr, Node->IPv4, sizeof(Node->IPv4));
+		*AddressLength = sizeof(*Address4);
+		return true;
 	}
-
-	wchar_t EncryptedText[2048];
-	DWORD EncryptedTextLen = GetPrivateProfileStringW(BUDDY_CONFIG, L"DerpPrivateKey", L"", EncryptedText, ARRAYSIZE(EncryptedText), Buddy->ConfigPath);
-
-	bool PrivateKeyValid = false;
-	if (EncryptedTextLen)
+	else if (Node->HasIPv6)
 	{
-		uint8_t EncryptedBlob[1024];
-		for (size_t i = 0; i < EncryptedTextLen; i += 2)
-		{
-			swscanf(EncryptedText + i, L"%02hhx", &EncryptedBlob[i/2]);
-		}
-
-		DATA_BLOB BlobInput = { EncryptedTextLen, EncryptedBlob };
-		DATA_BLOB BlobOutput;
-		BOOL Decrypted = CryptUnprotectData(&BlobInput, NULL, NULL, NULL, NULL, CRYPTPROTECT_UI_FORBIDDEN, &BlobOutput);
-
-		if (Decrypted && BlobOutput.cbData == sizeof(Buddy->MyPrivateKey))
-		{
-			CopyMemory(&Buddy->MyPrivateKey, BlobOutput.pbData, BlobOutput.cbData);
-			PrivateKeyValid = true;
-		}
-
-		LocalFree(BlobOutput.pbData);
+		SOCKADDR_IN6* Address6 = (SOCKADDR_IN6*)Address;
+		Address6->sin6_family = AF_INET6;
+		Address6->sin6_port = htons(Node->DerpPort);
+		CopyMemory(&Address6->sin6_addr, Node->IPv6, sizeof(Node->IPv6));
+		*AddressLength = sizeof(*Address6);
+		return true;
 	}
+	return false;
+}
 
-	if (!PrivateKeyValid)
+// formats addresses as text for DerpNet_OpenEx
+static size_t Buddy_GetNodeAddressList(DerpMapNode* Node, char Addresses[2][64])
+{
+	size_t Count = 0;
+	if (Node->HasIPv6)
 	{
-		DerpNet_CreateNewKey(&Buddy->MyPrivateKey);
+		InetNtopA(AF_INET6, Node->IPv6, Addresses[Count++], 64);
 	}
-
-	DerpNet_GetPublicKey(&Buddy->MyPrivateKey, &Buddy->MyPublicKey);
+	if (Node->HasIPv4)
+	{
+		InetNtopA(AF_INET, Node->IPv4, Addresses[Count++], 64);
+	}
+	return Count;
 }
 
 //
 
-static void CALLBACK Buddy_WaitCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Context, PTP_WAIT Wait, TP_WAIT_RESULT WaitResult)
-{
-	ScreenBuddy* Buddy = Context;
-	PostMessageW(Buddy->DialogWindow, BUDDY_WM_NET_EVENT, 0, 0);
-}
+// DerpMap cache file, all numbers are little endian:
+//   "SBDM" magic, u8 version
+//   u8 length + ETag, u8 length + Last-Modified (ASCII)
+//   u16 region count, for each region:
+//     u8 region id, u8 node count, for each node:
+//       u8 flags, u8 length + hostname (UTF-8), u8[4] IPv4 & u8[16] IPv6 when present in flags, u16 DERP port, u16 STUN port
 
-static void Buddy_NextWait(ScreenBuddy* Buddy)
-{
-	SetThreadpoolWait(Buddy->WaitCallback, Buddy->Net.SocketEvent, NULL);
-}
+#define BUDDY_DERPMAP_MAGIC "SBDM"
 
-static void Buddy_StartWait(ScreenBuddy* Buddy)
+enum
 {
-	Buddy->WaitCallback = CreateThreadpoolWait(&Buddy_WaitCallback, Buddy, NULL);
-	Assert(Buddy->WaitCallback);
-
-	Buddy_NextWait(Buddy);
-}
+	BUDDY_DERPMAP_VERSION		= 1,
+	BUDDY_DERPMAP_HAS_IPV4		= 1 << 0,
+	BUDDY_DERPMAP_HAS_IPV6		= 1 << 1,
+	BUDDY_DERPMAP_STUN_ONLY		= 1 << 2,
+};
 
-static void Buddy_CancelWait(ScreenBuddy* Buddy)
+typedef struct
 {
-	SetThreadpoolWait(Buddy->WaitCallback, NULL, NULL);
-	WaitForThreadpoolWaitCallbacks(Buddy->WaitCallback, TRUE);
-	CloseThreadpoolWait(Buddy->WaitCallback);
+	const uint8_t* Data;
+	size_t Size;
+	bool Error;
 }
+Buddy_CacheReader;
 
-//
-
-static HRESULT STDMETHODCALLTYPE Buddy__QueryInterface(IMFAsyncCallback* This, REFIID Riid, void** Object)
+static const uint8_t* Buddy_CacheRead(Buddy_CacheReader* Reader, size_t Size)
 {
-	if (Object == NULL)
-	{
-		return E_POINTER;
-	}
-	if (IsEqualGUID(&IID_IUnknown, Riid) || IsEqualGUID(&IID_IMFAsyncCallback, Riid))
+	if (Reader->Error || Reader->Size < Size)
 	{
-		*Object = This;
-		return S_OK;
+		Reader->Error = true;
+		return NULL;
 	}
-	return E_NOINTERFACE;
-}
 
-static ULONG STDMETHODCALLTYPE Buddy__AddRef(IMFAsyncCallback* This)
-{
-	return 1;
+	const uint8_t* Result = Reader->Data;
+	Reader->Data += Size;
+	Reader->Size -= Size;
+	return Result;
 }
 
-static ULONG STDMETHODCALLTYPE Buddy__Release(IMFAsyncCallback* This)
+static uint32_t Buddy_CacheReadByte(Buddy_CacheReader* Reader)
 {
-	return 1;
+	const uint8_t* Data = Buddy_CacheRead(Reader, 1);
+	return Data ? Data[0] : 0;
 }
 
-static HRESULT STDMETHODCALLTYPE Buddy__GetParameters(IMFAsyncCallback* This, DWORD* Flags, DWORD* Queue)
+static uint32_t Buddy_CacheReadShort(Buddy_CacheReader* Reader)
 {
-	*Flags = 0;
-	*Queue = MFASYNC_CALLBACK_QUEUE_MULTITHREADED;
-	return S_OK;
+	const uint8_t* Data = Buddy_CacheRead(Reader, 2);
+	return Data ? Data[0] | (Data[1] << 8) : 0;
 }
 
-static HRESULT STDMETHODCALLTYPE Buddy__Invoke(IMFAsyncCallback* This, IMFAsyncResult* AsyncResult)
+static void Buddy_CacheReadString(Buddy_CacheReader* Reader, char* String, size_t StringSize)
 {
-	ScreenBuddy* Buddy = CONTAINING_RECORD(This, ScreenBuddy, EventCallback);
-
-	IMFMediaEvent* Event;
-	if (SUCCEEDED(IMFMediaEventGenerator_EndGetEvent(Buddy->Generator, AsyncResult, &Event)))
+	uint32_t Length = Buddy_CacheReadByte(Reader);
+	const uint8_t* Data = Buddy_CacheRead(Reader, Length);
+	if (Data == NULL || Length >= StringSize)
 	{
-		MediaEventType Type;
-		HR(IMFMediaEvent_GetType(Event, &Type));
-		IMFMediaEvent_Release(Event);
-
-		PostMessageW(Buddy->DialogWindow, BUDDY_WM_MEDIA_EVENT, (WPARAM)Type, 0);
+		Reader->Error = true;
+		String[0] = 0;
+		return;
 	}
-
-	return S_OK;
+	CopyMemory(String, Data, Length);
+	String[Length] = 0;
 }
 
-//
-
-static bool Buddy_CreateEncoder(ScreenBuddy* Buddy, int EncodeWidth, int EncodeHeight)
+static uint8_t* Buddy_CacheWriteString(uint8_t* Write, const char* String)
 {
-	MFT_REGISTER_TYPE_INFO Input = { .guidMajorType = MFMediaType_Video, .guidSubtype = MFVideoFormat_NV12 };
-	MFT_REGISTER_TYPE_INFO Output = { .guidMajorType = MFMediaType_Video, .guidSubtype = MFVideoFormat_H264 };
+	size_t Length = lstrlenA(String);
+	Assert(Length < 256);
 
-	DXGI_ADAPTER_DESC AdapterDesc;
+	*Write++ = (uint8_t)Length;
+	CopyMemory(Write, String, Length);
+	return Write + Length;
+}
+
+static bool Buddy_LoadDerpMap(Buddy_DerpMap* DerpMap, const wchar_t* Path)
+{
+	HANDLE File = CreateFileW(Path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (File == INVALID_HANDLE_VALUE)
 	{
-		IDXGIDevice* DxgiDevice;
-		HR(ID3D11Device_QueryInterface(Buddy->Device, &IID_IDXGIDevice, (void**)&DxgiDevice));
+		return false;
+	}
 
-		IDXGIAdapter* DxgiAdapter;
-		HR(IDXGIDevice_GetAdapter(DxgiDevice, &DxgiAdapter));
+	bool Result = false;
 
-		IDXGIAdapter_GetDesc(DxgiAdapter, &AdapterDesc);
+	LARGE_INTEGER FileSize;
+	if (GetFileSizeEx(File, &FileSize) && FileSize.QuadPart < 16 * 1024 * 1024)
+	{
+		uint8_t* Buffer = HeapAlloc(GetProcessHeap(), 0, FileSize.QuadPart + 1);
+		Assert(Buffer);
 
-		IDXGIAdapter_Release(DxgiAdapter);
-		IDXGIDevice_Release(DxgiDevice);
-	}
+		DWORD Read;
+		if (ReadFile(File, Buffer, (DWORD)FileSize.QuadPart, &Read, NULL) && Read == FileSize.QuadPart)
+		{
+			Buddy_CacheReader Reader = { Buffer, Read, false };
 
-	IMFAttributes* EnumAttributes;
-	HR(MFCreateAttributes(&EnumAttributes, 1));
-	HR(IMFAttributes_SetBlob(EnumAttributes, &MFT_ENUM_ADAPTER_LUID, (UINT8*)&AdapterDesc.AdapterLuid, sizeof(AdapterDesc.AdapterLuid)));
+			const uint8_t* Magic = Buddy_CacheRead(&Reader, 4);
+			uint32_t Version = Buddy_CacheReadByte(&Reader);
+			if (Magic && memcmp(Magic, BUDDY_DERPMAP_MAGIC, 4) == 0 && Version == BUDDY_DERPMAP_VERSION)
+			{
+				ZeroMemory(DerpMap, sizeof(*DerpMap));
 
-	IMFActivate** Activate;
-	UINT32 ActivateCount;
-	HR(MFTEnum2(MFT_CATEGORY_VIDEO_ENCODER, MFT_ENUM_FLAG_ASYNCMFT | MFT_ENUM_FLAG_HARDWARE | MFT_ENUM_FLAG_SORTANDFILTER, &Input, &Output, EnumAttributes, &Activate, &ActivateCount));
-	IMFAttributes_Release(EnumAttributes);
+				char Text[256];
+				Buddy_CacheReadString(&Reader, Text, sizeof(Text));
+				MultiByteToWideChar(CP_UTF8, 0, Text, -1, DerpMap->ETag, ARRAYSIZE(DerpMap->ETag));
+				Buddy_CacheReadString(&Reader, Text, sizeof(Text));
+				MultiByteToWideChar(CP_UTF8, 0, Text, -1, DerpMap->LastModified, ARRAYSIZE(DerpMap->LastModified));
 
-	if (ActivateCount == 0)
+				uint32_t RegionCount = Buddy_CacheReadShort(&Reader);
+				for (uint32_t Index = 0; Index < RegionCount && !Reader.Error; Index++)
+				{
+					DerpMapRegion* Region = &DerpMap->Regions[Buddy_CacheReadByte(&Reader)];
+					uint32_t NodeCount = Buddy_CacheReadByte(&Reader);
+
+					for (uint32_t NodeIndex = 0; NodeIndex < NodeCount && !Reader.Error; NodeIndex++)
+					{
+						DerpMapNode Node = { 0 };
+
+						uint32_t Flags = Buddy_CacheReadByte(&Reader);
+						Buddy_CacheReadString(&Reader, Node.HostName, sizeof(Node.HostName));
+						if (Flags & BUDDY_DERPMAP_HAS_IPV4)
+						{
+							const uint8_t* IPv4 = Buddy_CacheRead(&Reader, sizeof(Node.IPv4));
+							if (IPv4)
+							{
+								CopyMemory(Node.IPv4, IPv4, sizeof(Node.IPv4));
+								Node.HasIPv4 = true;
+							}
+						}
+						if (Flags & BUDDY_DERPMAP_HAS_IPV6)
+						{
+							const uint8_t* IPv6 = Buddy_CacheRead(&Reader, sizeof(Node.IPv6));
+							if (IPv6)
+							{
+								CopyMemory(Node.IPv6, IPv6, sizeof(Node.IPv6));
+								Node.HasIPv6 = true;
+							}
+						}
+						Node.StunOnly = (Flags & BUDDY_DERPMAP_STUN_ONLY) != 0;
+						Node.DerpPort = (uint16_t)Buddy_CacheReadShort(&Reader);
+						Node.StunPort = (uint16_t)Buddy_CacheReadShort(&Reader);
+						if (Node.DerpPort == 0)
+						{
+							// used for TCP probes & relay connections, parser never stores 0
+							Reader.Error = true;
+						}
+
+						if (Region->NodeCount < DERPMAP_MAX_NODE_COUNT)
+						{
+							Region->Nodes[Region->NodeCount++] = Node;
+						}
+					}
+				}
+
+				Result = !Reader.Error;
+				if (!Result)
+				{
+					ZeroMemory(DerpMap, sizeof(*DerpMap));
+				}
+			}
+		}
+
+		HeapFree(GetProcessHeap(), 0, Buffer);
+	}
+
+	CloseHandle(File);
+	return Result;
+}
+
+static void Buddy_SaveDerpMap(Buddy_DerpMap* DerpMap, const wchar_t* Path)
+{
+	size_t MaxNodeSize = 1 + 1 + DERPMAP_MAX_HOST_LENGTH + 4 + 16 + 2 + 2;
+	size_t MaxSize = 4 + 1 + 2 * 256 + 2 + DERPMAP_MAX_REGION_COUNT * (2 + DERPMAP_MAX_NODE_COUNT * MaxNodeSize);
+
+	uint8_t* Buffer = HeapAlloc(GetProcessHeap(), 0, MaxSize);
+	Assert(Buffer);
+
+	uint8_t* Write = Buffer;
+	CopyMemory(Write, BUDDY_DERPMAP_MAGIC, 4);
+	Write += 4;
+	*Write++ = BUDDY_DERPMAP_VERSION;
+
+	char Text[256];
+	WideCharToMultiByte(CP_UTF8, 0, DerpMap->ETag, -1, Text, sizeof(Text), NULL, NULL);
+	Write = Buddy_CacheWriteString(Write, Text);
+	WideCharToMultiByte(CP_UTF8, 0, DerpMap->LastModified, -1, Text, sizeof(Text), NULL, NULL);
+	Write = Buddy_CacheWriteString(Write, Text);
+
+	uint8_t* RegionCount = Write;
+	Write += 2;
+
+	uint32_t Count = 0;
+	for (uint32_t RegionIndex = 0; RegionIndex < DERPMAP_MAX_REGION_COUNT; RegionIndex++)
+	{
+		DerpMapRegion* Region = &DerpMap->Regions[RegionIndex];
+		if (Region->NodeCount == 0)
+		{
+			continue;
+		}
+
+		*Write++ = (uint8_t)RegionIndex;
+		*Write++ = (uint8_t)Region->NodeCount;
+		for (uint32_t NodeIndex = 0; NodeIndex < Region->NodeCount; NodeIndex++)
+		{
+			DerpMapNode* Node = &Region->Nodes[NodeIndex];
+
+			*Write++ = (uint8_t)((Node->HasIPv4 ? BUDDY_DERPMAP_HAS_IPV4 : 0) | (Node->HasIPv6 ? BUDDY_DERPMAP_HAS_IPV6 : 0) | (Node->StunOnly ? BUDDY_DERPMAP_STUN_ONLY : 0));
+			Write = Buddy_CacheWriteString(Write, Node->HostName);
+			if (Node->HasIPv4)
+			{
+				CopyMemory(Write, Node->IPv4, sizeof(Node->IPv4));
+				Write += sizeof(Node->IPv4);
+			}
+			if (Node->HasIPv6)
+			{
+				CopyMemory(Write, Node->IPv6, sizeof(Node->IPv6));
+				Write += sizeof(Node->IPv6);
+			}
+			*Write++ = (uint8_t)Node->DerpPort;
+			*Write++ = (uint8_t)(Node->DerpPort >> 8);
+			*Write++ = (uint8_t)Node->StunPort;
+			*Write++ = (uint8_t)(Node->StunPort >> 8);
+		}
+		Count++;
+	}
+	RegionCount[0] = (uint8_t)Count;
+	RegionCount[1] = (uint8_t)(Count >> 8);
+
+	Assert((size_t)(Write - Buffer) <= MaxSize);
+
+	// write to temporary file first, so partially written cache is never loaded
+	wchar_t TempPath[BUDDY_CONFIG_MAXPATH];
+	StrFormat(TempPath, L"%ls.tmp", Path);
+
+	HANDLE File = CreateFileW(TempPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (File != INVALID_HANDLE_VALUE)
+	{
+		DWORD Written;
+		BOOL WriteOk = WriteFile(File, Buffer, (DWORD)(Write - Buffer), &Written, NULL);
+		CloseHandle(File);
+
+		if (!WriteOk || !MoveFileExW(TempPath, Path, MOVEFILE_REPLACE_EXISTING))
+		{
+			DeleteFileW(TempPath);
+		}
+	}
+
+	HeapFree(GetProcessHeap(), 0, Buffer);
+}
+
+// conditional request with ETag & Last-Modified from cached DerpMap, which get updated on 200 OK response
+// returns HTTP status code or 0 on network error, Buffer is allocated only for 200 OK response
+static DWORD Buddy_DownloadDerpMap(HINTERNET HttpSession, Buddy_DerpMap* DerpMap, uint8_t** Buffer, size_t* BufferSize)
+{
+	DWORD Status = 0;
+	*Buffer = NULL;
+	*BufferSize = 0;
+
+	HINTERNET HttpConnection = WinHttpConnect(HttpSession, L"login.tailscale.com", INTERNET_DEFAULT_HTTPS_PORT, 0);
+	if (HttpConnection)
+	{
+		HINTERNET HttpRequest = WinHttpOpenRequest(HttpConnection, L"GET", L"/derpmap/default", NULL, NULL, NULL, WINHTTP_FLAG_SECURE);
+		if (HttpRequest)
+		{
+			wchar_t Headers[512];
+			int HeadersLength = 0;
+			if (DerpMap->ETag[0])
+			{
+				HeadersLength += _snwprintf(Headers + HeadersLength, ARRAYSIZE(Headers) - HeadersLength, L"If-None-Match: %ls\r\n", DerpMap->ETag);
+			}
+			if (DerpMap->LastModified[0])
+			{
+				HeadersLength += _snwprintf(Headers + HeadersLength, ARRAYSIZE(Headers) - HeadersLength, L"If-Modified-Since: %ls\r\n", DerpMap->LastModified);
+			}
+
+			if (WinHttpSendRequest(HttpRequest, HeadersLength ? Headers : WINHTTP_NO_ADDITIONAL_HEADERS, HeadersLength, WINHTTP_NO_REQUEST_DATA, 0, 0, 0) && WinHttpReceiveResponse(HttpRequest, NULL))
+			{
+				DWORD StatusSize = sizeof(Status);
+
+				WinHttpQueryHeaders(
+					HttpRequest,
+					WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
+					WINHTTP_HEADER_NAME_BY_INDEX,
+					&Status,
+					&StatusSize,
+					WINHTTP_NO_HEADER_INDEX);
+
+				if (Status == HTTP_STATUS_OK)
+				{
+					DWORD ETagSize = sizeof(DerpMap->ETag);
+					if (!WinHttpQueryHeaders(HttpRequest, WINHTTP_QUERY_ETAG, WINHTTP_HEADER_NAME_BY_INDEX, DerpMap->ETag, &ETagSize, WINHTTP_NO_HEADER_INDEX))
+					{
+						DerpMap->ETag[0] = 0;
+					}
+
+					DWORD LastModifiedSize = sizeof(DerpMap->LastModified);
+					if (!WinHttpQueryHeaders(HttpRequest, WINHTTP_QUERY_LAST_MODIFIED, WINHTTP_HEADER_NAME_BY_INDEX, DerpMap->LastModified, &LastModifiedSize, WINHTTP_NO_HEADER_INDEX))
+					{
+						DerpMap->LastModified[0] = 0;
+					}
+
+					size_t Size = 0;
+					size_t MaxSize = 64 * 1024;
+					uint8_t* Data = HeapAlloc(GetProcessHeap(), 0, MaxSize);
+					Assert(Data);
+
+					for (;;)
+					{
+						if (Size == MaxSize)
+						{
+							MaxSize *= 2;
+							Data = HeapReAlloc(GetProcessHeap(), 0, Data, MaxSize);
+							Assert(Data);
+						}
+
+						DWORD Read;
+						if (!WinHttpReadData(HttpRequest, Data + Size, (DWORD)(MaxSize - Size), &Read))
+						{
+							HeapFree(GetProcessHeap(), 0, Data);
+							Data = NULL;
+							Size = 0;
+							Status = 0;
+							break;
+						}
+						if (Read == 0)
+						{
+							break;
+						}
+						Size += Read;
+					}
+
+					*Buffer = Data;
+					*BufferSize = Size;
+				}
+			}
+			WinHttpCloseHandle(HttpRequest);
+		}
+		WinHttpCloseHandle(HttpConnection);
+	}
+
+	return Status;
+}
+
+static bool Buddy_ParseDerpMap(Buddy_DerpMap* DerpMap, uint8_t* Buffer, size_t BufferSize)
+{
+	// regions are extracted into separate buffer, so older regions are kept if downloaded JSON is broken
+	DerpMapRegion* Regions = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(DerpMap->Regions));
+	Assert(Regions);
+
+	bool Result = DerpMap_Parse(Regions, (const char*)Buffer, BufferSize);
+	if (Result)
+	{
+		CopyMemory(DerpMap->Regions, Regions, sizeof(DerpMap->Regions));
+	}
+
+	HeapFree(GetProcessHeap(), 0, Regions);
+	return Result;
+}
+
+static void Buddy_ResolveRegions(Buddy_RegionProbe* Probe)
+{
+	ADDRINFOEXW AddressHints =
+	{
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_STREAM,
+		.ai_protocol = IPPROTO_TCP,
+	};
+
+	PADDRINFOEXW Lookups[DERPMAP_MAX_REGION_COUNT] = { 0 };
+	OVERLAPPED Overlapped[DERPMAP_MAX_REGION_COUNT] = { 0 };
+	HANDLE CancelHandle[DERPMAP_MAX_REGION_COUNT];
+
+	// DNS is needed only for nodes without addresses in DerpMap, start all queries at the same time
+	for (size_t RegionIndex = 0; RegionIndex != DERPMAP_MAX_REGION_COUNT; RegionIndex++)
+	{
+		DerpMapNode* Node = Buddy_GetDerpNode(&Probe->DerpMap.Regions[RegionIndex]);
+		if (Node == NULL || Buddy_GetNodeAddress(Node, &Probe->Addresses[RegionIndex], &Probe->AddressLengths[RegionIndex]))
+		{
+			continue;
+		}
+
+		wchar_t HostName[DERPMAP_MAX_HOST_LENGTH];
+		MultiByteToWideChar(CP_UTF8, 0, Node->HostName, -1, HostName, ARRAYSIZE(HostName));
+
+		wchar_t Port[8];
+		StrFormat(Port, L"%u", Node->DerpPort);
+
+		Overlapped[RegionIndex].hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+		Assert(Overlapped[RegionIndex].hEvent);
+
+		INT Error = GetAddrInfoExW(HostName, Port, NS_ALL, NULL, &AddressHints, &Lookups[RegionIndex], NULL, &Overlapped[RegionIndex], NULL, &CancelHandle[RegionIndex]);
+		if (Error != WSA_IO_PENDING)
+		{
+			CloseHandle(Overlapped[RegionIndex].hEvent);
+			Overlapped[RegionIndex].hEvent = NULL;
+
+			if (Error != NO_ERROR)
+			{
+				Lookups[RegionIndex] = NULL;
+			}
+		}
+	}
+
+	// collect results, cancel whatever is not finished in time
+	uint64_t Deadline = GetTickCount64() + BUDDY_PROBE_TIMEOUT;
+	for (size_t RegionIndex = 0; RegionIndex != DERPMAP_MAX_REGION_COUNT; RegionIndex++)
+	{
+		HANDLE Event = Overlapped[RegionIndex].hEvent;
+		if (Event)
+		{
+			uint64_t Now = GetTickCount64();
+			DWORD Timeout = Now < Deadline ? (DWORD)(Deadline - Now) : 0;
+			if (WaitForSingleObject(Event, Timeout) != WAIT_OBJECT_0)
+			{
+				GetAddrInfoExCancel(&CancelHandle[RegionIndex]);
+				WaitForSingleObject(Event, INFINITE);
+			}
+
+			if (GetAddrInfoExOverlappedResult(&Overlapped[RegionIndex]) != NO_ERROR)
+			{
+				Lookups[RegionIndex] = NULL;
+			}
+			CloseHandle(Event);
+		}
+
+		PADDRINFOEXW Lookup = Lookups[RegionIndex];
+		if (Lookup)
+		{
+			Assert(Lookup->ai_addrlen <= sizeof(Probe->Addresses[RegionIndex]));
+			CopyMemory(&Probe->Addresses[RegionIndex], Lookup->ai_addr, Lookup->ai_addrlen);
+			Probe->AddressLengths[RegionIndex] = (int)Lookup->ai_addrlen;
+			FreeAddrInfoExW(Lookup);
+		}
+	}
+}
+
+static void Buddy_ProbeTcpRound(Buddy_RegionProbe* Probe, uint64_t Freq)
+{
+	SOCKET Sockets[DERPMAP_MAX_REGION_COUNT];
+	uint32_t SocketRegion[DERPMAP_MAX_REGION_COUNT];
+	uint64_t SocketStart[DERPMAP_MAX_REGION_COUNT];
+	uint32_t SocketCount = 0;
+
+	LARGE_INTEGER Start;
+	QueryPerformanceCounter(&Start);
+
+	// start nonblocking connections to all regions
+	for (uint32_t RegionIndex = 0; RegionIndex != DERPMAP_MAX_REGION_COUNT; RegionIndex++)
+	{
+		if (Probe->AddressLengths[RegionIndex] == 0)
+		{
+			continue;
+		}
+
+		SOCKADDR* Address = (SOCKADDR*)&Probe->Addresses[RegionIndex];
+		SOCKET Socket = socket(Address->sa_family, SOCK_STREAM, IPPROTO_TCP);
+		if (Socket == INVALID_SOCKET)
+		{
+			continue;
+		}
+
+		u_long NonBlocking = 1;
+		int NonBlockingOk = ioctlsocket(Socket, FIONBIO, &NonBlocking);
+		Assert(NonBlockingOk == 0);
+
+		LARGE_INTEGER Now;
+		QueryPerformanceCounter(&Now);
+
+		int Connected = connect(Socket, Address, Probe->AddressLengths[RegionIndex]);
+		if (Connected == 0 || WSAGetLastError() == WSAEWOULDBLOCK)
+		{
+			Sockets[SocketCount] = Socket;
+			SocketRegion[SocketCount] = RegionIndex;
+			SocketStart[SocketCount] = Now.QuadPart;
+			SocketCount++;
+		}
+		else
+		{
+			closesocket(Socket);
+		}
+	}
+
+	// wait for all of them to finish
+	uint64_t Deadline = Start.QuadPart + Freq * BUDDY_PROBE_TIMEOUT / 1000;
+	while (SocketCount != 0)
+	{
+		WSAPOLLFD Poll[DERPMAP_MAX_REGION_COUNT];
+		for (uint32_t Index = 0; Index != SocketCount; Index++)
+		{
+			Poll[Index] = (WSAPOLLFD) { .fd = Sockets[Index], .events = POLLOUT };
+		}
+
+		LARGE_INTEGER Now;
+		QueryPerformanceCounter(&Now);
+		if ((uint64_t)Now.QuadPart >= Deadline)
+		{
+			break;
+		}
+
+		if (WSAPoll(Poll, SocketCount, (INT)((Deadline - Now.QuadPart) * 1000 / Freq)) <= 0)
+		{
+			break;
+		}
+		QueryPerformanceCounter(&Now);
+
+		uint32_t Remaining = 0;
+		for (uint32_t Index = 0; Index != SocketCount; Index++)
+		{
+			if (Poll[Index].revents & (POLLERR | POLLHUP))
+			{
+				closesocket(Sockets[Index]);
+			}
+			else if (Poll[Index].revents & POLLOUT)
+			{
+				uint32_t RegionIndex = SocketRegion[Index];
+				uint32_t Sample = (uint32_t)((Now.QuadPart - SocketStart[Index]) * 1000000 / Freq);
+				Probe->TcpSamples[RegionIndex][Probe->TcpSampleCount[RegionIndex]++] = Sample;
+				closesocket(Sockets[Index]);
+
+				// fastest to connect in first round is good enough to start sharing, ranking continues in background
+				if (Probe->FirstRun && !Probe->FirstPosted)
+				{
+					Probe->FirstTime = (uint32_t)(GetTickCount64() - Probe->StartTime);
+					Probe->FirstPosted = true;
+					PostMessageW(Probe->Buddy->DialogWindow, BUDDY_WM_FIRST_REGION, RegionIndex, (LPARAM)Probe);
+				}
+			}
+			else
+			{
+				Sockets[Remaining] = Sockets[Index];
+				SocketRegion[Remaining] = SocketRegion[Index];
+				SocketStart[Remaining] = SocketStart[Index];
+				Remaining++;
+			}
+		}
+		SocketCount = Remaining;
+	}
+
+	for (uint32_t Index = 0; Index != SocketCount; Index++)
+	{
+		closesocket(Sockets[Index]);
+	}
+}
+
+static void Buddy_ProbeDerpPing(Buddy_RegionProbe* Probe, Buddy_RegionRank* Rank)
+{
+	DerpMapNode* Node = Buddy_GetDerpNode(&Probe->DerpMap.Regions[Rank->Region]);
+
+	char Addresses[2][64];
+	const char* AddressList[2] = { Addresses[0], Addresses[1] };
+	size_t AddressCount = Buddy_GetNodeAddressList(Node, Addresses);
+
+	DerpKey PrivateKey;
+	DerpNet_CreateNewKey(&PrivateKey);
+
+	if (DerpNet_OpenEx(&Probe->Net, Node->HostName, Node->DerpPort, AddressList, AddressCount, &PrivateKey))
+	{
+		uint32_t Samples[BUDDY_PROBE_DERP_SAMPLES];
+		uint32_t SampleCount = 0;
+
+		while (SampleCount != BUDDY_PROBE_DERP_SAMPLES)
+		{
+			if (!DerpNet_Ping(&Probe->Net, BUDDY_PROBE_TIMEOUT, &Samples[SampleCount]))
+			{
+				break;
+			}
+			SampleCount++;
+		}
+		DerpNet_Close(&Probe->Net);
+
+		if (SampleCount != 0)
+		{
+			Buddy_GetSampleStats(Samples, SampleCount, &Rank->Median, &Rank->Jitter);
+			Rank->DerpVerified = true;
+		}
+	}
+}
+
+static DWORD CALLBACK Buddy_RegionProbeThread(LPVOID Arg)
+{
+	Buddy_RegionProbe* Probe = Arg;
+	ScreenBuddy* Buddy = Probe->Buddy;
+
+	uint8_t* Buffer;
+	size_t BufferSize;
+	if (Buddy->DerpMapFile[0])
+	{
+		// fixed map was loaded with config
+	}
+	else if (Buddy_DownloadDerpMap(Buddy->HttpSession, &Probe->DerpMap, &Buffer, &BufferSize) == HTTP_STATUS_OK)
+	{
+		if (Buddy_ParseDerpMap(&Probe->DerpMap, Buffer, BufferSize))
+		{
+			Buddy_SaveDerpMap(&Probe->DerpMap, Buddy->DerpMapPath);
+		}
+		else
+		{
+			// keep older map, but do not revalidate it against new version
+			Probe->DerpMap.ETag[0] = 0;
+			Probe->DerpMap.LastModified[0] = 0;
+		}
+		HeapFree(GetProcessHeap(), 0, Buffer);
+	}
+	Probe->MapTime = (uint32_t)(GetTickCount64() - Probe->StartTime);
+
+	// DerpMap is not modified after this point, UI thread can copy it when first region is posted
+	Buddy_ResolveRegions(Probe);
+	Probe->ResolveTime = (uint32_t)(GetTickCount64() - Probe->StartTime);
+
+	// take multiple TCP connect samples for every region
+	for (uint32_t Round = 0; Round != BUDDY_PROBE_TCP_SAMPLES; Round++)
+	{
+		Buddy_ProbeTcpRound(Probe, Buddy->Freq);
+	}
+	Probe->TcpTime = (uint32_t)(GetTickCount64() - Probe->StartTime);
+
+	for (uint32_t RegionIndex = 0; RegionIndex != DERPMAP_MAX_REGION_COUNT; RegionIndex++)
+	{
+		if (Probe->TcpSampleCount[RegionIndex] != 0)
+		{
+			Buddy_RegionRank* Rank = &Probe->Ranking[Probe->RankingCount++];
+			Rank->Region = RegionIndex;
+			Buddy_GetSampleStats(Probe->TcpSamples[RegionIndex], Probe->TcpSampleCount[RegionIndex], &Rank->Median, &Rank->Jitter);
+		}
+	}
+	Buddy_SortRanking(Probe->Ranking, Probe->RankingCount);
+
+	// verify few best regions with DERP level ping, this includes TLS and relay server processing
+	for (uint32_t Index = 0; Index < min(Probe->RankingCount, BUDDY_PROBE_DERP_REGIONS); Index++)
+	{
+		Buddy_ProbeDerpPing(Probe, &Probe->Ranking[Index]);
+	}
+	Buddy_SortRanking(Probe->Ranking, Probe->RankingCount);
+	Probe->DerpTime = (uint32_t)(GetTickCount64() - Probe->StartTime);
+
+	PostMessageW(Buddy->DialogWindow, BUDDY_WM_BEST_REGION, 0, (LPARAM)Probe);
+
+	return 0;
+}
+
+static void Buddy_StartRegionProbe(ScreenBuddy* Buddy)
+{
+	if (Buddy->DerpRegionThread)
+	{
+		return;
+	}
+
+	Buddy_RegionProbe* Probe = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(*Probe));
+	Assert(Probe);
+
+	Probe->Buddy = Buddy;
+	Probe->FirstRun = Buddy->DerpRegion == 0;
+	Probe->StartTime = GetTickCount64();
+	CopyMemory(&Probe->DerpMap, &Buddy->DerpMap, sizeof(Probe->DerpMap));
+
+	Buddy->DerpRegionThread = CreateThread(NULL, 0, &Buddy_RegionProbeThread, Probe, 0, NULL);
+	Assert(Buddy->DerpRegionThread);
+}
+
+static void Buddy_SaveRegions(ScreenBuddy* Buddy)
+{
+	wchar_t Text[128];
+	StrFormat(Text, L"%u", Buddy->DerpRegion);
+	WritePrivateProfileStringW(BUDDY_CONFIG, L"DerpRegion", Text, Buddy->ConfigPath);
+
+	// "Region:Median:Jitter:DerpVerified" entries separated by space
+	wchar_t Ranking[DERPMAP_MAX_REGION_COUNT * 32];
+	int RankingLength = 0;
+	Ranking[0] = 0;
+	for (uint32_t Index = 0; Index < Buddy->DerpRankingCount; Index++)
+	{
+		Buddy_RegionRank* Rank = &Buddy->DerpRanking[Index];
+		RankingLength += _snwprintf(Ranking + RankingLength, ARRAYSIZE(Ranking) - RankingLength, L"%ls%u:%u:%u:%u", Index ? L" " : L"", Rank->Region, Rank->Median, Rank->Jitter, Rank->DerpVerified);
+	}
+	WritePrivateProfileStringW(BUDDY_CONFIG, L"DerpRanking", Ranking, Buddy->ConfigPath);
+
+	StrFormat(Text, L"%llu", Buddy->DerpRankingTime);
+	WritePrivateProfileStringW(BUDDY_CONFIG, L"DerpRankingTime", Text, Buddy->ConfigPath);
+}
+
+// appends "time_ms,name,value" row to -metrics file, sim\run.cmd collects these from both instances
+static void Buddy_Metric(ScreenBuddy* Buddy, const char* Name, double Value)
+{
+	if (Buddy->MetricsFile == NULL)
+	{
+		return;
+	}
+
+	wchar_t Text[128];
+	StrFormat(Text, L"%llu,%hs,%.3f\n", GetTickCount64() - Buddy->MetricsStart, Name, Value);
+
+	char Line[128];
+	int LineLength = WideCharToMultiByte(CP_UTF8, 0, Text, -1, Line, sizeof(Line), NULL, NULL);
+	if (LineLength > 1)
+	{
+		DWORD Written;
+		WriteFile(Buddy->MetricsFile, Line, (DWORD)LineLength - 1, &Written, NULL);
+	}
+}
+
+// average & longest wait from socket signal until UI thread gets packet, and UI thread time spent getting
+// packets, over all relay connections since previous call
+static void Buddy_NetRingMetrics(ScreenBuddy* Buddy)
+{
+	uint64_t DelaySum = 0;
+	uint64_t DelayMax = 0;
+	uint32_t DelayCount = 0;
+	uint64_t RecvTime = 0;
+
+	uint32_t RingCount = Buddy->Stripes ? Buddy->StripeCount : 1;
+	for (uint32_t Index = 0; Index < RingCount; Index++)
+	{
+		Buddy_NetRing* Ring = Index == 0 ? &Buddy->NetRing : &Buddy->Stripes[Index - 1].Ring;
+
+		DelaySum += Ring->DelaySum;
+		DelayMax = max(DelayMax, Ring->DelayMax);
+		DelayCount += Ring->DelayCount;
+		RecvTime += Ring->RecvTime;
+
+		Ring->DelaySum = 0;
+		Ring->DelayMax = 0;
+		Ring->DelayCount = 0;
+		Ring->RecvTime = 0;
+	}
+
+	double Msec = 1000.0 / (double)Buddy->Freq;
+	Buddy_Metric(Buddy, "net_delay_ms", DelayCount ? (double)DelaySum * Msec / DelayCount : 0);
+	Buddy_Metric(Buddy, "net_delay_max_ms", (double)DelayMax * Msec);
+	Buddy_Metric(Buddy, "net_recv_ms", (double)RecvTime * Msec);
+}
+
+// TLS records & send calls per second on main relay connection since previous call, corking packs messages into
+// fewer of both
+static void Buddy_NetSendMetrics(ScreenBuddy* Buddy, uint64_t Elapsed)
+{
+	size_t Records = Buddy->Net.TotalRecords - Buddy->LastRecords;
+	size_t Sends = Buddy->Net.TotalSends - Buddy->LastSends;
+	Buddy->LastRecords = Buddy->Net.TotalRecords;
+	Buddy->LastSends = Buddy->Net.TotalSends;
+
+	Buddy_Metric(Buddy, "tls_records", Elapsed ? (double)Records * 1000.0 / (double)Elapsed : 0);
+	Buddy_Metric(Buddy, "send_calls", Elapsed ? (double)Sends * 1000.0 / (double)Elapsed : 0);
+}
+
+// -config <ini> -share <codefile> -connect <codefile> -metrics <csv>
+static void Buddy_ParseCommandLine(ScreenBuddy* Buddy)
+{
+	int ArgCount;
+	wchar_t** Args = CommandLineToArgvW(GetCommandLineW(), &ArgCount);
+	if (Args == NULL)
+	{
+		return;
+	}
+
+	for (int ArgIndex = 1; ArgIndex + 1 < ArgCount; ArgIndex += 2)
+	{
+		const wchar_t* Name = Args[ArgIndex];
+		const wchar_t* Value = Args[ArgIndex + 1];
+
+		if (wcscmp(Name, L"-config") == 0)
+		{
+			GetFullPathNameW(Value, ARRAYSIZE(Buddy->ConfigPath), Buddy->ConfigPath, NULL);
+		}
+		else if (wcscmp(Name, L"-share") == 0)
+		{
+			GetFullPathNameW(Value, ARRAYSIZE(Buddy->AutoSharePath), Buddy->AutoSharePath, NULL);
+		}
+		else if (wcscmp(Name, L"-connect") == 0)
+		{
+			GetFullPathNameW(Value, ARRAYSIZE(Buddy->AutoConnectPath), Buddy->AutoConnectPath, NULL);
+		}
+		else if (wcscmp(Name, L"-metrics") == 0)
+		{
+			HANDLE File = CreateFileW(Value, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+			if (File != INVALID_HANDLE_VALUE)
+			{
+				const char Header[] = "time_ms,name,value\n";
+				DWORD Written;
+				WriteFile(File, Header, sizeof(Header) - 1, &Written, NULL);
+
+				Buddy->MetricsFile = File;
+				Buddy->MetricsStart = GetTickCount64();
+			}
+		}
+	}
+
+	LocalFree(Args);
+}
+
+// DerpMapFile from ini replaces downloaded DerpMap, it has same json format as https://login.tailscale.com/derpmap/default
+static bool Buddy_LoadDerpMapFile(Buddy_DerpMap* DerpMap, const wchar_t* Path)
+{
+	HANDLE File = CreateFileW(Path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (File == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	bool Result = false;
+
+	LARGE_INTEGER FileSize;
+	if (GetFileSizeEx(File, &FileSize) && FileSize.QuadPart < 16 * 1024 * 1024)
+	{
+		uint8_t* Buffer = HeapAlloc(GetProcessHeap(), 0, FileSize.QuadPart + 1);
+		Assert(Buffer);
+
+		DWORD Read;
+		if (ReadFile(File, Buffer, (DWORD)FileSize.QuadPart, &Read, NULL) && Read == FileSize.QuadPart)
+		{
+			Result = Buddy_ParseDerpMap(DerpMap, Buffer, Read);
+		}
+		HeapFree(GetProcessHeap(), 0, Buffer);
+	}
+
+	CloseHandle(File);
+	return Result;
+}
+
+static void Buddy_LoadConfig(ScreenBuddy* Buddy)
+{
+	DWORD ExePathOk = GetModuleFileNameW(NULL, Buddy->ConfigPath, ARRAYSIZE(Buddy->ConfigPath));
+	Assert(ExePathOk != 0);
+
+	HR(PathCchRenameExtension(Buddy->ConfigPath, ARRAYSIZE(Buddy->ConfigPath), L".ini"));
+
+	// -config replaces ini path, cached DerpMap is stored next to it
+	Buddy_ParseCommandLine(Buddy);
+
+	CopyMemory(Buddy->DerpMapPath, Buddy->ConfigPath, sizeof(Buddy->DerpMapPath));
+	HR(PathCchRenameExtension(Buddy->DerpMapPath, ARRAYSIZE(Buddy->DerpMapPath), L".derpmap"));
+
+	Buddy->DerpRegion = GetPrivateProfileIntW(BUDDY_CONFIG, L"DerpRegion", 0, Buddy->ConfigPath);
+	Buddy->DerpMesh = GetPrivateProfileIntW(BUDDY_CONFIG, L"DerpMesh", 0, Buddy->ConfigPath) != 0;
+	Buddy->NetTimeout = GetPrivateProfileIntW(BUDDY_CONFIG, L"NetTimeout", BUDDY_NET_TIMEOUT, Buddy->ConfigPath);
+	Buddy->NetTimeout = max(Buddy->NetTimeout, 2 * BUDDY_NET_KEEPALIVE);
+	Buddy->NetCorking = GetPrivateProfileIntW(BUDDY_CONFIG, L"DerpCorking", 1, Buddy->ConfigPath) != 0;
+	Buddy->NetThreadEnabled = GetPrivateProfileIntW(BUDDY_CONFIG, L"NetThread", 1, Buddy->ConfigPath) != 0;
+	Buddy->UdpLocalCandidates = GetPrivateProfileIntW(BUDDY_CONFIG, L"UdpLocalCandidates", 1, Buddy->ConfigPath) != 0;
+	Buddy->StripeCount = GetPrivateProfileIntW(BUDDY_CONFIG, L"DerpStripes", 1, Buddy->ConfigPath);
+	Buddy->StripeCount = max(1u, min(Buddy->StripeCount, (uint32_t)BUDDY_MAX_STRIPES));
+	Buddy->PaceEnabled = GetPrivateProfileIntW(BUDDY_CONFIG, L"DerpPacing", 1, Buddy->ConfigPath) != 0;
+	Buddy->KeySoft = GetPrivateProfileIntW(BUDDY_CONFIG, L"SoftKeyFrames", 0, Buddy->ConfigPath) != 0;
+	Buddy->ConvertSoftware = GetPrivateProfileIntW(BUDDY_CONFIG, L"SoftwareConvert", 0, Buddy->ConfigPath) != 0;
+	Buddy->ConvertBt709 = GetPrivateProfileIntW(BUDDY_CONFIG, L"ColorMatrix", 709, Buddy->ConfigPath) != 601;
+	Buddy->ConvertFullRange = GetPrivateProfileIntW(BUDDY_CONFIG, L"ColorFullRange", 0, Buddy->ConfigPath) != 0;
+	Buddy->NetLatencyInterval = GetPrivateProfileIntW(BUDDY_CONFIG, L"LatencyInterval", BUDDY_NET_KEEPALIVE, Buddy->ConfigPath);
+	Buddy->NetLatencyInterval = max(Buddy->NetLatencyInterval, BUDDY_NET_TICK);
+	Buddy->ChangeConfig = GetPrivateProfileIntW(BUDDY_CONFIG, L"ChangeDetect", BUDDY_CHANGE_AUTO, Buddy->ConfigPath);
+	Buddy->ScrollDetect = GetPrivateProfileIntW(BUDDY_CONFIG, L"ScrollDetect", 1, Buddy->ConfigPath) != 0;
+	Buddy->OverlayEnabled = GetPrivateProfileIntW(BUDDY_CONFIG, L"LosslessOverlay", 1, Buddy->ConfigPath) != 0;
+	Buddy->ViewScale = GetPrivateProfileIntW(BUDDY_CONFIG, L"ScaleToViewer", 1, Buddy->ConfigPath) != 0;
+	Buddy->PresentSoftware = GetPrivateProfileIntW(BUDDY_CONFIG, L"SoftwarePresent", 0, Buddy->ConfigPath) != 0;
+	Buddy->PresentFilter = GetPrivateProfileIntW(BUDDY_CONFIG, L"PresentFilter", PIXEL_FILTER_LANCZOS, Buddy->ConfigPath) == PIXEL_FILTER_BICUBIC ? PIXEL_FILTER_BICUBIC : PIXEL_FILTER_LANCZOS;
+
+	GetPrivateProfileStringW(BUDDY_CONFIG, L"DerpMapFile", L"", Buddy->DerpMapFile, ARRAYSIZE(Buddy->DerpMapFile), Buddy->ConfigPath);
+	if (Buddy->DerpMapFile[0])
+	{
+		if (!Buddy_LoadDerpMapFile(&Buddy->DerpMap, Buddy->DerpMapFile))
+		{
+			MessageBoxW(NULL, L"Cannot load DerpMapFile!", BUDDY_TITLE, MB_ICONERROR);
+			ExitProcess(0);
+		}
+	}
+	else if (!Buddy_LoadDerpMap(&Buddy->DerpMap, Buddy->DerpMapPath))
+	{
+		// older versions stored only hostname of first node for each region in ini file
+		for (int RegionIndex = 0; RegionIndex < DERPMAP_MAX_REGION_COUNT; RegionIndex++)
+		{
+			wchar_t DerpRegionName[128];
+			StrFormat(DerpRegionName, L"DerpRegion%d", RegionIndex);
+
+			wchar_t HostName[DERPMAP_MAX_HOST_LENGTH];
+			if (GetPrivateProfileStringW(BUDDY_CONFIG, DerpRegionName, L"", HostName, ARRAYSIZE(HostName), Buddy->ConfigPath))
+			{
+				DerpMapRegion* Region = &Buddy->DerpMap.Regions[RegionIndex];
+				WideCharToMultiByte(CP_UTF8, 0, HostName, -1, Region->Nodes[0].HostName, sizeof(Region->Nodes[0].HostName), NULL, NULL);
+				Region->Nodes[0].DerpPort = 443;
+				Region->NodeCount = 1;
+			}
+		}
+	}
+
+	if (Buddy->DerpRegion >= DERPMAP_MAX_REGION_COUNT || Buddy_GetDerpNode(&Buddy->DerpMap.Regions[Buddy->DerpRegion]) == NULL)
+	{
+		Buddy->DerpRegion = 0;
+	}
+
+	wchar_t RankingText[DERPMAP_MAX_REGION_COUNT * 32];
+	GetPrivateProfileStringW(BUDDY_CONFIG, L"DerpRanking", L"", RankingText, ARRAYSIZE(RankingText), Buddy->ConfigPath);
+
+	Buddy->DerpRankingCount = 0;
+	for (wchar_t* Text = RankingText; Buddy->DerpRankingCount < DERPMAP_MAX_REGION_COUNT; )
+	{
+		Buddy_RegionRank Rank;
+		uint32_t DerpVerified;
+		int TextUsed;
+		if (swscanf(Text, L"%u:%u:%u:%u%n", &Rank.Region, &Rank.Median, &Rank.Jitter, &DerpVerified, &TextUsed) != 4)
+		{
+			break;
+		}
+		Text += TextUsed;
+
+		if (Rank.Region < DERPMAP_MAX_REGION_COUNT && Buddy_GetDerpNode(&Buddy->DerpMap.Regions[Rank.Region]))
+		{
+			Rank.DerpVerified = DerpVerified != 0;
+			Buddy->DerpRanking[Buddy->DerpRankingCount++] = Rank;
+		}
+	}
+
+	wchar_t RankingTime[64];
+	GetPrivateProfileStringW(BUDDY_CONFIG, L"DerpRankingTime", L"0", RankingTime, ARRAYSIZE(RankingTime), Buddy->ConfigPath);
+	Buddy->DerpRankingTime = 0;
+	swscanf(RankingTime, L"%llu", &Buddy->DerpRankingTime);
+
+	wchar_t EncryptedText[2048];
+	DWORD EncryptedTextLen = GetPrivateProfileStringW(BUDDY_CONFIG, L"DerpPrivateKey", L"", EncryptedText, ARRAYSIZE(EncryptedText), Buddy->ConfigPath);
+
+	bool PrivateKeyValid = false;
+	if (EncryptedTextLen)
+	{
+		uint8_t EncryptedBlob[1024];
+		for (size_t i = 0; i < EncryptedTextLen; i += 2)
+		{
+			swscanf(EncryptedText + i, L"%02hhx", &EncryptedBlob[i/2]);
+		}
+
+		DATA_BLOB BlobInput = { EncryptedTextLen, EncryptedBlob };
+		DATA_BLOB BlobOutput;
+		BOOL Decrypted = CryptUnprotectData(&BlobInput, NULL, NULL, NULL, NULL, CRYPTPROTECT_UI_FORBIDDEN, &BlobOutput);
+
+		if (Decrypted && BlobOutput.cbData == sizeof(Buddy->MyPrivateKey))
+		{
+			CopyMemory(&Buddy->MyPrivateKey, BlobOutput.pbData, BlobOutput.cbData);
+			PrivateKeyValid = true;
+		}
+
+		LocalFree(BlobOutput.pbData);
+	}
+
+	if (!PrivateKeyValid)
+	{
+		DerpNet_CreateNewKey(&Buddy->MyPrivateKey);
+	}
+
+	DerpNet_GetPublicKey(&Buddy->MyPrivateKey, &Buddy->MyPublicKey);
+}
+
+//
+
+//
+// network I/O thread
+//
+// receiving, TLS decryption & unsealing happen on separate thread, so UI thread only handles
+// packets that are ready. Packets are passed through single producer / single consumer ring of
+// preallocated slots, when ring is full I/O thread waits. UI thread is notified with one
+// BUDDY_WM_NET_EVENT message for any amount of new packets. Sending stays on UI thread. Each relay
+// connection has its own ring & thread. With NetThread=0 in config there is no thread, socket wait only
+// posts message and UI thread receives itself, so both can be compared with sim\run.cmd.
+
+// called on I/O thread, returns NULL if thread must stop
+static Buddy_NetMessage* Buddy_NetRingReserve(Buddy_NetRing* Ring)
+{
+	for (;;)
+	{
+		LONG Write = Ring->Write;
+		if (Write - ReadAcquire(&Ring->Read) != BUDDY_NET_RING_SIZE)
+		{
+			return &Ring->Slots[Write % BUDDY_NET_RING_SIZE];
+		}
+
+		HANDLE Handles[] = { Ring->StopEvent, Ring->SpaceEvent };
+		if (WaitForMultipleObjects(ARRAYSIZE(Handles), Handles, FALSE, INFINITE) == WAIT_OBJECT_0)
+		{
+			return NULL;
+		}
+	}
+}
+
+static bool Buddy_NetRingPush(Buddy_NetRing* Ring, Buddy_NetMessageType Type, const DerpKey* Key, const uint8_t* Data, uint32_t Size)
+{
+	Buddy_NetMessage* Message = Buddy_NetRingReserve(Ring);
+	if (Message == NULL)
+	{
+		return false;
+	}
+
+	Assert(Size <= sizeof(Message->Buffer));
+
+	Message->Type = Type;
+	Message->Key = *Key;
+	Message->Size = Size;
+	Message->Data = Message->Buffer;
+	Message->Time = Ring->SignalTime;
+	CopyMemory(Message->Buffer, Data, Size);
+
+	WriteRelease(&Ring->Write, Ring->Write + 1);
+	if (InterlockedExchange(&Ring->Notified, 1) == 0)
+	{
+		PostMessageW(Ring->Window, BUDDY_WM_NET_EVENT, Ring->Index, 0);
+	}
+	return true;
+}
+
+// called on UI thread when it is done with message from Buddy_NetRingPeek
+static void Buddy_NetRingRelease(Buddy_NetRing* Ring)
+{
+	if (Ring->Inline)
+	{
+		// without I/O thread socket is waited for again only when UI thread stops receiving
+		if (Ring->Wait)
+		{
+			SetThreadpoolWait(Ring->Wait, Ring->Net->SocketEvent, NULL);
+		}
+	}
+	else if (Ring->Held)
+	{
+		Ring->Held = false;
+		WriteRelease(&Ring->Read, Ring->Read + 1);
+		SetEvent(Ring->SpaceEvent);
+	}
+}
+
+static Buddy_NetMessage* Buddy_NetRingNext(Buddy_NetRing* Ring)
+{
+	Buddy_NetRingRelease(Ring);
+
+	LONG Read = Ring->Read;
+	if (Read == ReadAcquire(&Ring->Write))
+	{
+		return NULL;
+	}
+
+	Ring->Held = true;
+	return &Ring->Slots[Read % BUDDY_NET_RING_SIZE];
+}
+
+// NetThread=0, returned packet points to DerpNet buffer and is valid until next call
+static Buddy_NetMessage* Buddy_NetRingRecv(Buddy_NetRing* Ring)
+{
+	Buddy_NetMessage* Packet = &Ring->Slots[1];
+	if (Ring->InlinePending)
+	{
+		Ring->InlinePending = false;
+		return Packet;
+	}
+
+	int Recv = DerpNet_Recv(Ring->Net, &Packet->Key, &Packet->Data, &Packet->Size, false);
+	Packet->Type = Recv < 0 ? BUDDY_NET_MESSAGE_CLOSED : BUDDY_NET_MESSAGE_PACKET;
+	Packet->Time = Ring->SignalTime;
+
+	// same order as I/O thread pushes them
+	if (Ring->PeerGone)
+	{
+		Ring->PeerGone = false;
+		Ring->InlinePending = Recv != 0;
+
+		Buddy_NetMessage* Gone = &Ring->Slots[0];
+		Gone->Type = BUDDY_NET_MESSAGE_PEER_GONE;
+		Gone->Key = Ring->PeerGoneKey;
+		Gone->Size = 0;
+		Gone->Time = Ring->SignalTime;
+		return Gone;
+	}
+
+	return Recv == 0 ? NULL : Packet;
+}
+
+// called on UI thread, previously returned message is released
+static Buddy_NetMessage* Buddy_NetRingPeek(Buddy_NetRing* Ring)
+{
+	LARGE_INTEGER Start;
+	QueryPerformanceCounter(&Start);
+
+	Buddy_NetMessage* Message = Ring->Inline ? Buddy_NetRingRecv(Ring) : Buddy_NetRingNext(Ring);
+
+	LARGE_INTEGER Now;
+	QueryPerformanceCounter(&Now);
+	Ring->RecvTime += Now.QuadPart - Start.QuadPart;
+
+	if (Message && Message->Type == BUDDY_NET_MESSAGE_PACKET)
+	{
+		uint64_t Delay = Now.QuadPart - Message->Time;
+		Ring->DelaySum += Delay;
+		Ring->DelayMax = max(Ring->DelayMax, Delay);
+		Ring->DelayCount++;
+	}
+	return Message;
+}
+
+// NetThread=0, socket wait on thread pool only wakes up UI thread
+static void CALLBACK Buddy_NetWaitCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Context, PTP_WAIT Wait, TP_WAIT_RESULT WaitResult)
+{
+	Buddy_NetRing* Ring = Context;
+	if (InterlockedExchange(&Ring->Notified, 1) == 0)
+	{
+		LARGE_INTEGER Now;
+		QueryPerformanceCounter(&Now);
+		Ring->SignalTime = Now.QuadPart;
+
+		PostMessageW(Ring->Window, BUDDY_WM_NET_EVENT, Ring->Index, 0);
+	}
+}
+
+static DWORD WINAPI Buddy_NetThread(LPVOID Arg)
+{
+	Buddy_NetRing* Ring = Arg;
+	DerpKey NoKey = { 0 };
+
+	for (;;)
+	{
+		for (;;)
+		{
+			DerpKey RecvKey;
+			uint8_t* RecvData;
+			uint32_t RecvSize;
+			int Recv = DerpNet_Recv(Ring->Net, &RecvKey, &RecvData, &RecvSize, false);
+
+			if (Ring->PeerGone)
+			{
+				Ring->PeerGone = false;
+				if (!Buddy_NetRingPush(Ring, BUDDY_NET_MESSAGE_PEER_GONE, &Ring->PeerGoneKey, NULL, 0))
+				{
+					return 0;
+				}
+			}
+
+			if (Recv < 0)
+			{
+				Buddy_NetRingPush(Ring, BUDDY_NET_MESSAGE_CLOSED, &NoKey, NULL, 0);
+				return 0;
+			}
+			else if (Recv == 0)
+			{
+				break;
+			}
+
+			if (!Buddy_NetRingPush(Ring, BUDDY_NET_MESSAGE_PACKET, &RecvKey, RecvData, RecvSize))
+			{
+				return 0;
+			}
+		}
+
+		HANDLE Handles[] = { Ring->StopEvent, Ring->Net->SocketEvent };
+		if (WaitForMultipleObjects(ARRAYSIZE(Handles), Handles, FALSE, INFINITE) == WAIT_OBJECT_0)
+		{
+			return 0;
+		}
+
+		LARGE_INTEGER Now;
+		QueryPerformanceCounter(&Now);
+		Ring->SignalTime = Now.QuadPart;
+	}
+}
+
+static void Buddy_StartNetThread(Buddy_NetRing* Ring)
+{
+	if (Ring->Slots == NULL)
+	{
+		Ring->Slots = HeapAlloc(GetProcessHeap(), 0, BUDDY_NET_RING_SIZE * sizeof(Buddy_NetMessage));
+		Assert(Ring->Slots);
+
+		Ring->StopEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+		Ring->SpaceEvent = CreateEventW(NULL, FALSE, FALSE, NULL);
+		Assert(Ring->StopEvent && Ring->SpaceEvent);
+	}
+
+	Ring->Write = 0;
+	Ring->Read = 0;
+	Ring->Notified = 0;
+	Ring->Held = false;
+	Ring->PeerGone = false;
+	Ring->InlinePending = false;
+	ResetEvent(Ring->StopEvent);
+
+	LARGE_INTEGER Now;
+	QueryPerformanceCounter(&Now);
+	Ring->SignalTime = Now.QuadPart;
+
+	if (Ring->Inline)
+	{
+		Ring->Wait = CreateThreadpoolWait(&Buddy_NetWaitCallback, Ring, NULL);
+		Assert(Ring->Wait);
+
+		// data that arrived before wait is set up, is received when UI thread handles this message
+		Ring->Notified = 1;
+		PostMessageW(Ring->Window, BUDDY_WM_NET_EVENT, Ring->Index, 0);
+		return;
+	}
+
+	Ring->Thread = CreateThread(NULL, 0, &Buddy_NetThread, Ring, 0, NULL);
+	Assert(Ring->Thread);
+}
+
+// must be called before closing connection, packets not handled yet are dropped
+static void Buddy_StopNetThread(Buddy_NetRing* Ring)
+{
+	if (Ring->Inline)
+	{
+		if (Ring->Wait)
+		{
+			SetThreadpoolWait(Ring->Wait, NULL, NULL);
+			WaitForThreadpoolWaitCallbacks(Ring->Wait, TRUE);
+			CloseThreadpoolWait(Ring->Wait);
+			Ring->Wait = NULL;
+		}
+		Ring->InlinePending = false;
+		return;
+	}
+
+	SetEvent(Ring->StopEvent);
+	WaitForSingleObject(Ring->Thread, INFINITE);
+	CloseHandle(Ring->Thread);
+	Ring->Thread = NULL;
+
+	Ring->Write = 0;
+	Ring->Read = 0;
+	Ring->Held = false;
+}
+
+static void Buddy_OnNetOpen(DerpNet* Net, bool Connected, void* UserData)
+{
+	ScreenBuddy* Buddy = UserData;
+	PostMessageW(Buddy->DialogWindow, BUDDY_WM_NET_OPEN, Connected, 0);
+}
+
+// called from DerpNet_Recv on I/O thread, UI thread gets BUDDY_NET_MESSAGE_PEER_GONE message
+static void Buddy_OnNetPeer(const DerpKey* PeerKey, bool Present, void* UserData)
+{
+	Buddy_NetRing* Ring = UserData;
+	if (!Present)
+	{
+		Ring->PeerGoneKey = *PeerKey;
+		Ring->PeerGone = true;
+	}
+}
+
+// returns false if region has no usable node
+static bool Buddy_GetNetAddress(ScreenBuddy* Buddy, uint32_t Region, const char** HostName, uint16_t* Port, char Addresses[2][64], size_t* AddressCount)
+{
+	*AddressCount = 0;
+
+	if (DERPNET_USE_PLAIN_HTTP && Buddy->DerpMapFile[0] == 0)
+	{
+		*HostName = "localhost";
+		*Port = 0;
+		return true;
+	}
+
+	DerpMapNode* Node = Buddy_GetDerpNode(&Buddy->DerpMap.Regions[Region]);
+	if (Node == NULL)
+	{
+		return false;
+	}
+
+	// addresses & port from DerpMap cache allow to start connecting without waiting on DNS
+	*HostName = Node->HostName;
+	*Port = Node->DerpPort;
+	*AddressCount = Buddy_GetNodeAddressList(Node, Addresses);
+	return true;
+}
+
+// connects in background, BUDDY_WM_NET_OPEN is posted when done
+static bool Buddy_OpenNet(ScreenBuddy* Buddy, uint32_t Region, const DerpKey* PrivateKey)
+{
+	char Addresses[2][64];
+	const char* AddressList[2] = { Addresses[0], Addresses[1] };
+	size_t AddressCount;
+
+	const char* DerpHostName;
+	uint16_t DerpPort;
+	if (!Buddy_GetNetAddress(Buddy, Region, &DerpHostName, &DerpPort, Addresses, &AddressCount))
+	{
+		return false;
+	}
+
+	Buddy->NetRegion = Region;
+	Buddy->NetPrivateKey = *PrivateKey;
+	Buddy->NetPeerGone = false;
+	Buddy->NetRing.Net = &Buddy->Net;
+	Buddy->NetRing.Window = Buddy->DialogWindow;
+	Buddy->NetRing.Index = 0;
+	Buddy->NetRing.Inline = !Buddy->NetThreadEnabled;
+	Buddy->Net.PeerCallback = &Buddy_OnNetPeer;
+	Buddy->Net.PeerUserData = &Buddy->NetRing;
+	Buddy->Net.CorkDisabled = !Buddy->NetCorking;
+	Buddy->NetOpening = DerpNet_OpenAsync(&Buddy->Net, DerpHostName, DerpPort, AddressList, AddressCount, PrivateKey, &Buddy_OnNetOpen, Buddy);
+	return Buddy->NetOpening;
+}
+
+static void Buddy_UdpStop(ScreenBuddy* Buddy);
+static void Buddy_StopStripes(ScreenBuddy* Buddy);
+
+// if connection is still being opened, it will be closed when BUDDY_WM_NET_OPEN arrives
+static void Buddy_CloseNet(ScreenBuddy* Buddy)
+{
+	Buddy_UdpStop(Buddy);
+	Buddy_StopStripes(Buddy);
+
+	KillTimer(Buddy->DialogWindow, BUDDY_NET_TIMER);
+	Buddy->NetMigrating = false;
+
+	if (Buddy->NetOpen)
+	{
+		Buddy_StopNetThread(&Buddy->NetRing);
+		DerpNet_Close(&Buddy->Net);
+		Buddy->NetOpen = false;
+	}
+}
+
+//
+
+static HRESULT STDMETHODCALLTYPE Buddy__QueryInterface(IMFAsyncCallback* This, REFIID Riid, void** Object)
+{
+	if (Object == NULL)
+	{
+		return E_POINTER;
+	}
+	if (IsEqualGUID(&IID_IUnknown, Riid) || IsEqualGUID(&IID_IMFAsyncCallback, Riid))
+	{
+		*Object = This;
+		return S_OK;
+	}
+	return E_NOINTERFACE;
+}
+
+static ULONG STDMETHODCALLTYPE Buddy__AddRef(IMFAsyncCallback* This)
+{
+	return 1;
+}
+
+static ULONG STDMETHODCALLTYPE Buddy__Release(IMFAsyncCallback* This)
+{
+	return 1;
+}
+
+static HRESULT STDMETHODCALLTYPE Buddy__GetParameters(IMFAsyncCallback* This, DWORD* Flags, DWORD* Queue)
+{
+	*Flags = 0;
+	*Queue = MFASYNC_CALLBACK_QUEUE_MULTITHREADED;
+	return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE Buddy__Invoke(IMFAsyncCallback* This, IMFAsyncResult* AsyncResult)
+{
+	ScreenBuddy* Buddy = CONTAINING_RECORD(This, ScreenBuddy, EventCallback);
+
+	// state is encoder that event came from, it may be already replaced with new one
+	IMFMediaEventGenerator* Generator;
+	HR(IMFAsyncResult_GetState(AsyncResult, (IUnknown**)&Generator));
+
+	IMFMediaEvent* Event;
+	if (SUCCEEDED(IMFMediaEventGenerator_EndGetEvent(Generator, AsyncResult, &Event)))
+	{
+		MediaEventType Type;
+		HR(IMFMediaEvent_GetType(Event, &Type));
+		IMFMediaEvent_Release(Event);
+
+		// reference is released by message handler
+		PostMessageW(Buddy->DialogWindow, BUDDY_WM_MEDIA_EVENT, (WPARAM)Type, (LPARAM)Generator);
+	}
+	else
+	{
+		IMFMediaEventGenerator_Release(Generator);
+	}
+
+	return S_OK;
+}
+
+//
+// color conversion
+//
+// software BGRA -> NV12 conversion, used for encoder input when Video Processor MFT is not available, or when
+// enabled with SoftwareConvert=1 in config. Matrix is BT.709 or BT.601 (ColorMatrix=601), with limited or full
+// (ColorFullRange=1) range. Kernels are in external/PixelKernels.h, tests\PixelKernelsTest.c checks them.
+
+static void Buddy_CreateCaptureReadback(ScreenBuddy* Buddy, int Width, int Height)
+{
+	D3D11_TEXTURE2D_DESC Desc =
+	{
+		.Width = Width,
+		.Height = Height,
+		.MipLevels = 1,
+		.ArraySize = 1,
+		.Format = DXGI_FORMAT_B8G8R8A8_UNORM,
+		.SampleDesc = { 1, 0 },
+		.Usage = D3D11_USAGE_STAGING,
+		.CPUAccessFlags = D3D11_CPU_ACCESS_READ,
+	};
+	HR(ID3D11Device_CreateTexture2D(Buddy->Device, &Desc, NULL, &Buddy->CaptureReadback));
+}
+
+// copies encoded part of captured frame to memory, must be unmapped after use
+static void Buddy_ReadbackFrame(ScreenBuddy* Buddy, ID3D11Texture2D* Texture, D3D11_MAPPED_SUBRESOURCE* Mapped)
+{
+	const RECT* Crop = &Buddy->EncodeCrop;
+
+	D3D11_BOX Box = { Crop->left, Crop->top, 0, Crop->right, Crop->bottom, 1 };
+	ID3D11DeviceContext_CopySubresourceRegion(Buddy->Context, (ID3D11Resource*)Buddy->CaptureReadback, 0, 0, 0, 0, (ID3D11Resource*)Texture, 0, &Box);
+	HR(ID3D11DeviceContext_Map(Buddy->Context, (ID3D11Resource*)Buddy->CaptureReadback, 0, D3D11_MAP_READ, 0, Mapped));
+}
+
+static void Buddy_CreateSoftwareConverter(ScreenBuddy* Buddy, int Width, int Height)
+{
+	Pixel_GetColorMatrix(&Buddy->ConvertMatrix, Buddy->ConvertBt709, Buddy->ConvertFullRange);
+	Buddy->ConvertRows = Pixel_GetConvertRows();
+
+	D3D11_TEXTURE2D_DESC Desc =
+	{
+		.Width = Width,
+		.Height = Height,
+		.MipLevels = 1,
+		.ArraySize = 1,
+		.Format = DXGI_FORMAT_NV12,
+		.SampleDesc = { 1, 0 },
+		.Usage = D3D11_USAGE_STAGING,
+		.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE,
+	};
+	HR(ID3D11Device_CreateTexture2D(Buddy->Device, &Desc, NULL, &Buddy->ConvertUpload));
+}
+
+static void Buddy_ReleaseSoftwareConverter(ScreenBuddy* Buddy)
+{
+	if (Buddy->ConvertUpload)
+	{
+		ID3D11Texture2D_Release(Buddy->ConvertUpload);
+		Buddy->ConvertUpload = NULL;
+	}
+	if (Buddy->CaptureReadback)
+	{
+		ID3D11Texture2D_Release(Buddy->CaptureReadback);
+		Buddy->CaptureReadback = NULL;
+	}
+}
+
+// converts captured frame from Buddy_ReadbackFrame into texture of encoder input sample
+static void Buddy_ConvertFrame(ScreenBuddy* Buddy, const D3D11_MAPPED_SUBRESOURCE* Source, IMFSample* Sample)
+{
+	D3D11_TEXTURE2D_DESC Desc;
+	ID3D11Texture2D_GetDesc(Buddy->ConvertUpload, &Desc);
+
+	D3D11_MAPPED_SUBRESOURCE Target;
+	HR(ID3D11DeviceContext_Map(Buddy->Context, (ID3D11Resource*)Buddy->ConvertUpload, 0, D3D11_MAP_WRITE, 0, &Target));
+	{
+		// chroma plane follows luma plane with same pitch
+		const uint8_t* Bgra = Source->pData;
+		uint8_t* Luma = Target.pData;
+		uint8_t* Chroma = Luma + Target.RowPitch * Desc.Height;
+
+		for (uint32_t Y = 0; Y < Desc.Height; Y += 2)
+		{
+			uint32_t Next = min(Y + 1, Desc.Height - 1);
+			Buddy->ConvertRows(&Buddy->ConvertMatrix,
+				Bgra + Y * Source->RowPitch, Bgra + Next * Source->RowPitch,
+				Luma + Y * Target.RowPitch, Luma + Next * Target.RowPitch,
+				Chroma + Y / 2 * Target.RowPitch, Desc.Width);
+		}
+	}
+	ID3D11DeviceContext_Unmap(Buddy->Context, (ID3D11Resource*)Buddy->ConvertUpload, 0);
+
+	IMFMediaBuffer* Buffer;
+	HR(IMFSample_GetBufferByIndex(Sample, 0, &Buffer));
+
+	IMFDXGIBuffer* DxgiBuffer;
+	HR(IMFMediaBuffer_QueryInterface(Buffer, &IID_IMFDXGIBuffer, (void**)&DxgiBuffer));
+
+	ID3D11Texture2D* SampleTexture;
+	UINT SampleIndex;
+	HR(IMFDXGIBuffer_GetResource(DxgiBuffer, &IID_ID3D11Texture2D, (void**)&SampleTexture));
+	HR(IMFDXGIBuffer_GetSubresourceIndex(DxgiBuffer, &SampleIndex));
+
+	ID3D11DeviceContext_CopySubresourceRegion(Buddy->Context, (ID3D11Resource*)SampleTexture, SampleIndex, 0, 0, 0, (ID3D11Resource*)Buddy->ConvertUpload, 0, NULL);
+
+	ID3D11Texture2D_Release(SampleTexture);
+	IMFDXGIBuffer_Release(DxgiBuffer);
+
+	DWORD Length;
+	HR(IMFMediaBuffer_GetMaxLength(Buffer, &Length));
+	HR(IMFMediaBuffer_SetCurrentLength(Buffer, Length));
+	IMFMediaBuffer_Release(Buffer);
+}
+
+//
+// video scaling
+//
+// software presentation for viewer, used when Video Processor MFT is not available, or when enabled with
+// SoftwarePresent=1 in config. Decoded NV12 frame is converted to BGRA and resized to exact window size with
+// separable Lanczos-3 (or Catmull-Rom bicubic with PresentFilter=0) filter, instead of GPU mips & bilinear
+// sampling that makes small text blurry. Each source row is converted & filtered horizontally only once, into
+// ring of rows that vertical filter reads from. Kernels & filters are in external/PixelKernels.h.
+// Sharer's software conversion uses same Lanczos-3 filter for captured BGRA frame, when it is encoded smaller.
+
+static void Buddy_InitPresent(ScreenBuddy* Buddy)
+{
+	Pixel_GetYuvMatrix(&Buddy->PresentMatrix, Buddy->ConvertBt709, Buddy->ConvertFullRange);
+	Buddy->PresentYuvToBgra = Pixel_GetYuvToBgra();
+	Buddy->PresentScaleRow = Pixel_GetScaleRow();
+	Buddy->PresentScaleColumns = Pixel_GetScaleColumns();
+}
+
+static void Buddy_ReleaseFrameScaler(ScreenBuddy* Buddy)
+{
+	if (Buddy->ConvertScaled)
+	{
+		Pixel_ReleaseScaleFilter(&Buddy->ConvertFilterX);
+		Pixel_ReleaseScaleFilter(&Buddy->ConvertFilterY);
+
+		HeapFree(GetProcessHeap(), 0, Buddy->ConvertRing);
+		HeapFree(GetProcessHeap(), 0, (void*)Buddy->ConvertRingRows);
+		HeapFree(GetProcessHeap(), 0, Buddy->ConvertScaled);
+		Buddy->ConvertRing = NULL;
+		Buddy->ConvertRingRows = NULL;
+		Buddy->ConvertScaled = NULL;
+	}
+}
+
+// sharer's software conversion downscales captured frame to encode size with Lanczos-3 filter
+static void Buddy_CreateFrameScaler(ScreenBuddy* Buddy, uint32_t InputWidth, uint32_t InputHeight, uint32_t Width, uint32_t Height)
+{
+	Buddy->ConvertScaleRow = Pixel_GetScaleRow();
+	Buddy->ConvertScaleColumns = Pixel_GetScaleColumns();
+
+	uint32_t PaddedWidth = (Width + 3) & ~3;
+	bool Created = Pixel_CreateScaleFilter(&Buddy->ConvertFilterX, PIXEL_FILTER_LANCZOS, InputWidth, Width, PaddedWidth)
+		&& Pixel_CreateScaleFilter(&Buddy->ConvertFilterY, PIXEL_FILTER_LANCZOS, InputHeight, Height, Height);
+	Assert(Created);
+
+	uint32_t Taps = Buddy->ConvertFilterY.Taps;
+	Buddy->ConvertScaledPitch = PaddedWidth * 4;
+	Buddy->ConvertRing = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, Taps * PaddedWidth * 4 * sizeof(int16_t));
+	Buddy->ConvertRingRows = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, Taps * sizeof(*Buddy->ConvertRingRows));
+	Buddy->ConvertScaled = HeapAlloc(GetProcessHeap(), 0, Height * Buddy->ConvertScaledPitch);
+	Assert(Buddy->ConvertRing && Buddy->ConvertRingRows && Buddy->ConvertScaled);
+}
+
+// scales frame from Buddy_ReadbackFrame, captured rows are filtered horizontally directly from mapped memory
+static void Buddy_ScaleFrame(ScreenBuddy* Buddy, const D3D11_MAPPED_SUBRESOURCE* Source, D3D11_MAPPED_SUBRESOURCE* Scaled)
+{
+	D3D11_TEXTURE2D_DESC Desc;
+	ID3D11Texture2D_GetDesc(Buddy->CaptureReadback, &Desc);
+
+	const PixelScaleFilter* FilterY = &Buddy->ConvertFilterY;
+	uint32_t Taps = FilterY->Taps;
+	uint32_t PaddedWidth = (Buddy->EncodeWidth + 3) & ~3;
+	uint32_t RingPitch = PaddedWidth * 4;
+	const uint8_t* Bgra = Source->pData;
+
+	uint32_t NextRow = 0;
+	for (uint32_t Y = 0; Y < Buddy->EncodeHeight; Y++)
+	{
+		uint32_t Start = FilterY->Start[Y];
+
+		for (uint32_t End = min(Start + Taps, Desc.Height); NextRow < End; NextRow++)
+		{
+			Buddy->ConvertScaleRow(&Buddy->ConvertFilterX, Bgra + NextRow * Source->RowPitch, Buddy->ConvertRing + NextRow % Taps * RingPitch, PaddedWidth);
+		}
+
+		for (uint32_t Tap = 0; Tap < Taps; Tap++)
+		{
+			uint32_t Row = min(Start + Tap, Desc.Height - 1);
+			Buddy->ConvertRingRows[Tap] = Buddy->ConvertRing + Row % Taps * RingPitch;
+		}
+		Buddy->ConvertScaleColumns(Buddy->ConvertRingRows, FilterY->Weights + Y * Taps, Taps, Buddy->ConvertScaled + Y * Buddy->ConvertScaledPitch, PaddedWidth);
+	}
+
+	Scaled->pData = Buddy->ConvertScaled;
+	Scaled->RowPitch = Buddy->ConvertScaledPitch;
+	Scaled->DepthPitch = 0;
+}
+
+static void Buddy_ReleasePresentScaler(ScreenBuddy* Buddy)
+{
+	if (Buddy->PresentView)
+	{
+		ID3D11ShaderResourceView_Release(Buddy->PresentView);
+		ID3D11Texture2D_Release(Buddy->PresentTexture);
+		Buddy->PresentView = NULL;
+		Buddy->PresentTexture = NULL;
+
+		Pixel_ReleaseScaleFilter(&Buddy->PresentFilterX);
+		Pixel_ReleaseScaleFilter(&Buddy->PresentFilterY);
+
+		HeapFree(GetProcessHeap(), 0, Buddy->PresentRow);
+		HeapFree(GetProcessHeap(), 0, Buddy->PresentRing);
+		HeapFree(GetProcessHeap(), 0, (void*)Buddy->PresentRows);
+		HeapFree(GetProcessHeap(), 0, Buddy->PresentOutput);
+	}
+	Buddy->PresentWidth = 0;
+	Buddy->PresentHeight = 0;
+}
+
+static void Buddy_CreatePresentScaler(ScreenBuddy* Buddy, uint32_t Width, uint32_t Height)
+{
+	Buddy_ReleasePresentScaler(Buddy);
+
+	uint32_t InputWidth = Buddy->InputWidth;
+	uint32_t InputHeight = Buddy->InputHeight;
+	uint32_t PaddedInput = (InputWidth + 7) & ~7;
+	uint32_t PaddedWidth = (Width + 3) & ~3;
+
+	bool Created = Pixel_CreateScaleFilter(&Buddy->PresentFilterX, Buddy->PresentFilter, InputWidth, Width, PaddedWidth)
+		&& Pixel_CreateScaleFilter(&Buddy->PresentFilterY, Buddy->PresentFilter, InputHeight, Height, Height);
+	Assert(Created);
+
+	// horizontal filter may read past image when it has fewer pixels than taps
+	uint32_t RowSize = max(PaddedInput, Buddy->PresentFilterX.Taps) * 4;
+	uint32_t Taps = Buddy->PresentFilterY.Taps;
+
+	Buddy->PresentRow = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, RowSize);
+	Buddy->PresentRing = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, Taps * PaddedWidth * 4 * sizeof(int16_t));
+	Buddy->PresentRows = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, Taps * sizeof(*Buddy->PresentRows));
+	Buddy->PresentOutput = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, max(PaddedInput, PaddedWidth) * 4);
+
+	D3D11_TEXTURE2D_DESC Desc =
+	{
+		.Width = Width,
+		.Height = Height,
+		.MipLevels = 1,
+		.ArraySize = 1,
+		.Format = DXGI_FORMAT_B8G8R8A8_UNORM,
+		.SampleDesc = { 1, 0 },
+		.Usage = D3D11_USAGE_DYNAMIC,
+		.BindFlags = D3D11_BIND_SHADER_RESOURCE,
+		.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE,
+	};
+	HR(ID3D11Device_CreateTexture2D(Buddy->Device, &Desc, NULL, &Buddy->PresentTexture));
+	HR(ID3D11Device_CreateShaderResourceView(Buddy->Device, (ID3D11Resource*)Buddy->PresentTexture, NULL, &Buddy->PresentView));
+
+	Buddy->PresentWidth = Width;
+	Buddy->PresentHeight = Height;
+	Buddy->PresentDirty = true;
+}
+
+static void Buddy_OverlayRow(ScreenBuddy* Buddy, uint8_t* Row, uint32_t Y, uint32_t Width);
+
+static void Buddy_PresentScale(ScreenBuddy* Buddy, uint8_t* Output, uint32_t OutputPitch)
+{
+	uint32_t InputWidth = Buddy->InputWidth;
+	uint32_t InputHeight = Buddy->InputHeight;
+	uint32_t Width = Buddy->PresentWidth;
+	uint32_t Height = Buddy->PresentHeight;
+
+	// kernels process whole blocks of pixels
+	uint32_t PaddedInput = (InputWidth + 7) & ~7;
+	uint32_t PaddedWidth = (Width + 3) & ~3;
+
+	uint32_t Pitch = Buddy->PresentPitch;
+	const uint8_t* Luma = Buddy->PresentFrame;
+	const uint8_t* Chroma = Luma + Pitch * InputHeight;
+	uint32_t ChromaHeight = (InputHeight + 1) / 2;
+
+	if (Width == InputWidth && Height == InputHeight)
+	{
+		for (uint32_t Y = 0; Y < Height; Y++)
+		{
+			uint32_t Near = Y / 2;
+			uint32_t Far = Y & 1 ? min(Near + 1, ChromaHeight - 1) : Near == 0 ? 0 : Near - 1;
+
+			Buddy->PresentYuvToBgra(&Buddy->PresentMatrix, Luma + Y * Pitch, Chroma + Near * Pitch, Chroma + Far * Pitch, Buddy->PresentOutput, PaddedInput);
+			Buddy_OverlayRow(Buddy, Buddy->PresentOutput, Y, InputWidth);
+			CopyMemory(Output + Y * OutputPitch, Buddy->PresentOutput, Width * 4);
+		}
+		return;
+	}
+
+	const PixelScaleFilter* FilterY = &Buddy->PresentFilterY;
+	uint32_t Taps = FilterY->Taps;
+	uint32_t RingPitch = PaddedWidth * 4;
+
+	uint32_t NextRow = 0;
+	for (uint32_t Y = 0; Y < Height; Y++)
+	{
+		uint32_t Start = FilterY->Start[Y];
+
+		// every source row is converted & filtered horizontally only once
+		for (uint32_t End = min(Start + Taps, InputHeight); NextRow < End; NextRow++)
+		{
+			uint32_t Near = NextRow / 2;
+			uint32_t Far = NextRow & 1 ? min(Near + 1, ChromaHeight - 1) : Near == 0 ? 0 : Near - 1;
+
+			Buddy->PresentYuvToBgra(&Buddy->PresentMatrix, Luma + NextRow * Pitch, Chroma + Near * Pitch, Chroma + Far * Pitch, Buddy->PresentRow, PaddedInput);
+			Buddy_OverlayRow(Buddy, Buddy->PresentRow, NextRow, InputWidth);
+			Buddy->PresentScaleRow(&Buddy->PresentFilterX, Buddy->PresentRow, Buddy->PresentRing + NextRow % Taps * RingPitch, PaddedWidth);
+		}
+
+		for (uint32_t Tap = 0; Tap < Taps; Tap++)
+		{
+			uint32_t Row = min(Start + Tap, InputHeight - 1);
+			Buddy->PresentRows[Tap] = Buddy->PresentRing + Row % Taps * RingPitch;
+		}
+		Buddy->PresentScaleColumns(Buddy->PresentRows, FilterY->Weights + Y * Taps, Taps, Buddy->PresentOutput, PaddedWidth);
+
+		CopyMemory(Output + Y * OutputPitch, Buddy->PresentOutput, Width * 4);
+	}
+}
+
+static void Buddy_ReleasePresentFrame(ScreenBuddy* Buddy)
+{
+	if (Buddy->PresentReadback)
+	{
+		ID3D11Texture2D_Release(Buddy->PresentReadback);
+		HeapFree(GetProcessHeap(), 0, Buddy->PresentFrame);
+		Buddy->PresentReadback = NULL;
+		Buddy->PresentFrame = NULL;
+	}
+	Buddy->PresentReady = false;
+}
+
+// copies decoded frame to memory, it is scaled only when window is rendered
+static void Buddy_PresentDecoded(ScreenBuddy* Buddy, IMFSample* Sample)
+{
+	IMFMediaBuffer* Buffer;
+	HR(IMFSample_GetBufferByIndex(Sample, 0, &Buffer));
+
+	IMFDXGIBuffer* DxgiBuffer;
+	HR(IMFMediaBuffer_QueryInterface(Buffer, &IID_IMFDXGIBuffer, (void**)&DxgiBuffer));
+
+	ID3D11Texture2D* Texture;
+	UINT TextureIndex;
+	HR(IMFDXGIBuffer_GetResource(DxgiBuffer, &IID_ID3D11Texture2D, (void**)&Texture));
+	HR(IMFDXGIBuffer_GetSubresourceIndex(DxgiBuffer, &TextureIndex));
+
+	D3D11_TEXTURE2D_DESC Desc;
+	ID3D11Texture2D_GetDesc(Texture, &Desc);
+
+	if (Buddy->PresentReadback)
+	{
+		D3D11_TEXTURE2D_DESC ReadbackDesc;
+		ID3D11Texture2D_GetDesc(Buddy->PresentReadback, &ReadbackDesc);
+		if (ReadbackDesc.Width != Desc.Width || ReadbackDesc.Height != Desc.Height)
+		{
+			Buddy_ReleasePresentFrame(Buddy);
+		}
+	}
+
+	uint32_t Width = Desc.Width;
+	uint32_t Height = Desc.Height;
+	uint32_t ChromaWidth = (Width + 1) / 2;
+	uint32_t ChromaHeight = (Height + 1) / 2;
+
+	if (Buddy->PresentReadback == NULL)
+	{
+		D3D11_TEXTURE2D_DESC ReadbackDesc =
+		{
+			.Width = Width,
+			.Height = Height,
+			.MipLevels = 1,
+			.ArraySize = 1,
+			.Format = DXGI_FORMAT_NV12,
+			.SampleDesc = { 1, 0 },
+			.Usage = D3D11_USAGE_STAGING,
+			.CPUAccessFlags = D3D11_CPU_ACCESS_READ,
+		};
+		HR(ID3D11Device_CreateTexture2D(Buddy->Device, &ReadbackDesc, NULL, &Buddy->PresentReadback));
+
+		// SIMD kernels read whole blocks past end of row
+		Buddy->PresentPitch = ((Width + 15) & ~15) + 32;
+		Buddy->PresentFrame = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, Buddy->PresentPitch * (Height + ChromaHeight));
+
+		// filters depend on input size
+		Buddy_ReleasePresentScaler(Buddy);
+	}
+
+	ID3D11DeviceContext_CopySubresourceRegion(Buddy->Context, (ID3D11Resource*)Buddy->PresentReadback, 0, 0, 0, 0, (ID3D11Resource*)Texture, TextureIndex, NULL);
+
+	ID3D11Texture2D_Release(Texture);
+	IMFDXGIBuffer_Release(DxgiBuffer);
+	IMFMediaBuffer_Release(Buffer);
+
+	D3D11_MAPPED_SUBRESOURCE Mapped;
+	HR(ID3D11DeviceContext_Map(Buddy->Context, (ID3D11Resource*)Buddy->PresentReadback, 0, D3D11_MAP_READ, 0, &Mapped));
+	{
+		uint32_t Pitch = Buddy->PresentPitch;
+		const uint8_t* Source = Mapped.pData;
+		uint8_t* Target = Buddy->PresentFrame;
+
+		for (uint32_t Y = 0; Y < Height; Y++)
+		{
+			CopyMemory(Target + Y * Pitch, Source + Y * Mapped.RowPitch, Width);
+		}
+
+		Source += Mapped.RowPitch * Height;
+		Target += Pitch * Height;
+		for (uint32_t Y = 0; Y < ChromaHeight; Y++)
+		{
+			uint8_t* Row = Target + Y * Pitch;
+			CopyMemory(Row, Source + Y * Mapped.RowPitch, ChromaWidth * 2);
+
+			// odd pixel in last column interpolates with next chroma pair
+			Row[ChromaWidth * 2 + 0] = Row[ChromaWidth * 2 - 2];
+			Row[ChromaWidth * 2 + 1] = Row[ChromaWidth * 2 - 1];
+		}
+	}
+	ID3D11DeviceContext_Unmap(Buddy->Context, (ID3D11Resource*)Buddy->PresentReadback, 0);
+
+	Buddy->InputWidth = Width;
+	Buddy->InputHeight = Height;
+	Buddy->PresentReady = true;
+	Buddy->PresentDirty = true;
+}
+
+// returns view with decoded image in exactly Width x Height size
+static ID3D11ShaderResourceView* Buddy_UpdatePresent(ScreenBuddy* Buddy, uint32_t Width, uint32_t Height)
+{
+	if (Width != Buddy->PresentWidth || Height != Buddy->PresentHeight)
+	{
+		Buddy_CreatePresentScaler(Buddy, Width, Height);
+	}
+
+	if (Buddy->PresentDirty)
+	{
+		D3D11_MAPPED_SUBRESOURCE Mapped;
+		HR(ID3D11DeviceContext_Map(Buddy->Context, (ID3D11Resource*)Buddy->PresentTexture, 0, D3D11_MAP_WRITE_DISCARD, 0, &Mapped));
+		Buddy_PresentScale(Buddy, Mapped.pData, Mapped.RowPitch);
+		ID3D11DeviceContext_Unmap(Buddy->Context, (ID3D11Resource*)Buddy->PresentTexture, 0);
+
+		Buddy->PresentDirty = false;
+	}
+
+	return Buddy->PresentView;
+}
+
+//
+
+//
+// change detection
+//
+// captured frame is split into 64x64 tiles, each tile is hashed & compared to its hash from previous frame.
+// Hash accumulates 32x32-bit products of 16-byte blocks mixed with per-column secrets, and scrambles
+// accumulators after every row, so content moved or swapped inside tile changes it. Tile rows are hashed
+// in parallel on thread pool. Result is bitmap of dirty tiles, and few rectangles covering all of them.
+// Hash & rectangles are in external/TileHash.h, tests\TileHashTest.c checks them.
+//
+// Detection needs frame in memory. Software conversion reads it back anyway, but with Video Processor MFT it
+// would cost full frame GPU -> CPU copy & Map stall every frame, so by default it is on only with software
+// conversion. ChangeDetect=1 in config forces it on, ChangeDetect=0 off.
+
+static void Buddy_CreateChanges(Buddy_Changes* Changes, uint32_t Width, uint32_t Height)
+{
+	Changes->Width = Width;
+	Changes->Height = Height;
+	Changes->TilesX = (Width + BUDDY_CHANGE_TILE - 1) / BUDDY_CHANGE_TILE;
+	Changes->TilesY = (Height + BUDDY_CHANGE_TILE - 1) / BUDDY_CHANGE_TILE;
+	Changes->DirtyPitch = (Changes->TilesX + 31) / 32;
+	Changes->Valid = false;
+
+	HANDLE Heap = GetProcessHeap();
+	Changes->Hashes = HeapAlloc(Heap, HEAP_ZERO_MEMORY, Changes->TilesX * Changes->TilesY * sizeof(*Changes->Hashes));
+	Changes->Dirty = HeapAlloc(Heap, HEAP_ZERO_MEMORY, Changes->DirtyPitch * Changes->TilesY * sizeof(*Changes->Dirty));
+	Changes->RowDirty = HeapAlloc(Heap, HEAP_ZERO_MEMORY, Changes->TilesY * sizeof(*Changes->RowDirty));
+	Changes->RowDone = HeapAlloc(Heap, HEAP_ZERO_MEMORY, Changes->TilesY * sizeof(*Changes->RowDone));
+	Assert(Changes->Hashes && Changes->Dirty && Changes->RowDirty && Changes->RowDone);
+
+	TileHash_Init(Changes->Secret);
+}
+
+static void Buddy_ReleaseChanges(Buddy_Changes* Changes)
+{
+	if (Changes->Hashes)
+	{
+		HANDLE Heap = GetProcessHeap();
+		HeapFree(Heap, 0, Changes->Hashes);
+		HeapFree(Heap, 0, Changes->Dirty);
+		HeapFree(Heap, 0, Changes->RowDirty);
+		HeapFree(Heap, 0, (void*)Changes->RowDone);
+		ZeroMemory(Changes, sizeof(*Changes));
+	}
+}
+
+static void Buddy_ChangeTask(void* Context, size_t Index)
+{
+	Buddy_Changes* Changes = Context;
+
+	uint32_t TileY = (uint32_t)Index;
+	uint32_t Y = TileY * BUDDY_CHANGE_TILE;
+	uint32_t Height = min((uint32_t)BUDDY_CHANGE_TILE, Changes->Height - Y);
+
+	uint64_t* Hashes = Changes->Hashes + TileY * Changes->TilesX;
+	uint32_t* Dirty = Changes->Dirty + TileY * Changes->DirtyPitch;
+	Changes->RowDirty[TileY] = TileHash_TileRow(Changes->Secret, Changes->Pixels + Y * Changes->Pitch, Changes->Pitch, Changes->Width, Height, Hashes, Dirty, Changes->Valid);
+}
+
+static void Buddy_ChangeRects(Buddy_Changes* Changes)
+{
+	Changes->DirtyCount = 0;
+	for (uint32_t TileY = 0; TileY < Changes->TilesY; TileY++)
+	{
+		Changes->DirtyCount += Changes->RowDirty[TileY];
+	}
+
+	TileHashRect Rects[BUDDY_CHANGE_MAX_RECTS];
+	TileHashRect Bounds;
+	Changes->RectCount = TileHash_Rects(Changes->Dirty, Changes->DirtyPitch, Changes->RowDirty, Changes->Width, Changes->Height, Rects, BUDDY_CHANGE_MAX_RECTS, &Bounds);
+
+	for (uint32_t Index = 0; Index < Changes->RectCount; Index++)
+	{
+		SetRect(&Changes->Rects[Index], Rects[Index].Left, Rects[Index].Top, Rects[Index].Right, Rects[Index].Bottom);
+	}
+	SetRect(&Changes->Bounds, Bounds.Left, Bounds.Top, Bounds.Right, Bounds.Bottom);
+}
+
+// Pixels is BGRA frame of size passed to Buddy_CreateChanges, first call reports everything as dirty
+static void Buddy_DetectChanges(Buddy_Changes* Changes, const uint8_t* Pixels, uint32_t Pitch)
+{
+	Changes->Pixels = Pixels;
+	Changes->Pitch = Pitch;
+	ZeroMemory((void*)Changes->RowDone, Changes->TilesY * sizeof(*Changes->RowDone));
+
+	DerpNet__Tasks Tasks;
+	DerpNet__TasksStart(&Tasks, Changes->TilesY, Changes->RowDone, DerpNet__GetThreadCount(0), &Buddy_ChangeTask, Changes);
+	for (uint32_t Index = 0; Index < Changes->TilesY; Index++)
+	{
+		DerpNet__TasksWait(&Tasks, Index);
+	}
+	DerpNet__TasksFinish(&Tasks);
+
+	Changes->Valid = true;
+	Changes->Pixels = NULL;
+
+	Buddy_ChangeRects(Changes);
+}
+
+// changed tiles get lower QP when they cover only small part of frame, like typing or cursor blinking
+// after scroll only newly exposed part counts, moved content is already in reference frame
+static void Buddy_SetChangeRegion(ScreenBuddy* Buddy, IMFSample* Sample)
+{
+	const Buddy_Changes* Changes = &Buddy->Changes;
+	const ScrollDetect* Scroll = &Buddy->Scroll.Detect;
+
+	RECT Exposed = { Scroll->Exposed.Left, Scroll->Exposed.Top, Scroll->Exposed.Right, Scroll->Exposed.Bottom };
+	const RECT* Region = Scroll->Found ? &Exposed : &Changes->Bounds;
+
+	uint64_t Area = (uint64_t)(Region->right - Region->left) * (Region->bottom - Region->top);
+	if (!IsRectEmpty(Region) && Area * 100 < (uint64_t)Changes->Width * Changes->Height * BUDDY_CHANGE_ROI_AREA)
+	{
+		// changes are in captured frame coordinates, encoded frame can be smaller
+		ROI_AREA Roi =
+		{
+			.rect =
+			{
+				.left = MulDiv(Region->left, Buddy->EncodeWidth, Changes->Width),
+				.top = MulDiv(Region->top, Buddy->EncodeHeight, Changes->Height),
+				.right = MulDiv(Region->right, Buddy->EncodeWidth, Changes->Width),
+				.bottom = MulDiv(Region->bottom, Buddy->EncodeHeight, Changes->Height),
+			},
+			.QPDelta = -BUDDY_CHANGE_ROI_QP,
+		};
+		HR(IMFSample_SetBlob(Sample, &MFSampleExtension_ROIRectangle, (const UINT8*)&Roi, sizeof(Roi)));
+	}
+	else
+	{
+		// samples are reused by allocator
+		IMFSample_DeleteItem(Sample, &MFSampleExtension_ROIRectangle);
+	}
+}
+
+// frames without changes are not encoded after encoder had time to refine quality, Pending forces encoding
+static bool Buddy_IsStaticFrame(ScreenBuddy* Buddy, bool Pending)
+{
+	if (Buddy->Changes.DirtyCount != 0)
+	{
+		Buddy->ChangeStatic = 0;
+		return false;
+	}
+
+	Buddy->ChangeStatic += 1;
+	if (Buddy->ChangeStatic <= BUDDY_CHANGE_SETTLE_FRAMES || Pending)
+	{
+		return false;
+	}
+
+	Buddy->ChangeSkipped += 1;
+	return true;
+}
+
+//
+// scroll detection
+//
+// scrolling document or terminal changes nearly every tile, and moves are often outside of encoder motion search range.
+// When enough tiles changed, few tile columns of dirty region are hashed row by row in current & previous frame, and
+// rows with same hash vote for vertical offset. Offset with most votes is verified by comparing pixels with copy of
+// previous frame, starting from best tile column & growing to neighbor columns that moved by same offset. Same is done
+// with tile rows & columns of pixels for horizontal scroll. Found region is moved in viewer's lossless overlay, and
+// encoder gets better quality only for newly exposed part. Detection is in external/ScrollDetect.h, copy of previous
+// frame is updated here only in changed tiles, on thread pool. Can be disabled with ScrollDetect=0 in config.
+
+static void Buddy_CreateScroll(Buddy_Scroll* Scroll, uint32_t Width, uint32_t Height)
+{
+	bool Created = Scroll_Create(&Scroll->Detect, Width, Height);
+	Assert(Created);
+
+	Scroll->Count = 0;
+	Scroll->RowDone = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, ((Height + BUDDY_CHANGE_TILE - 1) / BUDDY_CHANGE_TILE) * sizeof(*Scroll->RowDone));
+	Assert(Scroll->RowDone);
+}
+
+static void Buddy_ReleaseScroll(Buddy_Scroll* Scroll)
+{
+	if (Scroll->Detect.Previous)
+	{
+		Scroll_Release(&Scroll->Detect);
+		HeapFree(GetProcessHeap(), 0, (void*)Scroll->RowDone);
+		ZeroMemory(Scroll, sizeof(*Scroll));
+	}
+}
+
+// previous frame is updated only where it changed, each task copies runs of dirty tiles in one tile row
+static void Buddy_ScrollCopyTask(void* Context, size_t Index)
+{
+	Buddy_Scroll* Scroll = Context;
+	Scroll_CopyRow(&Scroll->Detect, &Scroll->Changes, Scroll->Frame, Scroll->FramePitch, (uint32_t)Index);
+}
+
+// call after Buddy_DetectChanges with same frame, Detect.Found & Detect.Rect describe region that moved since previous frame
+static void Buddy_DetectScroll(Buddy_Scroll* Scroll, const Buddy_Changes* Changes, const uint8_t* Pixels, uint32_t Pitch)
+{
+	Scroll->Changes = (ScrollChanges)
+	{
+		.Width = Changes->Width,
+		.Height = Changes->Height,
+		.TilesX = Changes->TilesX,
+		.TilesY = Changes->TilesY,
+		.DirtyPitch = Changes->DirtyPitch,
+		.Secret = Changes->Secret,
+		.Dirty = Changes->Dirty,
+		.RowDirty = Changes->RowDirty,
+		.DirtyCount = Changes->DirtyCount,
+		.Bounds = { Changes->Bounds.left, Changes->Bounds.top, Changes->Bounds.right, Changes->Bounds.bottom },
+	};
+	Scroll->Count += Scroll_Detect(&Scroll->Detect, &Scroll->Changes, Pixels, Pitch);
+
+	Scroll->Frame = Pixels;
+	Scroll->FramePitch = Pitch;
+	ZeroMemory((void*)Scroll->RowDone, Changes->TilesY * sizeof(*Scroll->RowDone));
+
+	DerpNet__Tasks Tasks;
+	DerpNet__TasksStart(&Tasks, Changes->TilesY, Scroll->RowDone, DerpNet__GetThreadCount(0), &Buddy_ScrollCopyTask, Scroll);
+	for (uint32_t Index = 0; Index < Changes->TilesY; Index++)
+	{
+		DerpNet__TasksWait(&Tasks, Index);
+	}
+	DerpNet__TasksFinish(&Tasks);
+
+	Scroll->Frame = NULL;
+}
+
+//
+// lossless overlay
+//
+// H.264 at BUDDY_ENCODE_BITRATE with 4:2:0 chroma blurs small text & colored UI edges. Tiles from change
+// detection that stay unchanged for OVERLAY_STABLE_FRAMES are compressed losslessly, and viewer draws them over
+// decoded video until they change. Tile codec, record queue on sharer & records applied on viewer are in
+// external/TileOverlay.h, this part attaches records to encoded frames & keeps overlay texture up to date.
+//
+// overlay travels inside encoded frames as user data SEI, which decoders ignore - it arrives in order with
+// video over any path, tile is removed exactly on frame where it changed, and older viewers see just video.
+// Keyframe resets overlay on both sides, so after lost frames all tiles are sent again. Can be disabled with
+// LosslessOverlay=0 in config.
+
+// sharer
+
+static void Buddy_CreateOverlayTiles(ScreenBuddy* Buddy)
+{
+	bool Created = Overlay_CreateSharer(&Buddy->OverlayTiles, Buddy->Changes.Width, Buddy->Changes.Height);
+	Assert(Created);
+}
+
+static void Buddy_ReleaseOverlayTiles(ScreenBuddy* Buddy)
+{
+	Overlay_ReleaseSharer(&Buddy->OverlayTiles);
+}
+
+// called for every frame that went through change detection
+static void Buddy_OverlayChanges(ScreenBuddy* Buddy)
+{
+	const Buddy_Changes* Changes = &Buddy->Changes;
+	const ScrollDetect* Scroll = &Buddy->Scroll.Detect;
+
+	Overlay_SharerChanges(&Buddy->OverlayTiles, Changes->Dirty, Changes->DirtyPitch, Scroll->Found ? &Scroll->Rect : NULL, Scroll->DX, Scroll->DY);
+}
+
+// returns new buffer with records for frames up to Time in SEI before first slice, or NULL if there is nothing to add
+static IMFMediaBuffer* Buddy_OverlayAttach(ScreenBuddy* Buddy, LONGLONG Time, const uint8_t* FrameData, uint32_t FrameSize, const H264Info* Info)
+{
+	if (Info->Type == H264_FRAME_IDR)
+	{
+		Overlay_SharerKeyFrame(&Buddy->OverlayTiles);
+		return NULL;
+	}
+
+	// frames that encoder dropped have their records merged into next one
+	uint32_t MaxSize = Overlay_SharerSeiSize(&Buddy->OverlayTiles, Time);
+	if (MaxSize == 0)
+	{
+		return NULL;
+	}
+
+	IMFMediaBuffer* Buffer;
+	HR(MFCreateMemoryBuffer(FrameSize + MaxSize, &Buffer));
+
+	BYTE* Output;
+	HR(IMFMediaBuffer_Lock(Buffer, &Output, NULL, NULL));
+
+	uint32_t Offset = Info->SliceCount ? Info->SliceOffset : FrameSize;
+	CopyMemory(Output, FrameData, Offset);
+
+	uint32_t SeiSize = Overlay_SharerWriteSei(&Buddy->OverlayTiles, Time, Output + Offset);
+	CopyMemory(Output + Offset + SeiSize, FrameData + Offset, FrameSize - Offset);
+
+	HR(IMFMediaBuffer_Unlock(Buffer));
+	HR(IMFMediaBuffer_SetCurrentLength(Buffer, FrameSize + SeiSize));
+	return Buffer;
+}
+
+// viewer
+
+static void Buddy_ReleaseOverlayLayer(ScreenBuddy* Buddy)
+{
+	Overlay_ReleaseLayer(&Buddy->OverlayLayer);
+	if (Buddy->OverlayTexture)
+	{
+		ID3D11Texture2D_Release(Buddy->OverlayTexture);
+		Buddy->OverlayTexture = NULL;
+	}
+}
+
+static void Buddy_CreateOverlayLayer(ScreenBuddy* Buddy, uint32_t Width, uint32_t Height)
+{
+	Buddy_ReleaseOverlayLayer(Buddy);
+
+	bool Created = Overlay_CreateLayer(&Buddy->OverlayLayer, Width, Height);
+	Assert(Created);
+
+	// software presentation reads tiles from memory, otherwise they are copied over decoded texture
+	if (Buddy->Converter)
+	{
+		D3D11_TEXTURE2D_DESC Desc =
+		{
+			.Width = Width,
+			.Height = Height,
+			.MipLevels = 1,
+			.ArraySize = 1,
+			.Format = DXGI_FORMAT_B8G8R8A8_UNORM,
+			.SampleDesc = { 1, 0 },
+			.Usage = D3D11_USAGE_DEFAULT,
+		};
+		HR(ID3D11Device_CreateTexture2D(Buddy->Device, &Desc, NULL, &Buddy->OverlayTexture));
+	}
+}
+
+static void Buddy_OverlayReset(ScreenBuddy* Buddy)
+{
+	Overlay_ResetLayer(&Buddy->OverlayLayer);
+}
+
+// Overlay_UpdateProc, copies new pixels of layer to texture
+static void Buddy_OverlayUpdate(void* Context, uint32_t X, uint32_t Y, uint32_t Width, uint32_t Height)
+{
+	ScreenBuddy* Buddy = Context;
+	if (Buddy->OverlayTexture)
+	{
+		uint32_t Pitch = Buddy->OverlayLayer.Width * 4;
+		D3D11_BOX Box = { X, Y, 0, X + Width, Y + Height, 1 };
+		ID3D11DeviceContext_UpdateSubresource(Buddy->Context, (ID3D11Resource*)Buddy->OverlayTexture, 0, &Box, Buddy->OverlayLayer.Pixels + Y * Pitch + X * 4, Pitch, 0);
+	}
+}
+
+// applies records from SEI found by H264Parse_AccessUnit, data comes from network
+static void Buddy_OverlayApply(ScreenBuddy* Buddy, const uint8_t* Nal, uint32_t NalSize)
+{
+	uint8_t* Payload = HeapAlloc(GetProcessHeap(), 0, NalSize);
+	Assert(Payload);
+
+	const uint8_t* Records;
+	uint32_t RecordsSize, Width, Height;
+	if (Overlay_ParseSei(Nal, NalSize, Payload, &Records, &RecordsSize, &Width, &Height))
+	{
+		if (Width != Buddy->OverlayLayer.Width || Height != Buddy->OverlayLayer.Height)
+		{
+			Buddy_CreateOverlayLayer(Buddy, Width, Height);
+		}
+		Overlay_ApplyRecords(&Buddy->OverlayLayer, Records, RecordsSize, &Buddy_OverlayUpdate, Buddy);
+	}
+
+	HeapFree(GetProcessHeap(), 0, Payload);
+}
+
+// copies runs of overlay tiles over decoded frame in InputView
+static void Buddy_OverlayComposite(ScreenBuddy* Buddy)
+{
+	if (Buddy->OverlayLayer.Count == 0 || !Buddy->OverlayTexture)
+	{
+		return;
+	}
+
+	ID3D11Resource* Target;
+	ID3D11ShaderResourceView_GetResource(Buddy->InputView, &Target);
+
+	D3D11_TEXTURE2D_DESC Desc;
+	ID3D11Texture2D_GetDesc((ID3D11Texture2D*)Target, &Desc);
+
+	uint32_t Width = min(Buddy->OverlayLayer.Width, Desc.Width);
+	uint32_t Height = min(Buddy->OverlayLayer.Height, Desc.Height);
+
+	for (uint32_t TileY = 0; TileY < Buddy->OverlayLayer.TilesY; TileY++)
+	{
+		const uint8_t* Valid = Buddy->OverlayLayer.Valid + TileY * Buddy->OverlayLayer.TilesX;
+		uint32_t TileX = 0;
+		while (TileX < Buddy->OverlayLayer.TilesX)
+		{
+			if (!Valid[TileX])
+			{
+				TileX++;
+				continue;
+			}
+
+			uint32_t Start = TileX;
+			while (TileX < Buddy->OverlayLayer.TilesX && Valid[TileX])
+			{
+				TileX++;
+			}
+
+			D3D11_BOX Box =
+			{
+				.left = Start * BUDDY_CHANGE_TILE,
+				.top = TileY * BUDDY_CHANGE_TILE,
+				.front = 0,
+				.right = min(TileX * BUDDY_CHANGE_TILE, Width),
+				.bottom = min((TileY + 1) * BUDDY_CHANGE_TILE, Height),
+				.back = 1,
+			};
+			if (Box.left < Box.right && Box.top < Box.bottom)
+			{
+				ID3D11DeviceContext_CopySubresourceRegion(Buddy->Context, Target, 0, Box.left, Box.top, 0, (ID3D11Resource*)Buddy->OverlayTexture, 0, &Box);
+			}
+		}
+	}
+
+	ID3D11Resource_Release(Target);
+}
+
+// replaces overlay tiles in converted BGRA row for software presentation
+static void Buddy_OverlayRow(ScreenBuddy* Buddy, uint8_t* Row, uint32_t Y, uint32_t Width)
+{
+	if (Buddy->OverlayLayer.Count == 0 || Y >= Buddy->OverlayLayer.Height)
+	{
+		return;
+	}
+
+	const uint8_t* Valid = Buddy->OverlayLayer.Valid + Y / BUDDY_CHANGE_TILE * Buddy->OverlayLayer.TilesX;
+	const uint8_t* Source = Buddy->OverlayLayer.Pixels + Y * Buddy->OverlayLayer.Width * 4;
+	Width = min(Width, Buddy->OverlayLayer.Width);
+
+	for (uint32_t TileX = 0; TileX < Buddy->OverlayLayer.TilesX && TileX * BUDDY_CHANGE_TILE < Width; TileX++)
+	{
+		if (Valid[TileX])
+		{
+			uint32_t X = TileX * BUDDY_CHANGE_TILE;
+			CopyMemory(Row + X * 4, Source + X * 4, min((uint32_t)BUDDY_CHANGE_TILE, Width - X) * 4);
+		}
+	}
+}
+
+//
+// viewport streaming
+//
+// scaled down desktop makes small text unreadable when viewer's window is much smaller than remote monitor. Viewer
+// can switch to viewport from window system menu - sharer then encodes only part of desktop with size of viewer's
+// window at native resolution, and viewer pans it by clicking or dragging on minimap in corner of window. Viewer
+// sends BUDDY_PACKET_VIEWPORT = [u16 center x][u16 center y][u16 width][u16 height] with center in 1/65536 of desktop
+// size, width 0 turns viewport off. Video Processor MFT reads only cropped rectangle of captured texture, software
+// conversion & change detection read back only cropped rectangle, so captured frame is never copied whole. Panning
+// with same viewport size moves crop rectangle on next frame, new size recreates encoder same way as window resize.
+//
+// while viewport is active, sharer sends desktop thumbnail every BUDDY_THUMB_INTERVAL. GPU reduces captured frame
+// with mip chain, smallest level that fits BUDDY_THUMB_MAX_SIZE is read back, its colors are quantized and only
+// 64x64 tiles that changed since previous thumbnail are sent, compressed same way as overlay tiles.
+// BUDDY_PACKET_THUMBNAIL = [u16 desktop width][u16 desktop height][u16 width][u16 height], followed by
+// [u16 tile index][u8 type][u16 size][data] records, large update is split over several packets.
+
+// viewport in desktop pixels, both sides clamp it same way
+static void Buddy_GetViewport(uint32_t CenterX, uint32_t CenterY, uint32_t Width, uint32_t Height, uint32_t DesktopWidth, uint32_t DesktopHeight, RECT* Rect)
+{
+	ViewRect Viewport;
+	View_GetViewport(CenterX, CenterY, Width, Height, DesktopWidth, DesktopHeight, &Viewport);
+	SetRect(Rect, Viewport.Left, Viewport.Top, Viewport.Right, Viewport.Bottom);
+}
+
+static void Buddy_CreateThumbnail(ScreenBuddy* Buddy, uint32_t Width, uint32_t Height)
+{
+	D3D11_TEXTURE2D_DESC Desc =
+	{
+		.Width = Width,
+		.Height = Height,
+		.MipLevels = 0,
+		.ArraySize = 1,
+		.Format = DXGI_FORMAT_B8G8R8A8_UNORM,
+		.SampleDesc = { 1, 0 },
+		.Usage = D3D11_USAGE_DEFAULT,
+		.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE,
+		.MiscFlags = D3D11_RESOURCE_MISC_GENERATE_MIPS,
+	};
+	HR(ID3D11Device_CreateTexture2D(Buddy->Device, &Desc, NULL, &Buddy->ThumbMips));
+	HR(ID3D11Device_CreateShaderResourceView(Buddy->Device, (ID3D11Resource*)Buddy->ThumbMips, NULL, &Buddy->ThumbMipsView));
+
+	// each mip level is half of previous one, rounded down
+	uint32_t Level = 0;
+	while (max(Width >> Level, Height >> Level) > BUDDY_THUMB_MAX_SIZE)
+	{
+		Level++;
+	}
+	Buddy->ThumbLevel = Level;
+	Buddy->ThumbWidth = max(Width >> Level, 1u);
+	Buddy->ThumbHeight = max(Height >> Level, 1u);
+
+	D3D11_TEXTURE2D_DESC ReadbackDesc =
+	{
+		.Width = Buddy->ThumbWidth,
+		.Height = Buddy->ThumbHeight,
+		.MipLevels = 1,
+		.ArraySize = 1,
+		.Format = DXGI_FORMAT_B8G8R8A8_UNORM,
+		.SampleDesc = { 1, 0 },
+		.Usage = D3D11_USAGE_STAGING,
+		.CPUAccessFlags = D3D11_CPU_ACCESS_READ,
+	};
+	HR(ID3D11Device_CreateTexture2D(Buddy->Device, &ReadbackDesc, NULL, &Buddy->ThumbReadback));
+
+	uint32_t TilesX = (Buddy->ThumbWidth + BUDDY_CHANGE_TILE - 1) / BUDDY_CHANGE_TILE;
+	uint32_t TilesY = (Buddy->ThumbHeight + BUDDY_CHANGE_TILE - 1) / BUDDY_CHANGE_TILE;
+
+	Buddy->ThumbHashes = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, TilesX * TilesY * sizeof(*Buddy->ThumbHashes));
+	Buddy->ThumbPacket = HeapAlloc(GetProcessHeap(), 0, BUDDY_ENCODE_CHUNK_SIZE);
+	Assert(Buddy->ThumbHashes && Buddy->ThumbPacket);
+}
+
+static void Buddy_ReleaseThumbnail(ScreenBuddy* Buddy)
+{
+	if (Buddy->ThumbMips)
+	{
+		ID3D11ShaderResourceView_Release(Buddy->ThumbMipsView);
+		ID3D11Texture2D_Release(Buddy->ThumbMips);
+		ID3D11Texture2D_Release(Buddy->ThumbReadback);
+		HeapFree(GetProcessHeap(), 0, Buddy->ThumbHashes);
+		HeapFree(GetProcessHeap(), 0, Buddy->ThumbPacket);
+
+		Buddy->ThumbMipsView = NULL;
+		Buddy->ThumbMips = NULL;
+		Buddy->ThumbReadback = NULL;
+		Buddy->ThumbHashes = NULL;
+		Buddy->ThumbPacket = NULL;
+	}
+	Buddy->ThumbCurrent = false;
+}
+
+// sharer, only tiles that changed since previous thumbnail are sent
+static void Buddy_SendThumbnail(ScreenBuddy* Buddy)
+{
+	uint32_t CaptureWidth = Buddy->Capture.Rect.right - Buddy->Capture.Rect.left;
+	uint32_t CaptureHeight = Buddy->Capture.Rect.bottom - Buddy->Capture.Rect.top;
+
+	ID3D11DeviceContext* Context = Buddy->Context;
+	ID3D11DeviceContext_GenerateMips(Context, Buddy->ThumbMipsView);
+	ID3D11DeviceContext_CopySubresourceRegion(Context, (ID3D11Resource*)Buddy->ThumbReadback, 0, 0, 0, 0, (ID3D11Resource*)Buddy->ThumbMips, Buddy->ThumbLevel, NULL);
+
+	D3D11_MAPPED_SUBRESOURCE Mapped;
+	HR(ID3D11DeviceContext_Map(Context, (ID3D11Resource*)Buddy->ThumbReadback, 0, D3D11_MAP_READ, 0, &Mapped));
+
+	uint32_t Width = Buddy->ThumbWidth;
+	uint32_t Height = Buddy->ThumbHeight;
+	uint32_t TilesX = (Width + BUDDY_CHANGE_TILE - 1) / BUDDY_CHANGE_TILE;
+	uint32_t TilesY = (Height + BUDDY_CHANGE_TILE - 1) / BUDDY_CHANGE_TILE;
+
+	uint16_t Header[4] = { (uint16_t)CaptureWidth, (uint16_t)CaptureHeight, (uint16_t)Width, (uint16_t)Height };
+
+	uint8_t* Packet = Buddy->ThumbPacket;
+	Packet[0] = BUDDY_PACKET_THUMBNAIL;
+	CopyMemory(Packet + 1, Header, sizeof(Header));
+	uint32_t Size = BUDDY_THUMB_HEADER;
+
+	uint32_t Tile[BUDDY_CHANGE_TILE * BUDDY_CHANGE_TILE];
+	for (uint32_t TileY = 0; TileY < TilesY; TileY++)
+	{
+		for (uint32_t TileX = 0; TileX < TilesX; TileX++)
+		{
+			uint32_t X = TileX * BUDDY_CHANGE_TILE;
+			uint32_t Y = TileY * BUDDY_CHANGE_TILE;
+			uint32_t TileWidth = min((uint32_t)BUDDY_CHANGE_TILE, Width - X);
+			uint32_t TileHeight = min((uint32_t)BUDDY_CHANGE_TILE, Height - Y);
+
+			// FNV-1a of quantized colors, 0 is for tiles not sent yet
+			uint32_t Hash = 2166136261u;
+			for (uint32_t Row = 0; Row < TileHeight; Row++)
+			{
+				const uint32_t* Source = (const uint32_t*)((const uint8_t*)Mapped.pData + (Y + Row) * Mapped.RowPitch) + X;
+				for (uint32_t Column = 0; Column < TileWidth; Column++)
+				{
+					uint32_t Color = Source[Column] & BUDDY_THUMB_COLOR_MASK;
+					Tile[Row * BUDDY_CHANGE_TILE + Column] = Color;
+					Hash = (Hash ^ Color) * 16777619u;
+				}
+			}
+			Hash |= 1;
+
+			uint32_t Index = TileY * TilesX + TileX;
+			if (Buddy->ThumbHashes[Index] == Hash)
+			{
+				continue;
+			}
+
+			uint8_t Type;
+			uint32_t Encoded = Overlay_EncodeTile((uint8_t*)Tile, BUDDY_CHANGE_TILE * 4, TileWidth, TileHeight, Packet + Size + BUDDY_THUMB_RECORD, BUDDY_ENCODE_CHUNK_SIZE - Size - BUDDY_THUMB_RECORD, &Type);
+			if (Encoded == 0 && Size != BUDDY_THUMB_HEADER)
+			{
+				// packet is full, tile goes to next one - failure here will be noticed by next receive
+				DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, Packet, Size);
+				Size = BUDDY_THUMB_HEADER;
+				Encoded = Overlay_EncodeTile((uint8_t*)Tile, BUDDY_CHANGE_TILE * 4, TileWidth, TileHeight, Packet + Size + BUDDY_THUMB_RECORD, BUDDY_ENCODE_CHUNK_SIZE - Size - BUDDY_THUMB_RECORD, &Type);
+			}
+			Assert(Encoded);
+
+			uint16_t TileIndex = (uint16_t)Index;
+			uint16_t TileSize = (uint16_t)Encoded;
+			CopyMemory(Packet + Size, &TileIndex, sizeof(TileIndex));
+			Packet[Size + 2] = Type;
+			CopyMemory(Packet + Size + 3, &TileSize, sizeof(TileSize));
+			Size += BUDDY_THUMB_RECORD + Encoded;
+
+			Buddy->ThumbHashes[Index] = Hash;
+		}
+	}
+
+	ID3D11DeviceContext_Unmap(Context, (ID3D11Resource*)Buddy->ThumbReadback, 0);
+
+	if (Size != BUDDY_THUMB_HEADER)
+	{
+		// failure here will be noticed by next receive
+		DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, Packet, Size);
+	}
+	Buddy->ThumbTime = GetTickCount64();
+}
+
+// sharer, captured frame is kept for thumbnail, and for encoding moved viewport when desktop does not change. Whole
+// frame is copied only when thumbnail is due, other frames copy only viewport that is encoded, so moved viewport is
+// current where it overlaps previous one, and rest of it is at most from last thumbnail until next captured frame
+static void Buddy_ViewportFrame(ScreenBuddy* Buddy, ID3D11Texture2D* Texture)
+{
+	uint32_t CaptureWidth = Buddy->Capture.Rect.right - Buddy->Capture.Rect.left;
+	uint32_t CaptureHeight = Buddy->Capture.Rect.bottom - Buddy->Capture.Rect.top;
+
+	if (!Buddy->ThumbMips)
+	{
+		Buddy_CreateThumbnail(Buddy, CaptureWidth, CaptureHeight);
+	}
+
+	bool ThumbDue = !Buddy->NetMigrating && GetTickCount64() - Buddy->ThumbTime >= BUDDY_THUMB_INTERVAL;
+	if (ThumbDue)
+	{
+		D3D11_BOX Box = { 0, 0, 0, CaptureWidth, CaptureHeight, 1 };
+		ID3D11DeviceContext_CopySubresourceRegion(Buddy->Context, (ID3D11Resource*)Buddy->ThumbMips, 0, 0, 0, 0, (ID3D11Resource*)Texture, 0, &Box);
+		Buddy->ThumbCurrent = true;
+
+		Buddy_SendThumbnail(Buddy);
+	}
+	else if (Buddy->ThumbCurrent)
+	{
+		const RECT* Crop = &Buddy->EncodeCrop;
+		D3D11_BOX Box = { Crop->left, Crop->top, 0, Crop->right, Crop->bottom, 1 };
+		ID3D11DeviceContext_CopySubresourceRegion(Buddy->Context, (ID3D11Resource*)Buddy->ThumbMips, 0, Crop->left, Crop->top, 0, (ID3D11Resource*)Texture, 0, &Box);
+	}
+}
+
+static void Buddy_ReleaseMinimap(ScreenBuddy* Buddy)
+{
+	if (Buddy->ThumbTexture)
+	{
+		ID3D11ShaderResourceView_Release(Buddy->ThumbView);
+		ID3D11Texture2D_Release(Buddy->ThumbTexture);
+		HeapFree(GetProcessHeap(), 0, Buddy->ThumbPixels);
+		HeapFree(GetProcessHeap(), 0, Buddy->ThumbFrame);
+
+		Buddy->ThumbView = NULL;
+		Buddy->ThumbTexture = NULL;
+		Buddy->ThumbPixels = NULL;
+		Buddy->ThumbFrame = NULL;
+	}
+	Buddy->ThumbWidth = 0;
+	Buddy->ThumbHeight = 0;
+}
+
+static void Buddy_CreateMinimap(ScreenBuddy* Buddy, uint32_t Width, uint32_t Height)
+{
+	Buddy_ReleaseMinimap(Buddy);
+
+	D3D11_TEXTURE2D_DESC Desc =
+	{
+		.Width = Width,
+		.Height = Height,
+		.MipLevels = 1,
+		.ArraySize = 1,
+		.Format = DXGI_FORMAT_B8G8R8A8_UNORM,
+		.SampleDesc = { 1, 0 },
+		.Usage = D3D11_USAGE_DEFAULT,
+		.BindFlags = D3D11_BIND_SHADER_RESOURCE,
+	};
+	HR(ID3D11Device_CreateTexture2D(Buddy->Device, &Desc, NULL, &Buddy->ThumbTexture));
+	HR(ID3D11Device_CreateShaderResourceView(Buddy->Device, (ID3D11Resource*)Buddy->ThumbTexture, NULL, &Buddy->ThumbView));
+
+	// black until tiles arrive
+	Buddy->ThumbPixels = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, Width * Height * 4);
+	Buddy->ThumbFrame = HeapAlloc(GetProcessHeap(), 0, Width * Height * 4);
+	Assert(Buddy->ThumbPixels && Buddy->ThumbFrame);
+
+	Buddy->ThumbWidth = Width;
+	Buddy->ThumbHeight = Height;
+}
+
+// viewer, minimap is in bottom right corner of window, false when it is not shown
+static bool Buddy_GetMinimapRect(ScreenBuddy* Buddy, RECT* Rect)
+{
+	if (!Buddy->ViewZoom || !Buddy->ThumbTexture)
+	{
+		return false;
+	}
+
+	RECT ClientRect;
+	GetClientRect(Buddy->MainWindow, &ClientRect);
+
+	int Right = ClientRect.right - BUDDY_THUMB_MARGIN;
+	int Bottom = ClientRect.bottom - BUDDY_THUMB_MARGIN;
+	SetRect(Rect, Right - (int)Buddy->ThumbWidth, Bottom - (int)Buddy->ThumbHeight, Right, Bottom);
+
+	return Rect->left >= BUDDY_THUMB_MARGIN && Rect->top >= BUDDY_THUMB_MARGIN;
+}
+
+// thumbnail with viewport rectangle on top, uploaded to texture
+static void Buddy_UpdateMinimap(ScreenBuddy* Buddy)
+{
+	uint32_t Width = Buddy->ThumbWidth;
+	uint32_t Height = Buddy->ThumbHeight;
+
+	// quantized colors are expanded back to full range, so white stays white
+	const uint32_t* Source = (const uint32_t*)Buddy->ThumbPixels;
+	uint32_t* Pixels = (uint32_t*)Buddy->ThumbFrame;
+	for (uint32_t Index = 0; Index < Width * Height; Index++)
+	{
+		uint32_t Color = Source[Index] & BUDDY_THUMB_COLOR_MASK;
+		Pixels[Index] = Color | (Color >> 4);
+	}
+
+	ViewRect Viewport;
+	View_GetViewport(Buddy->ViewCenterX, Buddy->ViewCenterY, Buddy->ViewWidth, Buddy->ViewHeight, Buddy->DesktopWidth, Buddy->DesktopHeight, &Viewport);
+
+	// clamped to thumbnail, so it never writes outside of it
+	ViewRect Rect;
+	View_GetOutline(&Viewport, Buddy->DesktopWidth, Buddy->DesktopHeight, Width, Height, &Rect);
+
+	uint32_t Outline = 0xffffc000;
+	for (int X = Rect.Left; X < Rect.Right; X++)
+	{
+		Pixels[Rect.Top * Width + X] = Outline;
+		Pixels[(Rect.Bottom - 1) * Width + X] = Outline;
+	}
+	for (int Y = Rect.Top; Y < Rect.Bottom; Y++)
+	{
+		Pixels[Y * Width + Rect.Left] = Outline;
+		Pixels[Y * Width + Rect.Right - 1] = Outline;
+	}
+
+	ID3D11DeviceContext_UpdateSubresource(Buddy->Context, (ID3D11Resource*)Buddy->ThumbTexture, 0, NULL, Pixels, Width * 4, 0);
+	Buddy->ThumbDirty = false;
+}
+
+// viewer, decodes changed tiles into thumbnail
+static void Buddy_OnThumbnail(ScreenBuddy* Buddy, const uint8_t* Data, uint32_t Size)
+{
+	uint16_t Header[4];
+	if (Size < sizeof(Header))
+	{
+		return;
+	}
+	CopyMemory(Header, Data, sizeof(Header));
+
+	uint32_t Width = Header[2];
+	uint32_t Height = Header[3];
+	// thumbnail is mip level of desktop, never larger than it - minimap outline is scaled from desktop to thumbnail
+	if (Header[0] < Width || Header[1] < Height || Width == 0 || Height == 0 || Width > BUDDY_THUMB_MAX_SIZE || Height > BUDDY_THUMB_MAX_SIZE)
+	{
+		return;
+	}
+
+	if (Width != Buddy->ThumbWidth || Height != Buddy->ThumbHeight)
+	{
+		Buddy_CreateMinimap(Buddy, Width, Height);
+	}
+	Buddy->DesktopWidth = Header[0];
+	Buddy->DesktopHeight = Header[1];
+
+	uint32_t TilesX = (Width + BUDDY_CHANGE_TILE - 1) / BUDDY_CHANGE_TILE;
+	uint32_t TilesY = (Height + BUDDY_CHANGE_TILE - 1) / BUDDY_CHANGE_TILE;
+
+	const uint8_t* Record = Data + sizeof(Header);
+	const uint8_t* End = Data + Size;
+	while (End - Record >= BUDDY_THUMB_RECORD)
+	{
+		uint16_t Index;
+		uint16_t TileSize;
+		CopyMemory(&Index, Record, sizeof(Index));
+		uint8_t Type = Record[2];
+		CopyMemory(&TileSize, Record + 3, sizeof(TileSize));
+		Record += BUDDY_THUMB_RECORD;
+
+		if (Index >= TilesX * TilesY || TileSize > End - Record)
+		{
+			break;
+		}
+
+		uint32_t X = Index % TilesX * BUDDY_CHANGE_TILE;
+		uint32_t Y = Index / TilesX * BUDDY_CHANGE_TILE;
+		uint32_t TileWidth = min((uint32_t)BUDDY_CHANGE_TILE, Width - X);
+		uint32_t TileHeight = min((uint32_t)BUDDY_CHANGE_TILE, Height - Y);
+
+		if (!Overlay_DecodeTile(Type, Record, TileSize, Buddy->ThumbPixels + (Y * Width + X) * 4, Width * 4, TileWidth, TileHeight))
+		{
+			break;
+		}
+		Record += TileSize;
+	}
+
+	Buddy->ThumbDirty = true;
+	InvalidateRect(Buddy->MainWindow, NULL, FALSE);
+}
+
+// viewer, reports window size, or viewport when it is active
+static void Buddy_SendView(ScreenBuddy* Buddy, uint32_t Width, uint32_t Height)
+{
+	uint16_t View[4] = { Buddy->ViewCenterX, Buddy->ViewCenterY, (uint16_t)min(Width, 0xffff), (uint16_t)min(Height, 0xffff) };
+
+	uint8_t Data[1 + sizeof(View)];
+	uint32_t Size;
+	if (Buddy->ViewZoom)
+	{
+		Data[0] = BUDDY_PACKET_VIEWPORT;
+		CopyMemory(Data + 1, View, sizeof(View));
+		Size = 1 + sizeof(View);
+	}
+	else
+	{
+		Data[0] = BUDDY_PACKET_VIEW_SIZE;
+		CopyMemory(Data + 1, View + 2, 2 * sizeof(View[0]));
+		Size = 1 + 2 * sizeof(View[0]);
+	}
+
+	// failure here will be noticed by next receive
+	DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, Data, Size);
+
+	Buddy->ViewWidth = Width;
+	Buddy->ViewHeight = Height;
+	Buddy->ThumbDirty = true;
+}
+
+// viewer, switches between whole desktop & viewport from window system menu
+static void Buddy_ToggleViewport(ScreenBuddy* Buddy)
+{
+	if (Buddy->State != BUDDY_STATE_CONNECTED || !Buddy->NetOpen || Buddy->NetMigrating)
+	{
+		return;
+	}
+
+	if (Buddy->ViewZoom)
+	{
+		// width 0 turns viewport off, then window size is reported again as it may have changed meanwhile
+		uint8_t Data[1 + 4 * sizeof(uint16_t)] = { BUDDY_PACKET_VIEWPORT };
+		DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, Data, sizeof(Data));
+		Buddy->ViewZoom = false;
+		Buddy->ViewDrag = false;
+	}
+	else
+	{
+		Buddy->ViewZoom = true;
+	}
+
+	RECT Rect;
+	GetClientRect(Buddy->MainWindow, &Rect);
+	Buddy->ViewNextWidth = max(Rect.right - Rect.left, 1);
+	Buddy->ViewNextHeight = max(Rect.bottom - Rect.top, 1);
+	Buddy_SendView(Buddy, Buddy->ViewNextWidth, Buddy->ViewNextHeight);
+
+	CheckMenuItem(GetSystemMenu(Buddy->MainWindow, FALSE), BUDDY_ID_VIEWPORT, MF_BYCOMMAND | (Buddy->ViewZoom ? MF_CHECKED : MF_UNCHECKED));
+	InvalidateRect(Buddy->MainWindow, NULL, FALSE);
+}
+
+// viewer, click or drag on minimap centers viewport there
+static void Buddy_PanViewport(ScreenBuddy* Buddy, const RECT* Minimap, int X, int Y)
+{
+	int CenterX = MulDiv(X - Minimap->left, 65536, Minimap->right - Minimap->left);
+	int CenterY = MulDiv(Y - Minimap->top, 65536, Minimap->bottom - Minimap->top);
+	Buddy->ViewCenterX = (uint16_t)max(0, min(CenterX, 0xffff));
+	Buddy->ViewCenterY = (uint16_t)max(0, min(CenterY, 0xffff));
+
+	if (Buddy->State == BUDDY_STATE_CONNECTED && Buddy->NetOpen && !Buddy->NetMigrating)
+	{
+		Buddy_SendView(Buddy, Buddy->ViewWidth, Buddy->ViewHeight);
+	}
+	InvalidateRect(Buddy->MainWindow, NULL, FALSE);
+}
+
+// Video Processor MFT input is whole captured texture
+static IMFMediaType* Buddy_CreateCaptureType(int Width, int Height)
+{
+	IMFMediaType* Type;
+	HR(MFCreateMediaType(&Type));
+	HR(IMFMediaType_SetGUID(Type, &MF_MT_MAJOR_TYPE, &MFMediaType_Video));
+	HR(IMFMediaType_SetGUID(Type, &MF_MT_SUBTYPE, &MFVideoFormat_RGB32));
+	HR(IMFMediaType_SetUINT32(Type, &MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive));
+	HR(IMFMediaType_SetUINT64(Type, &MF_MT_FRAME_RATE, MF64(BUDDY_ENCODE_FRAMERATE, 1)));
+	HR(IMFMediaType_SetUINT64(Type, &MF_MT_FRAME_SIZE, MF64(Width, Height)));
+	return Type;
+}
+
+// Video Processor MFT reads only this part of captured texture, without copying it first
+static void Buddy_SetConverterCrop(IMFTransform* Converter, const RECT* Crop)
+{
+	IMFVideoProcessorControl* Control;
+	HR(IMFTransform_QueryInterface(Converter, &IID_IMFVideoProcessorControl, (void**)&Control));
+	HR(IMFVideoProcessorControl_SetSourceRectangle(Control, (RECT*)Crop));
+	IMFVideoProcessorControl_Release(Control);
+}
+
+// cropped part of captured frames is scaled to encode size by Video Processor MFT, or on CPU with software conversion
+static bool Buddy_CreateEncoder(ScreenBuddy* Buddy, const RECT* Crop, int EncodeWidth, int EncodeHeight)
+{
+	int CaptureWidth = Buddy->Capture.Rect.right - Buddy->Capture.Rect.left;
+	int CaptureHeight = Buddy->Capture.Rect.bottom - Buddy->Capture.Rect.top;
+	int InputWidth = Crop->right - Crop->left;
+	int InputHeight = Crop->bottom - Crop->top;
+
+	MFT_REGISTER_TYPE_INFO Input = { .guidMajorType = MFMediaType_Video, .guidSubtype = MFVideoFormat_NV12 };
+	MFT_REGISTER_TYPE_INFO Output = { .guidMajorType = MFMediaType_Video, .guidSubtype = MFVideoFormat_H264 };
+
+	DXGI_ADAPTER_DESC AdapterDesc;
+	{
+		IDXGIDevice* DxgiDevice;
+		HR(ID3D11Device_QueryInterface(Buddy->Device, &IID_IDXGIDevice, (void**)&DxgiDevice));
+
+		IDXGIAdapter* DxgiAdapter;
+		HR(IDXGIDevice_GetAdapter(DxgiDevice, &DxgiAdapter));
+
+		IDXGIAdapter_GetDesc(DxgiAdapter, &AdapterDesc);
+
+		IDXGIAdapter_Release(DxgiAdapter);
+		IDXGIDevice_Release(DxgiDevice);
+	}
+
+	IMFAttributes* EnumAttributes;
+	HR(MFCreateAttributes(&EnumAttributes, 1));
+	HR(IMFAttributes_SetBlob(EnumAttributes, &MFT_ENUM_ADAPTER_LUID, (UINT8*)&AdapterDesc.AdapterLuid, sizeof(AdapterDesc.AdapterLuid)));
+
+	IMFActivate** Activate;
+	UINT32 ActivateCount;
+	HR(MFTEnum2(MFT_CATEGORY_VIDEO_ENCODER, MFT_ENUM_FLAG_ASYNCMFT | MFT_ENUM_FLAG_HARDWARE | MFT_ENUM_FLAG_SORTANDFILTER, &Input, &Output, EnumAttributes, &Activate, &ActivateCount));
+	IMFAttributes_Release(EnumAttributes);
+
+	if (ActivateCount == 0)
+	{
+		MessageBoxW(Buddy->DialogWindow, L"Cannot create GPU encoder!", L"Error", MB_ICONERROR);
+		return false;
+	}
+
+	//wchar_t Name[256];
+	//HR(IMFActivate_GetString(Activate[0], &MFT_FRIENDLY_NAME_Attribute, Name, ARRAYSIZE(Name), NULL));
+	//OutputDebugStringW(Name);
+
+	IMFTransform* Encoder;
+	HR(IMFActivate_ActivateObject(Activate[0], &IID_IMFTransform, (void**)&Encoder));
+	for (UINT32 Index = 0; Index < ActivateCount; Index++)
+	{
+		IMFActivate_Release(Activate[Index]);
+	}
+	CoTaskMemFree(Activate);
+
+	// without Video Processor MFT frames are converted on CPU
+	IMFTransform* Converter = NULL;
+	if (!Buddy->ConvertSoftware && FAILED(CoCreateInstance(&CLSID_VideoProcessorMFT, NULL, CLSCTX_INPROC_SERVER, &IID_IMFTransform, (void**)&Converter)))
+	{
+		Converter = NULL;
+	}
+
+	if (Converter)
+	{
+		IMFAttributes* Attributes;
+		HR(IMFTransform_GetAttributes(Converter, &Attributes));
+		HR(IMFAttributes_SetUINT32(Attributes, &MF_XVP_PLAYBACK_MODE, TRUE));
+		HR(IMFAttributes_SetUINT32(Attributes, &MF_XVP_CALLER_ALLOCATES_OUTPUT, TRUE));
+		IMFAttributes_Release(Attributes);
+	}
+	else
+	{
+		Buddy_CreateSoftwareConverter(Buddy, EncodeWidth, EncodeHeight);
+		if (EncodeWidth != InputWidth || EncodeHeight != InputHeight)
+		{
+			Buddy_CreateFrameScaler(Buddy, InputWidth, InputHeight, EncodeWidth, EncodeHeight);
+		}
+	}
+
+	// with Video Processor MFT frame stays on GPU, and readback for change detection would stall on Map every frame
+	Buddy->ChangeDetect = Buddy->ChangeConfig == BUDDY_CHANGE_AUTO ? !Converter : Buddy->ChangeConfig != 0;
+	if (!Converter || Buddy->ChangeDetect)
+	{
+		Buddy_CreateCaptureReadback(Buddy, InputWidth, InputHeight);
+	}
+
+	// changes are tracked in captured frame, overlay tiles would not match scaled video
+	if (Buddy->ChangeDetect)
+	{
+		Buddy_CreateChanges(&Buddy->Changes, InputWidth, InputHeight);
+		if (Buddy->ScrollDetect)
+		{
+			Buddy_CreateScroll(&Buddy->Scroll, InputWidth, InputHeight);
+		}
+		if (Buddy->OverlayEnabled && EncodeWidth == InputWidth && EncodeHeight == InputHeight)
+		{
+			Buddy_CreateOverlayTiles(Buddy);
+		}
+	}
+	Buddy->ChangeStatic = 0;
+	Buddy->ChangeSkipped = 0;
+
+	// unlock async encoder
+	{
+		IMFAttributes* Attributes;
+		HR(IMFTransform_GetAttributes(Encoder, &Attributes));
+
+		UINT32 IsAsync;
+		HR(IMFAttributes_GetUINT32(Attributes, &MF_TRANSFORM_ASYNC, &IsAsync));
+		Assert(IsAsync);
+
+		HR(IMFAttributes_SetUINT32(Attributes, &MF_TRANSFORM_ASYNC_UNLOCK, TRUE));
+		IMFAttributes_Release(Attributes);
+	}
+
+	IMFDXGIDeviceManager* Manager;
+	{
+		UINT Token;
+		HR(MFCreateDXGIDeviceManager(&Token, &Manager));
+		HR(IMFDXGIDeviceManager_ResetDevice(Manager, (IUnknown*)Buddy->Device, Token));
+		HR(IMFTransform_ProcessMessage(Encoder, MFT_MESSAGE_SET_D3D_MANAGER, (ULONG_PTR)Manager));
+		if (Converter)
+		{
+			HR(IMFTransform_ProcessMessage(Converter, MFT_MESSAGE_SET_D3D_MANAGER, (ULONG_PTR)Manager));
+		}
+	}
+
+	// enable low latency for encoder, no B-frames, max GOP size
+	{
+		ICodecAPI* Codec;
+		HR(IMFTransform_QueryInterface(Encoder, &IID_ICodecAPI, (void**)&Codec));
+
+		VARIANT LowLatency = { .vt = VT_BOOL, .boolVal = VARIANT_TRUE };
+		HR(ICodecAPI_SetValue(Codec, &CODECAPI_AVLowLatencyMode, &LowLatency));
+
+		VARIANT NoBFrames = { .vt = VT_UI4, .ulVal = 0 };
+		ICodecAPI_SetValue(Codec, &CODECAPI_AVEncMPVDefaultBPictureCount, &NoBFrames);
+
+		VARIANT GopMin, GopMax, GopDelta;
+		if (SUCCEEDED(ICodecAPI_GetParameterRange(Codec, &CODECAPI_AVEncMPVGOPSize, &GopMin, &GopMax, &GopDelta)))
+		{
+			HR(ICodecAPI_SetValue(Codec, &CODECAPI_AVEncMPVGOPSize, &GopMax));
+			VariantClear(&GopMin);
+			VariantClear(&GopMax);
+			VariantClear(&GopDelta);
+		}
+		else
+		{
+			VARIANT GopSize = { .vt = VT_UI4, .ulVal = BUDDY_ENCODE_FRAMERATE * 3600 };
+			ICodecAPI_SetValue(Codec, &CODECAPI_AVEncMPVGOPSize, &GopSize);
+		}
+
+		// not all encoders support ROI, changed region then gets same quality as rest of frame
+		VARIANT Roi = { .vt = VT_UI4, .ulVal = 1 };
+		Buddy->ChangeRoi = Buddy->ChangeDetect && SUCCEEDED(ICodecAPI_SetValue(Codec, &CODECAPI_AVEncVideoROIEnabled, &Roi));
+
+		ICodecAPI_Release(Codec);
+	}
+
+	IMFMediaType* InputType = Buddy_CreateCaptureType(CaptureWidth, CaptureHeight);
+
+	IMFMediaType* ConvertedType;
+	HR(MFCreateMediaType(&ConvertedType));
+	HR(IMFMediaType_SetGUID(ConvertedType, &MF_MT_MAJOR_TYPE, &MFMediaType_Video));
+	HR(IMFMediaType_SetGUID(ConvertedType, &MF_MT_SUBTYPE, &MFVideoFormat_NV12));
+	HR(IMFMediaType_SetUINT32(ConvertedType, &MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive));
+	HR(IMFMediaType_SetUINT64(ConvertedType, &MF_MT_FRAME_RATE, MF64(BUDDY_ENCODE_FRAMERATE, 1)));
+	HR(IMFMediaType_SetUINT64(ConvertedType, &MF_MT_FRAME_SIZE, MF64(EncodeWidth, EncodeHeight)));
+	HR(IMFMediaType_SetUINT32(ConvertedType, &MF_MT_YUV_MATRIX, Buddy->ConvertBt709 ? MFVideoTransferMatrix_BT709 : MFVideoTransferMatrix_BT601));
+	HR(IMFMediaType_SetUINT32(ConvertedType, &MF_MT_VIDEO_NOMINAL_RANGE, Buddy->ConvertFullRange ? MFNominalRange_0_255 : MFNominalRange_16_235));
+	HR(IMFMediaType_SetUINT32(ConvertedType, &MF_MT_VIDEO_CHROMA_SITING, MFVideoChromaSubsampling_MPEG2));
+
+	IMFMediaType* OutputType;
+	HR(MFCreateMediaType(&OutputType));
+	HR(IMFMediaType_SetGUID(OutputType, &MF_MT_MAJOR_TYPE, &MFMediaType_Video));
+	HR(IMFMediaType_SetGUID(OutputType, &MF_MT_SUBTYPE, &MFVideoFormat_H264));
+	HR(IMFMediaType_SetUINT32(OutputType, &MF_MT_MPEG2_PROFILE, eAVEncH264VProfile_High));
+	HR(IMFMediaType_SetUINT32(OutputType, &MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive));
+	HR(IMFMediaType_SetUINT32(OutputType, &MF_MT_AVG_BITRATE, BUDDY_ENCODE_BITRATE));
+	HR(IMFMediaType_SetUINT64(OutputType, &MF_MT_FRAME_RATE, MF64(BUDDY_ENCODE_FRAMERATE, 1)));
+	HR(IMFMediaType_SetUINT64(OutputType, &MF_MT_FRAME_SIZE, MF64(EncodeWidth, EncodeHeight)));
+	HR(IMFMediaType_SetUINT64(OutputType, &MF_MT_PIXEL_ASPECT_RATIO, MF64(1, 1)));
+
+	MFT_OUTPUT_STREAM_INFO OutputInfo;
+
+	if (Converter)
+	{
+		HR(IMFTransform_SetOutputType(Converter, 0, ConvertedType, 0));
+		HR(IMFTransform_SetInputType(Converter, 0, InputType, 0));
+
+		HR(IMFTransform_GetOutputStreamInfo(Converter, 0, &OutputInfo));
+		Assert((OutputInfo.dwFlags & MFT_OUTPUT_STREAM_PROVIDES_SAMPLES) == 0);
+
+		Buddy_SetConverterCrop(Converter, Crop);
+	}
+
+	HR(IMFTransform_SetOutputType(Encoder, 0, OutputType, 0));
+	HR(IMFTransform_SetInputType(Encoder, 0, ConvertedType, 0));
+
+	HR(IMFTransform_GetOutputStreamInfo(Encoder, 0, &OutputInfo));
+	Assert(OutputInfo.dwFlags & MFT_OUTPUT_STREAM_PROVIDES_SAMPLES);
+
+	if (Converter)
+	{
+		HR(IMFTransform_ProcessMessage(Converter, MFT_MESSAGE_NOTIFY_START_OF_STREAM, 0));
+	}
+	HR(IMFTransform_ProcessMessage(Encoder, MFT_MESSAGE_NOTIFY_START_OF_STREAM, 0));
+
+	static IMFAsyncCallbackVtbl Buddy__IMFAsyncCallbackVtbl =
+	{
+		.QueryInterface = &Buddy__QueryInterface,
+		.AddRef         = &Buddy__AddRef,
+		.Release        = &Buddy__Release,
+		.GetParameters  = &Buddy__GetParameters,
+		.Invoke         = &Buddy__Invoke,
+	};
+	Buddy->EventCallback.lpVtbl = &Buddy__IMFAsyncCallbackVtbl;
+
+	IMFVideoSampleAllocatorEx* SampleAllocator;
+	HR(MFCreateVideoSampleAllocatorEx(&IID_IMFVideoSampleAllocatorEx, (void**)&SampleAllocator));
+	HR(IMFVideoSampleAllocatorEx_SetDirectXManager(SampleAllocator, (IUnknown*)Manager));
+	{
+		IMFAttributes* Attributes;
+		HR(MFCreateAttributes(&Attributes, 2));
+		HR(IMFAttributes_SetUINT32(Attributes, &MF_SA_D3D11_BINDFLAGS, D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE));
+		HR(IMFAttributes_SetUINT32(Attributes, &MF_SA_D3D11_USAGE, D3D11_USAGE_DEFAULT));
+		HR(IMFVideoSampleAllocatorEx_InitializeSampleAllocatorEx(SampleAllocator, 0, BUDDY_ENCODE_QUEUE_SIZE, Attributes, ConvertedType));
+		IMFAttributes_Release(Attributes);
+	}
+
+	IMFMediaType_Release(InputType);
+	IMFMediaType_Release(ConvertedType);
+	IMFMediaType_Release(OutputType);
+	IMFDXGIDeviceManager_Release(Manager);
+
+	Buddy->EncodeWaitingForInput = false;
+	Buddy->EncodeQueueRead = 0;
+	Buddy->EncodeQueueWrite = 0;
+
+	Buddy->EncodeNextTime = 0;
+	Buddy->EncodeFirstTime = 0;
+	Buddy->EncodeWidth = EncodeWidth;
+	Buddy->EncodeHeight = EncodeHeight;
+	Buddy->EncodeCrop = *Crop;
+
+	Buddy->EncodeSampleAllocator = SampleAllocator;
+	Buddy->Codec = Encoder;
+	Buddy->Converter = Converter;
+	HR(IMFTransform_QueryInterface(Encoder, &IID_IMFMediaEventGenerator, (void**)&Buddy->Generator));
+
+	return true;
+}
+
+static bool Buddy_ResetDecoder(IMFTransform* Decoder, IMFTransform* Converter)
+{
+	DWORD DecodedIndex = 0;
+	IMFMediaType* DecodedType = NULL;
+	while (SUCCEEDED(IMFTransform_GetOutputAvailableType(Decoder, 0, DecodedIndex, &DecodedType)))
+	{
+		GUID Format;
+		if (SUCCEEDED(IMFMediaType_GetGUID(DecodedType, &MF_MT_SUBTYPE, &Format)))
+		{
+			if (IsEqualGUID(&Format, &MFVideoFormat_NV12))
+			{
+				break;
+			}
+			IMFMediaType_Release(DecodedType);
+			DecodedType = NULL;
+		}
+		DecodedIndex++;
+	}
+	Assert(DecodedType);
+
+	HR(IMFTransform_SetOutputType(Decoder, 0, DecodedType, 0));
+
+	// software presentation reads decoded NV12 directly
+	if (Converter)
+	{
+		HR(IMFTransform_SetInputType(Converter, 0, DecodedType, 0));
+
+		UINT64 FrameRate;
+		HR(IMFMediaType_GetUINT64(DecodedType, &MF_MT_FRAME_RATE, &FrameRate));
+
+		UINT64 FrameSize;
+		HR(IMFMediaType_GetUINT64(DecodedType, &MF_MT_FRAME_SIZE, &FrameSize));
+
+		IMFMediaType* OutputType;
+		HR(MFCreateMediaType(&OutputType));
+		HR(IMFMediaType_SetGUID(OutputType, &MF_MT_MAJOR_TYPE, &MFMediaType_Video));
+		HR(IMFMediaType_SetGUID(OutputType, &MF_MT_SUBTYPE, &MFVideoFormat_RGB32));
+		HR(IMFMediaType_SetUINT32(OutputType, &MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive));
+		HR(IMFMediaType_SetUINT64(OutputType, &MF_MT_FRAME_RATE, FrameRate));
+		HR(IMFMediaType_SetUINT64(OutputType, &MF_MT_FRAME_SIZE, FrameSize));
+		HR(IMFTransform_SetOutputType(Converter, 0, OutputType, 0));
+		IMFMediaType_Release(OutputType);
+	}
+
+	IMFMediaType_Release(DecodedType);
+
+	return true;
+}
+
+static bool Buddy_CreateDecoder(ScreenBuddy* Buddy)
+{
+	MFT_REGISTER_TYPE_INFO Input = { .guidMajorType = MFMediaType_Video, .guidSubtype = MFVideoFormat_H264 };
+	MFT_REGISTER_TYPE_INFO Output = { .guidMajorType = MFMediaType_Video, .guidSubtype = MFVideoFormat_NV12 };
+
+	IMFActivate** Activate;
+	UINT32 ActivateCount;
+	HR(MFTEnumEx(MFT_CATEGORY_VIDEO_DECODER, MFT_ENUM_FLAG_SYNCMFT | MFT_ENUM_FLAG_SORTANDFILTER, &Input, &Output, &Activate, &ActivateCount));
+
+	if (ActivateCount == 0)
+	{
+		MessageBoxW(Buddy->DialogWindow, L"Cannot create GPU decoder!", L"Error", MB_ICONERROR);
+		return false;
+	}
+
+	IMFTransform* Decoder;
+	HR(IMFActivate_ActivateObject(Activate[0], &IID_IMFTransform, (void**)&Decoder));
+	for (UINT32 Index = 0; Index < ActivateCount; Index++)
+	{
+		IMFActivate_Release(Activate[Index]);
+	}
+	CoTaskMemFree(Activate);
+
+	// without Video Processor MFT frames are converted & scaled on CPU
+	IMFTransform* Converter = NULL;
+	if (!Buddy->PresentSoftware && FAILED(CoCreateInstance(&CLSID_VideoProcessorMFT, NULL, CLSCTX_INPROC_SERVER, &IID_IMFTransform, (void**)&Converter)))
+	{
+		Converter = NULL;
+	}
+
+	if (Converter)
+	{
+		IMFAttributes* Attributes;
+		HR(IMFTransform_GetAttributes(Converter, &Attributes));
+		HR(IMFAttributes_SetUINT32(Attributes, &MF_XVP_PLAYBACK_MODE, TRUE));
+		HR(IMFAttributes_SetUINT32(Attributes, &MF_XVP_CALLER_ALLOCATES_OUTPUT, TRUE));
+		IMFAttributes_Release(Attributes);
+	}
+	else
+	{
+		Buddy_InitPresent(Buddy);
+	}
+	
+	{
+		UINT Token;
+		IMFDXGIDeviceManager* Manager;
+		HR(MFCreateDXGIDeviceManager(&Token, &Manager));
+		HR(IMFDXGIDeviceManager_ResetDevice(Manager, (IUnknown*)Buddy->Device, Token));
+		HR(IMFTransform_ProcessMessage(Decoder, MFT_MESSAGE_SET_D3D_MANAGER, (ULONG_PTR)Manager));
+		if (Converter)
+		{
+			HR(IMFTransform_ProcessMessage(Converter, MFT_MESSAGE_SET_D3D_MANAGER, (ULONG_PTR)Manager));
+		}
+		IMFDXGIDeviceManager_Release(Manager);
+	}
+
+	// enable low latency for decoder
+	{
+		ICodecAPI* Codec;
+		HR(IMFTransform_QueryInterface(Decoder, &IID_ICodecAPI, (void**)&Codec));
+
+		VARIANT LowLatency = { .vt = VT_UI4, .boolVal = VARIANT_TRUE };
+		HR(ICodecAPI_SetValue(Codec, &CODECAPI_AVLowLatencyMode, &LowLatency));
+
+		ICodecAPI_Release(Codec);
+	}
+
+	IMFMediaType* InputType;
+	HR(MFCreateMediaType(&InputType));
+	HR(IMFMediaType_SetGUID(InputType, &MF_MT_MAJOR_TYPE, &MFMediaType_Video));
+	HR(IMFMediaType_SetGUID(InputType, &MF_MT_SUBTYPE, &MFVideoFormat_H264));
+	HR(IMFMediaType_SetUINT32(InputType, &MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive));
+	HR(IMFMediaType_SetUINT64(InputType, &MF_MT_FRAME_RATE, MF64(BUDDY_ENCODE_FRAMERATE, 1)));
+	HR(IMFMediaType_SetUINT64(InputType, &MF_MT_FRAME_SIZE, MF64(4, 4)));
+	HR(IMFMediaType_SetUINT64(InputType, &MF_MT_PIXEL_ASPECT_RATIO, MF64(1, 1)));
+
+	HR(IMFTransform_SetInputType(Decoder, 0, InputType, 0));
+	IMFMediaType_Release(InputType);
+
+	if (!Buddy_ResetDecoder(Decoder, Converter))
+	{
+		Assert(0);
+	}
+
+	MFT_OUTPUT_STREAM_INFO OutputInfo;
+
+	HR(IMFTransform_GetOutputStreamInfo(Decoder, 0, &OutputInfo));
+	Assert(OutputInfo.dwFlags & MFT_OUTPUT_STREAM_PROVIDES_SAMPLES);
+
+	HR(IMFTransform_ProcessMessage(Decoder, MFT_MESSAGE_NOTIFY_START_OF_STREAM, 0));
+
+	if (Converter)
+	{
+		HR(IMFTransform_GetOutputStreamInfo(Converter, 0, &OutputInfo));
+		Assert((OutputInfo.dwFlags & MFT_OUTPUT_STREAM_PROVIDES_SAMPLES) == 0);
+
+		HR(IMFTransform_ProcessMessage(Converter, MFT_MESSAGE_NOTIFY_START_OF_STREAM, 0));
+	}
+
+	Buddy->DecodeInputExpected = 0;
+	Buddy->DecodeInputBuffer = NULL;
+	Buddy->DecodeOutputSample = NULL;
+	Buddy->Codec = Decoder;
+	Buddy->Converter = Converter;
+
+	return true;
+}
+
+static void Buddy_NextMediaEvent(ScreenBuddy* Buddy)
+{
+	IMFMediaEventGenerator_BeginGetEvent(Buddy->Generator, &Buddy->EventCallback, (IUnknown*)Buddy->Generator);
+}
+
+static void Buddy_InputToEncoder(ScreenBuddy* Buddy)
+{
+	if (Buddy->EncodeQueueWrite - Buddy->EncodeQueueRead == 0)
+	{
+		Buddy->EncodeWaitingForInput = true;
+		return;
+	}
+
+	IMFSample* Sample = Buddy->EncodeQueue[Buddy->EncodeQueueRead % BUDDY_ENCODE_QUEUE_SIZE];
+	Buddy->EncodeQueueRead += 1;
+
+	HR(IMFTransform_ProcessInput(Buddy->Codec, 0, Sample, 0));
+	IMFSample_Release(Sample);
+}
+
+static void Buddy_Disconnect(ScreenBuddy* Buddy, const wchar_t* Message);
+static void Buddy_NetFailed(ScreenBuddy* Buddy, const wchar_t* Message);
+static bool Buddy_UdpSendFrame(ScreenBuddy* Buddy, uint32_t FrameId, const uint8_t* Data, uint32_t Size);
+static void Buddy_StripeFailed(ScreenBuddy* Buddy, Buddy_Stripe* Stripe);
+
+// packets sent between cork & uncork are packed into as few TLS records and send calls as possible, with
+// DerpCorking=0 in config each one is sent right away
+static void Buddy_NetCork(ScreenBuddy* Buddy)
+{
+	if (Buddy->NetOpen)
+	{
+		DerpNet_Cork(&Buddy->Net);
+	}
+}
+
+static void Buddy_NetUncork(ScreenBuddy* Buddy)
+{
+	if (Buddy->NetOpen && !DerpNet_Uncork(&Buddy->Net))
+	{
+		Buddy_NetFailed(Buddy, L"DerpNet disconnect while sending data!");
+	}
+}
+
+// sends chunks of frame over DERP starting at Offset, until whole frame or at least Budget bytes are sent
+// returns false if main connection failed
+static bool Buddy_SendVideoChunks(ScreenBuddy* Buddy, uint32_t FrameId, const uint8_t* FrameData, uint32_t FrameSize, uint32_t* Offset, uint32_t Budget)
+{
+	uint8_t Extra[1 + sizeof(FrameSize) + sizeof(FrameId)];
+	Extra[0] = BUDDY_PACKET_VIDEO;
+	CopyMemory(Extra + 1, &FrameSize, sizeof(FrameSize));
+	CopyMemory(Extra + 1 + sizeof(FrameSize), &FrameId, sizeof(FrameId));
+
+	// first chunk carries frame size & id, rest only packet type, large keyframes are sealed on multiple cores
+	// with striping each chunk is wrapped with sequence number, and chunks go round-robin over connections
+	bool Striped = Buddy->StripeCount > 1;
+	uint8_t Prefixes[BUDDY_ENCODE_CHUNKS][BUDDY_STRIPE_HEADER + sizeof(Extra)];
+	DerpNet_Chunk Chunks[BUDDY_MAX_STRIPES][BUDDY_ENCODE_CHUNKS];
+	uint32_t ExtraSize = *Offset == 0 ? sizeof(Extra) : 1;
+	uint32_t Sent = 0;
+
+	while (*Offset != FrameSize && Sent < Budget)
+	{
+		// main connection first, then extra connections that peer has open
+		Buddy_Stripe* Links[BUDDY_MAX_STRIPES] = { NULL };
+		uint32_t LinkCount = 1;
+		for (uint32_t Index = 0; Striped && Buddy->Stripes && Index < Buddy->StripeCount - 1; Index++)
+		{
+			Buddy_Stripe* Stripe = &Buddy->Stripes[Index];
+			if (Stripe->Open && Stripe->RemoteOpen)
+			{
+				Links[LinkCount++] = Stripe;
+			}
+		}
+
+		uint32_t ChunkCount[BUDDY_MAX_STRIPES] = { 0 };
+		for (uint32_t Index = 0; *Offset != FrameSize && Sent < Budget && Index < BUDDY_ENCODE_CHUNKS; Index++)
+		{
+			const uint8_t* Prefix = Extra;
+			uint32_t PrefixSize = ExtraSize;
+			uint32_t Link = 0;
+
+			if (Striped)
+			{
+				uint8_t* Header = Prefixes[Index];
+				uint32_t Seq = Buddy->StripeSendSeq++;
+				Header[0] = BUDDY_PACKET_STRIPE;
+				CopyMemory(Header + 1, &Seq, sizeof(Seq));
+				Header[5] = ExtraSize == sizeof(Extra) ? BUDDY_STRIPE_FRAME_START : 0;
+				CopyMemory(Header + BUDDY_STRIPE_HEADER, Extra, ExtraSize);
+
+				Prefix = Header;
+				PrefixSize = BUDDY_STRIPE_HEADER + ExtraSize;
+				Link = Buddy->StripeNext++ % LinkCount;
+			}
+
+			uint32_t SendSize = min(FrameSize - *Offset, BUDDY_ENCODE_CHUNK_SIZE - PrefixSize);
+
+			Chunks[Link][ChunkCount[Link]++] = (DerpNet_Chunk)
+			{
+				.Prefix = Prefix,
+				.PrefixSize = PrefixSize,
+				.Data = FrameData + *Offset,
+				.DataSize = SendSize,
+			};
+
+			*Offset += SendSize;
+			Sent += SendSize;
+
+			ExtraSize = 1;
+		}
+
+		// failed extra connection loses only its chunks, viewer skips frame when they do not arrive
+		for (uint32_t Link = 1; Link < LinkCount; Link++)
+		{
+			Buddy_Stripe* Stripe = Links[Link];
+			if (ChunkCount[Link] && !DerpNet_SendChunks(&Stripe->Net, &Stripe->RemoteKey, Chunks[Link], ChunkCount[Link]))
+			{
+				Buddy_StripeFailed(Buddy, Stripe);
+			}
+		}
+
+		if (ChunkCount[0] && !DerpNet_SendChunks(&Buddy->Net, &Buddy->RemoteKey, Chunks[0], ChunkCount[0]))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+//
+// video pacing
+//
+// encoded frames are not written to relay connection all at once, large keyframe would sit in TCP & relay queues
+// in front of input events & everything else. Token bucket releases DERP chunks at PaceRate, which is at least
+// BUDDY_PACE_RATE_FACTOR times encoder bitrate, and fast enough that all queued frames are out within one frame
+// interval. Control & input packets are sent directly, so they go out between paced chunks. Direct UDP path is not
+// paced. Pacing can be disabled with DerpPacing=0 in config, sharer's window title shows largest burst & largest
+// delay of frame in pacer for comparison.
+//
+// when relay falls behind, frames that did not start sending yet are dropped where decoder does not need them -
+// keyframe replaces everything queued before it, and non-reference frames go first when queue is full.
+
+// drops queued frames, used when pacer cannot send anymore
+static void Buddy_PaceReset(ScreenBuddy* Buddy)
+{
+	while (Buddy->PaceRead != Buddy->PaceWrite)
+	{
+		IMFMediaBuffer_Release(Buddy->PaceQueue[Buddy->PaceRead++ % BUDDY_PACE_QUEUE_SIZE].Buffer);
+	}
+	Buddy->PaceRead = Buddy->PaceWrite = 0;
+	Buddy->PaceQueued = 0;
+
+	if (Buddy->PaceWait)
+	{
+		SetThreadpoolWait(Buddy->PaceWait, NULL, NULL);
+		CancelWaitableTimer(Buddy->PaceTimer);
+	}
+}
+
+static void CALLBACK Buddy_PaceCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Context, PTP_WAIT Wait, TP_WAIT_RESULT WaitResult)
+{
+	ScreenBuddy* Buddy = Context;
+	PostMessageW(Buddy->DialogWindow, BUDDY_WM_PACE_EVENT, 0, 0);
+}
+
+// BUDDY_WM_PACE_EVENT is posted after Delay, in 100nsec units
+static void Buddy_PaceArm(ScreenBuddy* Buddy, int64_t Delay)
+{
+	if (Buddy->PaceWait == NULL)
+	{
+		// regular waitable timer has same coarse resolution as SetTimer, which is about half of frame interval
+		Buddy->PaceTimer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+		if (Buddy->PaceTimer == NULL)
+		{
+			Buddy->PaceTimer = CreateWaitableTimerW(NULL, FALSE, NULL);
+		}
+		Assert(Buddy->PaceTimer);
+
+		Buddy->PaceWait = CreateThreadpoolWait(&Buddy_PaceCallback, Buddy, NULL);
+		Assert(Buddy->PaceWait);
+	}
+
+	LARGE_INTEGER DueTime = { .QuadPart = -max(Delay, 1) };
+	SetWaitableTimer(Buddy->PaceTimer, &DueTime, 0, NULL, NULL, FALSE);
+	SetThreadpoolWait(Buddy->PaceWait, Buddy->PaceTimer, NULL);
+}
+
+static void Buddy_PaceRefill(ScreenBuddy* Buddy)
+{
+	LARGE_INTEGER Now;
+	QueryPerformanceCounter(&Now);
+
+	if (Buddy->PaceTime == 0)
+	{
+		Buddy->PaceTokens = BUDDY_PACE_BURST;
+	}
+	else
+	{
+		int64_t Tokens = Buddy->PaceTokens + (int64_t)((Now.QuadPart - Buddy->PaceTime) * Buddy->PaceRate / Buddy->Freq);
+		Buddy->PaceTokens = min(Tokens, BUDDY_PACE_BURST);
+	}
+	Buddy->PaceTime = Now.QuadPart;
+}
+
+// sends queued frames while there are tokens, or everything when flushing
+static void Buddy_PaceSend(ScreenBuddy* Buddy, bool Flush)
+{
+	Buddy_PaceRefill(Buddy);
+
+	uint64_t Burst = 0;
+	while (Buddy->PaceRead != Buddy->PaceWrite && (Flush || Buddy->PaceTokens > 0))
+	{
+		// while session migrates to another region frames are dropped, new keyframe is produced afterwards
+		if (Buddy->NetMigrating || !Buddy->NetOpen)
+		{
+			Buddy_PaceReset(Buddy);
+			return;
+		}
+
+		Buddy_PaceFrame* Frame = &Buddy->PaceQueue[Buddy->PaceRead % BUDDY_PACE_QUEUE_SIZE];
+		uint32_t Offset = Frame->Offset;
+		uint32_t Budget = Flush ? UINT32_MAX : (uint32_t)min(Buddy->PaceTokens, UINT32_MAX);
+
+		BYTE* FrameData;
+		HR(IMFMediaBuffer_Lock(Frame->Buffer, &FrameData, NULL, NULL));
+		bool Ok = Buddy_SendVideoChunks(Buddy, Frame->Id, FrameData, Frame->Size, &Frame->Offset, Budget);
+		HR(IMFMediaBuffer_Unlock(Frame->Buffer));
+
+		if (!Ok)
+		{
+			Buddy_PaceReset(Buddy);
+			Buddy_NetFailed(Buddy, L"DerpNet disconnect while sending data!");
+			return;
+		}
+
+		uint32_t Sent = Frame->Offset - Offset;
+		Buddy->PaceQueued -= Sent;
+		Buddy->PaceStatsBytes += Sent;
+		Burst += Sent;
+		if (!Flush)
+		{
+			Buddy->PaceTokens -= Sent;
+		}
+
+		if (Frame->Offset == Frame->Size)
+		{
+			LARGE_INTEGER Now;
+			QueryPerformanceCounter(&Now);
+
+			uint32_t Delay = (uint32_t)((Now.QuadPart - Frame->Time) * 1000 / Buddy->Freq);
+			Buddy->PaceMaxDelay = max(Buddy->PaceMaxDelay, Delay);
+
+			IMFMediaBuffer_Release(Frame->Buffer);
+			Buddy->PaceRead++;
+		}
+	}
+
+	Buddy->PaceMaxBurst = max(Buddy->PaceMaxBurst, Burst);
+
+	if (Buddy->PaceRead != Buddy->PaceWrite)
+	{
+		// when bucket will have tokens again
+		Buddy_PaceArm(Buddy, (1 - Buddy->PaceTokens) * 10 * 1000 * 1000 / (int64_t)Buddy->PaceRate);
+	}
+}
+
+// drops queued frames that did not start sending yet, all of them or only non-reference ones
+static void Buddy_PaceDrop(ScreenBuddy* Buddy, bool All)
+{
+	uint32_t Start = Buddy->PaceRead;
+	if (Start != Buddy->PaceWrite && Buddy->PaceQueue[Start % BUDDY_PACE_QUEUE_SIZE].Offset != 0)
+	{
+		Start++;
+	}
+
+	uint32_t Write = Start;
+	for (uint32_t Read = Start; Read != Buddy->PaceWrite; Read++)
+	{
+		Buddy_PaceFrame* Frame = &Buddy->PaceQueue[Read % BUDDY_PACE_QUEUE_SIZE];
+		if (!All && Frame->Info.Reference)
+		{
+			Buddy->PaceQueue[Write++ % BUDDY_PACE_QUEUE_SIZE] = *Frame;
+		}
+		else
+		{
+			Buddy->PaceQueued -= Frame->Size;
+			Buddy->PaceDropped++;
+			IMFMediaBuffer_Release(Frame->Buffer);
+		}
+	}
+	Buddy->PaceWrite = Write;
+}
+
+// takes reference to buffer with encoded frame
+static void Buddy_PaceQueueFrame(ScreenBuddy* Buddy, uint32_t FrameId, IMFMediaBuffer* Buffer, uint32_t Size, const H264Info* Info)
+{
+	if (Info->Type == H264_FRAME_IDR)
+	{
+		Buddy_PaceDrop(Buddy, true);
+	}
+
+	if (Buddy->PaceWrite - Buddy->PaceRead == BUDDY_PACE_QUEUE_SIZE)
+	{
+		Buddy_PaceDrop(Buddy, false);
+	}
+
+	if (Buddy->PaceWrite - Buddy->PaceRead == BUDDY_PACE_QUEUE_SIZE)
+	{
+		if (!Info->Reference)
+		{
+			Buddy->PaceDropped++;
+			return;
+		}
+
+		// relay is slower than encoder, sending blocks until older frames are out
+		Buddy_PaceSend(Buddy, true);
+		if (Buddy->NetMigrating || !Buddy->NetOpen)
+		{
+			return;
+		}
+	}
+
+	LARGE_INTEGER Now;
+	QueryPerformanceCounter(&Now);
+
+	IMFMediaBuffer_AddRef(Buffer);
+	Buddy->PaceQueue[Buddy->PaceWrite++ % BUDDY_PACE_QUEUE_SIZE] = (Buddy_PaceFrame)
+	{
+		.Buffer = Buffer,
+		.Id = FrameId,
+		.Size = Size,
+		.Offset = 0,
+		.Time = Now.QuadPart,
+		.Info = *Info,
+	};
+
+	// tokens up to now are at old rate
+	Buddy_PaceRefill(Buddy);
+
+	// everything queued should be out before next frame arrives
+	Buddy->PaceQueued += Size;
+	Buddy->PaceRate = max((uint64_t)BUDDY_PACE_RATE_FACTOR * BUDDY_ENCODE_BITRATE / 8, Buddy->PaceQueued * BUDDY_ENCODE_FRAMERATE);
+
+	Buddy_PaceSend(Buddy, !Buddy->PaceEnabled);
+}
+
+//
+// keyframe recovery
+//
+// encoder uses largest GOP size, so after viewer loses frames - stripe gap, skipped UDP frame, decoder format
+// change in middle of stream - nothing would fix picture. Viewer drops frames from then on and sends
+// BUDDY_PACKET_KEYFRAME over DERP, repeated every BUDDY_KEYFRAME_RETRY until keyframe arrives. Sharer forces
+// requested keyframes at most every BUDDY_KEYFRAME_INTERVAL. New viewer also waits for keyframe before decoding.
+//
+// Media Foundation encoders have no common control for intra refresh, so with SoftKeyFrames=1 in config requested
+// keyframes are encoded with raised minimum QP instead - small keyframe goes through relay quickly, and following
+// P-frames bring quality back. Viewer's window title shows time from loss to decoded keyframe, with -metrics it is
+// written as recover_ms once per recovery, and sharer writes size of every keyframe as key_kb.
+
+static void Buddy_SetEncoderValue(ScreenBuddy* Buddy, const GUID* Api, uint32_t Value)
+{
+	ICodecAPI* Codec;
+	if (SUCCEEDED(IMFTransform_QueryInterface(Buddy->Codec, &IID_ICodecAPI, (void**)&Codec)))
+	{
+		VARIANT Variant = { .vt = VT_UI4, .ulVal = Value };
+		ICodecAPI_SetValue(Codec, Api, &Variant);
+		ICodecAPI_Release(Codec);
+	}
+}
+
+static void Buddy_ForceKeyFrame(ScreenBuddy* Buddy)
+{
+	Buddy_SetEncoderValue(Buddy, &CODECAPI_AVEncVideoForceKeyFrame, 1);
+	Buddy->KeyForceTime = GetTickCount64();
+	Buddy->KeyPending = false;
+
+	// keyframe must be encoded even when screen does not change
+	Buddy->ChangeStatic = 0;
+}
+
+static void Buddy_OnKeyFrameRequest(ScreenBuddy* Buddy)
+{
+	if (GetTickCount64() - Buddy->KeyForceTime < BUDDY_KEYFRAME_INTERVAL)
+	{
+		Buddy->KeyPending = true;
+		return;
+	}
+
+	if (Buddy->KeySoft)
+	{
+		Buddy_SetEncoderValue(Buddy, &CODECAPI_AVEncVideoMinQP, BUDDY_KEYFRAME_SOFT_QP);
+		Buddy->KeySoftActive = true;
+	}
+	Buddy_ForceKeyFrame(Buddy);
+}
+
+// called for every encoded frame
+static void Buddy_OnEncodedFrame(ScreenBuddy* Buddy, const H264Info* Info, uint32_t Size)
+{
+	if (Info->Type == H264_FRAME_IDR)
+	{
+		Buddy_Metric(Buddy, "key_kb", (double)Size / 1024.0);
+	}
+
+	if (Buddy->KeySoftActive && Info->Type == H264_FRAME_IDR)
+	{
+		Buddy_SetEncoderValue(Buddy, &CODECAPI_AVEncVideoMinQP, 0);
+		Buddy->KeySoftActive = false;
+	}
+}
+
+static void Buddy_RequestKeyFrame(ScreenBuddy* Buddy)
+{
+	uint64_t Now = GetTickCount64();
+	if (Buddy->NetOpen && !Buddy->NetMigrating && Now - Buddy->KeyRequestTime >= BUDDY_KEYFRAME_RETRY)
+	{
+		uint8_t Data[1] = { BUDDY_PACKET_KEYFRAME };
+		DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, Data, sizeof(Data));
+		Buddy->KeyRequestTime = Now;
+	}
+}
+
+// viewer lost frames, decoder cannot continue until next keyframe
+static void Buddy_LostFrames(ScreenBuddy* Buddy)
+{
+	if (!Buddy->KeyWaiting)
+	{
+		LARGE_INTEGER Now;
+		QueryPerformanceCounter(&Now);
+
+		Buddy->KeyWaiting = true;
+		Buddy->KeyLossTime = Now.QuadPart;
+		Buddy->KeyRequestTime = 0;
+	}
+	Buddy_RequestKeyFrame(Buddy);
+}
+
+static void Buddy_KeyFrameTimer(ScreenBuddy* Buddy)
+{
+	if (Buddy->State == BUDDY_STATE_SHARING)
+	{
+		if (Buddy->KeyPending && GetTickCount64() - Buddy->KeyForceTime >= BUDDY_KEYFRAME_INTERVAL)
+		{
+			Buddy_OnKeyFrameRequest(Buddy);
+		}
+	}
+	else if (Buddy->KeyWaiting)
+	{
+		Buddy_RequestKeyFrame(Buddy);
+	}
+}
+
+//
+
+static void Buddy_OutputFromEncoder(ScreenBuddy* Buddy)
+{
+	DWORD Status;
+	MFT_OUTPUT_DATA_BUFFER Output = { .pSample = NULL };
+
+	for (;;)
+	{
+		HRESULT hr = IMFTransform_ProcessOutput(Buddy->Codec, 0, 1, &Output, &Status);
+		if (SUCCEEDED(hr))
+		{
+			break;
+		}
+		else if (hr == MF_E_TRANSFORM_STREAM_CHANGE)
+		{
+			DWORD OutputIndex = 0;
+			IMFMediaType* OutputType = NULL;
+			while (SUCCEEDED(IMFTransform_GetOutputAvailableType(Buddy->Codec, 0, OutputIndex, &OutputType)))
+			{
+				GUID Format;
+				if (SUCCEEDED(IMFMediaType_GetGUID(OutputType, &MF_MT_SUBTYPE, &Format)))
+				{
+					if (IsEqualGUID(&Format, &MFVideoFormat_H264))
+					{
+						break;
+					}
+					IMFMediaType_Release(OutputType);
+					OutputType = NULL;
+				}
+				OutputIndex++;
+			}
+			Assert(OutputType);
+
+			HR(IMFTransform_SetOutputType(Buddy->Codec, 0, OutputType, 0));
+			return;
+		}
+		else
+		{
+			HR(hr);
+		}
+	}
+
+	IMFSample* OutputSample = Output.pSample;
+
+	IMFMediaBuffer* OutputBuffer;
+	HR(IMFSample_ConvertToContiguousBuffer(OutputSample, &OutputBuffer));
+
+	BYTE* OutputData;
+	DWORD OutputSize;
+	HR(IMFMediaBuffer_Lock(OutputBuffer, &OutputData, NULL, &OutputSize));
+
+	// unparseable output is treated as reference frame, so it is never dropped
+	H264Info Info;
+	if (!H264Parse_AccessUnit(OutputData, OutputSize, Overlay_Uuid, &Info))
+	{
+		Info.Reference = true;
+	}
+
+	Buddy_OnEncodedFrame(Buddy, &Info, OutputSize);
+
+	LONGLONG OutputTime;
+	if (Buddy->OverlayTiles.State && SUCCEEDED(IMFSample_GetSampleTime(OutputSample, &OutputTime)))
+	{
+		IMFMediaBuffer* OverlayBuffer = Buddy_OverlayAttach(Buddy, OutputTime, OutputData, OutputSize, &Info);
+		if (OverlayBuffer)
+		{
+			HR(IMFMediaBuffer_Unlock(OutputBuffer));
+			IMFMediaBuffer_Release(OutputBuffer);
+
+			OutputBuffer = OverlayBuffer;
+			HR(IMFMediaBuffer_Lock(OutputBuffer, &OutputData, NULL, &OutputSize));
+
+			// pacer must not drop frame with overlay records
+			Info.Reference = true;
+		}
+	}
+
+	uint32_t FrameId = Buddy->EncodeFrameId++;
+	bool Direct = Buddy_UdpSendFrame(Buddy, FrameId, OutputData, OutputSize);
+
+	HR(IMFMediaBuffer_Unlock(OutputBuffer));
+
+	// direct path sends whole frame at once, otherwise it goes over DERP in chunks through pacer
+	// while session migrates to another region frames are dropped, new keyframe is produced afterwards
+	if (!Direct && !Buddy->NetMigrating)
+	{
+		Buddy_PaceQueueFrame(Buddy, FrameId, OutputBuffer, OutputSize, &Info);
+	}
+
+	IMFMediaBuffer_Release(OutputBuffer);
+	IMFSample_Release(OutputSample);
+}
+
+static void Buddy_Decode(ScreenBuddy* Buddy, IMFMediaBuffer* InputBuffer)
+{
+	BYTE* InputData;
+	DWORD InputSize;
+	HR(IMFMediaBuffer_Lock(InputBuffer, &InputData, NULL, &InputSize));
+
+	H264Info Info;
+	bool KeyFrame = H264Parse_AccessUnit(InputData, InputSize, Overlay_Uuid, &Info) && Info.Type == H264_FRAME_IDR;
+
+	// overlay changes with frame it came in, frames dropped while waiting for keyframe are ignored
+	if (!Buddy->KeyWaiting || KeyFrame)
+	{
+		if (KeyFrame)
+		{
+			Buddy_OverlayReset(Buddy);
+		}
+		if (Info.UserData)
+		{
+			Buddy_OverlayApply(Buddy, Info.UserData, Info.UserDataSize);
+		}
+	}
+
+	HR(IMFMediaBuffer_Unlock(InputBuffer));
+
+	// without keyframe decoder would show garbage
+	if (Buddy->KeyWaiting)
+	{
+		if (!KeyFrame)
+		{
+			Buddy_RequestKeyFrame(Buddy);
+			return;
+		}
+		Buddy->KeyWaiting = false;
+		Buddy->KeyMeasure = Buddy->KeyLossTime != 0;
+	}
+
+	IMFSample* InputSample;
+	HR(MFCreateSample(&InputSample));
+	HR(IMFSample_AddBuffer(InputSample, InputBuffer));
+
+	HR(IMFTransform_ProcessInput(Buddy->Codec, 0, InputSample, 0));
+	IMFSample_Release(InputSample);
+
+	bool NewFrameDecoded = false;
+	for (;;)
+	{
+		DWORD Status;
+		MFT_OUTPUT_DATA_BUFFER Output = { .pSample = NULL };
+
+		HRESULT hr = IMFTransform_ProcessOutput(Buddy->Codec, 0, 1, &Output, &Status);
+		if (hr == MF_E_TRANSFORM_STREAM_CHANGE)
+		{
+			Buddy_ResetDecoder(Buddy->Codec, Buddy->Converter);
+
+			// format changed in middle of stream, references in decoder cannot be trusted
+			if (!KeyFrame)
+			{
+				Buddy_LostFrames(Buddy);
+			}
+
+			// previous frame stays on screen until first frame of new size, first frame of stream is not a gap
+			Buddy->FormatMeasure = Buddy->DecodeFrameTime != 0;
+
+			if (Buddy->DecodeOutputSample)
+			{
+				IMFSample_Release(Buddy->DecodeOutputSample);
+				Buddy->DecodeOutputSample = NULL;
+			}
+			continue;
+		}
+		else if (hr == MF_E_TRANSFORM_NEED_MORE_INPUT)
+		{
+			break;
+		}
+		HR(hr);
+
+		IMFSample* DecodedSample = Output.pSample;
+
+		if (Buddy->Converter == NULL)
+		{
+			Buddy_PresentDecoded(Buddy, DecodedSample);
+			IMFSample_Release(DecodedSample);
+
+			NewFrameDecoded = true;
+			continue;
+		}
+
+		if (Buddy->DecodeOutputSample == NULL)
+		{
+			IMFMediaBuffer* DecodedBuffer;
+			HR(IMFSample_GetBufferByIndex(DecodedSample, 0, &DecodedBuffer));
+
+			IMFDXGIBuffer* DxgiBuffer;
+			HR(IMFMediaBuffer_QueryInterface(DecodedBuffer, &IID_IMFDXGIBuffer, (void**)&DxgiBuffer));
+
+			ID3D11Texture2D* DecodedTexture;
+			HR(IMFDXGIBuffer_GetResource(DxgiBuffer, &IID_ID3D11Texture2D, (void**)&DecodedTexture));
+
+			D3D11_TEXTURE2D_DESC DecodedDesc;
+			ID3D11Texture2D_GetDesc(DecodedTexture, &DecodedDesc);
+
+			int DecodedWidth = DecodedDesc.Width;
+			int DecodedHeight = DecodedDesc.Height;
+
+			ID3D11Texture2D_Release(DecodedTexture);
+			IMFDXGIBuffer_Release(DxgiBuffer);
+			IMFMediaBuffer_Release(DecodedBuffer);
+
+			D3D11_TEXTURE2D_DESC TextureDesc =
+			{
+				.Width = DecodedWidth,
+				.Height = DecodedHeight,
+				.MipLevels = 0,
+				.ArraySize = 1,
+				.Format = DXGI_FORMAT_B8G8R8A8_UNORM,
+				.SampleDesc = { 1, 0 },
+				.Usage = D3D11_USAGE_DEFAULT,
+				.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE,
+				.MiscFlags = D3D11_RESOURCE_MISC_GENERATE_MIPS,
+			};
+
+			ID3D11Texture2D* Texture;
+			ID3D11Device_CreateTexture2D(Buddy->Device, &TextureDesc, NULL, &Texture);
+
+			if (Buddy->InputView)
+			{
+				ID3D11ShaderResourceView_Release(Buddy->InputView);
+			}
+			ID3D11Device_CreateShaderResourceView(Buddy->Device, (ID3D11Resource*)Texture, NULL, &Buddy->InputView);
+
+			Buddy->InputMipsGenerated = false;
+			Buddy->InputWidth = DecodedWidth;
+			Buddy->InputHeight = DecodedHeight;
+
+			//
+
+			IMFMediaBuffer* OutputBuffer;
+			HR(MFCreateDXGISurfaceBuffer(&IID_ID3D11Texture2D, (IUnknown*)Texture, 0, FALSE, &OutputBuffer));
+
+			DWORD OutputLength;
+			HR(IMFMediaBuffer_GetMaxLength(OutputBuffer, &OutputLength));
+			HR(IMFMediaBuffer_SetCurrentLength(OutputBuffer, OutputLength));
+
+			HR(MFCreateSample(&Buddy->DecodeOutputSample));
+			HR(IMFSample_AddBuffer(Buddy->DecodeOutputSample, OutputBuffer));
+
+			HR(IMFSample_SetSampleDuration(Buddy->DecodeOutputSample, 10 * 1000 * 1000 / BUDDY_ENCODE_FRAMERATE));
+			HR(IMFSample_SetSampleTime(Buddy->DecodeOutputSample, 0));
+
+			IMFMediaBuffer_Release(OutputBuffer);
+			ID3D11Texture2D_Release(Texture);
+		}
+
+		HR(IMFTransform_ProcessInput(Buddy->Converter, 0, DecodedSample, 0));
+		IMFSample_Release(DecodedSample);
+
+		MFT_OUTPUT_DATA_BUFFER ConverterOutput = { .pSample = Buddy->DecodeOutputSample };
+		HR(IMFTransform_ProcessOutput(Buddy->Converter, 0, 1, &ConverterOutput, &Status));
+		Buddy_OverlayComposite(Buddy);
+
+		NewFrameDecoded = true;
+		Buddy->InputMipsGenerated = false;
+	}
+
+	if (NewFrameDecoded)
+	{
+		LARGE_INTEGER Now;
+		QueryPerformanceCounter(&Now);
+
+		if (Buddy->FailoverWaitFrame)
+		{
+			Buddy->FailoverTime = (uint32_t)((Now.QuadPart - Buddy->FailoverStart) * 1000 / Buddy->Freq);
+			Buddy->FailoverWaitFrame = false;
+			Buddy_Metric(Buddy, "failover_ms", Buddy->FailoverTime);
+		}
+		if (Buddy->KeyMeasure)
+		{
+			Buddy->KeyRecoverTime = (uint32_t)((Now.QuadPart - Buddy->KeyLossTime) * 1000 / Buddy->Freq);
+			Buddy->KeyMeasure = false;
+
+			// one row per recovery, so percentiles are over recoveries and not over seconds since last one
+			Buddy_Metric(Buddy, "recover_ms", Buddy->KeyRecoverTime);
+		}
+		if (Buddy->FormatMeasure)
+		{
+			Buddy->FormatGapTime = (uint32_t)((Now.QuadPart - Buddy->DecodeFrameTime) * 1000 / Buddy->Freq);
+			Buddy->FormatMeasure = false;
+			Buddy_Metric(Buddy, "format_ms", Buddy->FormatGapTime);
+		}
+		Buddy->DecodeFrameTime = Now.QuadPart;
+		InvalidateRect(Buddy->MainWindow, NULL, FALSE);
+	}
+}
+
+static void Buddy_EncodeFrame(ScreenBuddy* Buddy, ID3D11Texture2D* Texture, uint64_t Time)
+{
+	IMFSample* ConvertedSample;
+	if (SUCCEEDED(IMFVideoSampleAllocatorEx_AllocateSample(Buddy->EncodeSampleAllocator, &ConvertedSample)))
+	{
+		if (Buddy->EncodeFirstTime == 0)
+		{
+			Buddy->EncodeFirstTime = Time;
+		}
+		Buddy->EncodeNextTime = Time + Buddy->Freq / BUDDY_ENCODE_FRAMERATE;
+		Buddy->ViewRefresh = false;
+
+		D3D11_MAPPED_SUBRESOURCE Mapped = { 0 };
+		if (Buddy->CaptureReadback)
+		{
+			Buddy_ReadbackFrame(Buddy, Texture, &Mapped);
+		}
+
+		// hashes are updated only when sample is available, so changes are never missed by skipping frame
+		if (Buddy->ChangeDetect)
+		{
+			Buddy_DetectChanges(&Buddy->Changes, Mapped.pData, Mapped.RowPitch);
+			if (Buddy->Scroll.Detect.Previous)
+			{
+				Buddy_DetectScroll(&Buddy->Scroll, &Buddy->Changes, Mapped.pData, Mapped.RowPitch);
+			}
+
+			bool Pending = false;
+			if (Buddy->OverlayTiles.State)
+			{
+				Buddy_OverlayChanges(Buddy);
+				Pending = Overlay_SharerPending(&Buddy->OverlayTiles);
+			}
+
+			if (Buddy_IsStaticFrame(Buddy, Pending))
+			{
+				ID3D11DeviceContext_Unmap(Buddy->Context, (ID3D11Resource*)Buddy->CaptureReadback, 0);
+				IMFSample_Release(ConvertedSample);
+				return;
+			}
+		}
+
+		LONGLONG SampleTime = MFllMulDiv(Time - Buddy->EncodeFirstTime, 10 * 1000 * 1000, Buddy->Freq, 0);
+		LONGLONG SampleDuration = 10 * 1000 * 1000 / BUDDY_ENCODE_FRAMERATE;
+
+		if (Buddy->Converter)
+		{
+			IMFMediaBuffer* InputBuffer;
+			HR(MFCreateDXGISurfaceBuffer(&IID_ID3D11Texture2D, (IUnknown*)Texture, 0, FALSE, &InputBuffer));
+
+			DWORD InputBufferLength;
+			HR(IMFMediaBuffer_GetMaxLength(InputBuffer, &InputBufferLength));
+			HR(IMFMediaBuffer_SetCurrentLength(InputBuffer, InputBufferLength));
+
+			IMFSample* InputSample;
+			HR(MFCreateSample(&InputSample));
+			HR(IMFSample_AddBuffer(InputSample, InputBuffer));
+			IMFMediaBuffer_Release(InputBuffer);
+
+			HR(IMFSample_SetSampleTime(InputSample, SampleTime));
+			HR(IMFSample_SetSampleDuration(InputSample, SampleDuration));
+
+			HR(IMFTransform_ProcessInput(Buddy->Converter, 0, InputSample, 0));
+			IMFSample_Release(InputSample);
+
+			DWORD Status;
+			MFT_OUTPUT_DATA_BUFFER Output = { .pSample = ConvertedSample };
+			HR(IMFTransform_ProcessOutput(Buddy->Converter, 0, 1, &Output, &Status));
+		}
+		else
+		{
+			// software conversion writes directly into sample from encoder allocator
+			if (Buddy->ConvertScaled)
+			{
+				D3D11_MAPPED_SUBRESOURCE Scaled;
+				Buddy_ScaleFrame(Buddy, &Mapped, &Scaled);
+				Buddy_ConvertFrame(Buddy, &Scaled, ConvertedSample);
+			}
+			else
+			{
+				Buddy_ConvertFrame(Buddy, &Mapped, ConvertedSample);
+			}
+
+			HR(IMFSample_SetSampleTime(ConvertedSample, SampleTime));
+			HR(IMFSample_SetSampleDuration(ConvertedSample, SampleDuration));
+		}
+
+		if (Buddy->OverlayTiles.State)
+		{
+			Overlay_SharerQueueFrame(&Buddy->OverlayTiles, SampleTime, Mapped.pData, Mapped.RowPitch);
+		}
+
+		if (Buddy->CaptureReadback)
+		{
+			ID3D11DeviceContext_Unmap(Buddy->Context, (ID3D11Resource*)Buddy->CaptureReadback, 0);
+		}
+
+		if (Buddy->ChangeRoi)
+		{
+			Buddy_SetChangeRegion(Buddy, ConvertedSample);
+		}
+
+		if (Buddy->EncodeQueueWrite - Buddy->EncodeQueueRead != BUDDY_ENCODE_QUEUE_SIZE)
+		{
+			Buddy->EncodeQueue[Buddy->EncodeQueueWrite % BUDDY_ENCODE_QUEUE_SIZE] = ConvertedSample;
+			Buddy->EncodeQueueWrite += 1;
+
+			if (Buddy->EncodeWaitingForInput)
+			{
+				Buddy->EncodeWaitingForInput = false;
+				Buddy_InputToEncoder(Buddy);
+			}
+		}
+		else
+		{
+			IMFSample_Release(ConvertedSample);
+		}
+	}
+}
+
+static bool Buddy_CheckCaptureSize(ScreenBuddy* Buddy, const ScreenCaptureFrame* Frame);
+
+static void Buddy_OnFrameCapture(ScreenCapture* Capture, bool Closed) 
+{
+	ScreenBuddy* Buddy = CONTAINING_RECORD(Capture, ScreenBuddy, Capture);
+
+	if (Buddy->State != BUDDY_STATE_SHARING)
+	{
+		return;
+	}
+
+	// session cannot be stopped from its own callback
+	if (Closed)
+	{
+		PostMessageW(Buddy->DialogWindow, BUDDY_WM_CAPTURE_CLOSED, 0, 0);
+		return;
+	}
+
+	ScreenCaptureFrame Frame;
+	if (ScreenCapture_GetFrame(&Buddy->Capture, &Frame))
+	{
+		if (!Buddy_CheckCaptureSize(Buddy, &Frame))
+		{
+			// frame must be released before capture is stopped
+			ScreenCapture_ReleaseFrame(&Buddy->Capture, &Frame);
+			if (!Buddy->Codec)
+			{
+				Buddy_Disconnect(Buddy, L"Cannot create GPU video encoder!");
+			}
+			return;
+		}
+		if (Buddy->ViewZoom)
+		{
+			Buddy_ViewportFrame(Buddy, Frame.Texture);
+		}
+		if (Frame.Time > Buddy->EncodeNextTime)
+		{
+			Buddy_EncodeFrame(Buddy, Frame.Texture, Frame.Time);
+		}
+		ScreenCapture_ReleaseFrame(&Buddy->Capture, &Frame);
+	}
+}
+
+//
+
+void Buddy_ShowMessage(ScreenBuddy* Buddy, const wchar_t* Message)
+{
+	HDC DeviceContext = CreateCompatibleDC(0);
+	Assert(DeviceContext);
+
+	int FontHeight = MulDiv(24, GetDeviceCaps(DeviceContext, LOGPIXELSY), 72);;
+	HFONT Font = CreateFontW(-FontHeight, 0, 0, 0, FW_BOLD,
+		FALSE, FALSE, FALSE, DEFAULT_CHARSET, OUT_DEFAULT_PRECIS,
+		CLIP_DEFAULT_PRECIS, CLEARTYPE_QUALITY, DEFAULT_PITCH, L"Segoe UI");
+	Assert(Font);
+
+	SelectObject(DeviceContext, Font);
+
+	int MessageLength = lstrlenW(Message);
+
+	SIZE Size;
+	GetTextExtentPoint32W(DeviceContext, Message, MessageLength, &Size);
+	int Width = Size.cx + 2 * FontHeight;
+	int Height = Size.cy + 2 * FontHeight;
+
+	BITMAPINFO Info =
+	{
+		.bmiHeader =
+		{
+			.biSize = sizeof(Info.bmiHeader),
+			.biWidth = Width,
+			.biHeight = -Height,
+			.biPlanes = 1,
+			.biBitCount = 32,
+			.biCompression = BI_RGB,
+		},
+	};
+
+	void* Bits;
+	HBITMAP Bitmap = CreateDIBSection(DeviceContext, &Info, DIB_RGB_COLORS, &Bits, NULL, 0);
+	Assert(Bitmap);
+
+	SelectObject(DeviceContext, Bitmap);
+	SetTextAlign(DeviceContext, TA_CENTER | TA_BASELINE);
+	SetTextColor(DeviceContext, RGB(255, 255, 255));
+	SetBkColor(DeviceContext, RGB(0, 0, 0));
+	ExtTextOutW(DeviceContext, Width / 2, Height / 2, ETO_OPAQUE, NULL, Message, MessageLength, NULL);
+
+	D3D11_TEXTURE2D_DESC TextureDesc =
+	{
+		.Width = Width,
+		.Height = Height,
+		.MipLevels = 0,
+		.ArraySize = 1,
+		.Format = DXGI_FORMAT_B8G8R8A8_UNORM,
+		.SampleDesc = { 1, 0 },
+		.Usage = D3D11_USAGE_DEFAULT,
+		.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE,
+		.MiscFlags = D3D11_RESOURCE_MISC_GENERATE_MIPS,
+	};
+
+	ID3D11Texture2D* Texture;
+	ID3D11Device_CreateTexture2D(Buddy->Device, &TextureDesc, NULL, &Texture);
+
+	D3D11_BOX Box =
+	{
+		.left = 0,
+		.top = 0,
+		.front = 0,
+		.right = Width,
+		.bottom = Height,
+		.back = 1,
+	};
+	ID3D11DeviceContext_UpdateSubresource(Buddy->Context, (ID3D11Resource*)Texture, 0, &Box, Bits, Width * 4, 0);
+
+	if (Buddy->InputView)
+	{
+		ID3D11ShaderResourceView_Release(Buddy->InputView);
+	}
+	ID3D11Device_CreateShaderResourceView(Buddy->Device, (ID3D11Resource*)Texture, NULL, &Buddy->InputView);
+	ID3D11Texture2D_Release(Texture);
+
+	DeleteObject(Bitmap);
+	DeleteObject(Font);
+	DeleteDC(DeviceContext);
+
+	Buddy->PresentReady = false;
+	Buddy->InputMipsGenerated = false;
+	Buddy->InputWidth = Width;
+	Buddy->InputHeight = Height;
+
+	InvalidateRect(Buddy->MainWindow, NULL, FALSE);
+}
+
+static void Buddy_CreateRendering(ScreenBuddy* Buddy, HWND Window)
+{
+	Buddy->ThumbTexture = NULL;
+	Buddy->ThumbWidth = 0;
+	Buddy->ThumbHeight = 0;
+	Buddy->InputMipsGenerated = false;
+	Buddy->InputWidth = 0;
+	Buddy->InputHeight = 0;
+	Buddy->OutputWidth = 0;
+	Buddy->OutputHeight = 0;
+	Buddy->InputView = NULL;
+	Buddy->OutputView = NULL;
+	Buddy->PresentReady = false;
+}
+
+static void Buddy_ReleaseRendering(ScreenBuddy* Buddy)
+{
+	ID3D11DeviceContext_ClearState(Buddy->Context);
+
+	if (Buddy->InputView)
+	{
+		ID3D11ShaderResourceView_Release(Buddy->InputView);
+	}
+	if (Buddy->OutputView)
+	{
+		ID3D11RenderTargetView_Release(Buddy->OutputView);
+	}
+	Buddy_ReleasePresentScaler(Buddy);
+	Buddy_ReleaseMinimap(Buddy);
+
+	ID3D11PixelShader_Release(Buddy->PixelShader);
+	ID3D11PixelShader_Release(Buddy->VertexShader);
+	ID3D11Buffer_Release(Buddy->ConstantBuffer);
+	IDXGISwapChain1_Release(Buddy->SwapChain);
+}
+
+static void Buddy_RenderWindow(ScreenBuddy* Buddy)
+{
+	RECT ClientRect;
+	GetClientRect(Buddy->MainWindow, &ClientRect);
+
+	int WindowWidth = ClientRect.right - ClientRect.left;
+	int WindowHeight = ClientRect.bottom - ClientRect.top;
+
+	if (WindowWidth == 0 || WindowHeight == 0)
+	{
+		return;
+	}
+
+	if (WindowWidth != Buddy->OutputWidth || WindowHeight != Buddy->OutputHeight)
+	{
+		if (Buddy->OutputView)
+		{
+			ID3D11DeviceContext_ClearState(Buddy->Context);
+			ID3D11RenderTargetView_Release(Buddy->OutputView);
+			Buddy->OutputView = NULL;
+		}
+
+		HR(IDXGISwapChain1_ResizeBuffers(Buddy->SwapChain, 0, WindowWidth, WindowHeight, DXGI_FORMAT_UNKNOWN, 0));
+		Buddy->OutputWidth = WindowWidth;
+		Buddy->OutputHeight = WindowHeight;
+	}
+
+	if (Buddy->OutputView == NULL)
+	{
+		ID3D11Texture2D* OutputTexture;
+		HR(IDXGISwapChain1_GetBuffer(Buddy->SwapChain, 0, &IID_ID3D11Texture2D, (void**)&OutputTexture));
+		ID3D11Device_CreateRenderTargetView(Buddy->Device, (ID3D11Resource*)OutputTexture, NULL, &Buddy->OutputView);
+		ID3D11Texture2D_Release(OutputTexture);
+	}
+
+	Assert(Buddy->InputView != NULL || Buddy->PresentReady);
+	int InputWidth = Buddy->InputWidth;
+	int InputHeight = Buddy->InputHeight;
+	int OutputWidth = Buddy->OutputWidth;
+	int OutputHeight = Buddy->OutputHeight;
+
+	if (OutputWidth * InputHeight < OutputHeight * InputWidth)
+	{
+		if (OutputWidth < InputWidth)
+		{
+			OutputHeight = InputHeight * OutputWidth / InputWidth;
+		}
+		else
+		{
+			OutputWidth = InputWidth;
+			OutputHeight = InputHeight;
+		}
+	}
+	else
+	{
+		if (OutputHeight < InputHeight)
+		{
+			OutputWidth = InputWidth * OutputHeight / InputHeight;
+		}
+		else
+		{
+			OutputWidth = InputWidth;
+			OutputHeight = InputHeight;
+		}
+	}
+
+	ID3D11DeviceContext* Context = Buddy->Context;
+
+	bool IsPartiallyCovered = OutputWidth != WindowWidth || OutputHeight != WindowHeight;
+	if (IsPartiallyCovered)
+	{
+		float BackgroundColor[4] = { 0, 0, 0, 0 };
+		ID3D11DeviceContext_ClearRenderTargetView(Context, Buddy->OutputView, BackgroundColor);
+	}
+
+	ID3D11ShaderResourceView* InputView = Buddy->InputView;
+	if (Buddy->PresentReady)
+	{
+		// software scaler produces image in exact output size
+		InputView = Buddy_UpdatePresent(Buddy, OutputWidth, OutputHeight);
+	}
+	else
+	{
+		bool IsInputLarger = InputWidth > OutputWidth || InputHeight > OutputHeight;
+		if (IsInputLarger)
+		{
+			if (!Buddy->InputMipsGenerated)
+			{
+				ID3D11DeviceContext_GenerateMips(Context, Buddy->InputView);
+				Buddy->InputMipsGenerated = true;
+			}
+		}
+	}
+
+	D3D11_MAPPED_SUBRESOURCE Mapped;
+	HR(ID3D11DeviceContext_Map(Context, (ID3D11Resource*)Buddy->ConstantBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &Mapped));
+	{
+		int W = OutputWidth;
+		int H = OutputHeight;
+		int X = (WindowWidth - OutputWidth) / 2;
+		int Y = (WindowHeight - OutputHeight) / 2;
+
+		float* Data = Mapped.pData;
+		Data[0] = (float)W / WindowWidth;
+		Data[1] = (float)H / WindowHeight;
+		Data[2] = (float)X / WindowWidth;
+		Data[3] = (float)Y / WindowHeight;
+	}
+	ID3D11DeviceContext_Unmap(Context, (ID3D11Resource*)Buddy->ConstantBuffer, 0);
+
+	D3D11_VIEWPORT Viewport =
+	{
+		.Width = (float)WindowWidth,
+		.Height = (float)WindowHeight,
+	};
+
+	ID3D11DeviceContext_ClearState(Context);
+	ID3D11DeviceContext_IASetPrimitiveTopology(Context, D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
+	ID3D11DeviceContext_VSSetConstantBuffers(Context, 0, 1, &Buddy->ConstantBuffer);
+	ID3D11DeviceContext_VSSetShader(Context, Buddy->VertexShader, NULL, 0);
+	ID3D11DeviceContext_RSSetViewports(Context, 1, &Viewport);
+	ID3D11DeviceContext_PSSetShaderResources(Context, 0, 1, &InputView);
+	ID3D11DeviceContext_PSSetShader(Context, Buddy->PixelShader, NULL, 0);
+	ID3D11DeviceContext_OMSetRenderTargets(Context, 1, &Buddy->OutputView, NULL);
+	ID3D11DeviceContext_Draw(Context, 4, 0);
+
+	// minimap is drawn over video at 1:1 size
+	RECT Minimap;
+	if (Buddy_GetMinimapRect(Buddy, &Minimap))
+	{
+		if (Buddy->ThumbDirty)
+		{
+			Buddy_UpdateMinimap(Buddy);
+		}
+
+		HR(ID3D11DeviceContext_Map(Context, (ID3D11Resource*)Buddy->ConstantBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &Mapped));
+		{
+			float* Data = Mapped.pData;
+			Data[0] = (float)Buddy->ThumbWidth / WindowWidth;
+			Data[1] = (float)Buddy->ThumbHeight / WindowHeight;
+			Data[2] = (float)Minimap.left / WindowWidth;
+			Data[3] = (float)Minimap.top / WindowHeight;
+		}
+		ID3D11DeviceContext_Unmap(Context, (ID3D11Resource*)Buddy->ConstantBuffer, 0);
+
+		ID3D11DeviceContext_PSSetShaderResources(Context, 0, 1, &Buddy->ThumbView);
+		ID3D11DeviceContext_Draw(Context, 4, 0);
+	}
+
+	HR(IDXGISwapChain1_Present(Buddy->SwapChain, 0, 0));
+}
+
+static bool Buddy_GetMousePosition(ScreenBuddy* Buddy, Buddy_MousePacket* Packet, int X, int Y)
+{
+	int InputWidth = Buddy->InputWidth;
+	int InputHeight = Buddy->InputHeight;
+	int OutputWidth = Buddy->OutputWidth;
+	int OutputHeight = Buddy->OutputHeight;
+
+	if (OutputWidth == 0 || OutputHeight == 0)
+	{
+		return false;
+	}
+
+	int WindowWidth = OutputWidth;
+	int WindowHeight = OutputHeight;
+
+	if (OutputWidth * InputHeight < OutputHeight * InputWidth)
+	{
+		if (OutputWidth < InputWidth)
+		{
+			OutputHeight = InputHeight * OutputWidth / InputWidth;
+		}
+		else
+		{
+			OutputWidth = InputWidth;
+			OutputHeight = InputHeight;
+		}
+	}
+	else
+	{
+		if (OutputHeight < InputHeight)
+		{
+			OutputWidth = InputWidth * OutputHeight / InputHeight;
+		}
+		else
+		{
+			OutputWidth = InputWidth;
+			OutputHeight = InputHeight;
+		}
+	}
+
+	int OffsetX = (WindowWidth - OutputWidth) / 2;
+	int OffsetY = (WindowHeight - OutputHeight) / 2;
+
+	X = (X - OffsetX) * InputWidth / OutputWidth;
+	Y = (Y - OffsetY) * InputHeight / OutputHeight;
+
+	Packet->X = X < INT16_MIN ? INT16_MIN : X > INT16_MAX ? INT16_MAX : X;
+	Packet->Y = Y < INT16_MIN ? INT16_MIN : Y > INT16_MAX ? INT16_MAX : Y;
+
+	return true;
+}
+
+static void Buddy_UpdateState(ScreenBuddy* Buddy, BuddyState NewState)
+{
+	bool Disconnected = NewState == BUDDY_STATE_INITIAL || NewState == BUDDY_STATE_DISCONNECTED;
+	bool Sharing = NewState == BUDDY_STATE_SHARE_STARTED || NewState == BUDDY_STATE_SHARING;
+	bool Connecting = NewState == BUDDY_STATE_CONNECTING || NewState == BUDDY_STATE_CONNECTED;
+
+	Button_SetText(GetDlgItem(Buddy->DialogWindow, BUDDY_ID_SHARE_BUTTON), Disconnected || Connecting ? L"Share" : L"Stop");
+	Button_SetText(GetDlgItem(Buddy->DialogWindow, BUDDY_ID_CONNECT_BUTTON), Disconnected || Sharing ? L"Connect" : L"Disconnect");
+
+	// new connection cannot start while previous one is still being opened
+	bool CanStart = Disconnected && !Buddy->NetOpening;
+
+	EnableWindow(GetDlgItem(Buddy->DialogWindow, BUDDY_ID_SHARE_BUTTON), CanStart || Sharing);
+	EnableWindow(GetDlgItem(Buddy->DialogWindow, BUDDY_ID_CONNECT_BUTTON), CanStart || Connecting);
+
+	EnableWindow(GetDlgItem(Buddy->DialogWindow, BUDDY_ID_SHARE_NEW), Disconnected);
+	EnableWindow(GetDlgItem(Buddy->DialogWindow, BUDDY_ID_CONNECT_PASTE), Disconnected);
+	EnableWindow(GetDlgItem(Buddy->DialogWindow, BUDDY_ID_SHARE_KEY), Disconnected);
+	EnableWindow(GetDlgItem(Buddy->DialogWindow, BUDDY_ID_CONNECT_KEY), Disconnected);
+
+	// capture target can change only while session is running
+	HMENU Menu = GetSystemMenu(Buddy->DialogWindow, FALSE);
+	UINT CaptureItems = MF_BYCOMMAND | (NewState == BUDDY_STATE_SHARING ? MF_ENABLED : MF_GRAYED);
+	EnableMenuItem(Menu, BUDDY_ID_CAPTURE_MONITOR, CaptureItems);
+	EnableMenuItem(Menu, BUDDY_ID_CAPTURE_WINDOW, CaptureItems);
+
+	Buddy_Metric(Buddy, "state", NewState);
+	Buddy->State = NewState;
+}
+
+static void Buddy_StopDecoder(ScreenBuddy* Buddy)
+{
+	IMFTransform_Release(Buddy->Codec);
+	if (Buddy->Converter)
+	{
+		IMFTransform_Release(Buddy->Converter);
+	}
+	Buddy_ReleasePresentFrame(Buddy);
+	Buddy_ReleasePresentScaler(Buddy);
+	Buddy_ReleaseOverlayLayer(Buddy);
+
+	if (Buddy->DecodeInputBuffer)
+	{
+		IMFMediaBuffer_Release(Buddy->DecodeInputBuffer);
+	}
+	if (Buddy->DecodeOutputSample)
+	{
+		IMFSample_Release(Buddy->DecodeOutputSample);
+	}
+}
+
+// everything created by Buddy_CreateEncoder, queued frames are dropped & events from old encoder are ignored
+static void Buddy_ReleaseEncoder(ScreenBuddy* Buddy)
+{
+	if (!Buddy->Codec)
+	{
+		return;
+	}
+
+	IMFShutdown* Shutdown;
+	HR(IMFTransform_QueryInterface(Buddy->Codec, &IID_IMFShutdown, (void**)&Shutdown));
+	HR(IMFShutdown_Shutdown(Shutdown));
+	IMFShutdown_Release(Shutdown);
+
+	while (Buddy->EncodeQueueRead != Buddy->EncodeQueueWrite)
+	{
+		IMFSample_Release(Buddy->EncodeQueue[Buddy->EncodeQueueRead % BUDDY_ENCODE_QUEUE_SIZE]);
+		Buddy->EncodeQueueRead += 1;
+	}
+
+	IMFMediaEventGenerator_Release(Buddy->Generator);
+	IMFTransform_Release(Buddy->Codec);
+	if (Buddy->Converter)
+	{
+		IMFTransform_Release(Buddy->Converter);
+	}
+	IMFVideoSampleAllocatorEx_Release(Buddy->EncodeSampleAllocator);
+	Buddy_ReleaseSoftwareConverter(Buddy);
+	Buddy_ReleaseFrameScaler(Buddy);
+	Buddy_ReleaseOverlayTiles(Buddy);
+	Buddy_ReleaseScroll(&Buddy->Scroll);
+	Buddy_ReleaseChanges(&Buddy->Changes);
+
+	Buddy->Generator = NULL;
+	Buddy->Codec = NULL;
+	Buddy->Converter = NULL;
+	Buddy->EncodeSampleAllocator = NULL;
+}
+
+static void Buddy_StopSharing(ScreenBuddy* Buddy)
+{
+	if (Buddy->State == BUDDY_STATE_SHARING)
+	{
+		ScreenCapture_Stop(&Buddy->Capture);
+	}
+
+	Buddy_PaceReset(Buddy);
+	SetWindowTextW(Buddy->DialogWindow, BUDDY_TITLE);
+
+	Buddy_ReleaseEncoder(Buddy);
+	Buddy_ReleaseThumbnail(Buddy);
+	ScreenCapture_Release(&Buddy->Capture);
+}
+
+static void Buddy_Disconnect(ScreenBuddy* Buddy, const wchar_t* Message)
+{
+	if (Buddy->State == BUDDY_STATE_CONNECTING || Buddy->State == BUDDY_STATE_CONNECTED)
+	{
+		if (Buddy->State == BUDDY_STATE_CONNECTING)
+		{
+			KillTimer(Buddy->MainWindow, BUDDY_DISCONNECT_TIMER);
+			KillTimer(Buddy->MainWindow, BUDDY_MESH_TIMER);
+		}
+		Buddy_StopDecoder(Buddy);
+
+		if (Buddy->ProgressWindow)
+		{
+			SendMessageW(Buddy->ProgressWindow, TDM_CLICK_BUTTON, IDCANCEL, 0);
+		}
+		DragAcceptFiles(Buddy->MainWindow, FALSE);
+
+		Buddy_ShowMessage(Buddy, Message);
+		Buddy_CloseNet(Buddy);
+	}
+	else if (Buddy->State == BUDDY_STATE_SHARE_STARTED || Buddy->State == BUDDY_STATE_SHARING)
+	{
+		Buddy_StopSharing(Buddy);
+
+		MessageBoxW(Buddy->DialogWindow, Message, BUDDY_TITLE, MB_ICONERROR);
+		Buddy_CloseNet(Buddy);
+	}
+
+	Buddy_UpdateState(Buddy, BUDDY_STATE_DISCONNECTED);
+}
+
+// relays did not forward first packet to sharer's region, viewer connects to sharer's region directly
+static void Buddy_MeshFallback(ScreenBuddy* Buddy)
+{
+	KillTimer(Buddy->MainWindow, BUDDY_MESH_TIMER);
+
+	if (Buddy->State != BUDDY_STATE_CONNECTING || Buddy->NetOpening || Buddy->NetRegion == Buddy->PeerRegion)
+	{
+		return;
+	}
+
+	if (Buddy->NetOpen)
+	{
+		Buddy_StopNetThread(&Buddy->NetRing);
+		DerpNet_Close(&Buddy->Net);
+		Buddy->NetOpen = false;
+	}
+
+	if (!Buddy_OpenNet(Buddy, Buddy->PeerRegion, &Buddy->NetPrivateKey))
+	{
+		Buddy_Disconnect(Buddy, L"Cannot connect to DerpNet server!");
+	}
+}
+
+static HRESULT CALLBACK Buddy_TaskCallback(HWND TaskWindow, UINT Message, WPARAM WParam, LPARAM LParam, LONG_PTR Data)
+{
+	ScreenBuddy* Buddy = (void*)Data;
+
+	switch (Message)
+	{
+	case TDN_CREATED:
+		Buddy->ProgressWindow = TaskWindow;
+		SendMessageW(TaskWindow, TDM_SET_PROGRESS_BAR_MARQUEE, TRUE, 0);
+		break;
+	}
+	return S_OK;
+}
+
+static void Buddy_SendFile(ScreenBuddy* Buddy, wchar_t* FileName)
+{
+	HANDLE FileHandle = CreateFileW(FileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+	if (FileHandle != INVALID_HANDLE_VALUE)
+	{
+		LARGE_INTEGER FileSize;
+		if (GetFileSizeEx(FileHandle, &FileSize) && FileSize.QuadPart)
+		{
+			Buddy->FileHandle = FileHandle;
+			Buddy->FileSize = FileSize.QuadPart;
+			Buddy->FileProgress = 0;
+			Buddy->FileLastTime = 0;
+			Buddy->FileLastSize = 0;
+			Buddy->ProgressWindow = NULL;
+
+			uint8_t Data[1 + 8 + 256];
+			Data[0] = BUDDY_PACKET_FILE;
+			CopyMemory(&Data[1], &FileSize, sizeof(FileSize));
+			size_t DataSize = 1 + 8 + WideCharToMultiByte(CP_UTF8, 0, FileName, -1, (char*)&Data[1 + 8], 256, NULL, NULL) - 1;
+
+			if (!DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, Data, DataSize))
+			{
+				Buddy_NetFailed(Buddy, L"DerpNet disconnect while sending filename!");
+			}
+			else
+			{
+				SHFILEINFOW FileInfo;
+				DWORD_PTR IconOk = SHGetFileInfoW(FileName, 0, &FileInfo, sizeof(FileInfo), SHGFI_ICON | SHGFI_USEFILEATTRIBUTES);
+
+				PathStripPathW(FileName);
+
+				TASKDIALOGCONFIG Config =
+				{
+					.cbSize = sizeof(Config),
+					.hwndParent = Buddy->MainWindow,
+					.dwFlags = TDF_USE_HICON_MAIN | TDF_ALLOW_DIALOG_CANCELLATION | TDF_SHOW_MARQUEE_PROGRESS_BAR | TDF_CAN_BE_MINIMIZED | TDF_SIZE_TO_CONTENT,
+					.dwCommonButtons = TDCBF_CANCEL_BUTTON,
+					.pszWindowTitle = BUDDY_TITLE,
+					.hMainIcon = IconOk ? FileInfo.hIcon : Buddy->Icon,
+					.pszMainInstruction = FileName,
+					.pszContent = L"Sending file...",
+					.nDefaultButton = IDCANCEL,
+					.pfCallback = &Buddy_TaskCallback,
+					.lpCallbackData = (LONG_PTR)Buddy,
+				};
+
+				TaskDialogIndirect(&Config, NULL, NULL, NULL);
+				KillTimer(Buddy->MainWindow, BUDDY_FILE_TIMER);
+
+				Buddy->ProgressWindow = NULL;
+				Buddy->FileHandle = NULL;
+
+				if (IconOk)
+				{
+					DestroyIcon(FileInfo.hIcon);
+				}
+			}
+		}
+
+		CloseHandle(FileHandle);
+	}
+}
+
+static bool Buddy_SendDatagram(ScreenBuddy* Buddy, const void* Data, size_t DataSize);
+
+static LRESULT CALLBACK Buddy_WindowProc(HWND Window, UINT Message, WPARAM WParam, LPARAM LParam)
+{
+	if (Message == WM_NCCREATE)
+	{
+		SetWindowLongPtrW(Window, GWLP_USERDATA, (LONG_PTR)(((CREATESTRUCT*)LParam)->lpCreateParams));
+		return DefWindowProcW(Window, Message, WParam, LParam);
+	}
+
+	ScreenBuddy* Buddy = (void*)GetWindowLongPtrW(Window, GWLP_USERDATA);
+	if (!Buddy)
+	{
+		return DefWindowProcW(Window, Message, WParam, LParam);
+	}
+
+	switch (Message)
+	{
+	case WM_CREATE:
+	{
+		Buddy->LastReceived = 0;
+		Buddy_CreateRendering(Buddy, Window);
+		Buddy_ShowMessage(Buddy, L"Connecting...");
+		SetTimer(Window, BUDDY_UPDATE_TITLE_TIMER, 1000, NULL);
+		SetWindowTextW(Window, BUDDY_TITLE);
+
+		HMENU Menu = GetSystemMenu(Window, FALSE);
+		AppendMenuW(Menu, MF_SEPARATOR, 0, NULL);
+		AppendMenuW(Menu, MF_STRING, BUDDY_ID_VIEWPORT, L"Native Resolution Viewport");
+		return 0;
+	}
+
+	case WM_SYSCOMMAND:
+		if ((WParam & 0xfff0) == BUDDY_ID_VIEWPORT)
+		{
+			Buddy_ToggleViewport(Buddy);
+			return 0;
+		}
+		break;
+
+	case WM_CAPTURECHANGED:
+		Buddy->ViewDrag = false;
+		return 0;
+
+	case WM_DESTROY:
+		Buddy_ReleaseRendering(Buddy);
+		Buddy_UpdateState(Buddy, BUDDY_STATE_INITIAL);
+		ShowWindow(Buddy->DialogWindow, SW_SHOWDEFAULT);
+		return 0;
+
+	case WM_TIMER:
+		if (WParam == BUDDY_DISCONNECT_TIMER)
+		{
+			Buddy_Disconnect(Buddy, L"Timeout while connecting to remote computer!");
+		}
+		else if (WParam == BUDDY_MESH_TIMER)
+		{
+			Buddy_MeshFallback(Buddy);
+		}
+		else if (WParam == BUDDY_UPDATE_TITLE_TIMER)
+		{
+			size_t BytesReceived = Buddy->Net.TotalReceived - Buddy->LastReceived;
+			Buddy->LastReceived = Buddy->Net.TotalReceived;
+
+			Buddy_Metric(Buddy, "recv_kbps", (double)BytesReceived * 8.0 / 1000.0);
+			Buddy_Metric(Buddy, "migrating", Buddy->NetMigrating);
+			Buddy_NetRingMetrics(Buddy);
+			Buddy_NetSendMetrics(Buddy, 1000);
+
+			wchar_t Title[256];
+			if (Buddy->NetMigrating)
+			{
+				StrFormat(Title, L"%ls - reconnecting...", BUDDY_TITLE);
+			}
+			else if (Buddy->FailoverTime)
+			{
+				StrFormat(Title, L"%ls - %.f KB/s - failover %u ms", BUDDY_TITLE, (double)BytesReceived / 1024.0, Buddy->FailoverTime);
+			}
+			else if (Buddy->KeyRecoverTime)
+			{
+				StrFormat(Title, L"%ls - %.f KB/s - recover %u ms", BUDDY_TITLE, (double)BytesReceived / 1024.0, Buddy->KeyRecoverTime);
+			}
+			else if (Buddy->FormatGapTime)
+			{
+				StrFormat(Title, L"%ls - %.f KB/s - format change %u ms", BUDDY_TITLE, (double)BytesReceived / 1024.0, Buddy->FormatGapTime);
+			}
+			else if (Buddy->NetLatency)
+			{
+				StrFormat(Title, L"%ls - %.f KB/s - rtt %u ms", BUDDY_TITLE, (double)BytesReceived / 1024.0, Buddy->NetLatency);
+			}
+			else
+			{
+				StrFormat(Title, L"%ls - %.f KB/s", BUDDY_TITLE, (double)BytesReceived / 1024.0);
+			}
+			SetWindowTextW(Window, Title);
+		}
+		else if (WParam == BUDDY_FILE_TIMER)
+		{
+			if (Buddy->ProgressWindow && Buddy->NetOpen)
+			{
+				LARGE_INTEGER TimeNow;
+				QueryPerformanceCounter(&TimeNow);
+
+				uint8_t Buffer[1 + (8 << 10)];
+				DWORD Read = 0;
+				if (ReadFile(Buddy->FileHandle, Buffer + 1, sizeof(Buffer) - 1, &Read, NULL))
+				{
+					if (Read == 0)
+					{
+						SendMessageW(Buddy->ProgressWindow, TDM_CLICK_BUTTON, IDCANCEL, 0);
+					}
+					else
+					{
+						Buffer[0] = BUDDY_PACKET_FILE_DATA;
+						if (!DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, Buffer, 1 + Read))
+						{
+							Buddy_NetFailed(Buddy, L"DerpNet disconnect while sending file data!");
+						}
+						else
+						{
+							Buddy->FileProgress += Read;
+
+							if (Buddy->FileLastTime == 0)
+							{
+								Buddy->FileLastTime = TimeNow.QuadPart;
+							}
+							else if (TimeNow.QuadPart - Buddy->FileLastTime >= Buddy->Freq)
+							{
+								double Time = (double)(TimeNow.QuadPart - Buddy->FileLastTime) / Buddy->Freq;
+								double Speed = (Buddy->FileProgress - Buddy->FileLastSize) / Time;
+
+								wchar_t Text[1024];
+								StrFormat(Text, L"Sending file... %.2f KB (%.2f KB/s)", Buddy->FileProgress / 1024.0, Speed / 1024.0);
+
+								SendMessageW(Buddy->ProgressWindow, TDM_SET_ELEMENT_TEXT, TDE_CONTENT, (LPARAM)Text);
+								SendMessageW(Buddy->ProgressWindow, TDM_SET_PROGRESS_BAR_POS, Buddy->FileProgress * 100 / Buddy->FileSize, 0);
+
+								Buddy->FileLastTime = TimeNow.QuadPart;
+								Buddy->FileLastSize = Buddy->FileProgress;
+							}
+						}
+					}
+				}
+			}
+		}
+		return 0;
+
+	case WM_DROPFILES:
 	{
-		MessageBoxW(Buddy->DialogWindow, L"Cannot create GPU encoder!", L"Error", MB_ICONERROR);
+		HDROP Drop = (HDROP)WParam;
+		wchar_t FileName[256];
+		if (DragQueryFileW(Drop, 0, FileName, ARRAYSIZE(FileName)))
+		{
+			if (Buddy->State == BUDDY_STATE_CONNECTED && !Buddy->NetMigrating)
+			{
+				DragAcceptFiles(Buddy->MainWindow, FALSE);
+				Buddy_SendFile(Buddy, FileName);
+				DragAcceptFiles(Buddy->MainWindow, TRUE);
+			}
+		}
+		DragFinish(Drop);
+		return 0;
+	}
+
+	case WM_PAINT:
+		Buddy_RenderWindow(Buddy);
+		ValidateRect(Window, NULL);
+		return 0;
+
+	case WM_CLOSE:
+		if (Buddy->State == BUDDY_STATE_CONNECTING)
+		{
+			Buddy_CloseNet(Buddy);
+		}
+		else if (Buddy->State == BUDDY_STATE_CONNECTED)
+		{
+			if (MessageBoxW(Window, L"Do you want to disconnect?", BUDDY_TITLE, MB_ICONQUESTION | MB_YESNO) == IDNO)
+			{
+				return 0;
+			}
+
+			if (Buddy->NetOpen)
+			{
+				uint8_t Data[1] = { BUDDY_PACKET_DISCONNECT };
+				DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, Data, sizeof(Data));
+			}
+
+			Buddy_CloseNet(Buddy);
+
+			if (Buddy->ProgressWindow)
+			{
+				SendMessageW(Buddy->ProgressWindow, TDM_CLICK_BUTTON, IDCANCEL, 0);
+			}
+		}
+
+		Buddy_UpdateState(Buddy, BUDDY_STATE_DISCONNECTED);
+		break;
+
+	case WM_MOUSEMOVE:
+	{
+		if (Buddy->ViewDrag)
+		{
+			RECT Minimap;
+			if (Buddy_GetMinimapRect(Buddy, &Minimap))
+			{
+				Buddy_PanViewport(Buddy, &Minimap, GET_X_LPARAM(LParam), GET_Y_LPARAM(LParam));
+			}
+		}
+		else if (Buddy->State == BUDDY_STATE_CONNECTED)
+		{
+			Buddy_MousePacket Packet =
+			{
+				.Packet = BUDDY_PACKET_MOUSE_MOVE,
+			};
+			if (Buddy_GetMousePosition(Buddy, &Packet, GET_X_LPARAM(LParam), GET_Y_LPARAM(LParam)))
+			{
+				if (!Buddy_SendDatagram(Buddy, &Packet, sizeof(Packet)))
+				{
+					Buddy_NetFailed(Buddy, L"DerpNet disconnect while sending data!");
+				}
+			}
+		}
+		return 0;
+	}
+
+	case WM_LBUTTONDOWN:
+	case WM_RBUTTONDOWN:
+	case WM_MBUTTONDOWN:
+	case WM_XBUTTONDOWN:
+	{
+		SetCapture(Window);
+
+		// clicks on minimap pan viewport & are not sent to remote computer
+		RECT Minimap;
+		POINT Point = { GET_X_LPARAM(LParam), GET_Y_LPARAM(LParam) };
+		if (Buddy_GetMinimapRect(Buddy, &Minimap) && PtInRect(&Minimap, Point))
+		{
+			if (Message == WM_LBUTTONDOWN)
+			{
+				Buddy->ViewDrag = true;
+				Buddy_PanViewport(Buddy, &Minimap, Point.x, Point.y);
+			}
+		}
+		else if (Buddy->State == BUDDY_STATE_CONNECTED && Buddy->NetOpen)
+		{
+			Buddy_MousePacket Packet =
+			{
+				.Packet = BUDDY_PACKET_MOUSE_BUTTON,
+				.Button = Message == WM_LBUTTONDOWN ? 0 : Message == WM_RBUTTONDOWN ? 1 : Message == WM_MBUTTONDOWN ? 2 : -1,
+				.IsDownOrHorizontalWheel = 1,
+			};
+			if (Message == WM_XBUTTONDOWN)
+			{
+				Packet.Button = HIWORD(WParam) == XBUTTON1 ? 3 : 4;
+			}
+			if (Buddy_GetMousePosition(Buddy, &Packet, GET_X_LPARAM(LParam), GET_Y_LPARAM(LParam)))
+			{
+				if (!DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, &Packet, sizeof(Packet)))
+				{
+					Buddy_NetFailed(Buddy, L"DerpNet disconnect while sending data!");
+				}
+			}
+		}
+		return 0;
+	}
+
+	case WM_LBUTTONUP:
+	case WM_RBUTTONUP:
+	case WM_MBUTTONUP:
+	case WM_XBUTTONUP:
+	{
+		// releasing capture ends panning
+		bool Panning = Buddy->ViewDrag;
+		ReleaseCapture();
+
+		RECT Minimap;
+		POINT Point = { GET_X_LPARAM(LParam), GET_Y_LPARAM(LParam) };
+		bool OnMinimap = Panning || (Buddy_GetMinimapRect(Buddy, &Minimap) && PtInRect(&Minimap, Point));
+
+		// remote computer did not get button press on minimap
+		if (!OnMinimap && Buddy->State == BUDDY_STATE_CONNECTED && Buddy->NetOpen)
+		{
+			Buddy_MousePacket Packet =
+			{
+				.Packet = BUDDY_PACKET_MOUSE_BUTTON,
+				.Button = Message == WM_LBUTTONUP ? 0 : Message == WM_RBUTTONUP ? 1 : Message == WM_MBUTTONUP ? 2 : -1,
+				.IsDownOrHorizontalWheel = 0,
+			};
+			if (Message == WM_XBUTTONUP)
+			{
+				Packet.Button = HIWORD(WParam) == XBUTTON1 ? 3 : 4;
+			}
+			if (Buddy_GetMousePosition(Buddy, &Packet, GET_X_LPARAM(LParam), GET_Y_LPARAM(LParam)))
+			{
+				if (!DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, &Packet, sizeof(Packet)))
+				{
+					Buddy_NetFailed(Buddy, L"DerpNet disconnect while sending data!");
+				}
+			}
+		}
+		return 0;
+	}
+
+	case WM_MOUSEWHEEL:
+	case WM_MOUSEHWHEEL:
+	{
+		if (Buddy->State == BUDDY_STATE_CONNECTED && Buddy->NetOpen)
+		{
+			POINT Point = { GET_X_LPARAM(LParam), GET_Y_LPARAM(LParam) };
+			ScreenToClient(Window, &Point);
+
+			Buddy_MousePacket Packet =
+			{
+				.Packet = BUDDY_PACKET_MOUSE_WHEEL,
+				.Button = GET_WHEEL_DELTA_WPARAM(WParam),
+				.IsDownOrHorizontalWheel = Message == WM_MOUSEHWHEEL ? 1 : 0,
+			};
+			Buddy_GetMousePosition(Buddy, &Packet, Point.x, Point.y);
+
+			if (!DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, &Packet, sizeof(Packet)))
+			{
+				Buddy_NetFailed(Buddy, L"DerpNet disconnect while sending data!");
+			}
+		}
+		return 0;
+	}
+
+	}
+
+	return DefWindowProcW(Window, Message, WParam, LParam);
+}
+
+//
+
+static bool Buddy_StartSharing(ScreenBuddy* Buddy)
+{
+	ScreenCapture_Create(&Buddy->Capture, &Buddy_OnFrameCapture, false);
+
+	HMONITOR Monitor = MonitorFromWindow(Buddy->DialogWindow, MONITOR_DEFAULTTOPRIMARY);
+	Assert(Monitor);
+
+	if (ScreenCapture_CreateForMonitor(&Buddy->Capture, Buddy->Device, Monitor, NULL))
+	{
+		int CaptureWidth = Buddy->Capture.Rect.right - Buddy->Capture.Rect.left;
+		int CaptureHeight = Buddy->Capture.Rect.bottom - Buddy->Capture.Rect.top;
+
+		// full size until viewer reports its window size
+		RECT Crop = { 0, 0, CaptureWidth, CaptureHeight };
+		if (Buddy_CreateEncoder(Buddy, &Crop, CaptureWidth, CaptureHeight))
+		{
+			Buddy->EncodeFrameId = 0;
+			Buddy->KeyForceTime = 0;
+			Buddy->KeyPending = false;
+			Buddy->KeySoftActive = false;
+			Buddy->ViewWidth = 0;
+			Buddy->ViewHeight = 0;
+			Buddy->ViewChangeTime = 0;
+			Buddy->ViewZoom = false;
+			Buddy->ViewRefresh = false;
+			if (Buddy_OpenNet(Buddy, Buddy->DerpRegion, &Buddy->MyPrivateKey))
+			{
+				return true;
+			}
+			else
+			{
+				MessageBoxW(Buddy->DialogWindow, L"Cannot connect to DerpNet server!", L"Error", MB_ICONERROR);
+			}
+		}
+		else
+		{
+			MessageBoxW(Buddy->DialogWindow, L"Cannot create GPU video encoder!", L"Error", MB_ICONERROR);
+		}
+	}
+	else
+	{
+		MessageBoxW(Buddy->DialogWindow, L"Cannot capture monitor output!", L"Error", MB_ICONERROR);
+	}
+
+	ScreenCapture_Release(&Buddy->Capture);
+	return false;
+
+}
+
+static bool Buddy_StartConnection(ScreenBuddy* Buddy)
+{
+	wchar_t ConnectKey[256];
+	int ConnectKeyLength = Edit_GetText(GetDlgItem(Buddy->DialogWindow, BUDDY_ID_CONNECT_KEY), ConnectKey, ARRAYSIZE(ConnectKey));
+	if (ConnectKeyLength != 2 + 2 * 32)
+	{
+		MessageBoxW(Buddy->DialogWindow, L"Incorrect length for connection code!", BUDDY_TITLE, MB_ICONERROR);
+		return false;
+	}
+
+	uint8_t Region;
+	swscanf(ConnectKey, L"%02hhx", &Region);
+	for (int i = 0; i < 32; i++)
+	{
+		swscanf(ConnectKey + 2 + 2 * i, L"%02hhx", &Buddy->RemoteKey.Bytes[i]);
+	}
+
+	if (!Buddy_CreateDecoder(Buddy))
+	{
+		return false;
+	}
+	Buddy->DecodeFrameId = 0;
+	Buddy->FailoverCount = 0;
+
+	// first request only if sharer's first keyframe does not arrive
+	Buddy->KeyWaiting = true;
+	Buddy->KeyMeasure = false;
+	Buddy->KeyRequestTime = GetTickCount64();
+	Buddy->KeyLossTime = 0;
+	Buddy->KeyRecoverTime = 0;
+	Buddy->DecodeFrameTime = 0;
+	Buddy->FormatMeasure = false;
+	Buddy->FormatGapTime = 0;
+
+	// window size is reported once connected
+	Buddy->ViewWidth = 0;
+	Buddy->ViewHeight = 0;
+	Buddy->ViewNextWidth = 0;
+	Buddy->ViewNextHeight = 0;
+
+	// whole desktop until viewport is switched on from window menu
+	Buddy->ViewZoom = false;
+	Buddy->ViewDrag = false;
+	Buddy->ViewCenterX = 0x8000;
+	Buddy->ViewCenterY = 0x8000;
+	Buddy->DesktopWidth = 0;
+	Buddy->DesktopHeight = 0;
+
+	DerpKey NewPrivateKey;
+	DerpNet_CreateNewKey(&NewPrivateKey);
+
+	// with meshed relays packets reach sharer from any region, so nearest one is used
+	uint32_t NetRegion = Region;
+	if (Buddy->DerpMesh && Buddy->DerpRegion != Region && Buddy_GetDerpNode(&Buddy->DerpMap.Regions[Buddy->DerpRegion]))
+	{
+		NetRegion = Buddy->DerpRegion;
+	}
+	Buddy->PeerRegion = Region;
+
+	// window shows up immediately, first packet is sent once connection is open
+	if (!Buddy_OpenNet(Buddy, NetRegion, &NewPrivateKey))
+	{
+		Buddy_StopDecoder(Buddy);
+		MessageBoxW(Buddy->DialogWindow, L"Cannot connect to DerpNet server!", BUDDY_TITLE, MB_ICONERROR);
 		return false;
 	}
 
-	//wchar_t Name[256];
-	//HR(IMFActivate_GetString(Activate[0], &MFT_FRIENDLY_NAME_Attribute, Name, ARRAYSIZE(Name), NULL));
-	//OutputDebugStringW(Name);
+	Buddy->MainWindow = CreateWindowExW(
+		0, BUDDY_CLASS, BUDDY_TITLE, WS_OVERLAPPEDWINDOW,
+		CW_USEDEFAULT, CW_USEDEFAULT, CW_USEDEFAULT, CW_USEDEFAULT,
+		NULL, NULL, GetModuleHandleW(NULL), Buddy);
+	Assert(Buddy->MainWindow);
 
-	IMFTransform* Encoder;
-	HR(IMFActivate_ActivateObject(Activate[0], &IID_IMFTransform, (void**)&Encoder));
-	for (UINT32 Index = 0; Index < ActivateCount; Index++)
+	D3D11_BUFFER_DESC ConstantBufferDesc =
 	{
-		IMFActivate_Release(Activate[Index]);
-	}
-	CoTaskMemFree(Activate);
+		.ByteWidth = 4 * sizeof(float),
+		.Usage = D3D11_USAGE_DYNAMIC,
+		.BindFlags = D3D11_BIND_CONSTANT_BUFFER,
+		.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE,
+	};
+	ID3D11Device_CreateBuffer(Buddy->Device, &ConstantBufferDesc, NULL, &Buddy->ConstantBuffer);
 
-	IMFTransform* Converter;
-	HR(CoCreateInstance(&CLSID_VideoProcessorMFT, NULL, CLSCTX_INPROC_SERVER, &IID_IMFTransform, (void**)&Converter));
+	ID3D11Device_CreateVertexShader(Buddy->Device, ScreenBuddyVS, sizeof(ScreenBuddyVS), NULL, &Buddy->VertexShader);
+	ID3D11Device_CreatePixelShader(Buddy->Device, ScreenBuddyPS, sizeof(ScreenBuddyPS), NULL, &Buddy->PixelShader);
+
+	IDXGIDevice* DxgiDevice;
+	IDXGIAdapter* DxgiAdapter;
+	IDXGIFactory2* DxgiFactory;
+
+	HR(ID3D11Device_QueryInterface(Buddy->Device, &IID_IDXGIDevice, (void**)&DxgiDevice));
+	HR(IDXGIDevice_GetAdapter(DxgiDevice, &DxgiAdapter));
+	HR(IDXGIAdapter_GetParent(DxgiAdapter, &IID_IDXGIFactory2, (void**)&DxgiFactory));
 
+	DXGI_SWAP_CHAIN_DESC1 Desc =
 	{
-		IMFAttributes* Attributes;
-		HR(IMFTransform_GetAttributes(Converter, &Attributes));
-		HR(IMFAttributes_SetUINT32(Attributes, &MF_XVP_PLAYBACK_MODE, TRUE));
-		HR(IMFAttributes_SetUINT32(Attributes, &MF_XVP_CALLER_ALLOCATES_OUTPUT, TRUE));
-		IMFAttributes_Release(Attributes);
-	}
+		.Format = DXGI_FORMAT_B8G8R8A8_UNORM,
+		.SampleDesc = { 1, 0 },
+		.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT,
+		.BufferCount = 2,
+		.Scaling = DXGI_SCALING_NONE,
+		.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD,
+	};
+	HR(IDXGIFactory2_CreateSwapChainForHwnd(DxgiFactory, (IUnknown*)Buddy->Device, Buddy->MainWindow, &Desc, NULL, NULL, &Buddy->SwapChain));
+	HR(IDXGIFactory2_MakeWindowAssociation(DxgiFactory, Buddy->MainWindow, DXGI_MWA_NO_ALT_ENTER));
 
-	// unlock async encoder
+	IDXGIFactory2_Release(DxgiFactory);
+	IDXGIAdapter_Release(DxgiAdapter);
+	IDXGIDevice_Release(DxgiDevice);
+
+	ShowWindow(Buddy->MainWindow, SW_SHOWDEFAULT);
+	ShowWindow(Buddy->DialogWindow, SW_HIDE);
+	return true;
+}
+
+static void Buddy_OnMouseInput(ScreenBuddy* Buddy, uint8_t Packet, const uint8_t* RecvData, uint32_t RecvSize)
+{
+	Buddy_MousePacket Data;
+	if (1 + RecvSize == sizeof(Data))
 	{
-		IMFAttributes* Attributes;
-		HR(IMFTransform_GetAttributes(Encoder, &Attributes));
+		CopyMemory(&Data.Packet + 1, RecvData, RecvSize);
 
-		UINT32 IsAsync;
-		HR(IMFAttributes_GetUINT32(Attributes, &MF_TRANSFORM_ASYNC, &IsAsync));
-		Assert(IsAsync);
+		// captured pixels start at top-left of monitor, or of window's frame, which can move
+		POINT Origin;
+		if (Buddy->Capture.Window)
+		{
+			RECT Bounds;
+			if (FAILED(DwmGetWindowAttribute(Buddy->Capture.Window, DWMWA_EXTENDED_FRAME_BOUNDS, &Bounds, sizeof(Bounds))))
+			{
+				return;
+			}
+			Origin = (POINT){ Bounds.left, Bounds.top };
+		}
+		else
+		{
+			// monitor can be disconnected before capture session reports it
+			MONITORINFO MonitorInfo =
+			{
+				.cbSize = sizeof(MonitorInfo),
+			};
+			if (!GetMonitorInfoW(Buddy->Capture.Monitor, &MonitorInfo))
+			{
+				return;
+			}
+			Origin = (POINT){ MonitorInfo.rcMonitor.left, MonitorInfo.rcMonitor.top };
+		}
 
-		HR(IMFAttributes_SetUINT32(Attributes, &MF_TRANSFORM_ASYNC_UNLOCK, TRUE));
-		IMFAttributes_Release(Attributes);
+		MONITORINFO PrimaryMonitorInfo =
+		{
+			.cbSize = sizeof(PrimaryMonitorInfo),
+		};
+		BOOL PrimaryOk = GetMonitorInfoW(MonitorFromWindow(NULL, MONITOR_DEFAULTTOPRIMARY), &PrimaryMonitorInfo);
+		Assert(PrimaryOk);
+
+		const RECT* Primary = &PrimaryMonitorInfo.rcMonitor;
+
+		// position is in decoded frame, which is smaller than monitor when viewer's window is smaller, or only part of it with viewport
+		const RECT* Crop = &Buddy->EncodeCrop;
+		int X = Crop->left + MulDiv(Data.X, Crop->right - Crop->left, Buddy->EncodeWidth);
+		int Y = Crop->top + MulDiv(Data.Y, Crop->bottom - Crop->top, Buddy->EncodeHeight);
+
+		INPUT Input =
+		{
+			.type = INPUT_MOUSE,
+			.mi.dx = (X + Origin.x) * 65535 / (Primary->right - Primary->left),
+			.mi.dy = (Y + Origin.y) * 65535 / (Primary->bottom - Primary->top),
+			.mi.dwFlags = MOUSEEVENTF_ABSOLUTE,
+		};
+
+		if (Packet == BUDDY_PACKET_MOUSE_MOVE)
+		{
+			Input.mi.dwFlags |= MOUSEEVENTF_MOVE;
+			SendInput(1, &Input, sizeof(Input));
+		}
+		else if (Packet == BUDDY_PACKET_MOUSE_BUTTON)
+		{
+			switch (Data.Button)
+			{
+			case 0: Input.mi.dwFlags |= Data.IsDownOrHorizontalWheel ? MOUSEEVENTF_LEFTDOWN : MOUSEEVENTF_LEFTUP; break;
+			case 1: Input.mi.dwFlags |= Data.IsDownOrHorizontalWheel ? MOUSEEVENTF_RIGHTDOWN : MOUSEEVENTF_RIGHTUP; break;
+			case 2: Input.mi.dwFlags |= Data.IsDownOrHorizontalWheel ? MOUSEEVENTF_MIDDLEDOWN : MOUSEEVENTF_MIDDLEUP; break;
+			case 3: Input.mi.dwFlags |= Data.IsDownOrHorizontalWheel ? MOUSEEVENTF_XDOWN : MOUSEEVENTF_XUP; Input.mi.mouseData = XBUTTON1; break;
+			case 4: Input.mi.dwFlags |= Data.IsDownOrHorizontalWheel ? MOUSEEVENTF_XDOWN : MOUSEEVENTF_XUP; Input.mi.mouseData = XBUTTON2; break;
+			}
+			SendInput(1, &Input, sizeof(Input));
+		}
+		else if (Packet == BUDDY_PACKET_MOUSE_WHEEL)
+		{
+			Input.mi.mouseData = Data.Button;
+			Input.mi.dwFlags |= (Data.IsDownOrHorizontalWheel ? MOUSEEVENTF_HWHEEL : MOUSEEVENTF_WHEEL);
+			SendInput(1, &Input, sizeof(Input));
+		}
 	}
+}
 
-	IMFDXGIDeviceManager* Manager;
+//
+// viewer-driven resolution
+//
+// encoding whole monitor for small viewer window wastes bitrate on pixels that viewer only scales down. Viewer
+// reports size of its window client area with BUDDY_PACKET_VIEW_SIZE = [u16 width][u16 height] once connected, and
+// after window size stays same for BUDDY_VIEW_SETTLE. Window is per-monitor DPI aware, so size is already in physical
+// pixels and DPI is not sent. Sharer encodes largest size with monitor's aspect ratio that fits window, never larger
+// than captured frame. Encoder is recreated at most every BUDDY_VIEW_INTERVAL, and only when width changes more than
+// BUDDY_VIEW_GROW or BUDDY_VIEW_SHRINK percent, so resizing window does not restart stream constantly. Captured frame
+// is scaled by Video Processor MFT, or on CPU with software conversion. Session, capture & network stay as they are,
+// new encoder starts with keyframe, which makes viewer's decoder switch to new size. Lossless overlay is used only at
+// full size. Can be disabled with ScaleToViewer=0 in config on sharer. Size math is in external/ViewSize.h,
+// tests\ViewSizeTest.c checks it.
+
+static void Buddy_GetEncodeSize(ScreenBuddy* Buddy, RECT* Crop, uint32_t* Width, uint32_t* Height)
+{
+	uint32_t CaptureWidth = Buddy->Capture.Rect.right - Buddy->Capture.Rect.left;
+	uint32_t CaptureHeight = Buddy->Capture.Rect.bottom - Buddy->Capture.Rect.top;
+
+	// viewport is encoded at native resolution
+	if (Buddy->ViewZoom)
 	{
-		UINT Token;
-		HR(MFCreateDXGIDeviceManager(&Token, &Manager));
-		HR(IMFDXGIDeviceManager_ResetDevice(Manager, (IUnknown*)Buddy->Device, Token));
-		HR(IMFTransform_ProcessMessage(Encoder, MFT_MESSAGE_SET_D3D_MANAGER, (ULONG_PTR)Manager));
-		HR(IMFTransform_ProcessMessage(Converter, MFT_MESSAGE_SET_D3D_MANAGER, (ULONG_PTR)Manager));
+		Buddy_GetViewport(Buddy->ViewCenterX, Buddy->ViewCenterY, Buddy->ViewZoomWidth, Buddy->ViewZoomHeight, CaptureWidth, CaptureHeight, Crop);
+		*Width = Crop->right - Crop->left;
+		*Height = Crop->bottom - Crop->top;
+		return;
 	}
 
-	// enable low latency for encoder, no B-frames, max GOP size
-	{
-		ICodecAPI* Codec;
-		HR(IMFTransform_QueryInterface(Encoder, &IID_ICodecAPI, (void**)&Codec));
+	SetRect(Crop, 0, 0, CaptureWidth, CaptureHeight);
+	*Width = CaptureWidth;
+	*Height = CaptureHeight;
 
-		VARIANT LowLatency = { .vt = VT_BOOL, .boolVal = VARIANT_TRUE };
-		HR(ICodecAPI_SetValue(Codec, &CODECAPI_AVLowLatencyMode, &LowLatency));
+	if (Buddy->ViewScale)
+	{
+		View_GetEncodeSize(Buddy->ViewWidth, Buddy->ViewHeight, Width, Height);
+	}
+}
 
-		VARIANT NoBFrames = { .vt = VT_UI4, .ulVal = 0 };
-		ICodecAPI_SetValue(Codec, &CODECAPI_AVEncMPVDefaultBPictureCount, &NoBFrames);
+// sharer, moved or resized viewport is encoded from kept frame, otherwise it would wait for next change on desktop
+static void Buddy_RefreshViewport(ScreenBuddy* Buddy)
+{
+	Buddy->ViewRefresh = false;
+	if (Buddy->ThumbCurrent)
+	{
+		// same clock as SystemRelativeTime of captured frames
+		LARGE_INTEGER Now;
+		QueryPerformanceCounter(&Now);
 
-		VARIANT GopMin, GopMax, GopDelta;
-		if (SUCCEEDED(ICodecAPI_GetParameterRange(Codec, &CODECAPI_AVEncMPVGOPSize, &GopMin, &GopMax, &GopDelta)))
+		uint64_t Time = MFllMulDiv(Now.QuadPart, 10 * 1000 * 1000, Buddy->Freq, 0);
+		if (Time > Buddy->EncodeNextTime)
 		{
-			HR(ICodecAPI_SetValue(Codec, &CODECAPI_AVEncMPVGOPSize, &GopMax));
-			VariantClear(&GopMin);
-			VariantClear(&GopMax);
-			VariantClear(&GopDelta);
+			Buddy_EncodeFrame(Buddy, Buddy->ThumbMips, Time);
 		}
 		else
 		{
-			VARIANT GopSize = { .vt = VT_UI4, .ulVal = BUDDY_ENCODE_FRAMERATE * 3600 };
-			ICodecAPI_SetValue(Codec, &CODECAPI_AVEncMPVGOPSize, &GopSize);
+			// panning faster than frame rate, last position is encoded on next timer tick
+			Buddy->ViewRefresh = true;
 		}
+	}
+}
 
-		ICodecAPI_Release(Codec);
+// new encoder for same captured frames, session continues without interruption
+static bool Buddy_ResizeEncoder(ScreenBuddy* Buddy, const RECT* Crop, uint32_t Width, uint32_t Height)
+{
+	Buddy_ReleaseEncoder(Buddy);
+	if (!Buddy_CreateEncoder(Buddy, Crop, Width, Height))
+	{
+		return false;
 	}
 
-	IMFMediaType* InputType;
-	HR(MFCreateMediaType(&InputType));
-	HR(IMFMediaType_SetGUID(InputType, &MF_MT_MAJOR_TYPE, &MFMediaType_Video));
-	HR(IMFMediaType_SetGUID(InputType, &MF_MT_SUBTYPE, &MFVideoFormat_RGB32));
-	HR(IMFMediaType_SetUINT32(InputType, &MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive));
-	HR(IMFMediaType_SetUINT64(InputType, &MF_MT_FRAME_RATE, MF64(BUDDY_ENCODE_FRAMERATE, 1)));
-	HR(IMFMediaType_SetUINT64(InputType, &MF_MT_FRAME_SIZE, MF64(EncodeWidth, EncodeHeight)));
+	// first frame of new encoder is keyframe
+	Buddy->ViewChangeTime = GetTickCount64();
+	Buddy->KeyForceTime = Buddy->ViewChangeTime;
+	Buddy->KeyPending = false;
+	Buddy->KeySoftActive = false;
 
-	IMFMediaType* ConvertedType;
-	HR(MFCreateMediaType(&ConvertedType));
-	HR(IMFMediaType_SetGUID(ConvertedType, &MF_MT_MAJOR_TYPE, &MFMediaType_Video));
-	HR(IMFMediaType_SetGUID(ConvertedType, &MF_MT_SUBTYPE, &MFVideoFormat_NV12));
-	HR(IMFMediaType_SetUINT32(ConvertedType, &MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive));
-	HR(IMFMediaType_SetUINT64(ConvertedType, &MF_MT_FRAME_RATE, MF64(BUDDY_ENCODE_FRAMERATE, 1)));
-	HR(IMFMediaType_SetUINT64(ConvertedType, &MF_MT_FRAME_SIZE, MF64(EncodeWidth, EncodeHeight)));
+	Buddy_NextMediaEvent(Buddy);
+	Buddy_RefreshViewport(Buddy);
+	return true;
+}
 
-	IMFMediaType* OutputType;
-	HR(MFCreateMediaType(&OutputType));
-	HR(IMFMediaType_SetGUID(OutputType, &MF_MT_MAJOR_TYPE, &MFMediaType_Video));
-	HR(IMFMediaType_SetGUID(OutputType, &MF_MT_SUBTYPE, &MFVideoFormat_H264));
-	HR(IMFMediaType_SetUINT32(OutputType, &MF_MT_MPEG2_PROFILE, eAVEncH264VProfile_High));
-	HR(IMFMediaType_SetUINT32(OutputType, &MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive));
-	HR(IMFMediaType_SetUINT32(OutputType, &MF_MT_AVG_BITRATE, BUDDY_ENCODE_BITRATE));
-	HR(IMFMediaType_SetUINT64(OutputType, &MF_MT_FRAME_RATE, MF64(BUDDY_ENCODE_FRAMERATE, 1)));
-	HR(IMFMediaType_SetUINT64(OutputType, &MF_MT_FRAME_SIZE, MF64(EncodeWidth, EncodeHeight)));
-	HR(IMFMediaType_SetUINT64(OutputType, &MF_MT_PIXEL_ASPECT_RATIO, MF64(1, 1)));
+// viewport of same size only moves crop rectangle, encoder continues with next frame
+static void Buddy_MoveViewport(ScreenBuddy* Buddy, const RECT* Crop)
+{
+	Buddy->EncodeCrop = *Crop;
+	if (Buddy->Converter)
+	{
+		Buddy_SetConverterCrop(Buddy->Converter, Crop);
+	}
+	Buddy_RefreshViewport(Buddy);
+}
 
-	HR(IMFTransform_SetOutputType(Converter, 0, ConvertedType, 0));
-	HR(IMFTransform_SetInputType(Converter, 0, InputType, 0));
+static void Buddy_ViewTimer(ScreenBuddy* Buddy)
+{
+	uint64_t Now = GetTickCount64();
 
-	HR(IMFTransform_SetOutputType(Encoder, 0, OutputType, 0));
-	HR(IMFTransform_SetInputType(Encoder, 0, ConvertedType, 0));
+	if (Buddy->State == BUDDY_STATE_SHARING)
+	{
+		if (Buddy->ViewRefresh)
+		{
+			Buddy_RefreshViewport(Buddy);
+		}
 
-	MFT_OUTPUT_STREAM_INFO OutputInfo;
+		RECT Crop;
+		uint32_t Width, Height;
+		Buddy_GetEncodeSize(Buddy, &Crop, &Width, &Height);
 
-	HR(IMFTransform_GetOutputStreamInfo(Converter, 0, &OutputInfo));
-	Assert((OutputInfo.dwFlags & MFT_OUTPUT_STREAM_PROVIDES_SAMPLES) == 0);
+		// viewport switched on or off, or resized
+		bool Cropped = Crop.right - Crop.left != Buddy->EncodeCrop.right - Buddy->EncodeCrop.left
+			|| Crop.bottom - Crop.top != Buddy->EncodeCrop.bottom - Buddy->EncodeCrop.top;
 
-	HR(IMFTransform_GetOutputStreamInfo(Encoder, 0, &OutputInfo));
-	Assert(OutputInfo.dwFlags & MFT_OUTPUT_STREAM_PROVIDES_SAMPLES);
+		if (!Cropped && !EqualRect(&Crop, &Buddy->EncodeCrop))
+		{
+			Buddy_MoveViewport(Buddy, &Crop);
+			return;
+		}
 
-	HR(IMFTransform_ProcessMessage(Converter, MFT_MESSAGE_NOTIFY_START_OF_STREAM, 0));
-	HR(IMFTransform_ProcessMessage(Encoder, MFT_MESSAGE_NOTIFY_START_OF_STREAM, 0));
+		if (Now - Buddy->ViewChangeTime < BUDDY_VIEW_INTERVAL)
+		{
+			return;
+		}
 
-	static IMFAsyncCallbackVtbl Buddy__IMFAsyncCallbackVtbl =
-	{
-		.QueryInterface = &Buddy__QueryInterface,
-		.AddRef         = &Buddy__AddRef,
-		.Release        = &Buddy__Release,
-		.GetParameters  = &Buddy__GetParameters,
-		.Invoke         = &Buddy__Invoke,
-	};
-	Buddy->EventCallback.lpVtbl = &Buddy__IMFAsyncCallbackVtbl;
+		// full size is always worth it, as viewer then gets exact pixels
+		uint32_t Current = Buddy->EncodeWidth;
+		uint32_t CaptureWidth = Buddy->Capture.Rect.right - Buddy->Capture.Rect.left;
+		bool Grow = Width > Current && (Width == CaptureWidth || (Width - Current) * 100 > Current * BUDDY_VIEW_GROW);
+		bool Shrink = Width < Current && (Current - Width) * 100 > Current * BUDDY_VIEW_SHRINK;
 
-	IMFVideoSampleAllocatorEx* SampleAllocator;
-	HR(MFCreateVideoSampleAllocatorEx(&IID_IMFVideoSampleAllocatorEx, (void**)&SampleAllocator));
-	HR(IMFVideoSampleAllocatorEx_SetDirectXManager(SampleAllocator, (IUnknown*)Manager));
-	{
-		IMFAttributes* Attributes;
-		HR(MFCreateAttributes(&Attributes, 2));
-		HR(IMFAttributes_SetUINT32(Attributes, &MF_SA_D3D11_BINDFLAGS, D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE));
-		HR(IMFAttributes_SetUINT32(Attributes, &MF_SA_D3D11_USAGE, D3D11_USAGE_DEFAULT));
-		HR(IMFVideoSampleAllocatorEx_InitializeSampleAllocatorEx(SampleAllocator, 0, BUDDY_ENCODE_QUEUE_SIZE, Attributes, ConvertedType));
-		IMFAttributes_Release(Attributes);
+		if ((Cropped || Grow || Shrink) && !Buddy_ResizeEncoder(Buddy, &Crop, Width, Height))
+		{
+			Buddy_Disconnect(Buddy, L"Cannot create GPU video encoder!");
+		}
 	}
+	else if (Buddy->State == BUDDY_STATE_CONNECTED && Buddy->NetOpen && !Buddy->NetMigrating)
+	{
+		RECT Rect;
+		GetClientRect(Buddy->MainWindow, &Rect);
 
-	IMFMediaType_Release(InputType);
-	IMFMediaType_Release(ConvertedType);
-	IMFMediaType_Release(OutputType);
-	IMFDXGIDeviceManager_Release(Manager);
+		// minimized window keeps previous size
+		uint32_t Width = Rect.right - Rect.left;
+		uint32_t Height = Rect.bottom - Rect.top;
+		if (Width == 0 || Height == 0)
+		{
+			return;
+		}
 
-	Buddy->EncodeWaitingForInput = false;
-	Buddy->EncodeQueueRead = 0;
-	Buddy->EncodeQueueWrite = 0;
+		if (Width != Buddy->ViewNextWidth || Height != Buddy->ViewNextHeight)
+		{
+			Buddy->ViewNextWidth = Width;
+			Buddy->ViewNextHeight = Height;
+			Buddy->ViewChangeTime = Now;
+		}
 
-	Buddy->EncodeNextTime = 0;
-	Buddy->EncodeFirstTime = 0;
+		// first size is sent right away
+		bool Changed = Width != Buddy->ViewWidth || Height != Buddy->ViewHeight;
+		if (Changed && (Buddy->ViewWidth == 0 || Now - Buddy->ViewChangeTime >= BUDDY_VIEW_SETTLE))
+		{
+			Buddy_SendView(Buddy, Width, Height);
+		}
+	}
+}
 
-	Buddy->EncodeSampleAllocator = SampleAllocator;
-	Buddy->Codec = Encoder;
-	Buddy->Converter = Converter;
-	HR(IMFTransform_QueryInterface(Encoder, &IID_IMFMediaEventGenerator, (void**)&Buddy->Generator));
+static void Buddy_OnViewSize(ScreenBuddy* Buddy, const uint8_t* Data, uint32_t Size)
+{
+	uint16_t View[2];
+	if (Size == sizeof(View))
+	{
+		CopyMemory(View, Data, sizeof(View));
+		Buddy->ViewWidth = View[0];
+		Buddy->ViewHeight = View[1];
 
-	return true;
+		// applied right away, unless encoder was recreated recently
+		Buddy_ViewTimer(Buddy);
+	}
 }
 
-static bool Buddy_ResetDecoder(IMFTransform* Decoder, IMFTransform* Converter)
+static void Buddy_OnViewport(ScreenBuddy* Buddy, const uint8_t* Data, uint32_t Size)
 {
-	DWORD DecodedIndex = 0;
-	IMFMediaType* DecodedType = NULL;
-	while (SUCCEEDED(IMFTransform_GetOutputAvailableType(Decoder, 0, DecodedIndex, &DecodedType)))
+	uint16_t View[4];
+	if (Size == sizeof(View))
 	{
-		GUID Format;
-		if (SUCCEEDED(IMFMediaType_GetGUID(DecodedType, &MF_MT_SUBTYPE, &Format)))
+		CopyMemory(View, Data, sizeof(View));
+
+		// all thumbnail tiles are sent again with first captured frame after viewport is turned on
+		bool Zoom = View[2] != 0 && View[3] != 0;
+		if (Zoom && !Buddy->ViewZoom)
 		{
-			if (IsEqualGUID(&Format, &MFVideoFormat_NV12))
+			if (Buddy->ThumbMips)
 			{
-				break;
+				uint32_t TilesX = (Buddy->ThumbWidth + BUDDY_CHANGE_TILE - 1) / BUDDY_CHANGE_TILE;
+				uint32_t TilesY = (Buddy->ThumbHeight + BUDDY_CHANGE_TILE - 1) / BUDDY_CHANGE_TILE;
+				ZeroMemory(Buddy->ThumbHashes, TilesX * TilesY * sizeof(*Buddy->ThumbHashes));
 			}
-			IMFMediaType_Release(DecodedType);
-			DecodedType = NULL;
+			Buddy->ThumbTime = 0;
 		}
-		DecodedIndex++;
+		else if (!Zoom)
+		{
+			// kept frame gets stale while viewport is off
+			Buddy->ThumbCurrent = false;
+		}
+
+		Buddy->ViewZoom = Zoom;
+		Buddy->ViewCenterX = View[0];
+		Buddy->ViewCenterY = View[1];
+		Buddy->ViewZoomWidth = View[2];
+		Buddy->ViewZoomHeight = View[3];
+
+		// panning is applied right away, new size unless encoder was recreated recently
+		Buddy_ViewTimer(Buddy);
 	}
-	Assert(DecodedType);
+}
 
-	HR(IMFTransform_SetOutputType(Decoder, 0, DecodedType, 0));
-	HR(IMFTransform_SetInputType(Converter, 0, DecodedType, 0));
+//
+// capture reconfiguration
+//
+// shared monitor can change resolution, and sharer can switch to other monitor or window from dialog's system menu,
+// while viewer stays connected. ScreenCapture_ReleaseFrame recreates frame pool when content size changes, first
+// texture of new size then rebuilds only stages that depend on it. When crop & encode size stay same - viewport at
+// native resolution, or other monitor with same resolution - encoder, its sample allocator & CPU buffers are kept,
+// only input size & crop of Video Processor MFT change and next frame is keyframe. Otherwise encoder is recreated
+// same way as for new viewer's window size. Thumbnail is recreated for new desktop size and sent in full. DPI change
+// alone does not change captured pixels, so nothing is done for it. Viewer keeps showing previous frame until its
+// decoder switches to new size, and gap between last frame of old size and first frame of new one is shown in its
+// window title. Windows are captured with frame, from top-left of their extended frame bounds.
+
+// returns false if encoder could not be recreated
+static bool Buddy_ReconfigureCapture(ScreenBuddy* Buddy)
+{
+	uint32_t CaptureWidth = Buddy->Capture.Rect.right - Buddy->Capture.Rect.left;
+	uint32_t CaptureHeight = Buddy->Capture.Rect.bottom - Buddy->Capture.Rect.top;
 
-	UINT64 FrameRate;
-	HR(IMFMediaType_GetUINT64(DecodedType, &MF_MT_FRAME_RATE, &FrameRate));
+	// new one is created with next captured frame, all tiles are sent right away
+	Buddy_ReleaseThumbnail(Buddy);
+	Buddy->ThumbTime = 0;
 
-	UINT64 FrameSize;
-	HR(IMFMediaType_GetUINT64(DecodedType, &MF_MT_FRAME_SIZE, &FrameSize));
+	RECT Crop;
+	uint32_t Width, Height;
+	Buddy_GetEncodeSize(Buddy, &Crop, &Width, &Height);
 
-	IMFMediaType* OutputType;
-	HR(MFCreateMediaType(&OutputType));
-	HR(IMFMediaType_SetGUID(OutputType, &MF_MT_MAJOR_TYPE, &MFMediaType_Video));
-	HR(IMFMediaType_SetGUID(OutputType, &MF_MT_SUBTYPE, &MFVideoFormat_RGB32));
-	HR(IMFMediaType_SetUINT32(OutputType, &MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive));
-	HR(IMFMediaType_SetUINT64(OutputType, &MF_MT_FRAME_RATE, FrameRate));
-	HR(IMFMediaType_SetUINT64(OutputType, &MF_MT_FRAME_SIZE, FrameSize));
-	HR(IMFTransform_SetOutputType(Converter, 0, OutputType, 0));
+	bool SameInput = Crop.right - Crop.left == Buddy->EncodeCrop.right - Buddy->EncodeCrop.left
+		&& Crop.bottom - Crop.top == Buddy->EncodeCrop.bottom - Buddy->EncodeCrop.top;
+
+	if (SameInput && Width == Buddy->EncodeWidth && Height == Buddy->EncodeHeight)
+	{
+		if (Buddy->Converter)
+		{
+			IMFMediaType* OutputType;
+			HR(IMFTransform_GetOutputCurrentType(Buddy->Converter, 0, &OutputType));
+
+			IMFMediaType* InputType = Buddy_CreateCaptureType(CaptureWidth, CaptureHeight);
+			HR(IMFTransform_ProcessMessage(Buddy->Converter, MFT_MESSAGE_COMMAND_FLUSH, 0));
+			HR(IMFTransform_SetOutputType(Buddy->Converter, 0, OutputType, 0));
+			HR(IMFTransform_SetInputType(Buddy->Converter, 0, InputType, 0));
+			Buddy_SetConverterCrop(Buddy->Converter, &Crop);
+
+			IMFMediaType_Release(InputType);
+			IMFMediaType_Release(OutputType);
+		}
+		Buddy->EncodeCrop = Crop;
 
-	IMFMediaType_Release(DecodedType);
-	IMFMediaType_Release(OutputType);
+		// references in encoder are from previous content, viewer gets clean start of new one
+		Buddy_ForceKeyFrame(Buddy);
+		return true;
+	}
 
-	return true;
+	return Buddy_ResizeEncoder(Buddy, &Crop, Width, Height);
 }
 
-static bool Buddy_CreateDecoder(ScreenBuddy* Buddy)
+// sharer, called for every captured frame, returns false if frame cannot be encoded
+static bool Buddy_CheckCaptureSize(ScreenBuddy* Buddy, const ScreenCaptureFrame* Frame)
 {
-	MFT_REGISTER_TYPE_INFO Input = { .guidMajorType = MFMediaType_Video, .guidSubtype = MFVideoFormat_H264 };
-	MFT_REGISTER_TYPE_INFO Output = { .guidMajorType = MFMediaType_Video, .guidSubtype = MFVideoFormat_NV12 };
+	D3D11_TEXTURE2D_DESC Desc;
+	ID3D11Texture2D_GetDesc(Frame->Texture, &Desc);
 
-	IMFActivate** Activate;
-	UINT32 ActivateCount;
-	HR(MFTEnumEx(MFT_CATEGORY_VIDEO_DECODER, MFT_ENUM_FLAG_SYNCMFT | MFT_ENUM_FLAG_SORTANDFILTER, &Input, &Output, &Activate, &ActivateCount));
+	// monitor keeps its initial rectangle, window can be larger than texture until frame pool is recreated
+	ViewRect Window = { Frame->Rect.left, Frame->Rect.top, Frame->Rect.right, Frame->Rect.bottom };
 
-	if (ActivateCount == 0)
+	uint32_t Width, Height;
+	if (!View_GetCaptureSize(Desc.Width, Desc.Height, Buddy->Capture.Window ? &Window : NULL, &Width, &Height))
 	{
-		MessageBoxW(Buddy->DialogWindow, L"Cannot create GPU decoder!", L"Error", MB_ICONERROR);
 		return false;
 	}
 
-	IMFTransform* Decoder;
-	HR(IMFActivate_ActivateObject(Activate[0], &IID_IMFTransform, (void**)&Decoder));
-	for (UINT32 Index = 0; Index < ActivateCount; Index++)
+	if (Width != (uint32_t)(Buddy->Capture.Rect.right - Buddy->Capture.Rect.left) || Height != (uint32_t)(Buddy->Capture.Rect.bottom - Buddy->Capture.Rect.top))
 	{
-		IMFActivate_Release(Activate[Index]);
+		SetRect(&Buddy->Capture.Rect, 0, 0, Width, Height);
+		return Buddy_ReconfigureCapture(Buddy);
 	}
-	CoTaskMemFree(Activate);
+	return true;
+}
 
-	IMFTransform* Converter;
-	HR(CoCreateInstance(&CLSID_VideoProcessorMFT, NULL, CLSCTX_INPROC_SERVER, &IID_IMFTransform, (void**)&Converter));
+// capture session moves to other monitor or window, encoder & network stay as they are
+static void Buddy_SwitchCapture(ScreenBuddy* Buddy, HMONITOR Monitor, HWND Window)
+{
+	ScreenCapture_Stop(&Buddy->Capture);
+
+	bool Created = Window
+		? ScreenCapture_CreateForWindow(&Buddy->Capture, Buddy->Device, Window, false, false)
+		: ScreenCapture_CreateForMonitor(&Buddy->Capture, Buddy->Device, Monitor, NULL);
 
+	// window could be closed already, primary monitor is always there
+	if (!Created)
 	{
-		IMFAttributes* Attributes;
-		HR(IMFTransform_GetAttributes(Converter, &Attributes));
-		HR(IMFAttributes_SetUINT32(Attributes, &MF_XVP_PLAYBACK_MODE, TRUE));
-		HR(IMFAttributes_SetUINT32(Attributes, &MF_XVP_CALLER_ALLOCATES_OUTPUT, TRUE));
-		IMFAttributes_Release(Attributes);
+		Created = ScreenCapture_CreateForMonitor(&Buddy->Capture, Buddy->Device, MonitorFromWindow(NULL, MONITOR_DEFAULTTOPRIMARY), NULL);
 	}
-	
+	if (!Created)
 	{
-		UINT Token;
-		IMFDXGIDeviceManager* Manager;
-		HR(MFCreateDXGIDeviceManager(&Token, &Manager));
-		HR(IMFDXGIDeviceManager_ResetDevice(Manager, (IUnknown*)Buddy->Device, Token));
-		HR(IMFTransform_ProcessMessage(Decoder, MFT_MESSAGE_SET_D3D_MANAGER, (ULONG_PTR)Manager));
-		HR(IMFTransform_ProcessMessage(Converter, MFT_MESSAGE_SET_D3D_MANAGER, (ULONG_PTR)Manager));
-		IMFDXGIDeviceManager_Release(Manager);
+		// released by failed create
+		Buddy->Capture.Device = NULL;
+		Buddy_Disconnect(Buddy, L"Cannot capture monitor output!");
+		return;
 	}
 
-	// enable low latency for decoder
+	RECT* Rect = &Buddy->Capture.Rect;
+	SetRect(Rect, 0, 0, (Rect->right - Rect->left) & ~1, (Rect->bottom - Rect->top) & ~1);
+	ScreenCapture_Start(&Buddy->Capture, true, true);
+
+	if (!Buddy_ReconfigureCapture(Buddy))
 	{
-		ICodecAPI* Codec;
-		HR(IMFTransform_QueryInterface(Decoder, &IID_ICodecAPI, (void**)&Codec));
+		Buddy_Disconnect(Buddy, L"Cannot create GPU video encoder!");
+	}
+}
 
-		VARIANT LowLatency = { .vt = VT_UI4, .boolVal = VARIANT_TRUE };
-		HR(ICodecAPI_SetValue(Codec, &CODECAPI_AVLowLatencyMode, &LowLatency));
+typedef struct
+{
+	uint32_t Count;
+	HMONITOR Monitors[BUDDY_CAPTURE_MAX_MONITORS];
+}
+Buddy_MonitorList;
 
-		ICodecAPI_Release(Codec);
+static BOOL CALLBACK Buddy_EnumMonitor(HMONITOR Monitor, HDC DeviceContext, LPRECT Rect, LPARAM Param)
+{
+	Buddy_MonitorList* List = (Buddy_MonitorList*)Param;
+	if (List->Count < BUDDY_CAPTURE_MAX_MONITORS)
+	{
+		List->Monitors[List->Count++] = Monitor;
 	}
+	return TRUE;
+}
 
-	IMFMediaType* InputType;
-	HR(MFCreateMediaType(&InputType));
-	HR(IMFMediaType_SetGUID(InputType, &MF_MT_MAJOR_TYPE, &MFMediaType_Video));
-	HR(IMFMediaType_SetGUID(InputType, &MF_MT_SUBTYPE, &MFVideoFormat_H264));
-	HR(IMFMediaType_SetUINT32(InputType, &MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive));
-	HR(IMFMediaType_SetUINT64(InputType, &MF_MT_FRAME_RATE, MF64(BUDDY_ENCODE_FRAMERATE, 1)));
-	HR(IMFMediaType_SetUINT64(InputType, &MF_MT_FRAME_SIZE, MF64(4, 4)));
-	HR(IMFMediaType_SetUINT64(InputType, &MF_MT_PIXEL_ASPECT_RATIO, MF64(1, 1)));
-
-	HR(IMFTransform_SetInputType(Decoder, 0, InputType, 0));
-	IMFMediaType_Release(InputType);
+// captured window goes back to its monitor, otherwise monitors are cycled in enumeration order
+static void Buddy_CaptureNextMonitor(ScreenBuddy* Buddy)
+{
+	Buddy_MonitorList List = { 0 };
+	EnumDisplayMonitors(NULL, NULL, &Buddy_EnumMonitor, (LPARAM)&List);
 
-	if (!Buddy_ResetDecoder(Decoder, Converter))
+	HMONITOR Monitor = Buddy->Capture.Window ? MonitorFromWindow(Buddy->Capture.Window, MONITOR_DEFAULTTOPRIMARY) : NULL;
+	for (uint32_t Index = 0; !Monitor && Index < List.Count; Index++)
 	{
-		Assert(0);
+		if (List.Monitors[Index] == Buddy->Capture.Monitor)
+		{
+			Monitor = List.Monitors[(Index + 1) % List.Count];
+		}
 	}
 
-	MFT_OUTPUT_STREAM_INFO OutputInfo;
+	Buddy_SwitchCapture(Buddy, Monitor ? Monitor : MonitorFromWindow(NULL, MONITOR_DEFAULTTOPRIMARY), NULL);
+}
 
-	HR(IMFTransform_GetOutputStreamInfo(Decoder, 0, &OutputInfo));
-	Assert(OutputInfo.dwFlags & MFT_OUTPUT_STREAM_PROVIDES_SAMPLES);
+// first window below sharer's dialog that user would recognize, search continues below captured one so menu cycles
+static void Buddy_CaptureWindowBelow(ScreenBuddy* Buddy)
+{
+	HWND Starts[2] = { Buddy->Capture.Window, Buddy->DialogWindow };
+	for (uint32_t Pass = 0; Pass < ARRAYSIZE(Starts); Pass++)
+	{
+		for (HWND Window = Starts[Pass] ? GetWindow(Starts[Pass], GW_HWNDNEXT) : NULL; Window; Window = GetWindow(Window, GW_HWNDNEXT))
+		{
+			DWORD Cloaked = 0;
+			DwmGetWindowAttribute(Window, DWMWA_CLOAKED, &Cloaked, sizeof(Cloaked));
+
+			if (Window != Buddy->Capture.Window
+				&& IsWindowVisible(Window)
+				&& !IsIconic(Window)
+				&& !Cloaked
+				&& (GetWindowLongW(Window, GWL_EXSTYLE) & WS_EX_TOOLWINDOW) == 0
+				&& GetWindowTextLengthW(Window) != 0)
+			{
+				Buddy_SwitchCapture(Buddy, NULL, Window);
+				return;
+			}
+		}
+	}
+	MessageBeep(MB_ICONWARNING);
+}
 
-	HR(IMFTransform_GetOutputStreamInfo(Converter, 0, &OutputInfo));
-	Assert((OutputInfo.dwFlags & MFT_OUTPUT_STREAM_PROVIDES_SAMPLES) == 0);
+//
+// direct UDP path
+//
+// once DERP connection to peer works, both sides gather candidate addresses - local interface addresses and
+// public address from STUN server of DERP region - and send them to each other over DERP. Then both send pings
+// to all remote candidates, which opens NAT mappings on the way. First authenticated pong selects direct path.
+// Video frames and mouse moves then go over UDP, all other packets stay on DERP. If nothing arrives from peer
+// for BUDDY_UDP_PATH_TIMEOUT, both sides go back to DERP and encoder produces new keyframe.
+//
+// datagram = BUDDY_UDP_MAGIC byte + payload sealed with same key as DERP packets, payload starts with BUDDY_UDP_* type
+// FRAGMENT = [u32 frame id][u32 frame size][u16 index][u16 count][data]
+// NACK     = [u32 frame id][u16 count][u16 index]... count 0 requests whole frame
+// PACKET   = regular packet that can be lost, like BUDDY_PACKET_MOUSE_MOVE
 
-	HR(IMFTransform_ProcessMessage(Decoder, MFT_MESSAGE_NOTIFY_START_OF_STREAM, 0));
-	HR(IMFTransform_ProcessMessage(Converter, MFT_MESSAGE_NOTIFY_START_OF_STREAM, 0));
+static void Buddy_DecodeData(ScreenBuddy* Buddy, const uint8_t* Data, uint32_t Size)
+{
+	IMFMediaBuffer* Buffer;
+	HR(MFCreateMemoryBuffer(Size, &Buffer));
 
-	Buddy->DecodeInputExpected = 0;
-	Buddy->DecodeInputBuffer = NULL;
-	Buddy->DecodeOutputSample = NULL;
-	Buddy->Codec = Decoder;
-	Buddy->Converter = Converter;
+	BYTE* BufferData;
+	HR(IMFMediaBuffer_Lock(Buffer, &BufferData, NULL, NULL));
+	CopyMemory(BufferData, Data, Size);
+	HR(IMFMediaBuffer_Unlock(Buffer));
+	HR(IMFMediaBuffer_SetCurrentLength(Buffer, Size));
 
-	return true;
+	Buddy_Decode(Buddy, Buffer);
+	IMFMediaBuffer_Release(Buffer);
 }
 
-static void Buddy_NextMediaEvent(ScreenBuddy* Buddy)
+static void CALLBACK Buddy_UdpWaitCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Context, PTP_WAIT Wait, TP_WAIT_RESULT WaitResult)
 {
-	IMFMediaEventGenerator_BeginGetEvent(Buddy->Generator, &Buddy->EventCallback, NULL);
+	ScreenBuddy* Buddy = Context;
+	PostMessageW(Buddy->DialogWindow, BUDDY_WM_UDP_EVENT, 0, 0);
 }
 
-static void Buddy_InputToEncoder(ScreenBuddy* Buddy)
+static void Buddy_UdpSend(ScreenBuddy* Buddy, const SOCKADDR_IN* Address, const uint8_t* Payload, size_t PayloadSize)
 {
-	if (Buddy->EncodeQueueWrite - Buddy->EncodeQueueRead == 0)
-	{
-		Buddy->EncodeWaitingForInput = true;
-		return;
-	}
+	Assert(PayloadSize <= BUDDY_UDP_MAX_PAYLOAD);
 
-	IMFSample* Sample = Buddy->EncodeQueue[Buddy->EncodeQueueRead % BUDDY_ENCODE_QUEUE_SIZE];
-	Buddy->EncodeQueueRead += 1;
+	uint8_t Datagram[1 + 24 + 16 + BUDDY_UDP_MAX_PAYLOAD];
+	Datagram[0] = BUDDY_UDP_MAGIC;
+	DerpNet_SealCounter(Buddy->UdpSharedKey, Datagram + 1, Buddy->UdpSendPrefix, ++Buddy->UdpSendCounter, Payload, PayloadSize);
 
-	HR(IMFTransform_ProcessInput(Buddy->Codec, 0, Sample, 0));
-	IMFSample_Release(Sample);
+	// errors are ignored, lost datagrams are handled with retransmits & path timeout
+	sendto(Buddy->UdpSocket, (char*)Datagram, (int)(1 + 24 + 16 + PayloadSize), 0, (SOCKADDR*)Address, sizeof(*Address));
 }
 
-static void Buddy_Disconnect(ScreenBuddy* Buddy, const wchar_t* Message);
-
-static void Buddy_OutputFromEncoder(ScreenBuddy* Buddy)
+static void Buddy_UdpSendPing(ScreenBuddy* Buddy, const SOCKADDR_IN* Address, uint8_t Type)
 {
-	DWORD Status;
-	MFT_OUTPUT_DATA_BUFFER Output = { .pSample = NULL };
+	uint8_t Payload[1] = { Type };
+	Buddy_UdpSend(Buddy, Address, Payload, sizeof(Payload));
+}
 
-	for (;;)
+static bool Buddy_UdpAddCandidate(SOCKADDR_IN* Candidates, uint32_t* Count, const SOCKADDR_IN* Address)
+{
+	for (uint32_t Index = 0; Index < *Count; Index++)
 	{
-		HRESULT hr = IMFTransform_ProcessOutput(Buddy->Codec, 0, 1, &Output, &Status);
-		if (SUCCEEDED(hr))
+		if (Candidates[Index].sin_addr.s_addr == Address->sin_addr.s_addr && Candidates[Index].sin_port == Address->sin_port)
 		{
-			break;
+			return false;
 		}
-		else if (hr == MF_E_TRANSFORM_STREAM_CHANGE)
-		{
-			DWORD OutputIndex = 0;
-			IMFMediaType* OutputType = NULL;
-			while (SUCCEEDED(IMFTransform_GetOutputAvailableType(Buddy->Codec, 0, OutputIndex, &OutputType)))
-			{
-				GUID Format;
-				if (SUCCEEDED(IMFMediaType_GetGUID(OutputType, &MF_MT_SUBTYPE, &Format)))
-				{
-					if (IsEqualGUID(&Format, &MFVideoFormat_H264))
-					{
-						break;
-					}
-					IMFMediaType_Release(OutputType);
-					OutputType = NULL;
-				}
-				OutputIndex++;
-			}
-			Assert(OutputType);
+	}
 
-			HR(IMFTransform_SetOutputType(Buddy->Codec, 0, OutputType, 0));
-			return;
-		}
-		else
-		{
-			HR(hr);
-		}
+	if (*Count == BUDDY_UDP_MAX_CANDIDATES)
+	{
+		return false;
 	}
 
-	IMFSample* OutputSample = Output.pSample;
+	Candidates[(*Count)++] = *Address;
+	return true;
+}
 
-	IMFMediaBuffer* OutputBuffer;
-	HR(IMFSample_ConvertToContiguousBuffer(OutputSample, &OutputBuffer));
+static void Buddy_UdpSendCandidates(ScreenBuddy* Buddy)
+{
+	uint8_t Data[2 + BUDDY_UDP_MAX_CANDIDATES * 6];
+	Data[0] = BUDDY_PACKET_CANDIDATES;
+	Data[1] = (uint8_t)Buddy->UdpLocalCount;
 
-	BYTE* OutputData;
-	DWORD OutputSize;
-	HR(IMFMediaBuffer_Lock(OutputBuffer, &OutputData, NULL, &OutputSize));
+	// address & port in network byte order
+	for (uint32_t Index = 0; Index < Buddy->UdpLocalCount; Index++)
+	{
+		CopyMemory(Data + 2 + Index * 6, &Buddy->UdpLocal[Index].sin_addr, 4);
+		CopyMemory(Data + 2 + Index * 6 + 4, &Buddy->UdpLocal[Index].sin_port, 2);
+	}
 
-	uint8_t SendBuffer[65000];
+	// failure here will be noticed by next receive
+	if (Buddy->NetOpen)
+	{
+		DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, Data, 2 + Buddy->UdpLocalCount * 6);
+	}
+}
 
-	uint8_t Extra[1 + sizeof(OutputSize)];
-	uint32_t ExtraSize = sizeof(Extra);
+static void Buddy_UdpOnCandidates(ScreenBuddy* Buddy, const uint8_t* Data, uint32_t Size)
+{
+	if (!Buddy->UdpStarted || Size < 1)
+	{
+		return;
+	}
 
-	Extra[0] = BUDDY_PACKET_VIDEO;
-	CopyMemory(Extra + 1, &OutputSize, sizeof(OutputSize));
+	bool Added = false;
+	for (uint32_t Index = 0; Index < Data[0] && 1 + (Index + 1) * 6 <= Size; Index++)
+	{
+		SOCKADDR_IN Address = { .sin_family = AF_INET };
+		CopyMemory(&Address.sin_addr, Data + 1 + Index * 6, 4);
+		CopyMemory(&Address.sin_port, Data + 1 + Index * 6 + 4, 2);
+
+		Added |= Buddy_UdpAddCandidate(Buddy->UdpRemote, &Buddy->UdpRemoteCount, &Address);
+	}
 
-	while (OutputSize != 0)
+	// new candidates get full hole punching time, starting right away
+	if (Added)
 	{
-		if (ExtraSize)
-		{
-			CopyMemory(SendBuffer, Extra, ExtraSize);
-		}
+		Buddy->UdpPunchTime = GetTickCount64();
+		Buddy->UdpPingTime = 0;
+	}
+}
 
-		uint32_t SendSize = min(OutputSize, sizeof(SendBuffer) - ExtraSize);
-		CopyMemory(SendBuffer + ExtraSize, OutputData, SendSize);
+// loopback address is included too, so two instances on same computer can connect directly
+static void Buddy_UdpGatherLocal(ScreenBuddy* Buddy, uint16_t Port)
+{
+	ULONG Flags = GAA_FLAG_SKIP_ANYCAST | GAA_FLAG_SKIP_MULTICAST | GAA_FLAG_SKIP_DNS_SERVER;
+	ULONG Size = 16 * 1024;
 
-		if (!DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, SendBuffer, SendSize + ExtraSize))
-		{
-			Buddy_Disconnect(Buddy, L"DerpNet disconnect while sending data!");
-			break;
-		}
+	IP_ADAPTER_ADDRESSES* Adapters = HeapAlloc(GetProcessHeap(), 0, Size);
+	Assert(Adapters);
 
-		OutputData += SendSize;
-		OutputSize -= SendSize;
+	ULONG Error = GetAdaptersAddresses(AF_INET, Flags, NULL, Adapters, &Size);
+	if (Error == ERROR_BUFFER_OVERFLOW)
+	{
+		Adapters = HeapReAlloc(GetProcessHeap(), 0, Adapters, Size);
+		Assert(Adapters);
 
-		ExtraSize = 1;
+		Error = GetAdaptersAddresses(AF_INET, Flags, NULL, Adapters, &Size);
 	}
 
-	HR(IMFMediaBuffer_Unlock(OutputBuffer));
+	if (Error == NO_ERROR)
+	{
+		for (IP_ADAPTER_ADDRESSES* Adapter = Adapters; Adapter; Adapter = Adapter->Next)
+		{
+			if (Adapter->OperStatus != IfOperStatusUp)
+			{
+				continue;
+			}
 
-	IMFMediaBuffer_Release(OutputBuffer);
-	IMFSample_Release(OutputSample);
+			for (IP_ADAPTER_UNICAST_ADDRESS* Unicast = Adapter->FirstUnicastAddress; Unicast; Unicast = Unicast->Next)
+			{
+				if (Unicast->Address.lpSockaddr->sa_family == AF_INET)
+				{
+					SOCKADDR_IN Address = *(SOCKADDR_IN*)Unicast->Address.lpSockaddr;
+					Address.sin_port = Port;
+					Buddy_UdpAddCandidate(Buddy->UdpLocal, &Buddy->UdpLocalCount, &Address);
+				}
+			}
+		}
+	}
+
+	HeapFree(GetProcessHeap(), 0, Adapters);
 }
 
-static void Buddy_Decode(ScreenBuddy* Buddy, IMFMediaBuffer* InputBuffer)
+static const uint8_t Buddy_StunCookie[4] = { 0x21, 0x12, 0xa4, 0x42 };
+
+// RFC 5389 Binding request without any attributes
+static void Buddy_UdpSendStun(ScreenBuddy* Buddy)
 {
-	IMFSample* InputSample;
-	HR(MFCreateSample(&InputSample));
-	HR(IMFSample_AddBuffer(InputSample, InputBuffer));
+	uint8_t Request[20] = { 0x00, 0x01, 0x00, 0x00 };
+	CopyMemory(Request + 4, Buddy_StunCookie, sizeof(Buddy_StunCookie));
+	CopyMemory(Request + 8, Buddy->UdpStunTransaction, sizeof(Buddy->UdpStunTransaction));
 
-	HR(IMFTransform_ProcessInput(Buddy->Codec, 0, InputSample, 0));
-	IMFSample_Release(InputSample);
+	sendto(Buddy->UdpSocket, (char*)Request, sizeof(Request), 0, (SOCKADDR*)&Buddy->UdpStunServer, sizeof(Buddy->UdpStunServer));
+}
 
-	bool NewFrameDecoded = false;
-	for (;;)
+// only XOR-MAPPED-ADDRESS from Binding success response is used, it becomes new local candidate
+static void Buddy_UdpOnStun(ScreenBuddy* Buddy, const uint8_t* Data, int Size)
+{
+	if (Size < 20
+		|| Data[0] != 0x01 || Data[1] != 0x01
+		|| !RtlEqualMemory(Data + 4, Buddy_StunCookie, sizeof(Buddy_StunCookie))
+		|| !RtlEqualMemory(Data + 8, Buddy->UdpStunTransaction, sizeof(Buddy->UdpStunTransaction)))
 	{
-		DWORD Status;
-		MFT_OUTPUT_DATA_BUFFER Output = { .pSample = NULL };
+		return;
+	}
 
-		HRESULT hr = IMFTransform_ProcessOutput(Buddy->Codec, 0, 1, &Output, &Status);
-		if (hr == MF_E_TRANSFORM_STREAM_CHANGE)
-		{
-			Buddy_ResetDecoder(Buddy->Codec, Buddy->Converter);
+	int Length = min(20 + ((Data[2] << 8) | Data[3]), Size);
+	for (int Offset = 20; Offset + 4 <= Length; )
+	{
+		int Type = (Data[Offset + 0] << 8) | Data[Offset + 1];
+		int AttributeLength = (Data[Offset + 2] << 8) | Data[Offset + 3];
+		const uint8_t* Value = Data + Offset + 4;
 
-			if (Buddy->DecodeOutputSample)
-			{
-				IMFSample_Release(Buddy->DecodeOutputSample);
-				Buddy->DecodeOutputSample = NULL;
-			}
-			continue;
-		}
-		else if (hr == MF_E_TRANSFORM_NEED_MORE_INPUT)
+		if (Offset + 4 + AttributeLength > Length)
 		{
 			break;
 		}
-		HR(hr);
-
-		IMFSample* DecodedSample = Output.pSample;
 
-		if (Buddy->DecodeOutputSample == NULL)
+		if (Type == 0x0020 && AttributeLength >= 8 && Value[1] == 0x01)
 		{
-			IMFMediaBuffer* DecodedBuffer;
-			HR(IMFSample_GetBufferByIndex(DecodedSample, 0, &DecodedBuffer));
+			SOCKADDR_IN Address = { .sin_family = AF_INET };
 
-			IMFDXGIBuffer* DxgiBuffer;
-			HR(IMFMediaBuffer_QueryInterface(DecodedBuffer, &IID_IMFDXGIBuffer, (void**)&DxgiBuffer));
+			uint8_t* Port = (uint8_t*)&Address.sin_port;
+			Port[0] = Value[2] ^ Buddy_StunCookie[0];
+			Port[1] = Value[3] ^ Buddy_StunCookie[1];
 
-			ID3D11Texture2D* DecodedTexture;
-			HR(IMFDXGIBuffer_GetResource(DxgiBuffer, &IID_ID3D11Texture2D, (void**)&DecodedTexture));
+			uint8_t* IPv4 = (uint8_t*)&Address.sin_addr;
+			for (int Index = 0; Index < 4; Index++)
+			{
+				IPv4[Index] = Value[4 + Index] ^ Buddy_StunCookie[Index];
+			}
 
-			D3D11_TEXTURE2D_DESC DecodedDesc;
-			ID3D11Texture2D_GetDesc(DecodedTexture, &DecodedDesc);
+			// got the answer, no more retries needed
+			Buddy->UdpStunServer.sin_family = 0;
 
-			int DecodedWidth = DecodedDesc.Width;
-			int DecodedHeight = DecodedDesc.Height;
+			if (Buddy_UdpAddCandidate(Buddy->UdpLocal, &Buddy->UdpLocalCount, &Address))
+			{
+				Buddy_UdpSendCandidates(Buddy);
+			}
+			break;
+		}
 
-			ID3D11Texture2D_Release(DecodedTexture);
-			IMFDXGIBuffer_Release(DxgiBuffer);
-			IMFMediaBuffer_Release(DecodedBuffer);
+		Offset += 4 + ((AttributeLength + 3) & ~3);
+	}
+}
 
-			D3D11_TEXTURE2D_DESC TextureDesc =
-			{
-				.Width = DecodedWidth,
-				.Height = DecodedHeight,
-				.MipLevels = 0,
-				.ArraySize = 1,
-				.Format = DXGI_FORMAT_B8G8R8A8_UNORM,
-				.SampleDesc = { 1, 0 },
-				.Usage = D3D11_USAGE_DEFAULT,
-				.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE,
-				.MiscFlags = D3D11_RESOURCE_MISC_GENERATE_MIPS,
-			};
+static void Buddy_UdpReserve(Buddy_UdpFrame* Frame, uint32_t Size)
+{
+	if (Frame->Capacity < Size)
+	{
+		Frame->Data = Frame->Data ? HeapReAlloc(GetProcessHeap(), 0, Frame->Data, Size) : HeapAlloc(GetProcessHeap(), 0, Size);
+		Assert(Frame->Data);
+		Frame->Capacity = Size;
+	}
+}
+
+static void Buddy_UdpResetFrames(ScreenBuddy* Buddy)
+{
+	for (uint32_t Index = 0; Index < BUDDY_UDP_HISTORY; Index++)
+	{
+		Buddy->UdpFrames[Index].Active = false;
+	}
+}
 
-			ID3D11Texture2D* Texture;
-			ID3D11Device_CreateTexture2D(Buddy->Device, &TextureDesc, NULL, &Texture);
+static void Buddy_UdpSendFragment(ScreenBuddy* Buddy, Buddy_UdpFrame* Frame, uint32_t Index)
+{
+	uint32_t Offset = Index * BUDDY_UDP_FRAGMENT_SIZE;
+	uint32_t Size = min(Frame->Size - Offset, BUDDY_UDP_FRAGMENT_SIZE);
 
-			if (Buddy->InputView)
-			{
-				ID3D11ShaderResourceView_Release(Buddy->InputView);
-			}
-			ID3D11Device_CreateShaderResourceView(Buddy->Device, (ID3D11Resource*)Texture, NULL, &Buddy->InputView);
+	uint16_t FragmentIndex = (uint16_t)Index;
+	uint16_t FragmentCount = (uint16_t)Frame->Count;
 
-			Buddy->InputMipsGenerated = false;
-			Buddy->InputWidth = DecodedWidth;
-			Buddy->InputHeight = DecodedHeight;
+	uint8_t Payload[BUDDY_UDP_MAX_PAYLOAD];
+	Payload[0] = BUDDY_UDP_FRAGMENT;
+	CopyMemory(Payload + 1, &Frame->Id, sizeof(Frame->Id));
+	CopyMemory(Payload + 5, &Frame->Size, sizeof(Frame->Size));
+	CopyMemory(Payload + 9, &FragmentIndex, sizeof(FragmentIndex));
+	CopyMemory(Payload + 11, &FragmentCount, sizeof(FragmentCount));
+	CopyMemory(Payload + 13, Frame->Data + Offset, Size);
 
-			//
+	Buddy_UdpSend(Buddy, &Buddy->UdpPeer, Payload, 13 + Size);
+}
 
-			IMFMediaBuffer* OutputBuffer;
-			HR(MFCreateDXGISurfaceBuffer(&IID_ID3D11Texture2D, (IUnknown*)Texture, 0, FALSE, &OutputBuffer));
+// returns false if frame needs to be sent over DERP
+static bool Buddy_UdpSendFrame(ScreenBuddy* Buddy, uint32_t FrameId, const uint8_t* Data, uint32_t Size)
+{
+	uint32_t Count = (Size + BUDDY_UDP_FRAGMENT_SIZE - 1) / BUDDY_UDP_FRAGMENT_SIZE;
+	if (!Buddy->UdpDirect || Count == 0 || Count > BUDDY_UDP_MAX_FRAGMENTS)
+	{
+		return false;
+	}
 
-			DWORD OutputLength;
-			HR(IMFMediaBuffer_GetMaxLength(OutputBuffer, &OutputLength));
-			HR(IMFMediaBuffer_SetCurrentLength(OutputBuffer, OutputLength));
+	// frame is kept until slot is reused, to answer retransmit requests
+	Buddy_UdpFrame* Frame = &Buddy->UdpFrames[FrameId % BUDDY_UDP_HISTORY];
+	Buddy_UdpReserve(Frame, Size);
+	CopyMemory(Frame->Data, Data, Size);
 
-			HR(MFCreateSample(&Buddy->DecodeOutputSample));
-			HR(IMFSample_AddBuffer(Buddy->DecodeOutputSample, OutputBuffer));
+	Frame->Id = FrameId;
+	Frame->Size = Size;
+	Frame->Count = Count;
+	Frame->Received = Count;
+	Frame->Time = GetTickCount64();
+	Frame->Active = true;
 
-			HR(IMFSample_SetSampleDuration(Buddy->DecodeOutputSample, 10 * 1000 * 1000 / BUDDY_ENCODE_FRAMERATE));
-			HR(IMFSample_SetSampleTime(Buddy->DecodeOutputSample, 0));
+	for (uint32_t Index = 0; Index < Count; Index++)
+	{
+		Buddy_UdpSendFragment(Buddy, Frame, Index);
+	}
+	return true;
+}
 
-			IMFMediaBuffer_Release(OutputBuffer);
-			ID3D11Texture2D_Release(Texture);
-		}
+static void Buddy_UdpOnNack(ScreenBuddy* Buddy, const uint8_t* Data, uint32_t Size)
+{
+	if (Size < 6)
+	{
+		return;
+	}
 
-		HR(IMFTransform_ProcessInput(Buddy->Converter, 0, DecodedSample, 0));
-		IMFSample_Release(DecodedSample);
+	uint32_t FrameId;
+	uint16_t Count;
+	CopyMemory(&FrameId, Data, sizeof(FrameId));
+	CopyMemory(&Count, Data + 4, sizeof(Count));
 
-		MFT_OUTPUT_DATA_BUFFER ConverterOutput = { .pSample = Buddy->DecodeOutputSample };
-		HR(IMFTransform_ProcessOutput(Buddy->Converter, 0, 1, &ConverterOutput, &Status));
+	// frame too old or sent over DERP, receiver will skip it
+	Buddy_UdpFrame* Frame = &Buddy->UdpFrames[FrameId % BUDDY_UDP_HISTORY];
+	if (!Frame->Active || Frame->Id != FrameId)
+	{
+		return;
+	}
 
-		NewFrameDecoded = true;
-		Buddy->InputMipsGenerated = false;
+	if (Count == 0)
+	{
+		for (uint32_t Index = 0; Index < Frame->Count; Index++)
+		{
+			Buddy_UdpSendFragment(Buddy, Frame, Index);
+		}
+	}
+	else
+	{
+		for (uint32_t Index = 0; Index < Count && 6 + (Index + 1) * 2 <= Size; Index++)
+		{
+			uint16_t FragmentIndex;
+			CopyMemory(&FragmentIndex, Data + 6 + Index * 2, sizeof(FragmentIndex));
+			if (FragmentIndex < Frame->Count)
+			{
+				Buddy_UdpSendFragment(Buddy, Frame, FragmentIndex);
+			}
+		}
 	}
+}
 
-	if (NewFrameDecoded)
+// decodes completed frames in order
+static void Buddy_UdpDeliverFrames(ScreenBuddy* Buddy)
+{
+	for (;;)
 	{
-		InvalidateRect(Buddy->MainWindow, NULL, FALSE);
+		Buddy_UdpFrame* Frame = &Buddy->UdpFrames[Buddy->DecodeFrameId % BUDDY_UDP_HISTORY];
+		if (!Frame->Active || Frame->Id != Buddy->DecodeFrameId || Frame->Received != Frame->Count)
+		{
+			break;
+		}
+
+		Buddy_DecodeData(Buddy, Frame->Data, Frame->Size);
+		Frame->Active = false;
+		Buddy->DecodeFrameId++;
 	}
 }
 
-static void Buddy_OnFrameCapture(ScreenCapture* Capture, bool Closed) 
+static void Buddy_UdpOnFragment(ScreenBuddy* Buddy, const uint8_t* Data, uint32_t Size)
 {
-	ScreenBuddy* Buddy = CONTAINING_RECORD(Capture, ScreenBuddy, Capture);
+	if (Size < 12)
+	{
+		return;
+	}
 
-	if (Buddy->State != BUDDY_STATE_SHARING)
+	uint32_t FrameId;
+	uint32_t FrameSize;
+	uint16_t Index;
+	uint16_t Count;
+	CopyMemory(&FrameId, Data + 0, sizeof(FrameId));
+	CopyMemory(&FrameSize, Data + 4, sizeof(FrameSize));
+	CopyMemory(&Index, Data + 8, sizeof(Index));
+	CopyMemory(&Count, Data + 10, sizeof(Count));
+
+	Data += 12;
+	Size -= 12;
+
+	uint32_t Offset = Index * BUDDY_UDP_FRAGMENT_SIZE;
+	if (Count == 0 || Count > BUDDY_UDP_MAX_FRAGMENTS || Index >= Count
+		|| FrameSize <= (Count - 1) * BUDDY_UDP_FRAGMENT_SIZE || FrameSize > Count * BUDDY_UDP_FRAGMENT_SIZE
+		|| Size != min(FrameSize - Offset, BUDDY_UDP_FRAGMENT_SIZE))
 	{
 		return;
 	}
 
-	ScreenCaptureFrame Frame;
-	if (ScreenCapture_GetFrame(&Buddy->Capture, &Frame))
+	int32_t Ahead = (int32_t)(FrameId - Buddy->DecodeFrameId);
+	if (Ahead < 0)
 	{
-		if (Frame.Time > Buddy->EncodeNextTime)
-		{
-			IMFSample* ConvertedSample;
-			if (SUCCEEDED(IMFVideoSampleAllocatorEx_AllocateSample(Buddy->EncodeSampleAllocator, &ConvertedSample)))
-			{
-				if (Buddy->EncodeFirstTime == 0)
-				{
-					Buddy->EncodeFirstTime = Frame.Time;
-				}
-				Buddy->EncodeNextTime = Frame.Time + Buddy->Freq / BUDDY_ENCODE_FRAMERATE;
+		// already decoded or skipped
+		return;
+	}
+	else if (Ahead >= BUDDY_UDP_HISTORY)
+	{
+		// too far behind, give up on older incomplete frames
+		Buddy->DecodeFrameId = FrameId - BUDDY_UDP_HISTORY + 1;
+		Buddy_LostFrames(Buddy);
+		Buddy_UdpDeliverFrames(Buddy);
+	}
+
+	Buddy_UdpFrame* Frame = &Buddy->UdpFrames[FrameId % BUDDY_UDP_HISTORY];
+	if (!Frame->Active || Frame->Id != FrameId)
+	{
+		Buddy_UdpReserve(Frame, FrameSize);
+		Frame->Id = FrameId;
+		Frame->Size = FrameSize;
+		Frame->Count = Count;
+		Frame->Received = 0;
+		Frame->Active = true;
+		ZeroMemory(Frame->Mask, sizeof(Frame->Mask));
+	}
+	else if (Frame->Size != FrameSize || Frame->Count != Count)
+	{
+		return;
+	}
+
+	uint64_t Bit = 1ULL << (Index % 64);
+	if (!(Frame->Mask[Index / 64] & Bit))
+	{
+		Frame->Mask[Index / 64] |= Bit;
+		CopyMemory(Frame->Data + Offset, Data, Size);
+		Frame->Received++;
+	}
+	Frame->Time = GetTickCount64();
+
+	Buddy_UdpDeliverFrames(Buddy);
+}
 
-				IMFMediaBuffer* InputBuffer;
-				HR(MFCreateDXGISurfaceBuffer(&IID_ID3D11Texture2D, (IUnknown*)Frame.Texture, 0, FALSE, &InputBuffer));
+// asks to retransmit missing fragments of next frame to decode, or skips it if it takes too long
+static void Buddy_UdpRequestMissing(ScreenBuddy* Buddy, uint64_t Now)
+{
+	uint32_t FrameId = Buddy->DecodeFrameId;
+	Buddy_UdpFrame* Frame = &Buddy->UdpFrames[FrameId % BUDDY_UDP_HISTORY];
+	bool Started = Frame->Active && Frame->Id == FrameId;
 
-				DWORD InputBufferLength;
-				HR(IMFMediaBuffer_GetMaxLength(InputBuffer, &InputBufferLength));
-				HR(IMFMediaBuffer_SetCurrentLength(InputBuffer, InputBufferLength));
+	bool Later = false;
+	for (uint32_t Index = 0; Index < BUDDY_UDP_HISTORY; Index++)
+	{
+		Buddy_UdpFrame* Other = &Buddy->UdpFrames[Index];
+		Later |= Other->Active && (int32_t)(Other->Id - FrameId) > 0;
+	}
 
-				IMFSample* InputSample;
-				HR(MFCreateSample(&InputSample));
-				HR(IMFSample_AddBuffer(InputSample, InputBuffer));
-				IMFMediaBuffer_Release(InputBuffer);
+	// fragments can still be arriving if nothing newer has been received
+	if (!Later && !(Started && Now - Frame->Time >= BUDDY_UDP_NACK_INTERVAL))
+	{
+		return;
+	}
 
-				HR(IMFSample_SetSampleTime(InputSample, MFllMulDiv(Frame.Time - Buddy->EncodeFirstTime, 10 * 1000 * 1000, Buddy->Freq, 0)));
-				HR(IMFSample_SetSampleDuration(InputSample, 10 * 1000 * 1000 / BUDDY_ENCODE_FRAMERATE));
+	if (Buddy->UdpStallTime == 0 || Buddy->UdpStallId != FrameId)
+	{
+		Buddy->UdpStallId = FrameId;
+		Buddy->UdpStallTime = Now;
+	}
+	else if (Now - Buddy->UdpStallTime >= BUDDY_UDP_FRAME_TIMEOUT)
+	{
+		if (Started)
+		{
+			Frame->Active = false;
+		}
+		Buddy->DecodeFrameId++;
+		Buddy_LostFrames(Buddy);
+		Buddy_UdpDeliverFrames(Buddy);
+		return;
+	}
 
-				HR(IMFTransform_ProcessInput(Buddy->Converter, 0, InputSample, 0));
-				IMFSample_Release(InputSample);
+	if (Now - Buddy->UdpNackTime < BUDDY_UDP_NACK_INTERVAL)
+	{
+		return;
+	}
+	Buddy->UdpNackTime = Now;
 
-				DWORD Status;
-				MFT_OUTPUT_DATA_BUFFER Output = { .pSample = ConvertedSample };
-				HR(IMFTransform_ProcessOutput(Buddy->Converter, 0, 1, &Output, &Status));
+	uint8_t Payload[BUDDY_UDP_MAX_PAYLOAD];
+	uint16_t Count = 0;
 
-				if (Buddy->EncodeQueueWrite - Buddy->EncodeQueueRead != BUDDY_ENCODE_QUEUE_SIZE)
-				{
-					Buddy->EncodeQueue[Buddy->EncodeQueueWrite % BUDDY_ENCODE_QUEUE_SIZE] = ConvertedSample;
-					Buddy->EncodeQueueWrite += 1;
+	Payload[0] = BUDDY_UDP_NACK;
+	CopyMemory(Payload + 1, &FrameId, sizeof(FrameId));
 
-					if (Buddy->EncodeWaitingForInput)
-					{
-						Buddy->EncodeWaitingForInput = false;
-						Buddy_InputToEncoder(Buddy);
-					}
-				}
-				else
-				{
-					IMFSample_Release(ConvertedSample);
-				}
+	if (Started)
+	{
+		for (uint32_t Index = 0; Index < Frame->Count && 7 + (Count + 1) * 2 <= BUDDY_UDP_MAX_PAYLOAD; Index++)
+		{
+			if (!(Frame->Mask[Index / 64] & (1ULL << (Index % 64))))
+			{
+				uint16_t FragmentIndex = (uint16_t)Index;
+				CopyMemory(Payload + 7 + Count * 2, &FragmentIndex, sizeof(FragmentIndex));
+				Count++;
 			}
 		}
-		ScreenCapture_ReleaseFrame(&Buddy->Capture, &Frame);
 	}
-}
+	CopyMemory(Payload + 5, &Count, sizeof(Count));
 
-//
+	Buddy_UdpSend(Buddy, &Buddy->UdpPeer, Payload, 7 + Count * 2);
+}
 
-void Buddy_ShowMessage(ScreenBuddy* Buddy, const wchar_t* Message)
+static void Buddy_UdpOnDirect(ScreenBuddy* Buddy, const SOCKADDR_IN* Address)
 {
-	HDC DeviceContext = CreateCompatibleDC(0);
-	Assert(DeviceContext);
+	Buddy->UdpPeer = *Address;
 
-	int FontHeight = MulDiv(24, GetDeviceCaps(DeviceContext, LOGPIXELSY), 72);;
-	HFONT Font = CreateFontW(-FontHeight, 0, 0, 0, FW_BOLD,
-		FALSE, FALSE, FALSE, DEFAULT_CHARSET, OUT_DEFAULT_PRECIS,
-		CLIP_DEFAULT_PRECIS, CLEARTYPE_QUALITY, DEFAULT_PITCH, L"Segoe UI");
-	Assert(Font);
+	if (!Buddy->UdpDirect)
+	{
+		Buddy->UdpDirect = true;
+		Buddy->UdpPingTime = GetTickCount64();
+		Buddy_Metric(Buddy, "direct", 1);
 
-	SelectObject(DeviceContext, Font);
+		// frames start arriving over different path, keyframe makes the switch clean
+		if (Buddy->State == BUDDY_STATE_SHARING)
+		{
+			Buddy_ForceKeyFrame(Buddy);
+		}
+	}
+}
 
-	int MessageLength = lstrlenW(Message);
+// goes back to DERP, hole punching starts again in case direct path recovers
+static void Buddy_UdpFallback(ScreenBuddy* Buddy, bool NotifyPeer)
+{
+	if (!Buddy->UdpDirect)
+	{
+		return;
+	}
 
-	SIZE Size;
-	GetTextExtentPoint32W(DeviceContext, Message, MessageLength, &Size);
-	int Width = Size.cx + 2 * FontHeight;
-	int Height = Size.cy + 2 * FontHeight;
+	Buddy->UdpDirect = false;
+	Buddy->UdpPunchTime = GetTickCount64();
+	Buddy->UdpPingTime = 0;
+	Buddy_UdpResetFrames(Buddy);
+	Buddy_Metric(Buddy, "direct", 0);
 
-	BITMAPINFO Info =
+	if (NotifyPeer && Buddy->NetOpen)
 	{
-		.bmiHeader =
-		{
-			.biSize = sizeof(Info.bmiHeader),
-			.biWidth = Width,
-			.biHeight = -Height,
-			.biPlanes = 1,
-			.biBitCount = 32,
-			.biCompression = BI_RGB,
-		},
-	};
+		uint8_t Data[1] = { BUDDY_PACKET_DIRECT_CLOSED };
+		DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, Data, sizeof(Data));
+	}
 
-	void* Bits;
-	HBITMAP Bitmap = CreateDIBSection(DeviceContext, &Info, DIB_RGB_COLORS, &Bits, NULL, 0);
-	Assert(Bitmap);
+	// frames in flight are lost, and will not be retransmitted over DERP
+	if (Buddy->State == BUDDY_STATE_SHARING)
+	{
+		Buddy_ForceKeyFrame(Buddy);
+	}
+}
 
-	SelectObject(DeviceContext, Bitmap);
-	SetTextAlign(DeviceContext, TA_CENTER | TA_BASELINE);
-	SetTextColor(DeviceContext, RGB(255, 255, 255));
-	SetBkColor(DeviceContext, RGB(0, 0, 0));
-	ExtTextOutW(DeviceContext, Width / 2, Height / 2, ETO_OPAQUE, NULL, Message, MessageLength, NULL);
+// for packets that are fine to lose, uses direct path when available
+static bool Buddy_SendDatagram(ScreenBuddy* Buddy, const void* Data, size_t DataSize)
+{
+	if (Buddy->UdpDirect)
+	{
+		uint8_t Payload[BUDDY_UDP_MAX_PAYLOAD];
+		Assert(1 + DataSize <= sizeof(Payload));
 
-	D3D11_TEXTURE2D_DESC TextureDesc =
+		Payload[0] = BUDDY_UDP_PACKET;
+		CopyMemory(Payload + 1, Data, DataSize);
+
+		Buddy_UdpSend(Buddy, &Buddy->UdpPeer, Payload, 1 + DataSize);
+		return true;
+	}
+	else if (!Buddy->NetOpen)
 	{
-		.Width = Width,
-		.Height = Height,
-		.MipLevels = 0,
-		.ArraySize = 1,
-		.Format = DXGI_FORMAT_B8G8R8A8_UNORM,
-		.SampleDesc = { 1, 0 },
-		.Usage = D3D11_USAGE_DEFAULT,
-		.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE,
-		.MiscFlags = D3D11_RESOURCE_MISC_GENERATE_MIPS,
-	};
+		// dropped while session migrates to another region
+		return true;
+	}
+	return DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, Data, DataSize);
+}
 
-	ID3D11Texture2D* Texture;
-	ID3D11Device_CreateTexture2D(Buddy->Device, &TextureDesc, NULL, &Texture);
+static void Buddy_UdpStart(ScreenBuddy* Buddy, uint32_t Region)
+{
+	SOCKET Socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (Socket == INVALID_SOCKET)
+	{
+		return;
+	}
 
-	D3D11_BOX Box =
+	SOCKADDR_IN Bind = { .sin_family = AF_INET };
+	int BindLength = sizeof(Bind);
+	if (bind(Socket, (SOCKADDR*)&Bind, sizeof(Bind)) != 0 || getsockname(Socket, (SOCKADDR*)&Bind, &BindLength) != 0)
 	{
-		.left = 0,
-		.top = 0,
-		.front = 0,
-		.right = Width,
-		.bottom = Height,
-		.back = 1,
-	};
-	ID3D11DeviceContext_UpdateSubresource(Buddy->Context, (ID3D11Resource*)Texture, 0, &Box, Bits, Width * 4, 0);
+		closesocket(Socket);
+		return;
+	}
 
-	if (Buddy->InputView)
+	// bursts of video fragments need larger buffers than default
+	int BufferSize = 4 * 1024 * 1024;
+	setsockopt(Socket, SOL_SOCKET, SO_RCVBUF, (char*)&BufferSize, sizeof(BufferSize));
+	setsockopt(Socket, SOL_SOCKET, SO_SNDBUF, (char*)&BufferSize, sizeof(BufferSize));
+
+	// otherwise ICMP port unreachable from candidates that do not work makes recvfrom fail
+	BOOL ReportReset = FALSE;
+	DWORD Returned;
+	WSAIoctl(Socket, SIO_UDP_CONNRESET, &ReportReset, sizeof(ReportReset), NULL, 0, &Returned, NULL, NULL);
+
+	// this also makes socket non-blocking
+	Buddy->UdpEvent = WSACreateEvent();
+	Assert(Buddy->UdpEvent);
+	WSAEventSelect(Socket, Buddy->UdpEvent, FD_READ);
+
+	Buddy->UdpSocket = Socket;
+	Buddy->UdpStarted = true;
+	Buddy->UdpDirect = false;
+	Buddy->UdpLocalCount = 0;
+	Buddy->UdpRemoteCount = 0;
+	Buddy->UdpPunchTime = GetTickCount64();
+	Buddy->UdpStunTime = 0;
+	Buddy->UdpPingTime = 0;
+	Buddy->UdpRecvTime = 0;
+	Buddy->UdpNackTime = 0;
+	Buddy->UdpStallTime = 0;
+	Buddy_UdpResetFrames(Buddy);
+
+	// restarting with same peer continues same nonce sequence, so peer's replay window keeps working
+	uint8_t SharedKey[32];
+	DerpNet_GetSharedKey(&Buddy->Net, &Buddy->RemoteKey, SharedKey);
+	if (!RtlEqualMemory(SharedKey, Buddy->UdpSharedKey, sizeof(SharedKey)))
 	{
-		ID3D11ShaderResourceView_Release(Buddy->InputView);
+		CopyMemory(Buddy->UdpSharedKey, SharedKey, sizeof(SharedKey));
+		BCryptGenRandom(NULL, Buddy->UdpSendPrefix, sizeof(Buddy->UdpSendPrefix), BCRYPT_USE_SYSTEM_PREFERRED_RNG);
+		Buddy->UdpSendCounter = 0;
+		ZeroMemory(&Buddy->UdpReplay, sizeof(Buddy->UdpReplay));
 	}
-	ID3D11Device_CreateShaderResourceView(Buddy->Device, (ID3D11Resource*)Texture, NULL, &Buddy->InputView);
-	ID3D11Texture2D_Release(Texture);
 
-	DeleteObject(Bitmap);
-	DeleteObject(Font);
-	DeleteDC(DeviceContext);
+	if (Buddy->UdpLocalCandidates)
+	{
+		Buddy_UdpGatherLocal(Buddy, Bind.sin_port);
+	}
 
-	Buddy->InputMipsGenerated = false;
-	Buddy->InputWidth = Width;
-	Buddy->InputHeight = Height;
+	// STUN server of same region tells public address, works only with IPv4 from DerpMap cache
+	ZeroMemory(&Buddy->UdpStunServer, sizeof(Buddy->UdpStunServer));
+	DerpMapRegion* DerpRegion = &Buddy->DerpMap.Regions[Region];
+	for (uint32_t NodeIndex = 0; NodeIndex < DerpRegion->NodeCount; NodeIndex++)
+	{
+		DerpMapNode* Node = &DerpRegion->Nodes[NodeIndex];
+		if (Node->HasIPv4 && Node->StunPort)
+		{
+			Buddy->UdpStunServer.sin_family = AF_INET;
+			Buddy->UdpStunServer.sin_port = htons(Node->StunPort);
+			CopyMemory(&Buddy->UdpStunServer.sin_addr, Node->IPv4, sizeof(Node->IPv4));
+			break;
+		}
+	}
+	BCryptGenRandom(NULL, Buddy->UdpStunTransaction, sizeof(Buddy->UdpStunTransaction), BCRYPT_USE_SYSTEM_PREFERRED_RNG);
 
-	InvalidateRect(Buddy->MainWindow, NULL, FALSE);
-}
+	Buddy_UdpSendCandidates(Buddy);
 
-static void Buddy_CreateRendering(ScreenBuddy* Buddy, HWND Window)
-{
-	Buddy->InputMipsGenerated = false;
-	Buddy->InputWidth = 0;
-	Buddy->InputHeight = 0;
-	Buddy->OutputWidth = 0;
-	Buddy->OutputHeight = 0;
-	Buddy->InputView = NULL;
-	Buddy->OutputView = NULL;
+	Buddy->UdpWaitCallback = CreateThreadpoolWait(&Buddy_UdpWaitCallback, Buddy, NULL);
+	Assert(Buddy->UdpWaitCallback);
+	SetThreadpoolWait(Buddy->UdpWaitCallback, Buddy->UdpEvent, NULL);
+
+	SetTimer(Buddy->DialogWindow, BUDDY_UDP_TIMER, BUDDY_UDP_TICK, NULL);
 }
 
-static void Buddy_ReleaseRendering(ScreenBuddy* Buddy)
+static void Buddy_UdpStop(ScreenBuddy* Buddy)
 {
-	ID3D11DeviceContext_ClearState(Buddy->Context);
-
-	if (Buddy->InputView)
+	if (!Buddy->UdpStarted)
 	{
-		ID3D11ShaderResourceView_Release(Buddy->InputView);
+		return;
 	}
-	if (Buddy->OutputView)
+
+	KillTimer(Buddy->DialogWindow, BUDDY_UDP_TIMER);
+
+	SetThreadpoolWait(Buddy->UdpWaitCallback, NULL, NULL);
+	WaitForThreadpoolWaitCallbacks(Buddy->UdpWaitCallback, TRUE);
+	CloseThreadpoolWait(Buddy->UdpWaitCallback);
+
+	closesocket(Buddy->UdpSocket);
+	WSACloseEvent(Buddy->UdpEvent);
+
+	for (uint32_t Index = 0; Index < BUDDY_UDP_HISTORY; Index++)
 	{
-		ID3D11RenderTargetView_Release(Buddy->OutputView);
+		Buddy_UdpFrame* Frame = &Buddy->UdpFrames[Index];
+		if (Frame->Data)
+		{
+			HeapFree(GetProcessHeap(), 0, Frame->Data);
+		}
+		ZeroMemory(Frame, sizeof(*Frame));
 	}
-
-	ID3D11PixelShader_Release(Buddy->PixelShader);
-	ID3D11PixelShader_Release(Buddy->VertexShader);
-	ID3D11Buffer_Release(Buddy->ConstantBuffer);
-	IDXGISwapChain1_Release(Buddy->SwapChain);
+
+	Buddy->UdpStarted = false;
+	Buddy->UdpDirect = false;
 }
 
-static void Buddy_RenderWindow(ScreenBuddy* Buddy)
+static void Buddy_UdpTimer(ScreenBuddy* Buddy)
 {
-	RECT ClientRect;
-	GetClientRect(Buddy->MainWindow, &ClientRect);
+	uint64_t Now = GetTickCount64();
 
-	int WindowWidth = ClientRect.right - ClientRect.left;
-	int WindowHeight = ClientRect.bottom - ClientRect.top;
-
-	if (WindowWidth == 0 || WindowHeight == 0)
+	if (Buddy->UdpStunServer.sin_family == AF_INET && Now - Buddy->UdpStunTime >= BUDDY_UDP_STUN_INTERVAL && Now - Buddy->UdpPunchTime < BUDDY_UDP_PUNCH_TIMEOUT)
 	{
-		return;
+		Buddy->UdpStunTime = Now;
+		Buddy_UdpSendStun(Buddy);
 	}
 
-	if (WindowWidth != Buddy->OutputWidth || WindowHeight != Buddy->OutputHeight)
+	if (Buddy->UdpDirect)
 	{
-		if (Buddy->OutputView)
+		if (Now - Buddy->UdpRecvTime >= BUDDY_UDP_PATH_TIMEOUT)
 		{
-			ID3D11DeviceContext_ClearState(Buddy->Context);
-			ID3D11RenderTargetView_Release(Buddy->OutputView);
-			Buddy->OutputView = NULL;
+			Buddy_UdpFallback(Buddy, true);
+			return;
 		}
 
-		HR(IDXGISwapChain1_ResizeBuffers(Buddy->SwapChain, 0, WindowWidth, WindowHeight, DXGI_FORMAT_UNKNOWN, 0));
-		Buddy->OutputWidth = WindowWidth;
-		Buddy->OutputHeight = WindowHeight;
-	}
+		if (Now - Buddy->UdpPingTime >= BUDDY_UDP_KEEPALIVE)
+		{
+			Buddy->UdpPingTime = Now;
+			Buddy_UdpSendPing(Buddy, &Buddy->UdpPeer, BUDDY_UDP_PING);
+		}
 
-	if (Buddy->OutputView == NULL)
+		if (Buddy->State == BUDDY_STATE_CONNECTED)
+		{
+			Buddy_UdpRequestMissing(Buddy, Now);
+		}
+	}
+	else if (Now - Buddy->UdpPunchTime < BUDDY_UDP_PUNCH_TIMEOUT && Now - Buddy->UdpPingTime >= BUDDY_UDP_PUNCH_INTERVAL)
 	{
-		ID3D11Texture2D* OutputTexture;
-		HR(IDXGISwapChain1_GetBuffer(Buddy->SwapChain, 0, &IID_ID3D11Texture2D, (void**)&OutputTexture));
-		ID3D11Device_CreateRenderTargetView(Buddy->Device, (ID3D11Resource*)OutputTexture, NULL, &Buddy->OutputView);
-		ID3D11Texture2D_Release(OutputTexture);
+		// every ping opens NAT mapping towards candidate, pong from any of them selects the path
+		Buddy->UdpPingTime = Now;
+		for (uint32_t Index = 0; Index < Buddy->UdpRemoteCount; Index++)
+		{
+			Buddy_UdpSendPing(Buddy, &Buddy->UdpRemote[Index], BUDDY_UDP_PING);
+		}
 	}
+}
 
-	Assert(Buddy->InputView != NULL);
-	int InputWidth = Buddy->InputWidth;
-	int InputHeight = Buddy->InputHeight;
-	int OutputWidth = Buddy->OutputWidth;
-	int OutputHeight = Buddy->OutputHeight;
+static void Buddy_UdpEvent(ScreenBuddy* Buddy)
+{
+	WSAResetEvent(Buddy->UdpEvent);
 
-	if (OutputWidth * InputHeight < OutputHeight * InputWidth)
+	while (Buddy->UdpStarted)
 	{
-		if (OutputWidth < InputWidth)
+		uint8_t Datagram[2048];
+		SOCKADDR_IN Address;
+		int AddressLength = sizeof(Address);
+
+		int Size = recvfrom(Buddy->UdpSocket, (char*)Datagram, sizeof(Datagram), 0, (SOCKADDR*)&Address, &AddressLength);
+		if (Size < 0)
 		{
-			OutputHeight = InputHeight * OutputWidth / InputWidth;
+			// too large datagram is dropped, anything else means all datagrams are read
+			if (WSAGetLastError() == WSAEMSGSIZE)
+			{
+				continue;
+			}
+			break;
 		}
-		else
+
+		if (Size >= 20 && Datagram[0] == 0x01 && Datagram[1] == 0x01)
 		{
-			OutputWidth = InputWidth;
-			OutputHeight = InputHeight;
+			Buddy_UdpOnStun(Buddy, Datagram, Size);
+			continue;
 		}
-	}
-	else
-	{
-		if (OutputHeight < InputHeight)
+
+		// replayed pong would move direct path to address of whoever replays it
+		uint8_t* Payload = Datagram + 1 + 24 + 16;
+		if (Size < 1 + 24 + 16 + 1 || Datagram[0] != BUDDY_UDP_MAGIC || !DerpNet_Unseal(Buddy->UdpSharedKey, Payload, Datagram + 1, Size - 1)
+			|| !DerpNet_AcceptNonce(&Buddy->UdpReplay, Datagram + 1))
 		{
-			OutputWidth = InputWidth * OutputHeight / InputHeight;
+			continue;
 		}
-		else
+		uint32_t PayloadSize = Size - (1 + 24 + 16);
+
+		Buddy->UdpRecvTime = GetTickCount64();
+
+		uint8_t Type = Payload[0];
+		Payload += 1;
+		PayloadSize -= 1;
+
+		if (Type == BUDDY_UDP_PING)
 		{
-			OutputWidth = InputWidth;
-			OutputHeight = InputHeight;
+			// peer behind symmetric NAT pings from other port than STUN reported, so its source address becomes
+			// candidate too, otherwise only one side would see pong when other side has cone or restricted NAT
+			if (!Buddy->UdpDirect)
+			{
+				Buddy_UdpAddCandidate(Buddy->UdpRemote, &Buddy->UdpRemoteCount, &Address);
+			}
+			Buddy_UdpSendPing(Buddy, &Address, BUDDY_UDP_PONG);
+		}
+		else if (Type == BUDDY_UDP_PONG)
+		{
+			Buddy_UdpOnDirect(Buddy, &Address);
+		}
+		else if (Type == BUDDY_UDP_FRAGMENT && Buddy->State == BUDDY_STATE_CONNECTED)
+		{
+			Buddy_UdpOnFragment(Buddy, Payload, PayloadSize);
+		}
+		else if (Type == BUDDY_UDP_NACK && Buddy->State == BUDDY_STATE_SHARING)
+		{
+			Buddy_UdpOnNack(Buddy, Payload, PayloadSize);
+		}
+		else if (Type == BUDDY_UDP_PACKET && Buddy->State == BUDDY_STATE_SHARING && PayloadSize >= 1 && Payload[0] == BUDDY_PACKET_MOUSE_MOVE)
+		{
+			Buddy_OnMouseInput(Buddy, Payload[0], Payload + 1, PayloadSize - 1);
 		}
 	}
+}
 
-	ID3D11DeviceContext* Context = Buddy->Context;
+//
 
-	bool IsPartiallyCovered = OutputWidth != WindowWidth || OutputHeight != WindowHeight;
-	if (IsPartiallyCovered)
+//
+// relay striping
+//
+// one TCP connection to relay is limited by its congestion window & by per-connection rate limits of relay, which
+// caps bitrate of high resolution sessions. With DerpStripes > 1 in config both peers open extra connections to
+// same region, each with own key derived from session key, and announce their public keys to each other with
+// BUDDY_PACKET_STRIPES. Sharer wraps video chunks in BUDDY_PACKET_STRIPE with sequence number, and sends them
+// round-robin over main connection and extra connections that peer has open. Viewer puts chunks back in order
+// before reassembling frames. When chunk does not arrive in BUDDY_STRIPE_GAP_TIMEOUT it is skipped together with
+// rest of its frame. Control & input packets always use main connection. Extra connections are closed when
+// session migrates, and opened again in new region.
+
+// partially received frame will never be completed
+static void Buddy_DropPartialFrame(ScreenBuddy* Buddy)
+{
+	if (Buddy->DecodeInputBuffer)
 	{
-		float BackgroundColor[4] = { 0, 0, 0, 0 };
-		ID3D11DeviceContext_ClearRenderTargetView(Context, Buddy->OutputView, BackgroundColor);
+		IMFMediaBuffer_Release(Buddy->DecodeInputBuffer);
+		Buddy->DecodeInputBuffer = NULL;
+		Buddy->DecodeInputExpected = 0;
 	}
+}
 
-	bool IsInputLarger = InputWidth > OutputWidth || InputHeight > OutputHeight;
-	if (IsInputLarger)
+// reassembles frame from BUDDY_PACKET_VIDEO chunks, data is without packet type
+// first chunk = [u32 frame size][u32 frame id][data], next chunks = [data] until frame size bytes have arrived
+static void Buddy_OnVideoPacket(ScreenBuddy* Buddy, const uint8_t* Data, uint32_t Size)
+{
+	if (Buddy->DecodeInputExpected == 0)
 	{
-		if (!Buddy->InputMipsGenerated)
+		uint32_t Expected;
+		uint32_t FrameId;
+		if (Size < sizeof(Expected) + sizeof(FrameId))
+		{
+			// header does not fit, frame is lost
+			Buddy_LostFrames(Buddy);
+			return;
+		}
+
+		CopyMemory(&Expected, Data, sizeof(Expected));
+		CopyMemory(&FrameId, Data + sizeof(Expected), sizeof(FrameId));
+
+		Data += sizeof(Expected) + sizeof(FrameId);
+		Size -= sizeof(Expected) + sizeof(FrameId);
+
+		if (Expected == 0 || Expected > BUDDY_DECODE_MAX_FRAME || Size > Expected)
 		{
-			ID3D11DeviceContext_GenerateMips(Context, Buddy->InputView);
-			Buddy->InputMipsGenerated = true;
+			Buddy_LostFrames(Buddy);
+			return;
 		}
+
+		Buddy->DecodeInputExpected = Expected;
+		Buddy->DecodeInputFrameId = FrameId;
+		HR(MFCreateMemoryBuffer(Buddy->DecodeInputExpected, &Buddy->DecodeInputBuffer));
 	}
 
-	D3D11_MAPPED_SUBRESOURCE Mapped;
-	HR(ID3D11DeviceContext_Map(Context, (ID3D11Resource*)Buddy->ConstantBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &Mapped));
+	BYTE* BufferData;
+	DWORD BufferMaxLength;
+	DWORD BufferLength;
+	HR(IMFMediaBuffer_Lock(Buddy->DecodeInputBuffer, &BufferData, &BufferMaxLength, &BufferLength));
+
+	// chunk past end of frame means chunks got mixed up, rest of frame is dropped
+	bool Overflow = Size > Buddy->DecodeInputExpected - BufferLength;
+	if (!Overflow)
 	{
-		int W = OutputWidth;
-		int H = OutputHeight;
-		int X = (WindowWidth - OutputWidth) / 2;
-		int Y = (WindowHeight - OutputHeight) / 2;
+		CopyMemory(BufferData + BufferLength, Data, Size);
+	}
+	HR(IMFMediaBuffer_Unlock(Buddy->DecodeInputBuffer));
 
-		float* Data = Mapped.pData;
-		Data[0] = (float)W / WindowWidth;
-		Data[1] = (float)H / WindowHeight;
-		Data[2] = (float)X / WindowWidth;
-		Data[3] = (float)Y / WindowHeight;
+	if (Overflow)
+	{
+		Buddy_DropPartialFrame(Buddy);
+		Buddy_LostFrames(Buddy);
+		return;
 	}
-	ID3D11DeviceContext_Unmap(Context, (ID3D11Resource*)Buddy->ConstantBuffer, 0);
 
-	D3D11_VIEWPORT Viewport =
+	BufferLength += Size;
+	HR(IMFMediaBuffer_SetCurrentLength(Buddy->DecodeInputBuffer, BufferLength));
+
+	if (BufferLength == Buddy->DecodeInputExpected)
 	{
-		.Width = (float)WindowWidth,
-		.Height = (float)WindowHeight,
-	};
+		// frame can arrive over DERP after newer frames were decoded from direct path
+		if ((int32_t)(Buddy->DecodeInputFrameId - Buddy->DecodeFrameId) >= 0)
+		{
+			Buddy_Decode(Buddy, Buddy->DecodeInputBuffer);
+			Buddy->DecodeFrameId = Buddy->DecodeInputFrameId + 1;
+		}
 
-	ID3D11DeviceContext_ClearState(Context);
-	ID3D11DeviceContext_IASetPrimitiveTopology(Context, D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
-	ID3D11DeviceContext_VSSetConstantBuffers(Context, 0, 1, &Buddy->ConstantBuffer);
-	ID3D11DeviceContext_VSSetShader(Context, Buddy->VertexShader, NULL, 0);
-	ID3D11DeviceContext_RSSetViewports(Context, 1, &Viewport);
-	ID3D11DeviceContext_PSSetShaderResources(Context, 0, 1, &Buddy->InputView);
-	ID3D11DeviceContext_PSSetShader(Context, Buddy->PixelShader, NULL, 0);
-	ID3D11DeviceContext_OMSetRenderTargets(Context, 1, &Buddy->OutputView, NULL);
-	ID3D11DeviceContext_Draw(Context, 4, 0);
+		IMFMediaBuffer_Release(Buddy->DecodeInputBuffer);
+		Buddy->DecodeInputBuffer = NULL;
+		Buddy->DecodeInputExpected = 0;
 
-	HR(IDXGISwapChain1_Present(Buddy->SwapChain, 0, 0));
+		Buddy_UdpDeliverFrames(Buddy);
+	}
 }
 
-static bool Buddy_GetMousePosition(ScreenBuddy* Buddy, Buddy_MousePacket* Packet, int X, int Y)
+static void Buddy_DeriveStripeKey(const DerpKey* SessionKey, uint32_t Index, DerpKey* StripeKey)
 {
-	int InputWidth = Buddy->InputWidth;
-	int InputHeight = Buddy->InputHeight;
-	int OutputWidth = Buddy->OutputWidth;
-	int OutputHeight = Buddy->OutputHeight;
+	static const char Label[] = "ScreenBuddy stripe";
 
-	if (OutputWidth == 0 || OutputHeight == 0)
+	uint8_t Input[sizeof(Label) + sizeof(SessionKey->Bytes) + sizeof(Index)];
+	CopyMemory(Input, Label, sizeof(Label));
+	CopyMemory(Input + sizeof(Label), SessionKey->Bytes, sizeof(SessionKey->Bytes));
+	CopyMemory(Input + sizeof(Label) + sizeof(SessionKey->Bytes), &Index, sizeof(Index));
+
+	NTSTATUS Status = BCryptHash(BCRYPT_SHA256_ALG_HANDLE, NULL, 0, Input, sizeof(Input), StripeKey->Bytes, sizeof(StripeKey->Bytes));
+	Assert(BCRYPT_SUCCESS(Status));
+
+	// same clamping as DerpNet_CreateNewKey does
+	StripeKey->Bytes[ 0] &= 0xf8;
+	StripeKey->Bytes[31] &= 0x7f;
+	StripeKey->Bytes[31] |= 0x40;
+}
+
+static void Buddy_OnStripeNetOpen(DerpNet* Net, bool Connected, void* UserData)
+{
+	Buddy_Stripe* Stripe = UserData;
+	PostMessageW(Stripe->Ring.Window, BUDDY_WM_STRIPE_OPEN, Stripe->Ring.Index, Connected);
+}
+
+// opens extra connections that are not open yet, and are not waiting for retry
+static void Buddy_OpenStripes(ScreenBuddy* Buddy)
+{
+	char Addresses[2][64];
+	const char* AddressList[2] = { Addresses[0], Addresses[1] };
+	size_t AddressCount;
+
+	const char* DerpHostName;
+	uint16_t DerpPort;
+	if (!Buddy_GetNetAddress(Buddy, Buddy->NetRegion, &DerpHostName, &DerpPort, Addresses, &AddressCount))
 	{
-		return false;
+		return;
 	}
 
-	int WindowWidth = OutputWidth;
-	int WindowHeight = OutputHeight;
+	uint64_t Now = GetTickCount64();
 
-	if (OutputWidth * InputHeight < OutputHeight * InputWidth)
+	for (uint32_t Index = 0; Index < Buddy->StripeCount - 1; Index++)
 	{
-		if (OutputWidth < InputWidth)
+		Buddy_Stripe* Stripe = &Buddy->Stripes[Index];
+		if (Stripe->Opening || Stripe->Open || Now < Stripe->RetryTime)
 		{
-			OutputHeight = InputHeight * OutputWidth / InputWidth;
+			continue;
 		}
-		else
+
+		Buddy_DeriveStripeKey(&Buddy->NetPrivateKey, 1 + Index, &Stripe->PrivateKey);
+		DerpNet_GetPublicKey(&Stripe->PrivateKey, &Stripe->PublicKey);
+
+		Stripe->Region = Buddy->NetRegion;
+		Stripe->Net.PeerCallback = &Buddy_OnNetPeer;
+		Stripe->Net.PeerUserData = &Stripe->Ring;
+		Stripe->Net.CorkDisabled = !Buddy->NetCorking;
+		Stripe->Opening = DerpNet_OpenAsync(&Stripe->Net, DerpHostName, DerpPort, AddressList, AddressCount, &Stripe->PrivateKey, &Buddy_OnStripeNetOpen, Stripe);
+		if (!Stripe->Opening)
 		{
-			OutputWidth = InputWidth;
-			OutputHeight = InputHeight;
+			Stripe->RetryTime = Now + BUDDY_STRIPE_RETRY;
 		}
 	}
-	else
+}
+
+static void Buddy_StartStripes(ScreenBuddy* Buddy)
+{
+	if (Buddy->StripeCount <= 1)
 	{
-		if (OutputHeight < InputHeight)
-		{
-			OutputWidth = InputWidth * OutputHeight / InputHeight;
-		}
-		else
-		{
-			OutputWidth = InputWidth;
-			OutputHeight = InputHeight;
-		}
+		return;
 	}
 
-	int OffsetX = (WindowWidth - OutputWidth) / 2;
-	int OffsetY = (WindowHeight - OutputHeight) / 2;
+	if (Buddy->Stripes == NULL)
+	{
+		Buddy->Stripes = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, (Buddy->StripeCount - 1) * sizeof(Buddy_Stripe));
+		Assert(Buddy->Stripes);
 
-	X = (X - OffsetX) * InputWidth / OutputWidth;
-	Y = (Y - OffsetY) * InputHeight / OutputHeight;
+		for (uint32_t Index = 0; Index < Buddy->StripeCount - 1; Index++)
+		{
+			Buddy_Stripe* Stripe = &Buddy->Stripes[Index];
+			Stripe->Ring.Net = &Stripe->Net;
+			Stripe->Ring.Window = Buddy->DialogWindow;
+			Stripe->Ring.Index = 1 + Index;
+			Stripe->Ring.Inline = !Buddy->NetThreadEnabled;
+		}
+	}
 
-	Packet->X = X < INT16_MIN ? INT16_MIN : X > INT16_MAX ? INT16_MAX : X;
-	Packet->Y = Y < INT16_MIN ? INT16_MIN : Y > INT16_MAX ? INT16_MAX : Y;
+	for (uint32_t Index = 0; Index < Buddy->StripeCount - 1; Index++)
+	{
+		Buddy->Stripes[Index].RetryTime = 0;
+	}
 
-	return true;
+	Buddy->StripesStarted = true;
+	Buddy_OpenStripes(Buddy);
 }
 
-static void Buddy_UpdateState(ScreenBuddy* Buddy, BuddyState NewState)
+static void Buddy_CloseStripe(Buddy_Stripe* Stripe)
 {
-	bool Disconnected = NewState == BUDDY_STATE_INITIAL || NewState == BUDDY_STATE_DISCONNECTED;
-	bool Sharing = NewState == BUDDY_STATE_SHARE_STARTED || NewState == BUDDY_STATE_SHARING;
-	bool Connecting = NewState == BUDDY_STATE_CONNECTING || NewState == BUDDY_STATE_CONNECTED;
-
-	Button_SetText(GetDlgItem(Buddy->DialogWindow, BUDDY_ID_SHARE_BUTTON), Disconnected || Connecting ? L"Share" : L"Stop");
-	Button_SetText(GetDlgItem(Buddy->DialogWindow, BUDDY_ID_CONNECT_BUTTON), Disconnected || Sharing ? L"Connect" : L"Disconnect");
-
-	EnableWindow(GetDlgItem(Buddy->DialogWindow, BUDDY_ID_SHARE_BUTTON), Disconnected || Sharing);
-	EnableWindow(GetDlgItem(Buddy->DialogWindow, BUDDY_ID_CONNECT_BUTTON), Disconnected || Connecting);
-
-	EnableWindow(GetDlgItem(Buddy->DialogWindow, BUDDY_ID_SHARE_NEW), Disconnected);
-	EnableWindow(GetDlgItem(Buddy->DialogWindow, BUDDY_ID_CONNECT_PASTE), Disconnected);
-	EnableWindow(GetDlgItem(Buddy->DialogWindow, BUDDY_ID_SHARE_KEY), Disconnected);
-	EnableWindow(GetDlgItem(Buddy->DialogWindow, BUDDY_ID_CONNECT_KEY), Disconnected);
-
-	Buddy->State = NewState;
+	if (Stripe->Open)
+	{
+		Buddy_StopNetThread(&Stripe->Ring);
+		DerpNet_Close(&Stripe->Net);
+		Stripe->Open = false;
+	}
 }
 
-static void Buddy_StopDecoder(ScreenBuddy* Buddy)
+static void Buddy_ResetStripeRecv(ScreenBuddy* Buddy)
 {
-	IMFTransform_Release(Buddy->Codec);
-	IMFTransform_Release(Buddy->Converter);
+	Buddy->StripeRecvStarted = false;
+	Buddy->StripeResync = true;
+	Buddy->StripeBuffered = 0;
+	Buddy->StripeGapTime = 0;
 
-	if (Buddy->DecodeInputBuffer)
+	if (Buddy->StripeSlots)
 	{
-		IMFMediaBuffer_Release(Buddy->DecodeInputBuffer);
+		for (uint32_t Index = 0; Index < BUDDY_STRIPE_REORDER; Index++)
+		{
+			Buddy->StripeSlots[Index].Used = false;
+		}
 	}
-	if (Buddy->DecodeOutputSample)
+}
+
+// connections that are still being opened are closed when BUDDY_WM_STRIPE_OPEN arrives
+static void Buddy_StopStripes(ScreenBuddy* Buddy)
+{
+	Buddy->StripesStarted = false;
+
+	if (Buddy->Stripes)
 	{
-		IMFSample_Release(Buddy->DecodeOutputSample);
+		for (uint32_t Index = 0; Index < Buddy->StripeCount - 1; Index++)
+		{
+			Buddy_CloseStripe(&Buddy->Stripes[Index]);
+			Buddy->Stripes[Index].RemoteOpen = false;
+		}
 	}
+
+	Buddy_ResetStripeRecv(Buddy);
 }
 
-static void Buddy_StopSharing(ScreenBuddy* Buddy)
+// tells peer which extra connections are open, peer sends video chunks only to those
+static void Buddy_SendStripes(ScreenBuddy* Buddy)
 {
-	if (Buddy->State == BUDDY_STATE_SHARING)
+	if (!Buddy->NetOpen || Buddy->Stripes == NULL)
 	{
-		ScreenCapture_Stop(&Buddy->Capture);
+		return;
 	}
 
-	IMFShutdown* Shutdown;
-	HR(IMFTransform_QueryInterface(Buddy->Codec, &IID_IMFShutdown, (void**)&Shutdown));
-	HR(IMFShutdown_Shutdown(Shutdown));
-	IMFShutdown_Release(Shutdown);
-
-	IMFTransform_Release(Buddy->Codec);
-	IMFTransform_Release(Buddy->Converter);
-	IMFVideoSampleAllocatorEx_Release(Buddy->EncodeSampleAllocator);
+	uint32_t Count = Buddy->StripeCount - 1;
 
-	ScreenCapture_Release(&Buddy->Capture);
-}
+	uint8_t Data[2 + (BUDDY_MAX_STRIPES - 1) * sizeof(DerpKey)];
+	Data[0] = BUDDY_PACKET_STRIPES;
+	Data[1] = (uint8_t)Count;
 
-static void Buddy_Disconnect(ScreenBuddy* Buddy, const wchar_t* Message)
-{
-	if (Buddy->State == BUDDY_STATE_CONNECTING || Buddy->State == BUDDY_STATE_CONNECTED)
+	for (uint32_t Index = 0; Index < Count; Index++)
 	{
-		if (Buddy->State == BUDDY_STATE_CONNECTING)
+		Buddy_Stripe* Stripe = &Buddy->Stripes[Index];
+		if (Stripe->Open)
 		{
-			KillTimer(Buddy->MainWindow, BUDDY_DISCONNECT_TIMER);
+			CopyMemory(Data + 2 + Index * sizeof(DerpKey), &Stripe->PublicKey, sizeof(DerpKey));
 		}
-		Buddy_StopDecoder(Buddy);
-
-		if (Buddy->ProgressWindow)
+		else
 		{
-			SendMessageW(Buddy->ProgressWindow, TDM_CLICK_BUTTON, IDCANCEL, 0);
+			ZeroMemory(Data + 2 + Index * sizeof(DerpKey), sizeof(DerpKey));
 		}
-		DragAcceptFiles(Buddy->MainWindow, FALSE);
+	}
 
-		Buddy_ShowMessage(Buddy, Message);
-		Buddy_CancelWait(Buddy);
-		DerpNet_Close(&Buddy->Net);
+	DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, Data, 2 + Count * sizeof(DerpKey));
+}
+
+static void Buddy_OnStripes(ScreenBuddy* Buddy, const uint8_t* Data, uint32_t Size)
+{
+	if (Buddy->Stripes == NULL || Size < 1)
+	{
+		return;
 	}
-	else if (Buddy->State == BUDDY_STATE_SHARE_STARTED || Buddy->State == BUDDY_STATE_SHARING)
+
+	DerpKey NoKey = { 0 };
+
+	for (uint32_t Index = 0; Index < Buddy->StripeCount - 1; Index++)
 	{
-		Buddy_StopSharing(Buddy);
+		Buddy_Stripe* Stripe = &Buddy->Stripes[Index];
+		Stripe->RemoteOpen = false;
+
+		if (Index < Data[0] && 1 + (Index + 1) * sizeof(DerpKey) <= Size)
+		{
+			CopyMemory(&Stripe->RemoteKey, Data + 1 + Index * sizeof(DerpKey), sizeof(DerpKey));
+			Stripe->RemoteOpen = !RtlEqualMemory(&Stripe->RemoteKey, &NoKey, sizeof(NoKey));
+		}
+	}
+}
 
-		MessageBoxW(Buddy->DialogWindow, Message, BUDDY_TITLE, MB_ICONERROR);
-		Buddy_CancelWait(Buddy);
-		DerpNet_Close(&Buddy->Net);
+// peer closed its extra connections while migrating, it will announce them again when they are open
+static void Buddy_OnPeerMigrated(ScreenBuddy* Buddy)
+{
+	if (Buddy->Stripes)
+	{
+		for (uint32_t Index = 0; Index < Buddy->StripeCount - 1; Index++)
+		{
+			Buddy->Stripes[Index].RemoteOpen = false;
+		}
 	}
 
-	Buddy_UpdateState(Buddy, BUDDY_STATE_DISCONNECTED);
+	// this side's connections may have stayed open, and peer forgot about them
+	Buddy_SendStripes(Buddy);
 }
 
-static HRESULT CALLBACK Buddy_TaskCallback(HWND TaskWindow, UINT Message, WPARAM WParam, LPARAM LParam, LONG_PTR Data)
+static void Buddy_StripeOpened(ScreenBuddy* Buddy, Buddy_Stripe* Stripe, bool Connected)
 {
-	ScreenBuddy* Buddy = (void*)Data;
+	Stripe->Opening = false;
 
-	switch (Message)
+	if (!Connected)
 	{
-	case TDN_CREATED:
-		Buddy->ProgressWindow = TaskWindow;
-		SendMessageW(TaskWindow, TDM_SET_PROGRESS_BAR_MARQUEE, TRUE, 0);
-		break;
+		Stripe->RetryTime = GetTickCount64() + BUDDY_STRIPE_RETRY;
+		return;
 	}
-	return S_OK;
-}
 
-static void Buddy_SendFile(ScreenBuddy* Buddy, wchar_t* FileName)
-{
-	HANDLE FileHandle = CreateFileW(FileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
-	if (FileHandle != INVALID_HANDLE_VALUE)
+	// session ended or moved to another region while connection was being opened
+	if (!Buddy->StripesStarted || Stripe->Region != Buddy->NetRegion)
 	{
-		LARGE_INTEGER FileSize;
-		if (GetFileSizeEx(FileHandle, &FileSize) && FileSize.QuadPart)
+		DerpNet_Close(&Stripe->Net);
+		if (Buddy->StripesStarted)
 		{
-			Buddy->FileHandle = FileHandle;
-			Buddy->FileSize = FileSize.QuadPart;
-			Buddy->FileProgress = 0;
-			Buddy->FileLastTime = 0;
-			Buddy->FileLastSize = 0;
-			Buddy->ProgressWindow = NULL;
-
-			uint8_t Data[1 + 8 + 256];
-			Data[0] = BUDDY_PACKET_FILE;
-			CopyMemory(&Data[1], &FileSize, sizeof(FileSize));
-			size_t DataSize = 1 + 8 + WideCharToMultiByte(CP_UTF8, 0, FileName, -1, (char*)&Data[1 + 8], 256, NULL, NULL) - 1;
-
-			if (!DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, Data, DataSize))
-			{
-				Buddy_Disconnect(Buddy, L"DerpNet disconnect while sending filename!");
-			}
-			else
-			{
-				SHFILEINFOW FileInfo;
-				DWORD_PTR IconOk = SHGetFileInfoW(FileName, 0, &FileInfo, sizeof(FileInfo), SHGFI_ICON | SHGFI_USEFILEATTRIBUTES);
+			Buddy_OpenStripes(Buddy);
+		}
+		return;
+	}
 
-				PathStripPathW(FileName);
+	Stripe->Open = true;
+	Buddy_StartNetThread(&Stripe->Ring);
+	Buddy_SendStripes(Buddy);
+}
 
-				TASKDIALOGCONFIG Config =
-				{
-					.cbSize = sizeof(Config),
-					.hwndParent = Buddy->MainWindow,
-					.dwFlags = TDF_USE_HICON_MAIN | TDF_ALLOW_DIALOG_CANCELLATION | TDF_SHOW_MARQUEE_PROGRESS_BAR | TDF_CAN_BE_MINIMIZED | TDF_SIZE_TO_CONTENT,
-					.dwCommonButtons = TDCBF_CANCEL_BUTTON,
-					.pszWindowTitle = BUDDY_TITLE,
-					.hMainIcon = IconOk ? FileInfo.hIcon : Buddy->Icon,
-					.pszMainInstruction = FileName,
-					.pszContent = L"Sending file...",
-					.nDefaultButton = IDCANCEL,
-					.pfCallback = &Buddy_TaskCallback,
-					.lpCallbackData = (LONG_PTR)Buddy,
-				};
+// extra connection is closed and opened again later, its chunks in flight are lost
+static void Buddy_StripeFailed(ScreenBuddy* Buddy, Buddy_Stripe* Stripe)
+{
+	Buddy_CloseStripe(Stripe);
+	Stripe->RetryTime = GetTickCount64() + BUDDY_STRIPE_RETRY;
+	Buddy_SendStripes(Buddy);
+}
 
-				TaskDialogIndirect(&Config, NULL, NULL, NULL);
-				KillTimer(Buddy->MainWindow, BUDDY_FILE_TIMER);
+// delivers chunks from reorder buffer that are next in sequence
+static void Buddy_StripeDeliver(ScreenBuddy* Buddy)
+{
+	while (Buddy->StripeBuffered != 0)
+	{
+		Buddy_StripeSlot* Slot = &Buddy->StripeSlots[Buddy->StripeRecvSeq % BUDDY_STRIPE_REORDER];
+		if (!Slot->Used || Slot->Seq != Buddy->StripeRecvSeq)
+		{
+			break;
+		}
 
-				Buddy->ProgressWindow = NULL;
-				Buddy->FileHandle = NULL;
+		Slot->Used = false;
+		Buddy->StripeBuffered--;
+		Buddy->StripeRecvSeq++;
 
-				if (IconOk)
-				{
-					DestroyIcon(FileInfo.hIcon);
-				}
-			}
+		uint8_t Flags = Slot->Data[0];
+		if (Buddy->StripeResync && !(Flags & BUDDY_STRIPE_FRAME_START))
+		{
+			continue;
 		}
+		Buddy->StripeResync = false;
 
-		CloseHandle(FileHandle);
+		Buddy_OnVideoPacket(Buddy, Slot->Data + 1, Slot->Size - 1);
 	}
-}
 
-static LRESULT CALLBACK Buddy_WindowProc(HWND Window, UINT Message, WPARAM WParam, LPARAM LParam)
-{
-	if (Message == WM_NCCREATE)
+	if (Buddy->StripeBuffered == 0)
 	{
-		SetWindowLongPtrW(Window, GWLP_USERDATA, (LONG_PTR)(((CREATESTRUCT*)LParam)->lpCreateParams));
-		return DefWindowProcW(Window, Message, WParam, LParam);
+		Buddy->StripeGapTime = 0;
 	}
-
-	ScreenBuddy* Buddy = (void*)GetWindowLongPtrW(Window, GWLP_USERDATA);
-	if (!Buddy)
+	else if (Buddy->StripeGapTime == 0)
 	{
-		return DefWindowProcW(Window, Message, WParam, LParam);
+		Buddy->StripeGapTime = GetTickCount64();
 	}
+}
 
-	switch (Message)
+// gives up on missing chunks before oldest buffered one
+static void Buddy_StripeSkipGap(ScreenBuddy* Buddy)
+{
+	while (Buddy->StripeBuffered != 0)
 	{
-	case WM_CREATE:
-		Buddy->LastReceived = 0;
-		Buddy_CreateRendering(Buddy, Window);
-		Buddy_ShowMessage(Buddy, L"Connecting...");
-		SetTimer(Window, BUDDY_UPDATE_TITLE_TIMER, 1000, NULL);
-		SetWindowTextW(Window, BUDDY_TITLE);
-		return 0;
-
-	case WM_DESTROY:
-		Buddy_ReleaseRendering(Buddy);
-		Buddy_UpdateState(Buddy, BUDDY_STATE_INITIAL);
-		ShowWindow(Buddy->DialogWindow, SW_SHOWDEFAULT);
-		return 0;
-
-	case WM_TIMER:
-		if (WParam == BUDDY_DISCONNECT_TIMER)
+		Buddy_StripeSlot* Slot = &Buddy->StripeSlots[Buddy->StripeRecvSeq % BUDDY_STRIPE_REORDER];
+		if (Slot->Used && Slot->Seq == Buddy->StripeRecvSeq)
 		{
-			Buddy_Disconnect(Buddy, L"Timeout while connecting to remote computer!");
+			break;
 		}
-		else if (WParam == BUDDY_UPDATE_TITLE_TIMER)
-		{
-			size_t BytesReceived = Buddy->Net.TotalReceived - Buddy->LastReceived;
-			Buddy->LastReceived = Buddy->Net.TotalReceived;
+		Buddy->StripeRecvSeq++;
+	}
 
-			wchar_t Title[256];
-			StrFormat(Title, L"%ls - %.f KB/s", BUDDY_TITLE, (double)BytesReceived / 1024.0);
-			SetWindowTextW(Window, Title);
-		}
-		else if (WParam == BUDDY_FILE_TIMER)
-		{
-			if (Buddy->ProgressWindow)
-			{
-				LARGE_INTEGER TimeNow;
-				QueryPerformanceCounter(&TimeNow);
+	Buddy_DropPartialFrame(Buddy);
+	Buddy->StripeResync = true;
+	Buddy->StripeGapTime = 0;
+	Buddy_LostFrames(Buddy);
+	Buddy_StripeDeliver(Buddy);
+}
 
-				uint8_t Buffer[1 + (8 << 10)];
-				DWORD Read = 0;
-				if (ReadFile(Buddy->FileHandle, Buffer + 1, sizeof(Buffer) - 1, &Read, NULL))
-				{
-					if (Read == 0)
-					{
-						SendMessageW(Buddy->ProgressWindow, TDM_CLICK_BUTTON, IDCANCEL, 0);
-					}
-					else
-					{
-						Buffer[0] = BUDDY_PACKET_FILE_DATA;
-						if (!DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, Buffer, 1 + Read))
-						{
-							Buddy_Disconnect(Buddy, L"DerpNet disconnect while sending file data!");
-						}
-						else
-						{
-							Buddy->FileProgress += Read;
+// data is without packet type
+static void Buddy_OnStripePacket(ScreenBuddy* Buddy, const uint8_t* Data, uint32_t Size)
+{
+	if (Size < sizeof(uint32_t) + 1 + 1 || Size - sizeof(uint32_t) > sizeof(Buddy->StripeSlots[0].Data))
+	{
+		return;
+	}
 
-							if (Buddy->FileLastTime == 0)
-							{
-								Buddy->FileLastTime = TimeNow.QuadPart;
-							}
-							else if (TimeNow.QuadPart - Buddy->FileLastTime >= Buddy->Freq)
-							{
-								double Time = (double)(TimeNow.QuadPart - Buddy->FileLastTime) / Buddy->Freq;
-								double Speed = (Buddy->FileProgress - Buddy->FileLastSize) / Time;
+	uint32_t Seq;
+	CopyMemory(&Seq, Data, sizeof(Seq));
 
-								wchar_t Text[1024];
-								StrFormat(Text, L"Sending file... %.2f KB (%.2f KB/s)", Buddy->FileProgress / 1024.0, Speed / 1024.0);
+	Data += sizeof(Seq);
+	Size -= sizeof(Seq);
 
-								SendMessageW(Buddy->ProgressWindow, TDM_SET_ELEMENT_TEXT, TDE_CONTENT, (LPARAM)Text);
-								SendMessageW(Buddy->ProgressWindow, TDM_SET_PROGRESS_BAR_POS, Buddy->FileProgress * 100 / Buddy->FileSize, 0);
+	if (!Buddy->StripeRecvStarted)
+	{
+		Buddy->StripeRecvStarted = true;
+		Buddy->StripeRecvSeq = Seq;
+	}
 
-								Buddy->FileLastTime = TimeNow.QuadPart;
-								Buddy->FileLastSize = Buddy->FileProgress;
-							}
-						}
-					}
-				}
-			}
-		}
-		return 0;
+	if ((int32_t)(Seq - Buddy->StripeRecvSeq) < 0)
+	{
+		// arrived after it was skipped
+		return;
+	}
 
-	case WM_DROPFILES:
+	// no space to wait for missing chunk any longer, frames after it need keyframe same as after stripe gap
+	if ((int32_t)(Seq - Buddy->StripeRecvSeq) >= BUDDY_STRIPE_REORDER)
 	{
-		HDROP Drop = (HDROP)WParam;
-		wchar_t FileName[256];
-		if (DragQueryFileW(Drop, 0, FileName, ARRAYSIZE(FileName)))
+		Buddy_LostFrames(Buddy);
+	}
+	while ((int32_t)(Seq - Buddy->StripeRecvSeq) >= BUDDY_STRIPE_REORDER)
+	{
+		Buddy_DropPartialFrame(Buddy);
+		Buddy->StripeResync = true;
+
+		if (Buddy->StripeBuffered == 0)
 		{
-			if (Buddy->State == BUDDY_STATE_CONNECTED)
-			{
-				DragAcceptFiles(Buddy->MainWindow, FALSE);
-				Buddy_SendFile(Buddy, FileName);
-				DragAcceptFiles(Buddy->MainWindow, TRUE);
-			}
+			Buddy->StripeRecvSeq = Seq;
+		}
+		else
+		{
+			Buddy->StripeRecvSeq++;
+			Buddy_StripeDeliver(Buddy);
 		}
-		DragFinish(Drop);
-		return 0;
 	}
 
-	case WM_PAINT:
-		Buddy_RenderWindow(Buddy);
-		ValidateRect(Window, NULL);
-		return 0;
+	// common case, nothing is missing so no need to copy
+	if (Seq == Buddy->StripeRecvSeq && Buddy->StripeBuffered == 0)
+	{
+		Buddy->StripeRecvSeq++;
 
-	case WM_CLOSE:
-		if (Buddy->State == BUDDY_STATE_CONNECTING)
+		uint8_t Flags = Data[0];
+		if (Buddy->StripeResync && !(Flags & BUDDY_STRIPE_FRAME_START))
 		{
-			Buddy_CancelWait(Buddy);
-			DerpNet_Close(&Buddy->Net);
+			return;
 		}
-		else if (Buddy->State == BUDDY_STATE_CONNECTED)
-		{
-			if (MessageBoxW(Window, L"Do you want to disconnect?", BUDDY_TITLE, MB_ICONQUESTION | MB_YESNO) == IDNO)
-			{
-				return 0;
-			}
+		Buddy->StripeResync = false;
 
-			uint8_t Data[1] = { BUDDY_PACKET_DISCONNECT };
-			DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, Data, sizeof(Data));
+		Buddy_OnVideoPacket(Buddy, Data + 1, Size - 1);
+		return;
+	}
 
-			Buddy_CancelWait(Buddy);
-			DerpNet_Close(&Buddy->Net);
+	if (Buddy->StripeSlots == NULL)
+	{
+		Buddy->StripeSlots = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, BUDDY_STRIPE_REORDER * sizeof(Buddy_StripeSlot));
+		Assert(Buddy->StripeSlots);
+	}
 
-			if (Buddy->ProgressWindow)
-			{
-				SendMessageW(Buddy->ProgressWindow, TDM_CLICK_BUTTON, IDCANCEL, 0);
-			}
-		}
+	Buddy_StripeSlot* Slot = &Buddy->StripeSlots[Seq % BUDDY_STRIPE_REORDER];
+	if (!Slot->Used)
+	{
+		Slot->Used = true;
+		Slot->Seq = Seq;
+		Slot->Size = Size;
+		CopyMemory(Slot->Data, Data, Size);
+		Buddy->StripeBuffered++;
+	}
 
-		Buddy_UpdateState(Buddy, BUDDY_STATE_DISCONNECTED);
-		break;
+	Buddy_StripeDeliver(Buddy);
+}
 
-	case WM_MOUSEMOVE:
+// video chunks arriving over extra connection
+static void Buddy_StripeEvent(ScreenBuddy* Buddy, Buddy_Stripe* Stripe)
+{
+	// packets pushed after this will post new message
+	InterlockedExchange(&Stripe->Ring.Notified, 0);
+
+	while (Stripe->Open)
 	{
-		if (Buddy->State == BUDDY_STATE_CONNECTED)
+		Buddy_NetMessage* Message = Buddy_NetRingPeek(&Stripe->Ring);
+		if (Message == NULL)
 		{
-			Buddy_MousePacket Packet =
-			{
-				.Packet = BUDDY_PACKET_MOUSE_MOVE,
-			};
-			if (Buddy_GetMousePosition(Buddy, &Packet, GET_X_LPARAM(LParam), GET_Y_LPARAM(LParam)))
-			{
-				if (!DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, &Packet, sizeof(Packet)))
-				{
-					Buddy_Disconnect(Buddy, L"DerpNet disconnect while sending data!");
-				}
-			}
+			break;
 		}
-		return 0;
-	}
-
-	case WM_LBUTTONDOWN:
-	case WM_RBUTTONDOWN:
-	case WM_MBUTTONDOWN:
-	case WM_XBUTTONDOWN:
-	{
-		SetCapture(Window);
 
-		if (Buddy->State == BUDDY_STATE_CONNECTED)
+		if (Message->Type == BUDDY_NET_MESSAGE_PEER_GONE)
 		{
-			Buddy_MousePacket Packet =
-			{
-				.Packet = BUDDY_PACKET_MOUSE_BUTTON,
-				.Button = Message == WM_LBUTTONDOWN ? 0 : Message == WM_RBUTTONDOWN ? 1 : Message == WM_MBUTTONDOWN ? 2 : -1,
-				.IsDownOrHorizontalWheel = 1,
-			};
-			if (Message == WM_XBUTTONDOWN)
+			if (RtlEqualMemory(&Message->Key, &Stripe->RemoteKey, sizeof(Message->Key)))
 			{
-				Packet.Button = HIWORD(WParam) == XBUTTON1 ? 3 : 4;
+				Stripe->RemoteOpen = false;
 			}
-			if (Buddy_GetMousePosition(Buddy, &Packet, GET_X_LPARAM(LParam), GET_Y_LPARAM(LParam)))
+		}
+		else if (Message->Type == BUDDY_NET_MESSAGE_CLOSED)
+		{
+			Buddy_StripeFailed(Buddy, Stripe);
+			break;
+		}
+		else if (Buddy->State == BUDDY_STATE_CONNECTED && Stripe->RemoteOpen && RtlEqualMemory(&Message->Key, &Stripe->RemoteKey, sizeof(Message->Key)))
+		{
+			if (Message->Size >= 1 && Message->Data[0] == BUDDY_PACKET_STRIPE)
 			{
-				if (!DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, &Packet, sizeof(Packet)))
-				{
-					Buddy_Disconnect(Buddy, L"DerpNet disconnect while sending data!");
-				}
+				Buddy_OnStripePacket(Buddy, Message->Data + 1, Message->Size - 1);
 			}
 		}
-		return 0;
 	}
 
-	case WM_LBUTTONUP:
-	case WM_RBUTTONUP:
-	case WM_MBUTTONUP:
-	case WM_XBUTTONUP:
+	Buddy_NetRingRelease(&Stripe->Ring);
+}
+
+static void Buddy_StripeTimer(ScreenBuddy* Buddy)
+{
+	if (Buddy->StripesStarted)
 	{
-		ReleaseCapture();
-		if (Buddy->State == BUDDY_STATE_CONNECTED)
+		Buddy_OpenStripes(Buddy);
+	}
+
+	if (Buddy->StripeGapTime && GetTickCount64() - Buddy->StripeGapTime >= BUDDY_STRIPE_GAP_TIMEOUT)
+	{
+		Buddy_StripeSkipGap(Buddy);
+	}
+}
+
+//
+
+//
+// session migration
+//
+// sharer sends its ranked list of DERP regions to viewer when session starts. When relay disconnects, side that
+// lost connection first tries to resume session in same region, most drops are transient. Then, or when nothing
+// arrives from peer for NetTimeout from config, both sides go through failover list in same order, skipping the failed
+// region, and connect with same keys as before. Each region gets BUDDY_MIGRATE_REGION_TIMEOUT, failed connection
+// is retried within this time, so peers that start at about the same time end up in same region. Both keep
+// announcing themselves with BUDDY_PACKET_MIGRATED, first packet from peer finishes migration. Encoder and decoder
+// stay alive for whole grace period, sharer only forces new keyframe. Per-session DERP key of viewer is what
+// identifies session, relay only delivers packets sealed with it. Direct UDP path, if established, keeps working
+// during migration. Viewer's window title shows time from lost relay to first decoded frame after migration, with
+// -metrics it is written as failover_ms once per migration. Both sides also write resume_ms when session resumed in
+// same region, time from lost connection until peer was seen again.
+
+static void Buddy_SendFailover(ScreenBuddy* Buddy)
+{
+	Buddy->FailoverCount = 0;
+	for (uint32_t Index = 0; Index < Buddy->DerpRankingCount && Buddy->FailoverCount < BUDDY_MAX_FAILOVER_REGIONS; Index++)
+	{
+		uint32_t Region = Buddy->DerpRanking[Index].Region;
+		if (Buddy_GetDerpNode(&Buddy->DerpMap.Regions[Region]))
 		{
-			Buddy_MousePacket Packet =
-			{
-				.Packet = BUDDY_PACKET_MOUSE_BUTTON,
-				.Button = Message == WM_LBUTTONUP ? 0 : Message == WM_RBUTTONUP ? 1 : Message == WM_MBUTTONUP ? 2 : -1,
-				.IsDownOrHorizontalWheel = 0,
-			};
-			if (Message == WM_XBUTTONUP)
-			{
-				Packet.Button = HIWORD(WParam) == XBUTTON1 ? 3 : 4;
-			}
-			if (Buddy_GetMousePosition(Buddy, &Packet, GET_X_LPARAM(LParam), GET_Y_LPARAM(LParam)))
-			{
-				if (!DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, &Packet, sizeof(Packet)))
-				{
-					Buddy_Disconnect(Buddy, L"DerpNet disconnect while sending data!");
-				}
-			}
+			Buddy->FailoverRegions[Buddy->FailoverCount++] = (uint8_t)Region;
 		}
-		return 0;
 	}
 
-	case WM_MOUSEWHEEL:
-	case WM_MOUSEHWHEEL:
+	// without ranking any known region is better than nothing
+	for (uint32_t Region = 0; Region < DERPMAP_MAX_REGION_COUNT && Buddy->FailoverCount < BUDDY_MAX_FAILOVER_REGIONS; Region++)
 	{
-		if (Buddy->State == BUDDY_STATE_CONNECTED)
+		bool Listed = false;
+		for (uint32_t Index = 0; Index < Buddy->FailoverCount; Index++)
 		{
-			POINT Point = { GET_X_LPARAM(LParam), GET_Y_LPARAM(LParam) };
-			ScreenToClient(Window, &Point);
+			Listed |= Buddy->FailoverRegions[Index] == Region;
+		}
 
-			Buddy_MousePacket Packet =
-			{
-				.Packet = BUDDY_PACKET_MOUSE_WHEEL,
-				.Button = GET_WHEEL_DELTA_WPARAM(WParam),
-				.IsDownOrHorizontalWheel = Message == WM_MOUSEHWHEEL ? 1 : 0,
-			};
-			Buddy_GetMousePosition(Buddy, &Packet, Point.x, Point.y);
+		if (!Listed && Buddy_GetDerpNode(&Buddy->DerpMap.Regions[Region]))
+		{
+			Buddy->FailoverRegions[Buddy->FailoverCount++] = (uint8_t)Region;
+		}
+	}
 
-			if (!DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, &Packet, sizeof(Packet)))
-			{
-				Buddy_Disconnect(Buddy, L"DerpNet disconnect while sending data!");
-			}
+	uint8_t Data[2 + BUDDY_MAX_FAILOVER_REGIONS];
+	Data[0] = BUDDY_PACKET_FAILOVER;
+	Data[1] = (uint8_t)Buddy->FailoverCount;
+	CopyMemory(Data + 2, Buddy->FailoverRegions, Buddy->FailoverCount);
+
+	DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, Data, 2 + Buddy->FailoverCount);
+}
+
+static void Buddy_OnFailover(ScreenBuddy* Buddy, const uint8_t* Data, uint32_t Size)
+{
+	Buddy->FailoverCount = 0;
+	for (uint32_t Index = 0; Size >= 1 && Index < Data[0] && 1 + Index < Size && Buddy->FailoverCount < BUDDY_MAX_FAILOVER_REGIONS; Index++)
+	{
+		uint8_t Region = Data[1 + Index];
+		if (Region < DERPMAP_MAX_REGION_COUNT)
+		{
+			Buddy->FailoverRegions[Buddy->FailoverCount++] = Region;
 		}
-		return 0;
 	}
+}
 
+// called once both peers have seen each other through relay
+static void Buddy_StartSession(ScreenBuddy* Buddy)
+{
+	Buddy->NetPeerKeepAlive = false;
+	Buddy->NetRecvTime = GetTickCount64();
+	Buddy->NetSendTime = 0;
+	Buddy->NetLatencyTime = 0;
+	Buddy->NetLatency = 0;
+	Buddy->NetMigrating = false;
+	Buddy->FailoverWaitFrame = false;
+	Buddy->FailoverTime = 0;
+
+	if (Buddy->State == BUDDY_STATE_SHARING)
+	{
+		Buddy_SendFailover(Buddy);
 	}
 
-	return DefWindowProcW(Window, Message, WParam, LParam);
+	SetTimer(Buddy->DialogWindow, BUDDY_NET_TIMER, BUDDY_NET_TICK, NULL);
+	Buddy_UdpStart(Buddy, Buddy->NetRegion);
+	Buddy_StartStripes(Buddy);
 }
 
-//
-
-static bool Buddy_StartSharing(ScreenBuddy* Buddy)
+// index 0 is same region as before migration, rest is failover list
+static uint32_t Buddy_MigrateRegion(ScreenBuddy* Buddy, uint32_t Index)
 {
-	ScreenCapture_Create(&Buddy->Capture, &Buddy_OnFrameCapture, false);
+	return Index == 0 ? Buddy->MigrateFromRegion : Buddy->FailoverRegions[Index - 1];
+}
 
-	HMONITOR Monitor = MonitorFromWindow(Buddy->DialogWindow, MONITOR_DEFAULTTOPRIMARY);
-	Assert(Monitor);
+// opens connection to next region, returns false if there are no more regions to try
+static bool Buddy_MigrateNext(ScreenBuddy* Buddy)
+{
+	Buddy->MigrateRetryTime = 0;
 
-	if (ScreenCapture_CreateForMonitor(&Buddy->Capture, Buddy->Device, Monitor, NULL))
+	while (Buddy->MigrateIndex < 1 + Buddy->FailoverCount)
 	{
-		int EncodeWidth = Buddy->Capture.Rect.right - Buddy->Capture.Rect.left;
-		int EncodeHeight = Buddy->Capture.Rect.bottom - Buddy->Capture.Rect.top;
-
-		if (Buddy_CreateEncoder(Buddy, EncodeWidth, EncodeHeight))
+		uint32_t Region = Buddy_MigrateRegion(Buddy, Buddy->MigrateIndex);
+		if ((Buddy->MigrateIndex == 0 || Region != Buddy->MigrateFromRegion) && Buddy_OpenNet(Buddy, Region, &Buddy->NetPrivateKey))
 		{
-			char DerpHostName[256];
-			if (DERPNET_USE_PLAIN_HTTP)
-			{
-				lstrcpyA(DerpHostName, "localhost");
-			}
-			else
-			{
-				WideCharToMultiByte(CP_UTF8, 0, Buddy->DerpRegions[Buddy->DerpRegion], -1, DerpHostName, ARRAYSIZE(DerpHostName), NULL, NULL);
-			}
-			if (DerpNet_Open(&Buddy->Net, DerpHostName, &Buddy->MyPrivateKey))
-			{
-				Buddy_StartWait(Buddy);
-				return true;
-			}
-			else
-			{
-				MessageBoxW(Buddy->DialogWindow, L"Cannot connect to DerpNet server!", L"Error", MB_ICONERROR);
-			}
+			return true;
 		}
-		else
+		Buddy->MigrateIndex++;
+		Buddy->MigrateDeadline = GetTickCount64() + BUDDY_MIGRATE_REGION_TIMEOUT;
+	}
+
+	Buddy->NetMigrating = false;
+	return false;
+}
+
+// returns false if session cannot be migrated, resume = try same region first
+static bool Buddy_StartMigration(ScreenBuddy* Buddy, bool NotifyPeer, bool Resume)
+{
+	if ((!Resume && Buddy->FailoverCount == 0) || Buddy->NetOpening)
+	{
+		return false;
+	}
+
+	if (Buddy->NetOpen)
+	{
+		if (NotifyPeer)
 		{
-			MessageBoxW(Buddy->DialogWindow, L"Cannot create GPU video encoder!", L"Error", MB_ICONERROR);
+			uint8_t Data[1] = { BUDDY_PACKET_MIGRATE };
+			DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, Data, sizeof(Data));
 		}
+
+		Buddy_StopNetThread(&Buddy->NetRing);
+		DerpNet_Close(&Buddy->Net);
+		Buddy->NetOpen = false;
 	}
-	else
+
+	// file data in flight is lost, and is not resent
+	if (Buddy->ProgressWindow)
 	{
-		MessageBoxW(Buddy->DialogWindow, L"Cannot capture monitor output!", L"Error", MB_ICONERROR);
+		SendMessageW(Buddy->ProgressWindow, TDM_CLICK_BUTTON, IDCANCEL, 0);
 	}
 
-	ScreenCapture_Release(&Buddy->Capture);
-	return false;
+	Buddy_StopStripes(Buddy);
+	Buddy_DropPartialFrame(Buddy);
 
+	LARGE_INTEGER Now;
+	QueryPerformanceCounter(&Now);
+
+	Buddy->NetMigrating = true;
+	Buddy->MigrateIndex = Resume ? 0 : 1;
+	Buddy->MigrateFromRegion = Buddy->NetRegion;
+	Buddy->MigrateDeadline = GetTickCount64() + BUDDY_MIGRATE_REGION_TIMEOUT;
+	Buddy->MigrateSendTime = 0;
+	Buddy->FailoverStart = Now.QuadPart;
+	Buddy->FailoverWaitFrame = false;
+
+	return Buddy_MigrateNext(Buddy);
 }
 
-static bool Buddy_StartConnection(ScreenBuddy* Buddy)
+static void Buddy_MigrateClose(ScreenBuddy* Buddy)
 {
-	wchar_t ConnectKey[256];
-	int ConnectKeyLength = Edit_GetText(GetDlgItem(Buddy->DialogWindow, BUDDY_ID_CONNECT_KEY), ConnectKey, ARRAYSIZE(ConnectKey));
-	if (ConnectKeyLength != 2 + 2 * 32)
+	if (Buddy->NetOpen)
 	{
-		MessageBoxW(Buddy->DialogWindow, L"Incorrect length for connection code!", BUDDY_TITLE, MB_ICONERROR);
-		return false;
+		Buddy_StopNetThread(&Buddy->NetRing);
+		DerpNet_Close(&Buddy->Net);
+		Buddy->NetOpen = false;
 	}
+}
 
-	uint8_t Region;
-	swscanf(ConnectKey, L"%02hhx", &Region);
-	for (int i = 0; i < 32; i++)
+// gives up on current region
+static void Buddy_MigrateAdvance(ScreenBuddy* Buddy)
+{
+	Buddy_MigrateClose(Buddy);
+
+	Buddy->MigrateIndex++;
+	Buddy->MigrateDeadline = GetTickCount64() + BUDDY_MIGRATE_REGION_TIMEOUT;
+	if (!Buddy_MigrateNext(Buddy))
 	{
-		swscanf(ConnectKey + 2 + 2 * i, L"%02hhx", &Buddy->RemoteKey.Bytes[i]);
+		Buddy_Disconnect(Buddy, L"DerpNet server disconnected!");
 	}
+}
 
-	if (!Buddy_CreateDecoder(Buddy))
+// connection to current region failed, it will be opened again if there is time left
+static void Buddy_MigrateRetryLater(ScreenBuddy* Buddy)
+{
+	Buddy_MigrateClose(Buddy);
+	Buddy->MigrateRetryTime = GetTickCount64() + BUDDY_MIGRATE_RETRY;
+}
+
+// relay connection does not work anymore, tries to resume session, or continue it in another region
+static void Buddy_NetFailed(ScreenBuddy* Buddy, const wchar_t* Message)
+{
+	if (Buddy->NetMigrating)
 	{
-		return false;
+		Buddy_MigrateRetryLater(Buddy);
 	}
+	else if (!Buddy_StartMigration(Buddy, false, true))
+	{
+		Buddy_Disconnect(Buddy, Message);
+	}
+}
 
-	DerpKey NewPrivateKey;
-	DerpNet_CreateNewKey(&NewPrivateKey);
-
-	char DerpHostName[256];
-	if (DERPNET_USE_PLAIN_HTTP)
+static void Buddy_OnMigrateOpen(ScreenBuddy* Buddy, bool Connected)
+{
+	if (Connected)
 	{
-		lstrcpyA(DerpHostName, "localhost");
+		Buddy_StartNetThread(&Buddy->NetRing);
+		Buddy->LastReceived = 0;
+
+		uint8_t Data[1] = { BUDDY_PACKET_MIGRATED };
+		DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, Data, sizeof(Data));
+		Buddy->MigrateSendTime = GetTickCount64();
 	}
 	else
 	{
-		WideCharToMultiByte(CP_UTF8, 0, Buddy->DerpRegions[Region], -1, DerpHostName, ARRAYSIZE(DerpHostName), NULL, NULL);
+		Buddy_MigrateRetryLater(Buddy);
 	}
+}
+
+static void Buddy_FinishMigration(ScreenBuddy* Buddy)
+{
+	Buddy->NetMigrating = false;
+	Buddy->NetRecvTime = GetTickCount64();
 
-	if (!DerpNet_Open(&Buddy->Net, DerpHostName, &NewPrivateKey))
+	if (Buddy->MigrateIndex == 0)
 	{
-		Buddy_StopDecoder(Buddy);
-		MessageBoxW(Buddy->DialogWindow, L"Cannot connect to DerpNet server!", BUDDY_TITLE, MB_ICONERROR);
-		return false;
+		LARGE_INTEGER Now;
+		QueryPerformanceCounter(&Now);
+		Buddy_Metric(Buddy, "resume_ms", (double)(Now.QuadPart - Buddy->FailoverStart) * 1000.0 / (double)Buddy->Freq);
 	}
 
-	if (!DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, NULL, 0))
+	// peer may have announced itself before this side arrived
+	uint8_t Data[1] = { BUDDY_PACKET_MIGRATED };
+	DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, Data, sizeof(Data));
+
+	Buddy_StartStripes(Buddy);
+
+	if (Buddy->State == BUDDY_STATE_SHARING)
 	{
-		Buddy_StopDecoder(Buddy);
-		return false;
+		Buddy_ForceKeyFrame(Buddy);
+	}
+	else
+	{
+		Buddy->FailoverWaitFrame = true;
 	}
-	Buddy_StartWait(Buddy);
+}
 
-	Buddy->MainWindow = CreateWindowExW(
-		0, BUDDY_CLASS, BUDDY_TITLE, WS_OVERLAPPEDWINDOW,
-		CW_USEDEFAULT, CW_USEDEFAULT, CW_USEDEFAULT, CW_USEDEFAULT,
-		NULL, NULL, GetModuleHandleW(NULL), Buddy);
-	Assert(Buddy->MainWindow);
+static void Buddy_NetTimer(ScreenBuddy* Buddy)
+{
+	uint64_t Now = GetTickCount64();
 
-	D3D11_BUFFER_DESC ConstantBufferDesc =
+	if (Buddy->NetMigrating)
 	{
-		.ByteWidth = 4 * sizeof(float),
-		.Usage = D3D11_USAGE_DYNAMIC,
-		.BindFlags = D3D11_BIND_CONSTANT_BUFFER,
-		.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE,
-	};
-	ID3D11Device_CreateBuffer(Buddy->Device, &ConstantBufferDesc, NULL, &Buddy->ConstantBuffer);
+		if (Buddy->NetOpening)
+		{
+			return;
+		}
 
-	ID3D11Device_CreateVertexShader(Buddy->Device, ScreenBuddyVS, sizeof(ScreenBuddyVS), NULL, &Buddy->VertexShader);
-	ID3D11Device_CreatePixelShader(Buddy->Device, ScreenBuddyPS, sizeof(ScreenBuddyPS), NULL, &Buddy->PixelShader);
+		if (Now >= Buddy->MigrateDeadline)
+		{
+			Buddy_MigrateAdvance(Buddy);
+		}
+		else if (Buddy->MigrateRetryTime && Now >= Buddy->MigrateRetryTime)
+		{
+			Buddy->MigrateRetryTime = 0;
+			if (!Buddy_OpenNet(Buddy, Buddy_MigrateRegion(Buddy, Buddy->MigrateIndex), &Buddy->NetPrivateKey))
+			{
+				Buddy_MigrateAdvance(Buddy);
+			}
+		}
+		else if (Buddy->NetOpen && Now - Buddy->MigrateSendTime >= BUDDY_MIGRATE_RESEND)
+		{
+			uint8_t Data[1] = { BUDDY_PACKET_MIGRATED };
+			DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, Data, sizeof(Data));
+			Buddy->MigrateSendTime = Now;
+		}
+		return;
+	}
 
-	IDXGIDevice* DxgiDevice;
-	IDXGIAdapter* DxgiAdapter;
-	IDXGIFactory2* DxgiFactory;
+	if (!Buddy->NetOpen)
+	{
+		return;
+	}
 
-	HR(ID3D11Device_QueryInterface(Buddy->Device, &IID_IDXGIDevice, (void**)&DxgiDevice));
-	HR(IDXGIDevice_GetAdapter(DxgiDevice, &DxgiAdapter));
-	HR(IDXGIAdapter_GetParent(DxgiAdapter, &IID_IDXGIFactory2, (void**)&DxgiFactory));
+	if (Now - Buddy->NetSendTime >= BUDDY_NET_KEEPALIVE)
+	{
+		// failure here will be noticed by next receive
+		uint8_t Data[1] = { BUDDY_PACKET_KEEPALIVE };
+		DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, Data, sizeof(Data));
+		Buddy->NetSendTime = Now;
+	}
 
-	DXGI_SWAP_CHAIN_DESC1 Desc =
+	// viewer measures round trip to sharer, which echoes packet back, includes queueing behind video
+	if (Buddy->State == BUDDY_STATE_CONNECTED && Now - Buddy->NetLatencyTime >= Buddy->NetLatencyInterval)
 	{
-		.Format = DXGI_FORMAT_B8G8R8A8_UNORM,
-		.SampleDesc = { 1, 0 },
-		.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT,
-		.BufferCount = 2,
-		.Scaling = DXGI_SCALING_NONE,
-		.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD,
-	};
-	HR(IDXGIFactory2_CreateSwapChainForHwnd(DxgiFactory, (IUnknown*)Buddy->Device, Buddy->MainWindow, &Desc, NULL, NULL, &Buddy->SwapChain));
-	HR(IDXGIFactory2_MakeWindowAssociation(DxgiFactory, Buddy->MainWindow, DXGI_MWA_NO_ALT_ENTER));
+		LARGE_INTEGER Counter;
+		QueryPerformanceCounter(&Counter);
 
-	IDXGIFactory2_Release(DxgiFactory);
-	IDXGIAdapter_Release(DxgiAdapter);
-	IDXGIDevice_Release(DxgiDevice);
+		uint8_t Data[1 + sizeof(Counter.QuadPart)] = { BUDDY_PACKET_LATENCY };
+		CopyMemory(Data + 1, &Counter.QuadPart, sizeof(Counter.QuadPart));
+		DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, Data, sizeof(Data));
+		Buddy->NetLatencyTime = Now;
+	}
 
-	ShowWindow(Buddy->MainWindow, SW_SHOWDEFAULT);
-	ShowWindow(Buddy->DialogWindow, SW_HIDE);
-	return true;
+	Buddy_StripeTimer(Buddy);
+	Buddy_KeyFrameTimer(Buddy);
+	Buddy_ViewTimer(Buddy);
+
+	if (Buddy->State == BUDDY_STATE_SHARING && Now - Buddy->PaceStatsTime >= 1000)
+	{
+		wchar_t Title[256];
+		StrFormat(Title, L"%ls - %.f KB/s - burst %.f KB - delay %u ms - dropped %u - static %u - scroll %u - %ux%u", BUDDY_TITLE,
+			(double)Buddy->PaceStatsBytes * 1000.0 / 1024.0 / (double)(Now - Buddy->PaceStatsTime),
+			(double)Buddy->PaceMaxBurst / 1024.0, Buddy->PaceMaxDelay, Buddy->PaceDropped, Buddy->ChangeSkipped, Buddy->Scroll.Count,
+			Buddy->EncodeWidth, Buddy->EncodeHeight);
+		SetWindowTextW(Buddy->DialogWindow, Title);
+
+		Buddy_Metric(Buddy, "send_kbps", (double)Buddy->PaceStatsBytes * 8.0 / (double)(Now - Buddy->PaceStatsTime));
+		Buddy_NetSendMetrics(Buddy, Now - Buddy->PaceStatsTime);
+		Buddy_Metric(Buddy, "burst_kb", (double)Buddy->PaceMaxBurst / 1024.0);
+		Buddy_Metric(Buddy, "pace_delay_ms", Buddy->PaceMaxDelay);
+		Buddy_Metric(Buddy, "dropped", Buddy->PaceDropped);
+		Buddy_Metric(Buddy, "static", Buddy->ChangeSkipped);
+		Buddy_Metric(Buddy, "scroll", Buddy->Scroll.Count);
+		Buddy_NetRingMetrics(Buddy);
+
+		Buddy->PaceStatsTime = Now;
+		Buddy->PaceStatsBytes = 0;
+		Buddy->PaceMaxBurst = 0;
+		Buddy->PaceMaxDelay = 0;
+		Buddy->PaceDropped = 0;
+		Buddy->ChangeSkipped = 0;
+		Buddy->Scroll.Count = 0;
+	}
+
+	// relay still accepts data, but nothing is delivered, no point to resume in same region
+	if (Buddy->NetPeerKeepAlive && Buddy->FailoverCount && Now - Buddy->NetRecvTime >= Buddy->NetTimeout)
+	{
+		if (Buddy_StartMigration(Buddy, true, false))
+		{
+			// relay was lost when last packet arrived, not when timeout noticed it
+			Buddy->FailoverStart -= (Now - Buddy->NetRecvTime) * Buddy->Freq / 1000;
+		}
+		else
+		{
+			Buddy_Disconnect(Buddy, L"DerpNet server disconnected!");
+		}
+	}
 }
 
+//
+
 static void Buddy_NetworkEvent(ScreenBuddy* Buddy)
 {
-	while (Buddy->State != BUDDY_STATE_DISCONNECTED)
+	// replies to all packets received here go out together
+	Buddy_NetCork(Buddy);
+
+	// packets pushed after this will post new message
+	InterlockedExchange(&Buddy->NetRing.Notified, 0);
+
+	// connection may be already closed for migration when this message arrives
+	while (Buddy->NetOpen && Buddy->State != BUDDY_STATE_DISCONNECTED)
 	{
-		DerpKey RecvKey;
-		uint8_t* RecvData;
-		uint32_t RecvSize;
-		int Recv = DerpNet_Recv(&Buddy->Net, &RecvKey, &RecvData, &RecvSize, false);
-		if (Recv < 0)
+		Buddy_NetMessage* Message = Buddy_NetRingPeek(&Buddy->NetRing);
+		if (Message == NULL)
 		{
-			Buddy_Disconnect(Buddy, L"DerpNet server disconnected!");
 			break;
 		}
-		else if (Recv == 0)
+
+		if (Message->Type == BUDDY_NET_MESSAGE_PEER_GONE)
+		{
+			if (RtlEqualMemory(&Message->Key, &Buddy->RemoteKey, sizeof(Message->Key)))
+			{
+				Buddy->NetPeerGone = true;
+			}
+			continue;
+		}
+		else if (Message->Type == BUDDY_NET_MESSAGE_CLOSED)
 		{
+			if (Buddy->State == BUDDY_STATE_CONNECTED || Buddy->State == BUDDY_STATE_SHARING)
+			{
+				Buddy_NetFailed(Buddy, L"DerpNet server disconnected!");
+			}
+			else
+			{
+				Buddy_Disconnect(Buddy, L"DerpNet server disconnected!");
+			}
 			break;
 		}
 
+		DerpKey RecvKey = Message->Key;
+		uint8_t* RecvData = Message->Data;
+		uint32_t RecvSize = Message->Size;
+
 		if (Buddy->State == BUDDY_STATE_CONNECTING || Buddy->State == BUDDY_STATE_CONNECTED)
 		{
+			if (Buddy->State == BUDDY_STATE_CONNECTING && RecvSize >= 1 && RecvData[0] == BUDDY_PACKET_VERSION && RtlEqualMemory(&RecvKey, &Buddy->RemoteKey, sizeof(RecvKey)))
+			{
+				Buddy_Disconnect(Buddy, L"Remote computer runs incompatible ScreenBuddy version!");
+				break;
+			}
+
 			if (Buddy->State == BUDDY_STATE_CONNECTING)
 			{
 				KillTimer(Buddy->MainWindow, BUDDY_DISCONNECT_TIMER);
+				KillTimer(Buddy->MainWindow, BUDDY_MESH_TIMER);
 				Buddy_UpdateState(Buddy, BUDDY_STATE_CONNECTED);
 				DragAcceptFiles(Buddy->MainWindow, TRUE);
+				Buddy_StartSession(Buddy);
 			}
 
 			if (RtlEqualMemory(&RecvKey, &Buddy->RemoteKey, sizeof(RecvKey)))
 			{
-				Assert(RecvSize >= 1);
+				// every packet after viewer's first one starts with type
+				if (RecvSize == 0)
+				{
+					continue;
+				}
+
+				Buddy->NetRecvTime = GetTickCount64();
+				if (Buddy->NetMigrating)
+				{
+					Buddy_FinishMigration(Buddy);
+				}
 
 				uint8_t Packet = RecvData[0];
 				RecvData += 1;
@@ -2061,47 +8155,66 @@ static void Buddy_NetworkEvent(ScreenBuddy* Buddy)
 
 				if (Packet == BUDDY_PACKET_VIDEO)
 				{
-					if (Buddy->DecodeInputExpected == 0)
-					{
-						Assert(RecvSize >= sizeof(Buddy->DecodeInputExpected));
-						CopyMemory(&Buddy->DecodeInputExpected, RecvData, sizeof(Buddy->DecodeInputExpected));
-
-						RecvData += sizeof(Buddy->DecodeInputExpected);
-						RecvSize -= sizeof(Buddy->DecodeInputExpected);
-
-						Assert(Buddy->DecodeInputBuffer == NULL);
-						HR(MFCreateMemoryBuffer(Buddy->DecodeInputExpected, &Buddy->DecodeInputBuffer));
-					}
-
-					Assert(Buddy->DecodeInputBuffer);
-
-					BYTE* BufferData;
-					DWORD BufferMaxLength;
-					DWORD BufferLength;
-					HR(IMFMediaBuffer_Lock(Buddy->DecodeInputBuffer, &BufferData, &BufferMaxLength, &BufferLength));
-					{
-						Assert(BufferLength + RecvSize <= BufferMaxLength);
-						CopyMemory(BufferData + BufferLength, RecvData, RecvSize);
-					}
-					HR(IMFMediaBuffer_Unlock(Buddy->DecodeInputBuffer));
-
-					BufferLength += RecvSize;
-					HR(IMFMediaBuffer_SetCurrentLength(Buddy->DecodeInputBuffer, BufferLength));
-
-					if (BufferLength == Buddy->DecodeInputExpected)
-					{
-						Buddy_Decode(Buddy, Buddy->DecodeInputBuffer);
-
-						IMFMediaBuffer_Release(Buddy->DecodeInputBuffer);
-						Buddy->DecodeInputBuffer = NULL;
-						Buddy->DecodeInputExpected = 0;
-					}
+					Buddy_OnVideoPacket(Buddy, RecvData, RecvSize);
+				}
+				else if (Packet == BUDDY_PACKET_STRIPE)
+				{
+					Buddy_OnStripePacket(Buddy, RecvData, RecvSize);
+				}
+				else if (Packet == BUDDY_PACKET_THUMBNAIL)
+				{
+					Buddy_OnThumbnail(Buddy, RecvData, RecvSize);
 				}
 				else if (Packet == BUDDY_PACKET_DISCONNECT)
 				{
 					Buddy_Disconnect(Buddy, L"Remote computer stopped sharing!");
 					break;
 				}
+				else if (Packet == BUDDY_PACKET_CANDIDATES)
+				{
+					Buddy_UdpOnCandidates(Buddy, RecvData, RecvSize);
+				}
+				else if (Packet == BUDDY_PACKET_DIRECT_CLOSED)
+				{
+					Buddy_UdpFallback(Buddy, false);
+				}
+				else if (Packet == BUDDY_PACKET_FAILOVER)
+				{
+					Buddy_OnFailover(Buddy, RecvData, RecvSize);
+				}
+				else if (Packet == BUDDY_PACKET_STRIPES)
+				{
+					Buddy_OnStripes(Buddy, RecvData, RecvSize);
+				}
+				else if (Packet == BUDDY_PACKET_MIGRATED)
+				{
+					Buddy_OnPeerMigrated(Buddy);
+				}
+				else if (Packet == BUDDY_PACKET_KEEPALIVE)
+				{
+					Buddy->NetPeerKeepAlive = true;
+				}
+				else if (Packet == BUDDY_PACKET_LATENCY && RecvSize == sizeof(uint64_t))
+				{
+					LARGE_INTEGER Now;
+					QueryPerformanceCounter(&Now);
+
+					// performance counter value from Buddy_NetTimer
+					uint64_t SentTime;
+					CopyMemory(&SentTime, RecvData, sizeof(SentTime));
+					double RoundTrip = (double)(Now.QuadPart - SentTime) * 1000.0 / (double)Buddy->Freq;
+
+					Buddy->NetLatency = (uint32_t)RoundTrip;
+					Buddy_Metric(Buddy, "rtt_ms", RoundTrip);
+				}
+				else if (Packet == BUDDY_PACKET_MIGRATE)
+				{
+					if (!Buddy_StartMigration(Buddy, false, false))
+					{
+						Buddy_Disconnect(Buddy, L"DerpNet server disconnected!");
+					}
+					break;
+				}
 				else if (Packet == BUDDY_PACKET_FILE_ACCEPT)
 				{
 					if (Buddy->ProgressWindow)
@@ -2122,7 +8235,7 @@ static void Buddy_NetworkEvent(ScreenBuddy* Buddy)
 		}
 		else if (Buddy->State == BUDDY_STATE_SHARE_STARTED)
 		{
-			if (RecvSize == 0)
+			if (RecvSize == 1 && RecvData[0] == BUDDY_PROTOCOL_VERSION)
 			{
 				Buddy->RemoteKey = RecvKey;
 
@@ -2130,18 +8243,35 @@ static void Buddy_NetworkEvent(ScreenBuddy* Buddy)
 				Buddy_NextMediaEvent(Buddy);
 
 				Buddy_UpdateState(Buddy, BUDDY_STATE_SHARING);
+				Buddy_StartSession(Buddy);
 			}
-			else
+			else if (RecvSize == 0 || RecvData[0] != BUDDY_PACKET_VERSION)
 			{
-				Buddy_Disconnect(Buddy, L"Received unexpected initial packet!");
-				break;
+				// viewer of other version, or stray packet, sharing keeps waiting for compatible viewer
+				uint8_t Data[2] = { BUDDY_PACKET_VERSION, BUDDY_PROTOCOL_VERSION };
+				DerpNet_Send(&Buddy->Net, &RecvKey, Data, sizeof(Data));
 			}
 		}
 		else if (Buddy->State == BUDDY_STATE_SHARING)
 		{
 			if (RtlEqualMemory(&RecvKey, &Buddy->RemoteKey, sizeof(RecvKey)))
 			{
-				Assert(RecvSize >= 1);
+				// every packet after viewer's first one starts with type
+				if (RecvSize == 0)
+				{
+					continue;
+				}
+
+				Buddy->NetRecvTime = GetTickCount64();
+				if (Buddy->NetMigrating)
+				{
+					Buddy_FinishMigration(Buddy);
+				}
+				else if (RecvData[0] == BUDDY_PACKET_MIGRATED)
+				{
+					// viewer resumed session on its own, and lost frames in meantime
+					Buddy_ForceKeyFrame(Buddy);
+				}
 
 				uint8_t Packet = RecvData[0];
 				RecvData += 1;
@@ -2149,82 +8279,88 @@ static void Buddy_NetworkEvent(ScreenBuddy* Buddy)
 
 				if (Packet == BUDDY_PACKET_DISCONNECT)
 				{
-					DerpNet_Close(&Buddy->Net);
+					Buddy_CloseNet(Buddy);
 					Buddy_StopSharing(Buddy);
 					Buddy_UpdateState(Buddy, BUDDY_STATE_INITIAL);
 					break;
 				}
 				else if (Packet == BUDDY_PACKET_MOUSE_MOVE || Packet == BUDDY_PACKET_MOUSE_BUTTON || Packet == BUDDY_PACKET_MOUSE_WHEEL)
 				{
-					Buddy_MousePacket Data;
-					if (1 + RecvSize == sizeof(Data))
+					Buddy_OnMouseInput(Buddy, Packet, RecvData, RecvSize);
+				}
+				else if (Packet == BUDDY_PACKET_VIEW_SIZE)
+				{
+					Buddy_OnViewSize(Buddy, RecvData, RecvSize);
+					if (Buddy->State != BUDDY_STATE_SHARING)
 					{
-						CopyMemory(&Data.Packet + 1, RecvData, RecvSize);
-
-						MONITORINFO MonitorInfo =
-						{
-							.cbSize = sizeof(MonitorInfo),
-						};
-						BOOL MonitorOk = GetMonitorInfoW(Buddy->Capture.Monitor, &MonitorInfo);
-						Assert(MonitorOk);
-
-						MONITORINFO PrimaryMonitorInfo =
-						{
-							.cbSize = sizeof(PrimaryMonitorInfo),
-						};
-						BOOL PrimaryOk = GetMonitorInfoW(MonitorFromWindow(NULL, MONITOR_DEFAULTTOPRIMARY), &PrimaryMonitorInfo);
-						Assert(PrimaryOk);
-
-						const RECT* R = &MonitorInfo.rcMonitor;
-						const RECT* Primary = &PrimaryMonitorInfo.rcMonitor;
-
-						INPUT Input =
-						{
-							.type = INPUT_MOUSE,
-							.mi.dx = (Data.X + R->left) * 65535 / (Primary->right - Primary->left),
-							.mi.dy = (Data.Y + R->top) * 65535 / (Primary->bottom - Primary->top),
-							.mi.dwFlags = MOUSEEVENTF_ABSOLUTE,
-						};
-
-						if (Packet == BUDDY_PACKET_MOUSE_MOVE)
-						{
-							Input.mi.dwFlags |= MOUSEEVENTF_MOVE;
-							SendInput(1, &Input, sizeof(Input));
-						}
-						else if (Packet == BUDDY_PACKET_MOUSE_BUTTON)
-						{
-							switch (Data.Button)
-							{
-							case 0: Input.mi.dwFlags |= Data.IsDownOrHorizontalWheel ? MOUSEEVENTF_LEFTDOWN : MOUSEEVENTF_LEFTUP; break;
-							case 1: Input.mi.dwFlags |= Data.IsDownOrHorizontalWheel ? MOUSEEVENTF_RIGHTDOWN : MOUSEEVENTF_RIGHTUP; break;
-							case 2: Input.mi.dwFlags |= Data.IsDownOrHorizontalWheel ? MOUSEEVENTF_MIDDLEDOWN : MOUSEEVENTF_MIDDLEUP; break;
-							case 3: Input.mi.dwFlags |= Data.IsDownOrHorizontalWheel ? MOUSEEVENTF_XDOWN : MOUSEEVENTF_XUP; Input.mi.mouseData = XBUTTON1; break;
-							case 4: Input.mi.dwFlags |= Data.IsDownOrHorizontalWheel ? MOUSEEVENTF_XDOWN : MOUSEEVENTF_XUP; Input.mi.mouseData = XBUTTON2; break;
-							}
-							SendInput(1, &Input, sizeof(Input));
-						}
-						else if (Packet == BUDDY_PACKET_MOUSE_WHEEL)
-						{
-							Input.mi.mouseData = Data.Button;
-							Input.mi.dwFlags |= (Data.IsDownOrHorizontalWheel ? MOUSEEVENTF_HWHEEL : MOUSEEVENTF_WHEEL);
-							SendInput(1, &Input, sizeof(Input));
-						}
+						break;
+					}
+				}
+				else if (Packet == BUDDY_PACKET_VIEWPORT)
+				{
+					Buddy_OnViewport(Buddy, RecvData, RecvSize);
+					if (Buddy->State != BUDDY_STATE_SHARING)
+					{
+						break;
+					}
+				}
+				else if (Packet == BUDDY_PACKET_CANDIDATES)
+				{
+					Buddy_UdpOnCandidates(Buddy, RecvData, RecvSize);
+				}
+				else if (Packet == BUDDY_PACKET_DIRECT_CLOSED)
+				{
+					Buddy_UdpFallback(Buddy, false);
+				}
+				else if (Packet == BUDDY_PACKET_KEEPALIVE)
+				{
+					Buddy->NetPeerKeepAlive = true;
+				}
+				else if (Packet == BUDDY_PACKET_LATENCY && RecvSize == sizeof(uint64_t))
+				{
+					// failure here will be noticed by next receive
+					uint8_t Data[1 + sizeof(uint64_t)] = { BUDDY_PACKET_LATENCY };
+					CopyMemory(Data + 1, RecvData, sizeof(uint64_t));
+					DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, Data, sizeof(Data));
+				}
+				else if (Packet == BUDDY_PACKET_STRIPES)
+				{
+					Buddy_OnStripes(Buddy, RecvData, RecvSize);
+				}
+				else if (Packet == BUDDY_PACKET_MIGRATED)
+				{
+					Buddy_OnPeerMigrated(Buddy);
+				}
+				else if (Packet == BUDDY_PACKET_KEYFRAME)
+				{
+					Buddy_OnKeyFrameRequest(Buddy);
+				}
+				else if (Packet == BUDDY_PACKET_MIGRATE)
+				{
+					if (!Buddy_StartMigration(Buddy, false, false))
+					{
+						Buddy_Disconnect(Buddy, L"DerpNet server disconnected!");
 					}
+					break;
 				}
 				else if (Packet == BUDDY_PACKET_FILE)
 				{
+					// nothing should wait in queue while modal dialogs are shown
+					Buddy_NetUncork(Buddy);
+
 					wchar_t FileName[256];
 
-					if (Buddy->ProgressWindow == NULL)
+					if (Buddy->ProgressWindow == NULL && RecvSize > 8)
 					{
-						Assert(RecvSize > 8);
-
 						uint64_t FileSize;
 						CopyMemory(&FileSize, RecvData, sizeof(FileSize));
 
-						int FileNameLen = MultiByteToWideChar(CP_UTF8, 0, RecvData + 8, RecvSize - sizeof(FileSize), FileName, ARRAYSIZE(FileName));
+						int FileNameLen = MultiByteToWideChar(CP_UTF8, 0, RecvData + 8, RecvSize - sizeof(FileSize), FileName, ARRAYSIZE(FileName) - 1);
 						FileName[FileNameLen] = 0;
 
+						// packets keep arriving while dialogs are shown, this one is not needed anymore
+						Buddy_NetRingRelease(&Buddy->NetRing);
+
 						OPENFILENAMEW Dialog =
 						{
 							.lStructSize = sizeof(Dialog),
@@ -2260,8 +8396,11 @@ static void Buddy_NetworkEvent(ScreenBuddy* Buddy)
 						Buddy->FileLastTime = 0;
 						Buddy->FileLastSize = 0;
 
-						uint8_t Data[1] = { BUDDY_PACKET_FILE_ACCEPT };
-						DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, Data, sizeof(Data));
+						if (Buddy->NetOpen)
+						{
+							uint8_t Data[1] = { BUDDY_PACKET_FILE_ACCEPT };
+							DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, Data, sizeof(Data));
+						}
 
 						TASKDIALOGCONFIG Config =
 						{
@@ -2278,7 +8417,6 @@ static void Buddy_NetworkEvent(ScreenBuddy* Buddy)
 							.lpCallbackData = (LONG_PTR)Buddy,
 						};
 
-						Buddy_NextWait(Buddy);
 						SetTimer(Buddy->DialogWindow, BUDDY_FILE_TIMER, 50, NULL);
 						TaskDialogIndirect(&Config, NULL, NULL, NULL);
 						Buddy->ProgressWindow = NULL;
@@ -2298,8 +8436,11 @@ static void Buddy_NetworkEvent(ScreenBuddy* Buddy)
 					}
 					else
 					{
-						uint8_t Data[1] = { BUDDY_PACKET_FILE_REJECT };
-						DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, Data, sizeof(Data));
+						if (Buddy->NetOpen)
+						{
+							uint8_t Data[1] = { BUDDY_PACKET_FILE_REJECT };
+							DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, Data, sizeof(Data));
+						}
 					}
 				}
 				else if (Packet == BUDDY_PACKET_FILE_DATA)
@@ -2325,6 +8466,16 @@ static void Buddy_NetworkEvent(ScreenBuddy* Buddy)
 			}
 		}
 	}
+
+	Buddy_NetRingRelease(&Buddy->NetRing);
+	Buddy_NetUncork(Buddy);
+
+	// server answers first packet with PeerGone when it cannot forward it to sharer
+	if (Buddy->NetPeerGone && Buddy->State == BUDDY_STATE_CONNECTING)
+	{
+		Buddy->NetPeerGone = false;
+		Buddy_MeshFallback(Buddy);
+	}
 }
 
 //
@@ -2358,6 +8509,80 @@ static void Dialog_ShowShareKey(HWND Control, uint32_t Region, DerpKey* Key)
 	Edit_SetText(Control, Text);
 }
 
+// first run has share code as soon as any region is known, enables Share & generates code for it
+static void Dialog_SetFirstRegion(ScreenBuddy* Buddy, uint32_t Region)
+{
+	Buddy->DerpRegion = Region;
+	Buddy_SaveRegions(Buddy);
+
+	Button_Enable(GetDlgItem(Buddy->DialogWindow, BUDDY_ID_SHARE_BUTTON), TRUE);
+
+	SetActiveWindow(Buddy->DialogWindow);
+	SendDlgItemMessageW(Buddy->DialogWindow, BUDDY_ID_SHARE_NEW, BM_CLICK, 0, 0);
+	SetFocus(GetDlgItem(Buddy->DialogWindow, BUDDY_ID_SHARE_KEY));
+}
+
+// -share clicks Share once code is ready, -connect fills in code from file & clicks Connect
+static void Dialog_AutoStart(ScreenBuddy* Buddy, HWND Dialog)
+{
+	if (Buddy->State != BUDDY_STATE_INITIAL)
+	{
+		return;
+	}
+
+	if (Buddy->AutoSharePath[0] && Buddy->DerpRegion != 0)
+	{
+		PostMessageW(Dialog, WM_COMMAND, BUDDY_ID_SHARE_BUTTON, 0);
+	}
+	else if (Buddy->AutoConnectPath[0])
+	{
+		HANDLE File = CreateFileW(Buddy->AutoConnectPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (File != INVALID_HANDLE_VALUE)
+		{
+			char Code[2 + 32 * 2];
+			DWORD Read;
+			if (ReadFile(File, Code, sizeof(Code), &Read, NULL) && Read == sizeof(Code))
+			{
+				wchar_t Text[ARRAYSIZE(Code) + 1];
+				MultiByteToWideChar(CP_UTF8, 0, Code, sizeof(Code), Text, ARRAYSIZE(Code));
+				Text[ARRAYSIZE(Code)] = 0;
+
+				Edit_SetText(GetDlgItem(Dialog, BUDDY_ID_CONNECT_KEY), Text);
+				PostMessageW(Dialog, WM_COMMAND, BUDDY_ID_CONNECT_BUTTON, 0);
+			}
+			CloseHandle(File);
+		}
+		Buddy->AutoConnectPath[0] = 0;
+	}
+}
+
+// called when sharer is connected to relay, so viewer started after code file shows up finds it there
+static void Dialog_WriteShareCode(ScreenBuddy* Buddy)
+{
+	wchar_t ShareKey[128];
+	int ShareKeyLength = Edit_GetText(GetDlgItem(Buddy->DialogWindow, BUDDY_ID_SHARE_KEY), ShareKey, ARRAYSIZE(ShareKey));
+
+	char Code[128];
+	int CodeLength = WideCharToMultiByte(CP_UTF8, 0, ShareKey, ShareKeyLength, Code, sizeof(Code), NULL, NULL);
+
+	// written under temporary name first, code file never appears partially written
+	wchar_t TempPath[MAX_PATH + 4];
+	StrFormat(TempPath, L"%ls.tmp", Buddy->AutoSharePath);
+
+	HANDLE File = CreateFileW(TempPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (File != INVALID_HANDLE_VALUE)
+	{
+		DWORD Written;
+		BOOL Ok = WriteFile(File, Code, CodeLength, &Written, NULL);
+		CloseHandle(File);
+
+		if (Ok)
+		{
+			MoveFileExW(TempPath, Buddy->AutoSharePath, MOVEFILE_REPLACE_EXISTING);
+		}
+	}
+}
+
 static INT_PTR CALLBACK Buddy_DialogProc(HWND Dialog, UINT Message, WPARAM WParam, LPARAM LParam)
 {
 	ScreenBuddy* Buddy = (void*)GetWindowLongPtr(Dialog, GWLP_USERDATA);
@@ -2381,6 +8606,11 @@ static INT_PTR CALLBACK Buddy_DialogProc(HWND Dialog, UINT Message, WPARAM WPara
 		Dialog_SetTooltip(Dialog, BUDDY_ID_SHARE_NEW, "Generate New Code", TooltipWindow);
 		Dialog_SetTooltip(Dialog, BUDDY_ID_CONNECT_PASTE, "Paste", TooltipWindow);
 
+		HMENU Menu = GetSystemMenu(Dialog, FALSE);
+		AppendMenuW(Menu, MF_SEPARATOR, 0, NULL);
+		AppendMenuW(Menu, MF_STRING | MF_GRAYED, BUDDY_ID_CAPTURE_MONITOR, L"Share Next Monitor");
+		AppendMenuW(Menu, MF_STRING | MF_GRAYED, BUDDY_ID_CAPTURE_WINDOW, L"Share Window Below");
+
 		HWND ShareKey = GetDlgItem(Dialog, BUDDY_ID_SHARE_KEY);
 
 		if (Buddy->DerpRegion == 0)
@@ -2391,15 +8621,22 @@ static INT_PTR CALLBACK Buddy_DialogProc(HWND Dialog, UINT Message, WPARAM WPara
 			SetFocus(GetDlgItem(Dialog, BUDDY_ID_SHARE_COPY));
 
 			Buddy->DialogWindow = Dialog;
-			Buddy->DerpRegionThread = CreateThread(NULL, 0, &Buddy_GetBestDerpRegionThread, Buddy, 0, NULL);
-			Assert(Buddy->DerpRegionThread);
+			Buddy_StartRegionProbe(Buddy);
 		}
 		else
 		{
 			Dialog_ShowShareKey(ShareKey, Buddy->DerpRegion, &Buddy->MyPublicKey);
+
+			// cached ranking is used right away, but gets refreshed in background when too old
+			if (Buddy_GetUnixTime() - Buddy->DerpRankingTime >= BUDDY_PROBE_RANKING_TTL)
+			{
+				Buddy->DialogWindow = Dialog;
+				Buddy_StartRegionProbe(Buddy);
+			}
 		}
 		PostMessageW(ShareKey, EM_SETSEL, -1, 0);
 
+		Dialog_AutoStart(Buddy, Dialog);
 		return FALSE;
 
 	case WM_DPICHANGED:
@@ -2434,9 +8671,12 @@ static INT_PTR CALLBACK Buddy_DialogProc(HWND Dialog, UINT Message, WPARAM WPara
 				break;
 			}
 
-			uint8_t Data[1] = { BUDDY_PACKET_DISCONNECT };
-			DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, Data, sizeof(Data));
-			DerpNet_Close(&Buddy->Net);
+			if (Buddy->NetOpen)
+			{
+				uint8_t Data[1] = { BUDDY_PACKET_DISCONNECT };
+				DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, Data, sizeof(Data));
+			}
+			Buddy_CloseNet(Buddy);
 			Buddy_StopSharing(Buddy);
 		}
 
@@ -2473,6 +8713,14 @@ static INT_PTR CALLBACK Buddy_DialogProc(HWND Dialog, UINT Message, WPARAM WPara
 				}
 			}
 		}
+		else if (WParam == BUDDY_UDP_TIMER)
+		{
+			Buddy_UdpTimer(Buddy);
+		}
+		else if (WParam == BUDDY_NET_TIMER)
+		{
+			Buddy_NetTimer(Buddy);
+		}
 		return TRUE;
 
 	case WM_COMMAND:
@@ -2507,11 +8755,20 @@ static INT_PTR CALLBACK Buddy_DialogProc(HWND Dialog, UINT Message, WPARAM WPara
 			{
 				Edit_SetText(GetDlgItem(Dialog, BUDDY_ID_SHARE_KEY), L"...initializing...");
 
-				Buddy->DerpRegionThread = CreateThread(NULL, 0, &Buddy_GetBestDerpRegionThread, Buddy, 0, NULL);
-				Assert(Buddy->DerpRegionThread);
+				Buddy_StartRegionProbe(Buddy);
 			}
 			else
 			{
+				// new code always goes to currently best ranked region
+				if (Buddy->DerpRankingCount != 0 && Buddy->DerpRanking[0].Region != Buddy->DerpRegion)
+				{
+					Buddy->DerpRegion = Buddy->DerpRanking[0].Region;
+
+					wchar_t DerpRegionText[128];
+					StrFormat(DerpRegionText, L"%u", Buddy->DerpRegion);
+					WritePrivateProfileStringW(BUDDY_CONFIG, L"DerpRegion", DerpRegionText, Buddy->ConfigPath);
+				}
+
 				DerpNet_CreateNewKey(&Buddy->MyPrivateKey);
 				DerpNet_GetPublicKey(&Buddy->MyPrivateKey, &Buddy->MyPublicKey);
 
@@ -2554,15 +8811,17 @@ static INT_PTR CALLBACK Buddy_DialogProc(HWND Dialog, UINT Message, WPARAM WPara
 					Stop = MessageBoxW(Dialog, L"Do you want to stop sharing?", BUDDY_TITLE, MB_ICONQUESTION | MB_YESNO) == IDYES;
 					if (Stop)
 					{
-						uint8_t Data[1] = { BUDDY_PACKET_DISCONNECT };
-						DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, Data, sizeof(Data));
+						if (Buddy->NetOpen)
+						{
+							uint8_t Data[1] = { BUDDY_PACKET_DISCONNECT };
+							DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, Data, sizeof(Data));
+						}
 					}
 				}
 
 				if (Stop)
 				{
-					Buddy_CancelWait(Buddy);
-					DerpNet_Close(&Buddy->Net);
+					Buddy_CloseNet(Buddy);
 					Buddy_StopSharing(Buddy);
 					Buddy_UpdateState(Buddy, BUDDY_STATE_INITIAL);
 				}
@@ -2589,41 +8848,85 @@ static INT_PTR CALLBACK Buddy_DialogProc(HWND Dialog, UINT Message, WPARAM WPara
 
 	case BUDDY_WM_BEST_REGION:
 	{
+		Buddy_RegionProbe* Probe = (Buddy_RegionProbe*)LParam;
+
 		WaitForSingleObject(Buddy->DerpRegionThread, INFINITE);
 		CloseHandle(Buddy->DerpRegionThread);
+		Buddy->DerpRegionThread = NULL;
 
-		if (WParam == 0)
+		if (Probe->RankingCount == 0)
 		{
-			Edit_SetText(GetDlgItem(Dialog, BUDDY_ID_SHARE_KEY), L"Error!");
-			MessageBoxW(Buddy->DialogWindow, L"Cannot determine best DERP region! Please check your\ninternet connection and retry new code generation.", BUDDY_TITLE, MB_ICONERROR);
+			HeapFree(GetProcessHeap(), 0, Probe);
+
+			// failed background refresh keeps using cached ranking
+			if (Buddy->DerpRegion == 0)
+			{
+				Edit_SetText(GetDlgItem(Dialog, BUDDY_ID_SHARE_KEY), L"Error!");
+				MessageBoxW(Buddy->DialogWindow, L"Cannot determine best DERP region! Please check your\ninternet connection and retry new code generation.", BUDDY_TITLE, MB_ICONERROR);
+			}
 			return 0;
 		}
-		Buddy->DerpRegion = (uint32_t)WParam;
 
-		wchar_t DerpRegionText[128];
-		StrFormat(DerpRegionText, L"%u", Buddy->DerpRegion);
-		WritePrivateProfileStringW(BUDDY_CONFIG, L"DerpRegion", DerpRegionText, Buddy->ConfigPath);
+		Buddy_Metric(Buddy, "probe_map_ms", Probe->MapTime);
+		Buddy_Metric(Buddy, "probe_resolve_ms", Probe->ResolveTime);
+		Buddy_Metric(Buddy, "probe_tcp_ms", Probe->TcpTime);
+		Buddy_Metric(Buddy, "probe_derp_ms", Probe->DerpTime);
+
+		CopyMemory(&Buddy->DerpMap, &Probe->DerpMap, sizeof(Buddy->DerpMap));
+		CopyMemory(Buddy->DerpRanking, Probe->Ranking, Probe->RankingCount * sizeof(Probe->Ranking[0]));
+		Buddy->DerpRankingCount = Probe->RankingCount;
+		Buddy->DerpRankingTime = Buddy_GetUnixTime();
+		HeapFree(GetProcessHeap(), 0, Probe);
 
-		for (int RegionIndex = 0; RegionIndex < BUDDY_MAX_REGION_COUNT; RegionIndex++)
+		if (Buddy->DerpRegion == 0)
 		{
-			if (Buddy->DerpRegions[RegionIndex][0])
-			{
-				wchar_t DerpRegionName[128];
-				StrFormat(DerpRegionName, L"DerpRegion%d", RegionIndex);
-				WritePrivateProfileStringW(BUDDY_CONFIG, DerpRegionName, Buddy->DerpRegions[RegionIndex], Buddy->ConfigPath);
-			}
+			Dialog_SetFirstRegion(Buddy, Buddy->DerpRanking[0].Region);
+			Dialog_AutoStart(Buddy, Dialog);
+			return 0;
+		}
+
+		// refreshed ranking, on first run too, share code changes only if current region is not reachable anymore
+		bool Reachable = false;
+		for (uint32_t Index = 0; Index < Buddy->DerpRankingCount; Index++)
+		{
+			Reachable |= Buddy->DerpRanking[Index].Region == Buddy->DerpRegion;
+		}
+
+		if (!Reachable && (Buddy->State == BUDDY_STATE_INITIAL || Buddy->State == BUDDY_STATE_DISCONNECTED))
+		{
+			Buddy->DerpRegion = Buddy->DerpRanking[0].Region;
+			Dialog_ShowShareKey(GetDlgItem(Dialog, BUDDY_ID_SHARE_KEY), Buddy->DerpRegion, &Buddy->MyPublicKey);
 		}
+		Buddy_SaveRegions(Buddy);
+		return 0;
+	}
 
-		Button_Enable(GetDlgItem(Buddy->DialogWindow, BUDDY_ID_SHARE_BUTTON), TRUE);
+	case BUDDY_WM_FIRST_REGION:
+	{
+		// probe is freed only with BUDDY_WM_BEST_REGION that comes after this message, its DerpMap is not changing anymore
+		Buddy_RegionProbe* Probe = (Buddy_RegionProbe*)LParam;
+		Buddy_Metric(Buddy, "probe_first_ms", Probe->FirstTime);
 
-		SetActiveWindow(Buddy->DialogWindow);
-		SendDlgItemMessageW(Buddy->DialogWindow, BUDDY_ID_SHARE_NEW, BM_CLICK, 0, 0);
-		SetFocus(GetDlgItem(Buddy->DialogWindow, BUDDY_ID_SHARE_KEY));
+		if (Buddy->DerpRegion == 0)
+		{
+			CopyMemory(&Buddy->DerpMap, &Probe->DerpMap, sizeof(Buddy->DerpMap));
+			Dialog_SetFirstRegion(Buddy, (uint32_t)WParam);
+			Dialog_AutoStart(Buddy, Dialog);
+		}
 		return 0;
 	}
 
 	case BUDDY_WM_MEDIA_EVENT:
 	{
+		// events of encoder that was recreated for new size are ignored
+		IMFMediaEventGenerator* Generator = (IMFMediaEventGenerator*)LParam;
+		bool Current = Generator == Buddy->Generator;
+		IMFMediaEventGenerator_Release(Generator);
+		if (!Current)
+		{
+			return 0;
+		}
+
 		switch ((MediaEventType)WParam)
 		{
 		case METransformNeedInput:
@@ -2647,11 +8950,128 @@ static INT_PTR CALLBACK Buddy_DialogProc(HWND Dialog, UINT Message, WPARAM WPara
 		return 0;
 	}
 
+	case BUDDY_WM_NET_OPEN:
+	{
+		bool Connected = (bool)WParam;
+		Buddy->NetOpening = false;
+		Buddy->NetOpen = Connected;
+
+		// counters of new connection start from 0
+		Buddy->LastRecords = 0;
+		Buddy->LastSends = 0;
+
+		if (Buddy->State == BUDDY_STATE_SHARE_STARTED)
+		{
+			if (Connected)
+			{
+				Buddy_StartNetThread(&Buddy->NetRing);
+				if (Buddy->AutoSharePath[0])
+				{
+					Dialog_WriteShareCode(Buddy);
+				}
+			}
+			else
+			{
+				Buddy_StopSharing(Buddy);
+				Buddy_UpdateState(Buddy, BUDDY_STATE_INITIAL);
+				MessageBoxW(Dialog, L"Cannot connect to DerpNet server!", L"Error", MB_ICONERROR);
+			}
+		}
+		else if (Buddy->State == BUDDY_STATE_CONNECTING)
+		{
+			uint8_t Hello[1] = { BUDDY_PROTOCOL_VERSION };
+			if (Connected && DerpNet_Send(&Buddy->Net, &Buddy->RemoteKey, Hello, sizeof(Hello)))
+			{
+				Buddy_StartNetThread(&Buddy->NetRing);
+				if (Buddy->NetRegion != Buddy->PeerRegion)
+				{
+					SetTimer(Buddy->MainWindow, BUDDY_MESH_TIMER, BUDDY_MESH_TIMEOUT, NULL);
+				}
+			}
+			else
+			{
+				if (Connected)
+				{
+					DerpNet_Close(&Buddy->Net);
+					Buddy->NetOpen = false;
+				}
+				Buddy_Disconnect(Buddy, L"Cannot connect to DerpNet server!");
+			}
+		}
+		else if (Buddy->NetMigrating)
+		{
+			Buddy_OnMigrateOpen(Buddy, Connected);
+		}
+		else
+		{
+			// user cancelled while connection was being opened
+			if (Connected)
+			{
+				DerpNet_Close(&Buddy->Net);
+				Buddy->NetOpen = false;
+			}
+			Buddy_UpdateState(Buddy, Buddy->State);
+		}
+		return 0;
+	}
+
 	case BUDDY_WM_NET_EVENT:
-		Buddy_NetworkEvent(Buddy);
-		if (Buddy->State != BUDDY_STATE_INITIAL && Buddy->State != BUDDY_STATE_DISCONNECTED)
+		if (WParam == 0)
+		{
+			Buddy_NetworkEvent(Buddy);
+		}
+		else
+		{
+			Buddy_StripeEvent(Buddy, &Buddy->Stripes[WParam - 1]);
+		}
+		return 0;
+
+	case BUDDY_WM_PACE_EVENT:
+		if (Buddy->State == BUDDY_STATE_SHARING)
+		{
+			Buddy_PaceSend(Buddy, false);
+		}
+		return 0;
+
+	case BUDDY_WM_CAPTURE_CLOSED:
+		// captured window was closed or monitor disconnected, dialog's monitor is shared instead
+		if (Buddy->State == BUDDY_STATE_SHARING)
+		{
+			Buddy_SwitchCapture(Buddy, MonitorFromWindow(Buddy->DialogWindow, MONITOR_DEFAULTTOPRIMARY), NULL);
+		}
+		return 0;
+
+	case WM_SYSCOMMAND:
+		if ((WParam & 0xfff0) == BUDDY_ID_CAPTURE_MONITOR)
 		{
-			Buddy_NextWait(Buddy);
+			if (Buddy->State == BUDDY_STATE_SHARING)
+			{
+				Buddy_CaptureNextMonitor(Buddy);
+			}
+			return TRUE;
+		}
+		else if ((WParam & 0xfff0) == BUDDY_ID_CAPTURE_WINDOW)
+		{
+			if (Buddy->State == BUDDY_STATE_SHARING)
+			{
+				Buddy_CaptureWindowBelow(Buddy);
+			}
+			return TRUE;
+		}
+		break;
+
+	case BUDDY_WM_STRIPE_OPEN:
+		Buddy_StripeOpened(Buddy, &Buddy->Stripes[WParam - 1], (bool)LParam);
+		return 0;
+
+	case BUDDY_WM_UDP_EVENT:
+		if (Buddy->UdpStarted)
+		{
+			Buddy_UdpEvent(Buddy);
+			if (Buddy->UdpStarted)
+			{
+				SetThreadpoolWait(Buddy->UdpWaitCallback, Buddy->UdpEvent, NULL);
+			}
 		}
 		return 0;
 
@@ -11,6 +11,17 @@ where /Q cl.exe || (
   call "!VS!\VC\Auxiliary\Build\vcvarsall.bat" amd64 || exit /b 1
 )
 
+if "%1" equ "test" goto tests
+if "%1" equ "bench" goto tests
+if "%1" equ "simrun" (
+  call sim\run.cmd %2 %3 %4 %5
+  exit /b !errorlevel!
+)
+if "%1" equ "simbench" (
+  call sim\bench.cmd %2 %3
+  exit /b !errorlevel!
+)
+
 if "%1" equ "debug" (
   set CL=/MTd /Od /Zi /D_DEBUG /RTC1 /FdScreenBuddy.pdb /fsanitize=address
   set LINK=/DEBUG
@@ -24,4 +35,24 @@ fxc.exe /nologo /T ps_5_0 /E PS /O3 /WX /Ges /Fh ScreenBuddyPS.h /Vn ScreenBuddy
 
 rc.exe /nologo ScreenBuddy.rc || exit /b 1
 cl.exe /nologo /W3 /WX ScreenBuddy.c ScreenBuddy.res /link /INCREMENTAL:NO /MANIFEST:EMBED /MANIFESTINPUT:ScreenBuddy.manifest /SUBSYSTEM:WINDOWS /FIXED /merge:_RDATA=.rdata || exit /b 1
+if "%1" equ "derpsim" (
+  cl.exe /nologo /W3 /WX DerpSim.c /link /INCREMENTAL:NO /SUBSYSTEM:CONSOLE || exit /b 1
+  cl.exe /nologo /W3 /WX sim\NatSim.c /link /INCREMENTAL:NO /SUBSYSTEM:CONSOLE || exit /b 1
+  cl.exe /nologo /W3 /WX sim\SimReport.c /link /INCREMENTAL:NO /SUBSYSTEM:CONSOLE || exit /b 1
+  cl.exe /nologo /W3 /WX /DDERPNET_USE_PLAIN_HTTP=1 /FeScreenBuddyLocal.exe ScreenBuddy.c ScreenBuddy.res /link /INCREMENTAL:NO /MANIFEST:EMBED /MANIFESTINPUT:ScreenBuddy.manifest /SUBSYSTEM:WINDOWS /FIXED /merge:_RDATA=.rdata || exit /b 1
+)
+
 del *.obj *.res >nul
+exit /b 0
+
+:tests
+rem portable headers from external\ are tested without ScreenBuddy.c, same as tests\Makefile does with gcc or clang
+if not exist tests\out mkdir tests\out
+for %%f in (tests\*Test.c) do (
+  cl.exe /nologo /W3 /WX /O2 /Fotests\out\ /Fetests\out\%%~nf.exe %%f /link /INCREMENTAL:NO /SUBSYSTEM:CONSOLE || exit /b 1
+  if "%1" equ "bench" (
+    tests\out\%%~nf.exe bench || exit /b 1
+  ) else (
+    tests\out\%%~nf.exe || exit /b 1
+  )
+)
@@ -0,0 +1,331 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "JsonStream.h"
+
+// interface
+
+// DerpMap JSON to relay regions, without OS dependencies & without allocating memory
+//
+// extracts Regions[*].RegionID and Regions[*].Nodes[*] members in one pass over JSON text with JsonStream. RegionID
+// may come after Nodes array, so region is stored only when its object ends. Nodes without HostName are skipped,
+// regions outside of DERPMAP_MAX_REGION_COUNT are ignored and only first DERPMAP_MAX_NODE_COUNT nodes of region are
+// kept. IPv4 & IPv6 addresses are parsed here too, same text forms as inet_pton accepts - anything else leaves node
+// without that address, so it is resolved with DNS instead.
+
+enum
+{
+	DERPMAP_MAX_REGION_COUNT	= 256,
+	DERPMAP_MAX_NODE_COUNT		= 8,		// per region
+	DERPMAP_MAX_HOST_LENGTH		= 128,
+	DERPMAP_DERP_PORT			= 443,		// default when DERPPort is missing or 0
+	DERPMAP_STUN_PORT			= 3478,		// default when STUNPort is missing or 0, -1 means disabled
+};
+
+typedef struct
+{
+	char HostName[DERPMAP_MAX_HOST_LENGTH]; // UTF-8
+	uint8_t IPv4[4];
+	uint8_t IPv6[16];
+	bool HasIPv4;
+	bool HasIPv6;
+	bool StunOnly;
+	uint16_t DerpPort;
+	uint16_t StunPort; // 0 if disabled
+}
+DerpMapNode;
+
+typedef struct
+{
+	uint32_t NodeCount;
+	DerpMapNode Nodes[DERPMAP_MAX_NODE_COUNT];
+}
+DerpMapRegion;
+
+typedef struct
+{
+	DerpMapRegion* Regions; // DERPMAP_MAX_REGION_COUNT entries
+	bool FoundRegions;
+	bool InRegions;
+	bool InNodes;
+	int64_t RegionId;
+	DerpMapRegion Region;
+	DerpMapNode Node;
+}
+DerpMapParser;
+
+// Regions must have DERPMAP_MAX_REGION_COUNT zeroed entries, returns false for invalid JSON or without "Regions"
+// object - Regions can be partly filled then
+static bool DerpMap_Parse(DerpMapRegion* Regions, const char* Data, size_t Size);
+
+// JsonStream callback, UserData is DerpMapParser with only Regions set
+static bool DerpMap_OnJson(void* UserData, const JsonEvent* Event);
+
+// zero terminated text to address in network byte order, returns false for anything inet_pton would reject
+static bool DerpMap_ParseIPv4(const char* Text, uint8_t* Address);
+static bool DerpMap_ParseIPv6(const char* Text, uint8_t* Address);
+
+// implementation
+
+static int DerpMap__HexValue(char Ch)
+{
+	return Ch >= '0' && Ch <= '9' ? Ch - '0' : Ch >= 'a' && Ch <= 'f' ? Ch - 'a' + 10 : Ch >= 'A' && Ch <= 'F' ? Ch - 'A' + 10 : -1;
+}
+
+// dotted decimal, moves Text past it
+static bool DerpMap__ParseIPv4(const char** Text, uint8_t* Address)
+{
+	const char* Ptr = *Text;
+	for (uint32_t Part = 0; Part < 4; Part++)
+	{
+		if (Part != 0 && *Ptr++ != '.')
+		{
+			return false;
+		}
+
+		uint32_t Value = 0;
+		uint32_t Digits = 0;
+		while (*Ptr >= '0' && *Ptr <= '9' && Digits <= 3)
+		{
+			Value = Value * 10 + (*Ptr++ - '0');
+			Digits++;
+		}
+
+		// leading zero could be read as octal elsewhere
+		if (Digits == 0 || Digits > 3 || Value > 255 || (Digits > 1 && *(Ptr - Digits) == '0'))
+		{
+			return false;
+		}
+		Address[Part] = (uint8_t)Value;
+	}
+
+	*Text = Ptr;
+	return true;
+}
+
+static bool DerpMap_ParseIPv4(const char* Text, uint8_t* Address)
+{
+	uint8_t Result[4];
+	if (!DerpMap__ParseIPv4(&Text, Result) || *Text != 0)
+	{
+		return false;
+	}
+	memcpy(Address, Result, sizeof(Result));
+	return true;
+}
+
+static bool DerpMap_ParseIPv6(const char* Text, uint8_t* Address)
+{
+	uint8_t Bytes[16];
+	uint32_t Count = 0;
+	int32_t Gap = -1; // byte offset where "::" was
+
+	const char* Ptr = Text;
+	if (Ptr[0] == ':')
+	{
+		if (Ptr[1] != ':')
+		{
+			return false;
+		}
+		Ptr += 2;
+		Gap = 0;
+	}
+
+	while (*Ptr)
+	{
+		if (Count == 16)
+		{
+			return false;
+		}
+
+		const char* Group = Ptr;
+		uint32_t Value = 0;
+		uint32_t Digits = 0;
+		while (DerpMap__HexValue(*Ptr) >= 0 && Digits <= 4)
+		{
+			Value = Value * 16 + DerpMap__HexValue(*Ptr++);
+			Digits++;
+		}
+
+		// IPv4 in last 32 bits
+		if (*Ptr == '.')
+		{
+			Ptr = Group;
+			if (Count > 12 || !DerpMap__ParseIPv4(&Ptr, Bytes + Count) || *Ptr != 0)
+			{
+				return false;
+			}
+			Count += 4;
+			break;
+		}
+
+		if (Digits == 0 || Digits > 4)
+		{
+			return false;
+		}
+		Bytes[Count++] = (uint8_t)(Value >> 8);
+		Bytes[Count++] = (uint8_t)Value;
+
+		if (*Ptr == 0)
+		{
+			break;
+		}
+		if (*Ptr++ != ':')
+		{
+			return false;
+		}
+		if (*Ptr == ':')
+		{
+			if (Gap >= 0)
+			{
+				return false;
+			}
+			Gap = (int32_t)Count;
+			Ptr++;
+		}
+		else if (*Ptr == 0)
+		{
+			// single colon at end
+			return false;
+		}
+	}
+
+	// "::" stands for at least one zero group
+	if (Gap < 0 ? Count != 16 : Count > 14)
+	{
+		return false;
+	}
+
+	memset(Address, 0, 16);
+	if (Gap < 0)
+	{
+		memcpy(Address, Bytes, 16);
+	}
+	else
+	{
+		memcpy(Address, Bytes, Gap);
+		memcpy(Address + 16 - (Count - Gap), Bytes + Gap, Count - Gap);
+	}
+	return true;
+}
+
+// depth 1 = "Regions" object, 2 = region object, 3 = region members, 4 = node object, 5 = node members
+static bool DerpMap_OnJson(void* UserData, const JsonEvent* Event)
+{
+	DerpMapParser* Parser = UserData;
+
+	if (Event->Depth == 1)
+	{
+		if (JsonStream_IsKey(Event, "Regions") && Event->Type == JSON_EVENT_OBJECT_BEGIN)
+		{
+			Parser->FoundRegions = Parser->InRegions = true;
+		}
+		else if (Event->Type == JSON_EVENT_OBJECT_END)
+		{
+			Parser->InRegions = false;
+		}
+	}
+	else if (!Parser->InRegions)
+	{
+		// ignore everything outside of "Regions"
+	}
+	else if (Event->Depth == 2)
+	{
+		if (Event->Type == JSON_EVENT_OBJECT_BEGIN)
+		{
+			memset(&Parser->Region, 0, sizeof(Parser->Region));
+			Parser->RegionId = -1;
+		}
+		else if (Event->Type == JSON_EVENT_OBJECT_END && Parser->RegionId >= 0 && Parser->RegionId < DERPMAP_MAX_REGION_COUNT)
+		{
+			// RegionID may come after Nodes array, so region is stored only when its object ends
+			DerpMapRegion* Region = &Parser->Regions[Parser->RegionId];
+			for (uint32_t NodeIndex = 0; NodeIndex < Parser->Region.NodeCount && Region->NodeCount < DERPMAP_MAX_NODE_COUNT; NodeIndex++)
+			{
+				Region->Nodes[Region->NodeCount++] = Parser->Region.Nodes[NodeIndex];
+			}
+		}
+	}
+	else if (Event->Depth == 3)
+	{
+		if (JsonStream_IsKey(Event, "RegionID"))
+		{
+			JsonStream_GetInteger(Event, &Parser->RegionId);
+		}
+		else if (JsonStream_IsKey(Event, "Nodes"))
+		{
+			Parser->InNodes = Event->Type == JSON_EVENT_ARRAY_BEGIN;
+		}
+	}
+	else if (!Parser->InNodes)
+	{
+		// ignore other nested region members
+	}
+	else if (Event->Depth == 4)
+	{
+		DerpMapNode* Node = &Parser->Node;
+		if (Event->Type == JSON_EVENT_OBJECT_BEGIN)
+		{
+			memset(Node, 0, sizeof(*Node));
+			Node->DerpPort = DERPMAP_DERP_PORT;
+			Node->StunPort = DERPMAP_STUN_PORT;
+		}
+		else if (Event->Type == JSON_EVENT_OBJECT_END && Node->HostName[0] && Parser->Region.NodeCount < DERPMAP_MAX_NODE_COUNT)
+		{
+			Parser->Region.Nodes[Parser->Region.NodeCount++] = *Node;
+		}
+	}
+	else if (Event->Depth == 5)
+	{
+		DerpMapNode* Node = &Parser->Node;
+		char Address[64];
+		int64_t Port;
+
+		if (JsonStream_IsKey(Event, "HostName"))
+		{
+			if (!JsonStream_GetString(Event, Node->HostName, sizeof(Node->HostName)))
+			{
+				Node->HostName[0] = 0;
+			}
+		}
+		else if (JsonStream_IsKey(Event, "IPv4"))
+		{
+			Node->HasIPv4 = JsonStream_GetString(Event, Address, sizeof(Address)) && DerpMap_ParseIPv4(Address, Node->IPv4);
+		}
+		else if (JsonStream_IsKey(Event, "IPv6"))
+		{
+			Node->HasIPv6 = JsonStream_GetString(Event, Address, sizeof(Address)) && DerpMap_ParseIPv6(Address, Node->IPv6);
+		}
+		// 0 means default port, STUN port -1 means disabled
+		else if (JsonStream_IsKey(Event, "DERPPort"))
+		{
+			if (JsonStream_GetInteger(Event, &Port) && Port > 0 && Port < 65536)
+			{
+				Node->DerpPort = (uint16_t)Port;
+			}
+		}
+		else if (JsonStream_IsKey(Event, "STUNPort"))
+		{
+			if (JsonStream_GetInteger(Event, &Port))
+			{
+				Node->StunPort = Port > 0 && Port < 65536 ? (uint16_t)Port : Port == 0 ? DERPMAP_STUN_PORT : 0;
+			}
+		}
+		else if (JsonStream_IsKey(Event, "STUNOnly"))
+		{
+			Node->StunOnly = Event->Type == JSON_EVENT_TRUE;
+		}
+	}
+
+	return true;
+}
+
+static bool DerpMap_Parse(DerpMapRegion* Regions, const char* Data, size_t Size)
+{
+	DerpMapParser Parser = { .Regions = Regions };
+	return JsonStream_Parse(Data, Size, &DerpMap_OnJson, &Parser) && Parser.FoundRegions;
+}
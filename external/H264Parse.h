@@ -0,0 +1,400 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+// interface
+
+// H.264 Annex-B byte stream parser that does not allocate any memory and has no OS dependencies
+// stream is NAL units separated by 00 00 01 or 00 00 00 01 start codes, parser works in place on input buffer and
+// emulation prevention bytes are skipped while reading bits. Only what sender needs is decoded: frame type &
+// reference status from slice headers, stream parameters from SPS & PPS, and user data SEI with given UUID.
+
+// ordered by how much frame depends on other frames
+typedef enum
+{
+	H264_FRAME_UNKNOWN,
+	H264_FRAME_IDR,
+	H264_FRAME_I,
+	H264_FRAME_P,
+	H264_FRAME_B,
+}
+H264FrameType;
+
+typedef struct
+{
+	H264FrameType Type;
+	bool Reference;		// some slice has nal_ref_idc != 0, later frames may predict from it
+	uint32_t SliceCount;
+	uint32_t SliceOffset;	// start code of first slice
+
+	// last user_data_unregistered SEI NAL unit with UUID given to H264Parse_AccessUnit, still escaped
+	const uint8_t* UserData;
+	uint32_t UserDataSize;
+
+	// from SPS & PPS, if access unit has them
+	bool HasSps;
+	bool HasPps;
+	uint32_t Profile;
+	uint32_t Level;
+	uint32_t RefFrames;
+	uint32_t Width;
+	uint32_t Height;
+	bool Cabac;
+}
+H264Info;
+
+// next NAL unit without start code & trailing zeros, Data is advanced past it, returns false at end of stream
+static bool H264Parse_NextNal(const uint8_t** Data, const uint8_t* End, const uint8_t** Nal, uint32_t* NalSize);
+
+// parses one encoded frame, Uuid can be NULL when user data SEI is not needed
+// returns false if there are no slices in access unit
+static bool H264Parse_AccessUnit(const uint8_t* Data, uint32_t Size, const uint8_t Uuid[16], H264Info* Info);
+
+// implementation
+
+typedef struct
+{
+	const uint8_t* Data;
+	const uint8_t* End;
+	uint32_t Byte;
+	uint32_t Left;		// bits left in Byte
+	uint32_t Zeros;		// zero bytes before Data
+	bool Overflow;		// tried to read past end of NAL unit
+}
+H264Parse__BitReader;
+
+static void H264Parse__BitFill(H264Parse__BitReader* Reader)
+{
+	// 00 00 03 is escaped 00 00
+	if (Reader->Zeros >= 2 && Reader->Data != Reader->End && *Reader->Data == 3)
+	{
+		Reader->Data++;
+		Reader->Zeros = 0;
+	}
+
+	if (Reader->Data == Reader->End)
+	{
+		Reader->Byte = 0;
+		Reader->Overflow = true;
+	}
+	else
+	{
+		Reader->Byte = *Reader->Data++;
+		Reader->Zeros = Reader->Byte == 0 ? Reader->Zeros + 1 : 0;
+	}
+	Reader->Left = 8;
+}
+
+static uint32_t H264Parse__BitRead(H264Parse__BitReader* Reader, uint32_t Count)
+{
+	uint32_t Result = 0;
+	while (Count--)
+	{
+		if (Reader->Left == 0)
+		{
+			H264Parse__BitFill(Reader);
+		}
+		Reader->Left--;
+		Result = (Result << 1) | ((Reader->Byte >> Reader->Left) & 1);
+	}
+	return Result;
+}
+
+// ue(v), Exp-Golomb code
+static uint32_t H264Parse__BitReadUE(H264Parse__BitReader* Reader)
+{
+	uint32_t Zeros = 0;
+	while (H264Parse__BitRead(Reader, 1) == 0)
+	{
+		if (++Zeros == 32 || Reader->Overflow)
+		{
+			Reader->Overflow = true;
+			return 0;
+		}
+	}
+	return (1U << Zeros) - 1 + H264Parse__BitRead(Reader, Zeros);
+}
+
+// se(v)
+static int32_t H264Parse__BitReadSE(H264Parse__BitReader* Reader)
+{
+	uint32_t Value = H264Parse__BitReadUE(Reader);
+	return (Value & 1) ? (int32_t)((Value + 1) / 2) : -(int32_t)(Value / 2);
+}
+
+// first position of 00 00 00 or 00 00 01, or End, emulation prevention guarantees these never appear inside NAL unit
+static const uint8_t* H264Parse__Scan(const uint8_t* Ptr, const uint8_t* End)
+{
+	while (End - Ptr >= 3)
+	{
+		if (Ptr[2] > 1)
+		{
+			Ptr += 3;
+		}
+		else if (Ptr[1] != 0)
+		{
+			Ptr += 2;
+		}
+		else if (Ptr[0] != 0)
+		{
+			Ptr += 1;
+		}
+		else
+		{
+			return Ptr;
+		}
+	}
+	return End;
+}
+
+static bool H264Parse_NextNal(const uint8_t** Data, const uint8_t* End, const uint8_t** Nal, uint32_t* NalSize)
+{
+	const uint8_t* Ptr = *Data;
+	for (;;)
+	{
+		Ptr = H264Parse__Scan(Ptr, End);
+		if (Ptr == End)
+		{
+			return false;
+		}
+		if (Ptr[2] == 1)
+		{
+			break;
+		}
+		Ptr++;
+	}
+	Ptr += 3;
+
+	const uint8_t* Next = H264Parse__Scan(Ptr, End);
+
+	*Nal = Ptr;
+	*NalSize = (uint32_t)(Next - Ptr);
+	*Data = Next;
+	return true;
+}
+
+static void H264Parse__SkipScalingList(H264Parse__BitReader* Reader, uint32_t Size)
+{
+	int32_t Last = 8;
+	int32_t Next = 8;
+	for (uint32_t Index = 0; Index < Size && Next != 0; Index++)
+	{
+		// delta_scale is -128..127 in valid stream, broken one must not overflow int
+		int32_t Delta = H264Parse__BitReadSE(Reader) % 256;
+		Next = (Last + Delta + 256) % 256;
+		Last = Next == 0 ? Last : Next;
+	}
+}
+
+static void H264Parse__Sps(H264Parse__BitReader* Reader, H264Info* Info)
+{
+	uint32_t Profile = H264Parse__BitRead(Reader, 8);
+	H264Parse__BitRead(Reader, 8); // constraint flags
+	uint32_t Level = H264Parse__BitRead(Reader, 8);
+	H264Parse__BitReadUE(Reader); // seq_parameter_set_id
+
+	uint32_t ChromaFormat = 1;
+	bool SeparateColorPlanes = false;
+	if (Profile == 100 || Profile == 110 || Profile == 122 || Profile == 244 || Profile == 44 || Profile == 83 ||
+		Profile == 86 || Profile == 118 || Profile == 128 || Profile == 138 || Profile == 139 || Profile == 134 || Profile == 135)
+	{
+		ChromaFormat = H264Parse__BitReadUE(Reader);
+		if (ChromaFormat == 3)
+		{
+			SeparateColorPlanes = H264Parse__BitRead(Reader, 1);
+		}
+		H264Parse__BitReadUE(Reader); // bit_depth_luma_minus8
+		H264Parse__BitReadUE(Reader); // bit_depth_chroma_minus8
+		H264Parse__BitRead(Reader, 1); // qpprime_y_zero_transform_bypass_flag
+
+		if (H264Parse__BitRead(Reader, 1)) // seq_scaling_matrix_present_flag
+		{
+			for (uint32_t Index = 0; Index < (ChromaFormat != 3 ? 8U : 12U); Index++)
+			{
+				if (H264Parse__BitRead(Reader, 1))
+				{
+					H264Parse__SkipScalingList(Reader, Index < 6 ? 16 : 64);
+				}
+			}
+		}
+	}
+
+	H264Parse__BitReadUE(Reader); // log2_max_frame_num_minus4
+
+	uint32_t PocType = H264Parse__BitReadUE(Reader);
+	if (PocType == 0)
+	{
+		H264Parse__BitReadUE(Reader); // log2_max_pic_order_cnt_lsb_minus4
+	}
+	else if (PocType == 1)
+	{
+		H264Parse__BitRead(Reader, 1); // delta_pic_order_always_zero_flag
+		H264Parse__BitReadSE(Reader); // offset_for_non_ref_pic
+		H264Parse__BitReadSE(Reader); // offset_for_top_to_bottom_field
+		uint32_t CycleLength = H264Parse__BitReadUE(Reader);
+		for (uint32_t Index = 0; Index < CycleLength && !Reader->Overflow; Index++)
+		{
+			H264Parse__BitReadSE(Reader);
+		}
+	}
+
+	uint32_t RefFrames = H264Parse__BitReadUE(Reader);
+	H264Parse__BitRead(Reader, 1); // gaps_in_frame_num_value_allowed_flag
+	uint32_t WidthInMbs = H264Parse__BitReadUE(Reader) + 1;
+	uint32_t HeightInMapUnits = H264Parse__BitReadUE(Reader) + 1;
+	uint32_t FrameMbsOnly = H264Parse__BitRead(Reader, 1);
+	if (!FrameMbsOnly)
+	{
+		H264Parse__BitRead(Reader, 1); // mb_adaptive_frame_field_flag
+	}
+	H264Parse__BitRead(Reader, 1); // direct_8x8_inference_flag
+
+	uint32_t Width = WidthInMbs * 16;
+	uint32_t Height = HeightInMapUnits * 16 * (2 - FrameMbsOnly);
+
+	if (H264Parse__BitRead(Reader, 1)) // frame_cropping_flag
+	{
+		uint32_t CropLeft = H264Parse__BitReadUE(Reader);
+		uint32_t CropRight = H264Parse__BitReadUE(Reader);
+		uint32_t CropTop = H264Parse__BitReadUE(Reader);
+		uint32_t CropBottom = H264Parse__BitReadUE(Reader);
+
+		// crop is in chroma samples
+		uint32_t CropUnitX = 1;
+		uint32_t CropUnitY = 2 - FrameMbsOnly;
+		if (ChromaFormat != 0 && !SeparateColorPlanes)
+		{
+			CropUnitX *= ChromaFormat == 3 ? 1 : 2;
+			CropUnitY *= ChromaFormat == 1 ? 2 : 1;
+		}
+
+		// 64-bit so huge crop values from broken stream cannot wrap around
+		uint64_t CropX = ((uint64_t)CropLeft + CropRight) * CropUnitX;
+		uint64_t CropY = ((uint64_t)CropTop + CropBottom) * CropUnitY;
+		Width -= CropX < Width ? (uint32_t)CropX : Width;
+		Height -= CropY < Height ? (uint32_t)CropY : Height;
+	}
+
+	if (!Reader->Overflow)
+	{
+		Info->HasSps = true;
+		Info->Profile = Profile;
+		Info->Level = Level;
+		Info->RefFrames = RefFrames;
+		Info->Width = Width;
+		Info->Height = Height;
+	}
+}
+
+static void H264Parse__Pps(H264Parse__BitReader* Reader, H264Info* Info)
+{
+	H264Parse__BitReadUE(Reader); // pic_parameter_set_id
+	H264Parse__BitReadUE(Reader); // seq_parameter_set_id
+	uint32_t Cabac = H264Parse__BitRead(Reader, 1); // entropy_coding_mode_flag
+
+	if (!Reader->Overflow)
+	{
+		Info->HasPps = true;
+		Info->Cabac = Cabac;
+	}
+}
+
+static void H264Parse__Slice(H264Parse__BitReader* Reader, uint32_t NalType, uint32_t RefIdc, uint32_t Offset, H264Info* Info)
+{
+	H264Parse__BitReadUE(Reader); // first_mb_in_slice
+	uint32_t SliceType = H264Parse__BitReadUE(Reader) % 5;
+
+	if (Reader->Overflow)
+	{
+		return;
+	}
+
+	// SP & SI slices are treated as P & I
+	static const H264FrameType SliceTypes[5] = { H264_FRAME_P, H264_FRAME_B, H264_FRAME_I, H264_FRAME_P, H264_FRAME_I };
+	H264FrameType Type = NalType == 5 ? H264_FRAME_IDR : SliceTypes[SliceType];
+
+	if (Info->SliceCount++ == 0)
+	{
+		Info->SliceOffset = Offset;
+	}
+
+	// frame is as dependent as its most dependent slice
+	Info->Type = Type > Info->Type ? Type : Info->Type;
+	Info->Reference |= RefIdc != 0;
+}
+
+static bool H264Parse__IsUserData(const uint8_t* Nal, uint32_t NalSize, const uint8_t Uuid[16])
+{
+	// payloadType 5 is user_data_unregistered, payloadSize bytes are never escaped & UUID has no zeros
+	const uint8_t* End = Nal + NalSize;
+	if (NalSize < 2 || Nal[1] != 5)
+	{
+		return false;
+	}
+
+	const uint8_t* Ptr = Nal + 2;
+	while (Ptr != End && *Ptr == 255)
+	{
+		Ptr++;
+	}
+	if (End - Ptr < 1 + 16)
+	{
+		return false;
+	}
+	return memcmp(Ptr + 1, Uuid, 16) == 0;
+}
+
+static bool H264Parse_AccessUnit(const uint8_t* Data, uint32_t Size, const uint8_t Uuid[16], H264Info* Info)
+{
+	memset(Info, 0, sizeof(*Info));
+
+	const uint8_t* Start = Data;
+	const uint8_t* End = Data + Size;
+	const uint8_t* Nal;
+	uint32_t NalSize;
+	while (H264Parse_NextNal(&Data, End, &Nal, &NalSize))
+	{
+		if (NalSize == 0)
+		{
+			continue;
+		}
+
+		uint32_t RefIdc = (Nal[0] >> 5) & 3;
+		uint32_t NalType = Nal[0] & 0x1f;
+
+		H264Parse__BitReader Reader =
+		{
+			.Data = Nal + 1,
+			.End = Nal + NalSize,
+		};
+
+		switch (NalType)
+		{
+		case 1: // non-IDR slice
+		case 5: // IDR slice
+			H264Parse__Slice(&Reader, NalType, RefIdc, (uint32_t)(Nal - 3 - Start), Info);
+			break;
+
+		case 7:
+			H264Parse__Sps(&Reader, Info);
+			break;
+
+		case 8:
+			H264Parse__Pps(&Reader, Info);
+			break;
+
+		case 6:
+			if (Uuid && H264Parse__IsUserData(Nal, NalSize, Uuid))
+			{
+				Info->UserData = Nal;
+				Info->UserDataSize = NalSize;
+			}
+			break;
+		}
+	}
+
+	return Info->SliceCount != 0;
+}
@@ -0,0 +1,552 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+// interface
+
+// SAX style JSON parser that does not allocate any memory and has no OS dependencies
+// input is parsed in one pass, every value produces event for callback
+// strings are returned as pointers into input buffer, escapes are not decoded until JsonStream_GetString is called
+
+#ifndef JSON_STREAM_MAX_DEPTH
+#define JSON_STREAM_MAX_DEPTH 64
+#endif
+
+typedef enum
+{
+	JSON_EVENT_NULL,
+	JSON_EVENT_FALSE,
+	JSON_EVENT_TRUE,
+	JSON_EVENT_NUMBER,
+	JSON_EVENT_STRING,
+	JSON_EVENT_OBJECT_BEGIN,
+	JSON_EVENT_OBJECT_END,
+	JSON_EVENT_ARRAY_BEGIN,
+	JSON_EVENT_ARRAY_END,
+}
+JsonEventType;
+
+typedef struct
+{
+	JsonEventType Type;
+	// nesting level of value, 0 for root value, end event has same depth as its begin event
+	uint32_t Depth;
+	// member name when value is inside object, NULL when inside array or root value
+	const char* Key;
+	size_t KeyLength;
+	// raw text of number or string value (without quotes), NULL for other types
+	const char* Value;
+	size_t ValueLength;
+}
+JsonEvent;
+
+// return false to stop parsing
+typedef bool JsonStream_Callback(void* UserData, const JsonEvent* Event);
+
+// returns false on invalid JSON, or when callback stopped parsing
+static bool JsonStream_Parse(const char* Data, size_t Size, JsonStream_Callback* Callback, void* UserData);
+
+// checks if event is object member with specific name, Name must not contain characters that need escaping
+static bool JsonStream_IsKey(const JsonEvent* Event, const char* Name);
+
+// decodes escapes of string value to zero terminated UTF-8 text
+// returns false if Event is not string, or if Output is too small
+static bool JsonStream_GetString(const JsonEvent* Event, char* Output, size_t OutputSize);
+
+// returns false if Event is not number, or if number is not integer that fits in int64_t
+static bool JsonStream_GetInteger(const JsonEvent* Event, int64_t* Value);
+
+// implementation
+
+static bool JsonStream__IsSpace(char Ch)
+{
+	return Ch == ' ' || Ch == '\t' || Ch == '\n' || Ch == '\r';
+}
+
+static bool JsonStream__IsDigit(char Ch)
+{
+	return Ch >= '0' && Ch <= '9';
+}
+
+static int JsonStream__HexValue(char Ch)
+{
+	if (Ch >= '0' && Ch <= '9') return Ch - '0';
+	if (Ch >= 'a' && Ch <= 'f') return Ch - 'a' + 10;
+	if (Ch >= 'A' && Ch <= 'F') return Ch - 'A' + 10;
+	return -1;
+}
+
+static const char* JsonStream__SkipSpace(const char* Ptr, const char* End)
+{
+	while (Ptr != End && JsonStream__IsSpace(*Ptr))
+	{
+		Ptr++;
+	}
+	return Ptr;
+}
+
+// Ptr points after opening quote, returns pointer to closing quote or NULL on error
+static const char* JsonStream__ParseString(const char* Ptr, const char* End)
+{
+	while (Ptr != End)
+	{
+		unsigned char Ch = (unsigned char)*Ptr++;
+		if (Ch == '"')
+		{
+			return Ptr - 1;
+		}
+		else if (Ch < 0x20)
+		{
+			return NULL;
+		}
+		else if (Ch == '\\')
+		{
+			if (Ptr == End)
+			{
+				return NULL;
+			}
+
+			switch (*Ptr++)
+			{
+			case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+				break;
+
+			case 'u':
+				if (End - Ptr < 4)
+				{
+					return NULL;
+				}
+				for (int Index = 0; Index < 4; Index++)
+				{
+					if (JsonStream__HexValue(*Ptr++) < 0)
+					{
+						return NULL;
+					}
+				}
+				break;
+
+			default:
+				return NULL;
+			}
+		}
+	}
+	return NULL;
+}
+
+// returns pointer after last character of number, or NULL on error
+static const char* JsonStream__ParseNumber(const char* Ptr, const char* End)
+{
+	if (Ptr != End && *Ptr == '-')
+	{
+		Ptr++;
+	}
+
+	if (Ptr == End)
+	{
+		return NULL;
+	}
+	else if (*Ptr == '0')
+	{
+		Ptr++;
+	}
+	else if (JsonStream__IsDigit(*Ptr))
+	{
+		while (Ptr != End && JsonStream__IsDigit(*Ptr)) Ptr++;
+	}
+	else
+	{
+		return NULL;
+	}
+
+	if (Ptr != End && *Ptr == '.')
+	{
+		Ptr++;
+		if (Ptr == End || !JsonStream__IsDigit(*Ptr))
+		{
+			return NULL;
+		}
+		while (Ptr != End && JsonStream__IsDigit(*Ptr)) Ptr++;
+	}
+
+	if (Ptr != End && (*Ptr == 'e' || *Ptr == 'E'))
+	{
+		Ptr++;
+		if (Ptr != End && (*Ptr == '+' || *Ptr == '-'))
+		{
+			Ptr++;
+		}
+		if (Ptr == End || !JsonStream__IsDigit(*Ptr))
+		{
+			return NULL;
+		}
+		while (Ptr != End && JsonStream__IsDigit(*Ptr)) Ptr++;
+	}
+
+	return Ptr;
+}
+
+// parses object member name and colon after it, returns pointer to member value or NULL on error
+static const char* JsonStream__ParseKey(const char* Ptr, const char* End, const char** Key, size_t* KeyLength)
+{
+	Ptr = JsonStream__SkipSpace(Ptr, End);
+	if (Ptr == End || *Ptr != '"')
+	{
+		return NULL;
+	}
+
+	const char* KeyEnd = JsonStream__ParseString(Ptr + 1, End);
+	if (!KeyEnd)
+	{
+		return NULL;
+	}
+	*Key = Ptr + 1;
+	*KeyLength = (size_t)(KeyEnd - (Ptr + 1));
+
+	Ptr = JsonStream__SkipSpace(KeyEnd + 1, End);
+	if (Ptr == End || *Ptr != ':')
+	{
+		return NULL;
+	}
+	return Ptr + 1;
+}
+
+bool JsonStream_Parse(const char* Data, size_t Size, JsonStream_Callback* Callback, void* UserData)
+{
+	const char* Ptr = Data;
+	const char* End = Data + Size;
+
+	// container type and its member name for every nesting level
+	char Stack[JSON_STREAM_MAX_DEPTH];
+	const char* StackKey[JSON_STREAM_MAX_DEPTH];
+	size_t StackKeyLength[JSON_STREAM_MAX_DEPTH];
+	uint32_t Depth = 0;
+
+	const char* Key = NULL;
+	size_t KeyLength = 0;
+
+	for (;;)
+	{
+		Ptr = JsonStream__SkipSpace(Ptr, End);
+		if (Ptr == End)
+		{
+			return false;
+		}
+
+		JsonEvent Event =
+		{
+			.Depth = Depth,
+			.Key = Key,
+			.KeyLength = KeyLength,
+		};
+
+		char Ch = *Ptr;
+		bool Empty = false;
+
+		if (Ch == '{' || Ch == '[')
+		{
+			if (Depth == JSON_STREAM_MAX_DEPTH)
+			{
+				return false;
+			}
+
+			Event.Type = Ch == '{' ? JSON_EVENT_OBJECT_BEGIN : JSON_EVENT_ARRAY_BEGIN;
+			if (!Callback(UserData, &Event))
+			{
+				return false;
+			}
+
+			Stack[Depth] = Ch;
+			StackKey[Depth] = Key;
+			StackKeyLength[Depth] = KeyLength;
+			Depth++;
+
+			Ptr = JsonStream__SkipSpace(Ptr + 1, End);
+			if (Ptr != End && *Ptr == (Ch == '{' ? '}' : ']'))
+			{
+				Empty = true;
+			}
+			else if (Ch == '{')
+			{
+				Ptr = JsonStream__ParseKey(Ptr, End, &Key, &KeyLength);
+				if (!Ptr)
+				{
+					return false;
+				}
+				continue;
+			}
+			else
+			{
+				Key = NULL;
+				KeyLength = 0;
+				continue;
+			}
+		}
+		else if (Ch == '"')
+		{
+			const char* StringEnd = JsonStream__ParseString(Ptr + 1, End);
+			if (!StringEnd)
+			{
+				return false;
+			}
+
+			Event.Type = JSON_EVENT_STRING;
+			Event.Value = Ptr + 1;
+			Event.ValueLength = (size_t)(StringEnd - (Ptr + 1));
+			Ptr = StringEnd + 1;
+		}
+		else if (Ch == '-' || JsonStream__IsDigit(Ch))
+		{
+			const char* NumberEnd = JsonStream__ParseNumber(Ptr, End);
+			if (!NumberEnd)
+			{
+				return false;
+			}
+
+			Event.Type = JSON_EVENT_NUMBER;
+			Event.Value = Ptr;
+			Event.ValueLength = (size_t)(NumberEnd - Ptr);
+			Ptr = NumberEnd;
+		}
+		else if (End - Ptr >= 4 && memcmp(Ptr, "null", 4) == 0)
+		{
+			Event.Type = JSON_EVENT_NULL;
+			Ptr += 4;
+		}
+		else if (End - Ptr >= 4 && memcmp(Ptr, "true", 4) == 0)
+		{
+			Event.Type = JSON_EVENT_TRUE;
+			Ptr += 4;
+		}
+		else if (End - Ptr >= 5 && memcmp(Ptr, "false", 5) == 0)
+		{
+			Event.Type = JSON_EVENT_FALSE;
+			Ptr += 5;
+		}
+		else
+		{
+			return false;
+		}
+
+		if (!Empty && !Callback(UserData, &Event))
+		{
+			return false;
+		}
+
+		// after value there can be only separator to next value, or end of one or more containers
+		for (;;)
+		{
+			Ptr = JsonStream__SkipSpace(Ptr, End);
+			if (Depth == 0)
+			{
+				return Ptr == End;
+			}
+			if (Ptr == End)
+			{
+				return false;
+			}
+
+			char Container = Stack[Depth - 1];
+			if (*Ptr == ',')
+			{
+				if (Container == '{')
+				{
+					Ptr = JsonStream__ParseKey(Ptr + 1, End, &Key, &KeyLength);
+					if (!Ptr)
+					{
+						return false;
+					}
+				}
+				else
+				{
+					// array element after nested object must not get member name from inside that object
+					Key = NULL;
+					KeyLength = 0;
+					Ptr++;
+				}
+				break;
+			}
+			else if (*Ptr == (Container == '{' ? '}' : ']'))
+			{
+				Ptr++;
+				Depth--;
+
+				JsonEvent EndEvent =
+				{
+					.Type = Container == '{' ? JSON_EVENT_OBJECT_END : JSON_EVENT_ARRAY_END,
+					.Depth = Depth,
+					.Key = StackKey[Depth],
+					.KeyLength = StackKeyLength[Depth],
+				};
+				if (!Callback(UserData, &EndEvent))
+				{
+					return false;
+				}
+			}
+			else
+			{
+				return false;
+			}
+		}
+	}
+}
+
+bool JsonStream_IsKey(const JsonEvent* Event, const char* Name)
+{
+	size_t Length = strlen(Name);
+	return Event->Key && Event->KeyLength == Length && memcmp(Event->Key, Name, Length) == 0;
+}
+
+bool JsonStream_GetString(const JsonEvent* Event, char* Output, size_t OutputSize)
+{
+	if (Event->Type != JSON_EVENT_STRING || OutputSize == 0)
+	{
+		return false;
+	}
+
+	// value was already validated by parser, so escapes are well formed here
+	const char* Ptr = Event->Value;
+	const char* End = Event->Value + Event->ValueLength;
+	size_t Length = 0;
+
+	while (Ptr != End)
+	{
+		uint32_t Codepoint = (unsigned char)*Ptr++;
+		if (Codepoint == '\\')
+		{
+			char Escape = *Ptr++;
+			switch (Escape)
+			{
+			case 'b': Codepoint = '\b'; break;
+			case 'f': Codepoint = '\f'; break;
+			case 'n': Codepoint = '\n'; break;
+			case 'r': Codepoint = '\r'; break;
+			case 't': Codepoint = '\t'; break;
+			case 'u':
+				Codepoint = 0;
+				for (int Index = 0; Index < 4; Index++)
+				{
+					Codepoint = (Codepoint << 4) | (uint32_t)JsonStream__HexValue(*Ptr++);
+				}
+
+				// combine surrogate pair, unpaired surrogates are replaced with U+FFFD
+				if (Codepoint >= 0xd800 && Codepoint < 0xdc00 && End - Ptr >= 6 && Ptr[0] == '\\' && Ptr[1] == 'u')
+				{
+					uint32_t Low = 0;
+					for (int Index = 2; Index < 6; Index++)
+					{
+						Low = (Low << 4) | (uint32_t)JsonStream__HexValue(Ptr[Index]);
+					}
+					if (Low >= 0xdc00 && Low < 0xe000)
+					{
+						Codepoint = 0x10000 + ((Codepoint - 0xd800) << 10) + (Low - 0xdc00);
+						Ptr += 6;
+					}
+				}
+				if (Codepoint >= 0xd800 && Codepoint < 0xe000)
+				{
+					Codepoint = 0xfffd;
+				}
+				break;
+			default:
+				Codepoint = (unsigned char)Escape;
+				break;
+			}
+
+			uint8_t Utf8[4];
+			size_t Utf8Length;
+			if (Codepoint < 0x80)
+			{
+				Utf8[0] = (uint8_t)Codepoint;
+				Utf8Length = 1;
+			}
+			else if (Codepoint < 0x800)
+			{
+				Utf8[0] = (uint8_t)(0xc0 | (Codepoint >> 6));
+				Utf8[1] = (uint8_t)(0x80 | (Codepoint & 0x3f));
+				Utf8Length = 2;
+			}
+			else if (Codepoint < 0x10000)
+			{
+				Utf8[0] = (uint8_t)(0xe0 | (Codepoint >> 12));
+				Utf8[1] = (uint8_t)(0x80 | ((Codepoint >> 6) & 0x3f));
+				Utf8[2] = (uint8_t)(0x80 | (Codepoint & 0x3f));
+				Utf8Length = 3;
+			}
+			else
+			{
+				Utf8[0] = (uint8_t)(0xf0 | (Codepoint >> 18));
+				Utf8[1] = (uint8_t)(0x80 | ((Codepoint >> 12) & 0x3f));
+				Utf8[2] = (uint8_t)(0x80 | ((Codepoint >> 6) & 0x3f));
+				Utf8[3] = (uint8_t)(0x80 | (Codepoint & 0x3f));
+				Utf8Length = 4;
+			}
+
+			if (OutputSize - Length <= Utf8Length)
+			{
+				return false;
+			}
+			memcpy(Output + Length, Utf8, Utf8Length);
+			Length += Utf8Length;
+		}
+		else
+		{
+			if (OutputSize - Length <= 1)
+			{
+				return false;
+			}
+			Output[Length++] = (char)Codepoint;
+		}
+	}
+
+	Output[Length] = 0;
+	return true;
+}
+
+bool JsonStream_GetInteger(const JsonEvent* Event, int64_t* Value)
+{
+	if (Event->Type != JSON_EVENT_NUMBER)
+	{
+		return false;
+	}
+
+	const char* Ptr = Event->Value;
+	const char* End = Event->Value + Event->ValueLength;
+
+	bool Negative = *Ptr == '-';
+	if (Negative)
+	{
+		Ptr++;
+	}
+
+	// accumulate as negative number, so INT64_MIN can be represented
+	int64_t Result = 0;
+	while (Ptr != End)
+	{
+		if (!JsonStream__IsDigit(*Ptr))
+		{
+			return false;
+		}
+
+		int Digit = *Ptr++ - '0';
+		if (Result < (INT64_MIN + Digit) / 10)
+		{
+			return false;
+		}
+		Result = Result * 10 - Digit;
+	}
+
+	if (!Negative)
+	{
+		if (Result == INT64_MIN)
+		{
+			return false;
+		}
+		Result = -Result;
+	}
+
+	*Value = Result;
+	return true;
+}
@@ -0,0 +1,814 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#	define PIXEL_SIMD 1
+#	if defined(_MSC_VER)
+#		include <intrin.h>
+#	else
+#		include <immintrin.h>
+#		include <cpuid.h>
+#	endif
+#else
+#	define PIXEL_SIMD 0
+#endif
+
+// interface
+
+// software pixel kernels without OS dependencies, only scale filter allocates memory (with malloc)
+//
+// BGRA -> NV12 conversion for encoder input. Matrix is BT.709 or BT.601, with limited or full range. Chroma is
+// sited like MPEG-2 & H.264 default - horizontally on even luma column with [1 2 1] filter, vertically between two
+// rows. SSE4.1 & AVX2 kernels pick up C kernel for row ends that do not fill whole SIMD block.
+//
+// NV12 -> BGRA conversion and separable Lanczos-3 or Catmull-Rom downscaler for presenting decoded frames. Each
+// source row is filtered horizontally into 16-bit row, vertical filter combines Taps of such rows into BGRA. Filter
+// weights are precomputed per output pixel, with taps that fall outside of image folded into edge pixels.
+//
+// math is integer only, SIMD kernels give exactly same results as C kernels. SIMD kernels exist only on x86,
+// PIXEL_SIMD tells if they are compiled.
+
+enum
+{
+	PIXEL_LUMA_BITS			= 14,						// fixed point RGB to YUV coefficients
+	PIXEL_CHROMA_BITS		= PIXEL_LUMA_BITS + 3,		// chroma sums 8 weighted pixels
+	PIXEL_YUV_BITS			= 13,						// fixed point YUV to RGB coefficients
+	PIXEL_SCALE_BITS		= 14,						// fixed point filter weights
+	PIXEL_ROW_SHIFT			= 8,						// horizontally filtered rows keep 6 fractional bits
+
+	PIXEL_FILTER_BICUBIC	= 0,
+	PIXEL_FILTER_LANCZOS	= 1,
+};
+
+typedef struct
+{
+	// B, G, R, 0 repeated twice, for pmaddwd
+	int16_t Y[8];
+	int16_t U[8];
+	int16_t V[8];
+	int32_t YOffset;	// includes rounding
+	int32_t UVOffset;
+}
+PixelColorMatrix;
+
+typedef struct
+{
+	// (U, V) coefficient pairs, for pmaddwd
+	int16_t R[2];
+	int16_t G[2];
+	int16_t B[2];
+	int16_t Y[2];	// scale & rounding
+	int16_t YOffset;
+}
+PixelYuvMatrix;
+
+typedef struct
+{
+	uint32_t Taps;		// multiple of 4
+	int32_t* Start;		// first source pixel for each output pixel
+	int16_t* Weights;	// Taps weights for each output pixel
+}
+PixelScaleFilter;
+
+// converts two BGRA rows to two luma rows & one interleaved UV row, Width in pixels
+// for odd frame height last row is passed as both Row0 & Row1
+typedef void Pixel_ConvertRowsProc(const PixelColorMatrix* Matrix, const uint8_t* Row0, const uint8_t* Row1, uint8_t* Y0, uint8_t* Y1, uint8_t* UV, uint32_t Width);
+
+// converts luma row to BGRA, Near & Far are interleaved UV rows closest to luma row and next closest one
+// Width must be multiple of 8, and chroma rows must have 8 readable bytes past Width + 2
+typedef void Pixel_YuvToBgraProc(const PixelYuvMatrix* Matrix, const uint8_t* Y, const uint8_t* Near, const uint8_t* Far, uint8_t* Bgra, uint32_t Width);
+
+// filters BGRA row horizontally, Width must be multiple of 2 and Filter created with padded size of at least that
+// Bgra must have Filter->Taps readable pixels from every Start
+typedef void Pixel_ScaleRowProc(const PixelScaleFilter* Filter, const uint8_t* Bgra, int16_t* Output, uint32_t Width);
+
+// combines Taps horizontally filtered rows with Weights into BGRA row, Width must be multiple of 4
+typedef void Pixel_ScaleColumnsProc(const int16_t** Rows, const int16_t* Weights, uint32_t Taps, uint8_t* Bgra, uint32_t Width);
+
+static void Pixel_GetColorMatrix(PixelColorMatrix* Matrix, bool Bt709, bool FullRange);
+static void Pixel_GetYuvMatrix(PixelYuvMatrix* Matrix, bool Bt709, bool FullRange);
+
+// Kind is PIXEL_FILTER_*, output is only downscaled or copied, PaddedSize >= OutputSize outputs have weights
+// returns false when out of memory
+static bool Pixel_CreateScaleFilter(PixelScaleFilter* Filter, int Kind, uint32_t InputSize, uint32_t OutputSize, uint32_t PaddedSize);
+static void Pixel_ReleaseScaleFilter(PixelScaleFilter* Filter);
+
+static void Pixel_ConvertRowsC(const PixelColorMatrix* Matrix, const uint8_t* Row0, const uint8_t* Row1, uint8_t* Y0, uint8_t* Y1, uint8_t* UV, uint32_t Width);
+static void Pixel_YuvToBgraC(const PixelYuvMatrix* Matrix, const uint8_t* Y, const uint8_t* Near, const uint8_t* Far, uint8_t* Bgra, uint32_t Width);
+static void Pixel_ScaleRowC(const PixelScaleFilter* Filter, const uint8_t* Bgra, int16_t* Output, uint32_t Width);
+static void Pixel_ScaleColumnsC(const int16_t** Rows, const int16_t* Weights, uint32_t Taps, uint8_t* Bgra, uint32_t Width);
+#if PIXEL_SIMD
+static void Pixel_ConvertRowsSSE4(const PixelColorMatrix* Matrix, const uint8_t* Row0, const uint8_t* Row1, uint8_t* Y0, uint8_t* Y1, uint8_t* UV, uint32_t Width);
+static void Pixel_ConvertRowsAVX2(const PixelColorMatrix* Matrix, const uint8_t* Row0, const uint8_t* Row1, uint8_t* Y0, uint8_t* Y1, uint8_t* UV, uint32_t Width);
+static void Pixel_YuvToBgraSSE4(const PixelYuvMatrix* Matrix, const uint8_t* Y, const uint8_t* Near, const uint8_t* Far, uint8_t* Bgra, uint32_t Width);
+static void Pixel_ScaleRowSSE4(const PixelScaleFilter* Filter, const uint8_t* Bgra, int16_t* Output, uint32_t Width);
+static void Pixel_ScaleColumnsSSE4(const int16_t** Rows, const int16_t* Weights, uint32_t Taps, uint8_t* Bgra, uint32_t Width);
+#endif
+
+// what current CPU & OS support, both false without PIXEL_SIMD
+static void Pixel_GetCpuFeatures(bool* HasSse41, bool* HasAvx2);
+
+// fastest kernels for current CPU
+static Pixel_ConvertRowsProc* Pixel_GetConvertRows(void);
+static Pixel_YuvToBgraProc* Pixel_GetYuvToBgra(void);
+static Pixel_ScaleRowProc* Pixel_GetScaleRow(void);
+static Pixel_ScaleColumnsProc* Pixel_GetScaleColumns(void);
+
+// implementation
+
+// gcc & clang compile SIMD kernels for their instruction set without it being enabled for whole file
+#if defined(_MSC_VER)
+#	define PIXEL__TARGET(Target)
+#else
+#	define PIXEL__TARGET(Target) __attribute__((target(Target)))
+#endif
+
+static int16_t Pixel__RoundCoefficient(double Value)
+{
+	return (int16_t)(Value < 0 ? Value - 0.5 : Value + 0.5);
+}
+
+static void Pixel_GetColorMatrix(PixelColorMatrix* Matrix, bool Bt709, bool FullRange)
+{
+	double Kr = Bt709 ? 0.2126 : 0.299;
+	double Kb = Bt709 ? 0.0722 : 0.114;
+
+	double YScale = FullRange ? 1.0 : 219.0 / 255.0;
+	double CScale = FullRange ? 1.0 : 224.0 / 255.0;
+
+	double One = (double)(1 << PIXEL_LUMA_BITS);
+
+	// coefficients are adjusted so white has exact luma, and gray has no chroma
+	int16_t YR = Pixel__RoundCoefficient(One * YScale * Kr);
+	int16_t YB = Pixel__RoundCoefficient(One * YScale * Kb);
+	int16_t YG = (int16_t)(Pixel__RoundCoefficient(One * YScale) - YR - YB);
+
+	int16_t UR = Pixel__RoundCoefficient(-One * CScale * Kr / (2.0 * (1.0 - Kb)));
+	int16_t UB = Pixel__RoundCoefficient(One * CScale * 0.5);
+	int16_t UG = (int16_t)(-UR - UB);
+
+	int16_t VR = Pixel__RoundCoefficient(One * CScale * 0.5);
+	int16_t VB = Pixel__RoundCoefficient(-One * CScale * Kb / (2.0 * (1.0 - Kr)));
+	int16_t VG = (int16_t)(-VR - VB);
+
+	for (uint32_t Index = 0; Index < 8; Index += 4)
+	{
+		Matrix->Y[Index + 0] = YB; Matrix->Y[Index + 1] = YG; Matrix->Y[Index + 2] = YR; Matrix->Y[Index + 3] = 0;
+		Matrix->U[Index + 0] = UB; Matrix->U[Index + 1] = UG; Matrix->U[Index + 2] = UR; Matrix->U[Index + 3] = 0;
+		Matrix->V[Index + 0] = VB; Matrix->V[Index + 1] = VG; Matrix->V[Index + 2] = VR; Matrix->V[Index + 3] = 0;
+	}
+
+	Matrix->YOffset = ((FullRange ? 0 : 16) << PIXEL_LUMA_BITS) + (1 << (PIXEL_LUMA_BITS - 1));
+	Matrix->UVOffset = (128 << PIXEL_CHROMA_BITS) + (1 << (PIXEL_CHROMA_BITS - 1));
+}
+
+static uint8_t Pixel__ClampByte(int32_t Value)
+{
+	return (uint8_t)(Value < 0 ? 0 : Value > 255 ? 255 : Value);
+}
+
+// converts pixels starting from even column Start, to end of row
+static void Pixel__ConvertRowsScalar(const PixelColorMatrix* Matrix, const uint8_t* Row0, const uint8_t* Row1, uint8_t* Y0, uint8_t* Y1, uint8_t* UV, uint32_t Start, uint32_t Width)
+{
+	const int16_t* CY = Matrix->Y;
+	const int16_t* CU = Matrix->U;
+	const int16_t* CV = Matrix->V;
+
+	for (uint32_t X = Start; X < Width; X++)
+	{
+		const uint8_t* P0 = Row0 + X * 4;
+		const uint8_t* P1 = Row1 + X * 4;
+		Y0[X] = Pixel__ClampByte((CY[0] * P0[0] + CY[1] * P0[1] + CY[2] * P0[2] + Matrix->YOffset) >> PIXEL_LUMA_BITS);
+		Y1[X] = Pixel__ClampByte((CY[0] * P1[0] + CY[1] * P1[1] + CY[2] * P1[2] + Matrix->YOffset) >> PIXEL_LUMA_BITS);
+	}
+
+	for (uint32_t X = Start; X < Width; X += 2)
+	{
+		// left & right columns are repeated at row ends
+		uint32_t Left = (X == 0 ? 0 : X - 1) * 4;
+		uint32_t Center = X * 4;
+		uint32_t Right = (X + 1 < Width ? X + 1 : Width - 1) * 4;
+
+		int32_t Sum[3];
+		for (uint32_t Channel = 0; Channel < 3; Channel++)
+		{
+			Sum[Channel] = Row0[Left + Channel] + Row1[Left + Channel]
+				+ 2 * (Row0[Center + Channel] + Row1[Center + Channel])
+				+ Row0[Right + Channel] + Row1[Right + Channel];
+		}
+
+		UV[X + 0] = Pixel__ClampByte((CU[0] * Sum[0] + CU[1] * Sum[1] + CU[2] * Sum[2] + Matrix->UVOffset) >> PIXEL_CHROMA_BITS);
+		UV[X + 1] = Pixel__ClampByte((CV[0] * Sum[0] + CV[1] * Sum[1] + CV[2] * Sum[2] + Matrix->UVOffset) >> PIXEL_CHROMA_BITS);
+	}
+}
+
+static void Pixel_ConvertRowsC(const PixelColorMatrix* Matrix, const uint8_t* Row0, const uint8_t* Row1, uint8_t* Y0, uint8_t* Y1, uint8_t* UV, uint32_t Width)
+{
+	Pixel__ConvertRowsScalar(Matrix, Row0, Row1, Y0, Y1, UV, 0, Width);
+}
+
+static void Pixel_GetYuvMatrix(PixelYuvMatrix* Matrix, bool Bt709, bool FullRange)
+{
+	double Kr = Bt709 ? 0.2126 : 0.299;
+	double Kb = Bt709 ? 0.0722 : 0.114;
+	double Kg = 1.0 - Kr - Kb;
+
+	double YScale = FullRange ? 1.0 : 255.0 / 219.0;
+	double CScale = FullRange ? 1.0 : 255.0 / 224.0;
+
+	double One = (double)(1 << PIXEL_YUV_BITS);
+
+	Matrix->R[0] = 0;
+	Matrix->R[1] = Pixel__RoundCoefficient(One * CScale * 2.0 * (1.0 - Kr));
+	Matrix->G[0] = Pixel__RoundCoefficient(-One * CScale * 2.0 * (1.0 - Kb) * Kb / Kg);
+	Matrix->G[1] = Pixel__RoundCoefficient(-One * CScale * 2.0 * (1.0 - Kr) * Kr / Kg);
+	Matrix->B[0] = Pixel__RoundCoefficient(One * CScale * 2.0 * (1.0 - Kb));
+	Matrix->B[1] = 0;
+	Matrix->Y[0] = Pixel__RoundCoefficient(One * YScale);
+	Matrix->Y[1] = (int16_t)(1 << (PIXEL_YUV_BITS - 1));
+	Matrix->YOffset = (int16_t)(FullRange ? 0 : 16);
+}
+
+static double Pixel__ScaleKernel(int Kind, double X)
+{
+	X = X < 0 ? -X : X;
+	if (Kind == PIXEL_FILTER_LANCZOS)
+	{
+		if (X < 1e-8)
+		{
+			return 1.0;
+		}
+		if (X >= 3.0)
+		{
+			return 0.0;
+		}
+		double Pi = 3.14159265358979323846;
+		return 3.0 * sin(Pi * X) * sin(Pi * X / 3.0) / (Pi * Pi * X * X);
+	}
+	else
+	{
+		// Catmull-Rom
+		if (X < 1.0)
+		{
+			return (1.5 * X - 2.5) * X * X + 1.0;
+		}
+		if (X < 2.0)
+		{
+			return ((-0.5 * X + 2.5) * X - 4.0) * X + 2.0;
+		}
+		return 0.0;
+	}
+}
+
+static void Pixel_ReleaseScaleFilter(PixelScaleFilter* Filter)
+{
+	free(Filter->Start);
+	free(Filter->Weights);
+	Filter->Start = NULL;
+	Filter->Weights = NULL;
+}
+
+static bool Pixel_CreateScaleFilter(PixelScaleFilter* Filter, int Kind, uint32_t InputSize, uint32_t OutputSize, uint32_t PaddedSize)
+{
+	double Scale = (double)InputSize / OutputSize;
+	double Radius = (Kind == PIXEL_FILTER_LANCZOS ? 3.0 : 2.0) * Scale;
+
+	uint32_t Taps = InputSize == OutputSize ? 4 : ((uint32_t)ceil(Radius) * 2 + 4) & ~3;
+
+	Filter->Taps = Taps;
+	Filter->Start = calloc(PaddedSize, sizeof(*Filter->Start));
+	Filter->Weights = calloc((size_t)PaddedSize * Taps, sizeof(*Filter->Weights));
+
+	int32_t LastStart = InputSize > Taps ? (int32_t)(InputSize - Taps) : 0;
+	double One = (double)(1 << PIXEL_SCALE_BITS);
+	double* Values = malloc(Taps * sizeof(*Values));
+	if (!Filter->Start || !Filter->Weights || !Values)
+	{
+		free(Values);
+		Pixel_ReleaseScaleFilter(Filter);
+		return false;
+	}
+
+	for (uint32_t Index = 0; Index < OutputSize; Index++)
+	{
+		int16_t* Weights = Filter->Weights + Index * Taps;
+
+		if (InputSize == OutputSize)
+		{
+			Filter->Start[Index] = Index < (uint32_t)LastStart ? (int32_t)Index : LastStart;
+			Weights[Index - Filter->Start[Index]] = (int16_t)(1 << PIXEL_SCALE_BITS);
+			continue;
+		}
+
+		double Center = (Index + 0.5) * Scale - 0.5;
+		int32_t First = (int32_t)floor(Center - Radius) + 1;
+		int32_t Start = First < 0 ? 0 : First > LastStart ? LastStart : First;
+		Filter->Start[Index] = Start;
+
+		double Total = 0;
+		memset(Values, 0, Taps * sizeof(*Values));
+		for (uint32_t Tap = 0; Tap < Taps; Tap++)
+		{
+			int32_t Source = First + (int32_t)Tap;
+			double Value = Pixel__ScaleKernel(Kind, (Source - Center) / Scale);
+
+			// fold taps outside of image into edge pixels
+			int32_t Clamped = Source < 0 ? 0 : Source >= (int32_t)InputSize ? (int32_t)InputSize - 1 : Source;
+			Values[Clamped - Start] += Value;
+			Total += Value;
+		}
+
+		// weights must sum exactly to one, rounding error goes into largest weight
+		int32_t Sum = 0;
+		uint32_t Largest = 0;
+		for (uint32_t Tap = 0; Tap < Taps; Tap++)
+		{
+			Weights[Tap] = Pixel__RoundCoefficient(One * Values[Tap] / Total);
+			Sum += Weights[Tap];
+			Largest = Weights[Tap] > Weights[Largest] ? Tap : Largest;
+		}
+		Weights[Largest] = (int16_t)(Weights[Largest] + (1 << PIXEL_SCALE_BITS) - Sum);
+	}
+
+	free(Values);
+	return true;
+}
+
+// chroma is sited on even column & between two rows, Near row gets 3/4 weight
+static void Pixel_YuvToBgraC(const PixelYuvMatrix* Matrix, const uint8_t* Y, const uint8_t* Near, const uint8_t* Far, uint8_t* Bgra, uint32_t Width)
+{
+	for (uint32_t X = 0; X < Width; X++)
+	{
+		uint32_t Pair = X / 2 * 2;
+
+		int32_t U = (3 * Near[Pair + 0] + Far[Pair + 0] + 2) >> 2;
+		int32_t V = (3 * Near[Pair + 1] + Far[Pair + 1] + 2) >> 2;
+		if (X & 1)
+		{
+			U = (U + ((3 * Near[Pair + 2] + Far[Pair + 2] + 2) >> 2) + 1) >> 1;
+			V = (V + ((3 * Near[Pair + 3] + Far[Pair + 3] + 2) >> 2) + 1) >> 1;
+		}
+		U -= 128;
+		V -= 128;
+
+		int32_t L = (Y[X] - Matrix->YOffset) * Matrix->Y[0] + Matrix->Y[1];
+		int32_t R = (L + U * Matrix->R[0] + V * Matrix->R[1]) >> PIXEL_YUV_BITS;
+		int32_t G = (L + U * Matrix->G[0] + V * Matrix->G[1]) >> PIXEL_YUV_BITS;
+		int32_t B = (L + U * Matrix->B[0] + V * Matrix->B[1]) >> PIXEL_YUV_BITS;
+
+		Bgra[X * 4 + 0] = Pixel__ClampByte(B);
+		Bgra[X * 4 + 1] = Pixel__ClampByte(G);
+		Bgra[X * 4 + 2] = Pixel__ClampByte(R);
+		Bgra[X * 4 + 3] = 255;
+	}
+}
+
+static void Pixel_ScaleRowC(const PixelScaleFilter* Filter, const uint8_t* Bgra, int16_t* Output, uint32_t Width)
+{
+	for (uint32_t X = 0; X < Width; X++)
+	{
+		const uint8_t* Source = Bgra + Filter->Start[X] * 4;
+		const int16_t* Weights = Filter->Weights + X * Filter->Taps;
+
+		int32_t Sum[4] = { 0, 0, 0, 0 };
+		for (uint32_t Tap = 0; Tap < Filter->Taps; Tap++)
+		{
+			for (uint32_t Channel = 0; Channel < 4; Channel++)
+			{
+				Sum[Channel] += Weights[Tap] * Source[Tap * 4 + Channel];
+			}
+		}
+		for (uint32_t Channel = 0; Channel < 4; Channel++)
+		{
+			Output[X * 4 + Channel] = (int16_t)((Sum[Channel] + (1 << (PIXEL_ROW_SHIFT - 1))) >> PIXEL_ROW_SHIFT);
+		}
+	}
+}
+
+static void Pixel_ScaleColumnsC(const int16_t** Rows, const int16_t* Weights, uint32_t Taps, uint8_t* Bgra, uint32_t Width)
+{
+	const uint32_t Shift = 2 * PIXEL_SCALE_BITS - PIXEL_ROW_SHIFT;
+
+	for (uint32_t X = 0; X < Width * 4; X++)
+	{
+		int32_t Sum = 0;
+		for (uint32_t Tap = 0; Tap < Taps; Tap++)
+		{
+			Sum += Weights[Tap] * Rows[Tap][X];
+		}
+		Bgra[X] = (X & 3) == 3 ? (uint8_t)255 : Pixel__ClampByte((Sum + (1 << (Shift - 1))) >> Shift);
+	}
+}
+
+#if PIXEL_SIMD
+
+// 16 pixels per iteration, each 128-bit register with 16-bit channels holds two pixels - even one in low half,
+// odd one in high half. Chroma for pair K needs odd pixel of previous pair, which alignr brings in
+PIXEL__TARGET("sse4.1") static void Pixel_ConvertRowsSSE4(const PixelColorMatrix* Matrix, const uint8_t* Row0, const uint8_t* Row1, uint8_t* Y0, uint8_t* Y1, uint8_t* UV, uint32_t Width)
+{
+	const __m128i Zero = _mm_setzero_si128();
+	const __m128i CY = _mm_loadu_si128((const __m128i*)Matrix->Y);
+	const __m128i CU = _mm_loadu_si128((const __m128i*)Matrix->U);
+	const __m128i CV = _mm_loadu_si128((const __m128i*)Matrix->V);
+	const __m128i YOffset = _mm_set1_epi32(Matrix->YOffset);
+	const __m128i UVOffset = _mm_set1_epi32(Matrix->UVOffset);
+
+	__m128i Previous = Zero;
+
+	uint32_t X = 0;
+	for (; X + 16 <= Width; X += 16)
+	{
+		__m128i Pairs[8];
+		__m128i Luma0[4];
+		__m128i Luma1[4];
+		for (uint32_t Index = 0; Index < 4; Index++)
+		{
+			__m128i A = _mm_loadu_si128((const __m128i*)(Row0 + (X + Index * 4) * 4));
+			__m128i B = _mm_loadu_si128((const __m128i*)(Row1 + (X + Index * 4) * 4));
+
+			__m128i ALo = _mm_unpacklo_epi8(A, Zero);
+			__m128i AHi = _mm_unpackhi_epi8(A, Zero);
+			__m128i BLo = _mm_unpacklo_epi8(B, Zero);
+			__m128i BHi = _mm_unpackhi_epi8(B, Zero);
+
+			Luma0[Index] = _mm_hadd_epi32(_mm_madd_epi16(ALo, CY), _mm_madd_epi16(AHi, CY));
+			Luma1[Index] = _mm_hadd_epi32(_mm_madd_epi16(BLo, CY), _mm_madd_epi16(BHi, CY));
+
+			Pairs[Index * 2 + 0] = _mm_add_epi16(ALo, BLo);
+			Pairs[Index * 2 + 1] = _mm_add_epi16(AHi, BHi);
+		}
+
+		for (uint32_t Index = 0; Index < 4; Index++)
+		{
+			Luma0[Index] = _mm_srai_epi32(_mm_add_epi32(Luma0[Index], YOffset), PIXEL_LUMA_BITS);
+			Luma1[Index] = _mm_srai_epi32(_mm_add_epi32(Luma1[Index], YOffset), PIXEL_LUMA_BITS);
+		}
+		_mm_storeu_si128((__m128i*)(Y0 + X), _mm_packus_epi16(_mm_packs_epi32(Luma0[0], Luma0[1]), _mm_packs_epi32(Luma0[2], Luma0[3])));
+		_mm_storeu_si128((__m128i*)(Y1 + X), _mm_packus_epi16(_mm_packs_epi32(Luma1[0], Luma1[1]), _mm_packs_epi32(Luma1[2], Luma1[3])));
+
+		if (X == 0)
+		{
+			// left edge repeats first pixel
+			Previous = _mm_unpacklo_epi64(Pairs[0], Pairs[0]);
+		}
+
+		__m128i SumU[8];
+		__m128i SumV[8];
+		for (uint32_t Index = 0; Index < 8; Index++)
+		{
+			// [odd of previous pair, even] + [even, odd] = left + 2 * center + right, in two halves
+			__m128i Taps = _mm_add_epi16(_mm_alignr_epi8(Pairs[Index], Previous, 8), Pairs[Index]);
+			SumU[Index] = _mm_madd_epi16(Taps, CU);
+			SumV[Index] = _mm_madd_epi16(Taps, CV);
+			Previous = Pairs[Index];
+		}
+
+		__m128i U0 = _mm_hadd_epi32(_mm_hadd_epi32(SumU[0], SumU[1]), _mm_hadd_epi32(SumU[2], SumU[3]));
+		__m128i U1 = _mm_hadd_epi32(_mm_hadd_epi32(SumU[4], SumU[5]), _mm_hadd_epi32(SumU[6], SumU[7]));
+		__m128i V0 = _mm_hadd_epi32(_mm_hadd_epi32(SumV[0], SumV[1]), _mm_hadd_epi32(SumV[2], SumV[3]));
+		__m128i V1 = _mm_hadd_epi32(_mm_hadd_epi32(SumV[4], SumV[5]), _mm_hadd_epi32(SumV[6], SumV[7]));
+
+		U0 = _mm_srai_epi32(_mm_add_epi32(U0, UVOffset), PIXEL_CHROMA_BITS);
+		U1 = _mm_srai_epi32(_mm_add_epi32(U1, UVOffset), PIXEL_CHROMA_BITS);
+		V0 = _mm_srai_epi32(_mm_add_epi32(V0, UVOffset), PIXEL_CHROMA_BITS);
+		V1 = _mm_srai_epi32(_mm_add_epi32(V1, UVOffset), PIXEL_CHROMA_BITS);
+
+		__m128i U = _mm_packs_epi32(U0, U1);
+		__m128i V = _mm_packs_epi32(V0, V1);
+		_mm_storeu_si128((__m128i*)(UV + X), _mm_packus_epi16(_mm_unpacklo_epi16(U, V), _mm_unpackhi_epi16(U, V)));
+	}
+
+	Pixel__ConvertRowsScalar(Matrix, Row0, Row1, Y0, Y1, UV, X, Width);
+}
+
+// same as SSE4 kernel for 32 pixels per iteration, 128-bit lanes hold pairs out of order and final permute fixes it
+PIXEL__TARGET("avx2") static void Pixel_ConvertRowsAVX2(const PixelColorMatrix* Matrix, const uint8_t* Row0, const uint8_t* Row1, uint8_t* Y0, uint8_t* Y1, uint8_t* UV, uint32_t Width)
+{
+	const __m256i Zero = _mm256_setzero_si256();
+	const __m256i CY = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)Matrix->Y));
+	const __m256i CU = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)Matrix->U));
+	const __m256i CV = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)Matrix->V));
+	const __m256i YOffset = _mm256_set1_epi32(Matrix->YOffset);
+	const __m256i UVOffset = _mm256_set1_epi32(Matrix->UVOffset);
+	const __m256i Order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+	__m256i Previous = Zero;
+
+	uint32_t X = 0;
+	for (; X + 32 <= Width; X += 32)
+	{
+		__m256i Luma0[4];
+		__m256i Luma1[4];
+		__m256i SumU[4];
+		__m256i SumV[4];
+		for (uint32_t Index = 0; Index < 4; Index++)
+		{
+			__m256i A = _mm256_loadu_si256((const __m256i*)(Row0 + (X + Index * 8) * 4));
+			__m256i B = _mm256_loadu_si256((const __m256i*)(Row1 + (X + Index * 8) * 4));
+
+			// pixels [0 1 | 4 5] and [2 3 | 6 7]
+			__m256i ALo = _mm256_unpacklo_epi8(A, Zero);
+			__m256i AHi = _mm256_unpackhi_epi8(A, Zero);
+			__m256i BLo = _mm256_unpacklo_epi8(B, Zero);
+			__m256i BHi = _mm256_unpackhi_epi8(B, Zero);
+
+			Luma0[Index] = _mm256_hadd_epi32(_mm256_madd_epi16(ALo, CY), _mm256_madd_epi16(AHi, CY));
+			Luma1[Index] = _mm256_hadd_epi32(_mm256_madd_epi16(BLo, CY), _mm256_madd_epi16(BHi, CY));
+
+			__m256i PairsLo = _mm256_add_epi16(ALo, BLo);
+			__m256i PairsHi = _mm256_add_epi16(AHi, BHi);
+
+			if (X == 0 && Index == 0)
+			{
+				Previous = _mm256_permute4x64_epi64(PairsLo, 0);
+			}
+
+			// odd pixels 7 of previous block & 3, then 1 & 5
+			__m256i OddLo = _mm256_alignr_epi8(PairsLo, _mm256_permute2x128_si256(PairsHi, Previous, 0x03), 8);
+			__m256i OddHi = _mm256_alignr_epi8(PairsHi, PairsLo, 8);
+			Previous = PairsHi;
+
+			__m256i TapsLo = _mm256_add_epi16(OddLo, PairsLo);
+			__m256i TapsHi = _mm256_add_epi16(OddHi, PairsHi);
+
+			// chroma [0 1 | 2 3] parts
+			SumU[Index] = _mm256_hadd_epi32(_mm256_madd_epi16(TapsLo, CU), _mm256_madd_epi16(TapsHi, CU));
+			SumV[Index] = _mm256_hadd_epi32(_mm256_madd_epi16(TapsLo, CV), _mm256_madd_epi16(TapsHi, CV));
+		}
+
+		for (uint32_t Index = 0; Index < 4; Index++)
+		{
+			Luma0[Index] = _mm256_srai_epi32(_mm256_add_epi32(Luma0[Index], YOffset), PIXEL_LUMA_BITS);
+			Luma1[Index] = _mm256_srai_epi32(_mm256_add_epi32(Luma1[Index], YOffset), PIXEL_LUMA_BITS);
+		}
+
+		__m256i PackedY0 = _mm256_packus_epi16(_mm256_packs_epi32(Luma0[0], Luma0[1]), _mm256_packs_epi32(Luma0[2], Luma0[3]));
+		__m256i PackedY1 = _mm256_packus_epi16(_mm256_packs_epi32(Luma1[0], Luma1[1]), _mm256_packs_epi32(Luma1[2], Luma1[3]));
+		_mm256_storeu_si256((__m256i*)(Y0 + X), _mm256_permutevar8x32_epi32(PackedY0, Order));
+		_mm256_storeu_si256((__m256i*)(Y1 + X), _mm256_permutevar8x32_epi32(PackedY1, Order));
+
+		// chroma [0 1 4 5 | 2 3 6 7] and [8 9 12 13 | 10 11 14 15]
+		__m256i U0 = _mm256_hadd_epi32(SumU[0], SumU[1]);
+		__m256i U1 = _mm256_hadd_epi32(SumU[2], SumU[3]);
+		__m256i V0 = _mm256_hadd_epi32(SumV[0], SumV[1]);
+		__m256i V1 = _mm256_hadd_epi32(SumV[2], SumV[3]);
+
+		U0 = _mm256_srai_epi32(_mm256_add_epi32(U0, UVOffset), PIXEL_CHROMA_BITS);
+		U1 = _mm256_srai_epi32(_mm256_add_epi32(U1, UVOffset), PIXEL_CHROMA_BITS);
+		V0 = _mm256_srai_epi32(_mm256_add_epi32(V0, UVOffset), PIXEL_CHROMA_BITS);
+		V1 = _mm256_srai_epi32(_mm256_add_epi32(V1, UVOffset), PIXEL_CHROMA_BITS);
+
+		__m256i U = _mm256_packs_epi32(U0, U1);
+		__m256i V = _mm256_packs_epi32(V0, V1);
+		__m256i PackedUV = _mm256_packus_epi16(_mm256_unpacklo_epi16(U, V), _mm256_unpackhi_epi16(U, V));
+		_mm256_storeu_si256((__m256i*)(UV + X), _mm256_permutevar8x32_epi32(PackedUV, Order));
+	}
+
+	Pixel__ConvertRowsScalar(Matrix, Row0, Row1, Y0, Y1, UV, X, Width);
+}
+
+static int32_t Pixel__Pair16(const int16_t* Pair)
+{
+	return (uint16_t)Pair[0] | ((uint32_t)(uint16_t)Pair[1] << 16);
+}
+
+// processes 8 pixels at once, rows must be padded
+PIXEL__TARGET("sse4.1") static void Pixel_YuvToBgraSSE4(const PixelYuvMatrix* Matrix, const uint8_t* Y, const uint8_t* Near, const uint8_t* Far, uint8_t* Bgra, uint32_t Width)
+{
+	const __m128i CoefR = _mm_set1_epi32(Pixel__Pair16(Matrix->R));
+	const __m128i CoefG = _mm_set1_epi32(Pixel__Pair16(Matrix->G));
+	const __m128i CoefB = _mm_set1_epi32(Pixel__Pair16(Matrix->B));
+	const __m128i CoefY = _mm_set1_epi32(Pixel__Pair16(Matrix->Y));
+	const __m128i Offset = _mm_set1_epi16(Matrix->YOffset);
+	const __m128i Half = _mm_set1_epi16(128);
+	const __m128i Two = _mm_set1_epi16(2);
+	const __m128i One = _mm_set1_epi16(1);
+	const __m128i Alpha = _mm_set1_epi16(255);
+
+	for (uint32_t X = 0; X < Width; X += 8)
+	{
+		__m128i L = _mm_sub_epi16(_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(Y + X))), Offset);
+
+		// 4 chroma pairs for even pixels, and next 4 for interpolating odd pixels
+		__m128i N0 = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(Near + X)));
+		__m128i N1 = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(Near + X + 2)));
+		__m128i F0 = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(Far + X)));
+		__m128i F1 = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(Far + X + 2)));
+
+		__m128i C0 = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(_mm_add_epi16(N0, _mm_add_epi16(N0, N0)), F0), Two), 2);
+		__m128i C1 = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(_mm_add_epi16(N1, _mm_add_epi16(N1, N1)), F1), Two), 2);
+
+		__m128i Even = _mm_sub_epi16(C0, Half);
+		__m128i Odd = _mm_sub_epi16(_mm_avg_epu16(C0, C1), Half);
+
+		__m128i Chroma[2] = { _mm_unpacklo_epi32(Even, Odd), _mm_unpackhi_epi32(Even, Odd) };
+		__m128i Luma[2] = { _mm_unpacklo_epi16(L, One), _mm_unpackhi_epi16(L, One) };
+
+		__m128i R[2], G[2], B[2];
+		for (int Half4 = 0; Half4 < 2; Half4++)
+		{
+			__m128i Base = _mm_madd_epi16(Luma[Half4], CoefY);
+			R[Half4] = _mm_srai_epi32(_mm_add_epi32(Base, _mm_madd_epi16(Chroma[Half4], CoefR)), PIXEL_YUV_BITS);
+			G[Half4] = _mm_srai_epi32(_mm_add_epi32(Base, _mm_madd_epi16(Chroma[Half4], CoefG)), PIXEL_YUV_BITS);
+			B[Half4] = _mm_srai_epi32(_mm_add_epi32(Base, _mm_madd_epi16(Chroma[Half4], CoefB)), PIXEL_YUV_BITS);
+		}
+
+		__m128i R16 = _mm_packs_epi32(R[0], R[1]);
+		__m128i G16 = _mm_packs_epi32(G[0], G[1]);
+		__m128i B16 = _mm_packs_epi32(B[0], B[1]);
+
+		__m128i BG0 = _mm_unpacklo_epi16(B16, G16);
+		__m128i BG1 = _mm_unpackhi_epi16(B16, G16);
+		__m128i RA0 = _mm_unpacklo_epi16(R16, Alpha);
+		__m128i RA1 = _mm_unpackhi_epi16(R16, Alpha);
+
+		__m128i Out0 = _mm_packus_epi16(_mm_unpacklo_epi32(BG0, RA0), _mm_unpackhi_epi32(BG0, RA0));
+		__m128i Out1 = _mm_packus_epi16(_mm_unpacklo_epi32(BG1, RA1), _mm_unpackhi_epi32(BG1, RA1));
+
+		_mm_storeu_si128((__m128i*)(Bgra + X * 4 + 0), Out0);
+		_mm_storeu_si128((__m128i*)(Bgra + X * 4 + 16), Out1);
+	}
+}
+
+// processes 2 pixels at once, output must be padded
+PIXEL__TARGET("sse4.1") static void Pixel_ScaleRowSSE4(const PixelScaleFilter* Filter, const uint8_t* Bgra, int16_t* Output, uint32_t Width)
+{
+	// interleaves two neighbor pixels as (first, second) pairs of each channel
+	const __m128i Interleave0 = _mm_setr_epi8(0, -1, 4, -1, 1, -1, 5, -1, 2, -1, 6, -1, 3, -1, 7, -1);
+	const __m128i Interleave1 = _mm_setr_epi8(8, -1, 12, -1, 9, -1, 13, -1, 10, -1, 14, -1, 11, -1, 15, -1);
+	const __m128i Round = _mm_set1_epi32(1 << (PIXEL_ROW_SHIFT - 1));
+	const uint32_t Taps = Filter->Taps;
+
+	for (uint32_t X = 0; X < Width; X += 2)
+	{
+		__m128i Sum[2];
+		for (uint32_t Index = 0; Index < 2; Index++)
+		{
+			const uint8_t* Source = Bgra + Filter->Start[X + Index] * 4;
+			const int16_t* Weights = Filter->Weights + (X + Index) * Taps;
+
+			__m128i Acc = _mm_setzero_si128();
+			for (uint32_t Tap = 0; Tap < Taps; Tap += 4)
+			{
+				__m128i Pixels = _mm_loadu_si128((const __m128i*)(Source + Tap * 4));
+				__m128i Weight = _mm_loadl_epi64((const __m128i*)(Weights + Tap));
+
+				Acc = _mm_add_epi32(Acc, _mm_madd_epi16(_mm_shuffle_epi8(Pixels, Interleave0), _mm_shuffle_epi32(Weight, _MM_SHUFFLE(0, 0, 0, 0))));
+				Acc = _mm_add_epi32(Acc, _mm_madd_epi16(_mm_shuffle_epi8(Pixels, Interleave1), _mm_shuffle_epi32(Weight, _MM_SHUFFLE(1, 1, 1, 1))));
+			}
+			Sum[Index] = _mm_srai_epi32(_mm_add_epi32(Acc, Round), PIXEL_ROW_SHIFT);
+		}
+		_mm_storeu_si128((__m128i*)(Output + X * 4), _mm_packs_epi32(Sum[0], Sum[1]));
+	}
+}
+
+// processes 4 pixels at once, rows must be padded
+PIXEL__TARGET("sse4.1") static void Pixel_ScaleColumnsSSE4(const int16_t** Rows, const int16_t* Weights, uint32_t Taps, uint8_t* Bgra, uint32_t Width)
+{
+	const uint32_t Shift = 2 * PIXEL_SCALE_BITS - PIXEL_ROW_SHIFT;
+	const __m128i Round = _mm_set1_epi32(1 << (Shift - 1));
+	const __m128i Alpha = _mm_set1_epi32((int)0xff000000);
+
+	for (uint32_t X = 0; X < Width * 4; X += 16)
+	{
+		__m128i Acc0 = _mm_setzero_si128();
+		__m128i Acc1 = _mm_setzero_si128();
+		__m128i Acc2 = _mm_setzero_si128();
+		__m128i Acc3 = _mm_setzero_si128();
+
+		for (uint32_t Tap = 0; Tap < Taps; Tap += 2)
+		{
+			__m128i Weight = _mm_set1_epi32(Pixel__Pair16(Weights + Tap));
+
+			__m128i A0 = _mm_loadu_si128((const __m128i*)(Rows[Tap + 0] + X + 0));
+			__m128i B0 = _mm_loadu_si128((const __m128i*)(Rows[Tap + 1] + X + 0));
+			__m128i A1 = _mm_loadu_si128((const __m128i*)(Rows[Tap + 0] + X + 8));
+			__m128i B1 = _mm_loadu_si128((const __m128i*)(Rows[Tap + 1] + X + 8));
+
+			Acc0 = _mm_add_epi32(Acc0, _mm_madd_epi16(_mm_unpacklo_epi16(A0, B0), Weight));
+			Acc1 = _mm_add_epi32(Acc1, _mm_madd_epi16(_mm_unpackhi_epi16(A0, B0), Weight));
+			Acc2 = _mm_add_epi32(Acc2, _mm_madd_epi16(_mm_unpacklo_epi16(A1, B1), Weight));
+			Acc3 = _mm_add_epi32(Acc3, _mm_madd_epi16(_mm_unpackhi_epi16(A1, B1), Weight));
+		}
+
+		Acc0 = _mm_srai_epi32(_mm_add_epi32(Acc0, Round), Shift);
+		Acc1 = _mm_srai_epi32(_mm_add_epi32(Acc1, Round), Shift);
+		Acc2 = _mm_srai_epi32(_mm_add_epi32(Acc2, Round), Shift);
+		Acc3 = _mm_srai_epi32(_mm_add_epi32(Acc3, Round), Shift);
+
+		__m128i Out = _mm_packus_epi16(_mm_packs_epi32(Acc0, Acc1), _mm_packs_epi32(Acc2, Acc3));
+		_mm_storeu_si128((__m128i*)(Bgra + X), _mm_or_si128(Out, Alpha));
+	}
+}
+
+#endif
+
+#if PIXEL_SIMD
+
+static void Pixel__Cpuid(int Info[4], int Leaf)
+{
+#if defined(_MSC_VER)
+	__cpuidex(Info, Leaf, 0);
+#else
+	unsigned int Regs[4];
+	__cpuid_count(Leaf, 0, Regs[0], Regs[1], Regs[2], Regs[3]);
+	for (int Index = 0; Index < 4; Index++)
+	{
+		Info[Index] = (int)Regs[Index];
+	}
+#endif
+}
+
+static uint64_t Pixel__Xgetbv(void)
+{
+#if defined(_MSC_VER)
+	return _xgetbv(0);
+#else
+	uint32_t Low, High;
+	__asm__("xgetbv" : "=a"(Low), "=d"(High) : "c"(0));
+	return ((uint64_t)High << 32) | Low;
+#endif
+}
+
+static void Pixel_GetCpuFeatures(bool* HasSse41, bool* HasAvx2)
+{
+	int Info[4];
+	Pixel__Cpuid(Info, 0);
+	int MaxLeaf = Info[0];
+
+	Pixel__Cpuid(Info, 1);
+	*HasSse41 = (Info[2] & (1 << 19)) != 0;
+
+	// AVX needs OS support for saving YMM registers
+	bool HasAvx = (Info[2] & (1 << 27)) && (Info[2] & (1 << 28)) && (Pixel__Xgetbv() & 6) == 6;
+	*HasAvx2 = false;
+	if (HasAvx && MaxLeaf >= 7)
+	{
+		Pixel__Cpuid(Info, 7);
+		*HasAvx2 = (Info[1] & (1 << 5)) != 0;
+	}
+}
+
+#else
+
+static void Pixel_GetCpuFeatures(bool* HasSse41, bool* HasAvx2)
+{
+	*HasSse41 = false;
+	*HasAvx2 = false;
+}
+
+#endif
+
+static Pixel_ConvertRowsProc* Pixel_GetConvertRows(void)
+{
+#if PIXEL_SIMD
+	bool HasSse41, HasAvx2;
+	Pixel_GetCpuFeatures(&HasSse41, &HasAvx2);
+
+	return HasAvx2 ? &Pixel_ConvertRowsAVX2 : HasSse41 ? &Pixel_ConvertRowsSSE4 : &Pixel_ConvertRowsC;
+#else
+	return &Pixel_ConvertRowsC;
+#endif
+}
+
+static Pixel_YuvToBgraProc* Pixel_GetYuvToBgra(void)
+{
+#if PIXEL_SIMD
+	bool HasSse41, HasAvx2;
+	Pixel_GetCpuFeatures(&HasSse41, &HasAvx2);
+
+	return HasSse41 ? &Pixel_YuvToBgraSSE4 : &Pixel_YuvToBgraC;
+#else
+	return &Pixel_YuvToBgraC;
+#endif
+}
+
+static Pixel_ScaleRowProc* Pixel_GetScaleRow(void)
+{
+#if PIXEL_SIMD
+	bool HasSse41, HasAvx2;
+	Pixel_GetCpuFeatures(&HasSse41, &HasAvx2);
+
+	return HasSse41 ? &Pixel_ScaleRowSSE4 : &Pixel_ScaleRowC;
+#else
+	return &Pixel_ScaleRowC;
+#endif
+}
+
+static Pixel_ScaleColumnsProc* Pixel_GetScaleColumns(void)
+{
+#if PIXEL_SIMD
+	bool HasSse41, HasAvx2;
+	Pixel_GetCpuFeatures(&HasSse41, &HasAvx2);
+
+	return HasSse41 ? &Pixel_ScaleColumnsSSE4 : &Pixel_ScaleColumnsC;
+#else
+	return &Pixel_ScaleColumnsC;
+#endif
+}
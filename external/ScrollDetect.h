@@ -0,0 +1,617 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "TileHash.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#	define SCROLL_SIMD 1
+#	include <emmintrin.h>
+#else
+#	define SCROLL_SIMD 0
+#endif
+
+// interface
+
+// scroll detection for captured BGRA frames without OS dependencies - only detector state allocates (with malloc)
+//
+// scrolling document or terminal changes nearly every tile, and moves are often outside of encoder motion search range.
+// When enough tiles changed, few tile columns of dirty region are hashed row by row in current & previous frame, and
+// rows with same hash vote for vertical offset. Offset with most votes is verified by comparing pixels with copy of
+// previous frame, starting from best tile column & growing to neighbor columns that moved by same offset. Same is done
+// with tile rows & columns of pixels for horizontal scroll, so every pixel of found region is verified. Region grows
+// pixel by pixel past last whole band, so window edge between tiles does not make its tiles look newly exposed.
+//
+// copy of previous frame is updated by caller only in changed tiles, one tile row at a time (in parallel if it
+// wants). SSE2 & C column hashes are same, SCROLL_SIMD tells if SSE2 one is compiled and used by Scroll_HashColumns.
+
+enum
+{
+	SCROLL_MIN_TILES	= 8,					// changed tiles before frame is checked for scroll
+	SCROLL_MIN_SIZE		= 2 * TILEHASH_SIZE,	// pixels, shortest run of moved rows or columns
+	SCROLL_PROBES		= 4,					// tile columns or tile rows hashed to vote for offset
+	SCROLL_MIN_VOTES	= 8,					// distinct rows or columns agreeing on offset
+	SCROLL_MAX_MISSES	= 4,					// checks of same changed region without scroll, before it is checked less often
+	SCROLL_RETRY		= 8,					// frames between checks of such region
+};
+
+// changed tiles of current frame, from TileHash_TileRow & TileHash_Rects
+typedef struct
+{
+	uint32_t Width;
+	uint32_t Height;
+	uint32_t TilesX;
+	uint32_t TilesY;
+	uint32_t DirtyPitch;		// bitmap words per tile row
+	const uint64_t* Secret;		// from TileHash_Init
+	const uint32_t* Dirty;		// one bit per tile
+	const uint32_t* RowDirty;	// dirty tiles in each tile row
+	uint32_t DirtyCount;
+	TileHashRect Bounds;		// of all dirty tiles
+}
+ScrollChanges;
+
+typedef struct
+{
+	uint32_t Width;
+	uint32_t Height;
+	uint8_t* Previous;			// BGRA, copy of previous frame
+	uint32_t Pitch;
+	uint64_t* CurrentLines;		// hashes of rows or columns crossing probed band
+	uint64_t* PreviousLines;
+	uint32_t* Votes;			// per offset, biased by frame width or height
+	uint32_t* Table;			// hash table of PreviousLines
+	uint32_t TableMask;
+	bool Valid;					// Previous has previous frame
+	bool Found;
+	TileHashRect Rect;			// moved region in current frame
+	int32_t DX;					// offset from previous frame
+	int32_t DY;
+	TileHashRect Exposed;		// bounds of changed tiles with pixels outside Rect changed, empty when there are none
+	TileHashRect MissBounds;	// changed region of last checks that found nothing
+	uint32_t Misses;
+}
+ScrollDetect;
+
+static bool Scroll_Create(ScrollDetect* Scroll, uint32_t Width, uint32_t Height);
+static void Scroll_Release(ScrollDetect* Scroll);
+
+// call after change detection of same frame, returns Found. Rect, DX & DY describe region that moved since previous
+// frame. Before next call, every tile row must be copied with Scroll_CopyRow
+static bool Scroll_Detect(ScrollDetect* Scroll, const ScrollChanges* Changes, const uint8_t* Pixels, uint32_t Pitch);
+
+// copies dirty tiles of one tile row to previous frame, tile rows can be copied in parallel
+static void Scroll_CopyRow(ScrollDetect* Scroll, const ScrollChanges* Changes, const uint8_t* Pixels, uint32_t Pitch, uint32_t TileY);
+
+// hashes of Count columns of Height pixels, never reads past Count pixels of row
+static void Scroll_HashColumns(const uint8_t* Pixels, uint32_t Pitch, uint32_t Count, uint32_t Height, uint64_t* Hashes);
+static void Scroll_HashColumnsC(const uint8_t* Pixels, uint32_t Pitch, uint32_t Count, uint32_t Height, uint64_t* Hashes);
+#if SCROLL_SIMD
+static void Scroll_HashColumnsSSE2(const uint8_t* Pixels, uint32_t Pitch, uint32_t Count, uint32_t Height, uint64_t* Hashes);
+#endif
+
+// implementation
+
+static uint32_t Scroll__Min(uint32_t A, uint32_t B)
+{
+	return A < B ? A : B;
+}
+
+static uint32_t Scroll__Max(uint32_t A, uint32_t B)
+{
+	return A > B ? A : B;
+}
+
+static bool Scroll__Contains(const TileHashRect* Outer, const TileHashRect* Inner)
+{
+	return Inner->Left >= Outer->Left && Inner->Top >= Outer->Top && Inner->Right <= Outer->Right && Inner->Bottom <= Outer->Bottom;
+}
+
+static bool Scroll__Equal(const TileHashRect* A, const TileHashRect* B)
+{
+	return A->Left == B->Left && A->Top == B->Top && A->Right == B->Right && A->Bottom == B->Bottom;
+}
+
+static bool Scroll_Create(ScrollDetect* Scroll, uint32_t Width, uint32_t Height)
+{
+	memset(Scroll, 0, sizeof(*Scroll));
+
+	uint32_t Lines = Scroll__Max(Width, Height);
+
+	Scroll->TableMask = 1;
+	while (Scroll->TableMask < 2 * Lines)
+	{
+		Scroll->TableMask *= 2;
+	}
+	Scroll->TableMask -= 1;
+
+	Scroll->Width = Width;
+	Scroll->Height = Height;
+	Scroll->Pitch = Width * 4;
+
+	Scroll->Previous = malloc((size_t)Height * Scroll->Pitch);
+	Scroll->CurrentLines = malloc(Lines * sizeof(*Scroll->CurrentLines));
+	Scroll->PreviousLines = malloc(Lines * sizeof(*Scroll->PreviousLines));
+	Scroll->Votes = malloc(2 * Lines * sizeof(*Scroll->Votes));
+	Scroll->Table = malloc((Scroll->TableMask + 1) * sizeof(*Scroll->Table));
+	if (!Scroll->Previous || !Scroll->CurrentLines || !Scroll->PreviousLines || !Scroll->Votes || !Scroll->Table)
+	{
+		Scroll_Release(Scroll);
+		return false;
+	}
+	return true;
+}
+
+static void Scroll_Release(ScrollDetect* Scroll)
+{
+	free(Scroll->Previous);
+	free(Scroll->CurrentLines);
+	free(Scroll->PreviousLines);
+	free(Scroll->Votes);
+	free(Scroll->Table);
+	memset(Scroll, 0, sizeof(*Scroll));
+}
+
+//
+// hashes
+
+// four columns are hashed together in 32-bit lanes, reading frame row by row
+static void Scroll_HashColumnsC(const uint8_t* Pixels, uint32_t Pitch, uint32_t Count, uint32_t Height, uint64_t* Hashes)
+{
+	for (uint32_t Column = 0; Column < Count; Column += 4)
+	{
+		uint32_t Size = Scroll__Min(4, Count - Column);
+
+		uint32_t Acc[4] = { 0x9e3779b1, 0x9e3779b1, 0x9e3779b1, 0x9e3779b1 };
+		for (uint32_t Y = 0; Y < Height; Y++)
+		{
+			const uint8_t* Source = Pixels + (size_t)Y * Pitch + Column * 4;
+			for (uint32_t Lane = 0; Lane < 4; Lane++)
+			{
+				uint32_t Data = 0;
+				if (Lane < Size)
+				{
+					memcpy(&Data, Source + Lane * 4, sizeof(Data));
+				}
+				Acc[Lane] ^= Acc[Lane] >> 15;
+				Acc[Lane] = (Acc[Lane] ^ Data) * 0x9e3779b1;
+			}
+		}
+
+		for (uint32_t Lane = 0; Lane < Size; Lane++)
+		{
+			Hashes[Column + Lane] = TileHash_Mix64(Acc[Lane]);
+		}
+	}
+}
+
+#if SCROLL_SIMD
+
+// low 32 bits of four products, SSE2 has only even lanes multiply
+static __m128i Scroll__Mul32(__m128i A, __m128i B)
+{
+	__m128i Even = _mm_mul_epu32(A, B);
+	__m128i Odd = _mm_mul_epu32(_mm_srli_epi64(A, 32), _mm_srli_epi64(B, 32));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(Even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(Odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+static void Scroll_HashColumnsSSE2(const uint8_t* Pixels, uint32_t Pitch, uint32_t Count, uint32_t Height, uint64_t* Hashes)
+{
+	const __m128i Prime = _mm_set1_epi32((int)0x9e3779b1);
+
+	for (uint32_t Column = 0; Column < Count; Column += 4)
+	{
+		uint32_t Size = Scroll__Min(4, Count - Column) * 4;
+
+		__m128i Acc = Prime;
+		for (uint32_t Y = 0; Y < Height; Y++)
+		{
+			const uint8_t* Source = Pixels + (size_t)Y * Pitch + Column * 4;
+
+			__m128i Data;
+			if (Size == 16)
+			{
+				Data = _mm_loadu_si128((const __m128i*)Source);
+			}
+			else
+			{
+				// last columns of frame, must not read past end of row
+				uint8_t Last[16] = { 0 };
+				memcpy(Last, Source, Size);
+				Data = _mm_loadu_si128((const __m128i*)Last);
+			}
+			Acc = _mm_xor_si128(Acc, _mm_srli_epi32(Acc, 15));
+			Acc = Scroll__Mul32(_mm_xor_si128(Acc, Data), Prime);
+		}
+
+		uint32_t Lanes[4];
+		_mm_storeu_si128((__m128i*)Lanes, Acc);
+		for (uint32_t Index = 0; Index < Size / 4; Index++)
+		{
+			Hashes[Column + Index] = TileHash_Mix64(Lanes[Index]);
+		}
+	}
+}
+
+#endif
+
+static void Scroll_HashColumns(const uint8_t* Pixels, uint32_t Pitch, uint32_t Count, uint32_t Height, uint64_t* Hashes)
+{
+#if SCROLL_SIMD
+	Scroll_HashColumnsSSE2(Pixels, Pitch, Count, Height, Hashes);
+#else
+	Scroll_HashColumnsC(Pixels, Pitch, Count, Height, Hashes);
+#endif
+}
+
+// lines are rows for vertical scroll, columns for horizontal - band is tile column or tile row they cross
+static void Scroll__HashLines(const ScrollChanges* Changes, const uint8_t* Pixels, uint32_t Pitch, bool Vertical, uint32_t Band, uint32_t First, uint32_t Last, uint64_t* Hashes)
+{
+	uint32_t Start = Band * TILEHASH_SIZE;
+	if (Vertical)
+	{
+		uint32_t Width = Scroll__Min(TILEHASH_SIZE, Changes->Width - Start);
+		for (uint32_t Line = First; Line < Last; Line++)
+		{
+			Hashes[Line] = TileHash_Line(Changes->Secret, Pixels + (size_t)Line * Pitch + Start * 4, Width);
+		}
+	}
+	else
+	{
+		uint32_t Height = Scroll__Min(TILEHASH_SIZE, Changes->Height - Start);
+		Scroll_HashColumns(Pixels + (size_t)Start * Pitch + First * 4, Pitch, Last - First, Height, Hashes + First);
+	}
+}
+
+//
+// detection
+
+// compares line of band in current frame with line moved by Offset in previous frame
+static bool Scroll__Match(const ScrollDetect* Scroll, const ScrollChanges* Changes, const uint8_t* Pixels, uint32_t Pitch, bool Vertical, uint32_t Band, uint32_t Line, int32_t Offset)
+{
+	uint32_t Start = Band * TILEHASH_SIZE;
+	uint32_t Source = Line - Offset;
+
+	if (Vertical)
+	{
+		uint32_t Width = Scroll__Min(TILEHASH_SIZE, Changes->Width - Start);
+		return memcmp(Pixels + (size_t)Line * Pitch + Start * 4, Scroll->Previous + (size_t)Source * Scroll->Pitch + Start * 4, Width * 4) == 0;
+	}
+
+	uint32_t Height = Scroll__Min(TILEHASH_SIZE, Changes->Height - Start);
+	for (uint32_t Y = Start; Y < Start + Height; Y++)
+	{
+		if (memcmp(Pixels + (size_t)Y * Pitch + Line * 4, Scroll->Previous + (size_t)Y * Scroll->Pitch + Source * 4, 4) != 0)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// compares pixels Start..End of one column (vertical scroll) or row (horizontal) with pixels moved by Offset
+static bool Scroll__CrossMatch(const ScrollDetect* Scroll, const uint8_t* Pixels, uint32_t Pitch, bool Vertical, uint32_t Cross, uint32_t Start, uint32_t End, int32_t Offset)
+{
+	if (Vertical)
+	{
+		for (uint32_t Y = Start; Y < End; Y++)
+		{
+			if (memcmp(Pixels + (size_t)Y * Pitch + Cross * 4, Scroll->Previous + (size_t)(Y - Offset) * Scroll->Pitch + Cross * 4, 4) != 0)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	return memcmp(Pixels + (size_t)Cross * Pitch + Start * 4, Scroll->Previous + (size_t)Cross * Scroll->Pitch + (Start - Offset) * 4, (End - Start) * 4) == 0;
+}
+
+static bool Scroll__BandMatch(const ScrollDetect* Scroll, const ScrollChanges* Changes, const uint8_t* Pixels, uint32_t Pitch, bool Vertical, uint32_t Band, uint32_t Start, uint32_t End, int32_t Offset)
+{
+	for (uint32_t Line = Start; Line < End; Line++)
+	{
+		if (!Scroll__Match(Scroll, Changes, Pixels, Pitch, Vertical, Band, Line, Offset))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// lines that repeat line before them, like empty space, match anywhere & are not used for voting
+static void Scroll__Vote(ScrollDetect* Scroll, uint32_t Lines, uint32_t First, uint32_t Last)
+{
+	const uint64_t* Current = Scroll->CurrentLines;
+	const uint64_t* Previous = Scroll->PreviousLines;
+	uint32_t* Table = Scroll->Table;	// line + 1
+
+	memset(Table, 0, (Scroll->TableMask + 1) * sizeof(*Table));
+
+	for (uint32_t Line = First; Line < Last; Line++)
+	{
+		if (Line != First && Previous[Line] == Previous[Line - 1])
+		{
+			continue;
+		}
+
+		uint32_t Slot = (uint32_t)Previous[Line] & Scroll->TableMask;
+		while (Table[Slot] != 0 && Previous[Table[Slot] - 1] != Previous[Line])
+		{
+			Slot = (Slot + 1) & Scroll->TableMask;
+		}
+		Table[Slot] = Line + 1;
+	}
+
+	for (uint32_t Line = First; Line < Last; Line++)
+	{
+		if (Line != First && Current[Line] == Current[Line - 1])
+		{
+			continue;
+		}
+
+		uint32_t Slot = (uint32_t)Current[Line] & Scroll->TableMask;
+		while (Table[Slot] != 0)
+		{
+			uint32_t Source = Table[Slot] - 1;
+			if (Previous[Source] == Current[Line])
+			{
+				if (Source != Line)
+				{
+					Scroll->Votes[Line - Source + Lines] += 1;
+				}
+				break;
+			}
+			Slot = (Slot + 1) & Scroll->TableMask;
+		}
+	}
+}
+
+static bool Scroll__Find(ScrollDetect* Scroll, const ScrollChanges* Changes, const uint8_t* Pixels, uint32_t Pitch, bool Vertical)
+{
+	const TileHashRect* Bounds = &Changes->Bounds;
+
+	uint32_t Lines = Vertical ? Changes->Height : Changes->Width;
+	uint32_t First = Vertical ? Bounds->Top : Bounds->Left;
+	uint32_t Last = Vertical ? Bounds->Bottom : Bounds->Right;
+	uint32_t BandFirst = (Vertical ? Bounds->Left : Bounds->Top) / TILEHASH_SIZE;
+	uint32_t BandLast = ((Vertical ? Bounds->Right : Bounds->Bottom) + TILEHASH_SIZE - 1) / TILEHASH_SIZE;
+	uint32_t BandCount = BandLast - BandFirst;
+
+	if (Last - First < SCROLL_MIN_SIZE)
+	{
+		return false;
+	}
+
+	uint32_t Probes = Scroll__Min(SCROLL_PROBES, BandCount);
+	uint32_t Bands[SCROLL_PROBES];
+
+	memset(Scroll->Votes, 0, 2 * Lines * sizeof(*Scroll->Votes));
+	for (uint32_t Probe = 0; Probe < Probes; Probe++)
+	{
+		uint32_t Band = BandFirst + (2 * Probe + 1) * BandCount / (2 * Probes);
+		Bands[Probe] = Band;
+
+		Scroll__HashLines(Changes, Pixels, Pitch, Vertical, Band, First, Last, Scroll->CurrentLines);
+		Scroll__HashLines(Changes, Scroll->Previous, Scroll->Pitch, Vertical, Band, First, Last, Scroll->PreviousLines);
+		Scroll__Vote(Scroll, Lines, First, Last);
+	}
+
+	uint32_t Best = 0;
+	for (uint32_t Index = 1; Index < 2 * Lines; Index++)
+	{
+		if (Scroll->Votes[Index] > Scroll->Votes[Best])
+		{
+			Best = Index;
+		}
+	}
+	if (Scroll->Votes[Best] < SCROLL_MIN_VOTES)
+	{
+		return false;
+	}
+	int32_t Offset = (int32_t)Best - (int32_t)Lines;
+
+	// lines that have source in frame
+	uint32_t MatchFirst = Offset > 0 ? Scroll__Max(First, (uint32_t)Offset) : First;
+	uint32_t MatchLast = Offset < 0 ? Scroll__Min(Last, (uint32_t)((int32_t)Lines + Offset)) : Last;
+
+	// longest run of moved lines in probed bands
+	uint32_t Band = 0;
+	uint32_t Start = 0;
+	uint32_t End = 0;
+	for (uint32_t Probe = 0; Probe < Probes; Probe++)
+	{
+		uint32_t Line = MatchFirst;
+		while (Line < MatchLast)
+		{
+			if (!Scroll__Match(Scroll, Changes, Pixels, Pitch, Vertical, Bands[Probe], Line, Offset))
+			{
+				Line++;
+				continue;
+			}
+
+			uint32_t RunStart = Line;
+			while (Line < MatchLast && Scroll__Match(Scroll, Changes, Pixels, Pitch, Vertical, Bands[Probe], Line, Offset))
+			{
+				Line++;
+			}
+			if (Line - RunStart > End - Start)
+			{
+				Band = Bands[Probe];
+				Start = RunStart;
+				End = Line;
+			}
+		}
+	}
+	if (End - Start < SCROLL_MIN_SIZE)
+	{
+		return false;
+	}
+
+	// grow to neighbor bands where whole run moved
+	uint32_t Low = Band;
+	uint32_t High = Band + 1;
+	while (Low > BandFirst && Scroll__BandMatch(Scroll, Changes, Pixels, Pitch, Vertical, Low - 1, Start, End, Offset))
+	{
+		Low--;
+	}
+	while (High < BandLast && Scroll__BandMatch(Scroll, Changes, Pixels, Pitch, Vertical, High, Start, End, Offset))
+	{
+		High++;
+	}
+
+	// and pixel by pixel into bands that moved only in part, like window edge that is not on tile boundary
+	uint32_t BandStart = Low * TILEHASH_SIZE;
+	uint32_t BandEnd = Scroll__Min(High * TILEHASH_SIZE, Vertical ? Changes->Width : Changes->Height);
+	uint32_t CrossSize = Vertical ? Changes->Width : Changes->Height;
+	while (BandStart > 0 && Scroll__CrossMatch(Scroll, Pixels, Pitch, Vertical, BandStart - 1, Start, End, Offset))
+	{
+		BandStart--;
+	}
+	while (BandEnd < CrossSize && Scroll__CrossMatch(Scroll, Pixels, Pitch, Vertical, BandEnd, Start, End, Offset))
+	{
+		BandEnd++;
+	}
+	if (Vertical)
+	{
+		Scroll->Rect = (TileHashRect){ (int32_t)BandStart, (int32_t)Start, (int32_t)BandEnd, (int32_t)End };
+		Scroll->DX = 0;
+		Scroll->DY = Offset;
+	}
+	else
+	{
+		Scroll->Rect = (TileHashRect){ (int32_t)Start, (int32_t)BandStart, (int32_t)End, (int32_t)BandEnd };
+		Scroll->DX = Offset;
+		Scroll->DY = 0;
+	}
+	return true;
+}
+
+// changed tile that is only partly inside Rect was exposed only when its pixels outside of Rect changed too
+static bool Scroll__Exposed(const ScrollDetect* Scroll, const uint8_t* Pixels, uint32_t Pitch, const TileHashRect* Tile)
+{
+	const TileHashRect* Rect = &Scroll->Rect;
+	for (int32_t Y = Tile->Top; Y < Tile->Bottom; Y++)
+	{
+		const uint8_t* Row = Pixels + (size_t)Y * Pitch;
+		const uint8_t* Previous = Scroll->Previous + (size_t)Y * Scroll->Pitch;
+
+		// part of row inside Rect moved, rest of row must be same as before
+		int32_t Left = Tile->Right;
+		int32_t Right = Tile->Right;
+		if (Y >= Rect->Top && Y < Rect->Bottom && Rect->Left < Tile->Right && Rect->Right > Tile->Left)
+		{
+			Left = Rect->Left > Tile->Left ? Rect->Left : Tile->Left;
+			Right = Rect->Right < Tile->Right ? Rect->Right : Tile->Right;
+		}
+		if (memcmp(Row + Tile->Left * 4, Previous + Tile->Left * 4, (Left - Tile->Left) * 4) != 0 || memcmp(Row + Right * 4, Previous + Right * 4, (Tile->Right - Right) * 4) != 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool Scroll_Detect(ScrollDetect* Scroll, const ScrollChanges* Changes, const uint8_t* Pixels, uint32_t Pitch)
+{
+	Scroll->Found = false;
+	if (Scroll->Valid && Changes->DirtyCount >= SCROLL_MIN_TILES)
+	{
+		if (!Scroll__Equal(&Scroll->MissBounds, &Changes->Bounds))
+		{
+			Scroll->MissBounds = Changes->Bounds;
+			Scroll->Misses = 0;
+		}
+
+		// region that keeps changing without moving, like playing video, is checked only sometimes
+		if (Scroll->Misses < SCROLL_MAX_MISSES || Scroll->Misses % SCROLL_RETRY == 0)
+		{
+			Scroll->Found = Scroll__Find(Scroll, Changes, Pixels, Pitch, true) || Scroll__Find(Scroll, Changes, Pixels, Pitch, false);
+		}
+		Scroll->Misses = Scroll->Found ? 0 : Scroll->Misses + 1;
+	}
+
+	TileHashRect Exposed = { 0 };
+	if (Scroll->Found)
+	{
+		for (uint32_t TileY = 0; TileY < Changes->TilesY; TileY++)
+		{
+			const uint32_t* Dirty = Changes->Dirty + TileY * Changes->DirtyPitch;
+			for (uint32_t TileX = 0; TileX < Changes->TilesX; TileX++)
+			{
+				if ((Dirty[TileX / 32] & (1u << (TileX % 32))) == 0)
+				{
+					continue;
+				}
+
+				TileHashRect Tile =
+				{
+					.Left = TileX * TILEHASH_SIZE,
+					.Top = TileY * TILEHASH_SIZE,
+					.Right = Scroll__Min((TileX + 1) * TILEHASH_SIZE, Changes->Width),
+					.Bottom = Scroll__Min((TileY + 1) * TILEHASH_SIZE, Changes->Height),
+				};
+				if (Scroll__Contains(&Scroll->Rect, &Tile) || !Scroll__Exposed(Scroll, Pixels, Pitch, &Tile))
+				{
+					continue;
+				}
+
+				if (Exposed.Left == Exposed.Right)
+				{
+					Exposed = Tile;
+				}
+				else
+				{
+					Exposed.Left = Tile.Left < Exposed.Left ? Tile.Left : Exposed.Left;
+					Exposed.Top = Tile.Top < Exposed.Top ? Tile.Top : Exposed.Top;
+					Exposed.Right = Tile.Right > Exposed.Right ? Tile.Right : Exposed.Right;
+					Exposed.Bottom = Tile.Bottom > Exposed.Bottom ? Tile.Bottom : Exposed.Bottom;
+				}
+			}
+		}
+	}
+	Scroll->Exposed = Exposed;
+
+	// caller copies changed tiles before next frame
+	Scroll->Valid = true;
+	return Scroll->Found;
+}
+
+static void Scroll_CopyRow(ScrollDetect* Scroll, const ScrollChanges* Changes, const uint8_t* Pixels, uint32_t Pitch, uint32_t TileY)
+{
+	if (Changes->RowDirty[TileY] == 0)
+	{
+		return;
+	}
+
+	uint32_t Y = TileY * TILEHASH_SIZE;
+	uint32_t Height = Scroll__Min(TILEHASH_SIZE, Changes->Height - Y);
+	const uint32_t* Dirty = Changes->Dirty + TileY * Changes->DirtyPitch;
+
+	uint32_t TileX = 0;
+	while (TileX < Changes->TilesX)
+	{
+		if ((Dirty[TileX / 32] & (1u << (TileX % 32))) == 0)
+		{
+			TileX++;
+			continue;
+		}
+
+		uint32_t Start = TileX;
+		while (TileX < Changes->TilesX && (Dirty[TileX / 32] & (1u << (TileX % 32))))
+		{
+			TileX++;
+		}
+
+		uint32_t X = Start * TILEHASH_SIZE;
+		uint32_t Size = (Scroll__Min(TileX * TILEHASH_SIZE, Changes->Width) - X) * 4;
+		for (uint32_t Row = Y; Row < Y + Height; Row++)
+		{
+			memcpy(Scroll->Previous + (size_t)Row * Scroll->Pitch + X * 4, Pixels + (size_t)Row * Pitch + X * 4, Size);
+		}
+	}
+}
@@ -0,0 +1,407 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#	define TILEHASH_SIMD 1
+#	include <emmintrin.h>
+#else
+#	define TILEHASH_SIMD 0
+#endif
+
+// interface
+
+// change detection for captured BGRA frames without OS dependencies and memory allocations
+//
+// frame is split into 64x64 tiles, each tile is hashed & compared to its hash from previous frame. Hash accumulates
+// 32x32-bit products of 16-byte blocks mixed with per-column secrets, and scrambles accumulators after every row, so
+// content moved or swapped inside tile changes it. Caller hashes tile rows (in parallel if it wants), which gives
+// bitmap of dirty tiles, then few rectangles covering all dirty tiles are built from bitmap.
+//
+// SSE2 & C versions give same hashes, TILEHASH_SIMD tells if SSE2 one is compiled and used by TileHash_Tile.
+// Hashes are not cryptographic, secrets only spread bits of pixels over whole accumulator.
+
+enum
+{
+	TILEHASH_SIZE			= 64,							// pixels, width & height of tile
+	TILEHASH_SECRET_COUNT	= 2 * TILEHASH_SIZE / 4 + 2,	// two per 16-byte block of tile row, two for row key
+};
+
+typedef struct
+{
+	int32_t Left;
+	int32_t Top;
+	int32_t Right;		// exclusive
+	int32_t Bottom;
+}
+TileHashRect;
+
+// secrets only need to be fixed for whole session, these are same for every call
+static void TileHash_Init(uint64_t Secret[TILEHASH_SECRET_COUNT]);
+
+// hash of Width x Height pixels, at most TILEHASH_SIZE x TILEHASH_SIZE, never reads past Width pixels of row
+static uint64_t TileHash_Tile(const uint64_t* Secret, const uint8_t* Pixels, uint32_t Pitch, uint32_t Width, uint32_t Height);
+static uint64_t TileHash_TileC(const uint64_t* Secret, const uint8_t* Pixels, uint32_t Pitch, uint32_t Width, uint32_t Height);
+#if TILEHASH_SIMD
+static uint64_t TileHash_TileSSE2(const uint64_t* Secret, const uint8_t* Pixels, uint32_t Pitch, uint32_t Width, uint32_t Height);
+#endif
+
+// hash of one row of up to TILEHASH_SIZE pixels
+static uint64_t TileHash_Line(const uint64_t* Secret, const uint8_t* Row, uint32_t Width);
+
+// hashes row of tiles starting at Pixels, Width & Height are of frame part that row covers (Height <= TILEHASH_SIZE)
+// Hashes has one entry per tile & is updated, Dirty has one bit per tile & is overwritten, when Valid is false
+// every tile is dirty. Returns count of dirty tiles
+static uint32_t TileHash_TileRow(const uint64_t* Secret, const uint8_t* Pixels, uint32_t Pitch, uint32_t Width, uint32_t Height, uint64_t* Hashes, uint32_t* Dirty, bool Valid);
+
+// runs of dirty tiles in each tile row become rectangles, growing down when next row has run with same span. When
+// there are more than MaxRects, last one grows to cover rest, so they may overlap. RowDirty has count of dirty tiles
+// for each tile row, so clean rows are skipped. Bounds is union of all rectangles, returns rectangle count
+static uint32_t TileHash_Rects(const uint32_t* Dirty, uint32_t DirtyPitch, const uint32_t* RowDirty, uint32_t Width, uint32_t Height, TileHashRect* Rects, uint32_t MaxRects, TileHashRect* Bounds);
+
+static uint64_t TileHash_Mix64(uint64_t Value);
+
+// implementation
+
+static uint64_t TileHash_Mix64(uint64_t Value)
+{
+	Value ^= Value >> 30;
+	Value *= 0xbf58476d1ce4e5b9;
+	Value ^= Value >> 27;
+	Value *= 0x94d049bb133111eb;
+	Value ^= Value >> 31;
+	return Value;
+}
+
+static void TileHash_Init(uint64_t Secret[TILEHASH_SECRET_COUNT])
+{
+	uint64_t Seed = 0;
+	for (uint32_t Index = 0; Index < TILEHASH_SECRET_COUNT; Index++)
+	{
+		Seed += 0x9e3779b97f4a7c15;
+		Secret[Index] = TileHash_Mix64(Seed);
+	}
+}
+
+//
+// C, same math as SSE2 on two 64-bit lanes
+
+static uint64_t TileHash__Load64(const uint8_t* Data)
+{
+	uint64_t Value;
+	memcpy(&Value, Data, sizeof(Value));
+	return Value;
+}
+
+static void TileHash__BlockC(uint64_t Acc[2], const uint8_t* Data, const uint64_t* Secret)
+{
+	uint64_t Lanes[2] = { TileHash__Load64(Data), TileHash__Load64(Data + 8) };
+	for (uint32_t Lane = 0; Lane < 2; Lane++)
+	{
+		uint64_t Key = Lanes[Lane] ^ Secret[Lane];
+		Acc[Lane] += (Key & 0xffffffff) * (Key >> 32) + Lanes[Lane ^ 1];
+	}
+}
+
+static void TileHash__ScrambleC(uint64_t Acc[2], const uint64_t* Key)
+{
+	const uint64_t Prime = 0x9e3779b1;
+
+	for (uint32_t Lane = 0; Lane < 2; Lane++)
+	{
+		uint64_t Value = Acc[Lane];
+		Value ^= Value >> 47;
+		Value ^= Key[Lane];
+		Acc[Lane] = (Value & 0xffffffff) * Prime + (((Value >> 32) * Prime) << 32);
+	}
+}
+
+static uint64_t TileHash__Finish(const uint64_t* Lanes, uint32_t Width, uint32_t Height)
+{
+	uint64_t Hash = Width | ((uint64_t)Height << 32);
+	for (uint32_t Index = 0; Index < 8; Index++)
+	{
+		Hash = TileHash_Mix64(Hash ^ Lanes[Index]);
+	}
+	return Hash;
+}
+
+static uint64_t TileHash_TileC(const uint64_t* Secret, const uint8_t* Pixels, uint32_t Pitch, uint32_t Width, uint32_t Height)
+{
+	const uint64_t* RowKey = Secret + 2 * TILEHASH_SIZE / 4;
+
+	// four accumulators of two lanes, like four SSE2 registers
+	uint64_t Acc[8];
+	memcpy(Acc, Secret, sizeof(Acc));
+
+	uint32_t Size = Width * 4;
+	uint32_t Blocks = Size / 16;
+	uint32_t Tail = Size % 16;
+
+	for (uint32_t Y = 0; Y < Height; Y++)
+	{
+		const uint8_t* Row = Pixels + (size_t)Y * Pitch;
+
+		uint32_t Block = 0;
+		for (; Block + 4 <= Blocks; Block += 4)
+		{
+			for (uint32_t Index = 0; Index < 4; Index++)
+			{
+				TileHash__BlockC(Acc + 2 * Index, Row + (Block + Index) * 16, Secret + 2 * (Block + Index));
+			}
+		}
+		for (; Block < Blocks; Block++)
+		{
+			TileHash__BlockC(Acc + 0, Row + Block * 16, Secret + 2 * Block);
+		}
+		if (Tail)
+		{
+			uint8_t Last[16] = { 0 };
+			memcpy(Last, Row + Blocks * 16, Tail);
+			TileHash__BlockC(Acc + 2, Last, Secret + 2 * Blocks);
+		}
+
+		for (uint32_t Index = 0; Index < 4; Index++)
+		{
+			TileHash__ScrambleC(Acc + 2 * Index, RowKey);
+		}
+	}
+
+	return TileHash__Finish(Acc, Width, Height);
+}
+
+//
+// SSE2
+
+#if TILEHASH_SIMD
+
+static __m128i TileHash__Block(__m128i Acc, __m128i Data, const uint64_t* Secret)
+{
+	__m128i Key = _mm_xor_si128(Data, _mm_loadu_si128((const __m128i*)Secret));
+	__m128i Product = _mm_mul_epu32(Key, _mm_srli_epi64(Key, 32));
+	return _mm_add_epi64(Acc, _mm_add_epi64(Product, _mm_shuffle_epi32(Data, _MM_SHUFFLE(1, 0, 3, 2))));
+}
+
+static __m128i TileHash__Scramble(__m128i Acc, __m128i Key)
+{
+	const __m128i Prime = _mm_set1_epi32((int)0x9e3779b1);
+
+	Acc = _mm_xor_si128(Acc, _mm_srli_epi64(Acc, 47));
+	Acc = _mm_xor_si128(Acc, Key);
+
+	__m128i Low = _mm_mul_epu32(Acc, Prime);
+	__m128i High = _mm_mul_epu32(_mm_srli_epi64(Acc, 32), Prime);
+	return _mm_add_epi64(Low, _mm_slli_epi64(High, 32));
+}
+
+static uint64_t TileHash_TileSSE2(const uint64_t* Secret, const uint8_t* Pixels, uint32_t Pitch, uint32_t Width, uint32_t Height)
+{
+	__m128i RowKey = _mm_loadu_si128((const __m128i*)(Secret + 2 * TILEHASH_SIZE / 4));
+
+	__m128i Acc0 = _mm_loadu_si128((const __m128i*)(Secret + 0));
+	__m128i Acc1 = _mm_loadu_si128((const __m128i*)(Secret + 2));
+	__m128i Acc2 = _mm_loadu_si128((const __m128i*)(Secret + 4));
+	__m128i Acc3 = _mm_loadu_si128((const __m128i*)(Secret + 6));
+
+	uint32_t Size = Width * 4;
+	uint32_t Blocks = Size / 16;
+	uint32_t Tail = Size % 16;
+
+	for (uint32_t Y = 0; Y < Height; Y++)
+	{
+		const uint8_t* Row = Pixels + (size_t)Y * Pitch;
+
+		uint32_t Block = 0;
+		for (; Block + 4 <= Blocks; Block += 4)
+		{
+			Acc0 = TileHash__Block(Acc0, _mm_loadu_si128((const __m128i*)(Row + Block * 16 +  0)), Secret + 2 * Block + 0);
+			Acc1 = TileHash__Block(Acc1, _mm_loadu_si128((const __m128i*)(Row + Block * 16 + 16)), Secret + 2 * Block + 2);
+			Acc2 = TileHash__Block(Acc2, _mm_loadu_si128((const __m128i*)(Row + Block * 16 + 32)), Secret + 2 * Block + 4);
+			Acc3 = TileHash__Block(Acc3, _mm_loadu_si128((const __m128i*)(Row + Block * 16 + 48)), Secret + 2 * Block + 6);
+		}
+		for (; Block < Blocks; Block++)
+		{
+			Acc0 = TileHash__Block(Acc0, _mm_loadu_si128((const __m128i*)(Row + Block * 16)), Secret + 2 * Block);
+		}
+		if (Tail)
+		{
+			// partial block at right edge of frame, must not read past end of row
+			uint8_t Last[16] = { 0 };
+			memcpy(Last, Row + Blocks * 16, Tail);
+			Acc1 = TileHash__Block(Acc1, _mm_loadu_si128((const __m128i*)Last), Secret + 2 * Blocks);
+		}
+
+		Acc0 = TileHash__Scramble(Acc0, RowKey);
+		Acc1 = TileHash__Scramble(Acc1, RowKey);
+		Acc2 = TileHash__Scramble(Acc2, RowKey);
+		Acc3 = TileHash__Scramble(Acc3, RowKey);
+	}
+
+	uint64_t Lanes[8];
+	_mm_storeu_si128((__m128i*)&Lanes[0], Acc0);
+	_mm_storeu_si128((__m128i*)&Lanes[2], Acc1);
+	_mm_storeu_si128((__m128i*)&Lanes[4], Acc2);
+	_mm_storeu_si128((__m128i*)&Lanes[6], Acc3);
+	return TileHash__Finish(Lanes, Width, Height);
+}
+
+#endif
+
+static uint64_t TileHash_Tile(const uint64_t* Secret, const uint8_t* Pixels, uint32_t Pitch, uint32_t Width, uint32_t Height)
+{
+#if TILEHASH_SIMD
+	return TileHash_TileSSE2(Secret, Pixels, Pitch, Width, Height);
+#else
+	return TileHash_TileC(Secret, Pixels, Pitch, Width, Height);
+#endif
+}
+
+static uint64_t TileHash_Line(const uint64_t* Secret, const uint8_t* Row, uint32_t Width)
+{
+	uint32_t Size = Width * 4;
+	uint32_t Blocks = Size / 16;
+	uint32_t Tail = Size % 16;
+
+	uint64_t Lanes[2];
+#if TILEHASH_SIMD
+	__m128i Acc = _mm_loadu_si128((const __m128i*)Secret);
+	for (uint32_t Block = 0; Block < Blocks; Block++)
+	{
+		Acc = TileHash__Block(Acc, _mm_loadu_si128((const __m128i*)(Row + Block * 16)), Secret + 2 * Block);
+	}
+	if (Tail)
+	{
+		uint8_t Last[16] = { 0 };
+		memcpy(Last, Row + Blocks * 16, Tail);
+		Acc = TileHash__Block(Acc, _mm_loadu_si128((const __m128i*)Last), Secret + 2 * Blocks);
+	}
+	_mm_storeu_si128((__m128i*)Lanes, Acc);
+#else
+	memcpy(Lanes, Secret, sizeof(Lanes));
+	for (uint32_t Block = 0; Block < Blocks; Block++)
+	{
+		TileHash__BlockC(Lanes, Row + Block * 16, Secret + 2 * Block);
+	}
+	if (Tail)
+	{
+		uint8_t Last[16] = { 0 };
+		memcpy(Last, Row + Blocks * 16, Tail);
+		TileHash__BlockC(Lanes, Last, Secret + 2 * Blocks);
+	}
+#endif
+	return TileHash_Mix64(Lanes[0] ^ TileHash_Mix64(Lanes[1]));
+}
+
+static uint32_t TileHash_TileRow(const uint64_t* Secret, const uint8_t* Pixels, uint32_t Pitch, uint32_t Width, uint32_t Height, uint64_t* Hashes, uint32_t* Dirty, bool Valid)
+{
+	uint32_t TilesX = (Width + TILEHASH_SIZE - 1) / TILEHASH_SIZE;
+	memset(Dirty, 0, (TilesX + 31) / 32 * sizeof(*Dirty));
+
+	uint32_t Count = 0;
+	for (uint32_t TileX = 0; TileX < TilesX; TileX++)
+	{
+		uint32_t X = TileX * TILEHASH_SIZE;
+		uint32_t TileWidth = Width - X < TILEHASH_SIZE ? Width - X : TILEHASH_SIZE;
+
+		uint64_t Hash = TileHash_Tile(Secret, Pixels + X * 4, Pitch, TileWidth, Height);
+		if (!Valid || Hashes[TileX] != Hash)
+		{
+			Hashes[TileX] = Hash;
+			Dirty[TileX / 32] |= 1u << (TileX % 32);
+			Count++;
+		}
+	}
+	return Count;
+}
+
+static bool TileHash__IsDirty(const uint32_t* Dirty, uint32_t TileX)
+{
+	return (Dirty[TileX / 32] & (1u << (TileX % 32))) != 0;
+}
+
+static void TileHash__Union(TileHashRect* Rect, const TileHashRect* Other)
+{
+	if (Rect->Left >= Rect->Right || Rect->Top >= Rect->Bottom)
+	{
+		*Rect = *Other;
+	}
+	else
+	{
+		Rect->Left = Other->Left < Rect->Left ? Other->Left : Rect->Left;
+		Rect->Top = Other->Top < Rect->Top ? Other->Top : Rect->Top;
+		Rect->Right = Other->Right > Rect->Right ? Other->Right : Rect->Right;
+		Rect->Bottom = Other->Bottom > Rect->Bottom ? Other->Bottom : Rect->Bottom;
+	}
+}
+
+static uint32_t TileHash_Rects(const uint32_t* Dirty, uint32_t DirtyPitch, const uint32_t* RowDirty, uint32_t Width, uint32_t Height, TileHashRect* Rects, uint32_t MaxRects, TileHashRect* Bounds)
+{
+	uint32_t TilesX = (Width + TILEHASH_SIZE - 1) / TILEHASH_SIZE;
+	uint32_t TilesY = (Height + TILEHASH_SIZE - 1) / TILEHASH_SIZE;
+
+	uint32_t RectCount = 0;
+	memset(Bounds, 0, sizeof(*Bounds));
+
+	for (uint32_t TileY = 0; TileY < TilesY; TileY++)
+	{
+		if (RowDirty[TileY] == 0)
+		{
+			continue;
+		}
+
+		const uint32_t* RowBits = Dirty + TileY * DirtyPitch;
+		uint32_t TileX = 0;
+		while (TileX < TilesX)
+		{
+			if (!TileHash__IsDirty(RowBits, TileX))
+			{
+				TileX++;
+				continue;
+			}
+
+			uint32_t Start = TileX;
+			while (TileX < TilesX && TileHash__IsDirty(RowBits, TileX))
+			{
+				TileX++;
+			}
+
+			TileHashRect Run =
+			{
+				.Left = Start * TILEHASH_SIZE,
+				.Top = TileY * TILEHASH_SIZE,
+				.Right = TileX * TILEHASH_SIZE < Width ? TileX * TILEHASH_SIZE : Width,
+				.Bottom = (TileY + 1) * TILEHASH_SIZE < Height ? (TileY + 1) * TILEHASH_SIZE : Height,
+			};
+			TileHash__Union(Bounds, &Run);
+
+			bool Extended = false;
+			for (uint32_t Index = 0; Index < RectCount; Index++)
+			{
+				TileHashRect* Rect = &Rects[Index];
+				if (Rect->Left == Run.Left && Rect->Right == Run.Right && Rect->Bottom == Run.Top)
+				{
+					Rect->Bottom = Run.Bottom;
+					Extended = true;
+					break;
+				}
+			}
+
+			if (!Extended)
+			{
+				if (RectCount < MaxRects)
+				{
+					Rects[RectCount++] = Run;
+				}
+				else
+				{
+					TileHash__Union(&Rects[MaxRects - 1], &Run);
+				}
+			}
+		}
+	}
+
+	return RectCount;
+}
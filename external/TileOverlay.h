@@ -0,0 +1,1076 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "TileHash.h"
+
+// interface
+
+// lossless overlay of static screen tiles, without OS dependencies - only sharer & layer state allocate (with malloc)
+//
+// tiles from change detection that stay unchanged for OVERLAY_STABLE_FRAMES are compressed losslessly, and viewer
+// draws them over decoded video until they change. Tile is palette indices when it has at most 256 colors, otherwise
+// color differences to left pixel, packed with byte-oriented LZ. Tiles that compress worse than OVERLAY_MAX_TILE, like
+// photos or video, are left to video encoder until they change.
+//
+// records travel inside H.264 frames as user data SEI with Overlay_Uuid, which decoders ignore. Payload is frame
+// size followed by records - changed tile to remove, new tile, or scrolled region to move. Keyframe resets overlay on
+// both sides. Sharer queues records for every captured frame & attaches them to encoded frame with same time, frames
+// that encoder dropped have their records merged into next one. Everything that comes from network is validated.
+
+enum
+{
+	OVERLAY_STABLE_FRAMES	= 10,			// frames without change before tile is sent losslessly
+	OVERLAY_FRAME_BUDGET	= 12 * 1024,	// bytes of tiles added to one encoded frame
+	OVERLAY_FRAME_TILES		= 16,			// tiles compressed for one captured frame at most
+	OVERLAY_MAX_TILE		= 6 * 1024,		// bytes, tiles that compress worse are left to video
+	OVERLAY_QUEUE_SIZE		= 16,			// frames between capture & encoder output, twice encoder queue
+	OVERLAY_MAX_SIZE		= 16384,		// frame width & height, largest texture
+	OVERLAY_HEADER			= 2 + 2,		// frame width & height
+	OVERLAY_RECORD			= 1 + 2 + 2,	// type, tile index, tile data size
+	OVERLAY_CLEAR_RECORD	= 1 + 2,		// type, tile index
+	OVERLAY_COPY_RECORD		= 1 + 4 * 2 + 2 * 2,	// type, destination rectangle, offset from source
+	OVERLAY_LZ_HASH_BITS	= 12,
+	OVERLAY_LZ_MIN_MATCH	= 4,
+};
+
+// record types
+enum
+{
+	OVERLAY_CLEAR,		// tile changed, viewer stops drawing it
+	OVERLAY_PALETTE,
+	OVERLAY_COLOR,
+	OVERLAY_COPY,		// region scrolled, viewer moves its tiles
+};
+
+// tile state on sharer
+enum
+{
+	OVERLAY_TILE_UNSENT,
+	OVERLAY_TILE_SENT,
+	OVERLAY_TILE_REJECTED,	// compressed too large, waits for change
+	OVERLAY_TILE_CHANGED,	// viewer still has old tile, clear record is needed
+};
+
+static const uint8_t Overlay_Uuid[16] = { 'S', 'c', 'r', 'e', 'e', 'n', 'B', 'u', 'd', 'd', 'y', 'O', 'v', 'r', 'l', '1' };
+
+typedef struct
+{
+	int64_t Time;		// encoder sample time
+	uint32_t Size;		// bytes of records
+}
+OverlayFrame;
+
+typedef struct
+{
+	uint32_t Width;
+	uint32_t Height;
+	uint32_t TilesX;
+	uint32_t TilesY;
+	uint8_t* State;		// per tile
+	uint8_t* Age;		// per tile, frames without change
+	uint8_t* Data;		// records for each queued frame
+	uint32_t SlotSize;
+	OverlayFrame Queue[OVERLAY_QUEUE_SIZE];
+	uint32_t Read;
+	uint32_t Write;
+	uint32_t Prefix;	// bytes already written for next queued frame, by scroll
+}
+OverlaySharer;
+
+typedef struct
+{
+	uint32_t Width;
+	uint32_t Height;
+	uint32_t TilesX;
+	uint32_t TilesY;
+	uint32_t Count;		// valid tiles
+	uint8_t* Pixels;	// BGRA
+	uint8_t* Valid;		// per tile
+}
+OverlayLayer;
+
+// called for every part of layer that got new pixels
+typedef void Overlay_UpdateProc(void* Context, uint32_t X, uint32_t Y, uint32_t Width, uint32_t Height);
+
+// LZ77 with LZ4-like sequences, returns 0 if output does not fit in Capacity
+static uint32_t Overlay_LzCompress(const uint8_t* Input, uint32_t Size, uint8_t* Output, uint32_t Capacity);
+// input comes from network, returns false unless it decodes to exactly Size bytes
+static bool Overlay_LzDecompress(const uint8_t* Input, uint32_t InputSize, uint8_t* Output, uint32_t Size);
+
+// BGRA tile of at most TILEHASH_SIZE x TILEHASH_SIZE to palette or color record data, returns 0 if it does not fit
+// in Capacity. Alpha is not stored, decoded tiles are opaque
+static uint32_t Overlay_EncodeTile(const uint8_t* Pixels, uint32_t Pitch, uint32_t Width, uint32_t Height, uint8_t* Output, uint32_t Capacity, uint8_t* Type);
+// record data to BGRA tile, returns false if data is not valid
+static bool Overlay_DecodeTile(uint8_t Type, const uint8_t* Input, uint32_t InputSize, uint8_t* Pixels, uint32_t Pitch, uint32_t Width, uint32_t Height);
+
+// tile fully inside moved region keeps Keep only when every tile it came from had it, other tiles touching region
+// lose it. Rect must be inside frame, and also Rect moved by -DX, -DY
+static void Overlay_MoveTiles(uint8_t* Tiles, uint32_t TilesX, uint32_t TilesY, uint32_t Width, uint32_t Height, const TileHashRect* Rect, int32_t DX, int32_t DY, uint8_t Keep);
+
+// sharer, for frames of size that change detection uses
+static bool Overlay_CreateSharer(OverlaySharer* Sharer, uint32_t Width, uint32_t Height);
+static void Overlay_ReleaseSharer(OverlaySharer* Sharer);
+// called for every frame that went through change detection, Moved is region that scrolled by DX, DY or NULL
+static void Overlay_SharerChanges(OverlaySharer* Sharer, const uint32_t* Dirty, uint32_t DirtyPitch, const TileHashRect* Moved, int32_t DX, int32_t DY);
+// frame must be encoded even without changes, when it has overlay records to carry
+static bool Overlay_SharerPending(const OverlaySharer* Sharer);
+// prepares records for captured frame, they are attached to encoded frame with same sample time
+static void Overlay_SharerQueueFrame(OverlaySharer* Sharer, int64_t Time, const uint8_t* Pixels, uint32_t Pitch);
+// encoder produced keyframe, viewer starts with empty overlay & everything sent or queued until now is sent again
+static void Overlay_SharerKeyFrame(OverlaySharer* Sharer);
+// most bytes that SEI NAL unit with records for frames up to Time can take, 0 when there is nothing to send
+static uint32_t Overlay_SharerSeiSize(const OverlaySharer* Sharer, int64_t Time);
+// writes SEI NAL unit with 4 byte start code and records for frames up to Time, returns its size
+static uint32_t Overlay_SharerWriteSei(OverlaySharer* Sharer, int64_t Time, uint8_t* Output);
+
+// viewer layer, Width & Height up to OVERLAY_MAX_SIZE
+static bool Overlay_CreateLayer(OverlayLayer* Layer, uint32_t Width, uint32_t Height);
+static void Overlay_ReleaseLayer(OverlayLayer* Layer);
+static void Overlay_ResetLayer(OverlayLayer* Layer);
+// user data SEI NAL unit from H264Parse_AccessUnit without emulation prevention bytes into Payload of NalSize bytes,
+// returns false when it is not overlay data. Width & Height are for layer that records apply to
+static bool Overlay_ParseSei(const uint8_t* Nal, uint32_t NalSize, uint8_t* Payload, const uint8_t** Records, uint32_t* RecordsSize, uint32_t* Width, uint32_t* Height);
+// applies records to layer of size from Overlay_ParseSei, stops on first invalid record
+static void Overlay_ApplyRecords(OverlayLayer* Layer, const uint8_t* Records, uint32_t Size, Overlay_UpdateProc* Update, void* Context);
+
+// implementation
+
+static uint32_t Overlay__Min(uint32_t A, uint32_t B)
+{
+	return A < B ? A : B;
+}
+
+static bool Overlay__Contains(const TileHashRect* Outer, const TileHashRect* Inner)
+{
+	return Inner->Left >= Outer->Left && Inner->Top >= Outer->Top && Inner->Right <= Outer->Right && Inner->Bottom <= Outer->Bottom;
+}
+
+static TileHashRect Overlay__Tile(uint32_t TileX, uint32_t TileY, uint32_t Width, uint32_t Height)
+{
+	TileHashRect Tile =
+	{
+		.Left = TileX * TILEHASH_SIZE,
+		.Top = TileY * TILEHASH_SIZE,
+		.Right = Overlay__Min((TileX + 1) * TILEHASH_SIZE, Width),
+		.Bottom = Overlay__Min((TileY + 1) * TILEHASH_SIZE, Height),
+	};
+	return Tile;
+}
+
+//
+// LZ
+
+static uint32_t Overlay__LzWriteLength(uint8_t* Output, uint32_t Length)
+{
+	uint32_t Size = 0;
+	while (Length >= 255)
+	{
+		Output[Size++] = 255;
+		Length -= 255;
+	}
+	Output[Size++] = (uint8_t)Length;
+	return Size;
+}
+
+static uint32_t Overlay_LzCompress(const uint8_t* Input, uint32_t Size, uint8_t* Output, uint32_t Capacity)
+{
+	uint16_t Table[1 << OVERLAY_LZ_HASH_BITS] = { 0 };	// position + 1
+
+	uint32_t OutSize = 0;
+	uint32_t Literal = 0;
+	uint32_t Pos = 0;
+
+	while (Pos < Size)
+	{
+		uint32_t MatchPos = 0;
+		uint32_t MatchLength = 0;
+
+		if (Pos + OVERLAY_LZ_MIN_MATCH <= Size)
+		{
+			uint32_t Value;
+			memcpy(&Value, Input + Pos, sizeof(Value));
+			uint32_t Hash = (Value * 2654435761u) >> (32 - OVERLAY_LZ_HASH_BITS);
+
+			uint32_t Candidate = Table[Hash];
+			Table[Hash] = (uint16_t)(Pos + 1);
+
+			if (Candidate != 0)
+			{
+				MatchPos = Candidate - 1;
+				while (Pos + MatchLength < Size && Input[MatchPos + MatchLength] == Input[Pos + MatchLength])
+				{
+					MatchLength++;
+				}
+			}
+		}
+
+		if (MatchLength < OVERLAY_LZ_MIN_MATCH)
+		{
+			Pos++;
+			continue;
+		}
+
+		// token, literals, offset & extra length bytes
+		uint32_t LiteralCount = Pos - Literal;
+		uint32_t MatchCode = MatchLength - OVERLAY_LZ_MIN_MATCH;
+		if (OutSize + 1 + LiteralCount / 255 + 1 + LiteralCount + 2 + MatchCode / 255 + 1 > Capacity)
+		{
+			return 0;
+		}
+
+		uint8_t* Token = &Output[OutSize++];
+		*Token = (uint8_t)((Overlay__Min(LiteralCount, 15) << 4) | Overlay__Min(MatchCode, 15));
+		if (LiteralCount >= 15)
+		{
+			OutSize += Overlay__LzWriteLength(Output + OutSize, LiteralCount - 15);
+		}
+		memcpy(Output + OutSize, Input + Literal, LiteralCount);
+		OutSize += LiteralCount;
+
+		uint16_t Offset = (uint16_t)(Pos - MatchPos);
+		memcpy(Output + OutSize, &Offset, sizeof(Offset));
+		OutSize += sizeof(Offset);
+		if (MatchCode >= 15)
+		{
+			OutSize += Overlay__LzWriteLength(Output + OutSize, MatchCode - 15);
+		}
+
+		// positions inside match are not hashed, long runs stay fast
+		Pos += MatchLength;
+		Literal = Pos;
+	}
+
+	// last sequence has only literals
+	uint32_t LiteralCount = Size - Literal;
+	if (OutSize + 1 + LiteralCount / 255 + 1 + LiteralCount > Capacity)
+	{
+		return 0;
+	}
+	Output[OutSize++] = (uint8_t)(Overlay__Min(LiteralCount, 15) << 4);
+	if (LiteralCount >= 15)
+	{
+		OutSize += Overlay__LzWriteLength(Output + OutSize, LiteralCount - 15);
+	}
+	memcpy(Output + OutSize, Input + Literal, LiteralCount);
+	OutSize += LiteralCount;
+
+	return OutSize;
+}
+
+static bool Overlay__LzReadLength(const uint8_t** Input, const uint8_t* End, uint32_t* Length)
+{
+	uint8_t Byte;
+	do
+	{
+		if (*Input == End)
+		{
+			return false;
+		}
+		Byte = *(*Input)++;
+		*Length += Byte;
+	}
+	while (Byte == 255);
+	return true;
+}
+
+static bool Overlay_LzDecompress(const uint8_t* Input, uint32_t InputSize, uint8_t* Output, uint32_t Size)
+{
+	const uint8_t* End = Input + InputSize;
+	uint32_t Pos = 0;
+
+	while (Input != End)
+	{
+		uint8_t Token = *Input++;
+
+		uint32_t LiteralCount = Token >> 4;
+		if (LiteralCount == 15 && !Overlay__LzReadLength(&Input, End, &LiteralCount))
+		{
+			return false;
+		}
+		if (LiteralCount > (uint32_t)(End - Input) || LiteralCount > Size - Pos)
+		{
+			return false;
+		}
+		memcpy(Output + Pos, Input, LiteralCount);
+		Input += LiteralCount;
+		Pos += LiteralCount;
+
+		if (Input == End)
+		{
+			break;
+		}
+
+		uint16_t Offset;
+		if ((size_t)(End - Input) < sizeof(Offset))
+		{
+			return false;
+		}
+		memcpy(&Offset, Input, sizeof(Offset));
+		Input += sizeof(Offset);
+
+		uint32_t MatchLength = Token & 15;
+		if (MatchLength == 15 && !Overlay__LzReadLength(&Input, End, &MatchLength))
+		{
+			return false;
+		}
+		MatchLength += OVERLAY_LZ_MIN_MATCH;
+
+		if (Offset == 0 || Offset > Pos || MatchLength > Size - Pos)
+		{
+			return false;
+		}
+
+		// overlapping copy repeats pattern
+		for (uint32_t Index = 0; Index < MatchLength; Index++)
+		{
+			Output[Pos + Index] = Output[Pos - Offset + Index];
+		}
+		Pos += MatchLength;
+	}
+
+	return Pos == Size;
+}
+
+//
+// tiles
+
+// returns bits per palette index
+static uint32_t Overlay__IndexBits(uint32_t Count)
+{
+	return Count <= 2 ? 1 : Count <= 4 ? 2 : Count <= 16 ? 4 : 8;
+}
+
+static uint32_t Overlay_EncodeTile(const uint8_t* Pixels, uint32_t Pitch, uint32_t Width, uint32_t Height, uint8_t* Output, uint32_t Capacity, uint8_t* Type)
+{
+	uint8_t Data[TILEHASH_SIZE * TILEHASH_SIZE * 3];
+	uint32_t DataSize = 0;
+
+	uint32_t Palette[256];
+	uint32_t Count = 0;
+	uint16_t Slots[1024] = { 0 };	// palette index + 1
+	uint32_t Last = 0;
+	uint32_t LastIndex = UINT32_MAX;
+
+	// screen content often has few colors, indices are stored one byte per pixel for now
+	for (uint32_t Y = 0; Y < Height && Count <= 256; Y++)
+	{
+		const uint8_t* Row = Pixels + (size_t)Y * Pitch;
+		for (uint32_t X = 0; X < Width; X++)
+		{
+			uint32_t Color;
+			memcpy(&Color, Row + X * 4, sizeof(Color));
+			Color &= 0xffffff;
+
+			if (Color != Last || LastIndex == UINT32_MAX)
+			{
+				uint32_t Slot = (Color * 2654435761u) >> 22;
+				while (Slots[Slot] != 0 && Palette[Slots[Slot] - 1] != Color)
+				{
+					Slot = (Slot + 1) % (sizeof(Slots) / sizeof(*Slots));
+				}
+				if (Slots[Slot] == 0)
+				{
+					if (Count == 256)
+					{
+						Count++;
+						break;
+					}
+					Palette[Count] = Color;
+					Slots[Slot] = (uint16_t)++Count;
+				}
+				Last = Color;
+				LastIndex = Slots[Slot] - 1;
+			}
+			Data[Y * Width + X] = (uint8_t)LastIndex;
+		}
+	}
+
+	uint32_t Size = 0;
+	if (Count <= 256)
+	{
+		if (1 + 3 * Count > Capacity)
+		{
+			return 0;
+		}
+
+		Output[Size++] = (uint8_t)(Count - 1);
+		for (uint32_t Index = 0; Index < Count; Index++)
+		{
+			Output[Size++] = (uint8_t)(Palette[Index]);
+			Output[Size++] = (uint8_t)(Palette[Index] >> 8);
+			Output[Size++] = (uint8_t)(Palette[Index] >> 16);
+		}
+
+		// rows are packed in place, each starts on byte boundary
+		uint32_t Bits = Overlay__IndexBits(Count);
+		uint32_t RowSize = (Width * Bits + 7) / 8;
+		for (uint32_t Y = 0; Y < Height; Y++)
+		{
+			const uint8_t* Indices = Data + Y * Width;
+			uint8_t* Packed = Data + DataSize;
+			for (uint32_t Byte = 0; Byte < RowSize; Byte++)
+			{
+				uint32_t Value = 0;
+				for (uint32_t Bit = 0; Bit < 8; Bit += Bits)
+				{
+					uint32_t X = Byte * 8 / Bits + Bit / Bits;
+					Value = (Value << Bits) | (X < Width ? Indices[X] : 0);
+				}
+				Packed[Byte] = (uint8_t)Value;
+			}
+			DataSize += RowSize;
+		}
+		*Type = OVERLAY_PALETTE;
+	}
+	else
+	{
+		// green is predicted from left pixel (above for first column), red & blue from green difference
+		for (uint32_t Y = 0; Y < Height; Y++)
+		{
+			const uint8_t* Row = Pixels + (size_t)Y * Pitch;
+			const uint8_t* Above = Y ? Row - Pitch : NULL;
+			for (uint32_t X = 0; X < Width; X++)
+			{
+				const uint8_t* Pixel = Row + X * 4;
+				const uint8_t* Prediction = X ? Pixel - 4 : Above;
+
+				uint8_t B = Pixel[0], G = Pixel[1], R = Pixel[2];
+				uint8_t PB = 0, PG = 0, PR = 0;
+				if (Prediction)
+				{
+					PB = Prediction[0];
+					PG = Prediction[1];
+					PR = Prediction[2];
+				}
+
+				uint8_t DG = (uint8_t)(G - PG);
+				Data[DataSize++] = (uint8_t)(B - PB - DG);
+				Data[DataSize++] = DG;
+				Data[DataSize++] = (uint8_t)(R - PR - DG);
+			}
+		}
+		*Type = OVERLAY_COLOR;
+	}
+
+	uint32_t Compressed = Overlay_LzCompress(Data, DataSize, Output + Size, Capacity - Size);
+	return Compressed ? Size + Compressed : 0;
+}
+
+static bool Overlay_DecodeTile(uint8_t Type, const uint8_t* Input, uint32_t InputSize, uint8_t* Pixels, uint32_t Pitch, uint32_t Width, uint32_t Height)
+{
+	uint8_t Data[TILEHASH_SIZE * TILEHASH_SIZE * 3];
+
+	if (Type == OVERLAY_PALETTE)
+	{
+		if (InputSize < 1)
+		{
+			return false;
+		}
+		uint32_t Count = Input[0] + 1;
+		if (InputSize < 1 + 3 * Count)
+		{
+			return false;
+		}
+		const uint8_t* Palette = Input + 1;
+
+		uint32_t Bits = Overlay__IndexBits(Count);
+		uint32_t RowSize = (Width * Bits + 7) / 8;
+		if (!Overlay_LzDecompress(Input + 1 + 3 * Count, InputSize - 1 - 3 * Count, Data, RowSize * Height))
+		{
+			return false;
+		}
+
+		for (uint32_t Y = 0; Y < Height; Y++)
+		{
+			const uint8_t* Packed = Data + Y * RowSize;
+			uint8_t* Row = Pixels + (size_t)Y * Pitch;
+			for (uint32_t X = 0; X < Width; X++)
+			{
+				uint32_t Bit = X * Bits;
+				uint32_t Index = (Packed[Bit / 8] >> (8 - Bits - Bit % 8)) & ((1 << Bits) - 1);
+				if (Index >= Count)
+				{
+					return false;
+				}
+				Row[X * 4 + 0] = Palette[Index * 3 + 0];
+				Row[X * 4 + 1] = Palette[Index * 3 + 1];
+				Row[X * 4 + 2] = Palette[Index * 3 + 2];
+				Row[X * 4 + 3] = 255;
+			}
+		}
+		return true;
+	}
+	else if (Type == OVERLAY_COLOR)
+	{
+		if (!Overlay_LzDecompress(Input, InputSize, Data, Width * Height * 3))
+		{
+			return false;
+		}
+
+		const uint8_t* Residual = Data;
+		for (uint32_t Y = 0; Y < Height; Y++)
+		{
+			uint8_t* Row = Pixels + (size_t)Y * Pitch;
+			const uint8_t* Above = Y ? Row - Pitch : NULL;
+			for (uint32_t X = 0; X < Width; X++)
+			{
+				uint8_t* Pixel = Row + X * 4;
+				const uint8_t* Prediction = X ? Pixel - 4 : Above;
+
+				uint8_t PB = 0, PG = 0, PR = 0;
+				if (Prediction)
+				{
+					PB = Prediction[0];
+					PG = Prediction[1];
+					PR = Prediction[2];
+				}
+
+				uint8_t DG = Residual[1];
+				Pixel[0] = (uint8_t)(Residual[0] + DG + PB);
+				Pixel[1] = (uint8_t)(DG + PG);
+				Pixel[2] = (uint8_t)(Residual[2] + DG + PR);
+				Pixel[3] = 255;
+				Residual += 3;
+			}
+		}
+		return true;
+	}
+
+	return false;
+}
+
+static void Overlay_MoveTiles(uint8_t* Tiles, uint32_t TilesX, uint32_t TilesY, uint32_t Width, uint32_t Height, const TileHashRect* Rect, int32_t DX, int32_t DY, uint8_t Keep)
+{
+	// without copy of tiles before move, every tile touching region loses Keep
+	uint8_t* Before = malloc(TilesX * TilesY);
+	if (Before)
+	{
+		memcpy(Before, Tiles, TilesX * TilesY);
+	}
+
+	for (uint32_t TileY = Rect->Top / TILEHASH_SIZE; TileY * TILEHASH_SIZE < (uint32_t)Rect->Bottom; TileY++)
+	{
+		for (uint32_t TileX = Rect->Left / TILEHASH_SIZE; TileX * TILEHASH_SIZE < (uint32_t)Rect->Right; TileX++)
+		{
+			TileHashRect Tile = Overlay__Tile(TileX, TileY, Width, Height);
+
+			uint8_t Value = 0;
+			if (Before && Overlay__Contains(Rect, &Tile))
+			{
+				Value = Keep;
+				for (uint32_t SourceY = (uint32_t)(Tile.Top - DY) / TILEHASH_SIZE; SourceY <= (uint32_t)(Tile.Bottom - 1 - DY) / TILEHASH_SIZE; SourceY++)
+				{
+					for (uint32_t SourceX = (uint32_t)(Tile.Left - DX) / TILEHASH_SIZE; SourceX <= (uint32_t)(Tile.Right - 1 - DX) / TILEHASH_SIZE; SourceX++)
+					{
+						if (Before[SourceY * TilesX + SourceX] != Keep)
+						{
+							Value = 0;
+						}
+					}
+				}
+			}
+			Tiles[TileY * TilesX + TileX] = Value;
+		}
+	}
+
+	free(Before);
+}
+
+//
+// sharer
+
+static bool Overlay_CreateSharer(OverlaySharer* Sharer, uint32_t Width, uint32_t Height)
+{
+	memset(Sharer, 0, sizeof(*Sharer));
+	Sharer->Width = Width;
+	Sharer->Height = Height;
+	Sharer->TilesX = (Width + TILEHASH_SIZE - 1) / TILEHASH_SIZE;
+	Sharer->TilesY = (Height + TILEHASH_SIZE - 1) / TILEHASH_SIZE;
+
+	// records for clearing every tile, and tiles up to budget with last one going over it
+	uint32_t TileCount = Sharer->TilesX * Sharer->TilesY;
+	Sharer->SlotSize = TileCount * OVERLAY_CLEAR_RECORD + OVERLAY_COPY_RECORD + OVERLAY_FRAME_TILES * OVERLAY_RECORD + OVERLAY_FRAME_BUDGET + OVERLAY_MAX_TILE;
+
+	Sharer->State = calloc(TileCount, 1);
+	Sharer->Age = calloc(TileCount, 1);
+	Sharer->Data = malloc((size_t)OVERLAY_QUEUE_SIZE * Sharer->SlotSize);
+	if (!Sharer->State || !Sharer->Age || !Sharer->Data)
+	{
+		Overlay_ReleaseSharer(Sharer);
+		return false;
+	}
+	return true;
+}
+
+static void Overlay_ReleaseSharer(OverlaySharer* Sharer)
+{
+	free(Sharer->State);
+	free(Sharer->Age);
+	free(Sharer->Data);
+	memset(Sharer, 0, sizeof(*Sharer));
+}
+
+// records for every tile that viewer still has with old content
+static uint32_t Overlay__QueueClears(OverlaySharer* Sharer, uint8_t* Data)
+{
+	uint32_t TileCount = Sharer->TilesX * Sharer->TilesY;
+	uint32_t Size = 0;
+
+	for (uint32_t Index = 0; Index < TileCount; Index++)
+	{
+		if (Sharer->State[Index] == OVERLAY_TILE_CHANGED)
+		{
+			uint16_t Tile = (uint16_t)Index;
+			Data[Size] = OVERLAY_CLEAR;
+			memcpy(Data + Size + 1, &Tile, sizeof(Tile));
+			Size += OVERLAY_CLEAR_RECORD;
+
+			Sharer->State[Index] = OVERLAY_TILE_UNSENT;
+		}
+	}
+	return Size;
+}
+
+// viewer moves its tiles together with scrolled region, so only newly exposed tiles are sent again. Tiles changed
+// in earlier frames are cleared before move, as viewer has their old content. Records start next queued frame
+static void Overlay__QueueCopy(OverlaySharer* Sharer, const TileHashRect* Moved, int32_t DX, int32_t DY)
+{
+	uint8_t* Data = Sharer->Data + Sharer->Write % OVERLAY_QUEUE_SIZE * Sharer->SlotSize;
+	uint32_t Size = Overlay__QueueClears(Sharer, Data);
+
+	uint16_t Rect[4] = { (uint16_t)Moved->Left, (uint16_t)Moved->Top, (uint16_t)Moved->Right, (uint16_t)Moved->Bottom };
+	int16_t Offset[2] = { (int16_t)DX, (int16_t)DY };
+	Data[Size] = OVERLAY_COPY;
+	memcpy(Data + Size + 1, Rect, sizeof(Rect));
+	memcpy(Data + Size + 1 + sizeof(Rect), Offset, sizeof(Offset));
+	Size += OVERLAY_COPY_RECORD;
+
+	Overlay_MoveTiles(Sharer->State, Sharer->TilesX, Sharer->TilesY, Sharer->Width, Sharer->Height, Moved, DX, DY, OVERLAY_TILE_SENT);
+	Sharer->Prefix = Size;
+}
+
+static void Overlay_SharerChanges(OverlaySharer* Sharer, const uint32_t* Dirty, uint32_t DirtyPitch, const TileHashRect* Moved, int32_t DX, int32_t DY)
+{
+	// frame with scroll has changes, so it is always queued after this
+	bool Move = Moved && Sharer->Write - Sharer->Read != OVERLAY_QUEUE_SIZE;
+	if (Move)
+	{
+		Overlay__QueueCopy(Sharer, Moved, DX, DY);
+	}
+
+	for (uint32_t TileY = 0; TileY < Sharer->TilesY; TileY++)
+	{
+		const uint32_t* RowBits = Dirty + TileY * DirtyPitch;
+		for (uint32_t TileX = 0; TileX < Sharer->TilesX; TileX++)
+		{
+			uint32_t Index = TileY * Sharer->TilesX + TileX;
+			if (RowBits[TileX / 32] & (1u << (TileX % 32)))
+			{
+				uint8_t State = Sharer->State[Index];
+				if (Move && State == OVERLAY_TILE_SENT)
+				{
+					// tile moved into place on viewer
+					TileHashRect Tile = Overlay__Tile(TileX, TileY, Sharer->Width, Sharer->Height);
+					if (Overlay__Contains(Moved, &Tile))
+					{
+						Sharer->Age[Index] = 0;
+						continue;
+					}
+				}
+				Sharer->State[Index] = State == OVERLAY_TILE_SENT || State == OVERLAY_TILE_CHANGED ? OVERLAY_TILE_CHANGED : OVERLAY_TILE_UNSENT;
+				Sharer->Age[Index] = 0;
+			}
+			else if (Sharer->Age[Index] != UINT8_MAX)
+			{
+				Sharer->Age[Index]++;
+			}
+		}
+	}
+}
+
+static bool Overlay_SharerPending(const OverlaySharer* Sharer)
+{
+	uint32_t TileCount = Sharer->TilesX * Sharer->TilesY;
+	for (uint32_t Index = 0; Index < TileCount; Index++)
+	{
+		uint8_t State = Sharer->State[Index];
+		if (State == OVERLAY_TILE_CHANGED || (State == OVERLAY_TILE_UNSENT && Sharer->Age[Index] >= OVERLAY_STABLE_FRAMES))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+static void Overlay_SharerQueueFrame(OverlaySharer* Sharer, int64_t Time, const uint8_t* Pixels, uint32_t Pitch)
+{
+	// when encoder is behind, changed tiles stay marked until next frame
+	if (Sharer->Write - Sharer->Read == OVERLAY_QUEUE_SIZE)
+	{
+		return;
+	}
+
+	uint32_t TileCount = Sharer->TilesX * Sharer->TilesY;
+
+	uint8_t* Data = Sharer->Data + Sharer->Write % OVERLAY_QUEUE_SIZE * Sharer->SlotSize;
+	uint32_t Size = Sharer->Prefix;
+	Sharer->Prefix = 0;
+
+	// clears go first, tile that changed & is stable again in same frame is replaced in right order
+	Size += Overlay__QueueClears(Sharer, Data + Size);
+
+	uint32_t Attempts = 0;
+	uint32_t TileBytes = 0;
+	for (uint32_t Index = 0; Index < TileCount && Attempts < OVERLAY_FRAME_TILES && TileBytes < OVERLAY_FRAME_BUDGET; Index++)
+	{
+		if (Sharer->State[Index] != OVERLAY_TILE_UNSENT || Sharer->Age[Index] < OVERLAY_STABLE_FRAMES)
+		{
+			continue;
+		}
+		Attempts++;
+
+		uint32_t X = Index % Sharer->TilesX * TILEHASH_SIZE;
+		uint32_t Y = Index / Sharer->TilesX * TILEHASH_SIZE;
+		uint32_t Width = Overlay__Min(TILEHASH_SIZE, Sharer->Width - X);
+		uint32_t Height = Overlay__Min(TILEHASH_SIZE, Sharer->Height - Y);
+
+		uint8_t Type;
+		uint32_t TileSize = Overlay_EncodeTile(Pixels + (size_t)Y * Pitch + X * 4, Pitch, Width, Height, Data + Size + OVERLAY_RECORD, OVERLAY_MAX_TILE, &Type);
+		if (TileSize == 0)
+		{
+			Sharer->State[Index] = OVERLAY_TILE_REJECTED;
+			continue;
+		}
+
+		uint16_t Tile = (uint16_t)Index;
+		uint16_t TileSize16 = (uint16_t)TileSize;
+		Data[Size] = Type;
+		memcpy(Data + Size + 1, &Tile, sizeof(Tile));
+		memcpy(Data + Size + 3, &TileSize16, sizeof(TileSize16));
+		Size += OVERLAY_RECORD + TileSize;
+		TileBytes += TileSize;
+
+		Sharer->State[Index] = OVERLAY_TILE_SENT;
+	}
+
+	if (Size != 0)
+	{
+		OverlayFrame* Frame = &Sharer->Queue[Sharer->Write++ % OVERLAY_QUEUE_SIZE];
+		Frame->Time = Time;
+		Frame->Size = Size;
+	}
+}
+
+static void Overlay_SharerKeyFrame(OverlaySharer* Sharer)
+{
+	uint32_t TileCount = Sharer->TilesX * Sharer->TilesY;
+	for (uint32_t Index = 0; Index < TileCount; Index++)
+	{
+		uint8_t State = Sharer->State[Index];
+		if (State == OVERLAY_TILE_SENT || State == OVERLAY_TILE_CHANGED)
+		{
+			Sharer->State[Index] = OVERLAY_TILE_UNSENT;
+		}
+	}
+	Sharer->Read = Sharer->Write;
+}
+
+// bytes of records in queued frames up to Time, End is first frame after them
+static uint32_t Overlay__RecordSize(const OverlaySharer* Sharer, int64_t Time, uint32_t* End)
+{
+	uint32_t Size = 0;
+	*End = Sharer->Read;
+	while (*End != Sharer->Write && Sharer->Queue[*End % OVERLAY_QUEUE_SIZE].Time <= Time)
+	{
+		Size += Sharer->Queue[(*End)++ % OVERLAY_QUEUE_SIZE].Size;
+	}
+	return Size;
+}
+
+static uint32_t Overlay_SharerSeiSize(const OverlaySharer* Sharer, int64_t Time)
+{
+	uint32_t End;
+	uint32_t RecordSize = Overlay__RecordSize(Sharer, Time, &End);
+	if (End == Sharer->Read)
+	{
+		return 0;
+	}
+
+	// user_data_unregistered payload, escaping adds at most one byte for every two
+	uint32_t PayloadSize = sizeof(Overlay_Uuid) + OVERLAY_HEADER + RecordSize;
+	uint32_t SeiSize = 1 + PayloadSize / 255 + 1 + PayloadSize + 1;
+	return 5 + SeiSize + SeiSize / 2 + 1;
+}
+
+typedef struct
+{
+	uint8_t* Data;
+	uint32_t Size;
+	uint32_t Zeros;		// zero bytes before Data + Size
+}
+Overlay__NalWriter;
+
+// 00 00 followed by 00, 01, 02 or 03 is escaped with 03
+static void Overlay__NalWrite(Overlay__NalWriter* Writer, const uint8_t* Data, uint32_t Size)
+{
+	for (uint32_t Index = 0; Index < Size; Index++)
+	{
+		uint8_t Byte = Data[Index];
+		if (Writer->Zeros >= 2 && Byte <= 3)
+		{
+			Writer->Data[Writer->Size++] = 3;
+			Writer->Zeros = 0;
+		}
+		Writer->Data[Writer->Size++] = Byte;
+		Writer->Zeros = Byte == 0 ? Writer->Zeros + 1 : 0;
+	}
+}
+
+static uint32_t Overlay_SharerWriteSei(OverlaySharer* Sharer, int64_t Time, uint8_t* Output)
+{
+	uint32_t End;
+	uint32_t PayloadSize = sizeof(Overlay_Uuid) + OVERLAY_HEADER + Overlay__RecordSize(Sharer, Time, &End);
+
+	// start code & nal_unit_type 6 are not escaped
+	static const uint8_t NalStart[] = { 0, 0, 0, 1, 6 };
+	memcpy(Output, NalStart, sizeof(NalStart));
+
+	Overlay__NalWriter Writer = { .Data = Output, .Size = sizeof(NalStart) };
+	{
+		uint8_t Byte = 5; // payloadType
+		Overlay__NalWrite(&Writer, &Byte, 1);
+
+		uint32_t Left = PayloadSize;
+		for (Byte = 255; Left >= 255; Left -= 255)
+		{
+			Overlay__NalWrite(&Writer, &Byte, 1);
+		}
+		Byte = (uint8_t)Left;
+		Overlay__NalWrite(&Writer, &Byte, 1);
+	}
+	Overlay__NalWrite(&Writer, Overlay_Uuid, sizeof(Overlay_Uuid));
+	{
+		uint16_t Size[2] = { (uint16_t)Sharer->Width, (uint16_t)Sharer->Height };
+		Overlay__NalWrite(&Writer, (const uint8_t*)Size, sizeof(Size));
+	}
+	for (; Sharer->Read != End; Sharer->Read++)
+	{
+		uint32_t Slot = Sharer->Read % OVERLAY_QUEUE_SIZE;
+		Overlay__NalWrite(&Writer, Sharer->Data + Slot * Sharer->SlotSize, Sharer->Queue[Slot].Size);
+	}
+	{
+		uint8_t Trailing = 0x80; // rbsp_trailing_bits
+		Overlay__NalWrite(&Writer, &Trailing, 1);
+	}
+	return Writer.Size;
+}
+
+//
+// viewer
+
+static bool Overlay_CreateLayer(OverlayLayer* Layer, uint32_t Width, uint32_t Height)
+{
+	memset(Layer, 0, sizeof(*Layer));
+	Layer->Width = Width;
+	Layer->Height = Height;
+	Layer->TilesX = (Width + TILEHASH_SIZE - 1) / TILEHASH_SIZE;
+	Layer->TilesY = (Height + TILEHASH_SIZE - 1) / TILEHASH_SIZE;
+
+	Layer->Pixels = malloc((size_t)Width * Height * 4);
+	Layer->Valid = calloc(Layer->TilesX * Layer->TilesY, 1);
+	if (!Layer->Pixels || !Layer->Valid)
+	{
+		Overlay_ReleaseLayer(Layer);
+		return false;
+	}
+	return true;
+}
+
+static void Overlay_ReleaseLayer(OverlayLayer* Layer)
+{
+	free(Layer->Pixels);
+	free(Layer->Valid);
+	memset(Layer, 0, sizeof(*Layer));
+}
+
+static void Overlay_ResetLayer(OverlayLayer* Layer)
+{
+	if (Layer->Valid)
+	{
+		memset(Layer->Valid, 0, Layer->TilesX * Layer->TilesY);
+	}
+	Layer->Count = 0;
+}
+
+static bool Overlay_ParseSei(const uint8_t* Nal, uint32_t NalSize, uint8_t* Payload, const uint8_t** Records, uint32_t* RecordsSize, uint32_t* Width, uint32_t* Height)
+{
+	// remove emulation prevention bytes, skip nal_unit_type & payloadType
+	uint32_t Size = 0;
+	uint32_t Zeros = 0;
+	for (uint32_t Index = 2; Index < NalSize; Index++)
+	{
+		uint8_t Byte = Nal[Index];
+		if (Zeros >= 2 && Byte == 3)
+		{
+			Zeros = 0;
+			continue;
+		}
+		Payload[Size++] = Byte;
+		Zeros = Byte == 0 ? Zeros + 1 : 0;
+	}
+
+	uint32_t Pos = 0;
+	uint32_t PayloadSize = 0;
+	while (Pos < Size && Payload[Pos] == 255)
+	{
+		PayloadSize += Payload[Pos++];
+	}
+	if (Pos < Size)
+	{
+		PayloadSize += Payload[Pos++];
+	}
+
+	const uint8_t* Data = Payload + Pos;
+	uint32_t DataSize = Overlay__Min(PayloadSize, Size - Pos);
+	if (DataSize < sizeof(Overlay_Uuid) + OVERLAY_HEADER || memcmp(Data, Overlay_Uuid, sizeof(Overlay_Uuid)) != 0)
+	{
+		return false;
+	}
+	Data += sizeof(Overlay_Uuid);
+
+	uint16_t FrameWidth, FrameHeight;
+	memcpy(&FrameWidth, Data + 0, sizeof(FrameWidth));
+	memcpy(&FrameHeight, Data + 2, sizeof(FrameHeight));
+	if (FrameWidth == 0 || FrameHeight == 0 || FrameWidth > OVERLAY_MAX_SIZE || FrameHeight > OVERLAY_MAX_SIZE)
+	{
+		return false;
+	}
+
+	*Records = Data + OVERLAY_HEADER;
+	*RecordsSize = DataSize - sizeof(Overlay_Uuid) - OVERLAY_HEADER;
+	*Width = FrameWidth;
+	*Height = FrameHeight;
+	return true;
+}
+
+// Rect is destination from network, returns false when it does not fit in layer
+static bool Overlay__Move(OverlayLayer* Layer, const uint16_t* Rect, int32_t DX, int32_t DY, Overlay_UpdateProc* Update, void* Context)
+{
+	TileHashRect Target = { Rect[0], Rect[1], Rect[2], Rect[3] };
+	TileHashRect Source = { Target.Left - DX, Target.Top - DY, Target.Right - DX, Target.Bottom - DY };
+	TileHashRect Frame = { 0, 0, (int32_t)Layer->Width, (int32_t)Layer->Height };
+
+	if (Target.Left >= Target.Right || Target.Top >= Target.Bottom || !Overlay__Contains(&Frame, &Target) || !Overlay__Contains(&Frame, &Source))
+	{
+		return false;
+	}
+
+	uint32_t Pitch = Layer->Width * 4;
+	uint32_t Width = Target.Right - Target.Left;
+	uint32_t Height = Target.Bottom - Target.Top;
+
+	// rows are moved in order that reads every source row before it is overwritten
+	for (uint32_t Row = 0; Row < Height; Row++)
+	{
+		uint32_t Y = DY > 0 ? Target.Bottom - 1 - Row : Target.Top + Row;
+		memmove(Layer->Pixels + (size_t)Y * Pitch + Target.Left * 4, Layer->Pixels + (size_t)(Y - DY) * Pitch + Source.Left * 4, Width * 4);
+	}
+
+	Overlay_MoveTiles(Layer->Valid, Layer->TilesX, Layer->TilesY, Layer->Width, Layer->Height, &Target, DX, DY, 1);
+
+	uint32_t TileCount = Layer->TilesX * Layer->TilesY;
+	Layer->Count = 0;
+	for (uint32_t Index = 0; Index < TileCount; Index++)
+	{
+		Layer->Count += Layer->Valid[Index];
+	}
+
+	Update(Context, Target.Left, Target.Top, Width, Height);
+	return true;
+}
+
+static void Overlay_ApplyRecords(OverlayLayer* Layer, const uint8_t* Records, uint32_t Size, Overlay_UpdateProc* Update, void* Context)
+{
+	const uint8_t* Data = Records;
+	const uint8_t* End = Records + Size;
+
+	uint32_t Pitch = Layer->Width * 4;
+	uint32_t TileCount = Layer->TilesX * Layer->TilesY;
+
+	while (Data != End)
+	{
+		uint8_t Type = *Data++;
+
+		if (Type == OVERLAY_COPY)
+		{
+			uint16_t Rect[4];
+			int16_t Offset[2];
+			if ((size_t)(End - Data) < sizeof(Rect) + sizeof(Offset))
+			{
+				break;
+			}
+			memcpy(Rect, Data, sizeof(Rect));
+			memcpy(Offset, Data + sizeof(Rect), sizeof(Offset));
+			Data += sizeof(Rect) + sizeof(Offset);
+
+			if (!Overlay__Move(Layer, Rect, Offset[0], Offset[1], Update, Context))
+			{
+				break;
+			}
+			continue;
+		}
+
+		uint16_t Index;
+		if ((size_t)(End - Data) < sizeof(Index))
+		{
+			break;
+		}
+		memcpy(&Index, Data, sizeof(Index));
+		Data += sizeof(Index);
+
+		if (Index >= TileCount)
+		{
+			break;
+		}
+
+		if (Type == OVERLAY_CLEAR)
+		{
+			Layer->Count -= Layer->Valid[Index];
+			Layer->Valid[Index] = 0;
+			continue;
+		}
+
+		uint16_t TileSize;
+		if ((size_t)(End - Data) < sizeof(TileSize))
+		{
+			break;
+		}
+		memcpy(&TileSize, Data, sizeof(TileSize));
+		Data += sizeof(TileSize);
+		if (End - Data < TileSize)
+		{
+			break;
+		}
+
+		uint32_t X = Index % Layer->TilesX * TILEHASH_SIZE;
+		uint32_t Y = Index / Layer->TilesX * TILEHASH_SIZE;
+		uint32_t TileWidth = Overlay__Min(TILEHASH_SIZE, Layer->Width - X);
+		uint32_t TileHeight = Overlay__Min(TILEHASH_SIZE, Layer->Height - Y);
+
+		uint8_t Valid = Overlay_DecodeTile(Type, Data, TileSize, Layer->Pixels + (size_t)Y * Pitch + X * 4, Pitch, TileWidth, TileHeight);
+		Data += TileSize;
+
+		Layer->Count += Valid - Layer->Valid[Index];
+		Layer->Valid[Index] = Valid;
+
+		if (Valid)
+		{
+			Update(Context, X, Y, TileWidth, TileHeight);
+		}
+	}
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// interface
+
+// encode size & viewport from viewer's window, without OS dependencies
+//
+// sharer encodes largest size with captured frame's aspect ratio that fits viewer's window, never larger than captured
+// frame and never narrower than VIEW_MIN_WIDTH. Viewport is part of desktop around center given in 1/65536 units of
+// desktop size, never smaller than VIEW_VIEWPORT_MIN_WIDTH x VIEW_VIEWPORT_MIN_HEIGHT and always fully inside desktop.
+// Sharer & viewer both clamp viewport same way, so they agree on it without sending rectangle back. NV12 needs even
+// size, so every width & height is even and at least VIEW_MIN_HEIGHT, as long as desktop itself has that many pixels.
+
+enum
+{
+	VIEW_MIN_WIDTH				= 640,		// pixels, smallest encode width
+	VIEW_MIN_HEIGHT				= 2,		// pixels, smallest encode height, very wide capture can scale below it
+	VIEW_VIEWPORT_MIN_WIDTH		= 640,		// pixels, smallest encoded part of desktop
+	VIEW_VIEWPORT_MIN_HEIGHT	= 360,
+};
+
+typedef struct
+{
+	int32_t Left;
+	int32_t Top;
+	int32_t Right;
+	int32_t Bottom;
+}
+ViewRect;
+
+// Width & Height is captured size, then reduced to fit ViewWidth x ViewHeight, unchanged when view size is 0
+static void View_GetEncodeSize(uint32_t ViewWidth, uint32_t ViewHeight, uint32_t* Width, uint32_t* Height);
+
+// viewport of Width x Height at CenterX & CenterY, clamped to desktop
+static void View_GetViewport(uint32_t CenterX, uint32_t CenterY, uint32_t Width, uint32_t Height, uint32_t DesktopWidth, uint32_t DesktopHeight, ViewRect* Rect);
+
+// even size of captured texture, window content can be smaller than texture until frame pool is recreated so its
+// Window rectangle limits it too, NULL for monitor. Returns false when nothing is left to encode
+static bool View_GetCaptureSize(uint32_t TextureWidth, uint32_t TextureHeight, const ViewRect* Window, uint32_t* Width, uint32_t* Height);
+
+// viewport scaled from desktop to Width x Height thumbnail (both at least 1), at least one pixel and always fully
+// inside of thumbnail
+static void View_GetOutline(const ViewRect* Viewport, uint32_t DesktopWidth, uint32_t DesktopHeight, uint32_t Width, uint32_t Height, ViewRect* Outline);
+
+// implementation
+
+static uint32_t View__Min(uint32_t A, uint32_t B)
+{
+	return A < B ? A : B;
+}
+
+static uint32_t View__Max(uint32_t A, uint32_t B)
+{
+	return A > B ? A : B;
+}
+
+static int32_t View__Clamp(int32_t Value, int32_t Low, int32_t High)
+{
+	return Value < Low ? Low : Value > High ? High : Value;
+}
+
+// rounded, same as MulDiv
+static int32_t View__Scale(int32_t Value, uint32_t From, uint32_t To)
+{
+	return From == 0 ? 0 : (int32_t)(((int64_t)Value * To + From / 2) / From);
+}
+
+static void View_GetEncodeSize(uint32_t ViewWidth, uint32_t ViewHeight, uint32_t* Width, uint32_t* Height)
+{
+	uint32_t CaptureWidth = *Width;
+	uint32_t CaptureHeight = *Height;
+	if (ViewWidth == 0 || ViewHeight == 0 || CaptureWidth == 0 || CaptureHeight == 0)
+	{
+		return;
+	}
+
+	// viewer scales frame to fit window with same aspect ratio
+	uint32_t FitWidth = ViewWidth;
+	if ((uint64_t)ViewWidth * CaptureHeight > (uint64_t)ViewHeight * CaptureWidth)
+	{
+		FitWidth = (uint32_t)((uint64_t)ViewHeight * CaptureWidth / CaptureHeight);
+	}
+	FitWidth = View__Max(FitWidth, VIEW_MIN_WIDTH);
+
+	if (FitWidth < CaptureWidth)
+	{
+		// very wide capture would round height down to 0, encoder needs at least one NV12 row pair
+		uint32_t FitHeight = (uint32_t)((uint64_t)(FitWidth & ~1) * CaptureHeight / CaptureWidth) & ~1;
+		*Width = FitWidth & ~1;
+		*Height = View__Min(View__Max(FitHeight, VIEW_MIN_HEIGHT), CaptureHeight & ~1);
+	}
+}
+
+static void View_GetViewport(uint32_t CenterX, uint32_t CenterY, uint32_t Width, uint32_t Height, uint32_t DesktopWidth, uint32_t DesktopHeight, ViewRect* Rect)
+{
+	Width = View__Min(View__Max(Width, VIEW_VIEWPORT_MIN_WIDTH), DesktopWidth) & ~1;
+	Height = View__Min(View__Max(Height, VIEW_VIEWPORT_MIN_HEIGHT), DesktopHeight) & ~1;
+
+	int32_t Left = (int32_t)(((uint64_t)CenterX * DesktopWidth) >> 16) - (int32_t)(Width / 2);
+	int32_t Top = (int32_t)(((uint64_t)CenterY * DesktopHeight) >> 16) - (int32_t)(Height / 2);
+	Left = View__Clamp(Left, 0, (int32_t)(DesktopWidth - Width));
+	Top = View__Clamp(Top, 0, (int32_t)(DesktopHeight - Height));
+
+	*Rect = (ViewRect){ Left, Top, Left + (int32_t)Width, Top + (int32_t)Height };
+}
+
+static void View_GetOutline(const ViewRect* Viewport, uint32_t DesktopWidth, uint32_t DesktopHeight, uint32_t Width, uint32_t Height, ViewRect* Outline)
+{
+	// viewport that rounds to nothing or is outside of thumbnail still gets outline on its edge
+	int32_t Left = View__Clamp(View__Scale(Viewport->Left, DesktopWidth, Width), 0, (int32_t)Width - 1);
+	int32_t Top = View__Clamp(View__Scale(Viewport->Top, DesktopHeight, Height), 0, (int32_t)Height - 1);
+	int32_t Right = View__Clamp(View__Scale(Viewport->Right, DesktopWidth, Width), Left + 1, (int32_t)Width);
+	int32_t Bottom = View__Clamp(View__Scale(Viewport->Bottom, DesktopHeight, Height), Top + 1, (int32_t)Height);
+
+	*Outline = (ViewRect){ Left, Top, Right, Bottom };
+}
+
+static bool View_GetCaptureSize(uint32_t TextureWidth, uint32_t TextureHeight, const ViewRect* Window, uint32_t* Width, uint32_t* Height)
+{
+	uint32_t CaptureWidth = TextureWidth;
+	uint32_t CaptureHeight = TextureHeight;
+	if (Window)
+	{
+		// minimized window reports empty or inverted rectangle
+		CaptureWidth = Window->Right > Window->Left ? View__Min(CaptureWidth, (uint32_t)(Window->Right - Window->Left)) : 0;
+		CaptureHeight = Window->Bottom > Window->Top ? View__Min(CaptureHeight, (uint32_t)(Window->Bottom - Window->Top)) : 0;
+	}
+
+	*Width = CaptureWidth & ~1;
+	*Height = CaptureHeight & ~1;
+	return *Width != 0 && *Height != 0;
+}
@@ -23,26 +23,91 @@ typedef struct {
 DERPNET_API void DerpNet_CreateNewKey(DerpKey* UserSecret);
 DERPNET_API void DerpNet_GetPublicKey(const DerpKey* UserSecret, DerpKey* UserPublic);
 
+// called from DerpNet_Recv when server reports that peer is connected or gone
+typedef void DerpNet_PeerCallback(const DerpKey* PeerKey, bool Present, void* UserData);
+
+#ifndef DERPNET_RECV_SENDERS
+#define DERPNET_RECV_SENDERS 8 // replay windows DerpNet_Recv keeps, one per sender key
+#endif
+
+// sliding window over nonces of one sender, nonce is 16 bytes prefix followed by 64-bit little endian counter
+// zero initialized window takes prefix of first nonce, after that only same prefix with new counters is accepted
+typedef struct {
+	uint8_t Prefix[16];
+	uint64_t Counter;            // highest counter accepted
+	uint64_t Window;             // bit N is set when Counter - N was accepted, 0 until first nonce
+} DerpNet_Replay;
+
+typedef struct {
+	uint8_t PublicKey[32];
+	uint64_t LastTime;           // usec, when packet from sender was last accepted
+	uint64_t Accepted;           // packets accepted from sender
+	DerpNet_Replay Replay;
+} DerpNet_RecvSender;
+
 typedef struct {
 	uintptr_t Socket;
 	void* SocketEvent;
-	void* CredHandle[2];
 	void* CtxHandle[2];
+	void* TlsLock;               // SRWLOCK, because DerpNet_Recv may run on different thread than sending
 	uint8_t UserPrivateKey[32];
 	uint8_t LastPublicKey[32];
 	uint8_t LastSharedKey[32];
+	uint8_t LastRecvPublicKey[32];
+	uint8_t LastRecvSharedKey[32];
+	uint8_t SendNonce[16];       // random nonce prefix, followed by 64-bit counter, both kept while same user key is used
+	uint64_t SendCounter;
+	DerpNet_RecvSender RecvSenders[DERPNET_RECV_SENDERS];
+	uint64_t RecvSequence;       // counter of last packet returned from DerpNet_Recv
+	size_t TotalReplays;         // packets dropped by replay window
+	uint32_t MaxThreads;         // for sealing & unsealing large data, 0 means one per CPU core, 1 disables parallelism
+	bool CorkDisabled;           // every send is flushed right away, DerpNet_Cork & DerpNet_SendChunks do not batch
 	size_t BufferSize;
 	size_t BufferReceived;
 	size_t LastFrameSize;
 	size_t TotalReceived;
 	size_t TotalSent;
+	size_t TotalRecords;  // TLS records sent
+	size_t TotalSends;    // send syscalls
+	uint32_t ReadTimeout; // msec, 0 means waiting reads block forever
+	uint32_t DnsTime;     // how long each DerpNet_Open phase took, in microseconds
+	uint32_t TcpTime;
+	uint32_t TlsTime;
+	uint32_t DerpTime;
+	bool TlsResumed;      // abbreviated TLS handshake was done with cached session from previous connection to same server
+	char MeshKey[65];                   // optional hex string, set before opening to be trusted mesh peer of server
+	DerpNet_PeerCallback* PeerCallback; // optional
+	void* PeerUserData;
+	uint32_t StreamHeader;  // TLS record sizes, queried once after handshake
+	uint32_t StreamTrailer;
+	uint32_t StreamMaxMessage;
+	bool Corked;
+	size_t WriteCount;      // queued records, last one is partially filled
+	size_t WriteSize;       // plaintext bytes in last queued record
+	uint8_t WriteBuffer[4][16384 + 512];
 	uint8_t Buffer[1 << 16];
 } DerpNet;
 
 // use DERP server hostname from https://login.tailscale.com/derpmap/default
+// resolves A & AAAA records in parallel and races connections to all addresses (RFC 8305)
 DERPNET_API bool DerpNet_Open(DerpNet* Net, const char* DerpServer, const DerpKey* UserSecret);
 DERPNET_API void DerpNet_Close(DerpNet* Net);
 
+// same as DerpNet_Open, but starts connecting to known numeric IPv4/IPv6 addresses without waiting for DNS
+// DerpServer is still resolved in parallel as fallback, and is used for TLS certificate validation
+// Port is DERPPort from DerpMap, 0 means default port - 443, or 80 with DERPNET_USE_PLAIN_HTTP
+DERPNET_API bool DerpNet_OpenEx(DerpNet* Net, const char* DerpServer, uint16_t Port, const char* const* Addresses, size_t AddressCount, const DerpKey* UserSecret);
+
+// called from background thread when DerpNet_OpenAsync finishes
+typedef void DerpNet_OpenCallback(DerpNet* Net, bool Connected, void* UserData);
+
+// same as DerpNet_OpenEx, but runs in thread pool, DerpServer, Addresses and UserSecret are copied
+// Net must not be used until Callback is called, returns false if work cannot be queued
+DERPNET_API bool DerpNet_OpenAsync(DerpNet* Net, const char* DerpServer, uint16_t Port, const char* const* Addresses, size_t AddressCount, const DerpKey* UserSecret, DerpNet_OpenCallback* Callback, void* UserData);
+
+// DerpNet_Recv can be called from different thread than functions that send data, but each of
+// these two groups must be used only by one thread at a time
+
 // returns 1 when received data from other user, pointer is valid till next call
 // returns -1 if disconnected from server
 // returns 0 if no new info is available to read
@@ -52,9 +117,59 @@ DERPNET_API int DerpNet_Recv(DerpNet* Net, DerpKey* ReceivedUserPublicKey, uint8
 // returns false if disconnected
 DERPNET_API bool DerpNet_Send(DerpNet* Net, const DerpKey* TargetUserPublicKey, const void* Data, size_t DataSize);
 
-// use this if you're an expert!
+// each chunk is sent as separate packet with Prefix bytes followed by Data bytes
+typedef struct {
+	const void* Prefix;
+	size_t PrefixSize;
+	const void* Data;
+	size_t DataSize;
+} DerpNet_Chunk;
+
+// same as calling DerpNet_Send for each chunk, but chunks are sealed in parallel on thread pool
+// and written to connection in same order as given, returns false if disconnected
+DERPNET_API bool DerpNet_SendChunks(DerpNet* Net, const DerpKey* TargetUserPublicKey, const DerpNet_Chunk* Chunks, size_t ChunkCount);
+
+// after DerpNet_Cork sends are only queued, small messages are packed together into full TLS records
+// DerpNet_Uncork encrypts & sends everything queued with single syscall, returns false if disconnected
+// queue is flushed earlier if it fills up, so large amounts of data can be sent while corked
+DERPNET_API void DerpNet_Cork(DerpNet* Net);
+DERPNET_API bool DerpNet_Uncork(DerpNet* Net);
+
+// use this if you're an expert! Nonce must be prefix & counter like DerpNet_AcceptNonce expects, receiver keeps
+// first prefix it sees from sender key and drops packets with other prefixes or repeated counters as replays
 DERPNET_API bool DerpNet_SendEx(DerpNet* Net, const DerpKey* TargetUserPublicKey, const uint8_t SharedKey[32], const uint8_t Nonce[24], const void* Data, size_t DataSize);
 
+// same shared key that DerpNet_Send uses for TargetUserPublicKey, to use for encrypting data on other transports
+DERPNET_API void DerpNet_GetSharedKey(DerpNet* Net, const DerpKey* TargetUserPublicKey, uint8_t SharedKey[32]);
+
+// Output will contain 24 bytes nonce + 16 bytes auth + DataSize bytes of encrypted data
+// nonce is random, so receiver cannot tell replayed data from new one, use DerpNet_SealCounter when that matters
+DERPNET_API void DerpNet_Seal(const uint8_t SharedKey[32], uint8_t* Output, const void* Data, size_t DataSize);
+
+// same as DerpNet_Seal, but nonce is Prefix followed by Counter, which must grow with every call for same Prefix
+// receiver checks nonce from Output after DerpNet_Unseal succeeds with DerpNet_AcceptNonce
+DERPNET_API void DerpNet_SealCounter(const uint8_t SharedKey[32], uint8_t* Output, const uint8_t Prefix[16], uint64_t Counter, const void* Data, size_t DataSize);
+
+// returns false when nonce was already accepted, is too old, or has different prefix than earlier nonces
+// updates window, so call only for authentic data
+DERPNET_API bool DerpNet_AcceptNonce(DerpNet_Replay* Replay, const uint8_t Nonce[24]);
+
+// Input is output from DerpNet_Seal, InputSize - 40 bytes are decrypted to Output, which can be Input + 40
+// returns false if data is not authentic
+DERPNET_API bool DerpNet_Unseal(const uint8_t SharedKey[32], uint8_t* Output, const uint8_t* Input, size_t InputSize);
+
+// relay mesh, server accepts these only from clients with correct MeshKey
+// after WatchConns server reports all currently connected and future peers to PeerCallback
+DERPNET_API bool DerpNet_WatchConns(DerpNet* Net);
+
+// SealedData is packet as received by server from SourceUserPublicKey (24 bytes nonce + 16 bytes auth + data)
+// server delivers it to its local client TargetUserPublicKey as if SourceUserPublicKey sent it directly
+DERPNET_API bool DerpNet_ForwardPacket(DerpNet* Net, const DerpKey* SourceUserPublicKey, const DerpKey* TargetUserPublicKey, const void* SealedData, size_t SealedSize);
+
+// sends Ping frame to server and waits for its Pong, any other incoming frames are dropped
+// returns false on timeout or if disconnected, otherwise RoundTrip is set to microseconds
+DERPNET_API bool DerpNet_Ping(DerpNet* Net, uint32_t TimeoutMsec, uint32_t* RoundTrip);
+
 //
 // implementation
 //
@@ -64,6 +179,9 @@ DERPNET_API bool DerpNet_SendEx(DerpNet* Net, const DerpKey* TargetUserPublicKey
 #include <stdio.h>
 #include <string.h>
 
+// only crypto, parallel tasks, sealing & replay window build on other platforms, enough for tests\DerpNetTest.c
+// to run with gcc or clang - connection functions are Windows only
+#if defined(_WIN32)
 #define SECURITY_WIN32
 #define _WINSOCK_DEPRECATED_NO_WARNINGS
 #include <winsock2.h>
@@ -75,6 +193,23 @@ DERPNET_API bool DerpNet_SendEx(DerpNet* Net, const DerpKey* TargetUserPublicKey
 #pragma comment (lib, "bcrypt")
 #pragma comment (lib, "ws2_32")
 #pragma comment (lib, "secur32")
+#pragma comment (lib, "synchronization")
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#ifndef DERPNET_OPEN_TIMEOUT
+#define DERPNET_OPEN_TIMEOUT 10000 // msec, for whole DerpNet_Open
+#endif
+
+#define DERPNET_RESOLUTION_DELAY 50  // msec, how long to wait for AAAA answer after A answer arrives
+#define DERPNET_ATTEMPT_DELAY    250 // msec, between starting connection attempts
+#define DERPNET_MAX_ADDRESSES    16
+#define DERPNET_MAX_THREADS      16    // for parallel sealing & unsealing, including calling thread
+#define DERPNET_PARALLEL_SIZE    16384 // bytes, smaller amount of work is not split between threads
+#define DERPNET_SENDER_IDLE      60000 // msec, sender's replay window is first to be replaced after this much silence
 
 //
 // helpers
@@ -115,7 +250,7 @@ DERPNET_API bool DerpNet_SendEx(DerpNet* Net, const DerpKey* TargetUserPublicKey
 #	define rol32(x, n) ( ((x) << (n)) | ((x) >> (32-(n))) )
 #endif
 
-#if !defined(NDEBUG)
+#if !defined(NDEBUG) && defined(_WIN32)
 #	define DERPNET_ASSERT(cond) do { if (!(cond)) __debugbreak(); } while (0)
 #	define DERPNET_LOG(...) do {                                  \
 	char LogBuffer[256];                                          \
@@ -123,6 +258,9 @@ DERPNET_API bool DerpNet_SendEx(DerpNet* Net, const DerpKey* TargetUserPublicKey
 	OutputDebugStringA(LogBuffer);                                \
 	OutputDebugStringA("\n");                                     \
 } while (0)
+#elif !defined(NDEBUG)
+#	define DERPNET_ASSERT(cond) do { if (!(cond)) __builtin_trap(); } while (0)
+#	define DERPNET_LOG(...) do { fprintf(stderr, "DERP: " __VA_ARGS__); fputc('\n', stderr); } while (0)
 #else
 #	define DERPNET_ASSERT(cond) do { (void)(cond); } while (0)
 #	define DERPNET_LOG(...) do { (void)sizeof(__VA_ARGS__); } while (0)
@@ -130,12 +268,12 @@ DERPNET_API bool DerpNet_SendEx(DerpNet* Net, const DerpKey* TargetUserPublicKey
 
 static inline uint32_t Get32LE(const uint8_t* Buffer)
 {
-	return (Buffer[3] << 24) + (Buffer[2] << 16) + (Buffer[1] << 8) + Buffer[0];
+	return ((uint32_t)Buffer[3] << 24) + ((uint32_t)Buffer[2] << 16) + ((uint32_t)Buffer[1] << 8) + Buffer[0];
 }
 
 static inline uint32_t Get32BE(const uint8_t* Buffer)
 {
-	return (Buffer[0] << 24) + (Buffer[1] << 16) + (Buffer[2] << 8) + Buffer[3];
+	return ((uint32_t)Buffer[0] << 24) + ((uint32_t)Buffer[1] << 16) + ((uint32_t)Buffer[2] << 8) + Buffer[3];
 }
 
 static inline uint64_t Get64LE(const uint8_t* Buffer)
@@ -178,11 +316,25 @@ static inline void Set64LE(uint8_t* Buffer, uint64_t Value)
 	Buffer[7] = (uint8_t)(Value >> 56);
 }
 
+#if defined(_WIN32)
 static inline void DerpNet__GetRandom(void* Buffer, size_t BufferSize)
 {
 	int Status = BCryptGenRandom(NULL, (PUCHAR)Buffer, (ULONG)BufferSize, BCRYPT_USE_SYSTEM_PREFERRED_RNG);
 	DERPNET_ASSERT(Status == 0);
 }
+#else
+static inline void DerpNet__GetRandom(void* Buffer, size_t BufferSize)
+{
+	FILE* File = fopen("/dev/urandom", "rb");
+	DERPNET_ASSERT(File);
+	size_t Read = fread(Buffer, 1, BufferSize, File);
+	DERPNET_ASSERT(Read == BufferSize);
+	fclose(File);
+}
+
+#	define min(a, b) ((a) < (b) ? (a) : (b))
+#	define max(a, b) ((a) > (b) ? (a) : (b))
+#endif
 
 //
 // curve25519, based on public domain code from https://github.com/floodyberry/curve25519-donna
@@ -964,6 +1116,229 @@ static bool DerpNet__BoxUnseal(uint8_t* Output, const uint8_t* Input, size_t Inp
 	return DerpNet__BoxUnsealEx(Output, Input, InputSize, Auth, Nonce, SharedKey);
 }
 
+//
+// parallel tasks
+//
+// workers from Windows thread pool and calling thread all take next task index from shared counter, so
+// whichever thread is free takes over remaining work. Calling thread waits for tasks in order, and runs
+// not yet started tasks meanwhile instead of sleeping. Elsewhere workers are pthreads started for every
+// DerpNet__TasksStart, and waiting thread yields instead of sleeping on address
+
+typedef void DerpNet__TaskCallback(void* Context, size_t Index);
+
+#if defined(_WIN32)
+typedef LONG DerpNet__Flag;
+#else
+typedef int32_t DerpNet__Flag;
+#endif
+
+typedef struct {
+	DerpNet__TaskCallback* Callback;
+	void* Context;
+	size_t Count;
+	volatile int64_t Next;
+	volatile DerpNet__Flag* Done; // one flag per task
+#if defined(_WIN32)
+	PTP_WORK Work;
+#else
+	pthread_t Threads[DERPNET_MAX_THREADS];
+	size_t ThreadCount;
+#endif
+} DerpNet__Tasks;
+
+static uint32_t DerpNet__GetProcessorCount(void)
+{
+#if defined(_WIN32)
+	return GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+#else
+	long Count = sysconf(_SC_NPROCESSORS_ONLN);
+	return Count > 0 ? (uint32_t)Count : 1;
+#endif
+}
+
+static uint32_t DerpNet__GetThreadCount(uint32_t MaxThreads)
+{
+	uint32_t Count = MaxThreads ? MaxThreads : DerpNet__GetProcessorCount();
+	return max(1, min(Count, DERPNET_MAX_THREADS));
+}
+
+static bool DerpNet__RunTask(DerpNet__Tasks* Tasks)
+{
+#if defined(_WIN32)
+	size_t Index = (size_t)InterlockedIncrement64((volatile LONG64*)&Tasks->Next) - 1;
+#else
+	size_t Index = (size_t)__atomic_fetch_add(&Tasks->Next, 1, __ATOMIC_SEQ_CST);
+#endif
+	if (Index >= Tasks->Count)
+	{
+		return false;
+	}
+
+	Tasks->Callback(Tasks->Context, Index);
+
+#if defined(_WIN32)
+	InterlockedExchange(&Tasks->Done[Index], 1);
+	WakeByAddressAll((void*)&Tasks->Done[Index]);
+#else
+	__atomic_store_n(&Tasks->Done[Index], 1, __ATOMIC_RELEASE);
+#endif
+	return true;
+}
+
+#if defined(_WIN32)
+static void CALLBACK DerpNet__TaskWorkCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Context, PTP_WORK Work)
+{
+	while (DerpNet__RunTask(Context))
+	{
+	}
+}
+#else
+static void* DerpNet__TaskThread(void* Context)
+{
+	while (DerpNet__RunTask(Context))
+	{
+	}
+	return NULL;
+}
+#endif
+
+// Done must have Count zeroed flags
+static void DerpNet__TasksStart(DerpNet__Tasks* Tasks, size_t Count, volatile DerpNet__Flag* Done, uint32_t ThreadCount, DerpNet__TaskCallback* Callback, void* Context)
+{
+	Tasks->Callback = Callback;
+	Tasks->Context = Context;
+	Tasks->Count = Count;
+	Tasks->Next = 0;
+	Tasks->Done = Done;
+
+	size_t WorkerCount = Count == 0 ? 0 : min(Count, ThreadCount) - 1;
+#if defined(_WIN32)
+	Tasks->Work = NULL;
+	if (WorkerCount != 0)
+	{
+		// if work cannot be created, calling thread runs all tasks
+		Tasks->Work = CreateThreadpoolWork(&DerpNet__TaskWorkCallback, Tasks, NULL);
+		for (size_t Index = 0; Tasks->Work && Index < WorkerCount; Index++)
+		{
+			SubmitThreadpoolWork(Tasks->Work);
+		}
+	}
+#else
+	// if thread cannot be created, calling thread runs remaining tasks
+	Tasks->ThreadCount = 0;
+	while (Tasks->ThreadCount < WorkerCount && pthread_create(&Tasks->Threads[Tasks->ThreadCount], NULL, &DerpNet__TaskThread, Tasks) == 0)
+	{
+		Tasks->ThreadCount++;
+	}
+#endif
+}
+
+static void DerpNet__TasksWait(DerpNet__Tasks* Tasks, size_t Index)
+{
+#if defined(_WIN32)
+	while (Tasks->Done[Index] == 0)
+	{
+		if (!DerpNet__RunTask(Tasks))
+		{
+			LONG NotDone = 0;
+			WaitOnAddress(&Tasks->Done[Index], &NotDone, sizeof(NotDone), INFINITE);
+		}
+	}
+#else
+	while (__atomic_load_n(&Tasks->Done[Index], __ATOMIC_ACQUIRE) == 0)
+	{
+		if (!DerpNet__RunTask(Tasks))
+		{
+			sched_yield();
+		}
+	}
+#endif
+}
+
+// must be called before Tasks memory is released, even if not all tasks were waited for
+static void DerpNet__TasksFinish(DerpNet__Tasks* Tasks)
+{
+#if defined(_WIN32)
+	if (Tasks->Work)
+	{
+		WaitForThreadpoolWorkCallbacks(Tasks->Work, FALSE);
+		CloseThreadpoolWork(Tasks->Work);
+	}
+#else
+	for (size_t Index = 0; Index < Tasks->ThreadCount; Index++)
+	{
+		pthread_join(Tasks->Threads[Index], NULL);
+	}
+#endif
+}
+
+typedef struct {
+	uint8_t* Output;
+	const uint8_t* Input;
+	size_t InputSize;
+	size_t RangeSize;
+	const uint8_t* SubKey;
+	const uint8_t* Nonce;
+} DerpNet__XorTask;
+
+static void DerpNet__XorTaskCallback(void* Context, size_t Index)
+{
+	DerpNet__XorTask* Task = Context;
+
+	size_t Offset = Index * Task->RangeSize;
+	size_t Size = min(Task->RangeSize, Task->InputSize - Offset);
+
+	// first 32 bytes of data use second half of block 0, so block 1 starts at byte 32
+	salsa20_xor(Task->Output + Offset, Task->Input + Offset, Size, Task->SubKey, Task->Nonce + 16, 1 + Offset / 64);
+}
+
+// same as DerpNet__BoxUnsealEx, but after verifying auth tag decryption is split between threads
+static bool DerpNet__BoxUnsealParallel(uint32_t ThreadCount, uint8_t* Output, const uint8_t* Input, size_t InputSize, const uint8_t Auth[16], const uint8_t Nonce[24], const uint8_t SharedKey[32])
+{
+	if (ThreadCount == 1 || InputSize < 2 * DERPNET_PARALLEL_SIZE)
+	{
+		return DerpNet__BoxUnsealEx(Output, Input, InputSize, Auth, Nonce, SharedKey);
+	}
+
+	uint8_t SubKey[32];
+	hsalsa20(SubKey, Nonce, SharedKey);
+
+	uint8_t FirstBlock[64] = { 0 };
+	salsa20_xor(FirstBlock, FirstBlock, sizeof(FirstBlock), SubKey, Nonce + 16, 0);
+
+	uint8_t ExpectedAuth[16];
+	poly1305_auth(ExpectedAuth, Input, InputSize, FirstBlock);
+
+	if (poly1305_verify(Auth, ExpectedAuth) == 0)
+	{
+		return false;
+	}
+
+	for (size_t i = 0; i < 32; i++)
+	{
+		Output[i] = Input[i] ^ FirstBlock[32 + i];
+	}
+
+	// ranges must start on salsa20 block boundary
+	size_t RestSize = InputSize - 32;
+	size_t RangeCount = min(ThreadCount, RestSize / DERPNET_PARALLEL_SIZE);
+	size_t RangeSize = ((RestSize + RangeCount - 1) / RangeCount + 63) & ~(size_t)63;
+	RangeCount = (RestSize + RangeSize - 1) / RangeSize;
+
+	DerpNet__XorTask Task = { Output + 32, Input + 32, RestSize, RangeSize, SubKey, Nonce };
+
+	DerpNet__Flag Done[DERPNET_MAX_THREADS] = { 0 };
+	DerpNet__Tasks Tasks;
+	DerpNet__TasksStart(&Tasks, RangeCount, Done, ThreadCount, &DerpNet__XorTaskCallback, &Task);
+	for (size_t Index = 0; Index < RangeCount; Index++)
+	{
+		DerpNet__TasksWait(&Tasks, Index);
+	}
+	DerpNet__TasksFinish(&Tasks);
+
+	return true;
+}
+
 void DerpNet_CreateNewKey(DerpKey* UserSecret)
 {
 	DerpNet__GetRandom(UserSecret->Bytes, sizeof(UserSecret->Bytes));
@@ -979,15 +1354,31 @@ void DerpNet_GetPublicKey(const DerpKey* UserSecret, DerpKey* UserPublic)
 	curve25519_scalarmult(UserPublic->Bytes, UserSecret->Bytes, Base);
 }
 
-static bool DerpNet__TlsHandshake(DerpNet* Net, const char* Hostname, CredHandle* CredentialHandle, CtxtHandle* ContextHandle)
+#if defined(_WIN32)
+
+// one credentials handle for whole process, Schannel keeps its TLS session cache per credentials handle
+// so reconnecting to same server can do abbreviated handshake
+static INIT_ONCE DerpNet__CredentialsOnce = INIT_ONCE_STATIC_INIT;
+static CredHandle DerpNet__Credentials;
+
+static BOOL CALLBACK DerpNet__InitCredentials(PINIT_ONCE InitOnce, PVOID Parameter, PVOID* Context)
 {
 	SCHANNEL_CRED Cred = { 0 };
 	Cred.dwVersion = SCHANNEL_CRED_VERSION;
 	Cred.dwFlags = SCH_USE_STRONG_CRYPTO | SCH_CRED_AUTO_CRED_VALIDATION | SCH_CRED_NO_DEFAULT_CREDS;
 	Cred.grbitEnabledProtocols = SP_PROT_TLS1_2;
 
-	SECURITY_STATUS SecStatus = AcquireCredentialsHandleA(NULL, UNISP_NAME_A, SECPKG_CRED_OUTBOUND, NULL, &Cred, NULL, NULL, CredentialHandle, NULL);
-	DERPNET_ASSERT(SecStatus == SEC_E_OK);
+	SECURITY_STATUS SecStatus = AcquireCredentialsHandleA(NULL, UNISP_NAME_A, SECPKG_CRED_OUTBOUND, NULL, &Cred, NULL, NULL, &DerpNet__Credentials, NULL);
+	return SecStatus == SEC_E_OK;
+}
+
+static bool DerpNet__TlsHandshake(DerpNet* Net, const char* Hostname, CtxtHandle* ContextHandle)
+{
+	if (!InitOnceExecuteOnce(&DerpNet__CredentialsOnce, &DerpNet__InitCredentials, NULL, NULL))
+	{
+		DERPNET_LOG("cannot acquire Schannel credentials");
+		return false;
+	}
 
 	CtxtHandle* Context = NULL;
 
@@ -1006,8 +1397,8 @@ static bool DerpNet__TlsHandshake(DerpNet* Net, const char* Hostname, CredHandle
 		SecBufferDesc OutDesc = { SECBUFFER_VERSION, ARRAYSIZE(OutBuffers), OutBuffers };
 
 		DWORD Flags = ISC_REQ_USE_SUPPLIED_CREDS | ISC_REQ_ALLOCATE_MEMORY | ISC_REQ_CONFIDENTIALITY | ISC_REQ_REPLAY_DETECT | ISC_REQ_SEQUENCE_DETECT | ISC_REQ_STREAM;
-		SecStatus = InitializeSecurityContextA(
-			CredentialHandle,
+		SECURITY_STATUS SecStatus = InitializeSecurityContextA(
+			&DerpNet__Credentials,
 			Context,
 			Context ? NULL : (SEC_CHAR*)Hostname,
 			Flags,
@@ -1083,10 +1474,10 @@ static bool DerpNet__TlsHandshake(DerpNet* Net, const char* Hostname, CredHandle
 	}
 }
 
-static bool DerpNet__TlsWrite(DerpNet* Net, const void* Data, size_t DataSize)
+// sends all buffers, socket may accept only part of them at a time
+static bool DerpNet__SendBuffers(DerpNet* Net, WSABUF* Buffers, DWORD BufferCount)
 {
-#if DERPNET_USE_PLAIN_HTTP
-	while (DataSize != 0)
+	while (BufferCount != 0)
 	{
 		fd_set WriteSet;
 		FD_ZERO(&WriteSet);
@@ -1099,81 +1490,116 @@ static bool DerpNet__TlsWrite(DerpNet* Net, const void* Data, size_t DataSize)
 			return false;
 		}
 
-		int WriteSize = send(Net->Socket, Data, (int)DataSize, 0);
-		if (WriteSize <= 0)
+		DWORD WriteSize;
+		if (WSASend(Net->Socket, Buffers, BufferCount, &WriteSize, 0, NULL, NULL) != 0)
 		{
+			if (WSAGetLastError() == WSAEWOULDBLOCK)
+			{
+				continue;
+			}
 			DERPNET_LOG("failed to send data to server, remote server disconnected?");
 			return false;
 		}
 		Net->TotalSent += WriteSize;
+		Net->TotalSends++;
+
+		while (WriteSize != 0)
+		{
+			if (WriteSize >= Buffers->len)
+			{
+				WriteSize -= Buffers->len;
+				Buffers++;
+				BufferCount--;
+			}
+			else
+			{
+				Buffers->buf += WriteSize;
+				Buffers->len -= WriteSize;
+				WriteSize = 0;
+			}
+		}
+	}
+	return true;
+}
 
-		Data = (char*)Data + WriteSize;
-		DataSize -= WriteSize;
+// encrypts queued records in place and sends them all with one call
+static bool DerpNet__TlsFlush(DerpNet* Net)
+{
+	if (Net->WriteCount == 0)
+	{
+		return true;
 	}
-	return true; 
-#else
-	CtxtHandle ContextHandle;
-	memcpy(&ContextHandle, Net->CtxHandle, sizeof(ContextHandle));
 
-	SecPkgContext_StreamSizes StreamSizes;
-	SECURITY_STATUS SecStatus = QueryContextAttributes(&ContextHandle, SECPKG_ATTR_STREAM_SIZES, &StreamSizes);
-	DERPNET_ASSERT(SecStatus == SEC_E_OK);
+	WSABUF Buffers[ARRAYSIZE(Net->WriteBuffer)];
+	DWORD BufferCount = (DWORD)Net->WriteCount;
 
-	while (DataSize != 0)
+	for (DWORD Index = 0; Index < BufferCount; Index++)
 	{
-		size_t DataSizeToUse = min(DataSize, StreamSizes.cbMaximumMessage);
+		uint8_t* Record = Net->WriteBuffer[Index];
+		uint32_t RecordSize = Index == BufferCount - 1 ? (uint32_t)Net->WriteSize : Net->StreamMaxMessage;
 
-		char WriteBuffer[16384 + 512];
-		DERPNET_ASSERT(StreamSizes.cbHeader + StreamSizes.cbMaximumMessage + StreamSizes.cbTrailer <= sizeof(WriteBuffer));
+#if DERPNET_USE_PLAIN_HTTP
+		Buffers[Index].buf = (char*)Record;
+		Buffers[Index].len = RecordSize;
+#else
+		CtxtHandle ContextHandle;
+		memcpy(&ContextHandle, Net->CtxHandle, sizeof(ContextHandle));
 
 		SecBuffer OutBuffers[3] = { 0 };
 		OutBuffers[0].BufferType = SECBUFFER_STREAM_HEADER;
-		OutBuffers[0].pvBuffer = WriteBuffer;
-		OutBuffers[0].cbBuffer = StreamSizes.cbHeader;
+		OutBuffers[0].pvBuffer = Record;
+		OutBuffers[0].cbBuffer = Net->StreamHeader;
 		OutBuffers[1].BufferType = SECBUFFER_DATA;
-		OutBuffers[1].pvBuffer = WriteBuffer + StreamSizes.cbHeader;
-		OutBuffers[1].cbBuffer = (unsigned)DataSizeToUse;
+		OutBuffers[1].pvBuffer = Record + Net->StreamHeader;
+		OutBuffers[1].cbBuffer = RecordSize;
 		OutBuffers[2].BufferType = SECBUFFER_STREAM_TRAILER;
-		OutBuffers[2].pvBuffer = WriteBuffer + StreamSizes.cbHeader + DataSizeToUse;
-		OutBuffers[2].cbBuffer = StreamSizes.cbTrailer;
-
-		memcpy(OutBuffers[1].pvBuffer, Data, DataSizeToUse);
+		OutBuffers[2].pvBuffer = Record + Net->StreamHeader + RecordSize;
+		OutBuffers[2].cbBuffer = Net->StreamTrailer;
 
 		SecBufferDesc OutDesc = { SECBUFFER_VERSION, ARRAYSIZE(OutBuffers), OutBuffers };
-		SecStatus = EncryptMessage(&ContextHandle, 0, &OutDesc, 0);
+		AcquireSRWLockExclusive((SRWLOCK*)&Net->TlsLock);
+		SECURITY_STATUS SecStatus = EncryptMessage(&ContextHandle, 0, &OutDesc, 0);
+		ReleaseSRWLockExclusive((SRWLOCK*)&Net->TlsLock);
 		DERPNET_ASSERT(SecStatus == SEC_E_OK);
 
-		int SizeToSend = OutBuffers[0].cbBuffer + OutBuffers[1].cbBuffer + OutBuffers[2].cbBuffer;
-		int BytesSent = 0;
-		while (BytesSent != SizeToSend)
-		{
-			fd_set WriteSet;
-			FD_ZERO(&WriteSet);
-			FD_SET(Net->Socket, &WriteSet);
+		Buffers[Index].buf = (char*)Record;
+		Buffers[Index].len = OutBuffers[0].cbBuffer + OutBuffers[1].cbBuffer + OutBuffers[2].cbBuffer;
+#endif
+	}
 
-			int Select = select((int)(Net->Socket + 1), NULL, &WriteSet, NULL, NULL);
-			if (Select < 0)
-			{
-				DERPNET_LOG("select failed");
-				return false;
-			}
+	Net->TotalRecords += BufferCount;
+	Net->WriteCount = 0;
+	Net->WriteSize = 0;
 
-			int WriteSize = send(Net->Socket, WriteBuffer + BytesSent, SizeToSend - BytesSent, 0);
-			if (WriteSize <= 0)
+	return DerpNet__SendBuffers(Net, Buffers, BufferCount);
+}
+
+// appends data to queued TLS records, sends them right away unless connection is corked
+static bool DerpNet__TlsWrite(DerpNet* Net, const void* Data, size_t DataSize)
+{
+	while (DataSize != 0)
+	{
+		if (Net->WriteCount == 0 || Net->WriteSize == Net->StreamMaxMessage)
+		{
+			if (Net->WriteCount == ARRAYSIZE(Net->WriteBuffer) && !DerpNet__TlsFlush(Net))
 			{
-				DERPNET_LOG("failed to send data to server, remote server disconnected?");
 				return false;
 			}
-			Net->TotalSent += WriteSize;
-			BytesSent += WriteSize;
+			Net->WriteCount++;
+			Net->WriteSize = 0;
 		}
 
+		uint8_t* Record = Net->WriteBuffer[Net->WriteCount - 1];
+		size_t DataSizeToUse = min(DataSize, Net->StreamMaxMessage - Net->WriteSize);
+
+		memcpy(Record + Net->StreamHeader + Net->WriteSize, Data, DataSizeToUse);
+		Net->WriteSize += DataSizeToUse;
+
 		Data = (char*)Data + DataSizeToUse;
 		DataSize -= DataSizeToUse;
 	}
 
-	return true;
-#endif
+	return (Net->Corked && !Net->CorkDisabled) || DerpNet__TlsFlush(Net);
 }
 
 static bool DerpNet__TlsRead(DerpNet* Net, bool Wait)
@@ -1184,13 +1610,23 @@ static bool DerpNet__TlsRead(DerpNet* Net, bool Wait)
 	FD_SET(Net->Socket, &ReadSet);
 
 	struct timeval TimeVal = { 0, 0 };
-	int Select = select((int)(Net->Socket + 1), &ReadSet, NULL, NULL, Wait ? NULL : &TimeVal);
+	if (Wait)
+	{
+		TimeVal.tv_sec = Net->ReadTimeout / 1000;
+		TimeVal.tv_usec = (Net->ReadTimeout % 1000) * 1000;
+	}
+	int Select = select((int)(Net->Socket + 1), &ReadSet, NULL, NULL, Wait && Net->ReadTimeout == 0 ? NULL : &TimeVal);
 	if (Select < 0)
 	{
 		return false;
 	}
 	if (Select == 0)
 	{
+		if (Wait)
+		{
+			DERPNET_LOG("timeout while waiting for data from server");
+			return false;
+		}
 		return true;
 	}
 
@@ -1213,10 +1649,6 @@ static bool DerpNet__TlsRead(DerpNet* Net, bool Wait)
 	CtxtHandle ContextHandle;
 	memcpy(&ContextHandle, Net->CtxHandle, sizeof(ContextHandle));
 
-	SecPkgContext_StreamSizes StreamSizes;
-	SECURITY_STATUS SecStatus = QueryContextAttributes(&ContextHandle, SECPKG_ATTR_STREAM_SIZES, &StreamSizes);
-	DERPNET_ASSERT(SecStatus == SEC_E_OK);
-
 	for (;;)
 	{
 		size_t EncryptedSize = Net->BufferReceived - Net->BufferSize;
@@ -1224,7 +1656,6 @@ static bool DerpNet__TlsRead(DerpNet* Net, bool Wait)
 		if (EncryptedSize != 0)
 		{
 			SecBuffer InBuffers[4] = { 0 };
-			DERPNET_ASSERT(StreamSizes.cBuffers == ARRAYSIZE(InBuffers));
 
 			InBuffers[0].BufferType = SECBUFFER_DATA;
 			InBuffers[0].pvBuffer = Net->Buffer + Net->BufferSize;
@@ -1235,7 +1666,9 @@ static bool DerpNet__TlsRead(DerpNet* Net, bool Wait)
 
 			SecBufferDesc InDesc = { SECBUFFER_VERSION, ARRAYSIZE(InBuffers), InBuffers };
 
-			SecStatus = DecryptMessage(&ContextHandle, &InDesc, 0, NULL);
+			AcquireSRWLockExclusive((SRWLOCK*)&Net->TlsLock);
+			SECURITY_STATUS SecStatus = DecryptMessage(&ContextHandle, &InDesc, 0, NULL);
+			ReleaseSRWLockExclusive((SRWLOCK*)&Net->TlsLock);
 			if (SecStatus == SEC_E_OK)
 			{
 				//
@@ -1266,7 +1699,7 @@ static bool DerpNet__TlsRead(DerpNet* Net, bool Wait)
 				DERPNET_ASSERT(InBuffers[2].BufferType == SECBUFFER_STREAM_TRAILER);
 				DERPNET_ASSERT(InBuffers[3].BufferType == SECBUFFER_EXTRA || InBuffers[3].BufferType == SECBUFFER_EMPTY);
 
-				DERPNET_ASSERT(InBuffers[0].cbBuffer == StreamSizes.cbHeader);
+				DERPNET_ASSERT(InBuffers[0].cbBuffer == Net->StreamHeader);
 
 				DERPNET_ASSERT(InBuffers[0].pvBuffer == Net->Buffer + Net->BufferSize);
 				DERPNET_ASSERT(InBuffers[1].pvBuffer == Net->Buffer + Net->BufferSize + InBuffers[0].cbBuffer);
@@ -1274,11 +1707,11 @@ static bool DerpNet__TlsRead(DerpNet* Net, bool Wait)
 
 				if (InBuffers[3].BufferType == SECBUFFER_EXTRA)
 				{
-					DERPNET_ASSERT(InBuffers[3].pvBuffer == Net->Buffer + Net->BufferSize + InBuffers[0].cbBuffer + InBuffers[1].cbBuffer + StreamSizes.cbTrailer);
+					DERPNET_ASSERT(InBuffers[3].pvBuffer == Net->Buffer + Net->BufferSize + InBuffers[0].cbBuffer + InBuffers[1].cbBuffer + Net->StreamTrailer);
 				}
 				else if (InBuffers[3].BufferType == SECBUFFER_EMPTY)
 				{
-					DERPNET_ASSERT(Net->BufferSize + InBuffers[0].cbBuffer + InBuffers[1].cbBuffer + StreamSizes.cbTrailer == Net->BufferReceived);
+					DERPNET_ASSERT(Net->BufferSize + InBuffers[0].cbBuffer + InBuffers[1].cbBuffer + Net->StreamTrailer == Net->BufferReceived);
 				}
 
 				memmove(Net->Buffer + Net->BufferSize, InBuffers[1].pvBuffer, InBuffers[1].cbBuffer);
@@ -1289,9 +1722,9 @@ static bool DerpNet__TlsRead(DerpNet* Net, bool Wait)
 					size_t ExtraSize = (Net->Buffer + Net->BufferReceived) - (uint8_t*)InBuffers[3].pvBuffer;
 					memmove(Net->Buffer + Net->BufferSize, InBuffers[3].pvBuffer, ExtraSize);
 				}
-				Net->BufferReceived -= InBuffers[0].cbBuffer + StreamSizes.cbTrailer;
+				Net->BufferReceived -= InBuffers[0].cbBuffer + Net->StreamTrailer;
 				
-				DERPNET_LOG("TLS packet decrypted - encrypted=%lu, decrypted=%lu, BufferSize=%zu, BufferReceived=%zu", InBuffers[0].cbBuffer + InBuffers[1].cbBuffer + StreamSizes.cbTrailer, InBuffers[1].cbBuffer, Net->BufferSize, Net->BufferReceived);
+				DERPNET_LOG("TLS packet decrypted - encrypted=%lu, decrypted=%lu, BufferSize=%zu, BufferReceived=%zu", InBuffers[0].cbBuffer + InBuffers[1].cbBuffer + Net->StreamTrailer, InBuffers[1].cbBuffer, Net->BufferSize, Net->BufferReceived);
 
 				return true;
 			}
@@ -1315,13 +1748,23 @@ static bool DerpNet__TlsRead(DerpNet* Net, bool Wait)
 		FD_SET(Net->Socket, &ReadSet);
 
 		struct timeval TimeVal = { 0, 0 };
-		int Select = select((int)(Net->Socket + 1), &ReadSet, NULL, NULL, Wait ? NULL : &TimeVal);
+		if (Wait)
+		{
+			TimeVal.tv_sec = Net->ReadTimeout / 1000;
+			TimeVal.tv_usec = (Net->ReadTimeout % 1000) * 1000;
+		}
+		int Select = select((int)(Net->Socket + 1), &ReadSet, NULL, NULL, Wait && Net->ReadTimeout == 0 ? NULL : &TimeVal);
 		if (Select < 0)
 		{
 			return false;
 		}
 		if (Select == 0)
 		{
+			if (Wait)
+			{
+				DERPNET_LOG("timeout while waiting for data from server");
+				return false;
+			}
 			return true;
 		}
 
@@ -1432,83 +1875,432 @@ static int DerpNet__ReadFrame(DerpNet* Net, uint8_t* FrameType, uint32_t* FrameS
 	}
 }
 
-bool DerpNet_Open(DerpNet* Net, const char* DerpServer, const DerpKey* UserSecret)
+static uint64_t DerpNet__GetTime(void)
 {
-	CredHandle CredHandle;
-	CtxtHandle CtxHandle;
+	LARGE_INTEGER Freq, Counter;
+	QueryPerformanceFrequency(&Freq);
+	QueryPerformanceCounter(&Counter);
+	return Counter.QuadPart * 1000000 / Freq.QuadPart;
+}
 
-	SecInvalidateHandle(&CredHandle);
-	SecInvalidateHandle(&CtxHandle);
+// Happy Eyeballs v2 (RFC 8305) - A & AAAA queries are done in parallel, connections to all
+// addresses are started one after another with small delay, first one that connects wins
+static SOCKET DerpNet__Connect(DerpNet* Net, const char* DerpServer, uint16_t Port, const char* const* KnownAddresses, size_t KnownAddressCount, uint64_t Deadline)
+{
+	uint64_t StartTime = DerpNet__GetTime();
+	uint64_t ResolvedTime = 0;
+	SOCKET Result = INVALID_SOCKET;
 
-	struct addrinfo* AddrInfo = NULL;
-	Net->Socket = INVALID_SOCKET;
-	Net->SocketEvent = NULL;
-	Net->BufferSize = Net->BufferReceived = 0;
-	Net->TotalReceived = Net->TotalSent = 0;
+	WCHAR HostName[256];
+	if (!MultiByteToWideChar(CP_UTF8, 0, DerpServer, -1, HostName, ARRAYSIZE(HostName)))
+	{
+		return INVALID_SOCKET;
+	}
 
-	WSADATA SocketData;
-	int SocketOk = WSAStartup(MAKEWORD(2, 2), &SocketData);
-	DERPNET_ASSERT(SocketOk == 0);
+	WCHAR DerpServerPort[8];
+	_snwprintf(DerpServerPort, ARRAYSIZE(DerpServerPort), L"%u", Port);
 
-	//
-	// connect to DERP server
-	//
+	// 0 = AAAA, 1 = A
+	static const int Families[2] = { AF_INET6, AF_INET };
 
-	struct addrinfo AddrHints =
-	{
-		.ai_family = AF_UNSPEC,
-		.ai_socktype = SOCK_STREAM,
-	};
+	ADDRINFOEXW* Lookup[2] = { NULL, NULL };
+	OVERLAPPED LookupOverlapped[2] = { 0 };
+	HANDLE LookupCancel[2] = { NULL, NULL };
+	bool LookupPending[2] = { false, false };
+	uint64_t LookupDone[2] = { 0, 0 };
 
-#if DERPNET_USE_PLAIN_HTTP
-	const char* DerpServerPort = "80";
-#else
-	const char* DerpServerPort = "443";
-#endif
-	SocketOk = getaddrinfo(DerpServer, DerpServerPort, &AddrHints, &AddrInfo);
-	if (SocketOk != 0)
+	for (int Index = 0; Index < 2; Index++)
 	{
-		DERPNET_LOG("cannot resolve '%s' hostname", DerpServer);
-		goto error;
-	}
+		ADDRINFOEXW Hints =
+		{
+			.ai_family = Families[Index],
+			.ai_socktype = SOCK_STREAM,
+			.ai_protocol = IPPROTO_TCP,
+		};
 
-	Net->Socket = socket(AddrInfo->ai_family, AddrInfo->ai_socktype, AddrInfo->ai_protocol);
-	DERPNET_ASSERT(Net->Socket != INVALID_SOCKET);
+		LookupOverlapped[Index].hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+		DERPNET_ASSERT(LookupOverlapped[Index].hEvent);
 
-	SocketOk = connect(Net->Socket, AddrInfo->ai_addr, (int)AddrInfo->ai_addrlen);
-	if (SocketOk != 0)
-	{
-		DERPNET_LOG("cannot connect to '%s' server", DerpServer);
-		goto error;
+		INT Error = GetAddrInfoExW(HostName, DerpServerPort, NS_ALL, NULL, &Hints, &Lookup[Index], NULL, &LookupOverlapped[Index], NULL, &LookupCancel[Index]);
+		if (Error == WSA_IO_PENDING)
+		{
+			LookupPending[Index] = true;
+		}
+		else if (Error == NO_ERROR)
+		{
+			LookupDone[Index] = DerpNet__GetTime();
+		}
+		else
+		{
+			Lookup[Index] = NULL;
+		}
 	}
 
-#if !defined(NDEBUG)
-	char Address[128];
-	DWORD AddressLength = ARRAYSIZE(Address);
-	WSAAddressToStringA(AddrInfo->ai_addr, (DWORD)AddrInfo->ai_addrlen, NULL, Address, &AddressLength);
-	DERPNET_LOG("connected to '%s' -> '%s' server", DerpServer, Address);
-#endif
-
-	freeaddrinfo(AddrInfo);
-	AddrInfo = NULL;
-
-#if !DERPNET_USE_PLAIN_HTTP
-	if (!DerpNet__TlsHandshake(Net, DerpServer, &CredHandle, &CtxHandle))
+	struct
 	{
-		goto error;
+		SOCKADDR_STORAGE Address;
+		int AddressLength;
 	}
+	Addresses[DERPNET_MAX_ADDRESSES];
+	size_t AddressCount = 0;
+	size_t AddressNext = 0;
+	bool AddressesAdded[2] = { false, false };
 
-	DERPNET_ASSERT(sizeof(CredHandle) == sizeof(Net->CredHandle));
-	DERPNET_ASSERT(sizeof(CtxHandle) == sizeof(Net->CtxHandle));
-	memcpy(&Net->CredHandle, &CredHandle, sizeof(CredHandle));
-	memcpy(&Net->CtxHandle, &CtxHandle, sizeof(CtxHandle));
-#endif
+	// known addresses are tried first, without waiting for DNS
+	for (size_t Index = 0; Index < KnownAddressCount && AddressCount < DERPNET_MAX_ADDRESSES; Index++)
+	{
+		SOCKADDR_STORAGE* Address = &Addresses[AddressCount].Address;
+		memset(Address, 0, sizeof(*Address));
+
+		SOCKADDR_IN* Address4 = (SOCKADDR_IN*)Address;
+		SOCKADDR_IN6* Address6 = (SOCKADDR_IN6*)Address;
+		if (InetPtonA(AF_INET, KnownAddresses[Index], &Address4->sin_addr) == 1)
+		{
+			Address4->sin_family = AF_INET;
+			Address4->sin_port = htons(Port);
+			Addresses[AddressCount++].AddressLength = sizeof(*Address4);
+		}
+		else if (InetPtonA(AF_INET6, KnownAddresses[Index], &Address6->sin6_addr) == 1)
+		{
+			Address6->sin6_family = AF_INET6;
+			Address6->sin6_port = htons(Port);
+			Addresses[AddressCount++].AddressLength = sizeof(*Address6);
+		}
+	}
+	if (AddressCount != 0)
+	{
+		ResolvedTime = StartTime;
+	}
+
+	SOCKET Sockets[DERPNET_MAX_ADDRESSES];
+	WSAEVENT Events[DERPNET_MAX_ADDRESSES];
+	size_t Attempts[DERPNET_MAX_ADDRESSES];
+	size_t SocketCount = 0;
+	uint64_t NextAttemptTime = 0;
+
+	for (;;)
+	{
+		uint64_t Now = DerpNet__GetTime();
+
+		// check finished lookups
+		for (int Index = 0; Index < 2; Index++)
+		{
+			if (LookupPending[Index] && WaitForSingleObject(LookupOverlapped[Index].hEvent, 0) == WAIT_OBJECT_0)
+			{
+				LookupPending[Index] = false;
+				LookupDone[Index] = Now;
+				if (GetAddrInfoExOverlappedResult(&LookupOverlapped[Index]) != NO_ERROR)
+				{
+					if (Lookup[Index])
+					{
+						FreeAddrInfoExW(Lookup[Index]);
+					}
+					Lookup[Index] = NULL;
+				}
+			}
+		}
+
+		// start connecting when AAAA is done, or A is done and AAAA is late, or both are done
+		bool AaaaDone = !LookupPending[0];
+		bool ADone = !LookupPending[1];
+		bool CanConnect = AaaaDone || (ADone && Now >= LookupDone[1] + DERPNET_RESOLUTION_DELAY * 1000);
+
+		if (CanConnect && !(AddressesAdded[0] && AddressesAdded[1]))
+		{
+			// interleave families, starting with IPv6
+			ADDRINFOEXW* Next[2] =
+			{
+				AaaaDone && !AddressesAdded[0] ? Lookup[0] : NULL,
+				ADone && !AddressesAdded[1] ? Lookup[1] : NULL,
+			};
+			AddressesAdded[0] |= AaaaDone;
+			AddressesAdded[1] |= ADone;
+
+			while ((Next[0] || Next[1]) && AddressCount < DERPNET_MAX_ADDRESSES)
+			{
+				for (int Index = 0; Index < 2 && AddressCount < DERPNET_MAX_ADDRESSES; Index++)
+				{
+					if (Next[Index])
+					{
+						DERPNET_ASSERT(Next[Index]->ai_addrlen <= sizeof(Addresses[AddressCount].Address));
+
+						bool Duplicate = false;
+						for (size_t Existing = 0; Existing < AddressCount; Existing++)
+						{
+							Duplicate |= Addresses[Existing].AddressLength == (int)Next[Index]->ai_addrlen && memcmp(&Addresses[Existing].Address, Next[Index]->ai_addr, Next[Index]->ai_addrlen) == 0;
+						}
+
+						if (!Duplicate)
+						{
+							memcpy(&Addresses[AddressCount].Address, Next[Index]->ai_addr, Next[Index]->ai_addrlen);
+							Addresses[AddressCount].AddressLength = (int)Next[Index]->ai_addrlen;
+							AddressCount++;
+						}
+						Next[Index] = Next[Index]->ai_next;
+					}
+				}
+			}
+
+			if (ResolvedTime == 0 && AddressCount != 0)
+			{
+				ResolvedTime = Now;
+			}
+		}
+
+		// start next connection attempt
+		if (AddressNext < AddressCount && Now >= NextAttemptTime)
+		{
+			SOCKADDR* Address = (SOCKADDR*)&Addresses[AddressNext].Address;
+
+			SOCKET Socket = socket(Address->sa_family, SOCK_STREAM, IPPROTO_TCP);
+			if (Socket != INVALID_SOCKET)
+			{
+				WSAEVENT Event = WSACreateEvent();
+				DERPNET_ASSERT(Event);
+
+				// this also makes socket nonblocking
+				WSAEventSelect(Socket, Event, FD_CONNECT);
+
+				if (connect(Socket, Address, Addresses[AddressNext].AddressLength) == 0 || WSAGetLastError() == WSAEWOULDBLOCK)
+				{
+					Sockets[SocketCount] = Socket;
+					Events[SocketCount] = Event;
+					Attempts[SocketCount] = AddressNext;
+					SocketCount++;
+				}
+				else
+				{
+					WSACloseEvent(Event);
+					closesocket(Socket);
+				}
+			}
+			AddressNext++;
+			NextAttemptTime = Now + DERPNET_ATTEMPT_DELAY * 1000;
+		}
+
+		// check finished connections
+		for (size_t Index = 0; Index < SocketCount; )
+		{
+			WSANETWORKEVENTS NetworkEvents;
+			if (WSAEnumNetworkEvents(Sockets[Index], Events[Index], &NetworkEvents) == 0 && (NetworkEvents.lNetworkEvents & FD_CONNECT))
+			{
+				if (NetworkEvents.iErrorCode[FD_CONNECT_BIT] == 0)
+				{
+					Result = Sockets[Index];
+
+#if !defined(NDEBUG)
+					char Address[128];
+					DWORD AddressLength = ARRAYSIZE(Address);
+					WSAAddressToStringA((SOCKADDR*)&Addresses[Attempts[Index]].Address, Addresses[Attempts[Index]].AddressLength, NULL, Address, &AddressLength);
+					DERPNET_LOG("connected to '%s' -> '%s' server", DerpServer, Address);
+#endif
+					WSAEventSelect(Result, NULL, 0);
+					WSACloseEvent(Events[Index]);
+
+					SocketCount--;
+					Sockets[Index] = Sockets[SocketCount];
+					Events[Index] = Events[SocketCount];
+					Attempts[Index] = Attempts[SocketCount];
+					break;
+				}
+
+				// failed attempt, start next one immediately
+				WSACloseEvent(Events[Index]);
+				closesocket(Sockets[Index]);
+
+				SocketCount--;
+				Sockets[Index] = Sockets[SocketCount];
+				Events[Index] = Events[SocketCount];
+				Attempts[Index] = Attempts[SocketCount];
+				NextAttemptTime = Now;
+				continue;
+			}
+			Index++;
+		}
+
+		if (Result != INVALID_SOCKET)
+		{
+			break;
+		}
+
+		bool LookupsDone = !LookupPending[0] && !LookupPending[1];
+		if (LookupsDone && AddressNext == AddressCount && SocketCount == 0)
+		{
+			DERPNET_LOG("cannot connect to '%s' server", DerpServer);
+			break;
+		}
+
+		Now = DerpNet__GetTime();
+		if (Now >= Deadline)
+		{
+			DERPNET_LOG("timeout while connecting to '%s' server", DerpServer);
+			break;
+		}
+
+		// wait for lookup or connection to finish, or time for next attempt
+		uint64_t WaitUntil = Deadline;
+		if (AddressNext < AddressCount && NextAttemptTime < WaitUntil)
+		{
+			WaitUntil = NextAttemptTime;
+		}
+		if (!AaaaDone && ADone && LookupDone[1] + DERPNET_RESOLUTION_DELAY * 1000 < WaitUntil)
+		{
+			WaitUntil = LookupDone[1] + DERPNET_RESOLUTION_DELAY * 1000;
+		}
+
+		HANDLE Handles[2 + DERPNET_MAX_ADDRESSES];
+		DWORD HandleCount = 0;
+		for (int Index = 0; Index < 2; Index++)
+		{
+			if (LookupPending[Index])
+			{
+				Handles[HandleCount++] = LookupOverlapped[Index].hEvent;
+			}
+		}
+		for (size_t Index = 0; Index < SocketCount; Index++)
+		{
+			Handles[HandleCount++] = Events[Index];
+		}
+
+		DWORD Timeout = WaitUntil > Now ? (DWORD)((WaitUntil - Now + 999) / 1000) : 0;
+		if (HandleCount == 0)
+		{
+			Sleep(Timeout);
+		}
+		else
+		{
+			WaitForMultipleObjects(HandleCount, Handles, FALSE, Timeout);
+		}
+	}
+
+	// cleanup whatever is still pending
+	for (size_t Index = 0; Index < SocketCount; Index++)
+	{
+		WSACloseEvent(Events[Index]);
+		closesocket(Sockets[Index]);
+	}
+
+	for (int Index = 0; Index < 2; Index++)
+	{
+		if (LookupPending[Index])
+		{
+			GetAddrInfoExCancel(&LookupCancel[Index]);
+			WaitForSingleObject(LookupOverlapped[Index].hEvent, INFINITE);
+			if (GetAddrInfoExOverlappedResult(&LookupOverlapped[Index]) != NO_ERROR)
+			{
+				Lookup[Index] = NULL;
+			}
+		}
+		if (Lookup[Index])
+		{
+			FreeAddrInfoExW(Lookup[Index]);
+		}
+		CloseHandle(LookupOverlapped[Index].hEvent);
+	}
+
+	if (Result != INVALID_SOCKET)
+	{
+		uint64_t ConnectedTime = DerpNet__GetTime();
+		Net->DnsTime = (uint32_t)(ResolvedTime - StartTime);
+		Net->TcpTime = (uint32_t)(ConnectedTime - ResolvedTime);
+
+		// TLS handshake uses blocking socket
+		u_long NonBlocking = 0;
+		ioctlsocket(Result, FIONBIO, &NonBlocking);
+	}
+
+	return Result;
+}
+
+bool DerpNet_Open(DerpNet* Net, const char* DerpServer, const DerpKey* UserSecret)
+{
+	return DerpNet_OpenEx(Net, DerpServer, 0, NULL, 0, UserSecret);
+}
+
+bool DerpNet_OpenEx(DerpNet* Net, const char* DerpServer, uint16_t Port, const char* const* Addresses, size_t AddressCount, const DerpKey* UserSecret)
+{
+	CtxtHandle CtxHandle;
+	SecInvalidateHandle(&CtxHandle);
+	InitializeSRWLock((SRWLOCK*)&Net->TlsLock);
+
+	Net->Socket = INVALID_SOCKET;
+	Net->SocketEvent = NULL;
+	Net->BufferSize = Net->BufferReceived = 0;
+	Net->TotalReceived = Net->TotalSent = 0;
+	Net->TotalRecords = Net->TotalSends = 0;
+	Net->Corked = false;
+	Net->WriteCount = Net->WriteSize = 0;
+	Net->ReadTimeout = 0;
+	Net->DnsTime = Net->TcpTime = Net->TlsTime = Net->DerpTime = 0;
+	Net->TlsResumed = false;
+
+	uint64_t Deadline = DerpNet__GetTime() + DERPNET_OPEN_TIMEOUT * 1000ULL;
+
+	WSADATA SocketData;
+	int SocketOk = WSAStartup(MAKEWORD(2, 2), &SocketData);
+	DERPNET_ASSERT(SocketOk == 0);
+
+	//
+	// connect to DERP server
+	//
+
+#if DERPNET_USE_PLAIN_HTTP
+	uint16_t DerpServerPort = Port ? Port : 80;
+#else
+	uint16_t DerpServerPort = Port ? Port : 443;
+#endif
+	Net->Socket = DerpNet__Connect(Net, DerpServer, DerpServerPort, Addresses, AddressCount, Deadline);
+	if (Net->Socket == INVALID_SOCKET)
+	{
+		goto error;
+	}
+
+	// handshake must not block forever if server stops responding
+	DWORD SocketTimeout = DERPNET_OPEN_TIMEOUT;
+	setsockopt(Net->Socket, SOL_SOCKET, SO_RCVTIMEO, (const char*)&SocketTimeout, sizeof(SocketTimeout));
+	setsockopt(Net->Socket, SOL_SOCKET, SO_SNDTIMEO, (const char*)&SocketTimeout, sizeof(SocketTimeout));
+
+	uint64_t PhaseTime = DerpNet__GetTime();
+
+#if !DERPNET_USE_PLAIN_HTTP
+	if (!DerpNet__TlsHandshake(Net, DerpServer, &CtxHandle))
+	{
+		goto error;
+	}
+
+	SecPkgContext_SessionInfo SessionInfo;
+	if (QueryContextAttributesA(&CtxHandle, SECPKG_ATTR_SESSION_INFO, &SessionInfo) == SEC_E_OK)
+	{
+		Net->TlsResumed = (SessionInfo.dwFlags & SSL_SESSION_RECONNECT) != 0;
+	}
+
+	SecPkgContext_StreamSizes StreamSizes;
+	SECURITY_STATUS SecStatus = QueryContextAttributes(&CtxHandle, SECPKG_ATTR_STREAM_SIZES, &StreamSizes);
+	DERPNET_ASSERT(SecStatus == SEC_E_OK);
+	DERPNET_ASSERT(StreamSizes.cbHeader + StreamSizes.cbMaximumMessage + StreamSizes.cbTrailer <= sizeof(Net->WriteBuffer[0]));
+
+	Net->StreamHeader = StreamSizes.cbHeader;
+	Net->StreamTrailer = StreamSizes.cbTrailer;
+	Net->StreamMaxMessage = StreamSizes.cbMaximumMessage;
+
+	DERPNET_ASSERT(sizeof(CtxHandle) == sizeof(Net->CtxHandle));
+	memcpy(&Net->CtxHandle, &CtxHandle, sizeof(CtxHandle));
+#else
+	Net->StreamHeader = Net->StreamTrailer = 0;
+	Net->StreamMaxMessage = 16384;
+#endif
+
+	Net->TlsTime = (uint32_t)(DerpNet__GetTime() - PhaseTime);
+	PhaseTime = DerpNet__GetTime();
 
 	Net->SocketEvent = WSACreateEvent();
 	DERPNET_ASSERT(Net->SocketEvent);
 
 	WSAEventSelect(Net->Socket, Net->SocketEvent, FD_READ);
 
+	// socket is nonblocking from now on, so DERP handshake uses select timeout instead
+	Net->ReadTimeout = DERPNET_OPEN_TIMEOUT;
+
 	//
 	// send inital HTTP GET request, ask to switch to DERP protocol immediately
 	//
@@ -1535,6 +2327,7 @@ bool DerpNet_Open(DerpNet* Net, const char* DerpServer, const DerpKey* UserSecre
 	uint8_t FrameType;
 	uint32_t FrameSize;
 	memset(Net->LastPublicKey, 0, sizeof(Net->LastPublicKey));
+	memset(Net->LastRecvPublicKey, 0, sizeof(Net->LastRecvPublicKey));
 
 	//
 	// receive ServerKey frame
@@ -1571,16 +2364,20 @@ bool DerpNet_Open(DerpNet* Net, const char* DerpServer, const DerpKey* UserSecre
 	//
 
 	{
-		static const char ClientInfo[] = "{\"version\": 2}";
+		char ClientInfo[128];
+		int ClientInfoLength = Net->MeshKey[0]
+			? snprintf(ClientInfo, sizeof(ClientInfo), "{\"version\": 2, \"meshKey\": \"%.64s\"}", Net->MeshKey)
+			: snprintf(ClientInfo, sizeof(ClientInfo), "{\"version\": 2}");
 
-		uint8_t OutFrame[1 + 4 + 32 + 24 + 16 + sizeof(ClientInfo) - 1];
+		uint8_t OutFrame[1 + 4 + 32 + 24 + 16 + sizeof(ClientInfo)];
+		size_t OutFrameSize = 1 + 4 + 32 + 24 + 16 + ClientInfoLength;
 
 		OutFrame[0] = 2; // ClientInfo
-		Set32BE(OutFrame + 1, sizeof(OutFrame) - (1 + 4));
+		Set32BE(OutFrame + 1, (uint32_t)(OutFrameSize - (1 + 4)));
 		memcpy(OutFrame + 1 + 4, UserPublicKey.Bytes, sizeof(UserPublicKey.Bytes));
-		DerpNet__BoxSeal(OutFrame + 1 + 4 + 32, OutFrame + 1 + 4 + 32 + 24, OutFrame + 1 + 4 + 32 + 24 + 16, (uint8_t*)ClientInfo, sizeof(ClientInfo) - 1, UserSecret->Bytes, ServerPublicKey);
+		DerpNet__BoxSeal(OutFrame + 1 + 4 + 32, OutFrame + 1 + 4 + 32 + 24, OutFrame + 1 + 4 + 32 + 24 + 16, (uint8_t*)ClientInfo, ClientInfoLength, UserSecret->Bytes, ServerPublicKey);
 
-		if (!DerpNet__TlsWrite(Net, OutFrame, sizeof(OutFrame)))
+		if (!DerpNet__TlsWrite(Net, OutFrame, OutFrameSize))
 		{
 			goto error;
 		}
@@ -1618,8 +2415,24 @@ bool DerpNet_Open(DerpNet* Net, const char* DerpServer, const DerpKey* UserSecre
 	// ready!
 	//
 
+	// reopening with same key continues same nonce sequence, so peer's replay window keeps working
+	if (memcmp(Net->UserPrivateKey, UserSecret->Bytes, sizeof(Net->UserPrivateKey)) != 0)
+	{
+		DerpNet__GetRandom(Net->SendNonce, sizeof(Net->SendNonce));
+		Net->SendCounter = 0;
+		memset(Net->RecvSenders, 0, sizeof(Net->RecvSenders));
+		Net->TotalReplays = 0;
+	}
 	memcpy(Net->UserPrivateKey, UserSecret->Bytes, sizeof(Net->UserPrivateKey));
 
+	Net->DerpTime = (uint32_t)(DerpNet__GetTime() - PhaseTime);
+	DERPNET_LOG("opened in dns=%u, tcp=%u, tls=%u%s, derp=%u usec", Net->DnsTime, Net->TcpTime, Net->TlsTime, Net->TlsResumed ? " (resumed)" : "", Net->DerpTime);
+
+	SocketTimeout = 0;
+	setsockopt(Net->Socket, SOL_SOCKET, SO_RCVTIMEO, (const char*)&SocketTimeout, sizeof(SocketTimeout));
+	setsockopt(Net->Socket, SOL_SOCKET, SO_SNDTIMEO, (const char*)&SocketTimeout, sizeof(SocketTimeout));
+
+	Net->ReadTimeout = 0;
 	Net->LastFrameSize = 0;
 	return true;
 
@@ -1629,10 +2442,6 @@ error:
 	{
 		DeleteSecurityContext(&CtxHandle);
 	}
-	if (SecIsValidHandle(&CredHandle))
-	{
-		FreeCredentialsHandle(&CredHandle);
-	}
 #endif
 	if (Net->SocketEvent)
 	{
@@ -1642,10 +2451,6 @@ error:
 	{
 		closesocket(Net->Socket);
 	}
-	if (AddrInfo)
-	{
-		freeaddrinfo(AddrInfo);
-	}
 	WSACleanup();
 
 	return false;
@@ -1653,15 +2458,164 @@ error:
 
 void DerpNet_Close(DerpNet* Net)
 {
+	DERPNET_LOG("closing, sent %zu bytes in %zu records with %zu send calls", Net->TotalSent, Net->TotalRecords, Net->TotalSends);
+
 #if !DERPNET_USE_PLAIN_HTTP
+	// credentials handle is shared by all connections and stays alive to keep TLS session cache
 	DeleteSecurityContext((CtxtHandle*)Net->CtxHandle);
-	FreeCredentialsHandle((CredHandle*)Net->CredHandle);
 #endif
 	WSACloseEvent(Net->SocketEvent);
 	closesocket(Net->Socket);
 	WSACleanup();
 }
 
+typedef struct {
+	DerpNet* Net;
+	char DerpServer[256];
+	uint16_t Port;
+	char Addresses[DERPNET_MAX_ADDRESSES][64];
+	size_t AddressCount;
+	DerpKey UserSecret;
+	DerpNet_OpenCallback* Callback;
+	void* UserData;
+} DerpNet__OpenWork;
+
+static void CALLBACK DerpNet__OpenWorkCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Context)
+{
+	DerpNet__OpenWork Work = *(DerpNet__OpenWork*)Context;
+	SecureZeroMemory(Context, sizeof(Work));
+	HeapFree(GetProcessHeap(), 0, Context);
+
+	const char* Addresses[DERPNET_MAX_ADDRESSES];
+	for (size_t Index = 0; Index < Work.AddressCount; Index++)
+	{
+		Addresses[Index] = Work.Addresses[Index];
+	}
+
+	bool Connected = DerpNet_OpenEx(Work.Net, Work.DerpServer, Work.Port, Addresses, Work.AddressCount, &Work.UserSecret);
+	SecureZeroMemory(&Work.UserSecret, sizeof(Work.UserSecret));
+
+	Work.Callback(Work.Net, Connected, Work.UserData);
+}
+
+bool DerpNet_OpenAsync(DerpNet* Net, const char* DerpServer, uint16_t Port, const char* const* Addresses, size_t AddressCount, const DerpKey* UserSecret, DerpNet_OpenCallback* Callback, void* UserData)
+{
+	DerpNet__OpenWork* Work = HeapAlloc(GetProcessHeap(), 0, sizeof(*Work));
+	if (!Work)
+	{
+		return false;
+	}
+
+	Work->Net = Net;
+	lstrcpynA(Work->DerpServer, DerpServer, sizeof(Work->DerpServer));
+	Work->Port = Port;
+	Work->AddressCount = min(AddressCount, DERPNET_MAX_ADDRESSES);
+	for (size_t Index = 0; Index < Work->AddressCount; Index++)
+	{
+		lstrcpynA(Work->Addresses[Index], Addresses[Index], sizeof(Work->Addresses[Index]));
+	}
+	Work->UserSecret = *UserSecret;
+	Work->Callback = Callback;
+	Work->UserData = UserData;
+
+	if (!TrySubmitThreadpoolCallback(&DerpNet__OpenWorkCallback, Work, NULL))
+	{
+		SecureZeroMemory(Work, sizeof(*Work));
+		HeapFree(GetProcessHeap(), 0, Work);
+		return false;
+	}
+	return true;
+}
+
+#endif // defined(_WIN32)
+
+bool DerpNet_AcceptNonce(DerpNet_Replay* Replay, const uint8_t Nonce[24])
+{
+	uint64_t Counter = Get64LE(Nonce + sizeof(Replay->Prefix));
+
+	if (Replay->Window == 0)
+	{
+		memcpy(Replay->Prefix, Nonce, sizeof(Replay->Prefix));
+		Replay->Counter = Counter;
+		Replay->Window = 1;
+		return true;
+	}
+
+	// new prefix from same sender is old connection's packet or random nonce, either way window is not restarted
+	if (memcmp(Nonce, Replay->Prefix, sizeof(Replay->Prefix)) != 0)
+	{
+		return false;
+	}
+
+	if (Counter > Replay->Counter)
+	{
+		uint64_t Shift = Counter - Replay->Counter;
+		Replay->Window = Shift >= 64 ? 1 : (Replay->Window << Shift) | 1;
+		Replay->Counter = Counter;
+	}
+	else
+	{
+		uint64_t Offset = Replay->Counter - Counter;
+		if (Offset >= 64 || (Replay->Window & (1ULL << Offset)))
+		{
+			return false;
+		}
+		Replay->Window |= 1ULL << Offset;
+	}
+	return true;
+}
+
+#if defined(_WIN32)
+
+// new sender takes window of sender that is idle longest, if none is idle then of sender with fewest accepted
+// packets, so strays sending few packets to user key cannot push out window of long running session peer
+static bool DerpNet__AcceptSenderNonce(DerpNet* Net, const uint8_t* PublicKey, const uint8_t* Nonce)
+{
+	uint64_t Now = DerpNet__GetTime();
+
+	DerpNet_RecvSender* Found = NULL;
+	DerpNet_RecvSender* Replace = NULL;
+	uint64_t ReplaceScore = UINT64_MAX;
+
+	for (size_t Index = 0; Index < DERPNET_RECV_SENDERS; Index++)
+	{
+		DerpNet_RecvSender* Sender = &Net->RecvSenders[Index];
+		if (Sender->Replay.Window != 0 && memcmp(Sender->PublicKey, PublicKey, sizeof(Sender->PublicKey)) == 0)
+		{
+			Found = Sender;
+			break;
+		}
+
+		// unused slot first, then idle senders from oldest, then active senders from least used
+		uint64_t Idle = (Now - Sender->LastTime) / 1000;
+		uint64_t Score = Sender->Replay.Window == 0 ? 0
+			: Idle >= DERPNET_SENDER_IDLE ? UINT32_MAX - min(Idle, UINT32_MAX - 1)
+			: UINT32_MAX + Sender->Accepted;
+		if (Score < ReplaceScore)
+		{
+			Replace = Sender;
+			ReplaceScore = Score;
+		}
+	}
+
+	if (Found == NULL)
+	{
+		Found = Replace;
+		memset(Found, 0, sizeof(*Found));
+		memcpy(Found->PublicKey, PublicKey, sizeof(Found->PublicKey));
+	}
+
+	if (!DerpNet_AcceptNonce(&Found->Replay, Nonce))
+	{
+		return false;
+	}
+
+	Found->LastTime = Now;
+	Found->Accepted++;
+	Net->RecvSequence = Get64LE(Nonce + sizeof(Found->Replay.Prefix));
+	return true;
+}
+
 int DerpNet_Recv(DerpNet* Net, DerpKey* ReceivedUserPublicKey, uint8_t** ReceivedData, uint32_t* ReceivedSize, bool Wait)
 {
 	DerpNet__TlsConsume(Net, Net->LastFrameSize);
@@ -1694,14 +2648,15 @@ int DerpNet_Recv(DerpNet* Net, DerpKey* ReceivedUserPublicKey, uint8_t** Receive
 				uint8_t* Data = Auth + 16;
 				uint32_t DataSize = FrameSize - (32 + 24 + 16);
 
-				if (memcmp(PublicKey, Net->LastPublicKey, sizeof(Net->LastPublicKey)) != 0)
+				// separate from sending side cache, so receiving can happen on other thread
+				if (memcmp(PublicKey, Net->LastRecvPublicKey, sizeof(Net->LastRecvPublicKey)) != 0)
 				{
-					DerpNet__GetSharedKey(Net->LastSharedKey, Net->UserPrivateKey, PublicKey);
-					memcpy(Net->LastPublicKey, PublicKey, sizeof(Net->LastPublicKey));
+					DerpNet__GetSharedKey(Net->LastRecvSharedKey, Net->UserPrivateKey, PublicKey);
+					memcpy(Net->LastRecvPublicKey, PublicKey, sizeof(Net->LastRecvPublicKey));
 				}
 
-				bool UnsealOk = DerpNet__BoxUnsealEx(Data, Data, DataSize, Auth, Nonce, Net->LastSharedKey);
-				if (UnsealOk)
+				bool UnsealOk = DerpNet__BoxUnsealParallel(DerpNet__GetThreadCount(Net->MaxThreads), Data, Data, DataSize, Auth, Nonce, Net->LastRecvSharedKey);
+				if (UnsealOk && DerpNet__AcceptSenderNonce(Net, PublicKey, Nonce))
 				{
 					memcpy(ReceivedUserPublicKey->Bytes, PublicKey, sizeof(ReceivedUserPublicKey->Bytes));
 					*ReceivedData = Data;
@@ -1711,6 +2666,11 @@ int DerpNet_Recv(DerpNet* Net, DerpKey* ReceivedUserPublicKey, uint8_t** Receive
 
 					return 1;
 				}
+				else if (UnsealOk)
+				{
+					DERPNET_LOG("replayed or too old packet, ignoring");
+					Net->TotalReplays++;
+				}
 				else
 				{
 					DERPNET_LOG("failed to verify encrypted data");
@@ -1721,6 +2681,15 @@ int DerpNet_Recv(DerpNet* Net, DerpKey* ReceivedUserPublicKey, uint8_t** Receive
 				DERPNET_LOG("RecvPacket frame too short, expected at least %u bytes, got %u", 32 + 24 + 16, FrameSize);
 			}
 		}
+		else if (FrameType == 8 || FrameType == 9) // PeerGone, PeerPresent
+		{
+			if (FrameSize >= 32 && Net->PeerCallback)
+			{
+				DerpKey PeerKey;
+				memcpy(PeerKey.Bytes, Net->Buffer, sizeof(PeerKey.Bytes));
+				Net->PeerCallback(&PeerKey, FrameType == 9, Net->PeerUserData);
+			}
+		}
 		else
 		{
 			DERPNET_LOG("unknown frame, ignoring");
@@ -1741,7 +2710,8 @@ bool DerpNet_Send(DerpNet* Net, const DerpKey* TargetUserPublicKey, const void*
 	}
 
 	uint8_t Nonce[24];
-	DerpNet__GetRandom(Nonce, sizeof(Nonce));
+	memcpy(Nonce, Net->SendNonce, sizeof(Net->SendNonce));
+	Set64LE(Nonce + sizeof(Net->SendNonce), ++Net->SendCounter);
 
 	return DerpNet_SendEx(Net, TargetUserPublicKey, Net->LastSharedKey, Nonce, Data, DataSize);
 }
@@ -1769,4 +2739,261 @@ bool DerpNet_SendEx(DerpNet* Net, const DerpKey* TargetUserPublicKey, const uint
 	return DerpNet__TlsWrite(Net, OutFrame, OutFrameSize);
 }
 
+#endif // defined(_WIN32)
+
+typedef struct {
+	const DerpNet_Chunk* Chunks;
+	uint8_t** Frames;
+	const uint8_t* SharedKey;
+} DerpNet__SealTask;
+
+static void DerpNet__SealTaskCallback(void* Context, size_t Index)
+{
+	DerpNet__SealTask* Task = Context;
+	const DerpNet_Chunk* Chunk = &Task->Chunks[Index];
+
+	uint8_t* Nonce = Task->Frames[Index] + 1 + 4 + 32;
+	uint8_t* Auth = Nonce + 24;
+	uint8_t* Output = Auth + 16;
+
+	// sealing works in place, chunk without prefix can have NULL Prefix
+	if (Chunk->PrefixSize != 0)
+	{
+		memcpy(Output, Chunk->Prefix, Chunk->PrefixSize);
+	}
+	memcpy(Output + Chunk->PrefixSize, Chunk->Data, Chunk->DataSize);
+	DerpNet__BoxSealEx(Nonce, Auth, Output, Output, Chunk->PrefixSize + Chunk->DataSize, Task->SharedKey);
+}
+
+#if defined(_WIN32)
+
+bool DerpNet_SendChunks(DerpNet* Net, const DerpKey* TargetUserPublicKey, const DerpNet_Chunk* Chunks, size_t ChunkCount)
+{
+	if (memcmp(TargetUserPublicKey->Bytes, Net->LastPublicKey, sizeof(Net->LastPublicKey)) != 0)
+	{
+		DerpNet__GetSharedKey(Net->LastSharedKey, Net->UserPrivateKey, TargetUserPublicKey->Bytes);
+		memcpy(Net->LastPublicKey, TargetUserPublicKey->Bytes, sizeof(Net->LastPublicKey));
+	}
+
+	size_t MemorySize = ChunkCount * (sizeof(uint8_t*) + sizeof(DerpNet__Flag));
+	size_t TotalSize = 0;
+	for (size_t Index = 0; Index < ChunkCount; Index++)
+	{
+		size_t FrameSize = 1 + 4 + 32 + 24 + 16 + Chunks[Index].PrefixSize + Chunks[Index].DataSize;
+		DERPNET_ASSERT(FrameSize <= (1 << 16));
+
+		MemorySize += FrameSize;
+		TotalSize += Chunks[Index].PrefixSize + Chunks[Index].DataSize;
+	}
+
+	// small amount of data is not worth waking up other threads
+	uint32_t ThreadCount = TotalSize < 2 * DERPNET_PARALLEL_SIZE ? 1 : DerpNet__GetThreadCount(Net->MaxThreads);
+
+	uint8_t* Memory = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, MemorySize);
+	if (!Memory)
+	{
+		return false;
+	}
+
+	uint8_t** Frames = (uint8_t**)Memory;
+	volatile DerpNet__Flag* Done = (DerpNet__Flag*)(Memory + ChunkCount * sizeof(uint8_t*));
+	uint8_t* Frame = Memory + ChunkCount * (sizeof(uint8_t*) + sizeof(DerpNet__Flag));
+
+	// frame headers & nonces are assigned in order, so receiver sees increasing nonce counters
+	for (size_t Index = 0; Index < ChunkCount; Index++)
+	{
+		size_t FrameSize = 1 + 4 + 32 + 24 + 16 + Chunks[Index].PrefixSize + Chunks[Index].DataSize;
+
+		Frame[0] = 4; // SendPacket
+		Set32BE(Frame + 1, (uint32_t)(FrameSize - (1 + 4)));
+		memcpy(Frame + 1 + 4, TargetUserPublicKey->Bytes, 32);
+		memcpy(Frame + 1 + 4 + 32, Net->SendNonce, sizeof(Net->SendNonce));
+		Set64LE(Frame + 1 + 4 + 32 + sizeof(Net->SendNonce), ++Net->SendCounter);
+
+		Frames[Index] = Frame;
+		Frame += FrameSize;
+	}
+
+	DerpNet__SealTask Task = { Chunks, Frames, Net->LastSharedKey };
+
+	DerpNet__Tasks Tasks;
+	DerpNet__TasksStart(&Tasks, ChunkCount, Done, ThreadCount, &DerpNet__SealTaskCallback, &Task);
+
+	// frames are packed into TLS records as soon as each one is sealed, and sent together at the end
+	bool Corked = Net->Corked;
+	Net->Corked = true;
+
+	bool Result = true;
+	for (size_t Index = 0; Result && Index < ChunkCount; Index++)
+	{
+		DerpNet__TasksWait(&Tasks, Index);
+		Result = DerpNet__TlsWrite(Net, Frames[Index], 1 + 4 + 32 + 24 + 16 + Chunks[Index].PrefixSize + Chunks[Index].DataSize);
+	}
+	DerpNet__TasksFinish(&Tasks);
+
+	Net->Corked = Corked;
+	if (Result && !Corked)
+	{
+		Result = DerpNet__TlsFlush(Net);
+	}
+
+	HeapFree(GetProcessHeap(), 0, Memory);
+	return Result;
+}
+
+void DerpNet_Cork(DerpNet* Net)
+{
+	Net->Corked = true;
+}
+
+bool DerpNet_Uncork(DerpNet* Net)
+{
+	Net->Corked = false;
+	return DerpNet__TlsFlush(Net);
+}
+
+void DerpNet_GetSharedKey(DerpNet* Net, const DerpKey* TargetUserPublicKey, uint8_t SharedKey[32])
+{
+	if (memcmp(TargetUserPublicKey->Bytes, Net->LastPublicKey, sizeof(Net->LastPublicKey)) != 0)
+	{
+		DerpNet__GetSharedKey(Net->LastSharedKey, Net->UserPrivateKey, TargetUserPublicKey->Bytes);
+		memcpy(Net->LastPublicKey, TargetUserPublicKey->Bytes, sizeof(Net->LastPublicKey));
+	}
+	memcpy(SharedKey, Net->LastSharedKey, 32);
+}
+
+#endif // defined(_WIN32)
+
+void DerpNet_Seal(const uint8_t SharedKey[32], uint8_t* Output, const void* Data, size_t DataSize)
+{
+	uint8_t* Nonce = Output;
+	uint8_t* Auth = Nonce + 24;
+
+	DerpNet__GetRandom(Nonce, 24);
+	DerpNet__BoxSealEx(Nonce, Auth, Auth + 16, (const uint8_t*)Data, DataSize, SharedKey);
+}
+
+void DerpNet_SealCounter(const uint8_t SharedKey[32], uint8_t* Output, const uint8_t Prefix[16], uint64_t Counter, const void* Data, size_t DataSize)
+{
+	uint8_t* Nonce = Output;
+	uint8_t* Auth = Nonce + 24;
+
+	memcpy(Nonce, Prefix, 16);
+	Set64LE(Nonce + 16, Counter);
+	DerpNet__BoxSealEx(Nonce, Auth, Auth + 16, (const uint8_t*)Data, DataSize, SharedKey);
+}
+
+bool DerpNet_Unseal(const uint8_t SharedKey[32], uint8_t* Output, const uint8_t* Input, size_t InputSize)
+{
+	if (InputSize < 24 + 16)
+	{
+		return false;
+	}
+
+	const uint8_t* Nonce = Input;
+	const uint8_t* Auth = Nonce + 24;
+
+	return DerpNet__BoxUnsealEx(Output, Auth + 16, InputSize - (24 + 16), Auth, Nonce, SharedKey);
+}
+
+#if defined(_WIN32)
+
+bool DerpNet_WatchConns(DerpNet* Net)
+{
+	uint8_t OutFrame[1 + 4];
+	OutFrame[0] = 0x10; // WatchConns
+	Set32BE(OutFrame + 1, 0);
+
+	return DerpNet__TlsWrite(Net, OutFrame, sizeof(OutFrame));
+}
+
+bool DerpNet_ForwardPacket(DerpNet* Net, const DerpKey* SourceUserPublicKey, const DerpKey* TargetUserPublicKey, const void* SealedData, size_t SealedSize)
+{
+	uint8_t OutFrame[1 << 16];
+
+	size_t OutFrameSize = 1 + 4 + 32 + 32 + SealedSize;
+	if (OutFrameSize > sizeof(OutFrame))
+	{
+		return false;
+	}
+
+	OutFrame[0] = 0x0a; // ForwardPacket
+	Set32BE(OutFrame + 1, (uint32_t)(OutFrameSize - (1 + 4)));
+	memcpy(OutFrame + 1 + 4, SourceUserPublicKey->Bytes, 32);
+	memcpy(OutFrame + 1 + 4 + 32, TargetUserPublicKey->Bytes, 32);
+	memcpy(OutFrame + 1 + 4 + 32 + 32, SealedData, SealedSize);
+
+	return DerpNet__TlsWrite(Net, OutFrame, OutFrameSize);
+}
+
+bool DerpNet_Ping(DerpNet* Net, uint32_t TimeoutMsec, uint32_t* RoundTrip)
+{
+	DerpNet__TlsConsume(Net, Net->LastFrameSize);
+	Net->LastFrameSize = 0;
+
+	uint8_t OutFrame[1 + 4 + 8];
+	OutFrame[0] = 0x12; // Ping
+	Set32BE(OutFrame + 1, 8);
+	DerpNet__GetRandom(OutFrame + 1 + 4, 8);
+
+	LARGE_INTEGER Freq, Start, Now;
+	QueryPerformanceFrequency(&Freq);
+	QueryPerformanceCounter(&Start);
+
+	// ping must go out right away, even if connection is corked
+	if (!DerpNet__TlsWrite(Net, OutFrame, sizeof(OutFrame)) || !DerpNet__TlsFlush(Net))
+	{
+		return false;
+	}
+
+	for (;;)
+	{
+		uint8_t FrameType;
+		uint32_t FrameSize;
+
+		int GotFrame = DerpNet__ReadFrame(Net, &FrameType, &FrameSize, false);
+		if (GotFrame < 0)
+		{
+			DERPNET_LOG("disconnecting in Ping");
+			return false;
+		}
+
+		QueryPerformanceCounter(&Now);
+
+		if (GotFrame > 0)
+		{
+			bool IsPong = FrameType == 0x13 && FrameSize == 8 && memcmp(Net->Buffer, OutFrame + 1 + 4, 8) == 0;
+			DerpNet__TlsConsume(Net, FrameSize);
+
+			if (IsPong)
+			{
+				*RoundTrip = (uint32_t)((Now.QuadPart - Start.QuadPart) * 1000000 / Freq.QuadPart);
+				return true;
+			}
+			continue;
+		}
+
+		uint64_t Elapsed = (Now.QuadPart - Start.QuadPart) * 1000 / Freq.QuadPart;
+		if (Elapsed >= TimeoutMsec)
+		{
+			DERPNET_LOG("timeout while waiting for Pong frame");
+			return false;
+		}
+
+		uint32_t Remaining = TimeoutMsec - (uint32_t)Elapsed;
+
+		fd_set ReadSet;
+		FD_ZERO(&ReadSet);
+		FD_SET(Net->Socket, &ReadSet);
+
+		struct timeval TimeVal = { Remaining / 1000, (Remaining % 1000) * 1000 };
+		if (select((int)(Net->Socket + 1), &ReadSet, NULL, NULL, &TimeVal) < 0)
+		{
+			return false;
+		}
+	}
+}
+
+#endif // defined(_WIN32)
+
 #endif // defined(DERP_STATIC) || defined(DERP_IMPLEMENTATION)
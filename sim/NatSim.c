@@ -0,0 +1,535 @@
+#define _CRT_SECURE_NO_DEPRECATE
+#define _POSIX_C_SOURCE 200809L
+#define _WINSOCK_DEPRECATED_NO_WARNINGS
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment (lib, "ws2_32")
+typedef int socklen_t;
+#define poll WSAPoll
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+typedef int SOCKET;
+#define INVALID_SOCKET (-1)
+#define closesocket close
+#endif
+
+//
+// NatSim - UDP NAT simulator for testing direct path hole punching with two ScreenBuddy instances on one computer
+//
+// usage: NatSim [-stun 3478] [-mode port] [-drop 0] [-seed 1]
+//
+// NatSim is STUN server on 127.0.0.1, and NAT for every client that sends it Binding request. Each such client
+// gets its own public address 127.0.1.N, where NatSim opens mapped UDP ports for it. Client learns its mapped
+// port from STUN response, and peer sends to that port. Datagram that arrives on mapped port from another known
+// client goes through sender's NAT first - it gets mapping for that destination - and then through filter of
+// receiver's NAT. If it passes, NatSim sends it to receiver's real address from sender's mapped port, so
+// receiver sees only public addresses, same as behind real NAT. Datagrams from unknown clients are dropped.
+//
+// modes, -mode takes comma separated list, client N gets N-th entry, last entry repeats:
+//   cone        one mapping per client, any source can send to it
+//   restricted  one mapping per client, source address must have been sent to before
+//   port        one mapping per client, source address & port must have been sent to before
+//   symmetric   new mapping for every destination, filtered like port
+//
+// ScreenBuddy uses it when DerpMap has STUNPort of NatSim, and UdpLocalCandidates=0 in ini hides local interface
+// addresses, so hole punching has only public candidates. "set NAT=port,symmetric" before sim\run.cmd does that.
+// -drop is probability to lose forwarded datagram.
+//
+
+enum
+{
+	NAT_MAX_CLIENTS		= 16,
+	NAT_MAX_MAPPINGS	= 256,
+	NAT_MAX_PERMISSIONS	= 32,		// per mapping
+	NAT_MAX_MODES		= 8,
+	NAT_MAX_DATAGRAM	= 2048,
+	NAT_DEFAULT_STUN	= 3478,
+};
+
+typedef enum
+{
+	NAT_CONE,
+	NAT_RESTRICTED,
+	NAT_PORT,
+	NAT_SYMMETRIC,
+	NAT_MODE_COUNT,
+}
+Nat_Mode;
+
+static const char* Nat_ModeNames[NAT_MODE_COUNT] =
+{
+	"cone",
+	"restricted",
+	"port",
+	"symmetric",
+};
+
+typedef struct
+{
+	struct sockaddr_in Inside;		// real address of client
+	struct sockaddr_in Public;		// 127.0.1.N with port 0
+	Nat_Mode Mode;
+}
+Nat_Client;
+
+typedef struct
+{
+	uint32_t Client;
+	SOCKET Socket;
+	struct sockaddr_in Public;		// address & port of Socket
+	struct sockaddr_in Destination;	// only for symmetric mode
+	uint32_t PermissionCount;
+	struct sockaddr_in Permissions[NAT_MAX_PERMISSIONS];	// public endpoints client has sent to
+}
+Nat_Mapping;
+
+typedef struct
+{
+	SOCKET Stun;
+	uint16_t StunPort;
+	uint32_t ModeCount;
+	Nat_Mode Modes[NAT_MAX_MODES];
+	double Drop;
+	uint64_t Random;
+	bool Verbose;
+
+	uint32_t ClientCount;
+	Nat_Client Clients[NAT_MAX_CLIENTS];
+	uint32_t MappingCount;
+	Nat_Mapping Mappings[NAT_MAX_MAPPINGS];
+
+	// counters since start
+	uint64_t StunRequests;
+	uint64_t Forwarded;
+	uint64_t Filtered;		// rejected by receiver's NAT
+	uint64_t Unknown;		// from address that is not NatSim client
+	uint64_t Dropped;		// by -drop
+}
+Nat_Sim;
+
+static const uint8_t Nat_StunCookie[4] = { 0x21, 0x12, 0xa4, 0x42 };
+
+static bool Nat_SameEndpoint(const struct sockaddr_in* A, const struct sockaddr_in* B)
+{
+	return A->sin_addr.s_addr == B->sin_addr.s_addr && A->sin_port == B->sin_port;
+}
+
+static double Nat_Random01(uint64_t* State)
+{
+	// splitmix64
+	uint64_t Value = (*State += 0x9e3779b97f4a7c15ULL);
+	Value = (Value ^ (Value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	Value = (Value ^ (Value >> 27)) * 0x94d049bb133111ebULL;
+	Value ^= Value >> 31;
+	return (double)(Value >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static bool Nat_ParseModes(Nat_Sim* Nat, const char* Text)
+{
+	Nat->ModeCount = 0;
+	while (*Text)
+	{
+		size_t Length = strcspn(Text, ",");
+
+		int Mode = -1;
+		for (int Index = 0; Index < NAT_MODE_COUNT; Index++)
+		{
+			if (strlen(Nat_ModeNames[Index]) == Length && strncmp(Text, Nat_ModeNames[Index], Length) == 0)
+			{
+				Mode = Index;
+			}
+		}
+
+		if (Mode < 0 || Nat->ModeCount == NAT_MAX_MODES)
+		{
+			return false;
+		}
+		Nat->Modes[Nat->ModeCount++] = (Nat_Mode)Mode;
+
+		Text += Length;
+		Text += *Text == ',';
+	}
+	return Nat->ModeCount != 0;
+}
+
+static SOCKET Nat_OpenSocket(struct sockaddr_in* Address)
+{
+	SOCKET Socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (Socket == INVALID_SOCKET)
+	{
+		return INVALID_SOCKET;
+	}
+
+	socklen_t Length = sizeof(*Address);
+	if (bind(Socket, (struct sockaddr*)Address, sizeof(*Address)) != 0 || getsockname(Socket, (struct sockaddr*)Address, &Length) != 0)
+	{
+		closesocket(Socket);
+		return INVALID_SOCKET;
+	}
+
+#if defined(_WIN32)
+	u_long NonBlocking = 1;
+	ioctlsocket(Socket, FIONBIO, &NonBlocking);
+#else
+	fcntl(Socket, F_SETFL, fcntl(Socket, F_GETFL) | O_NONBLOCK);
+#endif
+	return Socket;
+}
+
+static bool Nat_Open(Nat_Sim* Nat, uint16_t StunPort)
+{
+	struct sockaddr_in Address = { .sin_family = AF_INET, .sin_port = htons(StunPort) };
+	Address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	Nat->Stun = Nat_OpenSocket(&Address);
+	Nat->StunPort = ntohs(Address.sin_port);
+	return Nat->Stun != INVALID_SOCKET;
+}
+
+static void Nat_Close(Nat_Sim* Nat)
+{
+	for (uint32_t Index = 0; Index < Nat->MappingCount; Index++)
+	{
+		closesocket(Nat->Mappings[Index].Socket);
+	}
+	Nat->MappingCount = 0;
+	Nat->ClientCount = 0;
+
+	if (Nat->Stun != INVALID_SOCKET)
+	{
+		closesocket(Nat->Stun);
+		Nat->Stun = INVALID_SOCKET;
+	}
+}
+
+static Nat_Client* Nat_FindClient(Nat_Sim* Nat, const struct sockaddr_in* Inside)
+{
+	for (uint32_t Index = 0; Index < Nat->ClientCount; Index++)
+	{
+		if (Nat_SameEndpoint(&Nat->Clients[Index].Inside, Inside))
+		{
+			return &Nat->Clients[Index];
+		}
+	}
+	return NULL;
+}
+
+static Nat_Client* Nat_AddClient(Nat_Sim* Nat, const struct sockaddr_in* Inside)
+{
+	Nat_Client* Client = Nat_FindClient(Nat, Inside);
+	if (Client || Nat->ClientCount == NAT_MAX_CLIENTS)
+	{
+		return Client;
+	}
+
+	uint32_t Index = Nat->ClientCount++;
+	Client = &Nat->Clients[Index];
+	Client->Inside = *Inside;
+	Client->Public = (struct sockaddr_in) { .sin_family = AF_INET };
+	Client->Public.sin_addr.s_addr = htonl(0x7f000100 + Index + 1);
+	Client->Mode = Nat->Modes[Index < Nat->ModeCount ? Index : Nat->ModeCount - 1];
+
+	if (Nat->Verbose)
+	{
+		printf("client %u from %s:%u is %s NAT\n", Index, inet_ntoa(Inside->sin_addr), ntohs(Inside->sin_port), Nat_ModeNames[Client->Mode]);
+	}
+	return Client;
+}
+
+// mapping that client uses to send to Destination, created on first use
+static Nat_Mapping* Nat_GetMapping(Nat_Sim* Nat, Nat_Client* Client, const struct sockaddr_in* Destination)
+{
+	uint32_t ClientIndex = (uint32_t)(Client - Nat->Clients);
+	bool PerDestination = Client->Mode == NAT_SYMMETRIC;
+
+	for (uint32_t Index = 0; Index < Nat->MappingCount; Index++)
+	{
+		Nat_Mapping* Mapping = &Nat->Mappings[Index];
+		if (Mapping->Client == ClientIndex && (!PerDestination || Nat_SameEndpoint(&Mapping->Destination, Destination)))
+		{
+			return Mapping;
+		}
+	}
+
+	if (Nat->MappingCount == NAT_MAX_MAPPINGS)
+	{
+		return NULL;
+	}
+
+	struct sockaddr_in Public = Client->Public;
+	SOCKET Socket = Nat_OpenSocket(&Public);
+	if (Socket == INVALID_SOCKET)
+	{
+		return NULL;
+	}
+
+	Nat_Mapping* Mapping = &Nat->Mappings[Nat->MappingCount++];
+	memset(Mapping, 0, sizeof(*Mapping));
+	Mapping->Client = ClientIndex;
+	Mapping->Socket = Socket;
+	Mapping->Public = Public;
+	Mapping->Destination = *Destination;
+	return Mapping;
+}
+
+static void Nat_Permit(Nat_Mapping* Mapping, const struct sockaddr_in* Destination)
+{
+	for (uint32_t Index = 0; Index < Mapping->PermissionCount; Index++)
+	{
+		if (Nat_SameEndpoint(&Mapping->Permissions[Index], Destination))
+		{
+			return;
+		}
+	}
+
+	// oldest permission is forgotten when there are too many
+	if (Mapping->PermissionCount == NAT_MAX_PERMISSIONS)
+	{
+		memmove(Mapping->Permissions, Mapping->Permissions + 1, (NAT_MAX_PERMISSIONS - 1) * sizeof(Mapping->Permissions[0]));
+		Mapping->PermissionCount--;
+	}
+	Mapping->Permissions[Mapping->PermissionCount++] = *Destination;
+}
+
+// filter of receiver's NAT
+static bool Nat_Allowed(Nat_Sim* Nat, const Nat_Mapping* Mapping, const struct sockaddr_in* Source)
+{
+	Nat_Mode Mode = Nat->Clients[Mapping->Client].Mode;
+	if (Mode == NAT_CONE)
+	{
+		return true;
+	}
+
+	for (uint32_t Index = 0; Index < Mapping->PermissionCount; Index++)
+	{
+		const struct sockaddr_in* Permission = &Mapping->Permissions[Index];
+		if (Permission->sin_addr.s_addr == Source->sin_addr.s_addr && (Mode == NAT_RESTRICTED || Permission->sin_port == Source->sin_port))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// Binding request from client, response has XOR-MAPPED-ADDRESS of mapping towards STUN server
+static void Nat_OnStun(Nat_Sim* Nat, const uint8_t* Data, int Size, const struct sockaddr_in* Source)
+{
+	if (Size < 20 || Data[0] != 0x00 || Data[1] != 0x01 || memcmp(Data + 4, Nat_StunCookie, sizeof(Nat_StunCookie)) != 0)
+	{
+		return;
+	}
+
+	Nat_Client* Client = Nat_AddClient(Nat, Source);
+	if (Client == NULL)
+	{
+		return;
+	}
+
+	struct sockaddr_in Server = { .sin_family = AF_INET, .sin_port = htons(Nat->StunPort) };
+	Server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	Nat_Mapping* Mapping = Nat_GetMapping(Nat, Client, &Server);
+	if (Mapping == NULL)
+	{
+		return;
+	}
+	Nat_Permit(Mapping, &Server);
+	Nat->StunRequests++;
+
+	uint8_t Response[20 + 12] = { 0x01, 0x01, 0x00, 12 };
+	memcpy(Response + 4, Data + 4, 16);
+
+	uint8_t* Attribute = Response + 20;
+	Attribute[0] = 0x00;
+	Attribute[1] = 0x20;
+	Attribute[2] = 0x00;
+	Attribute[3] = 8;
+	Attribute[4] = 0x00;
+	Attribute[5] = 0x01;
+
+	const uint8_t* Port = (const uint8_t*)&Mapping->Public.sin_port;
+	const uint8_t* Address = (const uint8_t*)&Mapping->Public.sin_addr;
+	Attribute[6] = Port[0] ^ Nat_StunCookie[0];
+	Attribute[7] = Port[1] ^ Nat_StunCookie[1];
+	for (int Index = 0; Index < 4; Index++)
+	{
+		Attribute[8 + Index] = Address[Index] ^ Nat_StunCookie[Index];
+	}
+
+	sendto(Nat->Stun, (const char*)Response, sizeof(Response), 0, (const struct sockaddr*)Source, sizeof(*Source));
+}
+
+// datagram arrived on public port of Target mapping from real address of Source
+static void Nat_OnDatagram(Nat_Sim* Nat, Nat_Mapping* Target, const uint8_t* Data, int Size, const struct sockaddr_in* Source)
+{
+	Nat_Client* Sender = Nat_FindClient(Nat, Source);
+	if (Sender == NULL)
+	{
+		Nat->Unknown++;
+		return;
+	}
+
+	// outgoing through sender's NAT, Target pointer may move when new mapping is added
+	uint32_t TargetIndex = (uint32_t)(Target - Nat->Mappings);
+	struct sockaddr_in Destination = Target->Public;
+
+	Nat_Mapping* Mapping = Nat_GetMapping(Nat, Sender, &Destination);
+	if (Mapping == NULL)
+	{
+		Nat->Unknown++;
+		return;
+	}
+	Nat_Permit(Mapping, &Destination);
+	Target = &Nat->Mappings[TargetIndex];
+
+	// incoming through receiver's NAT
+	if (!Nat_Allowed(Nat, Target, &Mapping->Public))
+	{
+		Nat->Filtered++;
+		return;
+	}
+
+	if (Nat->Drop > 0 && Nat_Random01(&Nat->Random) < Nat->Drop)
+	{
+		Nat->Dropped++;
+		return;
+	}
+
+	const struct sockaddr_in* Receiver = &Nat->Clients[Target->Client].Inside;
+	sendto(Mapping->Socket, (const char*)Data, Size, 0, (const struct sockaddr*)Receiver, sizeof(*Receiver));
+	Nat->Forwarded++;
+}
+
+// processes all datagrams that arrive within Timeout msec
+static void Nat_Poll(Nat_Sim* Nat, int Timeout)
+{
+	struct pollfd Polls[1 + NAT_MAX_MAPPINGS];
+	uint32_t PollCount = 0;
+
+	Polls[PollCount++] = (struct pollfd) { .fd = Nat->Stun, .events = POLLIN };
+	for (uint32_t Index = 0; Index < Nat->MappingCount; Index++)
+	{
+		Polls[PollCount++] = (struct pollfd) { .fd = Nat->Mappings[Index].Socket, .events = POLLIN };
+	}
+
+	if (poll(Polls, PollCount, Timeout) <= 0)
+	{
+		return;
+	}
+
+	for (uint32_t Index = 0; Index < PollCount; Index++)
+	{
+		if (!(Polls[Index].revents & POLLIN))
+		{
+			continue;
+		}
+
+		for (;;)
+		{
+			uint8_t Data[NAT_MAX_DATAGRAM];
+			struct sockaddr_in Source;
+			socklen_t SourceLength = sizeof(Source);
+
+			int Size = (int)recvfrom(Polls[Index].fd, (char*)Data, sizeof(Data), 0, (struct sockaddr*)&Source, &SourceLength);
+			if (Size < 0)
+			{
+				break;
+			}
+
+			if (Index == 0)
+			{
+				Nat_OnStun(Nat, Data, Size, &Source);
+			}
+			else
+			{
+				Nat_OnDatagram(Nat, &Nat->Mappings[Index - 1], Data, Size, &Source);
+			}
+		}
+	}
+}
+
+#if !defined(NATSIM_NO_MAIN)
+
+int main(int ArgCount, char** Args)
+{
+	static Nat_Sim Nat;
+	uint16_t StunPort = NAT_DEFAULT_STUN;
+	Nat.Modes[Nat.ModeCount++] = NAT_PORT;
+	Nat.Random = 1;
+	Nat.Verbose = true;
+
+	for (int ArgIndex = 1; ArgIndex < ArgCount; ArgIndex++)
+	{
+		const char* Arg = Args[ArgIndex];
+		const char* Value = ArgIndex + 1 < ArgCount ? Args[ArgIndex + 1] : NULL;
+
+		if (Value && strcmp(Arg, "-stun") == 0)
+		{
+			StunPort = (uint16_t)atoi(Value);
+		}
+		else if (Value && strcmp(Arg, "-mode") == 0 && Nat_ParseModes(&Nat, Value))
+		{
+		}
+		else if (Value && strcmp(Arg, "-drop") == 0)
+		{
+			Nat.Drop = atof(Value);
+		}
+		else if (Value && strcmp(Arg, "-seed") == 0)
+		{
+			Nat.Random = strtoull(Value, NULL, 10);
+		}
+		else
+		{
+			fprintf(stderr, "usage: %s [-stun 3478] [-mode cone|restricted|port|symmetric[,...]] [-drop 0] [-seed 1]\n", Args[0]);
+			return 1;
+		}
+		ArgIndex++;
+	}
+
+#if defined(_WIN32)
+	WSADATA SocketData;
+	if (WSAStartup(MAKEWORD(2, 2), &SocketData) != 0)
+	{
+		return 1;
+	}
+#endif
+
+	if (!Nat_Open(&Nat, StunPort))
+	{
+		fprintf(stderr, "cannot listen on port %u\n", StunPort);
+		return 1;
+	}
+
+	printf("NatSim STUN on 127.0.0.1:%u\n", Nat.StunPort);
+	fflush(stdout);
+
+	for (uint32_t Tick = 1; ; Tick++)
+	{
+		Nat_Poll(&Nat, 100);
+
+		if (Tick % 10 == 0)
+		{
+			printf("stun %llu, forwarded %llu, filtered %llu, unknown %llu, dropped %llu\n",
+				(unsigned long long)Nat.StunRequests, (unsigned long long)Nat.Forwarded, (unsigned long long)Nat.Filtered,
+				(unsigned long long)Nat.Unknown, (unsigned long long)Nat.Dropped);
+			fflush(stdout);
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,300 @@
+#define _CRT_SECURE_NO_DEPRECATE
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+// SimReport - summary of csv files that sim\run.cmd collects from one DerpSim run
+//
+// usage: SimReport <rundir> [<rundir> ...]
+//
+// reads from every run directory:
+//   relay.csv  written by DerpSim, "time,client,key,bytes_in,bytes_out,..." columns, one row per client per second
+//   relay2.csv same from second DerpSim, when run has meshed relays or relay to fail over to
+//   share.csv  written by sharing ScreenBuddy with -metrics, "time_ms,name,value" rows
+//   view.csv   written by viewing ScreenBuddy with -metrics, same format
+//
+// prints csv with one row per metric - run directory, source, metric name, sample count, mean, p50, p95, p99, max.
+// Relay metrics are per connection index, byte counters are converted to kbit/s. Instead of "state" values it
+// reports time in msec when instance reached sharing or connected state, from start of process to running session.
+//
+// builds & runs on Windows with "build.cmd derpsim", but is plain C, so reports can be made anywhere csv files are.
+//
+
+enum
+{
+	REPORT_MAX_METRICS	= 64,
+	REPORT_MAX_COLUMNS	= 16,
+	REPORT_MAX_NAME		= 32,
+
+	// BuddyState values from ScreenBuddy.c
+	REPORT_STATE_SHARING	= 2,
+	REPORT_STATE_CONNECTED	= 4,
+};
+
+typedef struct
+{
+	char Name[REPORT_MAX_NAME];
+	double* Values;
+	size_t Count;
+	size_t Capacity;
+}
+Report_Metric;
+
+typedef struct
+{
+	Report_Metric Metrics[REPORT_MAX_METRICS];
+	size_t MetricCount;
+}
+Report_Source;
+
+static Report_Metric* Report_GetMetric(Report_Source* Source, const char* Name)
+{
+	for (size_t Index = 0; Index < Source->MetricCount; Index++)
+	{
+		if (strcmp(Source->Metrics[Index].Name, Name) == 0)
+		{
+			return &Source->Metrics[Index];
+		}
+	}
+
+	if (Source->MetricCount == REPORT_MAX_METRICS)
+	{
+		return NULL;
+	}
+
+	Report_Metric* Metric = &Source->Metrics[Source->MetricCount++];
+	memset(Metric, 0, sizeof(*Metric));
+	snprintf(Metric->Name, sizeof(Metric->Name), "%s", Name);
+	return Metric;
+}
+
+static void Report_Add(Report_Source* Source, const char* Name, double Value)
+{
+	Report_Metric* Metric = Report_GetMetric(Source, Name);
+	if (Metric == NULL)
+	{
+		return;
+	}
+
+	if (Metric->Count == Metric->Capacity)
+	{
+		size_t Capacity = Metric->Capacity ? 2 * Metric->Capacity : 256;
+		double* Values = realloc(Metric->Values, Capacity * sizeof(*Values));
+		if (Values == NULL)
+		{
+			return;
+		}
+		Metric->Values = Values;
+		Metric->Capacity = Capacity;
+	}
+	Metric->Values[Metric->Count++] = Value;
+}
+
+static void Report_Free(Report_Source* Source)
+{
+	for (size_t Index = 0; Index < Source->MetricCount; Index++)
+	{
+		free(Source->Metrics[Index].Values);
+	}
+	Source->MetricCount = 0;
+}
+
+// splits line in place on commas, returns column count
+static size_t Report_Split(char* Line, char* Columns[REPORT_MAX_COLUMNS])
+{
+	size_t Count = 0;
+	for (char* Ptr = Line; Count < REPORT_MAX_COLUMNS; )
+	{
+		Columns[Count++] = Ptr;
+
+		char* Comma = strchr(Ptr, ',');
+		if (Comma == NULL)
+		{
+			Ptr[strcspn(Ptr, "\r\n")] = 0;
+			break;
+		}
+		*Comma = 0;
+		Ptr = Comma + 1;
+	}
+	return Count;
+}
+
+// DerpSim csv, every column after client index & key is metric of that client
+static bool Report_LoadRelay(Report_Source* Source, const char* Path)
+{
+	FILE* File = fopen(Path, "r");
+	if (File == NULL)
+	{
+		return false;
+	}
+
+	char Header[512];
+	char* Names[REPORT_MAX_COLUMNS];
+	size_t NameCount = fgets(Header, sizeof(Header), File) ? Report_Split(Header, Names) : 0;
+
+	char Line[512];
+	while (fgets(Line, sizeof(Line), File))
+	{
+		char* Columns[REPORT_MAX_COLUMNS];
+		size_t Count = Report_Split(Line, Columns);
+
+		for (size_t Index = 3; Index < Count && Index < NameCount; Index++)
+		{
+			double Value = atof(Columns[Index]);
+
+			// clients are kept apart, sharer & viewer see different directions of traffic
+			char Name[REPORT_MAX_NAME];
+			if (strncmp(Names[Index], "bytes_", 6) == 0)
+			{
+				// rows are one second apart
+				snprintf(Name, sizeof(Name), "client%s.%s_kbps", Columns[1], Names[Index] + 6);
+				Value = Value * 8.0 / 1000.0;
+			}
+			else
+			{
+				snprintf(Name, sizeof(Name), "client%s.%s", Columns[1], Names[Index]);
+			}
+			Report_Add(Source, Name, Value);
+		}
+	}
+
+	fclose(File);
+	return true;
+}
+
+// ScreenBuddy -metrics csv, "time_ms,name,value"
+static bool Report_LoadMetrics(Report_Source* Source, const char* Path)
+{
+	FILE* File = fopen(Path, "r");
+	if (File == NULL)
+	{
+		return false;
+	}
+
+	bool Started = false;
+
+	char Line[512];
+	fgets(Line, sizeof(Line), File);
+	while (fgets(Line, sizeof(Line), File))
+	{
+		char* Columns[REPORT_MAX_COLUMNS];
+		if (Report_Split(Line, Columns) != 3)
+		{
+			continue;
+		}
+
+		double Time = atof(Columns[0]);
+		double Value = atof(Columns[2]);
+
+		if (strcmp(Columns[1], "state") == 0)
+		{
+			if (!Started && (Value == REPORT_STATE_SHARING || Value == REPORT_STATE_CONNECTED))
+			{
+				Report_Add(Source, "session_ms", Time);
+				Started = true;
+			}
+		}
+		else
+		{
+			Report_Add(Source, Columns[1], Value);
+		}
+	}
+
+	fclose(File);
+	return true;
+}
+
+static int Report_Compare(const void* A, const void* B)
+{
+	double ValueA = *(const double*)A;
+	double ValueB = *(const double*)B;
+	return ValueA < ValueB ? -1 : ValueA > ValueB;
+}
+
+// nearest rank percentile of sorted values
+static double Report_Percentile(const double* Values, size_t Count, double Percent)
+{
+	size_t Rank = (size_t)(Percent / 100.0 * (double)Count + 0.999999);
+	Rank = Rank == 0 ? 1 : Rank > Count ? Count : Rank;
+	return Values[Rank - 1];
+}
+
+static void Report_Print(const char* Run, const char* SourceName, Report_Source* Source)
+{
+	for (size_t Index = 0; Index < Source->MetricCount; Index++)
+	{
+		Report_Metric* Metric = &Source->Metrics[Index];
+		if (Metric->Count == 0)
+		{
+			continue;
+		}
+
+		qsort(Metric->Values, Metric->Count, sizeof(*Metric->Values), &Report_Compare);
+
+		double Sum = 0;
+		for (size_t ValueIndex = 0; ValueIndex < Metric->Count; ValueIndex++)
+		{
+			Sum += Metric->Values[ValueIndex];
+		}
+
+		printf("%s,%s,%s,%zu,%.2f,%.2f,%.2f,%.2f,%.2f\n", Run, SourceName, Metric->Name, Metric->Count,
+			Sum / (double)Metric->Count,
+			Report_Percentile(Metric->Values, Metric->Count, 50),
+			Report_Percentile(Metric->Values, Metric->Count, 95),
+			Report_Percentile(Metric->Values, Metric->Count, 99),
+			Metric->Values[Metric->Count - 1]);
+	}
+}
+
+int main(int ArgCount, char** Args)
+{
+	if (ArgCount < 2)
+	{
+		fprintf(stderr, "usage: %s <rundir> [<rundir> ...]\n", Args[0]);
+		return 1;
+	}
+
+	static Report_Source Source;
+
+	printf("run,source,metric,count,mean,p50,p95,p99,max\n");
+	for (int ArgIndex = 1; ArgIndex < ArgCount; ArgIndex++)
+	{
+		const char* Run = Args[ArgIndex];
+		char Path[1024];
+
+		snprintf(Path, sizeof(Path), "%s/relay.csv", Run);
+		if (Report_LoadRelay(&Source, Path))
+		{
+			Report_Print(Run, "relay", &Source);
+			Report_Free(&Source);
+		}
+
+		snprintf(Path, sizeof(Path), "%s/relay2.csv", Run);
+		if (Report_LoadRelay(&Source, Path))
+		{
+			Report_Print(Run, "relay2", &Source);
+			Report_Free(&Source);
+		}
+
+		snprintf(Path, sizeof(Path), "%s/share.csv", Run);
+		if (Report_LoadMetrics(&Source, Path))
+		{
+			Report_Print(Run, "share", &Source);
+			Report_Free(&Source);
+		}
+
+		snprintf(Path, sizeof(Path), "%s/view.csv", Run);
+		if (Report_LoadMetrics(&Source, Path))
+		{
+			Report_Print(Run, "view", &Source);
+			Report_Free(&Source);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,56 @@
+@echo off
+setlocal enabledelayedexpansion
+
+rem usage: build.cmd simbench [seconds] [comparison]
+rem    or: sim\bench.cmd [seconds] [comparison]
+rem
+rem Runs pairs of sim\run.cmd runs, baseline settings & changed settings with same profile & seed, and writes SimReport
+rem of both to sim\out\<comparison>.csv so their metrics are next to each other. Without comparison name all are run,
+rem each run takes given seconds (30 by default). NAT & MESH are ignored, every run goes through one relay, except
+rem failover runs that have second relay to migrate to.
+rem
+rem   netthread  home profile, NetThread=0 receives on UI thread like before I/O thread existed, compare net_delay_ms,
+rem              net_delay_max_ms & net_recv_ms of viewer, rtt_ms & recv_kbps
+rem   stripes    ratelimit profile, relay accepts 8 Mbit/s from each connection, one connection vs DerpStripes=4,
+rem              compare send_kbps of sharer, recv_kbps of viewer & bytes_in_kbps of relay clients
+rem   pacing     hotel profile, DerpPacing=0 sends whole frame at once vs paced sender, burstiness is burst_kb of
+rem              sharer & max_delay_ms of viewer's relay client, tail latency is p95 & p99 of rtt_ms & pace_delay_ms
+rem   recover    drops profile, relay drops chunks of large frames, full keyframes vs SoftKeyFrames=1, compare
+rem              recover_ms of viewer (count is number of recoveries), key_kb of sharer & drops of viewer's relay client
+rem   failover   outage profile with FAILOVER, first relay stops delivering after 10 seconds, default 5 second timeout
+rem              vs NetTimeout=2000, compare failover_ms of viewer (from last packet to first frame in second region),
+rem              migrating of both & out_kbps of second relay's clients
+rem   corking    home profile, DerpCorking=0 sends every message in its own TLS record with its own send call vs
+rem              corked, compare tls_records & send_calls of both, send_kbps of sharer & rtt_ms of viewer
+
+set SIM=%~dp0
+set ROOT=%~dp0..
+set NAT=
+set MESH=
+set FAILOVER=
+
+set SECONDS=%~1
+if "%SECONDS%" equ "" set SECONDS=30
+set ONLY=%~2
+
+call :compare netthread home netloop default || exit /b 1
+call :compare stripes ratelimit default stripes4 || exit /b 1
+call :compare pacing hotel nopacing default || exit /b 1
+call :compare recover drops default softkey || exit /b 1
+set FAILOVER=1
+call :compare failover outage default nettimeout2s || exit /b 1
+set FAILOVER=
+call :compare corking home nocork default || exit /b 1
+exit /b 0
+
+rem :compare <name> <profile> <baseline settings> <changed settings>
+:compare
+if "%ONLY%" neq "" if "%ONLY%" neq "%1" exit /b 0
+call "%SIM%run.cmd" "%SIM%profiles\%2.txt" %SECONDS% "%SIM%settings\%3.txt" %1-%3 || exit /b 1
+call "%SIM%run.cmd" "%SIM%profiles\%2.txt" %SECONDS% "%SIM%settings\%4.txt" %1-%4 || exit /b 1
+rem run.cmd adds suffix to run name
+set SUFFIX=
+if "%FAILOVER%" neq "" set SUFFIX=-failover
+"%ROOT%\SimReport.exe" "%SIM%out\%1-%3%SUFFIX%" "%SIM%out\%1-%4%SUFFIX%" > "%SIM%out\%1.csv"
+echo %1: written to sim\out\%1.csv
+exit /b 0
@@ -0,0 +1,121 @@
+@echo off
+setlocal enabledelayedexpansion
+
+rem usage: build.cmd simrun <profile.txt> [seconds] [settings.txt] [name]
+rem    or: sim\run.cmd <profile.txt> [seconds] [settings.txt] [name]
+rem
+rem Starts DerpSim with profile, then sharing ScreenBuddyLocal, and once it has written its code file, viewing one.
+rem After given seconds (30 by default) all of them are stopped and sim\out\<name>\ has:
+rem   relay.csv   DerpSim metrics of every client
+rem   share.csv   -metrics of sharer
+rem   view.csv    -metrics of viewer
+rem   report.csv  SimReport summary of the above
+rem settings.txt has key=value lines added to [Buddy] section of both ini files, <settings>.share.txt and
+rem <settings>.view.txt next to it, if they exist, are added only to one of them. Name defaults to profile name
+rem followed by settings name. Runs stop every DerpSim.exe & ScreenBuddyLocal.exe process, run them on idle machine.
+rem Instances never announce local addresses, so all traffic goes through DerpSim. With NAT set to NatSim mode list,
+rem like "set NAT=port,symmetric", both do STUN & hole punching through NatSim.exe and can find direct path, the
+rem one whose STUN request arrives first is behind first NAT.
+rem With MESH set to inter-relay latency in msec, second DerpSim on port 8002 stands in for viewer's region, both
+rem relays mesh with each other and add that latency to packets they forward. Viewer uses DerpMesh=1 with its own
+rem region, relay2.csv has metrics of second relay. Settings with DerpMesh=0 in <settings>.view.txt give baseline
+rem where viewer connects to sharer's region. Viewer's rtt_ms metric is round trip between instances, measured 4 times
+rem per second.
+rem With FAILOVER set, like "set FAILOVER=1", both instances start in region 1 and second DerpSim on port 8002 without
+rem profile is region 2, where they migrate when profile's outage step takes first relay down. Viewer's failover_ms
+rem metric is time from last packet over lost relay to first frame in region 2, relay2.csv has metrics of second relay.
+rem FAILOVER is ignored together with MESH.
+
+set SIM=%~dp0
+set ROOT=%~dp0..
+
+if "%~1" equ "" (
+  echo usage: %~nx0 profile.txt [seconds] [settings.txt] [name]
+  exit /b 1
+)
+if not exist "%~f1" (
+  echo ERROR: profile "%~1" not found
+  exit /b 1
+)
+for %%e in (DerpSim.exe NatSim.exe ScreenBuddyLocal.exe SimReport.exe) do (
+  if not exist "%ROOT%\%%e" (
+    echo ERROR: %%e not found, run "build.cmd derpsim" first
+    exit /b 1
+  )
+)
+
+set PROFILE=%~f1
+set SECONDS=%~2
+if "%SECONDS%" equ "" set SECONDS=30
+set SETTINGS=%~f3
+if "%~3" equ "" set SETTINGS=%SIM%settings\default.txt
+for %%f in ("%SETTINGS%") do set SETTINGS_BASE=%%~dpnf& set SETTINGS_NAME=%%~nf
+set NAME=%~4
+if "%NAME%" equ "" set NAME=%~n1-%SETTINGS_NAME%
+if "%SEED%" equ "" set SEED=1
+
+set MAP=%SIM%derpmap.json
+if "%NAT%" neq "" set MAP=%SIM%derpmap-nat.json& set NAME=%NAME%-nat-%NAT:,=-%
+if "%MESH%" neq "" set MAP=%SIM%derpmap-mesh.json& set NAME=%NAME%-mesh%MESH%
+if "%FAILOVER%" neq "" if "%MESH%" equ "" set MAP=%SIM%derpmap-failover.json& set NAME=%NAME%-failover
+
+set OUT=%SIM%out\%NAME%
+if exist "%OUT%" rmdir /s /q "%OUT%"
+mkdir "%OUT%" || exit /b 1
+
+call :config share
+call :config view
+
+if "%NAT%" neq "" start "" /B "%ROOT%\NatSim.exe" -stun 3478 -mode %NAT% -seed %SEED% > "%OUT%\nat.log" 2>&1
+if "%MESH%" equ "" (
+  start "" /B "%ROOT%\DerpSim.exe" -port 8001 -profile "%PROFILE%" -seed %SEED% -csv "%OUT%\relay.csv" > "%OUT%\relay.log" 2>&1
+  if "%FAILOVER%" neq "" start "" /B "%ROOT%\DerpSim.exe" -port 8002 -seed %SEED% -csv "%OUT%\relay2.csv" > "%OUT%\relay2.log" 2>&1
+) else (
+  start "" /B "%ROOT%\DerpSim.exe" -port 8001 -profile "%PROFILE%" -seed %SEED% -csv "%OUT%\relay.csv" -mesh 8002 -meshlatency %MESH% > "%OUT%\relay.log" 2>&1
+  start "" /B "%ROOT%\DerpSim.exe" -port 8002 -profile "%PROFILE%" -seed %SEED% -csv "%OUT%\relay2.csv" -mesh 8001 -meshlatency %MESH% > "%OUT%\relay2.log" 2>&1
+)
+start "" "%ROOT%\ScreenBuddyLocal.exe" -config "%OUT%\share.ini" -share "%OUT%\code.txt" -metrics "%OUT%\share.csv"
+
+rem sharer writes code only after it is connected to relay
+set WAIT=0
+:wait
+if exist "%OUT%\code.txt" goto connect
+set /a WAIT+=1
+if %WAIT% geq 60 (
+  echo ERROR: sharer did not start in 60 seconds
+  goto stop
+)
+timeout /t 1 /nobreak >nul
+goto wait
+
+:connect
+start "" "%ROOT%\ScreenBuddyLocal.exe" -config "%OUT%\view.ini" -connect "%OUT%\code.txt" -metrics "%OUT%\view.csv"
+echo %NAME%: running for %SECONDS% seconds...
+timeout /t %SECONDS% /nobreak >nul
+
+:stop
+taskkill /F /IM ScreenBuddyLocal.exe >nul 2>&1
+taskkill /F /IM DerpSim.exe >nul 2>&1
+taskkill /F /IM NatSim.exe >nul 2>&1
+
+"%ROOT%\SimReport.exe" "%OUT%" > "%OUT%\report.csv"
+type "%OUT%\report.csv"
+exit /b 0
+
+:config
+> "%OUT%\%1.ini" echo [Buddy]
+rem without NatSim map has no STUN port, so no local candidates means no direct path past the relay
+>>"%OUT%\%1.ini" echo DerpMapFile=%MAP%
+>>"%OUT%\%1.ini" echo UdpLocalCandidates=0
+rem round trip is probed on every network timer tick, so rtt_ms percentiles show tail latency behind video
+>>"%OUT%\%1.ini" echo LatencyInterval=250
+type "%SETTINGS%" >> "%OUT%\%1.ini"
+if exist "%SETTINGS_BASE%.%1.txt" type "%SETTINGS_BASE%.%1.txt" >> "%OUT%\%1.ini"
+rem first occurrence of key wins, so settings above can change these
+if "%MESH%" neq "" (
+  if "%1" equ "share" >>"%OUT%\%1.ini" echo DerpRegion=1
+  if "%1" equ "view" >>"%OUT%\%1.ini" echo DerpRegion=2
+  if "%1" equ "view" >>"%OUT%\%1.ini" echo DerpMesh=1
+)
+if "%FAILOVER%" neq "" if "%MESH%" equ "" >>"%OUT%\%1.ini" echo DerpRegion=1
+exit /b 0
@@ -0,0 +1,329 @@
+#include "Test.h"
+
+#define DERPNET_STATIC
+#include "../external/derpnet.h"
+
+//
+// DerpNetTest - sealing, replay window & parallel crypto of derpnet.h
+//
+// connection code of derpnet.h is Windows only, these parts also build with gcc & clang where parallel tasks run
+// on pthreads instead of Windows thread pool.
+//
+// tests check that parallel unseal & chunk sealing give same bytes as single thread, and DerpNet_AcceptNonce cases.
+// benchmark measures scaling of seal & unseal with 1..16 threads on 4K keyframe sizes - keyframe is split into
+// 65000 byte chunks same as ScreenBuddy sends them, seal runs chunks in parallel like DerpNet_SendChunks does,
+// unseal splits every received chunk in ranges like DerpNet_Recv does.
+//
+
+enum
+{
+	CHUNK_SIZE	= 65000,	// BUDDY_ENCODE_CHUNK_SIZE from ScreenBuddy.c
+	FRAME_SIZE	= 1 + 4 + 32 + 24 + 16,
+};
+
+static const uint32_t ThreadCounts[] = { 1, 2, 4, 8, 16 };
+
+static void FillRandom(uint64_t* State, uint8_t* Data, size_t Size)
+{
+	for (size_t Index = 0; Index < Size; Index++)
+	{
+		Data[Index] = (uint8_t)Test_Random(State);
+	}
+}
+
+typedef struct
+{
+	DerpNet_Chunk* Chunks;
+	uint8_t** Frames;
+	volatile DerpNet__Flag* Done;
+	uint8_t* Memory;
+	size_t ChunkCount;
+}
+Keyframe;
+
+static void Keyframe_Init(Keyframe* Frame, const uint8_t* Data, size_t Size)
+{
+	Frame->ChunkCount = (Size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	Frame->Chunks = Test_Alloc(Frame->ChunkCount * sizeof(*Frame->Chunks));
+	Frame->Frames = Test_Alloc(Frame->ChunkCount * sizeof(*Frame->Frames));
+	Frame->Done = Test_Alloc(Frame->ChunkCount * sizeof(*Frame->Done));
+	Frame->Memory = Test_Alloc(Frame->ChunkCount * (FRAME_SIZE + CHUNK_SIZE));
+
+	for (size_t Index = 0; Index < Frame->ChunkCount; Index++)
+	{
+		size_t Offset = Index * CHUNK_SIZE;
+		Frame->Chunks[Index] = (DerpNet_Chunk) { NULL, 0, Data + Offset, Size - Offset < CHUNK_SIZE ? Size - Offset : CHUNK_SIZE };
+		Frame->Frames[Index] = Frame->Memory + Index * (FRAME_SIZE + CHUNK_SIZE);
+	}
+}
+
+static void Keyframe_Free(Keyframe* Frame)
+{
+	free(Frame->Chunks);
+	free(Frame->Frames);
+	free((void*)Frame->Done);
+	free(Frame->Memory);
+}
+
+// same sealing as DerpNet_SendChunks, without writing to connection
+static void Keyframe_Seal(Keyframe* Frame, uint32_t ThreadCount, const uint8_t SharedKey[32], uint64_t* Counter)
+{
+	for (size_t Index = 0; Index < Frame->ChunkCount; Index++)
+	{
+		uint8_t* Nonce = Frame->Frames[Index] + 1 + 4 + 32;
+		memset(Nonce, 0x55, 16);
+		Set64LE(Nonce + 16, ++*Counter);
+		Frame->Done[Index] = 0;
+	}
+
+	DerpNet__SealTask Task = { Frame->Chunks, Frame->Frames, SharedKey };
+
+	DerpNet__Tasks Tasks;
+	DerpNet__TasksStart(&Tasks, Frame->ChunkCount, Frame->Done, ThreadCount, &DerpNet__SealTaskCallback, &Task);
+	for (size_t Index = 0; Index < Frame->ChunkCount; Index++)
+	{
+		DerpNet__TasksWait(&Tasks, Index);
+	}
+	DerpNet__TasksFinish(&Tasks);
+}
+
+// same unsealing as DerpNet_Recv, one chunk after another as they arrive
+static bool Keyframe_Unseal(Keyframe* Frame, uint32_t ThreadCount, const uint8_t SharedKey[32], uint8_t* Output)
+{
+	bool Result = true;
+	for (size_t Index = 0; Index < Frame->ChunkCount; Index++)
+	{
+		const uint8_t* Nonce = Frame->Frames[Index] + 1 + 4 + 32;
+		const uint8_t* Auth = Nonce + 24;
+		size_t Size = Frame->Chunks[Index].DataSize;
+
+		Result &= DerpNet__BoxUnsealParallel(ThreadCount, Output + Index * CHUNK_SIZE, Auth + 16, Size, Auth, Nonce, SharedKey);
+	}
+	return Result;
+}
+
+static void Test_Unseal(void)
+{
+	uint64_t Random = 1;
+
+	uint8_t SharedKey[32];
+	FillRandom(&Random, SharedKey, sizeof(SharedKey));
+
+	// sizes around range split & salsa20 block boundaries
+	static const size_t Sizes[] = { 0, 1, 32, 33, 2 * 16384 - 1, 2 * 16384, 2 * 16384 + 31, 2 * 16384 + 33, 65000, 100003 };
+
+	for (size_t SizeIndex = 0; SizeIndex < sizeof(Sizes) / sizeof(*Sizes); SizeIndex++)
+	{
+		size_t Size = Sizes[SizeIndex];
+
+		uint8_t* Data = Test_Alloc(Size);
+		uint8_t* Sealed = Test_Alloc(24 + 16 + Size);
+		uint8_t* Single = Test_Alloc(Size);
+		uint8_t* Parallel = Test_Alloc(Size);
+		FillRandom(&Random, Data, Size);
+
+		uint8_t Prefix[16] = { 1 };
+		DerpNet_SealCounter(SharedKey, Sealed, Prefix, SizeIndex, Data, Size);
+		TEST_CHECK(Get64LE(Sealed + 16) == SizeIndex);
+
+		TEST_CHECK(DerpNet_Unseal(SharedKey, Single, Sealed, 24 + 16 + Size));
+		TEST_CHECK(Size == 0 || memcmp(Single, Data, Size) == 0);
+
+		for (size_t Index = 0; Index < sizeof(ThreadCounts) / sizeof(*ThreadCounts); Index++)
+		{
+			memset(Parallel, 0, Size);
+			TEST_CHECK(DerpNet__BoxUnsealParallel(ThreadCounts[Index], Parallel, Sealed + 24 + 16, Size, Sealed + 24, Sealed, SharedKey));
+			TEST_CHECK(Size == 0 || memcmp(Parallel, Data, Size) == 0);
+		}
+
+		// any flipped bit fails auth, also when decryption would be split between threads
+		if (Size != 0)
+		{
+			Sealed[24 + 16 + Size / 2] ^= 0x10;
+			TEST_CHECK(!DerpNet_Unseal(SharedKey, Single, Sealed, 24 + 16 + Size));
+			TEST_CHECK(!DerpNet__BoxUnsealParallel(4, Parallel, Sealed + 24 + 16, Size, Sealed + 24, Sealed, SharedKey));
+		}
+
+		free(Data);
+		free(Sealed);
+		free(Single);
+		free(Parallel);
+	}
+
+	TEST_CHECK(!DerpNet_Unseal(SharedKey, NULL, SharedKey, 24 + 16 - 1));
+}
+
+static void Test_SealChunks(void)
+{
+	uint64_t Random = 2;
+
+	uint8_t SharedKey[32];
+	FillRandom(&Random, SharedKey, sizeof(SharedKey));
+
+	size_t Size = 10 * CHUNK_SIZE + 1234;
+	uint8_t* Data = Test_Alloc(Size);
+	uint8_t* Output = Test_Alloc(Size);
+	FillRandom(&Random, Data, Size);
+
+	Keyframe Frame;
+	Keyframe_Init(&Frame, Data, Size);
+
+	uint8_t* Expected = Test_Alloc(Frame.ChunkCount * (FRAME_SIZE + CHUNK_SIZE));
+
+	// nonces are fixed, so every thread count must produce same frames
+	for (size_t Index = 0; Index < sizeof(ThreadCounts) / sizeof(*ThreadCounts); Index++)
+	{
+		uint64_t Counter = 0;
+		Keyframe_Seal(&Frame, ThreadCounts[Index], SharedKey, &Counter);
+		if (Index == 0)
+		{
+			memcpy(Expected, Frame.Memory, Frame.ChunkCount * (FRAME_SIZE + CHUNK_SIZE));
+		}
+		else
+		{
+			TEST_CHECK(memcmp(Expected, Frame.Memory, Frame.ChunkCount * (FRAME_SIZE + CHUNK_SIZE)) == 0);
+		}
+
+		memset(Output, 0, Size);
+		TEST_CHECK(Keyframe_Unseal(&Frame, ThreadCounts[Index], SharedKey, Output));
+		TEST_CHECK(memcmp(Output, Data, Size) == 0);
+	}
+
+	free(Expected);
+	Keyframe_Free(&Frame);
+	free(Data);
+	free(Output);
+}
+
+static void MakeNonce(uint8_t Nonce[24], uint8_t Prefix, uint64_t Counter)
+{
+	memset(Nonce, Prefix, 16);
+	Set64LE(Nonce + 16, Counter);
+}
+
+static bool Accept(DerpNet_Replay* Replay, uint8_t Prefix, uint64_t Counter)
+{
+	uint8_t Nonce[24];
+	MakeNonce(Nonce, Prefix, Counter);
+	return DerpNet_AcceptNonce(Replay, Nonce);
+}
+
+static void Test_Replay(void)
+{
+	DerpNet_Replay Replay = { 0 };
+
+	// first nonce pins prefix, even with large counter
+	TEST_CHECK(Accept(&Replay, 1, 1000));
+	TEST_CHECK(!Accept(&Replay, 1, 1000));
+	TEST_CHECK(!Accept(&Replay, 2, 1001));
+
+	// reordering inside window is accepted once
+	TEST_CHECK(Accept(&Replay, 1, 1005));
+	TEST_CHECK(Accept(&Replay, 1, 1003));
+	TEST_CHECK(!Accept(&Replay, 1, 1003));
+	TEST_CHECK(Accept(&Replay, 1, 1001));
+	TEST_CHECK(!Accept(&Replay, 1, 1005));
+
+	// 64 counters behind highest is outside window
+	TEST_CHECK(Accept(&Replay, 1, 1005 + 63));
+	TEST_CHECK(Accept(&Replay, 1, 1006));
+	TEST_CHECK(!Accept(&Replay, 1, 1005));
+	TEST_CHECK(!Accept(&Replay, 1, 1004));
+
+	// jump over whole window forgets everything older
+	TEST_CHECK(Accept(&Replay, 1, 5000));
+	TEST_CHECK(!Accept(&Replay, 1, 1005 + 63));
+	TEST_CHECK(Accept(&Replay, 1, 4999));
+	TEST_CHECK(!Accept(&Replay, 1, 5000));
+
+	// counter 0 as first nonce still starts window
+	DerpNet_Replay Zero = { 0 };
+	TEST_CHECK(Accept(&Zero, 7, 0));
+	TEST_CHECK(!Accept(&Zero, 7, 0));
+	TEST_CHECK(Accept(&Zero, 7, 1));
+
+	// random order of 64 counters is all accepted, repeat of any is not
+	DerpNet_Replay Shuffled = { 0 };
+	uint64_t Order[64];
+	uint64_t Random = 3;
+	for (size_t Index = 0; Index < 64; Index++)
+	{
+		Order[Index] = 100 + Index;
+	}
+	for (size_t Index = 63; Index > 0; Index--)
+	{
+		size_t Other = Test_RandomRange(&Random, (uint32_t)Index + 1);
+		uint64_t Temp = Order[Index];
+		Order[Index] = Order[Other];
+		Order[Other] = Temp;
+	}
+	TEST_CHECK(Accept(&Shuffled, 9, 163));
+	for (size_t Index = 0; Index < 64; Index++)
+	{
+		TEST_CHECK(Accept(&Shuffled, 9, Order[Index]) == (Order[Index] != 163));
+	}
+	for (size_t Index = 0; Index < 64; Index++)
+	{
+		TEST_CHECK(!Accept(&Shuffled, 9, Order[Index]));
+	}
+}
+
+static void Bench_Keyframe(size_t Size)
+{
+	uint64_t Random = 4;
+
+	uint8_t SharedKey[32];
+	FillRandom(&Random, SharedKey, sizeof(SharedKey));
+
+	uint8_t* Data = Test_Alloc(Size);
+	uint8_t* Output = Test_Alloc(Size);
+	FillRandom(&Random, Data, Size);
+
+	Keyframe Frame;
+	Keyframe_Init(&Frame, Data, Size);
+
+	double SealBase = 0;
+	double UnsealBase = 0;
+	uint64_t Counter = 0;
+
+	for (size_t Index = 0; Index < sizeof(ThreadCounts) / sizeof(*ThreadCounts); Index++)
+	{
+		uint32_t ThreadCount = ThreadCounts[Index];
+
+		double Seal;
+		TEST_BENCH(0.5, Seal, Keyframe_Seal(&Frame, ThreadCount, SharedKey, &Counter));
+
+		double Unseal;
+		TEST_BENCH(0.5, Unseal, TEST_CHECK(Keyframe_Unseal(&Frame, ThreadCount, SharedKey, Output)));
+
+		SealBase = Index == 0 ? Seal : SealBase;
+		UnsealBase = Index == 0 ? Unseal : UnsealBase;
+
+		printf("keyframe %5zu KB, %2u threads: seal %7.1f MB/s %5.2fx %6.2f ms, unseal %7.1f MB/s %5.2fx %6.2f ms\n",
+			Size / 1024, ThreadCount,
+			Size / Seal / 1e6, SealBase / Seal, Seal * 1000.0,
+			Size / Unseal / 1e6, UnsealBase / Unseal, Unseal * 1000.0);
+	}
+
+	Keyframe_Free(&Frame);
+	free(Data);
+	free(Output);
+}
+
+int main(int ArgCount, char** Args)
+{
+	if (Test_IsBench(ArgCount, Args))
+	{
+		printf("%u logical processors\n", DerpNet__GetProcessorCount());
+
+		// 4K H.264 keyframes are roughly 1..4 MB depending on content & bitrate
+		Bench_Keyframe(1 << 20);
+		Bench_Keyframe(4 << 20);
+		return Test_Finish("DerpNet bench");
+	}
+
+	Test_Unseal();
+	Test_SealChunks();
+	Test_Replay();
+	return Test_Finish("DerpNet");
+}
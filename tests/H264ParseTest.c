@@ -0,0 +1,724 @@
+#include "Test.h"
+#include "../external/H264Parse.h"
+
+//
+// H264ParseTest - Annex-B parser from external/H264Parse.h
+//
+// corpus is built here with bit writer, same syntax elements encoder writes - SPS for baseline, main, high & 4:4:4
+// profiles with cropping, interlace, scaling lists & POC type 1, PPS with CAVLC & CABAC, IDR/I/P/B slices with and
+// without nal_ref_idc, multi-slice frames, user data SEI, 3 & 4 byte start codes, trailing zeros and emulation
+// prevention bytes. Every entry is checked against what it was built from, then mutated copies of it are parsed
+// to check that broken streams do not read out of bounds (run with sanitizers by Makefile).
+//
+// benchmark parses 4K sized keyframe & P-frame access units and reports MB/s
+//
+
+static const uint8_t TestUuid[16] = { 'S', 'c', 'r', 'e', 'e', 'n', 'B', 'u', 'd', 'd', 'y', 'O', 'v', 'r', 'l', '1' };
+
+//
+// stream writer
+
+typedef struct
+{
+	uint8_t Data[1 << 12];
+	size_t Size;
+	uint32_t Bits;		// bits used in last byte, 0..7
+}
+Rbsp;
+
+static void Rbsp_Bit(Rbsp* R, uint32_t Bit)
+{
+	if (R->Bits == 0)
+	{
+		R->Data[R->Size++] = 0;
+	}
+	R->Data[R->Size - 1] |= (uint8_t)(Bit << (7 - R->Bits));
+	R->Bits = (R->Bits + 1) & 7;
+}
+
+static void Rbsp_Bits(Rbsp* R, uint32_t Value, uint32_t Count)
+{
+	while (Count--)
+	{
+		Rbsp_Bit(R, (Value >> Count) & 1);
+	}
+}
+
+static void Rbsp_UE(Rbsp* R, uint32_t Value)
+{
+	uint64_t Code = (uint64_t)Value + 1;
+	uint32_t Length = 0;
+	while ((Code >> Length) > 1)
+	{
+		Length++;
+	}
+	Rbsp_Bits(R, 0, Length);
+	for (int Bit = (int)Length; Bit >= 0; Bit--)
+	{
+		Rbsp_Bit(R, (uint32_t)(Code >> Bit) & 1);
+	}
+}
+
+static void Rbsp_SE(Rbsp* R, int32_t Value)
+{
+	Rbsp_UE(R, Value > 0 ? 2 * (uint32_t)Value - 1 : 2 * (uint32_t)-Value);
+}
+
+// rbsp_trailing_bits
+static void Rbsp_Finish(Rbsp* R)
+{
+	Rbsp_Bit(R, 1);
+	while (R->Bits)
+	{
+		Rbsp_Bit(R, 0);
+	}
+}
+
+typedef struct
+{
+	uint8_t* Data;
+	size_t Size;
+	size_t Capacity;
+}
+Stream;
+
+static void Stream_Byte(Stream* S, uint8_t Byte)
+{
+	if (S->Size == S->Capacity)
+	{
+		S->Capacity = S->Capacity ? 2 * S->Capacity : 4096;
+		S->Data = realloc(S->Data, S->Capacity);
+		if (!S->Data)
+		{
+			exit(1);
+		}
+	}
+	S->Data[S->Size++] = Byte;
+}
+
+// start code, header byte & escaped payload, returns offset of start code
+static size_t Stream_Nal(Stream* S, uint32_t StartCode, uint32_t RefIdc, uint32_t Type, const uint8_t* Payload, size_t Size)
+{
+	size_t Offset = S->Size;
+	for (uint32_t Index = 0; Index < StartCode - 1; Index++)
+	{
+		Stream_Byte(S, 0);
+	}
+	Stream_Byte(S, 1);
+	Stream_Byte(S, (uint8_t)((RefIdc << 5) | Type));
+
+	uint32_t Zeros = 0;
+	for (size_t Index = 0; Index < Size; Index++)
+	{
+		if (Zeros >= 2 && Payload[Index] <= 3)
+		{
+			Stream_Byte(S, 3);
+			Zeros = 0;
+		}
+		Stream_Byte(S, Payload[Index]);
+		Zeros = Payload[Index] == 0 ? Zeros + 1 : 0;
+	}
+	return Offset;
+}
+
+typedef struct
+{
+	uint32_t Profile;
+	uint32_t Level;
+	uint32_t SpsId;
+	uint32_t ChromaFormat;		// only written for high profiles
+	bool Scaling;
+	uint32_t PocType;
+	uint32_t RefFrames;
+	uint32_t WidthInMbs;
+	uint32_t HeightInMapUnits;
+	bool FrameMbsOnly;
+	uint32_t Crop[4];			// left, right, top, bottom
+}
+SpsDesc;
+
+static bool IsHighProfile(uint32_t Profile)
+{
+	return Profile == 100 || Profile == 110 || Profile == 122 || Profile == 244;
+}
+
+static void Stream_Sps(Stream* S, uint32_t StartCode, const SpsDesc* Desc, uint64_t* Random)
+{
+	Rbsp R = { 0 };
+	Rbsp_Bits(&R, Desc->Profile, 8);
+	Rbsp_Bits(&R, 0, 8);
+	Rbsp_Bits(&R, Desc->Level, 8);
+	Rbsp_UE(&R, Desc->SpsId);
+	if (IsHighProfile(Desc->Profile))
+	{
+		Rbsp_UE(&R, Desc->ChromaFormat);
+		if (Desc->ChromaFormat == 3)
+		{
+			Rbsp_Bit(&R, 0); // separate_colour_plane_flag
+		}
+		Rbsp_UE(&R, 0);
+		Rbsp_UE(&R, 0);
+		Rbsp_Bit(&R, 0);
+		Rbsp_Bit(&R, Desc->Scaling);
+		if (Desc->Scaling)
+		{
+			for (uint32_t Index = 0; Index < (Desc->ChromaFormat != 3 ? 8U : 12U); Index++)
+			{
+				// every other list present, with random deltas that end early sometimes
+				Rbsp_Bit(&R, Index & 1);
+				if (Index & 1)
+				{
+					uint32_t Size = Index < 6 ? 16 : 64;
+					int32_t Last = 8;
+					for (uint32_t Item = 0; Item < Size; Item++)
+					{
+						int32_t Next = (int32_t)Test_RandomRange(Random, 256);
+						Next = Item == Size / 2 && Index == 7 ? 0 : Next;
+						int32_t Delta = ((Next - Last + 384) % 256) - 128;
+						Rbsp_SE(&R, Delta);
+						if (Next == 0)
+						{
+							break;
+						}
+						Last = Next;
+					}
+				}
+			}
+		}
+	}
+	Rbsp_UE(&R, 0); // log2_max_frame_num_minus4
+	Rbsp_UE(&R, Desc->PocType);
+	if (Desc->PocType == 0)
+	{
+		Rbsp_UE(&R, 2);
+	}
+	else if (Desc->PocType == 1)
+	{
+		Rbsp_Bit(&R, 0);
+		Rbsp_SE(&R, -3);
+		Rbsp_SE(&R, 5);
+		Rbsp_UE(&R, 3);
+		Rbsp_SE(&R, 1);
+		Rbsp_SE(&R, -2);
+		Rbsp_SE(&R, 100);
+	}
+	Rbsp_UE(&R, Desc->RefFrames);
+	Rbsp_Bit(&R, 0);
+	Rbsp_UE(&R, Desc->WidthInMbs - 1);
+	Rbsp_UE(&R, Desc->HeightInMapUnits - 1);
+	Rbsp_Bit(&R, Desc->FrameMbsOnly);
+	if (!Desc->FrameMbsOnly)
+	{
+		Rbsp_Bit(&R, 0);
+	}
+	Rbsp_Bit(&R, 1);
+
+	bool Crop = Desc->Crop[0] || Desc->Crop[1] || Desc->Crop[2] || Desc->Crop[3];
+	Rbsp_Bit(&R, Crop);
+	if (Crop)
+	{
+		for (uint32_t Index = 0; Index < 4; Index++)
+		{
+			Rbsp_UE(&R, Desc->Crop[Index]);
+		}
+	}
+	Rbsp_Bit(&R, 0); // vui_parameters_present_flag
+	Rbsp_Finish(&R);
+
+	Stream_Nal(S, StartCode, 3, 7, R.Data, R.Size);
+}
+
+static void Stream_Pps(Stream* S, uint32_t StartCode, bool Cabac)
+{
+	Rbsp R = { 0 };
+	Rbsp_UE(&R, 0);
+	Rbsp_UE(&R, 0);
+	Rbsp_Bit(&R, Cabac);
+	Rbsp_Bits(&R, 0x5a, 8); // rest is not parsed
+	Rbsp_Finish(&R);
+
+	Stream_Nal(S, StartCode, 3, 8, R.Data, R.Size);
+}
+
+// slice header start & pseudo random slice data, returns offset of start code
+static size_t Stream_Slice(Stream* S, uint32_t StartCode, bool Idr, uint32_t RefIdc, uint32_t SliceType, uint32_t FirstMb, size_t DataSize, uint64_t* Random)
+{
+	Rbsp R = { 0 };
+	Rbsp_UE(&R, FirstMb);
+	Rbsp_UE(&R, SliceType);
+	Rbsp_UE(&R, 0); // pic_parameter_set_id
+	Rbsp_Finish(&R);
+
+	uint8_t* Payload = Test_Alloc(R.Size + DataSize);
+	memcpy(Payload, R.Data, R.Size);
+	for (size_t Index = 0; Index < DataSize; Index++)
+	{
+		// plenty of zeros, so escaping is exercised
+		uint32_t Value = Test_RandomRange(Random, 8);
+		Payload[R.Size + Index] = Value < 2 ? 0 : Value < 3 ? (uint8_t)Test_RandomRange(Random, 4) : (uint8_t)Test_Random(Random);
+	}
+	Payload[R.Size + DataSize - 1] |= 0x80; // NAL unit does not end with zero byte
+
+	size_t Offset = Stream_Nal(S, StartCode, RefIdc, Idr ? 5 : 1, Payload, R.Size + DataSize);
+	free(Payload);
+	return Offset;
+}
+
+static void Stream_Sei(Stream* S, uint32_t StartCode, const uint8_t Uuid[16], size_t DataSize)
+{
+	uint8_t* Payload = Test_Alloc(2 + DataSize / 255 + 16 + DataSize + 1);
+	size_t Size = 0;
+	Payload[Size++] = 5;
+	size_t PayloadSize = 16 + DataSize;
+	while (PayloadSize >= 255)
+	{
+		Payload[Size++] = 255;
+		PayloadSize -= 255;
+	}
+	Payload[Size++] = (uint8_t)PayloadSize;
+	memcpy(Payload + Size, Uuid, 16);
+	Size += 16;
+	for (size_t Index = 0; Index < DataSize; Index++)
+	{
+		Payload[Size++] = (uint8_t)(Index % 3 == 0 ? 0 : Index);
+	}
+	Payload[Size++] = 0x80;
+
+	Stream_Nal(S, StartCode, 0, 6, Payload, Size);
+	free(Payload);
+}
+
+//
+// corpus
+
+typedef struct
+{
+	const char* Name;
+	Stream Stream;
+	bool Result;
+	H264Info Expected;
+	size_t UserDataOffset;		// of start code, 0 when none
+	uint32_t NalCount;
+}
+Entry;
+
+enum { MAX_ENTRIES = 32 };
+
+static Entry Corpus[MAX_ENTRIES];
+static size_t CorpusCount;
+
+static Entry* Corpus_Add(const char* Name)
+{
+	Entry* E = &Corpus[CorpusCount++];
+	memset(E, 0, sizeof(*E));
+	E->Name = Name;
+	return E;
+}
+
+static void Expect_Sps(Entry* E, const SpsDesc* Desc)
+{
+	uint32_t Width = Desc->WidthInMbs * 16;
+	uint32_t Height = Desc->HeightInMapUnits * 16 * (Desc->FrameMbsOnly ? 1 : 2);
+
+	uint32_t Chroma = IsHighProfile(Desc->Profile) ? Desc->ChromaFormat : 1;
+	uint32_t UnitX = Chroma == 0 || Chroma == 3 ? 1 : 2;
+	uint32_t UnitY = (Chroma == 1 ? 2 : 1) * (Desc->FrameMbsOnly ? 1 : 2);
+
+	E->Expected.HasSps = true;
+	E->Expected.Profile = Desc->Profile;
+	E->Expected.Level = Desc->Level;
+	E->Expected.RefFrames = Desc->RefFrames;
+	E->Expected.Width = Width - (Desc->Crop[0] + Desc->Crop[1]) * UnitX;
+	E->Expected.Height = Height - (Desc->Crop[2] + Desc->Crop[3]) * UnitY;
+}
+
+static void Corpus_Build(void)
+{
+	uint64_t Random = 41;
+
+	// 1080p high profile keyframe, like hardware encoders produce
+	{
+		Entry* E = Corpus_Add("1080p high IDR");
+		SpsDesc Sps = { .Profile = 100, .Level = 40, .ChromaFormat = 1, .RefFrames = 1, .WidthInMbs = 120, .HeightInMapUnits = 68, .FrameMbsOnly = true, .Crop = { 0, 0, 0, 4 } };
+		Stream_Sps(&E->Stream, 4, &Sps, &Random);
+		Stream_Pps(&E->Stream, 4, true);
+		E->Expected.SliceOffset = (uint32_t)Stream_Slice(&E->Stream, 4, true, 3, 7, 0, 5000, &Random) + 1;
+		Expect_Sps(E, &Sps);
+		E->Expected.HasPps = true;
+		E->Expected.Cabac = true;
+		E->Expected.Type = H264_FRAME_IDR;
+		E->Expected.Reference = true;
+		E->Expected.SliceCount = 1;
+		E->Result = true;
+		E->NalCount = 3;
+	}
+
+	// 4K main profile, CAVLC, 3 byte start codes
+	{
+		Entry* E = Corpus_Add("2160p main IDR");
+		SpsDesc Sps = { .Profile = 77, .Level = 51, .RefFrames = 2, .WidthInMbs = 240, .HeightInMapUnits = 135, .FrameMbsOnly = true };
+		Stream_Sps(&E->Stream, 3, &Sps, &Random);
+		Stream_Pps(&E->Stream, 3, false);
+		E->Expected.SliceOffset = (uint32_t)Stream_Slice(&E->Stream, 3, true, 2, 2, 0, 20000, &Random);
+		Expect_Sps(E, &Sps);
+		E->Expected.HasPps = true;
+		E->Expected.Type = H264_FRAME_IDR;
+		E->Expected.Reference = true;
+		E->Expected.SliceCount = 1;
+		E->Result = true;
+		E->NalCount = 3;
+	}
+
+	// P-frame without parameter sets
+	{
+		Entry* E = Corpus_Add("P reference");
+		E->Expected.SliceOffset = (uint32_t)Stream_Slice(&E->Stream, 4, false, 2, 5, 0, 800, &Random) + 1;
+		E->Expected.Type = H264_FRAME_P;
+		E->Expected.Reference = true;
+		E->Expected.SliceCount = 1;
+		E->Result = true;
+		E->NalCount = 1;
+	}
+
+	// non-reference B-frame, baseline SPS with POC type 1 in front of it
+	{
+		Entry* E = Corpus_Add("baseline POC 1, B non-reference");
+		SpsDesc Sps = { .Profile = 66, .Level = 31, .PocType = 1, .RefFrames = 4, .WidthInMbs = 80, .HeightInMapUnits = 45, .FrameMbsOnly = true };
+		Stream_Sps(&E->Stream, 4, &Sps, &Random);
+		E->Expected.SliceOffset = (uint32_t)Stream_Slice(&E->Stream, 4, false, 0, 6, 0, 300, &Random) + 1;
+		Expect_Sps(E, &Sps);
+		E->Expected.Type = H264_FRAME_B;
+		E->Expected.SliceCount = 1;
+		E->Result = true;
+		E->NalCount = 2;
+	}
+
+	// I & P slices in same frame, frame is P, reference when any slice is
+	{
+		Entry* E = Corpus_Add("multi-slice I+P");
+		E->Expected.SliceOffset = (uint32_t)Stream_Slice(&E->Stream, 3, false, 0, 7, 0, 1000, &Random);
+		Stream_Slice(&E->Stream, 3, false, 1, 0, 4000, 1000, &Random);
+		Stream_Slice(&E->Stream, 3, false, 0, 2, 8000, 1000, &Random);
+		E->Expected.Type = H264_FRAME_P;
+		E->Expected.Reference = true;
+		E->Expected.SliceCount = 3;
+		E->Result = true;
+		E->NalCount = 3;
+	}
+
+	// interlaced, crop is in pairs of field lines
+	{
+		Entry* E = Corpus_Add("1080i high");
+		SpsDesc Sps = { .Profile = 100, .Level = 41, .ChromaFormat = 1, .RefFrames = 3, .WidthInMbs = 120, .HeightInMapUnits = 34, .FrameMbsOnly = false, .Crop = { 0, 0, 0, 2 } };
+		Stream_Sps(&E->Stream, 4, &Sps, &Random);
+		Stream_Pps(&E->Stream, 4, true);
+		E->Expected.SliceOffset = (uint32_t)Stream_Slice(&E->Stream, 4, false, 3, 2, 0, 100, &Random) + 1;
+		Expect_Sps(E, &Sps);
+		E->Expected.HasPps = true;
+		E->Expected.Cabac = true;
+		E->Expected.Type = H264_FRAME_I;
+		E->Expected.Reference = true;
+		E->Expected.SliceCount = 1;
+		E->Result = true;
+		E->NalCount = 3;
+	}
+
+	// 4:4:4 with scaling matrices, crop unit is one sample
+	{
+		Entry* E = Corpus_Add("high 4:4:4 scaling lists");
+		SpsDesc Sps = { .Profile = 244, .Level = 52, .ChromaFormat = 3, .Scaling = true, .RefFrames = 1, .WidthInMbs = 100, .HeightInMapUnits = 60, .FrameMbsOnly = true, .Crop = { 3, 5, 1, 7 } };
+		Stream_Sps(&E->Stream, 4, &Sps, &Random);
+		E->Expected.SliceOffset = (uint32_t)Stream_Slice(&E->Stream, 4, true, 1, 2, 0, 100, &Random) + 1;
+		Expect_Sps(E, &Sps);
+		E->Expected.Type = H264_FRAME_IDR;
+		E->Expected.Reference = true;
+		E->Expected.SliceCount = 1;
+		E->Result = true;
+		E->NalCount = 2;
+	}
+
+	// monochrome high, crop is not scaled by chroma
+	{
+		Entry* E = Corpus_Add("high 4:0:0");
+		SpsDesc Sps = { .Profile = 100, .Level = 30, .ChromaFormat = 0, .RefFrames = 1, .WidthInMbs = 40, .HeightInMapUnits = 30, .FrameMbsOnly = true, .Crop = { 1, 1, 1, 1 } };
+		Stream_Sps(&E->Stream, 4, &Sps, &Random);
+		E->Expected.SliceOffset = (uint32_t)Stream_Slice(&E->Stream, 4, true, 1, 7, 0, 10, &Random) + 1;
+		Expect_Sps(E, &Sps);
+		E->Expected.Type = H264_FRAME_IDR;
+		E->Expected.Reference = true;
+		E->Expected.SliceCount = 1;
+		E->Result = true;
+		E->NalCount = 2;
+	}
+
+	// zero constraint & level bytes followed by large sps id need emulation prevention inside SPS
+	{
+		Entry* E = Corpus_Add("escaped SPS");
+		SpsDesc Sps = { .Profile = 100, .Level = 0, .SpsId = 63, .ChromaFormat = 1, .RefFrames = 0, .WidthInMbs = 1, .HeightInMapUnits = 1, .FrameMbsOnly = true };
+		Stream_Sps(&E->Stream, 4, &Sps, &Random);
+		Expect_Sps(E, &Sps);
+		E->NalCount = 1;
+	}
+
+	// user data SEI before keyframe, long enough that payload size has 255 bytes, and one with other UUID
+	{
+		Entry* E = Corpus_Add("user data SEI");
+		static const uint8_t OtherUuid[16] = { 'S', 'c', 'r', 'e', 'e', 'n', 'B', 'u', 'd', 'd', 'y', 'O', 'v', 'r', 'l', '2' };
+		Stream_Sei(&E->Stream, 4, OtherUuid, 10);
+		E->UserDataOffset = E->Stream.Size;
+		Stream_Sei(&E->Stream, 4, TestUuid, 600);
+		E->Expected.SliceOffset = (uint32_t)Stream_Slice(&E->Stream, 4, true, 3, 7, 0, 200, &Random) + 1;
+		E->Expected.Type = H264_FRAME_IDR;
+		E->Expected.Reference = true;
+		E->Expected.SliceCount = 1;
+		E->Result = true;
+		E->NalCount = 3;
+	}
+
+	// trailing zeros between & after NAL units are not part of them
+	{
+		Entry* E = Corpus_Add("trailing zeros");
+		E->Expected.SliceOffset = (uint32_t)Stream_Slice(&E->Stream, 3, false, 2, 0, 0, 100, &Random);
+		for (int Index = 0; Index < 7; Index++)
+		{
+			Stream_Byte(&E->Stream, 0);
+		}
+		Stream_Slice(&E->Stream, 3, false, 2, 0, 10, 100, &Random);
+		for (int Index = 0; Index < 3; Index++)
+		{
+			Stream_Byte(&E->Stream, 0);
+		}
+		E->Expected.Type = H264_FRAME_P;
+		E->Expected.Reference = true;
+		E->Expected.SliceCount = 2;
+		E->Result = true;
+		E->NalCount = 2;
+	}
+
+	// slice header cut short is not counted
+	{
+		Entry* E = Corpus_Add("truncated slice");
+		Stream_Byte(&E->Stream, 0);
+		Stream_Byte(&E->Stream, 0);
+		Stream_Byte(&E->Stream, 1);
+		Stream_Byte(&E->Stream, 0x65);
+		Stream_Byte(&E->Stream, 0x00);
+		E->NalCount = 1;
+	}
+
+	// no start code at all
+	{
+		Entry* E = Corpus_Add("no start code");
+		for (int Index = 0; Index < 100; Index++)
+		{
+			Stream_Byte(&E->Stream, (uint8_t)(Index + 5));
+		}
+	}
+
+	// only zeros, and start code as last bytes
+	{
+		Entry* E = Corpus_Add("zeros & start code at end");
+		for (int Index = 0; Index < 50; Index++)
+		{
+			Stream_Byte(&E->Stream, 0);
+		}
+		Stream_Byte(&E->Stream, 1);
+		E->NalCount = 1;
+	}
+}
+
+static void Corpus_Free(void)
+{
+	for (size_t Index = 0; Index < CorpusCount; Index++)
+	{
+		free(Corpus[Index].Stream.Data);
+	}
+	CorpusCount = 0;
+}
+
+//
+// tests
+
+static void Test_Corpus(void)
+{
+	for (size_t Index = 0; Index < CorpusCount; Index++)
+	{
+		Entry* E = &Corpus[Index];
+		const uint8_t* Data = E->Stream.Data;
+		uint32_t Size = (uint32_t)E->Stream.Size;
+
+		H264Info Info;
+		bool Result = H264Parse_AccessUnit(Data, Size, TestUuid, &Info);
+
+		const H264Info* X = &E->Expected;
+		bool Ok = Result == E->Result
+			&& Info.Type == X->Type
+			&& Info.Reference == X->Reference
+			&& Info.SliceCount == X->SliceCount
+			&& (Info.SliceCount == 0 || Info.SliceOffset == X->SliceOffset)
+			&& Info.HasSps == X->HasSps
+			&& Info.HasPps == X->HasPps
+			&& (!X->HasSps || (Info.Profile == X->Profile && Info.Level == X->Level && Info.RefFrames == X->RefFrames && Info.Width == X->Width && Info.Height == X->Height))
+			&& (!X->HasPps || Info.Cabac == X->Cabac);
+		if (!Ok)
+		{
+			fprintf(stderr, "corpus \"%s\": result %d type %d ref %d slices %u offset %u sps %d %ux%u profile %u level %u refs %u pps %d cabac %d\n",
+				E->Name, Result, Info.Type, Info.Reference, Info.SliceCount, Info.SliceOffset, Info.HasSps, Info.Width, Info.Height,
+				Info.Profile, Info.Level, Info.RefFrames, Info.HasPps, Info.Cabac);
+		}
+		TEST_CHECK(Ok);
+
+		if (E->UserDataOffset)
+		{
+			// NAL unit starts after 4 byte start code
+			TEST_CHECK(Info.UserData == Data + E->UserDataOffset + 4);
+			TEST_CHECK(Info.UserDataSize > 600 && Info.UserData + Info.UserDataSize <= Data + Size);
+		}
+		else
+		{
+			TEST_CHECK(Info.UserData == NULL);
+		}
+
+		// without UUID user data is never returned
+		H264Info NoUuid;
+		H264Parse_AccessUnit(Data, Size, NULL, &NoUuid);
+		TEST_CHECK(NoUuid.UserData == NULL && NoUuid.SliceCount == Info.SliceCount);
+
+		uint32_t NalCount = 0;
+		const uint8_t* Ptr = Data;
+		const uint8_t* Nal;
+		uint32_t NalSize;
+		while (H264Parse_NextNal(&Ptr, Data + Size, &Nal, &NalSize))
+		{
+			TEST_CHECK(Nal >= Data && Nal + NalSize <= Data + Size);
+			TEST_CHECK(NalSize == 0 || Nal[NalSize - 1] != 0 || Nal + NalSize == Data + Size);
+			NalCount++;
+		}
+		if (NalCount != E->NalCount)
+		{
+			fprintf(stderr, "corpus \"%s\": %u NAL units, expected %u\n", E->Name, NalCount, E->NalCount);
+		}
+		TEST_CHECK(NalCount == E->NalCount);
+	}
+}
+
+// parses exact sized copy, so sanitizer catches any read past end
+static void Parse_Copy(const uint8_t* Data, size_t Size)
+{
+	uint8_t* Copy = Test_Alloc(Size);
+	memcpy(Copy, Data, Size);
+
+	H264Info Info;
+	bool Result = H264Parse_AccessUnit(Copy, (uint32_t)Size, TestUuid, &Info);
+	TEST_CHECK(Result == (Info.SliceCount != 0));
+	TEST_CHECK(Info.SliceCount == 0 || Info.SliceOffset < Size);
+	TEST_CHECK(Info.UserData == NULL || (Info.UserData > Copy && Info.UserData + Info.UserDataSize <= Copy + Size));
+	TEST_CHECK(Info.Type <= H264_FRAME_B);
+
+	free(Copy);
+}
+
+static void Test_Fuzz(uint32_t Rounds)
+{
+	uint64_t Random = 7;
+	uint8_t* Buffer = NULL;
+
+	for (size_t Index = 0; Index < CorpusCount; Index++)
+	{
+		const Stream* S = &Corpus[Index].Stream;
+		Buffer = realloc(Buffer, S->Size + 1);
+
+		for (uint32_t Round = 0; Round < Rounds; Round++)
+		{
+			memcpy(Buffer, S->Data, S->Size);
+			size_t Size = S->Size;
+
+			// few random bytes replaced with values that are special in Annex-B, then sometimes truncated
+			uint32_t Changes = 1 + Test_RandomRange(&Random, 8);
+			for (uint32_t Change = 0; Change < Changes && Size; Change++)
+			{
+				static const uint8_t Special[] = { 0, 0, 1, 3, 0xff, 0x80 };
+				uint32_t Position = Test_RandomRange(&Random, (uint32_t)Size);
+				uint32_t Kind = Test_RandomRange(&Random, 3);
+				Buffer[Position] = Kind == 0 ? Special[Test_RandomRange(&Random, sizeof(Special))] : Kind == 1 ? (uint8_t)Test_Random(&Random) : Buffer[Position] ^ (uint8_t)(1 << Test_RandomRange(&Random, 8));
+			}
+			if (Test_RandomRange(&Random, 4) == 0)
+			{
+				Size = Test_RandomRange(&Random, (uint32_t)Size + 1);
+			}
+
+			Parse_Copy(Buffer, Size);
+		}
+	}
+
+	// random short streams made of start codes & header bytes only
+	for (uint32_t Round = 0; Round < Rounds; Round++)
+	{
+		uint8_t Data[64];
+		size_t Size = Test_RandomRange(&Random, sizeof(Data) + 1);
+		for (size_t Index = 0; Index < Size; Index++)
+		{
+			static const uint8_t Bytes[] = { 0, 0, 0, 1, 3, 0x65, 0x41, 0x67, 0x68, 0x06, 0x05, 0xff };
+			Data[Index] = Bytes[Test_RandomRange(&Random, sizeof(Bytes))];
+		}
+		Parse_Copy(Data, Size);
+	}
+
+	free(Buffer);
+}
+
+//
+// benchmark
+
+static void Bench_Frame(const char* Name, const Stream* S)
+{
+	double Best;
+	uint32_t Slices = 0;
+	TEST_BENCH(0.5, Best,
+		H264Info Info;
+		H264Parse_AccessUnit(S->Data, (uint32_t)S->Size, TestUuid, &Info);
+		Slices += Info.SliceCount);
+
+	printf("%-26s %8zu bytes: %8.1f MB/s, %7.1f us per frame\n", Name, S->Size, (double)S->Size / Best / 1e6, Best * 1e6);
+	TEST_CHECK(Slices != 0);
+}
+
+int main(int ArgCount, char** Args)
+{
+	Corpus_Build();
+
+	if (Test_IsBench(ArgCount, Args))
+	{
+		uint64_t Random = 99;
+
+		// 4K keyframe of hardware encoder, 8 slices & SEI with overlay, about 1.5 MB
+		Stream Key = { 0 };
+		SpsDesc Sps = { .Profile = 100, .Level = 51, .ChromaFormat = 1, .RefFrames = 1, .WidthInMbs = 240, .HeightInMapUnits = 135, .FrameMbsOnly = true };
+		Stream_Sps(&Key, 4, &Sps, &Random);
+		Stream_Pps(&Key, 4, true);
+		Stream_Sei(&Key, 4, TestUuid, 60000);
+		for (uint32_t Slice = 0; Slice < 8; Slice++)
+		{
+			Stream_Slice(&Key, 4, true, 3, 7, Slice * 4050, 190000, &Random);
+		}
+		Bench_Frame("2160p IDR, 8 slices", &Key);
+
+		// 4K P-frame of mostly static desktop
+		Stream Delta = { 0 };
+		Stream_Slice(&Delta, 4, false, 2, 5, 0, 30000, &Random);
+		Bench_Frame("2160p P, 1 slice", &Delta);
+
+		// small frames are dominated by per-call overhead
+		Bench_Frame("1080p IDR corpus", &Corpus[0].Stream);
+
+		free(Key.Data);
+		free(Delta.Data);
+		Corpus_Free();
+		return Test_Finish("H264Parse bench");
+	}
+
+	Test_Corpus();
+	Test_Fuzz(2000);
+	Corpus_Free();
+	return Test_Finish("H264Parse");
+}
@@ -0,0 +1,1007 @@
+#include "Test.h"
+#include "../external/JsonStream.h"
+#include "../external/DerpMap.h"
+
+//
+// JsonStream tests, and DerpMap parser from external/DerpMap.h that uses it
+//
+// fixed cases check events, string decoding & integer parsing. Fuzzing mutates DerpMap like documents and compares
+// accept/reject decision with small recursive reference validator, while callback checks that every event points
+// inside input and JsonStream_GetString never writes past its output. Every mutated document also goes through
+// DerpMap_Parse. Inputs are copied to exactly sized heap blocks, so building with -fsanitize=address catches reads
+// past end of input. DerpMap tests check regions & nodes of generated documents, member order, defaults & limits,
+// and IPv4 & IPv6 text forms, fixed ones and random addresses written in every form inet_pton accepts.
+//
+// usage: JsonStreamTest [bench | fuzz <iterations>]
+//
+
+enum
+{
+	TEST_FUZZ_ITERATIONS = 20000,	// per seed document, default test run
+	TEST_MAX_EVENTS      = 64,
+};
+
+//
+// reference validator, RFC 8259 grammar with same nesting limit as parser
+//
+
+typedef struct
+{
+	const char* Ptr;
+	const char* End;
+	uint32_t Depth;
+}
+Ref_Parser;
+
+static void Ref_SkipSpace(Ref_Parser* Parser)
+{
+	while (Parser->Ptr != Parser->End && (*Parser->Ptr == ' ' || *Parser->Ptr == '\t' || *Parser->Ptr == '\n' || *Parser->Ptr == '\r'))
+	{
+		Parser->Ptr++;
+	}
+}
+
+static bool Ref_Literal(Ref_Parser* Parser, const char* Text)
+{
+	size_t Length = strlen(Text);
+	if ((size_t)(Parser->End - Parser->Ptr) < Length || memcmp(Parser->Ptr, Text, Length) != 0)
+	{
+		return false;
+	}
+	Parser->Ptr += Length;
+	return true;
+}
+
+static bool Ref_String(Ref_Parser* Parser)
+{
+	if (Parser->Ptr == Parser->End || *Parser->Ptr++ != '"')
+	{
+		return false;
+	}
+	while (Parser->Ptr != Parser->End)
+	{
+		unsigned char Ch = (unsigned char)*Parser->Ptr++;
+		if (Ch == '"')
+		{
+			return true;
+		}
+		if (Ch < 0x20)
+		{
+			return false;
+		}
+		if (Ch == '\\')
+		{
+			if (Parser->Ptr == Parser->End)
+			{
+				return false;
+			}
+			char Escape = *Parser->Ptr++;
+			if (Escape == 'u')
+			{
+				for (int Index = 0; Index < 4; Index++)
+				{
+					if (Parser->Ptr == Parser->End || !strchr("0123456789abcdefABCDEF", *Parser->Ptr) || *Parser->Ptr == 0)
+					{
+						return false;
+					}
+					Parser->Ptr++;
+				}
+			}
+			else if (!strchr("\"\\/bfnrt", Escape) || Escape == 0)
+			{
+				return false;
+			}
+		}
+	}
+	return false;
+}
+
+static bool Ref_Digits(Ref_Parser* Parser)
+{
+	const char* Start = Parser->Ptr;
+	while (Parser->Ptr != Parser->End && *Parser->Ptr >= '0' && *Parser->Ptr <= '9')
+	{
+		Parser->Ptr++;
+	}
+	return Parser->Ptr != Start;
+}
+
+static bool Ref_Number(Ref_Parser* Parser)
+{
+	if (Parser->Ptr != Parser->End && *Parser->Ptr == '-')
+	{
+		Parser->Ptr++;
+	}
+	if (Parser->Ptr != Parser->End && *Parser->Ptr == '0')
+	{
+		Parser->Ptr++;
+	}
+	else if (!Ref_Digits(Parser))
+	{
+		return false;
+	}
+	if (Parser->Ptr != Parser->End && *Parser->Ptr == '.')
+	{
+		Parser->Ptr++;
+		if (!Ref_Digits(Parser))
+		{
+			return false;
+		}
+	}
+	if (Parser->Ptr != Parser->End && (*Parser->Ptr == 'e' || *Parser->Ptr == 'E'))
+	{
+		Parser->Ptr++;
+		if (Parser->Ptr != Parser->End && (*Parser->Ptr == '+' || *Parser->Ptr == '-'))
+		{
+			Parser->Ptr++;
+		}
+		if (!Ref_Digits(Parser))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool Ref_Value(Ref_Parser* Parser)
+{
+	Ref_SkipSpace(Parser);
+	if (Parser->Ptr == Parser->End)
+	{
+		return false;
+	}
+
+	char Ch = *Parser->Ptr;
+	if (Ch == '{' || Ch == '[')
+	{
+		if (Parser->Depth == JSON_STREAM_MAX_DEPTH)
+		{
+			return false;
+		}
+		Parser->Depth++;
+		Parser->Ptr++;
+
+		char Close = Ch == '{' ? '}' : ']';
+		Ref_SkipSpace(Parser);
+		if (Parser->Ptr != Parser->End && *Parser->Ptr == Close)
+		{
+			Parser->Ptr++;
+			Parser->Depth--;
+			return true;
+		}
+
+		for (;;)
+		{
+			if (Ch == '{')
+			{
+				Ref_SkipSpace(Parser);
+				if (!Ref_String(Parser))
+				{
+					return false;
+				}
+				Ref_SkipSpace(Parser);
+				if (Parser->Ptr == Parser->End || *Parser->Ptr++ != ':')
+				{
+					return false;
+				}
+			}
+			if (!Ref_Value(Parser))
+			{
+				return false;
+			}
+			Ref_SkipSpace(Parser);
+			if (Parser->Ptr == Parser->End)
+			{
+				return false;
+			}
+			char Next = *Parser->Ptr++;
+			if (Next == Close)
+			{
+				Parser->Depth--;
+				return true;
+			}
+			if (Next != ',')
+			{
+				return false;
+			}
+		}
+	}
+	else if (Ch == '"')
+	{
+		return Ref_String(Parser);
+	}
+	else if (Ch == '-' || (Ch >= '0' && Ch <= '9'))
+	{
+		return Ref_Number(Parser);
+	}
+	return Ref_Literal(Parser, "null") || Ref_Literal(Parser, "true") || Ref_Literal(Parser, "false");
+}
+
+static bool Ref_Validate(const char* Data, size_t Size)
+{
+	Ref_Parser Parser = { Data, Data + Size, 0 };
+	if (!Ref_Value(&Parser))
+	{
+		return false;
+	}
+	Ref_SkipSpace(&Parser);
+	return Parser.Ptr == Parser.End;
+}
+
+//
+// checking callback
+//
+
+typedef struct
+{
+	const char* Data;
+	size_t Size;
+	char Stack[JSON_STREAM_MAX_DEPTH];
+	uint32_t Depth;
+	uint32_t Events;
+	bool Error;
+	JsonEventType Types[TEST_MAX_EVENTS];
+}
+Check_State;
+
+static bool Check_Inside(Check_State* State, const char* Ptr, size_t Length)
+{
+	return Ptr >= State->Data && Length <= State->Size && (size_t)(Ptr - State->Data) <= State->Size - Length;
+}
+
+static bool Check_OnEvent(void* UserData, const JsonEvent* Event)
+{
+	Check_State* State = UserData;
+
+	if (State->Events < TEST_MAX_EVENTS)
+	{
+		State->Types[State->Events] = Event->Type;
+	}
+	State->Events++;
+
+	bool InObject = State->Depth != 0 && State->Stack[State->Depth - 1] == '{';
+	bool Ok = true;
+
+	if (Event->Key)
+	{
+		Ok &= InObject || Event->Type == JSON_EVENT_OBJECT_END || Event->Type == JSON_EVENT_ARRAY_END;
+		Ok &= Check_Inside(State, Event->Key, Event->KeyLength);
+	}
+	if (Event->Value)
+	{
+		Ok &= Event->Type == JSON_EVENT_NUMBER || Event->Type == JSON_EVENT_STRING;
+		Ok &= Check_Inside(State, Event->Value, Event->ValueLength);
+	}
+
+	if (Event->Type == JSON_EVENT_OBJECT_END || Event->Type == JSON_EVENT_ARRAY_END)
+	{
+		char Expected = Event->Type == JSON_EVENT_OBJECT_END ? '{' : '[';
+		Ok &= State->Depth != 0 && State->Stack[State->Depth - 1] == Expected && Event->Depth == State->Depth - 1;
+		if (State->Depth != 0)
+		{
+			State->Depth--;
+		}
+	}
+	else
+	{
+		Ok &= Event->Depth == State->Depth;
+		Ok &= (Event->Key != NULL) == InObject;
+		if (Event->Type == JSON_EVENT_OBJECT_BEGIN || Event->Type == JSON_EVENT_ARRAY_BEGIN)
+		{
+			Ok &= State->Depth < JSON_STREAM_MAX_DEPTH;
+			if (State->Depth < JSON_STREAM_MAX_DEPTH)
+			{
+				State->Stack[State->Depth++] = Event->Type == JSON_EVENT_OBJECT_BEGIN ? '{' : '[';
+			}
+		}
+	}
+
+	// decoding must stay inside output for every size, guard bytes after it must not change
+	if (Event->Type == JSON_EVENT_STRING)
+	{
+		char Output[64 + 4];
+		size_t OutputSize = 1 + (Event->ValueLength * 7) % 64;
+		memset(Output, 0x5a, sizeof(Output));
+		if (JsonStream_GetString(Event, Output, OutputSize))
+		{
+			Ok &= strlen(Output) < OutputSize;
+		}
+		for (size_t Index = OutputSize; Index < sizeof(Output); Index++)
+		{
+			Ok &= Output[Index] == 0x5a;
+		}
+	}
+	else if (Event->Type == JSON_EVENT_NUMBER)
+	{
+		int64_t Value;
+		JsonStream_GetInteger(Event, &Value);
+	}
+
+	State->Error |= !Ok;
+	return true;
+}
+
+// returns parser result, checks events & compares result with reference validator
+static bool Check_Parse(const char* Text, size_t Size, Check_State* State)
+{
+	// exact allocation, so address sanitizer sees any read after last byte
+	char* Data = Test_Alloc(Size);
+	memcpy(Data, Text, Size);
+
+	memset(State, 0, sizeof(*State));
+	State->Data = Data;
+	State->Size = Size;
+
+	bool Result = JsonStream_Parse(Data, Size, &Check_OnEvent, State);
+	bool Expected = Ref_Validate(Data, Size);
+	if (Result != Expected || State->Error || (Result && State->Depth != 0))
+	{
+		fprintf(stderr, "mismatch: parser %d, reference %d, event error %d: '%.*s'\n", Result, Expected, State->Error, (int)(Size < 200 ? Size : 200), Text);
+		Test_Failures++;
+	}
+
+	free(Data);
+	return Result;
+}
+
+static bool Check_Text(const char* Text)
+{
+	Check_State State;
+	return Check_Parse(Text, strlen(Text), &State);
+}
+
+//
+// DerpMap like test documents
+//
+
+typedef struct
+{
+	char* Data;
+	size_t Size;
+	size_t Capacity;
+}
+Test_Text;
+
+static void Test_Append(Test_Text* Text, const char* Format, ...)
+{
+	if (!Text->Data)
+	{
+		Text->Capacity = 4096;
+		Text->Data = Test_Alloc(Text->Capacity);
+	}
+
+	for (;;)
+	{
+		va_list Args;
+		va_start(Args, Format);
+		int Length = vsnprintf(Text->Data + Text->Size, Text->Capacity - Text->Size, Format, Args);
+		va_end(Args);
+
+		if (Length >= 0 && (size_t)Length < Text->Capacity - Text->Size)
+		{
+			Text->Size += Length;
+			return;
+		}
+
+		Text->Capacity *= 2;
+		char* Data = Test_Alloc(Text->Capacity);
+		memcpy(Data, Text->Data, Text->Size);
+		free(Text->Data);
+		Text->Data = Data;
+	}
+}
+
+// same shape as https://login.tailscale.com/derpmap/default, members in different order for different seeds
+static Test_Text Test_MakeDerpMap(uint32_t RegionCount, uint32_t NodeCount, uint64_t Seed)
+{
+	Test_Text Text = { 0 };
+	Test_Append(&Text, "{\"Regions\":{");
+	for (uint32_t Region = 1; Region <= RegionCount; Region++)
+	{
+		bool IdLast = Test_RandomRange(&Seed, 4) == 0;
+
+		Test_Append(&Text, "%s\"%u\":{", Region == 1 ? "" : ",", Region);
+		if (!IdLast)
+		{
+			Test_Append(&Text, "\"RegionID\":%u,", Region);
+		}
+		Test_Append(&Text, "\"RegionCode\":\"r%u\",\"RegionName\":\"Region \\u00e9 %u \\ud83d\\ude00\",\"Latitude\":%u.%u,\"Longitude\":-%u.5e1,\"Nodes\":[",
+			Region, Region, Region * 7 % 90, Region, Region % 18);
+		for (uint32_t Node = 0; Node < NodeCount; Node++)
+		{
+			Test_Append(&Text, "%s{\"Name\":\"%u%c\",\"RegionID\":%u,\"HostName\":\"derp%u%c.tailscale.com\",\"CertName\":null,"
+				"\"IPv4\":\"%u.%u.%u.%u\",\"IPv6\":\"2001:db8:%x::%x\",\"CanPort80\":true",
+				Node ? "," : "", Region, 'a' + Node, Region, Region, 'a' + Node,
+				10 + Region % 200, Node, Region, 1 + Node, Region, Node);
+			if (Test_RandomRange(&Seed, 3) == 0)
+			{
+				Test_Append(&Text, ",\"DERPPort\":%u,\"STUNPort\":-1,\"STUNOnly\":false", 8443 + Node);
+			}
+			Test_Append(&Text, "}");
+		}
+		Test_Append(&Text, "]");
+		if (IdLast)
+		{
+			// RegionID after Nodes, as DerpMap parser callback must handle
+			Test_Append(&Text, ",\"RegionID\":%u", Region);
+		}
+		Test_Append(&Text, "}");
+	}
+	Test_Append(&Text, "},\"OmitDefaultRegions\":false}");
+	return Text;
+}
+
+//
+// tests
+//
+
+static void Test_Events(void)
+{
+	Check_State State;
+	const char* Text = " {\"a\" : [1, -2.5e+3, \"x\\ty\"], \"b\":{}, \"c\":[], \"d\":null, \"e\":true, \"f\":false} ";
+	TEST_CHECK(Check_Parse(Text, strlen(Text), &State));
+
+	JsonEventType Expected[] =
+	{
+		JSON_EVENT_OBJECT_BEGIN,
+		JSON_EVENT_ARRAY_BEGIN, JSON_EVENT_NUMBER, JSON_EVENT_NUMBER, JSON_EVENT_STRING, JSON_EVENT_ARRAY_END,
+		JSON_EVENT_OBJECT_BEGIN, JSON_EVENT_OBJECT_END,
+		JSON_EVENT_ARRAY_BEGIN, JSON_EVENT_ARRAY_END,
+		JSON_EVENT_NULL, JSON_EVENT_TRUE, JSON_EVENT_FALSE,
+		JSON_EVENT_OBJECT_END,
+	};
+	TEST_CHECK(State.Events == sizeof(Expected) / sizeof(Expected[0]));
+	TEST_CHECK(memcmp(State.Types, Expected, sizeof(Expected)) == 0);
+
+	TEST_CHECK(Check_Text("0"));
+	TEST_CHECK(Check_Text("\"\""));
+	TEST_CHECK(Check_Text("[[[[]]]]"));
+	TEST_CHECK(Check_Text("{\"\":{\"\":[{}]}}"));
+}
+
+static void Test_Invalid(void)
+{
+	const char* Invalid[] =
+	{
+		"", " ", "{", "}", "[", "[1,]", "[,1]", "{\"a\":1,}", "{\"a\"}", "{\"a\" 1}", "{1:2}", "[1 2]",
+		"01", "-", "1.", ".5", "1e", "1e+", "+1", "0x10", "nul", "True", "[true false]",
+		"\"abc", "\"\\x\"", "\"\\u12g4\"", "\"\\u123\"", "\"a\nb\"", "\"\\", "[1]]", "[1]x", "{}{}",
+	};
+	for (size_t Index = 0; Index < sizeof(Invalid) / sizeof(Invalid[0]); Index++)
+	{
+		TEST_CHECK(!Check_Text(Invalid[Index]));
+	}
+
+	// embedded zero byte is outside of any token
+	Check_State State;
+	TEST_CHECK(!Check_Parse("[1,\0 2]", 7, &State));
+
+	// nesting limit
+	char Deep[2 * (JSON_STREAM_MAX_DEPTH + 1) + 1];
+	for (int Limit = JSON_STREAM_MAX_DEPTH; Limit <= JSON_STREAM_MAX_DEPTH + 1; Limit++)
+	{
+		memset(Deep, '[', Limit);
+		memset(Deep + Limit, ']', Limit);
+		Deep[2 * Limit] = 0;
+		TEST_CHECK(Check_Text(Deep) == (Limit == JSON_STREAM_MAX_DEPTH));
+	}
+}
+
+typedef struct
+{
+	char String[64];
+	bool StringOk;
+	int64_t Integer;
+	bool IntegerOk;
+}
+Value_State;
+
+static bool Value_OnEvent(void* UserData, const JsonEvent* Event)
+{
+	Value_State* State = UserData;
+	if (Event->Depth == 1)
+	{
+		State->StringOk = JsonStream_GetString(Event, State->String, sizeof(State->String));
+		State->IntegerOk = JsonStream_GetInteger(Event, &State->Integer);
+	}
+	return true;
+}
+
+static Value_State Test_Value(const char* Value)
+{
+	char Text[128];
+	snprintf(Text, sizeof(Text), "[%s]", Value);
+
+	Value_State State = { 0 };
+	bool Parsed = JsonStream_Parse(Text, strlen(Text), &Value_OnEvent, &State);
+	TEST_CHECK(Parsed);
+	return State;
+}
+
+static void Test_Strings(void)
+{
+	struct
+	{
+		const char* Json;
+		const char* Utf8;
+	}
+	Cases[] =
+	{
+		{ "\"plain\"", "plain" },
+		{ "\"\\\"\\\\\\/\\b\\f\\n\\r\\t\"", "\"\\/\b\f\n\r\t" },
+		{ "\"\\u0041\\u00e9\\u20ac\"", "A\xc3\xa9\xe2\x82\xac" },
+		{ "\"\\ud83d\\ude00\"", "\xf0\x9f\x98\x80" },
+		{ "\"\\ud83dx\"", "\xef\xbf\xbdx" },				// unpaired high surrogate
+		{ "\"\\ude00\"", "\xef\xbf\xbd" },					// unpaired low surrogate
+		{ "\"\\ud83d\\u0041\"", "\xef\xbf\xbd" "A" },		// high surrogate followed by non-surrogate
+		{ "\"\xc3\xa9\"", "\xc3\xa9" },						// raw UTF-8 is copied
+	};
+	for (size_t Index = 0; Index < sizeof(Cases) / sizeof(Cases[0]); Index++)
+	{
+		Value_State State = Test_Value(Cases[Index].Json);
+		TEST_CHECK(State.StringOk && strcmp(State.String, Cases[Index].Utf8) == 0);
+		TEST_CHECK(!State.IntegerOk);
+	}
+
+	// output must fit terminator
+	JsonEvent Event = { .Type = JSON_EVENT_STRING, .Value = "abcd", .ValueLength = 4 };
+	char Output[8];
+	TEST_CHECK(!JsonStream_GetString(&Event, Output, 4));
+	TEST_CHECK(JsonStream_GetString(&Event, Output, 5) && strcmp(Output, "abcd") == 0);
+	TEST_CHECK(!JsonStream_GetString(&Event, Output, 0));
+
+	Event.Value = "\\u20ac";
+	Event.ValueLength = 6;
+	TEST_CHECK(!JsonStream_GetString(&Event, Output, 3));
+	TEST_CHECK(JsonStream_GetString(&Event, Output, 4) && strcmp(Output, "\xe2\x82\xac") == 0);
+}
+
+static void Test_Integers(void)
+{
+	struct
+	{
+		const char* Json;
+		bool Ok;
+		int64_t Value;
+	}
+	Cases[] =
+	{
+		{ "0", true, 0 },
+		{ "-0", true, 0 },
+		{ "443", true, 443 },
+		{ "-1", true, -1 },
+		{ "9223372036854775807", true, INT64_MAX },
+		{ "-9223372036854775808", true, INT64_MIN },
+		{ "9223372036854775808", false, 0 },
+		{ "-9223372036854775809", false, 0 },
+		{ "99999999999999999999", false, 0 },
+		{ "1.0", false, 0 },
+		{ "1e3", false, 0 },
+		{ "\"1\"", false, 0 },
+		{ "true", false, 0 },
+	};
+	for (size_t Index = 0; Index < sizeof(Cases) / sizeof(Cases[0]); Index++)
+	{
+		Value_State State = Test_Value(Cases[Index].Json);
+		TEST_CHECK(State.IntegerOk == Cases[Index].Ok);
+		TEST_CHECK(!State.IntegerOk || State.Integer == Cases[Index].Value);
+	}
+}
+
+static DerpMapRegion Test_Regions[DERPMAP_MAX_REGION_COUNT];
+
+static bool Test_ParseDerpMap(const char* Text)
+{
+	memset(Test_Regions, 0, sizeof(Test_Regions));
+	return DerpMap_Parse(Test_Regions, Text, strlen(Text));
+}
+
+static void Test_DerpMap(void)
+{
+	for (uint64_t Seed = 1; Seed <= 20; Seed++)
+	{
+		uint32_t RegionCount = Seed == 20 ? DERPMAP_MAX_REGION_COUNT - 1 : 1 + (uint32_t)Seed * 3;
+		uint32_t NodeCount = 1 + Seed % DERPMAP_MAX_NODE_COUNT;
+		Test_Text Text = Test_MakeDerpMap(RegionCount, NodeCount, Seed);
+
+		memset(Test_Regions, 0, sizeof(Test_Regions));
+		TEST_CHECK(DerpMap_Parse(Test_Regions, Text.Data, Text.Size));
+		TEST_CHECK(Test_Regions[0].NodeCount == 0);
+
+		for (uint32_t RegionId = 1; RegionId <= RegionCount; RegionId++)
+		{
+			const DerpMapRegion* Region = &Test_Regions[RegionId];
+			TEST_CHECK(Region->NodeCount == NodeCount);
+			for (uint32_t NodeIndex = 0; NodeIndex < Region->NodeCount; NodeIndex++)
+			{
+				const DerpMapNode* Node = &Region->Nodes[NodeIndex];
+
+				char HostName[64];
+				snprintf(HostName, sizeof(HostName), "derp%u%c.tailscale.com", RegionId, 'a' + NodeIndex);
+				TEST_CHECK(strcmp(Node->HostName, HostName) == 0);
+
+				uint8_t IPv4[4] = { (uint8_t)(10 + RegionId % 200), (uint8_t)NodeIndex, (uint8_t)RegionId, (uint8_t)(1 + NodeIndex) };
+				uint8_t IPv6[16] = { 0x20, 0x01, 0x0d, 0xb8, (uint8_t)(RegionId >> 8), (uint8_t)RegionId, [15] = (uint8_t)NodeIndex };
+				TEST_CHECK(Node->HasIPv4 && memcmp(Node->IPv4, IPv4, 4) == 0);
+				TEST_CHECK(Node->HasIPv6 && memcmp(Node->IPv6, IPv6, 16) == 0);
+
+				// generator adds DERPPort, STUNPort -1 & STUNOnly false to some nodes
+				TEST_CHECK(Node->DerpPort == DERPMAP_DERP_PORT ? Node->StunPort == DERPMAP_STUN_PORT : Node->DerpPort == 8443 + NodeIndex && Node->StunPort == 0);
+				TEST_CHECK(!Node->StunOnly);
+			}
+		}
+		TEST_CHECK(RegionCount + 1 == DERPMAP_MAX_REGION_COUNT || Test_Regions[RegionCount + 1].NodeCount == 0);
+		free(Text.Data);
+	}
+
+	// defaults, port limits, nodes without HostName, bad addresses, out of range RegionID, extra nodes
+	TEST_CHECK(Test_ParseDerpMap(
+		"{\"Regions\":{"
+			"\"1\":{\"Nodes\":[{\"HostName\":\"a\",\"DERPPort\":0,\"STUNPort\":0,\"STUNOnly\":true,\"IPv4\":\"1.2.3\",\"IPv6\":\"::1\"},"
+				"{\"IPv4\":\"1.2.3.4\"},{\"HostName\":\"b\",\"DERPPort\":70000,\"STUNPort\":65535,\"IPv4\":\"1.2.3.4\",\"IPv6\":\"1::2::3\"}],\"RegionID\":1},"
+			"\"2\":{\"RegionID\":256,\"Nodes\":[{\"HostName\":\"c\"}]},"
+			"\"3\":{\"RegionID\":-1,\"Nodes\":[{\"HostName\":\"d\"}]},"
+			"\"4\":{\"RegionID\":4,\"Nodes\":[{\"HostName\":\"1\"},{\"HostName\":\"2\"},{\"HostName\":\"3\"},{\"HostName\":\"4\"},"
+				"{\"HostName\":\"5\"},{\"HostName\":\"6\"},{\"HostName\":\"7\"},{\"HostName\":\"8\"},{\"HostName\":\"9\"}]},"
+			"\"5\":{\"RegionID\":\"5\",\"Nodes\":[{\"HostName\":\"e\"}]}"
+		"}}"));
+
+	const DerpMapNode* Node = &Test_Regions[1].Nodes[0];
+	TEST_CHECK(Test_Regions[1].NodeCount == 2);
+	TEST_CHECK(strcmp(Node->HostName, "a") == 0 && Node->DerpPort == 443 && Node->StunPort == 3478 && Node->StunOnly);
+	TEST_CHECK(!Node->HasIPv4 && Node->HasIPv6 && Node->IPv6[15] == 1);
+	Node = &Test_Regions[1].Nodes[1];
+	TEST_CHECK(strcmp(Node->HostName, "b") == 0 && Node->DerpPort == 443 && Node->StunPort == 65535);
+	TEST_CHECK(Node->HasIPv4 && !Node->HasIPv6);
+
+	TEST_CHECK(Test_Regions[4].NodeCount == DERPMAP_MAX_NODE_COUNT && strcmp(Test_Regions[4].Nodes[7].HostName, "8") == 0);
+	TEST_CHECK(Test_Regions[5].NodeCount == 0 && Test_Regions[255].NodeCount == 0);
+
+	// "Regions" must be object at top level
+	TEST_CHECK(Test_ParseDerpMap("{\"Regions\":{}}"));
+	TEST_CHECK(!Test_ParseDerpMap("{\"Regions\":[]}"));
+	TEST_CHECK(!Test_ParseDerpMap("{\"a\":{\"Regions\":{}}}"));
+	TEST_CHECK(!Test_ParseDerpMap("{\"Regions\":{\"1\":{\"RegionID\":1,\"Nodes\":[{\"HostName\":\"a\"}]}}"));
+}
+
+static void Test_Addresses(void)
+{
+	struct
+	{
+		const char* Text;
+		uint8_t Address[4];
+	}
+	IPv4[] =
+	{
+		{ "0.0.0.0", { 0, 0, 0, 0 } },
+		{ "255.255.255.255", { 255, 255, 255, 255 } },
+		{ "10.1.200.3", { 10, 1, 200, 3 } },
+	};
+	for (size_t Index = 0; Index < sizeof(IPv4) / sizeof(IPv4[0]); Index++)
+	{
+		uint8_t Address[4];
+		TEST_CHECK(DerpMap_ParseIPv4(IPv4[Index].Text, Address) && memcmp(Address, IPv4[Index].Address, 4) == 0);
+	}
+
+	const char* InvalidIPv4[] =
+	{
+		"256.1.1.1", "1.2.3", "1.2.3.4.5", "1.2.3.", ".1.2.3", "01.2.3.4", "1.2.3.4 ", " 1.2.3.4", "1..3.4", "1000.2.3.4",
+		"0x1.2.3.4", "1.2.3.-4", "",
+	};
+	for (size_t Index = 0; Index < sizeof(InvalidIPv4) / sizeof(InvalidIPv4[0]); Index++)
+	{
+		// address is not changed on failure
+		uint8_t Address[4] = { 0x5a, 0x5a, 0x5a, 0x5a };
+		TEST_CHECK(!DerpMap_ParseIPv4(InvalidIPv4[Index], Address) && Address[0] == 0x5a && Address[3] == 0x5a);
+	}
+
+	struct
+	{
+		const char* Text;
+		uint8_t Address[16];
+	}
+	IPv6[] =
+	{
+		{ "::", { 0 } },
+		{ "::1", { [15] = 1 } },
+		{ "1::", { 0, 1 } },
+		{ "2001:db8::8a2e:370:7334", { 0x20, 0x01, 0x0d, 0xb8, [10] = 0x8a, 0x2e, 0x03, 0x70, 0x73, 0x34 } },
+		{ "2001:DB8:0:0:0:0:0:1", { 0x20, 0x01, 0x0d, 0xb8, [15] = 1 } },
+		{ "1:2:3:4:5:6:7::", { 0, 1, 0, 2, 0, 3, 0, 4, 0, 5, 0, 6, 0, 7, 0, 0 } },
+		{ "::2:3:4:5:6:7:8", { 0, 0, 0, 2, 0, 3, 0, 4, 0, 5, 0, 6, 0, 7, 0, 8 } },
+		{ "::ffff:192.0.2.1", { [10] = 0xff, 0xff, 192, 0, 2, 1 } },
+		{ "1:2:3:4:5:6:1.2.3.4", { 0, 1, 0, 2, 0, 3, 0, 4, 0, 5, 0, 6, 1, 2, 3, 4 } },
+	};
+	for (size_t Index = 0; Index < sizeof(IPv6) / sizeof(IPv6[0]); Index++)
+	{
+		uint8_t Address[16];
+		TEST_CHECK(DerpMap_ParseIPv6(IPv6[Index].Text, Address) && memcmp(Address, IPv6[Index].Address, 16) == 0);
+	}
+
+	const char* InvalidIPv6[] =
+	{
+		":", ":::", "1:::2", "1::2::3", ":1::2", "1::2:", "1:2:3:4:5:6:7", "1:2:3:4:5:6:7:8:9", "1:2:3:4:5:6:7:8::",
+		"::1:2:3:4:5:6:7:8", "12345::", "g::", "::1.2.3", "1:2:3:4:5:6:7:1.2.3.4", "1.2.3.4", "::1.2.3.4:5", "fe80::1%1",
+		" ::1", "",
+	};
+	for (size_t Index = 0; Index < sizeof(InvalidIPv6) / sizeof(InvalidIPv6[0]); Index++)
+	{
+		uint8_t Address[16];
+		memset(Address, 0x5a, sizeof(Address));
+		TEST_CHECK(!DerpMap_ParseIPv6(InvalidIPv6[Index], Address) && Address[0] == 0x5a && Address[15] == 0x5a);
+	}
+
+	// random addresses with runs of zero groups, written full, with "::" for every zero run, and with IPv4 tail
+	uint64_t Random = 29;
+	for (uint32_t Iteration = 0; Iteration < 100000; Iteration++)
+	{
+		uint16_t Groups[8];
+		for (uint32_t Group = 0; Group < 8; Group++)
+		{
+			Groups[Group] = Test_RandomRange(&Random, 3) == 0 ? 0 : (uint16_t)Test_Random(&Random);
+		}
+
+		uint8_t Expected[16];
+		for (uint32_t Group = 0; Group < 8; Group++)
+		{
+			Expected[Group * 2] = (uint8_t)(Groups[Group] >> 8);
+			Expected[Group * 2 + 1] = (uint8_t)Groups[Group];
+		}
+
+		for (uint32_t Start = 0; Start <= 8; Start++)
+		{
+			for (uint32_t End = Start; End <= 8; End++)
+			{
+				// zero run [Start, End) written as "::", Start == End means no "::"
+				bool Compress = End > Start;
+				for (uint32_t Group = Start; Group < End; Group++)
+				{
+					Compress &= Groups[Group] == 0;
+				}
+				if (End > Start && !Compress)
+				{
+					continue;
+				}
+
+				for (uint32_t Tail = 0; Tail < 2; Tail++)
+				{
+					// IPv4 tail takes last two groups, they must not be part of "::"
+					if (Tail && End > 6)
+					{
+						continue;
+					}
+
+					char Text[64];
+					size_t Length = 0;
+					uint32_t Last = Tail ? 6 : 8;
+					for (uint32_t Group = 0; Group < Last; Group++)
+					{
+						if (Compress && Group == Start)
+						{
+							Length += snprintf(Text + Length, sizeof(Text) - Length, "::");
+							Group = End - 1;
+							continue;
+						}
+						bool Separator = Group != 0 && !(Compress && Group == End);
+						Length += snprintf(Text + Length, sizeof(Text) - Length, Separator ? ":%x" : "%x", Groups[Group]);
+					}
+					if (Tail)
+					{
+						bool Separator = !(Compress && End == 6);
+						Length += snprintf(Text + Length, sizeof(Text) - Length, "%s%u.%u.%u.%u", Separator ? ":" : "", Expected[12], Expected[13], Expected[14], Expected[15]);
+					}
+
+					uint8_t Address[16];
+					bool Ok = DerpMap_ParseIPv6(Text, Address);
+					TEST_CHECK(Ok && memcmp(Address, Expected, 16) == 0);
+					if (!Ok || memcmp(Address, Expected, 16) != 0)
+					{
+						fprintf(stderr, "IPv6 '%s'\n", Text);
+						return;
+					}
+				}
+			}
+		}
+	}
+}
+
+//
+// fuzzing
+//
+
+static size_t Fuzz_Mutate(uint64_t* Random, const char* Input, size_t InputSize, char* Output, size_t OutputCapacity)
+{
+	static const char Tokens[][8] = { "{", "}", "[", "]", ",", ":", "\"", "\\", "\\u", "\\ud800", "0", "-", "e", ".", "null", " ", "\x01", "\xff" };
+
+	size_t Size = InputSize < OutputCapacity ? InputSize : OutputCapacity;
+	memcpy(Output, Input, Size);
+
+	uint32_t Count = 1 + Test_RandomRange(Random, 4);
+	for (uint32_t Mutation = 0; Mutation < Count && Size != 0; Mutation++)
+	{
+		size_t Position = Test_RandomRange(Random, (uint32_t)Size);
+		switch (Test_RandomRange(Random, 6))
+		{
+		case 0: // flip bits of byte
+			Output[Position] ^= (char)(1 << Test_RandomRange(Random, 8));
+			break;
+
+		case 1: // replace byte with structural character
+			Output[Position] = Tokens[Test_RandomRange(Random, 7)][0];
+			break;
+
+		case 2: // delete range
+		{
+			size_t Length = 1 + Test_RandomRange(Random, 16);
+			Length = Length < Size - Position ? Length : Size - Position;
+			memmove(Output + Position, Output + Position + Length, Size - Position - Length);
+			Size -= Length;
+			break;
+		}
+
+		case 3: // insert token
+		{
+			const char* Token = Tokens[Test_RandomRange(Random, sizeof(Tokens) / sizeof(Tokens[0]))];
+			size_t Length = strlen(Token);
+			if (Size + Length <= OutputCapacity)
+			{
+				memmove(Output + Position + Length, Output + Position, Size - Position);
+				memcpy(Output + Position, Token, Length);
+				Size += Length;
+			}
+			break;
+		}
+
+		case 4: // duplicate range, creates deep nesting & repeated members
+		{
+			size_t Length = 1 + Test_RandomRange(Random, 64);
+			Length = Length < Size - Position ? Length : Size - Position;
+			if (Size + Length <= OutputCapacity)
+			{
+				// moved bytes leave copy of range in place
+				memmove(Output + Position + Length, Output + Position, Size - Position);
+				Size += Length;
+			}
+			break;
+		}
+
+		case 5: // truncate
+			Size = Position;
+			break;
+		}
+	}
+	return Size;
+}
+
+static void Test_Fuzz(uint64_t Iterations)
+{
+	Test_Text Seeds[3] =
+	{
+		Test_MakeDerpMap(2, 2, 1),
+		Test_MakeDerpMap(5, 3, 2),
+		{ 0 },
+	};
+	Test_Append(&Seeds[2], "[{\"a\":[1,2.5e-3,\"\\u00e9\\ud83d\\ude00\",true,false,null]},{\"\":{}},[],\"x\\\\y\",-0]");
+
+	size_t Capacity = 0;
+	for (size_t Index = 0; Index < sizeof(Seeds) / sizeof(Seeds[0]); Index++)
+	{
+		Check_State State;
+		TEST_CHECK(Check_Parse(Seeds[Index].Data, Seeds[Index].Size, &State));
+		Capacity = Seeds[Index].Size * 2 > Capacity ? Seeds[Index].Size * 2 : Capacity;
+	}
+
+	char* Buffer = Test_Alloc(Capacity);
+	uint64_t Random = 1;
+	uint64_t Accepted = 0;
+
+	for (size_t Index = 0; Index < sizeof(Seeds) / sizeof(Seeds[0]); Index++)
+	{
+		for (uint64_t Iteration = 0; Iteration < Iterations && Test_Failures < 10; Iteration++)
+		{
+			size_t Size = Fuzz_Mutate(&Random, Seeds[Index].Data, Seeds[Index].Size, Buffer, Capacity);
+
+			Check_State State;
+			Accepted += Check_Parse(Buffer, Size, &State);
+
+			// exact allocation, same as Check_Parse
+			char* Data = Test_Alloc(Size);
+			memcpy(Data, Buffer, Size);
+			memset(Test_Regions, 0, sizeof(Test_Regions));
+			DerpMap_Parse(Test_Regions, Data, Size);
+			free(Data);
+		}
+		free(Seeds[Index].Data);
+	}
+
+	// mutations must keep enough inputs valid to exercise event paths, not only early rejections
+	TEST_CHECK(Accepted != 0);
+	free(Buffer);
+}
+
+//
+// benchmarks
+//
+
+static bool Bench_OnEmpty(void* UserData, const JsonEvent* Event)
+{
+	(void)Event;
+	++*(uint64_t*)UserData;
+	return true;
+}
+
+static void Bench_Run(void)
+{
+	struct
+	{
+		const char* Name;
+		uint32_t Regions;
+		uint32_t Nodes;
+	}
+	Cases[] =
+	{
+		{ "derpmap default (30 regions)", 30, 3 },
+		{ "derpmap 255 regions x 8 nodes", 255, 8 },
+	};
+
+	printf("%-32s %10s %12s %10s\n", "input", "size KB", "usec/parse", "MB/s");
+	for (size_t Index = 0; Index < sizeof(Cases) / sizeof(Cases[0]); Index++)
+	{
+		Test_Text Text = Test_MakeDerpMap(Cases[Index].Regions, Cases[Index].Nodes, 1);
+
+		// regions are zeroed for every parse, same as ScreenBuddy does
+		bool Parsed;
+		double Best;
+		TEST_BENCH(0.5, Best,
+			memset(Test_Regions, 0, sizeof(Test_Regions));
+			Parsed = DerpMap_Parse(Test_Regions, Text.Data, Text.Size));
+		TEST_CHECK(Parsed && Test_Regions[Cases[Index].Regions].NodeCount == Cases[Index].Nodes);
+
+		printf("%-32s %10.1f %12.1f %10.1f\n", Cases[Index].Name, Text.Size / 1024.0, Best * 1e6, Text.Size / Best / 1e6);
+		free(Text.Data);
+	}
+
+	// raw parser speed on 16 MB document, empty callback
+	Test_Text Large = { 0 };
+	Test_Append(&Large, "[");
+	for (uint32_t Copy = 0; Large.Size < 16 << 20; Copy++)
+	{
+		Test_Text Text = Test_MakeDerpMap(30, 3, Copy);
+		Test_Append(&Large, "%s%.*s", Copy ? "," : "", (int)Text.Size, Text.Data);
+		free(Text.Data);
+	}
+	Test_Append(&Large, "]");
+
+	uint64_t Events;
+	double Best;
+	TEST_BENCH(1.0, Best,
+		Events = 0;
+		JsonStream_Parse(Large.Data, Large.Size, &Bench_OnEmpty, &Events));
+	printf("%-32s %10.1f %12.1f %10.1f\n", "16 MB, empty callback", Large.Size / 1024.0, Best * 1e6, Large.Size / Best / 1e6);
+	free(Large.Data);
+}
+
+int main(int ArgCount, char** Args)
+{
+	if (Test_IsBench(ArgCount, Args))
+	{
+		Bench_Run();
+		return Test_Finish("JsonStream bench");
+	}
+
+	uint64_t Iterations = TEST_FUZZ_ITERATIONS;
+	if (ArgCount > 2 && strcmp(Args[1], "fuzz") == 0)
+	{
+		Iterations = strtoull(Args[2], NULL, 10);
+	}
+
+	Test_Events();
+	Test_Invalid();
+	Test_Strings();
+	Test_Integers();
+	Test_DerpMap();
+	Test_Addresses();
+	Test_Fuzz(Iterations);
+
+	return Test_Finish("JsonStream");
+}
@@ -0,0 +1,283 @@
+#define NATSIM_NO_MAIN
+#include "../sim/NatSim.c"
+#include "Test.h"
+
+//
+// NatSim tests
+//
+// two UDP sockets on loopback act as ScreenBuddy instances: each asks NatSim STUN port for its public address, then
+// both send pings to other's public address and to address pings arrive from, answering pings with pongs, same as
+// Buddy_UdpTimer & Buddy_UdpEvent do. Checks that hole punching succeeds or fails for every pair of NAT modes same
+// as it would between real NATs, that STUN response parses like Buddy_UdpOnStun parses it, and that datagrams from
+// unknown addresses are not forwarded.
+//
+// usage: NatSimTest [bench]
+//
+
+enum
+{
+	TEST_PUNCH_ROUNDS	= 20,
+};
+
+typedef struct
+{
+	SOCKET Socket;
+	struct sockaddr_in Public;
+	struct sockaddr_in Reflexive;	// where ping came from, if it is not Public of other peer
+	bool GotPing;
+	bool GotPong;
+}
+Test_Peer;
+
+static void Test_OpenPeer(Test_Peer* Peer)
+{
+	memset(Peer, 0, sizeof(*Peer));
+
+	struct sockaddr_in Address = { .sin_family = AF_INET };
+	Address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	Peer->Socket = Nat_OpenSocket(&Address);
+	TEST_CHECK(Peer->Socket != INVALID_SOCKET);
+}
+
+// same checks as Buddy_UdpOnStun
+static bool Test_ParseStun(const uint8_t* Data, int Size, const uint8_t* Transaction, struct sockaddr_in* Public)
+{
+	if (Size < 20 || Data[0] != 0x01 || Data[1] != 0x01 || memcmp(Data + 4, Nat_StunCookie, 4) != 0 || memcmp(Data + 8, Transaction, 12) != 0)
+	{
+		return false;
+	}
+
+	for (int Offset = 20; Offset + 4 <= Size; )
+	{
+		int Type = (Data[Offset] << 8) | Data[Offset + 1];
+		int Length = (Data[Offset + 2] << 8) | Data[Offset + 3];
+		if (Offset + 4 + Length > Size)
+		{
+			return false;
+		}
+		if (Type == 0x0020 && Length == 8 && Data[Offset + 5] == 0x01)
+		{
+			*Public = (struct sockaddr_in) { .sin_family = AF_INET };
+			uint8_t* Port = (uint8_t*)&Public->sin_port;
+			uint8_t* Address = (uint8_t*)&Public->sin_addr;
+			Port[0] = Data[Offset + 6] ^ Nat_StunCookie[0];
+			Port[1] = Data[Offset + 7] ^ Nat_StunCookie[1];
+			for (int Index = 0; Index < 4; Index++)
+			{
+				Address[Index] = Data[Offset + 8 + Index] ^ Nat_StunCookie[Index];
+			}
+			return true;
+		}
+		Offset += 4 + ((Length + 3) & ~3);
+	}
+	return false;
+}
+
+static int Test_Recv(Test_Peer* Peer, uint8_t* Data, int Capacity, struct sockaddr_in* Source)
+{
+	socklen_t Length = sizeof(*Source);
+	return (int)recvfrom(Peer->Socket, (char*)Data, Capacity, 0, (struct sockaddr*)Source, &Length);
+}
+
+static void Test_Send(Test_Peer* Peer, const char* Text, const struct sockaddr_in* Destination)
+{
+	sendto(Peer->Socket, Text, (int)strlen(Text), 0, (const struct sockaddr*)Destination, sizeof(*Destination));
+}
+
+static bool Test_Stun(Nat_Sim* Nat, Test_Peer* Peer, uint8_t Id)
+{
+	uint8_t Request[20] = { 0x00, 0x01, 0x00, 0x00 };
+	memcpy(Request + 4, Nat_StunCookie, 4);
+	memset(Request + 8, Id, 12);
+
+	struct sockaddr_in Server = { .sin_family = AF_INET, .sin_port = htons(Nat->StunPort) };
+	Server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sendto(Peer->Socket, (const char*)Request, sizeof(Request), 0, (const struct sockaddr*)&Server, sizeof(Server));
+
+	Nat_Poll(Nat, 100);
+
+	uint8_t Data[NAT_MAX_DATAGRAM];
+	struct sockaddr_in Source;
+	for (int Attempt = 0; Attempt < 100; Attempt++)
+	{
+		int Size = Test_Recv(Peer, Data, sizeof(Data), &Source);
+		if (Size >= 0)
+		{
+			return Test_ParseStun(Data, Size, Request + 8, &Peer->Public);
+		}
+		Nat_Poll(Nat, 10);
+	}
+	return false;
+}
+
+static void Test_Receive(Test_Peer* Peer)
+{
+	uint8_t Data[NAT_MAX_DATAGRAM];
+	struct sockaddr_in Source;
+
+	int Size;
+	while ((Size = Test_Recv(Peer, Data, sizeof(Data) - 1, &Source)) >= 0)
+	{
+		Data[Size] = 0;
+		if (strcmp((char*)Data, "ping") == 0)
+		{
+			// answers to address ping came from, which is sender's mapping towards this peer, and starts
+			// pinging it too, same as Buddy_UdpEvent adds it to candidates
+			Peer->GotPing = true;
+			Peer->Reflexive = Source;
+			Test_Send(Peer, "pong", &Source);
+		}
+		else if (strcmp((char*)Data, "pong") == 0)
+		{
+			Peer->GotPong = true;
+		}
+	}
+}
+
+// returns true when both peers got pong
+static bool Test_Punch(const char* Modes, double Drop)
+{
+	static Nat_Sim Nat;
+	memset(&Nat, 0, sizeof(Nat));
+	Nat.Random = 1;
+	Nat.Drop = Drop;
+
+	TEST_CHECK(Nat_ParseModes(&Nat, Modes));
+	if (!Nat_Open(&Nat, 0))
+	{
+		TEST_CHECK(!"cannot open NatSim STUN socket");
+		return false;
+	}
+
+	Test_Peer A, B;
+	Test_OpenPeer(&A);
+	Test_OpenPeer(&B);
+
+	bool Result = false;
+	if (Test_Stun(&Nat, &A, 1) && Test_Stun(&Nat, &B, 2))
+	{
+		// each peer is on its own public address
+		TEST_CHECK(A.Public.sin_addr.s_addr != B.Public.sin_addr.s_addr);
+		TEST_CHECK(ntohl(A.Public.sin_addr.s_addr) >> 8 == 0x7f0001);
+
+		for (int Round = 0; Round < TEST_PUNCH_ROUNDS && !(A.GotPong && B.GotPong); Round++)
+		{
+			if (!A.GotPong)
+			{
+				Test_Send(&A, "ping", &B.Public);
+				if (A.GotPing) Test_Send(&A, "ping", &A.Reflexive);
+			}
+			if (!B.GotPong)
+			{
+				Test_Send(&B, "ping", &A.Public);
+				if (B.GotPing) Test_Send(&B, "ping", &B.Reflexive);
+			}
+
+			for (int Step = 0; Step < 4; Step++)
+			{
+				Nat_Poll(&Nat, 5);
+				Test_Receive(&A);
+				Test_Receive(&B);
+			}
+		}
+		Result = A.GotPong && B.GotPong;
+	}
+	else
+	{
+		TEST_CHECK(!"STUN response missing or malformed");
+	}
+
+	closesocket(A.Socket);
+	closesocket(B.Socket);
+	Nat_Close(&Nat);
+	return Result;
+}
+
+static void Test_Modes(void)
+{
+	static const struct
+	{
+		const char* Modes;
+		bool Expected;
+	}
+	Cases[] =
+	{
+		{ "cone",                  true  },
+		{ "restricted",            true  },
+		{ "port",                  true  },
+		{ "cone,symmetric",        true  },
+		{ "restricted,symmetric",  true  },
+		{ "port,symmetric",        false },
+		{ "symmetric,port",        false },
+		{ "symmetric",             false },
+	};
+
+	for (size_t Index = 0; Index < sizeof(Cases) / sizeof(Cases[0]); Index++)
+	{
+		bool Result = Test_Punch(Cases[Index].Modes, 0);
+		if (Result != Cases[Index].Expected)
+		{
+			fprintf(stderr, "mode %s: hole punching %s\n", Cases[Index].Modes, Result ? "succeeded" : "failed");
+		}
+		TEST_CHECK(Result == Cases[Index].Expected);
+	}
+
+	// occasional loss is recovered by repeated pings
+	TEST_CHECK(Test_Punch("port", 0.2));
+	TEST_CHECK(!Test_Punch("port", 1.0));
+}
+
+static void Test_Unknown(void)
+{
+	static Nat_Sim Nat;
+	memset(&Nat, 0, sizeof(Nat));
+	TEST_CHECK(Nat_ParseModes(&Nat, "cone"));
+	TEST_CHECK(!Nat_ParseModes(&Nat, "cone,full"));
+	TEST_CHECK(!Nat_ParseModes(&Nat, ""));
+	TEST_CHECK(Nat_ParseModes(&Nat, "cone"));
+	TEST_CHECK(Nat_Open(&Nat, 0));
+
+	Test_Peer A, Stranger;
+	Test_OpenPeer(&A);
+	Test_OpenPeer(&Stranger);
+	TEST_CHECK(Test_Stun(&Nat, &A, 1));
+
+	// even cone NAT forwards only between its clients, stranger never asked STUN
+	Test_Send(&Stranger, "ping", &A.Public);
+	for (int Step = 0; Step < 4; Step++)
+	{
+		Nat_Poll(&Nat, 5);
+		Test_Receive(&A);
+	}
+	TEST_CHECK(!A.GotPing);
+	TEST_CHECK(Nat.Unknown == 1);
+
+	// truncated & non-request STUN packets get no response
+	struct sockaddr_in Server = { .sin_family = AF_INET, .sin_port = htons(Nat.StunPort) };
+	Server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	Test_Send(&Stranger, "short", &Server);
+	Nat_Poll(&Nat, 5);
+	TEST_CHECK(Nat.ClientCount == 1);
+
+	closesocket(A.Socket);
+	closesocket(Stranger.Socket);
+	Nat_Close(&Nat);
+}
+
+int main(int ArgCount, char** Args)
+{
+#if defined(_WIN32)
+	WSADATA SocketData;
+	WSAStartup(MAKEWORD(2, 2), &SocketData);
+#endif
+
+	// NatSim is test tool, it has nothing to benchmark
+	if (Test_IsBench(ArgCount, Args))
+	{
+		return 0;
+	}
+
+	Test_Modes();
+	Test_Unknown();
+	return Test_Finish("NatSimTest");
+}
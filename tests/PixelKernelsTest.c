@@ -0,0 +1,714 @@
+#include "Test.h"
+#include "../external/PixelKernels.h"
+
+//
+// PixelKernelsTest - software pixel kernels from external/PixelKernels.h
+//
+// BGRA -> NV12: C kernel is compared with double precision BT.601 & BT.709 formulas, and SIMD kernels that this
+// CPU supports must give exactly same bytes as C kernel, for every width up to two SIMD blocks & full frames
+//
+// NV12 -> BGRA & scaling: SSE4.1 YuvToBgra, ScaleRow & ScaleColumns kernels must give same bytes as C kernels for
+// many widths & filter sizes. Quality is PSNR against smooth test image defined by formula - after BGRA -> NV12 ->
+// BGRA round trip, and after downscaling with both filters same way as viewer's software presentation does it
+//
+// benchmark converts 1080p & 4K frames with every kernel and reports msec per megapixel, and runs presentation
+// path - NV12 -> BGRA conversion with Lanczos-3 downscale - from 4K to common window sizes with C & SSE4.1 kernels
+//
+
+static const bool Bt709s[] = { false, true, false, true };
+static const bool FullRanges[] = { false, false, true, true };
+
+typedef struct
+{
+	const char* Name;
+	Pixel_ConvertRowsProc* Proc;
+}
+ConvertKernel;
+
+static ConvertKernel ConvertKernels[3];
+static size_t ConvertKernelCount;
+
+typedef struct
+{
+	const char* Name;
+	Pixel_YuvToBgraProc* YuvToBgra;
+	Pixel_ScaleRowProc* ScaleRow;
+	Pixel_ScaleColumnsProc* ScaleColumns;
+}
+PresentKernel;
+
+static PresentKernel PresentKernels[2];
+static size_t PresentKernelCount;
+
+static void Kernels_Init(void)
+{
+	bool HasSse41, HasAvx2;
+	Pixel_GetCpuFeatures(&HasSse41, &HasAvx2);
+
+	ConvertKernels[ConvertKernelCount++] = (ConvertKernel){ "C", &Pixel_ConvertRowsC };
+	PresentKernels[PresentKernelCount++] = (PresentKernel){ "C", &Pixel_YuvToBgraC, &Pixel_ScaleRowC, &Pixel_ScaleColumnsC };
+#if PIXEL_SIMD
+	if (HasSse41)
+	{
+		ConvertKernels[ConvertKernelCount++] = (ConvertKernel){ "SSE4.1", &Pixel_ConvertRowsSSE4 };
+		PresentKernels[PresentKernelCount++] = (PresentKernel){ "SSE4.1", &Pixel_YuvToBgraSSE4, &Pixel_ScaleRowSSE4, &Pixel_ScaleColumnsSSE4 };
+	}
+	if (HasAvx2)
+	{
+		ConvertKernels[ConvertKernelCount++] = (ConvertKernel){ "AVX2", &Pixel_ConvertRowsAVX2 };
+	}
+#endif
+}
+
+// random BGRA, with runs of black & white so clamping is exercised
+static void Fill_Bgra(uint8_t* Bgra, size_t Pixels, uint64_t* Random)
+{
+	for (size_t Index = 0; Index < Pixels; Index++)
+	{
+		uint32_t Kind = Test_RandomRange(Random, 8);
+		uint32_t Value = Kind == 0 ? 0 : Kind == 1 ? 0xffffffff : (uint32_t)Test_Random(Random);
+		memcpy(Bgra + Index * 4, &Value, 4);
+	}
+}
+
+//
+// BGRA -> NV12
+
+static double Reference_Clamp(double Value)
+{
+	return Value < 0 ? 0 : Value > 255 ? 255 : Value;
+}
+
+// luma of one pixel and chroma of [1 2 1] x [1 1] filtered block, same siting as kernels
+static void Reference_Convert(const uint8_t* Row0, const uint8_t* Row1, uint32_t X, uint32_t Width, bool Bt709, bool FullRange, double* Y0, double* Y1, double* U, double* V)
+{
+	double Kr = Bt709 ? 0.2126 : 0.299;
+	double Kb = Bt709 ? 0.0722 : 0.114;
+	double Kg = 1.0 - Kr - Kb;
+
+	double YScale = FullRange ? 1.0 : 219.0 / 255.0;
+	double CScale = FullRange ? 1.0 : 224.0 / 255.0;
+	double YOffset = FullRange ? 0 : 16;
+
+	const uint8_t* P0 = Row0 + X * 4;
+	const uint8_t* P1 = Row1 + X * 4;
+	*Y0 = Reference_Clamp(YOffset + YScale * (Kr * P0[2] + Kg * P0[1] + Kb * P0[0]));
+	*Y1 = Reference_Clamp(YOffset + YScale * (Kr * P1[2] + Kg * P1[1] + Kb * P1[0]));
+
+	if (X & 1)
+	{
+		return;
+	}
+
+	uint32_t Left = (X == 0 ? 0 : X - 1) * 4;
+	uint32_t Center = X * 4;
+	uint32_t Right = (X + 1 < Width ? X + 1 : Width - 1) * 4;
+
+	double Rgb[3];
+	for (uint32_t Channel = 0; Channel < 3; Channel++)
+	{
+		Rgb[2 - Channel] = (Row0[Left + Channel] + Row1[Left + Channel] + 2.0 * (Row0[Center + Channel] + Row1[Center + Channel])
+			+ Row0[Right + Channel] + Row1[Right + Channel]) / 8.0;
+	}
+
+	double Luma = Kr * Rgb[0] + Kg * Rgb[1] + Kb * Rgb[2];
+	*U = Reference_Clamp(128 + CScale * (Rgb[2] - Luma) / (2.0 * (1.0 - Kb)));
+	*V = Reference_Clamp(128 + CScale * (Rgb[0] - Luma) / (2.0 * (1.0 - Kr)));
+}
+
+static void Test_ConvertAccuracy(void)
+{
+	enum { WIDTH = 258 };
+	uint64_t Random = 43;
+
+	uint8_t* Row0 = Test_Alloc(WIDTH * 4);
+	uint8_t* Row1 = Test_Alloc(WIDTH * 4);
+	uint8_t Y0[WIDTH], Y1[WIDTH], UV[WIDTH];
+
+	for (size_t Combo = 0; Combo < 4; Combo++)
+	{
+		PixelColorMatrix Matrix;
+		Pixel_GetColorMatrix(&Matrix, Bt709s[Combo], FullRanges[Combo]);
+
+		double MaxError = 0;
+		for (uint32_t Round = 0; Round < 200; Round++)
+		{
+			Fill_Bgra(Row0, WIDTH, &Random);
+			Fill_Bgra(Row1, WIDTH, &Random);
+			Pixel_ConvertRowsC(&Matrix, Row0, Row1, Y0, Y1, UV, WIDTH);
+
+			for (uint32_t X = 0; X < WIDTH; X++)
+			{
+				double RY0, RY1, RU = 0, RV = 0;
+				Reference_Convert(Row0, Row1, X, WIDTH, Bt709s[Combo], FullRanges[Combo], &RY0, &RY1, &RU, &RV);
+
+				MaxError = fmax(MaxError, fabs(Y0[X] - RY0));
+				MaxError = fmax(MaxError, fabs(Y1[X] - RY1));
+				if ((X & 1) == 0)
+				{
+					MaxError = fmax(MaxError, fabs(UV[X + 0] - RU));
+					MaxError = fmax(MaxError, fabs(UV[X + 1] - RV));
+				}
+			}
+		}
+
+		// fixed point result is rounded, so it is within one step of exact value
+		if (MaxError > 1.0)
+		{
+			fprintf(stderr, "BGRA -> NV12 %s %s range: max error %.3f\n", Bt709s[Combo] ? "BT.709" : "BT.601", FullRanges[Combo] ? "full" : "limited", MaxError);
+		}
+		TEST_CHECK(MaxError <= 1.0);
+
+		// black, white & gray land exactly on range ends and have no chroma
+		static const uint8_t Grays[] = { 0, 128, 255 };
+		for (size_t Index = 0; Index < sizeof(Grays); Index++)
+		{
+			memset(Row0, Grays[Index], WIDTH * 4);
+			memset(Row1, Grays[Index], WIDTH * 4);
+			Pixel_ConvertRowsC(&Matrix, Row0, Row1, Y0, Y1, UV, WIDTH);
+
+			int Expected = FullRanges[Combo] ? Grays[Index] : 16 + (Grays[Index] * 219 + 127) / 255;
+			TEST_CHECK(Y0[0] == Expected && Y1[WIDTH - 1] == Expected);
+			TEST_CHECK(UV[0] == 128 && UV[1] == 128 && UV[WIDTH - 2] == 128 && UV[WIDTH - 1] == 128);
+		}
+	}
+
+	free(Row0);
+	free(Row1);
+}
+
+static void Test_ConvertExact(void)
+{
+	enum { MAX_WIDTH = 2 * 32 + 2 };
+	uint64_t Random = 44;
+
+	uint8_t Row0[MAX_WIDTH * 4];
+	uint8_t Row1[MAX_WIDTH * 4];
+
+	for (size_t Combo = 0; Combo < 4; Combo++)
+	{
+		PixelColorMatrix Matrix;
+		Pixel_GetColorMatrix(&Matrix, Bt709s[Combo], FullRanges[Combo]);
+
+		// NV12 has even width, every width up to two AVX2 blocks & tail
+		for (uint32_t Width = 2; Width <= MAX_WIDTH; Width += 2)
+		{
+			for (uint32_t Round = 0; Round < 20; Round++)
+			{
+				Fill_Bgra(Row0, Width, &Random);
+				Fill_Bgra(Row1, Width, &Random);
+
+				uint8_t Expected[3][MAX_WIDTH];
+				Pixel_ConvertRowsC(&Matrix, Row0, Row1, Expected[0], Expected[1], Expected[2], Width);
+
+				for (size_t Kernel = 1; Kernel < ConvertKernelCount; Kernel++)
+				{
+					// output one byte past width must stay untouched
+					uint8_t Output[3][MAX_WIDTH + 1];
+					memset(Output, 0xcd, sizeof(Output));
+					ConvertKernels[Kernel].Proc(&Matrix, Row0, Row1, Output[0], Output[1], Output[2], Width);
+
+					bool Same = true;
+					for (int Plane = 0; Plane < 3; Plane++)
+					{
+						Same = Same && memcmp(Output[Plane], Expected[Plane], Width) == 0 && Output[Plane][Width] == 0xcd;
+					}
+					if (!Same)
+					{
+						fprintf(stderr, "BGRA -> NV12 %s differs from C, width %u, matrix %zu\n", ConvertKernels[Kernel].Name, Width, Combo);
+					}
+					TEST_CHECK(Same);
+				}
+			}
+		}
+	}
+}
+
+// whole frame, like Buddy_ConvertFrame does it with last row repeated for odd height
+static void Convert_Frame(Pixel_ConvertRowsProc* Proc, const PixelColorMatrix* Matrix, const uint8_t* Bgra, uint8_t* Nv12, uint32_t Width, uint32_t Height)
+{
+	uint8_t* Luma = Nv12;
+	uint8_t* Chroma = Nv12 + (size_t)Width * Height;
+	for (uint32_t Y = 0; Y < Height; Y += 2)
+	{
+		uint32_t Next = Y + 1 < Height ? Y + 1 : Height - 1;
+		Proc(Matrix, Bgra + (size_t)Y * Width * 4, Bgra + (size_t)Next * Width * 4, Luma + (size_t)Y * Width, Luma + (size_t)Next * Width, Chroma + (size_t)Y / 2 * Width, Width);
+	}
+}
+
+static void Test_ConvertFrames(void)
+{
+	static const uint32_t Sizes[][2] = { { 1920, 1080 }, { 1366, 767 }, { 642, 2 } };
+	uint64_t Random = 45;
+
+	PixelColorMatrix Matrix;
+	Pixel_GetColorMatrix(&Matrix, true, false);
+
+	for (size_t Size = 0; Size < sizeof(Sizes) / sizeof(*Sizes); Size++)
+	{
+		uint32_t Width = Sizes[Size][0];
+		uint32_t Height = Sizes[Size][1];
+		size_t Nv12Size = (size_t)Width * Height + (size_t)Width * ((Height + 1) / 2);
+
+		uint8_t* Bgra = Test_Alloc((size_t)Width * Height * 4);
+		uint8_t* Expected = Test_Alloc(Nv12Size);
+		uint8_t* Output = Test_Alloc(Nv12Size);
+		Fill_Bgra(Bgra, (size_t)Width * Height, &Random);
+
+		Convert_Frame(&Pixel_ConvertRowsC, &Matrix, Bgra, Expected, Width, Height);
+		for (size_t Kernel = 1; Kernel < ConvertKernelCount; Kernel++)
+		{
+			Convert_Frame(ConvertKernels[Kernel].Proc, &Matrix, Bgra, Output, Width, Height);
+			TEST_CHECK(memcmp(Output, Expected, Nv12Size) == 0);
+		}
+
+		free(Bgra);
+		free(Expected);
+		free(Output);
+	}
+}
+
+// NV12 -> BGRA & scaling
+
+// smooth test image, lowest period is many times larger than 4K -> 1080p downscale factor
+static void Image_Rgb(double X, double Y, double Rgb[3])
+{
+	double Pi2 = 2.0 * 3.14159265358979323846;
+	Rgb[0] = 128 + 50 * sin(Pi2 * (X / 200.0 + Y / 310.0)) + 40 * cos(Pi2 * X / 133.0);
+	Rgb[1] = 128 + 60 * sin(Pi2 * Y / 170.0) + 30 * sin(Pi2 * (X + Y) / 251.0);
+	Rgb[2] = 128 + 70 * cos(Pi2 * (X - Y) / 190.0);
+}
+
+static void Image_Bgra(uint8_t* Bgra, uint32_t Width, uint32_t Height)
+{
+	for (uint32_t Y = 0; Y < Height; Y++)
+	{
+		for (uint32_t X = 0; X < Width; X++)
+		{
+			double Rgb[3];
+			Image_Rgb(X, Y, Rgb);
+
+			uint8_t* Pixel = Bgra + ((size_t)Y * Width + X) * 4;
+			Pixel[0] = (uint8_t)(Rgb[2] + 0.5);
+			Pixel[1] = (uint8_t)(Rgb[1] + 0.5);
+			Pixel[2] = (uint8_t)(Rgb[0] + 0.5);
+			Pixel[3] = 255;
+		}
+	}
+}
+
+// PSNR of BGR channels against test image sampled at centers of output pixels, Scale is input pixels per output pixel
+static double Image_Psnr(const uint8_t* Bgra, uint32_t Width, uint32_t Height, double ScaleX, double ScaleY, bool* Opaque)
+{
+	double Error = 0;
+	*Opaque = true;
+	for (uint32_t Y = 0; Y < Height; Y++)
+	{
+		for (uint32_t X = 0; X < Width; X++)
+		{
+			double Rgb[3];
+			Image_Rgb((X + 0.5) * ScaleX - 0.5, (Y + 0.5) * ScaleY - 0.5, Rgb);
+
+			const uint8_t* Pixel = Bgra + ((size_t)Y * Width + X) * 4;
+			for (int Channel = 0; Channel < 3; Channel++)
+			{
+				double Delta = Pixel[2 - Channel] - Rgb[Channel];
+				Error += Delta * Delta;
+			}
+			*Opaque = *Opaque && Pixel[3] == 255;
+		}
+	}
+	double Mse = Error / (3.0 * Width * Height);
+	return Mse == 0 ? 99.0 : 10.0 * log10(255.0 * 255.0 / Mse);
+}
+
+typedef struct
+{
+	uint32_t InputWidth;
+	uint32_t InputHeight;
+	uint32_t Pitch;			// of NV12 luma & chroma rows, padded for SIMD kernels
+	uint8_t* Nv12;
+
+	uint32_t Width;
+	uint32_t Height;
+	PixelYuvMatrix Matrix;
+	PixelScaleFilter FilterX;
+	PixelScaleFilter FilterY;
+	uint8_t* Row;
+	int16_t* Ring;
+	const int16_t** Rows;
+	uint8_t* Output;		// Width * Height BGRA
+}
+Present;
+
+static void Present_Create(Present* P, const uint8_t* Bgra, uint32_t InputWidth, uint32_t InputHeight, uint32_t Width, uint32_t Height, int Filter)
+{
+	memset(P, 0, sizeof(*P));
+	P->InputWidth = InputWidth;
+	P->InputHeight = InputHeight;
+	P->Width = Width;
+	P->Height = Height;
+
+	uint32_t PaddedInput = (InputWidth + 7) & ~7;
+	uint32_t PaddedWidth = (Width + 3) & ~3;
+	uint32_t ChromaHeight = (InputHeight + 1) / 2;
+
+	// decoded frame, converted with same matrix
+	PixelColorMatrix ColorMatrix;
+	Pixel_GetColorMatrix(&ColorMatrix, true, false);
+	P->Pitch = PaddedInput + 16;
+	P->Nv12 = Test_Alloc((size_t)P->Pitch * (InputHeight + ChromaHeight));
+	memset(P->Nv12, 0, (size_t)P->Pitch * (InputHeight + ChromaHeight));
+
+	uint8_t* Luma = P->Nv12;
+	uint8_t* Chroma = P->Nv12 + (size_t)P->Pitch * InputHeight;
+	for (uint32_t Y = 0; Y < InputHeight; Y += 2)
+	{
+		uint32_t Next = Y + 1 < InputHeight ? Y + 1 : InputHeight - 1;
+		Pixel_ConvertRowsC(&ColorMatrix, Bgra + (size_t)Y * InputWidth * 4, Bgra + (size_t)Next * InputWidth * 4,
+			Luma + (size_t)Y * P->Pitch, Luma + (size_t)Next * P->Pitch, Chroma + (size_t)Y / 2 * P->Pitch, InputWidth);
+	}
+
+	Pixel_GetYuvMatrix(&P->Matrix, true, false);
+	bool Created = Pixel_CreateScaleFilter(&P->FilterX, Filter, InputWidth, Width, PaddedWidth)
+		&& Pixel_CreateScaleFilter(&P->FilterY, Filter, InputHeight, Height, Height);
+	TEST_CHECK(Created);
+
+	uint32_t RowSize = (PaddedInput > P->FilterX.Taps ? PaddedInput : P->FilterX.Taps) * 4;
+	P->Row = Test_Alloc(RowSize);
+	memset(P->Row, 0, RowSize);
+	P->Ring = Test_Alloc((size_t)P->FilterY.Taps * PaddedWidth * 4 * sizeof(int16_t));
+	P->Rows = Test_Alloc(P->FilterY.Taps * sizeof(*P->Rows));
+	P->Output = Test_Alloc(((size_t)(Height - 1) * Width + (PaddedInput > PaddedWidth ? PaddedInput : PaddedWidth)) * 4);
+}
+
+static void Present_Release(Present* P)
+{
+	Pixel_ReleaseScaleFilter(&P->FilterX);
+	Pixel_ReleaseScaleFilter(&P->FilterY);
+	free(P->Nv12);
+	free(P->Row);
+	free(P->Ring);
+	free((void*)P->Rows);
+	free(P->Output);
+}
+
+// same steps as Buddy_PresentScale, output rows are written packed
+static void Present_Frame(Present* P, const PresentKernel* Kernel)
+{
+	uint32_t PaddedInput = (P->InputWidth + 7) & ~7;
+	uint32_t PaddedWidth = (P->Width + 3) & ~3;
+	uint32_t ChromaHeight = (P->InputHeight + 1) / 2;
+	const uint8_t* Luma = P->Nv12;
+	const uint8_t* Chroma = P->Nv12 + (size_t)P->Pitch * P->InputHeight;
+
+	if (P->Width == P->InputWidth && P->Height == P->InputHeight)
+	{
+		for (uint32_t Y = 0; Y < P->Height; Y++)
+		{
+			uint32_t Near = Y / 2;
+			uint32_t Far = Y & 1 ? (Near + 1 < ChromaHeight ? Near + 1 : ChromaHeight - 1) : Near == 0 ? 0 : Near - 1;
+			Kernel->YuvToBgra(&P->Matrix, Luma + (size_t)Y * P->Pitch, Chroma + (size_t)Near * P->Pitch, Chroma + (size_t)Far * P->Pitch, P->Output + (size_t)Y * P->Width * 4, PaddedInput);
+		}
+		return;
+	}
+
+	uint32_t Taps = P->FilterY.Taps;
+	uint32_t RingPitch = PaddedWidth * 4;
+
+	uint32_t NextRow = 0;
+	for (uint32_t Y = 0; Y < P->Height; Y++)
+	{
+		uint32_t Start = P->FilterY.Start[Y];
+		for (uint32_t End = Start + Taps < P->InputHeight ? Start + Taps : P->InputHeight; NextRow < End; NextRow++)
+		{
+			uint32_t Near = NextRow / 2;
+			uint32_t Far = NextRow & 1 ? (Near + 1 < ChromaHeight ? Near + 1 : ChromaHeight - 1) : Near == 0 ? 0 : Near - 1;
+			Kernel->YuvToBgra(&P->Matrix, Luma + (size_t)NextRow * P->Pitch, Chroma + (size_t)Near * P->Pitch, Chroma + (size_t)Far * P->Pitch, P->Row, PaddedInput);
+			Kernel->ScaleRow(&P->FilterX, P->Row, P->Ring + NextRow % Taps * RingPitch, PaddedWidth);
+		}
+
+		for (uint32_t Tap = 0; Tap < Taps; Tap++)
+		{
+			uint32_t Row = Start + Tap < P->InputHeight ? Start + Tap : P->InputHeight - 1;
+			P->Rows[Tap] = P->Ring + Row % Taps * RingPitch;
+		}
+		Kernel->ScaleColumns(P->Rows, P->FilterY.Weights + Y * Taps, Taps, P->Output + (size_t)Y * P->Width * 4, PaddedWidth);
+	}
+}
+
+static void Test_YuvToBgraExact(void)
+{
+	enum { MAX_WIDTH = 8 * 24 };
+	uint64_t Random = 47;
+
+	uint8_t Y[MAX_WIDTH];
+	uint8_t Near[MAX_WIDTH + 16];
+	uint8_t Far[MAX_WIDTH + 16];
+
+	for (size_t Combo = 0; Combo < 4; Combo++)
+	{
+		PixelYuvMatrix Matrix;
+		Pixel_GetYuvMatrix(&Matrix, Bt709s[Combo], FullRanges[Combo]);
+
+		for (uint32_t Width = 8; Width <= MAX_WIDTH; Width += 8)
+		{
+			for (uint32_t Round = 0; Round < 20; Round++)
+			{
+				// full byte range, so out of range YUV is clamped
+				for (uint32_t Index = 0; Index < sizeof(Near); Index++)
+				{
+					Near[Index] = (uint8_t)Test_Random(&Random);
+					Far[Index] = (uint8_t)Test_Random(&Random);
+					Y[Index % MAX_WIDTH] = (uint8_t)Test_Random(&Random);
+				}
+
+				uint8_t Expected[MAX_WIDTH * 4];
+				Pixel_YuvToBgraC(&Matrix, Y, Near, Far, Expected, Width);
+
+				for (size_t Kernel = 1; Kernel < PresentKernelCount; Kernel++)
+				{
+					uint8_t Output[MAX_WIDTH * 4];
+					PresentKernels[Kernel].YuvToBgra(&Matrix, Y, Near, Far, Output, Width);
+
+					bool Same = memcmp(Output, Expected, Width * 4) == 0;
+					if (!Same)
+					{
+						fprintf(stderr, "NV12 -> BGRA %s differs from C, width %u, matrix %zu\n", PresentKernels[Kernel].Name, Width, Combo);
+					}
+					TEST_CHECK(Same);
+				}
+			}
+		}
+	}
+}
+
+static void Test_ScaleExact(void)
+{
+	uint64_t Random = 48;
+
+	for (uint32_t Round = 0; Round < 400; Round++)
+	{
+		// downscale factors from copy to 8x, with sizes smaller than filter taps too
+		uint32_t InputSize = 1 + Test_RandomRange(&Random, 300);
+		uint32_t OutputSize = InputSize - Test_RandomRange(&Random, InputSize);
+		OutputSize = Round % 4 == 0 ? InputSize : OutputSize < InputSize / 8 + 1 ? InputSize / 8 + 1 : OutputSize;
+		int Filter = Round & 1 ? PIXEL_FILTER_LANCZOS : PIXEL_FILTER_BICUBIC;
+
+		uint32_t PaddedOutput = (OutputSize + 3) & ~3;
+		PixelScaleFilter FilterX;
+		TEST_CHECK(Pixel_CreateScaleFilter(&FilterX, Filter, InputSize, OutputSize, PaddedOutput));
+
+		// weights of every output sum to one
+		for (uint32_t Index = 0; Index < OutputSize; Index++)
+		{
+			int32_t Sum = 0;
+			for (uint32_t Tap = 0; Tap < FilterX.Taps; Tap++)
+			{
+				Sum += FilterX.Weights[Index * FilterX.Taps + Tap];
+			}
+			TEST_CHECK(Sum == 1 << PIXEL_SCALE_BITS);
+			TEST_CHECK(FilterX.Start[Index] >= 0 && (FilterX.Start[Index] + FilterX.Taps <= InputSize || FilterX.Start[Index] == 0));
+		}
+
+		uint32_t InputPixels = InputSize > FilterX.Taps ? InputSize : FilterX.Taps;
+		uint8_t* Bgra = Test_Alloc(InputPixels * 4);
+		Fill_Bgra(Bgra, InputPixels, &Random);
+
+		int16_t* Expected = Test_Alloc(PaddedOutput * 4 * sizeof(int16_t));
+		int16_t* Output = Test_Alloc(PaddedOutput * 4 * sizeof(int16_t));
+		Pixel_ScaleRowC(&FilterX, Bgra, Expected, PaddedOutput);
+
+		// rows of vertical filter are horizontally filtered rows with random weights of some real filter
+		uint32_t Taps = FilterX.Taps;
+		const int16_t** Rows = Test_Alloc(Taps * sizeof(*Rows));
+		int16_t* RowData = Test_Alloc((size_t)Taps * PaddedOutput * 4 * sizeof(int16_t));
+		for (uint32_t Tap = 0; Tap < Taps; Tap++)
+		{
+			Fill_Bgra(Bgra, InputPixels, &Random);
+			Pixel_ScaleRowC(&FilterX, Bgra, RowData + Tap * PaddedOutput * 4, PaddedOutput);
+			Rows[Tap] = RowData + Tap * PaddedOutput * 4;
+		}
+		const int16_t* Weights = FilterX.Weights + Test_RandomRange(&Random, OutputSize) * Taps;
+
+		uint8_t* ExpectedBgra = Test_Alloc(PaddedOutput * 4);
+		uint8_t* OutputBgra = Test_Alloc(PaddedOutput * 4);
+		Pixel_ScaleColumnsC(Rows, Weights, Taps, ExpectedBgra, PaddedOutput);
+
+		for (size_t Kernel = 1; Kernel < PresentKernelCount; Kernel++)
+		{
+			Fill_Bgra(Bgra, InputPixels, &Random);
+			Pixel_ScaleRowC(&FilterX, Bgra, Expected, PaddedOutput);
+			PresentKernels[Kernel].ScaleRow(&FilterX, Bgra, Output, PaddedOutput);
+			bool SameRow = memcmp(Output, Expected, PaddedOutput * 4 * sizeof(int16_t)) == 0;
+
+			PresentKernels[Kernel].ScaleColumns(Rows, Weights, Taps, OutputBgra, PaddedOutput);
+			bool SameColumns = memcmp(OutputBgra, ExpectedBgra, PaddedOutput * 4) == 0;
+
+			if (!SameRow || !SameColumns)
+			{
+				fprintf(stderr, "scale %s differs from C, %u -> %u, %u taps, row %d, columns %d\n", PresentKernels[Kernel].Name, InputSize, OutputSize, Taps, SameRow, SameColumns);
+			}
+			TEST_CHECK(SameRow && SameColumns);
+		}
+
+		Pixel_ReleaseScaleFilter(&FilterX);
+		free(Bgra);
+		free(Expected);
+		free(Output);
+		free((void*)Rows);
+		free(RowData);
+		free(ExpectedBgra);
+		free(OutputBgra);
+	}
+}
+
+static void Test_PresentQuality(void)
+{
+	static const struct
+	{
+		uint32_t InputWidth, InputHeight, Width, Height;
+		int Filter;
+		double MinPsnr;
+	}
+	Cases[] =
+	{
+		// no scaling, only YUV round trip where 4:2:0 chroma limits quality
+		{ 1280, 720, 1280, 720, PIXEL_FILTER_LANCZOS, 38.0 },
+		{ 1920, 1080, 1280, 720, PIXEL_FILTER_LANCZOS, 40.0 },
+		{ 1920, 1080, 1280, 720, PIXEL_FILTER_BICUBIC, 40.0 },
+		{ 2560, 1440, 1001, 563, PIXEL_FILTER_LANCZOS, 40.0 },
+		{ 1366, 768, 1365, 767, PIXEL_FILTER_LANCZOS, 38.0 },
+	};
+
+	for (size_t Index = 0; Index < sizeof(Cases) / sizeof(*Cases); Index++)
+	{
+		uint32_t InputWidth = Cases[Index].InputWidth;
+		uint32_t InputHeight = Cases[Index].InputHeight;
+
+		uint8_t* Bgra = Test_Alloc((size_t)InputWidth * InputHeight * 4);
+		Image_Bgra(Bgra, InputWidth, InputHeight);
+
+		Present P;
+		Present_Create(&P, Bgra, InputWidth, InputHeight, Cases[Index].Width, Cases[Index].Height, Cases[Index].Filter);
+
+		uint8_t* Expected = NULL;
+		size_t OutputSize = (size_t)P.Width * P.Height * 4;
+		for (size_t Kernel = 0; Kernel < PresentKernelCount; Kernel++)
+		{
+			Present_Frame(&P, &PresentKernels[Kernel]);
+
+			bool Opaque;
+			double Psnr = Image_Psnr(P.Output, P.Width, P.Height, (double)InputWidth / P.Width, (double)InputHeight / P.Height, &Opaque);
+			if (Psnr < Cases[Index].MinPsnr || !Opaque)
+			{
+				fprintf(stderr, "present %s %ux%u -> %ux%u %s: PSNR %.2f dB, opaque %d\n", PresentKernels[Kernel].Name, InputWidth, InputHeight,
+					P.Width, P.Height, Cases[Index].Filter == PIXEL_FILTER_LANCZOS ? "lanczos" : "bicubic", Psnr, Opaque);
+			}
+			TEST_CHECK(Psnr >= Cases[Index].MinPsnr && Opaque);
+
+			// whole frame of SIMD kernels is same as C
+			if (Kernel == 0)
+			{
+				Expected = Test_Alloc(OutputSize);
+				memcpy(Expected, P.Output, OutputSize);
+			}
+			else
+			{
+				TEST_CHECK(memcmp(P.Output, Expected, OutputSize) == 0);
+			}
+		}
+
+		free(Expected);
+		free(Bgra);
+		Present_Release(&P);
+	}
+}
+
+//
+// benchmark
+
+static void Bench_Convert(uint32_t Width, uint32_t Height)
+{
+	uint64_t Random = 46;
+	uint8_t* Bgra = Test_Alloc((size_t)Width * Height * 4);
+	uint8_t* Nv12 = Test_Alloc((size_t)Width * Height * 3 / 2);
+	Fill_Bgra(Bgra, (size_t)Width * Height, &Random);
+
+	PixelColorMatrix Matrix;
+	Pixel_GetColorMatrix(&Matrix, true, false);
+
+	double Megapixels = (double)Width * Height / 1e6;
+	double Baseline = 0;
+	for (size_t Kernel = 0; Kernel < ConvertKernelCount; Kernel++)
+	{
+		double Best;
+		TEST_BENCH(0.5, Best, Convert_Frame(ConvertKernels[Kernel].Proc, &Matrix, Bgra, Nv12, Width, Height));
+		Baseline = Kernel == 0 ? Best : Baseline;
+
+		printf("BGRA -> NV12 %4ux%-4u %-7s %7.3f ms/frame %7.3f ms/MP %5.2fx\n", Width, Height, ConvertKernels[Kernel].Name,
+			Best * 1e3, Best * 1e3 / Megapixels, Baseline / Best);
+	}
+
+	free(Bgra);
+	free(Nv12);
+}
+
+static void Bench_Present(uint32_t InputWidth, uint32_t InputHeight, uint32_t Width, uint32_t Height, int Filter)
+{
+	uint8_t* Bgra = Test_Alloc((size_t)InputWidth * InputHeight * 4);
+	Image_Bgra(Bgra, InputWidth, InputHeight);
+
+	Present P;
+	Present_Create(&P, Bgra, InputWidth, InputHeight, Width, Height, Filter);
+
+	double Megapixels = (double)InputWidth * InputHeight / 1e6;
+	double Baseline = 0;
+	for (size_t Kernel = 0; Kernel < PresentKernelCount; Kernel++)
+	{
+		double Best;
+		TEST_BENCH(0.5, Best, Present_Frame(&P, &PresentKernels[Kernel]));
+		Baseline = Kernel == 0 ? Best : Baseline;
+
+		bool Opaque;
+		double Psnr = Image_Psnr(P.Output, P.Width, P.Height, (double)InputWidth / Width, (double)InputHeight / Height, &Opaque);
+
+		printf("NV12 -> BGRA %4ux%-4u -> %4ux%-4u %-7s %-6s %7.3f ms/frame %7.3f ms/MP %5.2fx  PSNR %.2f dB\n", InputWidth, InputHeight, Width, Height,
+			Filter == PIXEL_FILTER_LANCZOS ? "lanczos" : "bicubic", PresentKernels[Kernel].Name, Best * 1e3, Best * 1e3 / Megapixels, Baseline / Best, Psnr);
+	}
+
+	Present_Release(&P);
+	free(Bgra);
+}
+
+int main(int ArgCount, char** Args)
+{
+	Kernels_Init();
+
+	if (Test_IsBench(ArgCount, Args))
+	{
+		Bench_Convert(1920, 1080);
+		Bench_Convert(3840, 2160);
+
+		// ms/MP is per input megapixel, first row is YUV conversion alone
+		Bench_Present(3840, 2160, 3840, 2160, PIXEL_FILTER_LANCZOS);
+		Bench_Present(3840, 2160, 2560, 1440, PIXEL_FILTER_LANCZOS);
+		Bench_Present(3840, 2160, 1920, 1080, PIXEL_FILTER_LANCZOS);
+		Bench_Present(3840, 2160, 1920, 1080, PIXEL_FILTER_BICUBIC);
+		Bench_Present(3840, 2160, 1280, 720, PIXEL_FILTER_LANCZOS);
+		return Test_Finish("PixelKernels bench");
+	}
+
+	if (ConvertKernelCount == 1)
+	{
+		printf("PixelKernels: no SIMD kernels on this CPU, only C kernel is tested\n");
+	}
+
+	Test_ConvertAccuracy();
+	Test_ConvertExact();
+	Test_ConvertFrames();
+	Test_YuvToBgraExact();
+	Test_ScaleExact();
+	Test_PresentQuality();
+	return Test_Finish("PixelKernels");
+}
@@ -0,0 +1,847 @@
+#include "Test.h"
+#include "../external/ScrollDetect.h"
+#include "../external/TileOverlay.h"
+#include "../external/H264Parse.h"
+
+//
+// ScrollDetectTest - scroll detection from external/ScrollDetect.h
+//
+// SSE2 & C column hashes must be same for every column count & height, and must never read past last column (checked
+// by address sanitizer). Frame of text scrolled by known offsets, up, down, left & right, must give back exactly that
+// offset and whole moved region.
+//
+// replay runs 1280x720 document window through scroll traces - mouse wheel, smooth touchpad scroll, horizontal pan,
+// page jumps with half & full page - and video playing in same window. Each frame goes through change detection,
+// scroll detection & lossless overlay sharer, then through encoder that delays outputs, drops some of them & makes
+// keyframes, and overlay viewer. Every found region must have all pixels moved by found offset, every scroll that
+// leaves at least SCROLL_MIN_SIZE moved rows or columns must be found, video must never be found as scroll, and each
+// tile viewer draws must be exactly same as that tile of captured frame that was encoded.
+//
+// benchmark replays each trace with & without moving overlay tiles by found scroll, and reports overlay bytes per
+// scroll, encoder better quality region per scroll (exposed part vs all changed tiles) & detection cost on frames that
+// scroll and on fully changed frames. There is no H.264 encoder here, so overlay without scroll copy - every tile of
+// window sent again - stands in for plain video that has to encode scrolled content again.
+//
+
+static uint16_t Font[64][14];
+
+static void Font_Init(void)
+{
+	uint64_t Random = 50;
+	for (uint32_t Glyph = 0; Glyph < 64; Glyph++)
+	{
+		for (uint32_t Row = 3; Row < 12; Row++)
+		{
+			Font[Glyph][Row] = (uint16_t)(Test_Random(&Random) & 0x3e);
+		}
+	}
+}
+
+static void Pixel_Set(uint8_t* Pixel, uint32_t Color)
+{
+	Pixel[0] = (uint8_t)Color;
+	Pixel[1] = (uint8_t)(Color >> 8);
+	Pixel[2] = (uint8_t)(Color >> 16);
+	Pixel[3] = 0xff;
+}
+
+// lines of 7x14 glyphs, up to Columns long, with lighter right edge like antialiasing
+static uint32_t Text_Pixel(uint64_t Seed, uint32_t Columns, uint32_t X, uint32_t Y)
+{
+	uint64_t LineHash = TileHash_Mix64(Seed + Y / 14);
+	uint32_t Column = X / 7;
+	if (Column >= LineHash % Columns)
+	{
+		return 0xffffff;
+	}
+
+	uint64_t Char = TileHash_Mix64(LineHash + Column);
+	if (Char % 6 == 0)
+	{
+		return 0xffffff;
+	}
+
+	uint32_t Bits = Font[Char % 64][Y % 14];
+	uint32_t Bit = X % 7;
+	if (Bits & (1u << Bit))
+	{
+		return 0x202020;
+	}
+	if (Bit > 0 && (Bits & (1u << (Bit - 1))))
+	{
+		return 0xc0c0c0;
+	}
+	return 0xffffff;
+}
+
+static void Text_Fill(uint8_t* Pixels, uint32_t Pitch, uint32_t Width, uint32_t Height, uint32_t Columns, uint64_t Seed)
+{
+	for (uint32_t Y = 0; Y < Height; Y++)
+	{
+		for (uint32_t X = 0; X < Width; X++)
+		{
+			Pixel_Set(Pixels + (size_t)Y * Pitch + X * 4, Text_Pixel(Seed, Columns, X, Y));
+		}
+	}
+}
+
+// changed tiles, same as Buddy_DetectChanges & Buddy_ChangeRects on one thread
+typedef struct
+{
+	uint32_t Width;
+	uint32_t Height;
+	uint32_t TilesX;
+	uint32_t TilesY;
+	uint32_t DirtyPitch;
+	uint64_t Secret[TILEHASH_SECRET_COUNT];
+	uint64_t* Hashes;
+	uint32_t* Dirty;
+	uint32_t* RowDirty;
+	uint32_t DirtyCount;
+	TileHashRect Bounds;
+	bool Valid;
+}
+Changes;
+
+static void Changes_Create(Changes* C, uint32_t Width, uint32_t Height)
+{
+	C->Width = Width;
+	C->Height = Height;
+	C->TilesX = (Width + TILEHASH_SIZE - 1) / TILEHASH_SIZE;
+	C->TilesY = (Height + TILEHASH_SIZE - 1) / TILEHASH_SIZE;
+	C->DirtyPitch = (C->TilesX + 31) / 32;
+	TileHash_Init(C->Secret);
+	C->Hashes = Test_Alloc(C->TilesX * C->TilesY * sizeof(*C->Hashes));
+	C->Dirty = Test_Alloc(C->DirtyPitch * C->TilesY * sizeof(*C->Dirty));
+	C->RowDirty = Test_Alloc(C->TilesY * sizeof(*C->RowDirty));
+	C->Valid = false;
+}
+
+static void Changes_Release(Changes* C)
+{
+	free(C->Hashes);
+	free(C->Dirty);
+	free(C->RowDirty);
+}
+
+static void Changes_Detect(Changes* C, const uint8_t* Pixels, uint32_t Pitch)
+{
+	C->DirtyCount = 0;
+	for (uint32_t TileY = 0; TileY < C->TilesY; TileY++)
+	{
+		uint32_t Y = TileY * TILEHASH_SIZE;
+		uint32_t Height = C->Height - Y < TILEHASH_SIZE ? C->Height - Y : TILEHASH_SIZE;
+		C->RowDirty[TileY] = TileHash_TileRow(C->Secret, Pixels + (size_t)Y * Pitch, Pitch, C->Width, Height, C->Hashes + TileY * C->TilesX, C->Dirty + TileY * C->DirtyPitch, C->Valid);
+		C->DirtyCount += C->RowDirty[TileY];
+	}
+	C->Valid = true;
+
+	TileHashRect Rects[32];
+	TileHash_Rects(C->Dirty, C->DirtyPitch, C->RowDirty, C->Width, C->Height, Rects, 32, &C->Bounds);
+}
+
+static ScrollChanges Changes_View(const Changes* C)
+{
+	return (ScrollChanges)
+	{
+		.Width = C->Width,
+		.Height = C->Height,
+		.TilesX = C->TilesX,
+		.TilesY = C->TilesY,
+		.DirtyPitch = C->DirtyPitch,
+		.Secret = C->Secret,
+		.Dirty = C->Dirty,
+		.RowDirty = C->RowDirty,
+		.DirtyCount = C->DirtyCount,
+		.Bounds = C->Bounds,
+	};
+}
+
+// every pixel of Rect in current frame is same as pixel moved by DX & DY in previous one
+static bool Rect_Moved(const TileHashRect* Rect, int32_t DX, int32_t DY, const uint8_t* Current, const uint8_t* Previous, uint32_t Pitch, uint32_t Width, uint32_t Height)
+{
+	if (Rect->Left < 0 || Rect->Top < 0 || Rect->Right > (int32_t)Width || Rect->Bottom > (int32_t)Height || Rect->Left >= Rect->Right || Rect->Top >= Rect->Bottom)
+	{
+		return false;
+	}
+	if (Rect->Left - DX < 0 || Rect->Top - DY < 0 || Rect->Right - DX > (int32_t)Width || Rect->Bottom - DY > (int32_t)Height)
+	{
+		return false;
+	}
+
+	for (int32_t Y = Rect->Top; Y < Rect->Bottom; Y++)
+	{
+		const uint8_t* Row = Current + (size_t)Y * Pitch + Rect->Left * 4;
+		const uint8_t* Source = Previous + (size_t)(Y - DY) * Pitch + (Rect->Left - DX) * 4;
+		if (memcmp(Row, Source, (Rect->Right - Rect->Left) * 4) != 0)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool Rect_Inside(const TileHashRect* Rect, int32_t X, int32_t Y)
+{
+	return X >= Rect->Left && X < Rect->Right && Y >= Rect->Top && Y < Rect->Bottom;
+}
+
+// changed pixels that are neither in moved region nor in region encoder gets with better quality
+static uint32_t Exposed_Misses(const ScrollDetect* Scroll, const uint8_t* Current, const uint8_t* Previous, uint32_t Pitch, uint32_t Width, uint32_t Height)
+{
+	uint32_t Misses = 0;
+	for (uint32_t Y = 0; Y < Height; Y++)
+	{
+		for (uint32_t X = 0; X < Width; X++)
+		{
+			size_t Offset = (size_t)Y * Pitch + X * 4;
+			if (memcmp(Current + Offset, Previous + Offset, 4) != 0 && !Rect_Inside(&Scroll->Rect, X, Y) && !Rect_Inside(&Scroll->Exposed, X, Y))
+			{
+				Misses++;
+			}
+		}
+	}
+	return Misses;
+}
+
+static void Test_Hash(void)
+{
+	uint64_t Random = 51;
+	for (uint32_t Count = 1; Count <= 37; Count++)
+	{
+		for (uint32_t Height = 1; Height <= TILEHASH_SIZE; Height += Height < 4 ? 1 : 13)
+		{
+			// exactly Count columns, so reading past last one is caught
+			uint32_t Pitch = Count * 4;
+			uint8_t* Pixels = Test_Alloc((size_t)Pitch * Height);
+			for (uint32_t Index = 0; Index < Pitch * Height; Index++)
+			{
+				Pixels[Index] = (uint8_t)Test_Random(&Random);
+			}
+
+			uint64_t Expected[37], Hashes[37];
+			Scroll_HashColumnsC(Pixels, Pitch, Count, Height, Expected);
+			Scroll_HashColumns(Pixels, Pitch, Count, Height, Hashes);
+			TEST_CHECK(memcmp(Expected, Hashes, Count * sizeof(*Hashes)) == 0);
+#if SCROLL_SIMD
+			Scroll_HashColumnsSSE2(Pixels, Pitch, Count, Height, Hashes);
+			TEST_CHECK(memcmp(Expected, Hashes, Count * sizeof(*Hashes)) == 0);
+#endif
+
+			// one changed pixel changes only hash of its column
+			uint32_t Column = Test_RandomRange(&Random, Count);
+			Pixels[(size_t)Test_RandomRange(&Random, Height) * Pitch + Column * 4 + 1] ^= 0x10;
+			Scroll_HashColumns(Pixels, Pitch, Count, Height, Hashes);
+			for (uint32_t Index = 0; Index < Count; Index++)
+			{
+				TEST_CHECK((Hashes[Index] != Expected[Index]) == (Index == Column));
+			}
+
+			free(Pixels);
+		}
+	}
+}
+
+// whole frame is document, so moved region is exactly overlap of frame & frame moved by offset
+static void Test_Offsets(void)
+{
+	static const int32_t Offsets[][2] =
+	{
+		{ 0, -1 }, { 0, 1 }, { 0, -14 }, { 0, 42 }, { 0, -213 }, { 0, 300 },
+		{ -1, 0 }, { 7, 0 }, { -64, 0 }, { 150, 0 }, { -333, 0 },
+	};
+	enum { Width = 700, Height = 500, DocumentSize = 1600 };
+
+	uint32_t Pitch = Width * 4;
+	uint8_t* Document = Test_Alloc((size_t)DocumentSize * DocumentSize * 4);
+	uint8_t* Frame = Test_Alloc((size_t)Pitch * Height);
+	Text_Fill(Document, DocumentSize * 4, DocumentSize, DocumentSize, 190, 52);
+
+	Changes C;
+	Changes_Create(&C, Width, Height);
+	ScrollDetect Scroll;
+	TEST_CHECK(Scroll_Create(&Scroll, Width, Height));
+
+	for (size_t Index = 0; Index < sizeof(Offsets) / sizeof(*Offsets); Index++)
+	{
+		int32_t DX = Offsets[Index][0];
+		int32_t DY = Offsets[Index][1];
+
+		// document position before & after, content moves opposite to document offset
+		for (uint32_t Step = 0; Step < 2; Step++)
+		{
+			uint32_t Left = 400 - (Step ? DX : 0);
+			uint32_t Top = 400 - (Step ? DY : 0);
+			for (uint32_t Y = 0; Y < Height; Y++)
+			{
+				memcpy(Frame + (size_t)Y * Pitch, Document + ((size_t)(Top + Y) * DocumentSize + Left) * 4, Pitch);
+			}
+
+			Changes_Detect(&C, Frame, Pitch);
+			ScrollChanges View = Changes_View(&C);
+			bool Found = Scroll_Detect(&Scroll, &View, Frame, Pitch);
+			for (uint32_t TileY = 0; TileY < C.TilesY; TileY++)
+			{
+				Scroll_CopyRow(&Scroll, &View, Frame, Pitch, TileY);
+			}
+
+			if (Step == 1)
+			{
+				TileHashRect Expected =
+				{
+					DX > 0 ? DX : 0, DY > 0 ? DY : 0,
+					DX < 0 ? Width + DX : Width, DY < 0 ? Height + DY : Height,
+				};
+				TEST_CHECK(Found);
+				TEST_CHECK(Scroll.DX == DX && Scroll.DY == DY);
+				TEST_CHECK(Scroll__Equal(&Scroll.Rect, &Expected));
+			}
+		}
+
+		// next offset starts from unrelated frame, which must not be found as scroll
+		memset(Frame, (int)(Index * 17), (size_t)Pitch * Height);
+		Changes_Detect(&C, Frame, Pitch);
+		ScrollChanges View = Changes_View(&C);
+		TEST_CHECK(!Scroll_Detect(&Scroll, &View, Frame, Pitch));
+		for (uint32_t TileY = 0; TileY < C.TilesY; TileY++)
+		{
+			Scroll_CopyRow(&Scroll, &View, Frame, Pitch, TileY);
+		}
+	}
+
+	Scroll_Release(&Scroll);
+	Changes_Release(&C);
+	free(Frame);
+	free(Document);
+}
+
+//
+// scroll traces
+
+enum
+{
+	TRACE_WHEEL,		// 3 lines every 16 frames
+	TRACE_SMOOTH,		// touchpad with momentum, few pixels per frame
+	TRACE_HORIZONTAL,	// wide document panned left & right
+	TRACE_PAGE,			// alternating page down & half page down every 32 frames, full page leaves too little to find
+	TRACE_VIDEO,		// video playing in window, changes whole window every frame
+	TRACE_COUNT,
+};
+
+static const char* TraceNames[TRACE_COUNT] = { "wheel", "smooth", "horizontal", "page", "video" };
+
+typedef struct
+{
+	uint32_t Width;
+	uint32_t Height;
+	uint32_t Pitch;
+	uint8_t* Pixels;
+
+	TileHashRect View;		// document window
+	uint32_t DocumentWidth;
+	uint32_t DocumentHeight;
+	uint8_t* Document;
+	int32_t OffsetX;		// document pixel at top left of View
+	int32_t OffsetY;
+	int32_t Direction;		// scroll direction, reversed at end of document
+	bool Typing;
+	uint64_t Random;
+}
+Scene;
+
+static void Scene_DrawView(Scene* S)
+{
+	uint32_t Width = S->View.Right - S->View.Left;
+	for (int32_t Y = S->View.Top; Y < S->View.Bottom; Y++)
+	{
+		const uint8_t* Source = S->Document + ((size_t)(S->OffsetY + Y - S->View.Top) * S->DocumentWidth + S->OffsetX) * 4;
+		memcpy(S->Pixels + (size_t)Y * S->Pitch + S->View.Left * 4, Source, Width * 4);
+	}
+}
+
+// wallpaper with window frame & title bar around document View
+static void Scene_Create(Scene* S, uint32_t Width, uint32_t Height, bool Typing, uint64_t Seed)
+{
+	S->Width = Width;
+	S->Height = Height;
+	S->Pitch = Width * 4 + 64;
+	S->Pixels = Test_Alloc((size_t)S->Pitch * Height);
+	S->View = (TileHashRect){ 36, 60, (int32_t)Width - 44, (int32_t)Height - 20 };
+	S->Direction = 1;
+	S->Typing = Typing;
+	S->Random = Seed;
+
+	for (uint32_t Y = 0; Y < Height; Y++)
+	{
+		for (uint32_t X = 0; X < Width; X++)
+		{
+			bool Frame = (int32_t)X >= S->View.Left - 4 && (int32_t)X < S->View.Right + 4 && (int32_t)Y >= S->View.Top - 30 && (int32_t)Y < S->View.Bottom + 4;
+			bool Title = Frame && (int32_t)Y < S->View.Top - 4;
+			uint32_t Color = Title ? 0x2b579a : Frame ? 0xe0e0e0 : ((X / 3) & 0xff) | (((Y / 2) & 0xff) << 8) | 0x400000;
+			Pixel_Set(S->Pixels + (size_t)Y * S->Pitch + X * 4, Color);
+		}
+	}
+
+	uint32_t ViewWidth = S->View.Right - S->View.Left;
+	uint32_t ViewHeight = S->View.Bottom - S->View.Top;
+	S->DocumentWidth = ViewWidth * 2;
+	S->DocumentHeight = ViewHeight * 6;
+	S->Document = Test_Alloc((size_t)S->DocumentWidth * S->DocumentHeight * 4);
+	Text_Fill(S->Document, S->DocumentWidth * 4, S->DocumentWidth, S->DocumentHeight, 2 * ViewWidth / 7 - 10, Seed);
+	S->OffsetX = 0;
+	S->OffsetY = 0;
+	Scene_DrawView(S);
+}
+
+static void Scene_Release(Scene* S)
+{
+	free(S->Pixels);
+	free(S->Document);
+}
+
+static int32_t Scene_Clamp(int32_t Value, int32_t Max, int32_t* Direction)
+{
+	if (Value < 0 || Value > Max)
+	{
+		*Direction = -*Direction;
+		return Value < 0 ? 0 : Max;
+	}
+	return Value;
+}
+
+// document scrolled by Amount pixels in Direction, DX & DY are how content inside View moved
+static void Scene_Scroll(Scene* S, int32_t AmountX, int32_t AmountY, int32_t* DX, int32_t* DY)
+{
+	int32_t MaxX = (int32_t)S->DocumentWidth - (S->View.Right - S->View.Left);
+	int32_t MaxY = (int32_t)S->DocumentHeight - (S->View.Bottom - S->View.Top);
+	int32_t OffsetX = Scene_Clamp(S->OffsetX + AmountX * S->Direction, MaxX, &S->Direction);
+	int32_t OffsetY = Scene_Clamp(S->OffsetY + AmountY * S->Direction, MaxY, &S->Direction);
+
+	*DX = S->OffsetX - OffsetX;
+	*DY = S->OffsetY - OffsetY;
+	S->OffsetX = OffsetX;
+	S->OffsetY = OffsetY;
+	Scene_DrawView(S);
+}
+
+// region of View that has same content as before scroll, returns false when there is none
+static bool Scene_Moved(const Scene* S, int32_t DX, int32_t DY, TileHashRect* Moved)
+{
+	if ((DX == 0 && DY == 0) || DX >= S->View.Right - S->View.Left || -DX >= S->View.Right - S->View.Left || DY >= S->View.Bottom - S->View.Top || -DY >= S->View.Bottom - S->View.Top)
+	{
+		return false;
+	}
+	*Moved = S->View;
+	Moved->Left += DX > 0 ? DX : 0;
+	Moved->Right += DX < 0 ? DX : 0;
+	Moved->Top += DY > 0 ? DY : 0;
+	Moved->Bottom += DY < 0 ? DY : 0;
+	return true;
+}
+
+// one glyph typed in visible part of document
+static void Scene_Type(Scene* S)
+{
+	uint32_t X = S->OffsetX + 7 * Test_RandomRange(&S->Random, (S->View.Right - S->View.Left) / 7);
+	uint32_t Y = S->OffsetY + 14 * Test_RandomRange(&S->Random, (S->View.Bottom - S->View.Top) / 14);
+	uint16_t* Glyph = Font[Test_RandomRange(&S->Random, 64)];
+	for (uint32_t Row = 0; Row < 14; Row++)
+	{
+		for (uint32_t Column = 0; Column < 7; Column++)
+		{
+			Pixel_Set(S->Document + ((size_t)(Y + Row) * S->DocumentWidth + X + Column) * 4, Glyph[Row] & (1u << Column) ? 0x202020 : 0xffffff);
+		}
+	}
+	Scene_DrawView(S);
+}
+
+static void Scene_Video(Scene* S)
+{
+	for (int32_t Y = S->View.Top; Y < S->View.Bottom; Y++)
+	{
+		uint8_t* Row = S->Pixels + (size_t)Y * S->Pitch;
+		for (int32_t X = S->View.Left; X < S->View.Right; X += 2)
+		{
+			uint64_t Noise = Test_Random(&S->Random);
+			memcpy(Row + X * 4, &Noise, X + 1 < S->View.Right ? 8 : 4);
+		}
+	}
+}
+
+// Step is frame number from start of trace, DX & DY are how content inside View moved
+static void Trace_Step(Scene* S, uint32_t Trace, uint32_t Step, int32_t* DX, int32_t* DY)
+{
+	static const int32_t Smooth[] = { 2, 4, 7, 11, 15, 18, 18, 15, 11, 7, 4, 2, 1 };
+	int32_t ViewHeight = S->View.Bottom - S->View.Top;
+	int32_t AmountX = 0;
+	int32_t AmountY = 0;
+
+	switch (Trace)
+	{
+	case TRACE_WHEEL:
+		AmountY = Step % 16 == 0 ? (Step / 16 % 4 == 3 ? -42 : 42) : 0;
+		break;
+	case TRACE_SMOOTH:
+		AmountY = Step % 32 < sizeof(Smooth) / sizeof(*Smooth) ? Smooth[Step % 32] * (Step / 32 % 3 == 2 ? -1 : 1) : 0;
+		break;
+	case TRACE_HORIZONTAL:
+		AmountX = Step % 16 == 0 ? (Step / 16 % 4 == 3 ? -96 : 48) : 0;
+		break;
+	case TRACE_PAGE:
+		AmountY = Step % 32 == 0 ? (Step / 32 % 2 ? ViewHeight / 2 : ViewHeight - 28) : 0;
+		break;
+	case TRACE_VIDEO:
+		Scene_Video(S);
+		break;
+	}
+
+	*DX = 0;
+	*DY = 0;
+	if (AmountX || AmountY)
+	{
+		Scene_Scroll(S, AmountX, AmountY, DX, DY);
+	}
+	else if (S->Typing && Trace != TRACE_VIDEO && Step % 8 == 5)
+	{
+		Scene_Type(S);
+	}
+}
+
+//
+// replay
+
+// valid tiles that are not same as frame
+static uint32_t Layer_Mismatches(const OverlayLayer* Layer, const uint8_t* Pixels, uint32_t Pitch)
+{
+	uint32_t Mismatches = 0;
+	for (uint32_t Index = 0; Index < Layer->TilesX * Layer->TilesY; Index++)
+	{
+		if (Layer->Valid[Index])
+		{
+			uint32_t X = Index % Layer->TilesX * TILEHASH_SIZE;
+			uint32_t Y = Index / Layer->TilesX * TILEHASH_SIZE;
+			uint32_t Width = Layer->Width - X < TILEHASH_SIZE ? Layer->Width - X : TILEHASH_SIZE;
+			uint32_t Height = Layer->Height - Y < TILEHASH_SIZE ? Layer->Height - Y : TILEHASH_SIZE;
+			for (uint32_t Row = 0; Row < Height; Row++)
+			{
+				if (memcmp(Pixels + (size_t)(Y + Row) * Pitch + X * 4, Layer->Pixels + ((size_t)(Y + Row) * Layer->Width + X) * 4, Width * 4) != 0)
+				{
+					Mismatches++;
+					break;
+				}
+			}
+		}
+	}
+	return Mismatches;
+}
+
+static void Update_Ignore(void* Context, uint32_t X, uint32_t Y, uint32_t Width, uint32_t Height)
+{
+	(void)Context, (void)X, (void)Y, (void)Width, (void)Height;
+}
+
+// SEI before P slice like Buddy_OverlayAttach makes it, parsed & applied like Buddy_OverlayApply, returns SEI size
+static uint32_t Frame_Send(OverlaySharer* Sharer, OverlayLayer* Layer, int64_t Time)
+{
+	static const uint8_t Slice[] = { 0, 0, 0, 1, 0x41, 0x9a, 0x02, 0x04, 0x80 };
+
+	uint32_t MaxSize = Overlay_SharerSeiSize(Sharer, Time);
+	if (MaxSize == 0)
+	{
+		return 0;
+	}
+
+	uint8_t* Frame = Test_Alloc(MaxSize + sizeof(Slice));
+	uint32_t SeiSize = Overlay_SharerWriteSei(Sharer, Time, Frame);
+	memcpy(Frame + SeiSize, Slice, sizeof(Slice));
+
+	H264Info Info;
+	TEST_CHECK(H264Parse_AccessUnit(Frame, SeiSize + sizeof(Slice), Overlay_Uuid, &Info));
+	TEST_CHECK(Info.UserData != NULL);
+	if (Info.UserData)
+	{
+		uint8_t* Payload = Test_Alloc(Info.UserDataSize);
+		const uint8_t* Records;
+		uint32_t RecordsSize, Width, Height;
+		bool Parsed = Overlay_ParseSei(Info.UserData, Info.UserDataSize, Payload, &Records, &RecordsSize, &Width, &Height);
+		TEST_CHECK(Parsed);
+		if (Parsed)
+		{
+			if (Width != Layer->Width || Height != Layer->Height)
+			{
+				Overlay_ReleaseLayer(Layer);
+				TEST_CHECK(Overlay_CreateLayer(Layer, Width, Height));
+			}
+			Overlay_ApplyRecords(Layer, Records, RecordsSize, &Update_Ignore, NULL);
+		}
+		free(Payload);
+	}
+
+	free(Frame);
+	return SeiSize;
+}
+
+typedef struct
+{
+	uint32_t Trace;
+	uint32_t Frames;		// after warmup
+	bool Copy;				// found scroll moves overlay tiles
+	bool Typing;
+	uint32_t MaxDelay;		// frames between capture & encoder output
+	uint32_t DropRate;		// one of DropRate frames is dropped by encoder, 0 for none
+	uint32_t KeyInterval;
+
+	// results
+	uint32_t Scrolls;		// frames where View content moved
+	uint32_t Detectable;	// of them, with at least SCROLL_MIN_SIZE moved rows or columns
+	uint32_t Detected;		// of them, found with same offset
+	uint32_t Found;
+	uint32_t Wrong;			// found regions with pixel that did not move by found offset
+	uint32_t Unexposed;		// changed pixels outside of found region & exposed region
+	uint32_t Outputs;
+	uint32_t Drops;
+	uint32_t Mismatches;
+	uint64_t Bytes;			// SEI of outputs after warmup
+	uint64_t ExposedArea;	// encoder better quality region on found scrolls
+	uint64_t BoundsArea;	// changed tiles of same frames
+	double ScrollTime;		// detection & previous frame copy, on frames that scroll
+	double ChangedTime;		// same on frames without scroll that have at least SCROLL_MIN_TILES changed tiles
+	uint32_t ChangedFrames;
+}
+Replay;
+
+static uint64_t Rect_Area(const TileHashRect* Rect)
+{
+	return (uint64_t)(Rect->Right - Rect->Left) * (Rect->Bottom - Rect->Top);
+}
+
+static void Replay_Run(Replay* R, uint64_t Seed)
+{
+	enum { Width = 1280, Height = 720, History = 32, Warmup = 40 };
+
+	Scene S;
+	Scene_Create(&S, Width, Height, R->Typing, Seed);
+
+	Changes C;
+	Changes_Create(&C, Width, Height);
+	ScrollDetect Scroll;
+	TEST_CHECK(Scroll_Create(&Scroll, Width, Height));
+	uint8_t* Previous = Test_Alloc((size_t)S.Pitch * Height);
+
+	OverlaySharer Sharer;
+	TEST_CHECK(Overlay_CreateSharer(&Sharer, Width, Height));
+	OverlayLayer Layer = { 0 };
+
+	uint8_t* Screens[History];
+	uint32_t Ready[History];
+	for (uint32_t Index = 0; Index < History; Index++)
+	{
+		Screens[Index] = Test_Alloc((size_t)S.Pitch * Height);
+	}
+
+	uint64_t Random = Seed;
+	uint32_t Frames = Warmup + R->Frames;
+	uint32_t Read = 0;
+	for (uint32_t Frame = 0; Read < Frames; Frame++)
+	{
+		if (Frame < Frames)
+		{
+			int32_t DX = 0, DY = 0;
+			if (Frame >= Warmup)
+			{
+				Trace_Step(&S, R->Trace, Frame - Warmup, &DX, &DY);
+			}
+			Changes_Detect(&C, S.Pixels, S.Pitch);
+
+			ScrollChanges View = Changes_View(&C);
+			double Start = Test_Time();
+			bool Found = Scroll_Detect(&Scroll, &View, S.Pixels, S.Pitch);
+			for (uint32_t TileY = 0; TileY < C.TilesY; TileY++)
+			{
+				Scroll_CopyRow(&Scroll, &View, S.Pixels, S.Pitch, TileY);
+			}
+			double Time = Test_Time() - Start;
+
+			TileHashRect Moved;
+			if (Scene_Moved(&S, DX, DY, &Moved))
+			{
+				R->Scrolls++;
+				R->Detectable += Moved.Right - Moved.Left >= SCROLL_MIN_SIZE && Moved.Bottom - Moved.Top >= SCROLL_MIN_SIZE;
+				R->Detected += Found && Scroll.DX == DX && Scroll.DY == DY;
+				R->ScrollTime += Time;
+			}
+			else if (C.DirtyCount >= SCROLL_MIN_TILES)
+			{
+				R->ChangedTime += Time;
+				R->ChangedFrames++;
+			}
+
+			if (Found)
+			{
+				R->Found++;
+				R->Wrong += !Rect_Moved(&Scroll.Rect, Scroll.DX, Scroll.DY, S.Pixels, Previous, S.Pitch, Width, Height);
+				R->Unexposed += Exposed_Misses(&Scroll, S.Pixels, Previous, S.Pitch, Width, Height);
+				R->ExposedArea += Rect_Area(&Scroll.Exposed);
+				R->BoundsArea += Rect_Area(&C.Bounds);
+			}
+			memcpy(Previous, S.Pixels, (size_t)S.Pitch * Height);
+
+			Overlay_SharerChanges(&Sharer, C.Dirty, C.DirtyPitch, R->Copy && Found ? &Scroll.Rect : NULL, Scroll.DX, Scroll.DY);
+			Overlay_SharerQueueFrame(&Sharer, Frame, S.Pixels, S.Pitch);
+
+			memcpy(Screens[Frame % History], S.Pixels, (size_t)S.Pitch * Height);
+			Ready[Frame % History] = Frame + Test_RandomRange(&Random, R->MaxDelay + 1);
+		}
+
+		// outputs come in order, each one waits for all before it
+		while (Read < Frames && Read <= Frame && (Ready[Read % History] <= Frame || Frame >= Frames))
+		{
+			uint32_t Time = Read++;
+			if (R->KeyInterval && Time % R->KeyInterval == 0)
+			{
+				Overlay_SharerKeyFrame(&Sharer);
+				Overlay_ResetLayer(&Layer);
+			}
+			else if (R->DropRate && Test_RandomRange(&Random, R->DropRate) == 0)
+			{
+				R->Drops++;
+				continue;
+			}
+			else
+			{
+				uint32_t Size = Frame_Send(&Sharer, &Layer, Time);
+				R->Bytes += Time >= Warmup ? Size : 0;
+			}
+
+			R->Outputs++;
+			if (Layer.Valid)
+			{
+				R->Mismatches += Layer_Mismatches(&Layer, Screens[Time % History], S.Pitch);
+			}
+		}
+		TEST_CHECK(Frame + 1 - Read <= History);
+	}
+
+	for (uint32_t Index = 0; Index < History; Index++)
+	{
+		free(Screens[Index]);
+	}
+	Overlay_ReleaseLayer(&Layer);
+	Overlay_ReleaseSharer(&Sharer);
+	free(Previous);
+	Scroll_Release(&Scroll);
+	Changes_Release(&C);
+	Scene_Release(&S);
+}
+
+static void Test_Replay(void)
+{
+	for (uint32_t Trace = 0; Trace < TRACE_COUNT; Trace++)
+	{
+		Replay Plain = { .Trace = Trace, .Frames = 128, .Copy = false, .Typing = true };
+		Replay Copy = { .Trace = Trace, .Frames = 128, .Copy = true, .Typing = true };
+		Replay Lossy = { .Trace = Trace, .Frames = 128, .Copy = true, .Typing = true, .MaxDelay = 4, .DropRate = 6, .KeyInterval = 41 };
+		Replay_Run(&Plain, 60 + Trace);
+		Replay_Run(&Copy, 60 + Trace);
+		Replay_Run(&Lossy, 60 + Trace);
+
+		const Replay* Runs[] = { &Plain, &Copy, &Lossy };
+		for (size_t Index = 0; Index < sizeof(Runs) / sizeof(*Runs); Index++)
+		{
+			const Replay* R = Runs[Index];
+			TEST_CHECK(R->Wrong == 0);
+			TEST_CHECK(R->Unexposed == 0);
+			TEST_CHECK(R->Detected == R->Detectable);
+			TEST_CHECK(R->Mismatches == 0);
+			TEST_CHECK(R->Outputs + R->Drops == 40 + R->Frames);
+			if (Trace == TRACE_VIDEO)
+			{
+				TEST_CHECK(R->Scrolls == 0 && R->Found == 0);
+			}
+			else
+			{
+				TEST_CHECK(R->Detectable != 0);
+			}
+		}
+		TEST_CHECK(Lossy.Drops != 0);
+
+		// encoder gets better quality only for what scroll exposed, full page has nothing moved
+		if (Trace != TRACE_VIDEO && Trace != TRACE_PAGE)
+		{
+			TEST_CHECK(Copy.ExposedArea * 4 < Copy.BoundsArea);
+		}
+
+		// moved tiles are not sent again, except in smooth scroll - tile moved by less than its size needs two valid
+		// source tiles, so invalid tiles from exposed edge spread one tile per frame and whole window is sent again
+		if (Trace != TRACE_VIDEO && Trace != TRACE_SMOOTH)
+		{
+			TEST_CHECK(Copy.Bytes < Plain.Bytes);
+		}
+	}
+}
+
+//
+// benchmark
+
+static void Bench_Hash(void)
+{
+	enum { Count = 1280, Height = TILEHASH_SIZE };
+	uint8_t* Pixels = Test_Alloc((size_t)Count * 4 * Height);
+	Text_Fill(Pixels, Count * 4, Count, Height, 180, 53);
+	uint64_t* Hashes = Test_Alloc(Count * sizeof(*Hashes));
+
+	double TimeC;
+	TEST_BENCH(0.5, TimeC, Scroll_HashColumnsC(Pixels, Count * 4, Count, Height, Hashes));
+	printf("hash columns %ux%u C     %7.1f us\n", Count, Height, TimeC * 1e6);
+#if SCROLL_SIMD
+	double TimeSSE2;
+	TEST_BENCH(0.5, TimeSSE2, Scroll_HashColumnsSSE2(Pixels, Count * 4, Count, Height, Hashes));
+	printf("hash columns %ux%u SSE2  %7.1f us\n", Count, Height, TimeSSE2 * 1e6);
+#endif
+
+	free(Hashes);
+	free(Pixels);
+}
+
+static void Bench_Replay(void)
+{
+	for (uint32_t Trace = 0; Trace < TRACE_COUNT; Trace++)
+	{
+		Replay Plain = { .Trace = Trace, .Frames = 512, .Copy = false, .MaxDelay = 2 };
+		Replay Copy = { .Trace = Trace, .Frames = 512, .Copy = true, .MaxDelay = 2 };
+		Replay_Run(&Plain, 70 + Trace);
+		Replay_Run(&Copy, 70 + Trace);
+		TEST_CHECK(Copy.Mismatches == 0 && Plain.Mismatches == 0 && Copy.Wrong == 0);
+
+		if (Trace == TRACE_VIDEO)
+		{
+			printf("%-10s 1280x720 %u frames: no scroll found, detection %.3f ms per fully changed frame\n",
+				TraceNames[Trace], Copy.Frames, Copy.ChangedTime * 1e3 / Copy.ChangedFrames);
+			continue;
+		}
+
+		printf("%-10s 1280x720 %3u scrolls, %3u of %3u detectable found: overlay %6.0f bytes/scroll (without scroll copy %6.0f), "
+			"better quality region %5.1f%% of changed tiles, detection %.3f ms per scroll\n",
+			TraceNames[Trace], Copy.Scrolls, Copy.Detected, Copy.Detectable,
+			(double)Copy.Bytes / Copy.Scrolls, (double)Plain.Bytes / Plain.Scrolls,
+			Copy.BoundsArea ? 100.0 * Copy.ExposedArea / Copy.BoundsArea : 0.0,
+			Copy.ScrollTime * 1e3 / Copy.Scrolls);
+	}
+}
+
+int main(int ArgCount, char** Args)
+{
+	Font_Init();
+
+	if (Test_IsBench(ArgCount, Args))
+	{
+		Bench_Hash();
+		Bench_Replay();
+		return Test_Finish("ScrollDetect bench");
+	}
+
+	Test_Hash();
+	Test_Offsets();
+	Test_Replay();
+	return Test_Finish("ScrollDetect");
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#define _CRT_SECURE_NO_DEPRECATE
+#define _POSIX_C_SOURCE 200809L
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+// helpers shared by tests, every test is standalone program without dependencies on ScreenBuddy.c
+// without arguments it runs tests & returns nonzero on failure, with "bench" argument it runs benchmarks
+
+static int Test_Failures;
+
+#define TEST_CHECK(Condition) do									\
+{																	\
+	if (!(Condition))												\
+	{																\
+		fprintf(stderr, "%s(%d): check failed: %s\n", __FILE__, __LINE__, #Condition);	\
+		Test_Failures++;											\
+	}																\
+} while (0)
+
+// returns true when program should run benchmarks
+static bool Test_IsBench(int ArgCount, char** Args)
+{
+	return ArgCount > 1 && strcmp(Args[1], "bench") == 0;
+}
+
+static int Test_Finish(const char* Name)
+{
+	if (Test_Failures)
+	{
+		fprintf(stderr, "%s: %d checks failed\n", Name, Test_Failures);
+		return 1;
+	}
+	printf("%s: ok\n", Name);
+	return 0;
+}
+
+// seconds, monotonic
+static double Test_Time(void)
+{
+#if defined(_WIN32)
+	LARGE_INTEGER Freq, Counter;
+	QueryPerformanceFrequency(&Freq);
+	QueryPerformanceCounter(&Counter);
+	return (double)Counter.QuadPart / (double)Freq.QuadPart;
+#else
+	struct timespec Time;
+	clock_gettime(CLOCK_MONOTONIC, &Time);
+	return (double)Time.tv_sec + (double)Time.tv_nsec * 1e-9;
+#endif
+}
+
+// splitmix64, same sequence on every platform, so fuzz & benchmark inputs are reproducible
+static uint64_t Test_Random(uint64_t* State)
+{
+	uint64_t Value = (*State += 0x9e3779b97f4a7c15ULL);
+	Value = (Value ^ (Value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	Value = (Value ^ (Value >> 27)) * 0x94d049bb133111ebULL;
+	return Value ^ (Value >> 31);
+}
+
+static uint32_t Test_RandomRange(uint64_t* State, uint32_t Count)
+{
+	return (uint32_t)(Test_Random(State) % Count);
+}
+
+static void* Test_Alloc(size_t Size)
+{
+	void* Result = malloc(Size ? Size : 1);
+	if (!Result)
+	{
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	return Result;
+}
+
+static uint8_t* Test_ReadFile(const char* Path, size_t* Size)
+{
+	FILE* File = fopen(Path, "rb");
+	if (!File)
+	{
+		return NULL;
+	}
+
+	fseek(File, 0, SEEK_END);
+	long FileSize = ftell(File);
+	fseek(File, 0, SEEK_SET);
+
+	uint8_t* Data = Test_Alloc(FileSize + 1);
+	*Size = fread(Data, 1, FileSize, File);
+	fclose(File);
+	return Data;
+}
+
+// runs Proc until at least MinTime seconds pass, returns best seconds per call of all repeats
+#define TEST_BENCH(MinTime, Best, ...) do							\
+{																	\
+	double BenchStart_ = Test_Time();								\
+	(Best) = 1e30;													\
+	do																\
+	{																\
+		double CallStart_ = Test_Time();							\
+		__VA_ARGS__;												\
+		double CallTime_ = Test_Time() - CallStart_;				\
+		(Best) = CallTime_ < (Best) ? CallTime_ : (Best);			\
+	}																\
+	while (Test_Time() - BenchStart_ < (MinTime));					\
+} while (0)
@@ -0,0 +1,495 @@
+#include "Test.h"
+#include "../external/TileHash.h"
+
+//
+// TileHashTest - change detection from external/TileHash.h
+//
+// C & SSE2 tile hashes must be same for every tile size, and hash must change for single flipped bit in every byte
+// of tile, for swapped pixels, swapped rows & content moved by one pixel. Frames are synthetic desktop-like BGRA
+// buffers - tile rows of changed frame must report exactly tiles that were touched, and rectangles built from random
+// dirty bitmaps must cover every dirty tile, stay inside frame, and cover no clean tile when there are enough of them.
+//
+// benchmark hashes 1080p & 4K frames on one thread with C & SSE2, and reports msec per frame & GB/s
+//
+
+typedef uint64_t TileHash_TileProc(const uint64_t* Secret, const uint8_t* Pixels, uint32_t Pitch, uint32_t Width, uint32_t Height);
+
+static uint64_t Secret[TILEHASH_SECRET_COUNT];
+
+// flat background with few "windows" of random text-like noise, Pitch has padding like mapped staging texture
+static uint8_t* Frame_Create(uint32_t Width, uint32_t Height, uint32_t Pitch, uint64_t* Random)
+{
+	uint8_t* Pixels = Test_Alloc((size_t)Pitch * Height);
+	memset(Pixels, 0xcc, (size_t)Pitch * Height);
+
+	for (uint32_t Window = 0; Window < 4; Window++)
+	{
+		uint32_t X0 = Test_RandomRange(Random, Width);
+		uint32_t Y0 = Test_RandomRange(Random, Height);
+		uint32_t X1 = X0 + Test_RandomRange(Random, Width - X0) + 1;
+		uint32_t Y1 = Y0 + Test_RandomRange(Random, Height - Y0) + 1;
+		for (uint32_t Y = Y0; Y < Y1; Y++)
+		{
+			for (uint32_t X = X0; X < X1; X++)
+			{
+				uint8_t* Pixel = Pixels + (size_t)Y * Pitch + X * 4;
+				uint8_t Value = Test_RandomRange(Random, 4) == 0 ? (uint8_t)Test_Random(Random) : 0xff;
+				Pixel[0] = Pixel[1] = Pixel[2] = Value;
+				Pixel[3] = 0xff;
+			}
+		}
+	}
+	return Pixels;
+}
+
+//
+// hash
+
+static void Test_HashSame(void)
+{
+	uint64_t Random = 45;
+
+	uint32_t Pitch = TILEHASH_SIZE * 4 + 20;
+	uint8_t* Pixels = Test_Alloc(Pitch * TILEHASH_SIZE);
+
+	for (uint32_t Width = 1; Width <= TILEHASH_SIZE; Width++)
+	{
+		for (uint32_t Height = 1; Height <= TILEHASH_SIZE; Height += Height < 4 ? 1 : 7)
+		{
+			for (uint32_t Index = 0; Index < Pitch * TILEHASH_SIZE; Index++)
+			{
+				Pixels[Index] = (uint8_t)Test_Random(&Random);
+			}
+
+			uint64_t Hash = TileHash_TileC(Secret, Pixels, Pitch, Width, Height);
+#if TILEHASH_SIMD
+			TEST_CHECK(TileHash_TileSSE2(Secret, Pixels, Pitch, Width, Height) == Hash);
+#endif
+			TEST_CHECK(TileHash_Tile(Secret, Pixels, Pitch, Width, Height) == Hash);
+
+			// pixels past Width & Height are not part of tile
+			for (uint32_t Y = 0; Y < TILEHASH_SIZE; Y++)
+			{
+				for (uint32_t X = (Y < Height ? Width : 0) * 4; X < Pitch; X++)
+				{
+					Pixels[Y * Pitch + X] ^= 0x5a;
+				}
+			}
+			TEST_CHECK(TileHash_Tile(Secret, Pixels, Pitch, Width, Height) == Hash);
+		}
+	}
+
+	free(Pixels);
+}
+
+static void Test_HashChanges(void)
+{
+	uint64_t Random = 46;
+
+	static const uint32_t Sizes[][2] = { { 64, 64 }, { 63, 64 }, { 64, 17 }, { 5, 3 }, { 1, 1 } };
+
+	TileHash_TileProc* Procs[] =
+	{
+		&TileHash_TileC,
+#if TILEHASH_SIMD
+		&TileHash_TileSSE2,
+#endif
+	};
+
+	for (size_t Proc = 0; Proc < sizeof(Procs) / sizeof(*Procs); Proc++)
+	{
+		for (size_t Size = 0; Size < sizeof(Sizes) / sizeof(*Sizes); Size++)
+		{
+			uint32_t Width = Sizes[Size][0];
+			uint32_t Height = Sizes[Size][1];
+			uint32_t Pitch = Width * 4;
+
+			uint8_t* Pixels = Test_Alloc(Pitch * Height);
+			for (uint32_t Index = 0; Index < Pitch * Height; Index++)
+			{
+				Pixels[Index] = (uint8_t)Test_Random(&Random);
+			}
+			uint64_t Hash = Procs[Proc](Secret, Pixels, Pitch, Width, Height);
+
+			// single bit in every byte, each bit position used in every column of 16-byte blocks
+			for (uint32_t Index = 0; Index < Pitch * Height; Index++)
+			{
+				uint32_t Bit = (Index + Index / Pitch) % 8;
+				Pixels[Index] ^= 1 << Bit;
+				TEST_CHECK(Procs[Proc](Secret, Pixels, Pitch, Width, Height) != Hash);
+				Pixels[Index] ^= 1 << Bit;
+			}
+
+			// pixels swapped inside row, and with pixel in other row
+			for (uint32_t Round = 0; Round < 200 && Width * Height > 1; Round++)
+			{
+				uint32_t A = Test_RandomRange(&Random, Width * Height);
+				uint32_t B = Test_RandomRange(&Random, Width * Height);
+
+				uint32_t PixelA, PixelB;
+				memcpy(&PixelA, Pixels + A * 4, 4);
+				memcpy(&PixelB, Pixels + B * 4, 4);
+				if (PixelA == PixelB)
+				{
+					continue;
+				}
+
+				memcpy(Pixels + A * 4, &PixelB, 4);
+				memcpy(Pixels + B * 4, &PixelA, 4);
+				TEST_CHECK(Procs[Proc](Secret, Pixels, Pitch, Width, Height) != Hash);
+				memcpy(Pixels + A * 4, &PixelA, 4);
+				memcpy(Pixels + B * 4, &PixelB, 4);
+			}
+
+			// rows swapped
+			uint8_t* Copy = Test_Alloc(Pitch * Height);
+			for (uint32_t Y = 0; Y + 1 < Height; Y++)
+			{
+				memcpy(Copy, Pixels, Pitch * Height);
+				memcpy(Copy + Y * Pitch, Pixels + (Y + 1) * Pitch, Pitch);
+				memcpy(Copy + (Y + 1) * Pitch, Pixels + Y * Pitch, Pitch);
+				TEST_CHECK(Procs[Proc](Secret, Copy, Pitch, Width, Height) != Hash);
+			}
+
+			// content moved by one pixel right & down, like small scroll
+			if (Width > 1 && Height > 1)
+			{
+				memcpy(Copy, Pixels, Pitch * Height);
+				for (uint32_t Y = 0; Y < Height; Y++)
+				{
+					memmove(Copy + Y * Pitch + 4, Copy + Y * Pitch, Pitch - 4);
+				}
+				TEST_CHECK(Procs[Proc](Secret, Copy, Pitch, Width, Height) != Hash);
+
+				memcpy(Copy, Pixels, Pitch * Height);
+				memmove(Copy + Pitch, Copy, Pitch * (Height - 1));
+				TEST_CHECK(Procs[Proc](Secret, Copy, Pitch, Width, Height) != Hash);
+			}
+
+			free(Copy);
+			free(Pixels);
+		}
+	}
+}
+
+//
+// frames
+
+typedef struct
+{
+	uint32_t Width;
+	uint32_t Height;
+	uint32_t TilesX;
+	uint32_t TilesY;
+	uint32_t DirtyPitch;
+	uint64_t* Hashes;
+	uint32_t* Dirty;
+	uint32_t* RowDirty;
+}
+Changes;
+
+static void Changes_Create(Changes* C, uint32_t Width, uint32_t Height)
+{
+	C->Width = Width;
+	C->Height = Height;
+	C->TilesX = (Width + TILEHASH_SIZE - 1) / TILEHASH_SIZE;
+	C->TilesY = (Height + TILEHASH_SIZE - 1) / TILEHASH_SIZE;
+	C->DirtyPitch = (C->TilesX + 31) / 32;
+	C->Hashes = Test_Alloc(C->TilesX * C->TilesY * sizeof(*C->Hashes));
+	C->Dirty = Test_Alloc(C->DirtyPitch * C->TilesY * sizeof(*C->Dirty));
+	C->RowDirty = Test_Alloc(C->TilesY * sizeof(*C->RowDirty));
+}
+
+static void Changes_Release(Changes* C)
+{
+	free(C->Hashes);
+	free(C->Dirty);
+	free(C->RowDirty);
+}
+
+// same as Buddy_DetectChanges, on one thread
+static uint32_t Changes_Detect(Changes* C, const uint8_t* Pixels, uint32_t Pitch, bool Valid)
+{
+	uint32_t Count = 0;
+	for (uint32_t TileY = 0; TileY < C->TilesY; TileY++)
+	{
+		uint32_t Y = TileY * TILEHASH_SIZE;
+		uint32_t Height = C->Height - Y < TILEHASH_SIZE ? C->Height - Y : TILEHASH_SIZE;
+		C->RowDirty[TileY] = TileHash_TileRow(Secret, Pixels + (size_t)Y * Pitch, Pitch, C->Width, Height, C->Hashes + TileY * C->TilesX, C->Dirty + TileY * C->DirtyPitch, Valid);
+		Count += C->RowDirty[TileY];
+	}
+	return Count;
+}
+
+static bool Changes_IsDirty(const Changes* C, uint32_t TileX, uint32_t TileY)
+{
+	return (C->Dirty[TileY * C->DirtyPitch + TileX / 32] & (1u << (TileX % 32))) != 0;
+}
+
+static void Test_Frames(void)
+{
+	uint64_t Random = 47;
+
+	static const uint32_t Sizes[][2] = { { 1920, 1080 }, { 1366, 768 }, { 2100, 70 }, { 63, 65 }, { 1, 1 } };
+	for (size_t Size = 0; Size < sizeof(Sizes) / sizeof(*Sizes); Size++)
+	{
+		uint32_t Width = Sizes[Size][0];
+		uint32_t Height = Sizes[Size][1];
+		uint32_t Pitch = (Width * 4 + 255) & ~255;
+
+		Changes C;
+		Changes_Create(&C, Width, Height);
+
+		uint8_t* Pixels = Frame_Create(Width, Height, Pitch, &Random);
+
+		// first frame is all dirty, same frame again is all clean
+		TEST_CHECK(Changes_Detect(&C, Pixels, Pitch, false) == C.TilesX * C.TilesY);
+		TEST_CHECK(Changes_Detect(&C, Pixels, Pitch, true) == 0);
+
+		// padding past Width is not part of frame
+		for (uint32_t Y = 0; Y < Height; Y++)
+		{
+			memset(Pixels + (size_t)Y * Pitch + Width * 4, Y, Pitch - Width * 4);
+		}
+		TEST_CHECK(Changes_Detect(&C, Pixels, Pitch, true) == 0);
+
+		for (uint32_t Round = 0; Round < 50; Round++)
+		{
+			// few random pixels, like typing & cursor
+			uint32_t Touched[8][2];
+			uint32_t TouchCount = 1 + Test_RandomRange(&Random, 8);
+			for (uint32_t Index = 0; Index < TouchCount; Index++)
+			{
+				uint32_t X = Test_RandomRange(&Random, Width);
+				uint32_t Y = Test_RandomRange(&Random, Height);
+				Pixels[(size_t)Y * Pitch + X * 4 + Test_RandomRange(&Random, 4)] ^= (uint8_t)(1 + Test_RandomRange(&Random, 255));
+				Touched[Index][0] = X / TILEHASH_SIZE;
+				Touched[Index][1] = Y / TILEHASH_SIZE;
+			}
+
+			uint32_t Count = Changes_Detect(&C, Pixels, Pitch, true);
+
+			// exactly touched tiles are dirty, same pixel can be touched twice & restored
+			uint32_t Expected = 0;
+			for (uint32_t TileY = 0; TileY < C.TilesY; TileY++)
+			{
+				for (uint32_t TileX = 0; TileX < C.TilesX; TileX++)
+				{
+					bool IsTouched = false;
+					for (uint32_t Index = 0; Index < TouchCount; Index++)
+					{
+						IsTouched = IsTouched || (Touched[Index][0] == TileX && Touched[Index][1] == TileY);
+					}
+					TEST_CHECK(!Changes_IsDirty(&C, TileX, TileY) || IsTouched);
+					Expected += Changes_IsDirty(&C, TileX, TileY);
+				}
+			}
+			TEST_CHECK(Count == Expected && Count <= TouchCount);
+		}
+
+		free(Pixels);
+		Changes_Release(&C);
+	}
+}
+
+//
+// rectangles
+
+static void Test_Rects(void)
+{
+	uint64_t Random = 48;
+
+	for (uint32_t Round = 0; Round < 2000; Round++)
+	{
+		uint32_t Width = 1 + Test_RandomRange(&Random, 2600);
+		uint32_t Height = 1 + Test_RandomRange(&Random, 1500);
+
+		Changes C;
+		Changes_Create(&C, Width, Height);
+
+		// sparse, dense, and blocky bitmaps like windows
+		uint32_t Density = 1 + Test_RandomRange(&Random, 100);
+		memset(C.Dirty, 0, C.DirtyPitch * C.TilesY * sizeof(*C.Dirty));
+		if (Round % 3 == 0)
+		{
+			for (uint32_t Block = 0; Block < 1 + Test_RandomRange(&Random, 4); Block++)
+			{
+				uint32_t X0 = Test_RandomRange(&Random, C.TilesX);
+				uint32_t Y0 = Test_RandomRange(&Random, C.TilesY);
+				uint32_t X1 = X0 + 1 + Test_RandomRange(&Random, C.TilesX - X0);
+				uint32_t Y1 = Y0 + 1 + Test_RandomRange(&Random, C.TilesY - Y0);
+				for (uint32_t TileY = Y0; TileY < Y1; TileY++)
+				{
+					for (uint32_t TileX = X0; TileX < X1; TileX++)
+					{
+						C.Dirty[TileY * C.DirtyPitch + TileX / 32] |= 1u << (TileX % 32);
+					}
+				}
+			}
+		}
+		else
+		{
+			for (uint32_t TileY = 0; TileY < C.TilesY; TileY++)
+			{
+				for (uint32_t TileX = 0; TileX < C.TilesX; TileX++)
+				{
+					if (Test_RandomRange(&Random, 100) < Density)
+					{
+						C.Dirty[TileY * C.DirtyPitch + TileX / 32] |= 1u << (TileX % 32);
+					}
+				}
+			}
+		}
+
+		uint32_t DirtyCount = 0;
+		for (uint32_t TileY = 0; TileY < C.TilesY; TileY++)
+		{
+			C.RowDirty[TileY] = 0;
+			for (uint32_t TileX = 0; TileX < C.TilesX; TileX++)
+			{
+				C.RowDirty[TileY] += Changes_IsDirty(&C, TileX, TileY);
+			}
+			DirtyCount += C.RowDirty[TileY];
+		}
+
+		enum { MAX_RECTS = 32 };
+		TileHashRect Rects[MAX_RECTS];
+		TileHashRect Bounds;
+		uint32_t MaxRects = Round & 1 ? MAX_RECTS : 1 + Test_RandomRange(&Random, 4);
+		uint32_t RectCount = TileHash_Rects(C.Dirty, C.DirtyPitch, C.RowDirty, Width, Height, Rects, MaxRects, &Bounds);
+
+		TEST_CHECK(RectCount <= MaxRects && (RectCount == 0) == (DirtyCount == 0));
+		if (DirtyCount == 0)
+		{
+			TEST_CHECK(Bounds.Left == Bounds.Right || Bounds.Top == Bounds.Bottom);
+		}
+
+		// inside frame & bounds, tile aligned except at right & bottom edge of frame
+		for (uint32_t Index = 0; Index < RectCount; Index++)
+		{
+			const TileHashRect* R = &Rects[Index];
+			TEST_CHECK(R->Left >= 0 && R->Top >= 0 && R->Left < R->Right && R->Top < R->Bottom);
+			TEST_CHECK(R->Right <= (int32_t)Width && R->Bottom <= (int32_t)Height);
+			TEST_CHECK(R->Left >= Bounds.Left && R->Top >= Bounds.Top && R->Right <= Bounds.Right && R->Bottom <= Bounds.Bottom);
+			TEST_CHECK(R->Left % TILEHASH_SIZE == 0 && R->Top % TILEHASH_SIZE == 0);
+			TEST_CHECK(R->Right % TILEHASH_SIZE == 0 || R->Right == (int32_t)Width);
+			TEST_CHECK(R->Bottom % TILEHASH_SIZE == 0 || R->Bottom == (int32_t)Height);
+		}
+
+		// every dirty tile is covered once, unless rectangles ran out and last one grew over others & clean tiles
+		bool Overflow = false;
+		uint32_t Covered = 0;
+		for (uint32_t TileY = 0; TileY < C.TilesY; TileY++)
+		{
+			for (uint32_t TileX = 0; TileX < C.TilesX; TileX++)
+			{
+				int32_t X = TileX * TILEHASH_SIZE;
+				int32_t Y = TileY * TILEHASH_SIZE;
+
+				uint32_t Inside = 0;
+				for (uint32_t Index = 0; Index < RectCount; Index++)
+				{
+					const TileHashRect* R = &Rects[Index];
+					Inside += X >= R->Left && X < R->Right && Y >= R->Top && Y < R->Bottom;
+				}
+
+				if (Changes_IsDirty(&C, TileX, TileY))
+				{
+					TEST_CHECK(Inside != 0);
+					Covered++;
+				}
+				Overflow = Overflow || Inside > (uint32_t)Changes_IsDirty(&C, TileX, TileY);
+			}
+		}
+		TEST_CHECK(Covered == DirtyCount);
+
+		if (Overflow)
+		{
+			TEST_CHECK(RectCount == MaxRects);
+		}
+
+		Changes_Release(&C);
+	}
+}
+
+//
+// benchmark
+
+static void Bench_Hash(uint32_t Width, uint32_t Height)
+{
+	uint64_t Random = 49;
+	uint32_t Pitch = (Width * 4 + 255) & ~255;
+	uint8_t* Pixels = Frame_Create(Width, Height, Pitch, &Random);
+
+	static const struct
+	{
+		const char* Name;
+		TileHash_TileProc* Proc;
+	}
+	Procs[] =
+	{
+		{ "C", &TileHash_TileC },
+#if TILEHASH_SIMD
+		{ "SSE2", &TileHash_TileSSE2 },
+#endif
+	};
+
+	double Baseline = 0;
+	for (size_t Proc = 0; Proc < sizeof(Procs) / sizeof(*Procs); Proc++)
+	{
+		uint64_t Sum = 0;
+		double Best;
+		TEST_BENCH(0.5, Best,
+			for (uint32_t Y = 0; Y < Height; Y += TILEHASH_SIZE)
+			{
+				uint32_t TileHeight = Height - Y < TILEHASH_SIZE ? Height - Y : TILEHASH_SIZE;
+				for (uint32_t X = 0; X < Width; X += TILEHASH_SIZE)
+				{
+					uint32_t TileWidth = Width - X < TILEHASH_SIZE ? Width - X : TILEHASH_SIZE;
+					Sum += Procs[Proc].Proc(Secret, Pixels + (size_t)Y * Pitch + X * 4, Pitch, TileWidth, TileHeight);
+				}
+			});
+		Baseline = Proc == 0 ? Best : Baseline;
+
+		printf("hash %4ux%-4u %-5s %7.3f ms/frame %6.2f GB/s %5.2fx\n", Width, Height, Procs[Proc].Name, Best * 1e3, (double)Width * Height * 4 / Best / 1e9, Baseline / Best);
+		TEST_CHECK(Sum != 0);
+	}
+
+	// whole detection of typing-sized change, hashes all tiles & builds rectangles
+	Changes C;
+	Changes_Create(&C, Width, Height);
+	Changes_Detect(&C, Pixels, Pitch, false);
+
+	double Best;
+	uint32_t Rounds = 0;
+	TEST_BENCH(0.5, Best,
+		Pixels[(size_t)(Height / 2) * Pitch + Width * 2] ^= 0xff;
+		Changes_Detect(&C, Pixels, Pitch, true);
+		TileHashRect Rects[32];
+		TileHashRect Bounds;
+		Rounds += TileHash_Rects(C.Dirty, C.DirtyPitch, C.RowDirty, Width, Height, Rects, 32, &Bounds));
+
+	printf("detect %4ux%-4u one tile changed %7.3f ms/frame, one thread\n", Width, Height, Best * 1e3);
+	TEST_CHECK(Rounds != 0);
+
+	Changes_Release(&C);
+	free(Pixels);
+}
+
+int main(int ArgCount, char** Args)
+{
+	TileHash_Init(Secret);
+
+	if (Test_IsBench(ArgCount, Args))
+	{
+		Bench_Hash(1920, 1080);
+		Bench_Hash(3840, 2160);
+		return Test_Finish("TileHash bench");
+	}
+
+	Test_HashSame();
+	Test_HashChanges();
+	Test_Frames();
+	Test_Rects();
+	return Test_Finish("TileHash");
+}
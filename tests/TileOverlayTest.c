@@ -0,0 +1,1117 @@
+#include "Test.h"
+#include "../external/TileOverlay.h"
+#include "../external/H264Parse.h"
+
+//
+// TileOverlayTest - lossless overlay from external/TileOverlay.h
+//
+// LZ & tile codec must give back exactly same bytes & pixels for every tile size, for text, UI, gradient & photo
+// content and on both sides of 256 color palette limit, and must never write past Capacity. Decoders get data from
+// network, so valid streams with flipped, inserted & cut bytes, and random bytes go to LZ decoder, palette & color
+// tile decoders, and SEI parsing with record application to layer - they must stay inside their buffers (checked by
+// address sanitizer) and keep layer consistent.
+//
+// protocol test runs sharer & viewer over synthetic desktop session - scrolled & edited document, clock, video &
+// photo - with encoder that delays outputs by few frames, drops some of them & makes keyframes. SEI goes through
+// H264Parse_AccessUnit like on viewer, and after every decoded frame each tile viewer draws must be exactly same as
+// that tile of captured frame that was encoded.
+//
+// benchmark encodes & decodes tiles of each content type and reports bytes & usec per tile, and runs 1080p desktop
+// session reporting overlay bytes per frame, sharer cost per captured frame & viewer cost per decoded frame
+//
+
+enum
+{
+	CONTENT_TEXT,
+	CONTENT_UI,
+	CONTENT_GRADIENT,
+	CONTENT_PHOTO,
+	CONTENT_COUNT,
+};
+
+static const char* ContentNames[CONTENT_COUNT] = { "text", "ui", "gradient", "photo" };
+
+static uint16_t Font[64][14];
+
+static void Font_Init(void)
+{
+	uint64_t Random = 50;
+	for (uint32_t Glyph = 0; Glyph < 64; Glyph++)
+	{
+		for (uint32_t Row = 3; Row < 12; Row++)
+		{
+			Font[Glyph][Row] = (uint16_t)(Test_Random(&Random) & 0x3e);
+		}
+	}
+}
+
+static void Pixel_Set(uint8_t* Pixel, uint32_t Color)
+{
+	Pixel[0] = (uint8_t)Color;
+	Pixel[1] = (uint8_t)(Color >> 8);
+	Pixel[2] = (uint8_t)(Color >> 16);
+	Pixel[3] = 0xff;
+}
+
+// lines of 7x14 glyphs from random font with lighter right edge like antialiasing, some lines are links
+static uint32_t Text_Pixel(uint64_t Seed, uint32_t X, uint32_t Y)
+{
+	uint64_t LineHash = TileHash_Mix64(Seed + Y / 14);
+	uint32_t Column = X / 7;
+	if (Column >= LineHash % 90)
+	{
+		return 0xffffff;
+	}
+
+	uint64_t Char = TileHash_Mix64(LineHash + Column);
+	if (Char % 6 == 0)
+	{
+		return 0xffffff;
+	}
+
+	bool Link = LineHash % 7 == 3;
+	uint32_t Bits = Font[Char % 64][Y % 14];
+	uint32_t Bit = X % 7;
+	if (Bits & (1u << Bit))
+	{
+		return Link ? 0x2060c0 : 0x202020;
+	}
+	if (Bit > 0 && (Bits & (1u << (Bit - 1))))
+	{
+		return Link ? 0xb0c8e8 : 0xc0c0c0;
+	}
+	return 0xffffff;
+}
+
+static uint32_t Gradient_Pixel(uint32_t X, uint32_t Y)
+{
+	return ((X * 3) & 0xff) | (((Y * 2) & 0xff) << 8) | (((X + Y) & 0xff) << 16);
+}
+
+// Width x Height pixels like on desktop, X & Y are position of content, so neighbouring tiles continue it
+static void Content_Fill(uint32_t Content, uint8_t* Pixels, uint32_t Pitch, uint32_t Width, uint32_t Height, uint32_t X0, uint32_t Y0, uint64_t Seed)
+{
+	uint64_t Random = Seed;
+
+	if (Content == CONTENT_UI)
+	{
+		static const uint32_t Colors[] = { 0xf0f0f0, 0xffffff, 0x0078d7, 0xe1e1e1, 0x333333, 0xcce4f7 };
+		for (uint32_t Y = 0; Y < Height; Y++)
+		{
+			for (uint32_t X = 0; X < Width; X++)
+			{
+				Pixel_Set(Pixels + (size_t)Y * Pitch + X * 4, Colors[0]);
+			}
+		}
+		for (uint32_t Box = 0; Box < 4; Box++)
+		{
+			uint32_t Left = Test_RandomRange(&Random, Width);
+			uint32_t Top = Test_RandomRange(&Random, Height);
+			uint32_t Right = Left + 1 + Test_RandomRange(&Random, Width - Left);
+			uint32_t Bottom = Top + 1 + Test_RandomRange(&Random, Height - Top);
+			uint32_t Fill = Colors[1 + Test_RandomRange(&Random, 5)];
+			for (uint32_t Y = Top; Y < Bottom; Y++)
+			{
+				for (uint32_t X = Left; X < Right; X++)
+				{
+					bool Border = X == Left || Y == Top || X == Right - 1 || Y == Bottom - 1;
+					Pixel_Set(Pixels + (size_t)Y * Pitch + X * 4, Border ? 0xadadad : Fill);
+				}
+			}
+		}
+		return;
+	}
+
+	for (uint32_t Y = 0; Y < Height; Y++)
+	{
+		for (uint32_t X = 0; X < Width; X++)
+		{
+			uint32_t Color;
+			if (Content == CONTENT_TEXT)
+			{
+				Color = Text_Pixel(Seed, X0 + X, Y0 + Y);
+			}
+			else if (Content == CONTENT_GRADIENT)
+			{
+				Color = Gradient_Pixel(X0 + X, Y0 + Y);
+			}
+			else
+			{
+				// smooth base with sensor noise
+				uint32_t Base = Gradient_Pixel(X0 + X, Y0 + Y);
+				uint64_t Noise = Test_Random(&Random);
+				Color = 0;
+				for (uint32_t Channel = 0; Channel < 24; Channel += 8)
+				{
+					int32_t Value = (int32_t)((Base >> Channel) & 0xff) + (int32_t)((Noise >> Channel) & 31) - 16;
+					Value = Value < 0 ? 0 : Value > 255 ? 255 : Value;
+					Color |= (uint32_t)Value << Channel;
+				}
+			}
+			Pixel_Set(Pixels + (size_t)Y * Pitch + X * 4, Color);
+		}
+	}
+}
+
+// decoded tile has same colors & opaque alpha
+static bool Tile_Same(const uint8_t* Expected, uint32_t ExpectedPitch, const uint8_t* Pixels, uint32_t Pitch, uint32_t Width, uint32_t Height)
+{
+	for (uint32_t Y = 0; Y < Height; Y++)
+	{
+		for (uint32_t X = 0; X < Width; X++)
+		{
+			const uint8_t* A = Expected + (size_t)Y * ExpectedPitch + X * 4;
+			const uint8_t* B = Pixels + (size_t)Y * Pitch + X * 4;
+			if (A[0] != B[0] || A[1] != B[1] || A[2] != B[2] || B[3] != 0xff)
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+//
+// LZ
+
+static void Lz_Fill(uint8_t* Data, uint32_t Size, uint32_t Alphabet, uint32_t MaxRun, uint64_t* Random)
+{
+	uint32_t Pos = 0;
+	while (Pos < Size)
+	{
+		uint8_t Value = (uint8_t)Test_RandomRange(Random, Alphabet);
+		uint32_t Run = 1 + Test_RandomRange(Random, MaxRun);
+		for (; Run && Pos < Size; Run--)
+		{
+			Data[Pos++] = Value;
+		}
+	}
+}
+
+static void Test_Lz(void)
+{
+	uint64_t Random = 51;
+
+	enum { MaxSize = TILEHASH_SIZE * TILEHASH_SIZE * 3 };
+	uint8_t* Input = Test_Alloc(MaxSize);
+	uint8_t* Compressed = Test_Alloc(MaxSize + MaxSize / 255 + 2);
+	uint8_t* Output = Test_Alloc(MaxSize + 1);
+
+	static const uint32_t Sizes[] = { 0, 1, 3, 4, 5, 15, 16, 19, 270, 1000, 4096, MaxSize };
+	static const uint32_t Alphabets[] = { 1, 2, 4, 16, 256 };
+	static const uint32_t Runs[] = { 1, 3, 40, 300 };
+
+	for (size_t SizeIndex = 0; SizeIndex < sizeof(Sizes) / sizeof(*Sizes); SizeIndex++)
+	{
+		for (size_t Alphabet = 0; Alphabet < sizeof(Alphabets) / sizeof(*Alphabets); Alphabet++)
+		{
+			for (size_t Run = 0; Run < sizeof(Runs) / sizeof(*Runs); Run++)
+			{
+				uint32_t Size = Sizes[SizeIndex];
+				Lz_Fill(Input, Size, Alphabets[Alphabet], Runs[Run], &Random);
+
+				// literals only is worst case
+				uint32_t CompressedSize = Overlay_LzCompress(Input, Size, Compressed, Size + Size / 255 + 2);
+				TEST_CHECK(CompressedSize != 0);
+
+				TEST_CHECK(Overlay_LzDecompress(Compressed, CompressedSize, Output, Size));
+				TEST_CHECK(memcmp(Input, Output, Size) == 0);
+
+				// output must be exactly Size
+				TEST_CHECK(!Overlay_LzDecompress(Compressed, CompressedSize, Output, Size + 1));
+				if (Size != 0)
+				{
+					TEST_CHECK(!Overlay_LzDecompress(Compressed, CompressedSize, Output, Size - 1));
+				}
+
+				// smaller capacity fails without writing past it
+				uint32_t Capacities[] = { 0, CompressedSize / 2, CompressedSize - 1 };
+				for (size_t Capacity = 0; Capacity < sizeof(Capacities) / sizeof(*Capacities); Capacity++)
+				{
+					uint8_t* Small = Test_Alloc(Capacities[Capacity]);
+					TEST_CHECK(Overlay_LzCompress(Input, Size, Small, Capacities[Capacity]) == 0);
+					free(Small);
+				}
+			}
+		}
+	}
+
+	free(Input);
+	free(Compressed);
+	free(Output);
+}
+
+// changes valid data like corrupted or hostile network input, returns new size
+static uint32_t Fuzz_Mutate(uint8_t* Data, uint32_t Size, uint32_t Capacity, uint32_t Start, uint64_t* Random)
+{
+	uint32_t Count = 1 + Test_RandomRange(Random, 4);
+	for (uint32_t Mutation = 0; Mutation < Count; Mutation++)
+	{
+		uint32_t Pos = Size > Start ? Start + Test_RandomRange(Random, Size - Start) : Size;
+		switch (Test_RandomRange(Random, 6))
+		{
+		case 0: // flipped bits
+			if (Pos < Size)
+			{
+				Data[Pos] ^= (uint8_t)(1 + Test_RandomRange(Random, 255));
+			}
+			break;
+
+		case 1: // lengths & counts at their limits
+			if (Pos < Size)
+			{
+				static const uint8_t Values[] = { 0, 1, 15, 0x0f, 0xf0, 0xff };
+				Data[Pos] = Values[Test_RandomRange(Random, sizeof(Values))];
+			}
+			break;
+
+		case 2: // cut
+			Size = Pos;
+			break;
+
+		case 3: // inserted bytes
+			if (Size < Capacity)
+			{
+				uint32_t Insert = 1 + Test_RandomRange(Random, Capacity - Size < 8 ? Capacity - Size : 8);
+				memmove(Data + Pos + Insert, Data + Pos, Size - Pos);
+				for (uint32_t Index = 0; Index < Insert; Index++)
+				{
+					Data[Pos + Index] = (uint8_t)Test_Random(Random);
+				}
+				Size += Insert;
+			}
+			break;
+
+		case 4: // removed bytes
+			if (Pos < Size)
+			{
+				uint32_t Remove = 1 + Test_RandomRange(Random, Size - Pos < 8 ? Size - Pos : 8);
+				memmove(Data + Pos, Data + Pos + Remove, Size - Pos - Remove);
+				Size -= Remove;
+			}
+			break;
+
+		case 5: // random tail
+			for (uint32_t Index = Pos; Index < Size; Index++)
+			{
+				Data[Index] = (uint8_t)Test_Random(Random);
+			}
+			break;
+		}
+	}
+	return Size;
+}
+
+static void Test_LzFuzz(void)
+{
+	uint64_t Random = 52;
+
+	enum { MaxSize = 3000, Capacity = 2 * MaxSize };
+	uint8_t* Input = Test_Alloc(MaxSize);
+	uint8_t* Compressed = Test_Alloc(Capacity);
+
+	uint32_t Rejected = 0;
+	uint32_t Rounds = 50000;
+	for (uint32_t Round = 0; Round < Rounds; Round++)
+	{
+		uint32_t Size = Test_RandomRange(&Random, MaxSize);
+		uint32_t CompressedSize;
+		if (Round % 8 == 0)
+		{
+			CompressedSize = Test_RandomRange(&Random, 64);
+			for (uint32_t Index = 0; Index < CompressedSize; Index++)
+			{
+				Compressed[Index] = (uint8_t)Test_Random(&Random);
+			}
+		}
+		else
+		{
+			Lz_Fill(Input, Size, 1 + Test_RandomRange(&Random, 16), 1 + Test_RandomRange(&Random, 100), &Random);
+			CompressedSize = Overlay_LzCompress(Input, Size, Compressed, Capacity);
+			CompressedSize = Fuzz_Mutate(Compressed, CompressedSize, Capacity, 0, &Random);
+		}
+
+		// exactly sized output, so any write past Size is caught
+		uint8_t* Output = Test_Alloc(Size);
+		Rejected += !Overlay_LzDecompress(Compressed, CompressedSize, Output, Size);
+		free(Output);
+	}
+	TEST_CHECK(Rejected > Rounds / 2);
+
+	free(Input);
+	free(Compressed);
+}
+
+//
+// tiles
+
+static void Test_Tiles(void)
+{
+	static const uint32_t Sizes[][2] = { { 64, 64 }, { 1, 1 }, { 1, 64 }, { 64, 1 }, { 13, 17 }, { 63, 64 }, { 33, 9 }, { 64, 40 } };
+
+	enum { Pitch = TILEHASH_SIZE * 4 + 12, Capacity = TILEHASH_SIZE * TILEHASH_SIZE * 4 };
+	uint8_t* Pixels = Test_Alloc(Pitch * TILEHASH_SIZE);
+	uint8_t* Data = Test_Alloc(Capacity);
+
+	for (uint32_t Content = 0; Content < CONTENT_COUNT; Content++)
+	{
+		for (size_t Size = 0; Size < sizeof(Sizes) / sizeof(*Sizes); Size++)
+		{
+			for (uint64_t Seed = 0; Seed < 4; Seed++)
+			{
+				uint32_t Width = Sizes[Size][0];
+				uint32_t Height = Sizes[Size][1];
+				Content_Fill(Content, Pixels, Pitch, Width, Height, (uint32_t)Seed * 37, (uint32_t)Seed * 91, Seed);
+
+				uint8_t Type;
+				uint32_t Encoded = Overlay_EncodeTile(Pixels, Pitch, Width, Height, Data, Capacity, &Type);
+				TEST_CHECK(Encoded != 0);
+				if (Content == CONTENT_TEXT || Content == CONTENT_UI)
+				{
+					TEST_CHECK(Type == OVERLAY_PALETTE);
+				}
+				else if (Width * Height >= 1024)
+				{
+					TEST_CHECK(Type == OVERLAY_COLOR);
+				}
+
+				// decoded into exactly sized buffer with other pitch
+				uint8_t* Decoded = Test_Alloc(Width * Height * 4);
+				TEST_CHECK(Overlay_DecodeTile(Type, Data, Encoded, Decoded, Width * 4, Width, Height));
+				TEST_CHECK(Tile_Same(Pixels, Pitch, Decoded, Width * 4, Width, Height));
+				free(Decoded);
+
+				uint32_t Capacities[] = { 0, Encoded / 2, Encoded - 1 };
+				for (size_t Small = 0; Small < sizeof(Capacities) / sizeof(*Capacities); Small++)
+				{
+					uint8_t* Output = Test_Alloc(Capacities[Small]);
+					TEST_CHECK(Overlay_EncodeTile(Pixels, Pitch, Width, Height, Output, Capacities[Small], &Type) == 0);
+					free(Output);
+				}
+			}
+		}
+	}
+
+	// palette limit, 256 colors are palette & 257 are not
+	for (uint32_t Count = 255; Count <= 258; Count++)
+	{
+		for (uint32_t Index = 0; Index < TILEHASH_SIZE * TILEHASH_SIZE; Index++)
+		{
+			Pixel_Set(Pixels + Index / TILEHASH_SIZE * Pitch + Index % TILEHASH_SIZE * 4, (Index % Count) * 0x010203);
+		}
+
+		uint8_t Type;
+		uint32_t Encoded = Overlay_EncodeTile(Pixels, Pitch, TILEHASH_SIZE, TILEHASH_SIZE, Data, Capacity, &Type);
+		TEST_CHECK(Encoded != 0);
+		TEST_CHECK(Type == (Count <= 256 ? OVERLAY_PALETTE : OVERLAY_COLOR));
+
+		uint8_t* Decoded = Test_Alloc(TILEHASH_SIZE * TILEHASH_SIZE * 4);
+		TEST_CHECK(Overlay_DecodeTile(Type, Data, Encoded, Decoded, TILEHASH_SIZE * 4, TILEHASH_SIZE, TILEHASH_SIZE));
+		TEST_CHECK(Tile_Same(Pixels, Pitch, Decoded, TILEHASH_SIZE * 4, TILEHASH_SIZE, TILEHASH_SIZE));
+		free(Decoded);
+	}
+
+	// noise is left to video
+	uint64_t Random = 53;
+	for (uint32_t Index = 0; Index < Pitch * TILEHASH_SIZE; Index++)
+	{
+		Pixels[Index] = (uint8_t)Test_Random(&Random);
+	}
+	uint8_t Type;
+	TEST_CHECK(Overlay_EncodeTile(Pixels, Pitch, TILEHASH_SIZE, TILEHASH_SIZE, Data, OVERLAY_MAX_TILE, &Type) == 0);
+
+	free(Pixels);
+	free(Data);
+}
+
+static void Test_TileFuzz(void)
+{
+	uint64_t Random = 54;
+
+	enum { Pitch = TILEHASH_SIZE * 4, Capacity = TILEHASH_SIZE * TILEHASH_SIZE * 4 };
+	uint8_t* Pixels = Test_Alloc(Pitch * TILEHASH_SIZE);
+	uint8_t* Data = Test_Alloc(Capacity);
+
+	uint32_t Decoded = 0;
+	uint32_t Rounds = 20000;
+	for (uint32_t Round = 0; Round < Rounds; Round++)
+	{
+		uint32_t Content = Test_RandomRange(&Random, CONTENT_COUNT);
+		uint32_t Width = 1 + Test_RandomRange(&Random, TILEHASH_SIZE);
+		uint32_t Height = 1 + Test_RandomRange(&Random, TILEHASH_SIZE);
+		Content_Fill(Content, Pixels, Pitch, Width, Height, 0, 0, Round);
+
+		uint8_t Type;
+		uint32_t Size = Overlay_EncodeTile(Pixels, Pitch, Width, Height, Data, Capacity, &Type);
+		TEST_CHECK(Size != 0);
+
+		// palette count, palette & packed indices, or residuals, and sometimes wrong record type
+		Size = Fuzz_Mutate(Data, Size, Capacity, 0, &Random);
+		if (Test_RandomRange(&Random, 8) == 0)
+		{
+			Type = (uint8_t)Test_RandomRange(&Random, 5);
+		}
+
+		// tile can be decoded to other size than it was encoded with
+		if (Test_RandomRange(&Random, 8) == 0)
+		{
+			Width = 1 + Test_RandomRange(&Random, TILEHASH_SIZE);
+			Height = 1 + Test_RandomRange(&Random, TILEHASH_SIZE);
+		}
+
+		uint8_t* Output = Test_Alloc(Width * Height * 4);
+		if (Overlay_DecodeTile(Type, Data, Size, Output, Width * 4, Width, Height))
+		{
+			Decoded++;
+			bool Opaque = true;
+			for (uint32_t Index = 0; Index < Width * Height; Index++)
+			{
+				Opaque &= Output[Index * 4 + 3] == 0xff;
+			}
+			TEST_CHECK(Opaque);
+		}
+		free(Output);
+	}
+	TEST_CHECK(Decoded < Rounds);
+
+	free(Pixels);
+	free(Data);
+}
+
+//
+// desktop session
+
+typedef struct
+{
+	uint32_t Width;
+	uint32_t Height;
+	uint32_t Pitch;
+	uint8_t* Pixels;
+
+	TileHashRect View;		// document window
+	TileHashRect Clock;		// changes every second
+	TileHashRect Video;		// changes every frame
+	uint32_t DocumentHeight;
+	uint8_t* Document;		// View width
+	int32_t Offset;			// document row at top of View
+	uint32_t Frame;
+	uint64_t Random;
+}
+Desktop;
+
+static void Desktop_DrawView(Desktop* D)
+{
+	uint32_t Width = D->View.Right - D->View.Left;
+	for (int32_t Y = D->View.Top; Y < D->View.Bottom; Y++)
+	{
+		memcpy(D->Pixels + (size_t)Y * D->Pitch + D->View.Left * 4, D->Document + (size_t)(D->Offset + Y - D->View.Top) * Width * 4, Width * 4);
+	}
+}
+
+static void Desktop_Fill(Desktop* D, const TileHashRect* Rect, uint32_t Content, uint64_t Seed)
+{
+	Content_Fill(Content, D->Pixels + (size_t)Rect->Top * D->Pitch + Rect->Left * 4, D->Pitch, Rect->Right - Rect->Left, Rect->Bottom - Rect->Top, Rect->Left, Rect->Top, Seed);
+}
+
+// gradient wallpaper, document window, photo, clock & video, sizes relative to frame
+static void Desktop_Create(Desktop* D, uint32_t Width, uint32_t Height, uint64_t Seed)
+{
+	D->Width = Width;
+	D->Height = Height;
+	D->Pitch = Width * 4 + 64;
+	D->Pixels = Test_Alloc((size_t)D->Pitch * Height);
+	D->Frame = 0;
+	D->Random = Seed;
+
+	TileHashRect Frame = { 0, 0, (int32_t)Width, (int32_t)Height };
+	Desktop_Fill(D, &Frame, CONTENT_GRADIENT, Seed);
+
+	int32_t W = Width, H = Height;
+	TileHashRect Photo = { W * 3 / 4, H / 10, W * 19 / 20, H * 4 / 10 };
+	Desktop_Fill(D, &Photo, CONTENT_PHOTO, Seed);
+	TileHashRect Toolbar = { W / 20, H / 20, W * 7 / 10, H / 10 };
+	Desktop_Fill(D, &Toolbar, CONTENT_UI, Seed);
+
+	D->View = (TileHashRect){ W / 20 + 3, H / 10, W * 7 / 10, H * 19 / 20 - 5 };
+	D->Clock = (TileHashRect){ W * 3 / 4, H / 2, W * 3 / 4 + 80, H / 2 + 14 };
+	D->Video = (TileHashRect){ W * 3 / 4, H * 6 / 10, W * 19 / 20, H * 8 / 10 };
+
+	uint32_t ViewWidth = D->View.Right - D->View.Left;
+	D->DocumentHeight = (D->View.Bottom - D->View.Top) * 8;
+	D->Document = Test_Alloc((size_t)ViewWidth * D->DocumentHeight * 4);
+	Content_Fill(CONTENT_TEXT, D->Document, ViewWidth * 4, ViewWidth, D->DocumentHeight, 0, 0, Seed);
+	D->Offset = 0;
+	Desktop_DrawView(D);
+}
+
+static void Desktop_Release(Desktop* D)
+{
+	free(D->Pixels);
+	free(D->Document);
+}
+
+// document scrolled by Amount rows, returns offset of content inside View, 0 when nothing moved
+static int32_t Desktop_Scroll(Desktop* D, int32_t Amount)
+{
+	int32_t Max = (int32_t)D->DocumentHeight - (D->View.Bottom - D->View.Top);
+	int32_t Offset = D->Offset + Amount;
+	Offset = Offset < 0 ? 0 : Offset > Max ? Max : Offset;
+
+	int32_t DY = D->Offset - Offset;
+	D->Offset = Offset;
+	Desktop_DrawView(D);
+	return DY;
+}
+
+// region of View that has same content as before scroll by DY, returns false when there is none
+static bool Desktop_Moved(const Desktop* D, int32_t DY, TileHashRect* Moved)
+{
+	int32_t Height = D->View.Bottom - D->View.Top;
+	if (DY == 0 || DY >= Height || -DY >= Height)
+	{
+		return false;
+	}
+	*Moved = D->View;
+	if (DY > 0)
+	{
+		Moved->Top += DY;
+	}
+	else
+	{
+		Moved->Bottom += DY;
+	}
+	return true;
+}
+
+// one glyph typed in visible part of document
+static void Desktop_Type(Desktop* D)
+{
+	uint32_t ViewWidth = D->View.Right - D->View.Left;
+	uint32_t X = 7 * Test_RandomRange(&D->Random, ViewWidth / 7);
+	uint32_t Y = D->Offset + 14 * Test_RandomRange(&D->Random, (D->View.Bottom - D->View.Top) / 14);
+	uint16_t* Glyph = Font[Test_RandomRange(&D->Random, 64)];
+	for (uint32_t Row = 0; Row < 14; Row++)
+	{
+		for (uint32_t Column = 0; Column < 7; Column++)
+		{
+			Pixel_Set(D->Document + ((size_t)(Y + Row) * ViewWidth + X + Column) * 4, Glyph[Row] & (1u << Column) ? 0x202020 : 0xffffff);
+		}
+	}
+	Desktop_DrawView(D);
+}
+
+// clock & video, and now and then typing or scroll, returns scroll offset of View
+static int32_t Desktop_Step(Desktop* D)
+{
+	D->Frame++;
+	if (D->Frame % 30 == 0)
+	{
+		Desktop_Fill(D, &D->Clock, CONTENT_TEXT, D->Frame);
+	}
+	Desktop_Fill(D, &D->Video, CONTENT_PHOTO, D->Frame);
+
+	uint32_t Event = Test_RandomRange(&D->Random, 32);
+	if (Event < 1)
+	{
+		static const int32_t Amounts[] = { 3, -3, 40, -40, 120, -120, 600, -600 };
+		return Desktop_Scroll(D, Amounts[Test_RandomRange(&D->Random, sizeof(Amounts) / sizeof(*Amounts))]);
+	}
+	if (Event < 3)
+	{
+		Desktop_Type(D);
+	}
+	return 0;
+}
+
+typedef struct
+{
+	uint32_t Width;
+	uint32_t Height;
+	uint32_t TilesX;
+	uint32_t TilesY;
+	uint32_t DirtyPitch;
+	uint64_t Secret[TILEHASH_SECRET_COUNT];
+	uint64_t* Hashes;
+	uint32_t* Dirty;
+	bool Valid;
+}
+Changes;
+
+static void Changes_Create(Changes* C, uint32_t Width, uint32_t Height)
+{
+	C->Width = Width;
+	C->Height = Height;
+	C->TilesX = (Width + TILEHASH_SIZE - 1) / TILEHASH_SIZE;
+	C->TilesY = (Height + TILEHASH_SIZE - 1) / TILEHASH_SIZE;
+	C->DirtyPitch = (C->TilesX + 31) / 32;
+	TileHash_Init(C->Secret);
+	C->Hashes = Test_Alloc(C->TilesX * C->TilesY * sizeof(*C->Hashes));
+	C->Dirty = Test_Alloc(C->DirtyPitch * C->TilesY * sizeof(*C->Dirty));
+	C->Valid = false;
+}
+
+static void Changes_Release(Changes* C)
+{
+	free(C->Hashes);
+	free(C->Dirty);
+}
+
+// same as Buddy_DetectChanges, on one thread
+static void Changes_Detect(Changes* C, const uint8_t* Pixels, uint32_t Pitch)
+{
+	for (uint32_t TileY = 0; TileY < C->TilesY; TileY++)
+	{
+		uint32_t Y = TileY * TILEHASH_SIZE;
+		uint32_t Height = C->Height - Y < TILEHASH_SIZE ? C->Height - Y : TILEHASH_SIZE;
+		TileHash_TileRow(C->Secret, Pixels + (size_t)Y * Pitch, Pitch, C->Width, Height, C->Hashes + TileY * C->TilesX, C->Dirty + TileY * C->DirtyPitch, C->Valid);
+	}
+	C->Valid = true;
+}
+
+typedef struct
+{
+	const OverlayLayer* Layer;
+	uint32_t Updates;
+	uint32_t Outside;
+}
+UpdateCheck;
+
+static void Update_Check(void* Context, uint32_t X, uint32_t Y, uint32_t Width, uint32_t Height)
+{
+	UpdateCheck* Check = Context;
+	Check->Updates++;
+	Check->Outside += Width == 0 || Height == 0 || X + Width > Check->Layer->Width || Y + Height > Check->Layer->Height;
+}
+
+// valid tiles that are not same as frame
+static uint32_t Layer_Mismatches(const OverlayLayer* Layer, const uint8_t* Pixels, uint32_t Pitch)
+{
+	uint32_t Mismatches = 0;
+	for (uint32_t Index = 0; Index < Layer->TilesX * Layer->TilesY; Index++)
+	{
+		if (Layer->Valid[Index])
+		{
+			uint32_t X = Index % Layer->TilesX * TILEHASH_SIZE;
+			uint32_t Y = Index / Layer->TilesX * TILEHASH_SIZE;
+			uint32_t Width = Layer->Width - X < TILEHASH_SIZE ? Layer->Width - X : TILEHASH_SIZE;
+			uint32_t Height = Layer->Height - Y < TILEHASH_SIZE ? Layer->Height - Y : TILEHASH_SIZE;
+			Mismatches += !Tile_Same(Pixels + (size_t)Y * Pitch + X * 4, Pitch, Layer->Pixels + ((size_t)Y * Layer->Width + X) * 4, Layer->Width * 4, Width, Height);
+		}
+	}
+	return Mismatches;
+}
+
+static bool Layer_CountValid(const OverlayLayer* Layer)
+{
+	uint32_t Count = 0;
+	bool Flags = true;
+	for (uint32_t Index = 0; Index < Layer->TilesX * Layer->TilesY; Index++)
+	{
+		Count += Layer->Valid[Index];
+		Flags &= Layer->Valid[Index] <= 1;
+	}
+	return Flags && Count == Layer->Count;
+}
+
+// encoded frame with SEI before P slice, like Buddy_OverlayAttach makes it, returns its size
+static uint32_t Frame_Attach(OverlaySharer* Sharer, int64_t Time, uint8_t** Frame, uint32_t* SeiSize)
+{
+	static const uint8_t Slice[] = { 0, 0, 0, 1, 0x41, 0x9a, 0x02, 0x04, 0x80 };
+
+	uint32_t MaxSize = Overlay_SharerSeiSize(Sharer, Time);
+	if (MaxSize == 0)
+	{
+		return 0;
+	}
+
+	*Frame = Test_Alloc(MaxSize + sizeof(Slice));
+	*SeiSize = Overlay_SharerWriteSei(Sharer, Time, *Frame);
+	TEST_CHECK(*SeiSize <= MaxSize);
+	memcpy(*Frame + *SeiSize, Slice, sizeof(Slice));
+	return *SeiSize + (uint32_t)sizeof(Slice);
+}
+
+// records from encoded frame applied same way as Buddy_OverlayApply does
+static void Frame_Apply(OverlayLayer* Layer, const uint8_t* Frame, uint32_t FrameSize, uint32_t SeiSize, UpdateCheck* Check)
+{
+	H264Info Info;
+	TEST_CHECK(H264Parse_AccessUnit(Frame, FrameSize, Overlay_Uuid, &Info));
+	TEST_CHECK(Info.UserData && Info.UserDataSize == SeiSize - 4);
+	if (!Info.UserData)
+	{
+		return;
+	}
+
+	uint8_t* Payload = Test_Alloc(Info.UserDataSize);
+	const uint8_t* Records;
+	uint32_t RecordsSize, Width, Height;
+	TEST_CHECK(Overlay_ParseSei(Info.UserData, Info.UserDataSize, Payload, &Records, &RecordsSize, &Width, &Height));
+	if (Width != Layer->Width || Height != Layer->Height)
+	{
+		Overlay_ReleaseLayer(Layer);
+		TEST_CHECK(Overlay_CreateLayer(Layer, Width, Height));
+	}
+	Check->Layer = Layer;
+	Overlay_ApplyRecords(Layer, Records, RecordsSize, &Update_Check, Check);
+	free(Payload);
+}
+
+typedef struct
+{
+	uint32_t Frames;
+	uint32_t MaxDelay;		// frames between capture & encoder output
+	uint32_t DropRate;		// one of DropRate frames is dropped by encoder, 0 for none
+	uint32_t KeyInterval;
+
+	// results
+	uint32_t Outputs;
+	uint32_t Drops;
+	uint32_t Keyframes;
+	uint32_t Scrolls;
+	uint32_t Mismatches;
+	uint32_t MaxValid;
+	uint64_t Bytes;			// SEI
+	double SharerTime;
+	double ViewerTime;
+}
+Session;
+
+static void Session_Run(Session* S, uint32_t Width, uint32_t Height, uint64_t Seed)
+{
+	enum { History = 32 };
+
+	Desktop D;
+	Desktop_Create(&D, Width, Height, Seed);
+
+	Changes C;
+	Changes_Create(&C, Width, Height);
+
+	OverlaySharer Sharer;
+	TEST_CHECK(Overlay_CreateSharer(&Sharer, Width, Height));
+	OverlayLayer Layer = { 0 };
+	UpdateCheck Check = { 0 };
+
+	uint8_t* Screens[History];
+	uint32_t Ready[History];
+	for (uint32_t Index = 0; Index < History; Index++)
+	{
+		Screens[Index] = Test_Alloc((size_t)D.Pitch * Height);
+	}
+
+	uint64_t Random = Seed;
+	uint32_t Read = 0;
+	for (uint32_t Frame = 0; Read < S->Frames; Frame++)
+	{
+		if (Frame < S->Frames)
+		{
+			int32_t DY = Frame ? Desktop_Step(&D) : 0;
+
+			double Start = Test_Time();
+			Changes_Detect(&C, D.Pixels, D.Pitch);
+			TileHashRect Moved;
+			bool Scrolled = Desktop_Moved(&D, DY, &Moved);
+			Overlay_SharerChanges(&Sharer, C.Dirty, C.DirtyPitch, Scrolled ? &Moved : NULL, 0, DY);
+			Overlay_SharerQueueFrame(&Sharer, Frame, D.Pixels, D.Pitch);
+			S->SharerTime += Test_Time() - Start;
+			S->Scrolls += Scrolled;
+
+			memcpy(Screens[Frame % History], D.Pixels, (size_t)D.Pitch * Height);
+			Ready[Frame % History] = Frame + Test_RandomRange(&Random, S->MaxDelay + 1);
+		}
+
+		// outputs come in order, each one waits for all before it
+		while (Read < S->Frames && Read <= Frame && (Ready[Read % History] <= Frame || Frame >= S->Frames))
+		{
+			uint32_t Time = Read++;
+			if (Time % S->KeyInterval == 0)
+			{
+				Overlay_SharerKeyFrame(&Sharer);
+				Overlay_ResetLayer(&Layer);
+				S->Keyframes++;
+			}
+			else if (S->DropRate && Test_RandomRange(&Random, S->DropRate) == 0)
+			{
+				S->Drops++;
+				continue;
+			}
+			else
+			{
+				double Start = Test_Time();
+				uint8_t* Encoded;
+				uint32_t SeiSize;
+				uint32_t EncodedSize = Frame_Attach(&Sharer, Time, &Encoded, &SeiSize);
+				double Middle = Test_Time();
+				if (EncodedSize)
+				{
+					Frame_Apply(&Layer, Encoded, EncodedSize, SeiSize, &Check);
+					free(Encoded);
+					S->Bytes += SeiSize;
+				}
+				S->SharerTime += Middle - Start;
+				S->ViewerTime += Test_Time() - Middle;
+			}
+
+			S->Outputs++;
+			if (Layer.Valid)
+			{
+				S->Mismatches += Layer_Mismatches(&Layer, Screens[Time % History], D.Pitch);
+				S->MaxValid = Layer.Count > S->MaxValid ? Layer.Count : S->MaxValid;
+				TEST_CHECK(Layer_CountValid(&Layer));
+			}
+		}
+		TEST_CHECK(Frame + 1 - Read <= History);
+	}
+	TEST_CHECK(Check.Outside == 0);
+
+	for (uint32_t Index = 0; Index < History; Index++)
+	{
+		free(Screens[Index]);
+	}
+	Overlay_ReleaseLayer(&Layer);
+	Overlay_ReleaseSharer(&Sharer);
+	Changes_Release(&C);
+	Desktop_Release(&D);
+}
+
+static void Test_Protocol(void)
+{
+	static const Session Sessions[] =
+	{
+		{ .Frames = 300, .MaxDelay = 0, .DropRate = 0, .KeyInterval = 1000 },
+		{ .Frames = 400, .MaxDelay = 5, .DropRate = 8, .KeyInterval = 90 },
+		{ .Frames = 300, .MaxDelay = 12, .DropRate = 3, .KeyInterval = 37 },
+	};
+	static const uint32_t Sizes[][2] = { { 640, 360 }, { 600, 350 } };
+
+	for (size_t Index = 0; Index < sizeof(Sessions) / sizeof(*Sessions); Index++)
+	{
+		for (size_t Size = 0; Size < sizeof(Sizes) / sizeof(*Sizes); Size++)
+		{
+			Session S = Sessions[Index];
+			Session_Run(&S, Sizes[Size][0], Sizes[Size][1], 55 + Index);
+
+			TEST_CHECK(S.Outputs + S.Drops == S.Frames);
+			TEST_CHECK(S.Mismatches == 0);
+			TEST_CHECK(S.Scrolls != 0);
+			TEST_CHECK(S.MaxValid > Sizes[Size][0] * Sizes[Size][1] / (TILEHASH_SIZE * TILEHASH_SIZE) / 2);
+		}
+	}
+}
+
+static void Test_ApplyFuzz(void)
+{
+	uint64_t Random = 56;
+
+	// valid SEI from short session with tiles, clears & scrolls
+	enum { MaxFrames = 64 };
+	uint8_t* Frames[MaxFrames];
+	uint32_t Sizes[MaxFrames];
+	uint32_t FrameCount = 0;
+	{
+		Desktop D;
+		Desktop_Create(&D, 300, 200, 57);
+		Changes C;
+		Changes_Create(&C, D.Width, D.Height);
+		OverlaySharer Sharer;
+		TEST_CHECK(Overlay_CreateSharer(&Sharer, D.Width, D.Height));
+
+		for (uint32_t Frame = 0; FrameCount < MaxFrames && Frame < 1000; Frame++)
+		{
+			int32_t DY = Frame > 20 && Frame % 4 == 0 ? Desktop_Scroll(&D, Frame % 8 ? 17 : -33) : Frame ? Desktop_Step(&D) : 0;
+			Changes_Detect(&C, D.Pixels, D.Pitch);
+			TileHashRect Moved;
+			bool Scrolled = Desktop_Moved(&D, DY, &Moved);
+			Overlay_SharerChanges(&Sharer, C.Dirty, C.DirtyPitch, Scrolled ? &Moved : NULL, 0, DY);
+			Overlay_SharerQueueFrame(&Sharer, Frame, D.Pixels, D.Pitch);
+
+			uint32_t SeiSize;
+			if (Frame_Attach(&Sharer, Frame, &Frames[FrameCount], &SeiSize))
+			{
+				Sizes[FrameCount++] = SeiSize;
+			}
+		}
+
+		Overlay_ReleaseSharer(&Sharer);
+		Changes_Release(&C);
+		Desktop_Release(&D);
+	}
+	TEST_CHECK(FrameCount == MaxFrames);
+
+	OverlayLayer Layer;
+	TEST_CHECK(Overlay_CreateLayer(&Layer, 300, 200));
+	UpdateCheck Check = { .Layer = &Layer };
+
+	uint32_t Applied = 0;
+	uint32_t Rounds = 20000;
+	for (uint32_t Round = 0; Round < Rounds; Round++)
+	{
+		uint32_t Frame = Test_RandomRange(&Random, FrameCount);
+		uint32_t Capacity = Sizes[Frame] + 64;
+		uint8_t* Nal = Test_Alloc(Capacity);
+		memcpy(Nal, Frames[Frame] + 4, Sizes[Frame] - 4);
+
+		// SEI header, payload size & UUID are mutated less often than records
+		uint32_t Start = Test_RandomRange(&Random, 4) == 0 ? 0 : 2 + 1 + (uint32_t)sizeof(Overlay_Uuid);
+		uint32_t NalSize = Fuzz_Mutate(Nal, Sizes[Frame] - 4, Capacity, Start, &Random);
+
+		uint8_t* Payload = Test_Alloc(NalSize);
+		const uint8_t* Records;
+		uint32_t RecordsSize, Width, Height;
+		if (Overlay_ParseSei(Nal, NalSize, Payload, &Records, &RecordsSize, &Width, &Height) && Width * Height <= 1024 * 1024)
+		{
+			if (Width != Layer.Width || Height != Layer.Height)
+			{
+				Overlay_ReleaseLayer(&Layer);
+				TEST_CHECK(Overlay_CreateLayer(&Layer, Width, Height));
+			}
+
+			// records are also applied out of order to layer in any state
+			Overlay_ApplyRecords(&Layer, Records, RecordsSize, &Update_Check, &Check);
+			TEST_CHECK(Layer_CountValid(&Layer));
+			Applied++;
+		}
+		free(Payload);
+		free(Nal);
+
+		if (Round % 64 == 0)
+		{
+			Overlay_ResetLayer(&Layer);
+		}
+	}
+	TEST_CHECK(Applied > Rounds / 4);
+	TEST_CHECK(Check.Outside == 0);
+
+	// random records with fields mostly in range
+	for (uint32_t Round = 0; Round < Rounds; Round++)
+	{
+		uint8_t Records[256];
+		uint32_t Size = 0;
+		while (Size + 16 < sizeof(Records))
+		{
+			uint8_t Type = (uint8_t)Test_RandomRange(&Random, 5);
+			Records[Size++] = Type;
+			if (Type == OVERLAY_COPY)
+			{
+				uint16_t Rect[4];
+				int16_t Offset[2];
+				for (uint32_t Index = 0; Index < 4; Index++)
+				{
+					Rect[Index] = (uint16_t)Test_RandomRange(&Random, Index % 2 ? Layer.Height + 2 : Layer.Width + 2);
+				}
+				Offset[0] = (int16_t)(Test_RandomRange(&Random, 129) - 64);
+				Offset[1] = (int16_t)(Test_RandomRange(&Random, 129) - 64);
+				memcpy(Records + Size, Rect, sizeof(Rect));
+				memcpy(Records + Size + sizeof(Rect), Offset, sizeof(Offset));
+				Size += sizeof(Rect) + sizeof(Offset);
+			}
+			else
+			{
+				uint16_t Tile = (uint16_t)Test_RandomRange(&Random, Layer.TilesX * Layer.TilesY + 2);
+				uint16_t TileSize = (uint16_t)Test_RandomRange(&Random, 8);
+				memcpy(Records + Size, &Tile, sizeof(Tile));
+				memcpy(Records + Size + 2, &TileSize, sizeof(TileSize));
+				Size += 4;
+				for (uint32_t Index = 0; Index < TileSize && Size < sizeof(Records); Index++)
+				{
+					Records[Size++] = (uint8_t)Test_Random(&Random);
+				}
+			}
+		}
+
+		Overlay_ApplyRecords(&Layer, Records, Test_RandomRange(&Random, Size + 1), &Update_Check, &Check);
+		TEST_CHECK(Layer_CountValid(&Layer));
+	}
+	TEST_CHECK(Check.Outside == 0);
+
+	Overlay_ReleaseLayer(&Layer);
+	for (uint32_t Frame = 0; Frame < FrameCount; Frame++)
+	{
+		free(Frames[Frame]);
+	}
+}
+
+//
+// benchmark
+
+static void Bench_Tiles(void)
+{
+	enum { Count = 64, Pitch = TILEHASH_SIZE * 4, Capacity = TILEHASH_SIZE * TILEHASH_SIZE * 4 };
+	uint8_t* Pixels = Test_Alloc((size_t)Count * Pitch * TILEHASH_SIZE);
+	uint8_t* Data = Test_Alloc((size_t)Count * Capacity);
+	uint8_t* Decoded = Test_Alloc(Pitch * TILEHASH_SIZE);
+	uint32_t Sizes[Count];
+	uint8_t Types[Count];
+
+	for (uint32_t Content = 0; Content < CONTENT_COUNT; Content++)
+	{
+		// 8x8 tiles of same content, like part of screen
+		for (uint32_t Tile = 0; Tile < Count; Tile++)
+		{
+			Content_Fill(Content, Pixels + (size_t)Tile * Pitch * TILEHASH_SIZE, Pitch, TILEHASH_SIZE, TILEHASH_SIZE, Tile % 8 * TILEHASH_SIZE, Tile / 8 * TILEHASH_SIZE, Content == CONTENT_UI ? Tile : 59);
+		}
+
+		double Encode;
+		TEST_BENCH(0.5, Encode,
+			for (uint32_t Tile = 0; Tile < Count; Tile++)
+			{
+				Sizes[Tile] = Overlay_EncodeTile(Pixels + (size_t)Tile * Pitch * TILEHASH_SIZE, Pitch, TILEHASH_SIZE, TILEHASH_SIZE, Data + (size_t)Tile * Capacity, Capacity, &Types[Tile]);
+			});
+
+		uint64_t Bytes = 0;
+		uint32_t Rejected = 0;
+		for (uint32_t Tile = 0; Tile < Count; Tile++)
+		{
+			Bytes += Sizes[Tile];
+			Rejected += Sizes[Tile] > OVERLAY_MAX_TILE;
+		}
+
+		uint32_t Valid = 0;
+		double Decode;
+		TEST_BENCH(0.5, Decode,
+			for (uint32_t Tile = 0; Tile < Count; Tile++)
+			{
+				Valid += Overlay_DecodeTile(Types[Tile], Data + (size_t)Tile * Capacity, Sizes[Tile], Decoded, Pitch, TILEHASH_SIZE, TILEHASH_SIZE);
+			});
+		TEST_CHECK(Valid != 0);
+
+		printf("tile %-8s %6.0f bytes (%5.1f%% of RGB) encode %6.1f us decode %6.1f us, %2u of %u over %u bytes\n",
+			ContentNames[Content], (double)Bytes / Count, 100.0 * Bytes / Count / (TILEHASH_SIZE * TILEHASH_SIZE * 3),
+			Encode * 1e6 / Count, Decode * 1e6 / Count, Rejected, Count, OVERLAY_MAX_TILE);
+	}
+
+	free(Pixels);
+	free(Data);
+	free(Decoded);
+}
+
+static void Bench_Session(uint32_t Width, uint32_t Height)
+{
+	Session S = { .Frames = 600, .MaxDelay = 2, .DropRate = 0, .KeyInterval = 100000 };
+	Session_Run(&S, Width, Height, 58);
+	TEST_CHECK(S.Mismatches == 0);
+
+	printf("session %ux%u %u frames: overlay %6.0f bytes/frame (%5.1f KB/s at 30 fps), %u tiles drawn at most\n",
+		Width, Height, S.Frames, (double)S.Bytes / S.Frames, (double)S.Bytes / S.Frames * 30 / 1024, S.MaxValid);
+	printf("session %ux%u sharer %6.3f ms/frame (detection, records, SEI), viewer %6.3f ms/frame (parse & apply)\n",
+		Width, Height, S.SharerTime * 1e3 / S.Frames, S.ViewerTime * 1e3 / S.Outputs);
+}
+
+int main(int ArgCount, char** Args)
+{
+	Font_Init();
+
+	if (Test_IsBench(ArgCount, Args))
+	{
+		Bench_Tiles();
+		Bench_Session(1920, 1080);
+		return Test_Finish("TileOverlay bench");
+	}
+
+	Test_Lz();
+	Test_LzFuzz();
+	Test_Tiles();
+	Test_TileFuzz();
+	Test_Protocol();
+	Test_ApplyFuzz();
+	return Test_Finish("TileOverlay");
+}
@@ -0,0 +1,293 @@
+#include "Test.h"
+#include "../external/ViewSize.h"
+
+//
+// ViewSizeTest - encode size & viewport from external/ViewSize.h
+//
+// encode size for known captures & windows - monitor into smaller window, tall & very wide captures, window larger
+// than capture - and then for random captures & windows. Every size must be even, at least VIEW_MIN_HEIGHT high, never
+// larger than capture, and keep capture's aspect ratio within rounding. Viewport must be fully inside desktop, even,
+// never smaller than minimum unless desktop is, and centered on given point when it is not pushed by desktop edge.
+// Minimap outline must be at least one pixel and inside thumbnail for any viewport, also when desktop size from
+// network is smaller than thumbnail or zero. Capture size after resolution change or window resize must be even and
+// never larger than texture or window, and viewport size must not depend on desktop size while desktop is larger,
+// which lets sharer keep encoder when monitor changes resolution during viewport streaming.
+//
+// benchmark sweeps window sizes over common monitor sizes, as when user drags window border, and reports time per
+// encode size & viewport call.
+//
+
+static void Test_KnownSizes(void)
+{
+	static const struct
+	{
+		uint32_t CaptureWidth, CaptureHeight;
+		uint32_t ViewWidth, ViewHeight;
+		uint32_t Width, Height;
+	}
+	Cases[] =
+	{
+		{ 1920, 1080, 1280,  720, 1280,  720 },		// same aspect ratio
+		{ 1920, 1080, 1280, 1000, 1280,  720 },		// window taller than frame
+		{ 1920, 1080, 2000,  720, 1280,  720 },		// window wider than frame
+		{ 1920, 1080, 2560, 1440, 1920, 1080 },		// window larger than capture
+		{ 1920, 1080,  320,  180,  640,  360 },		// never narrower than VIEW_MIN_WIDTH
+		{  600,  400,  320,  240,  600,  400 },		// VIEW_MIN_WIDTH is not smaller than capture
+		{ 3000,    2, 1280,  720, 1280,    2 },		// very wide, height would round to 0
+		{ 3000,    3, 1280,  720, 1280,    2 },
+		{ 7680,   10,  800,  600,  800,    2 },
+		{ 1080, 1920,  640,  480,  640, 1136 },		// tall, fit width is clamped up to VIEW_MIN_WIDTH
+		{ 1080, 1920, 1000, 2000, 1000, 1776 },		// tall, window has same aspect ratio
+		{ 1921, 1081, 1281,  721, 1280,  720 },		// odd sizes
+		{ 1920, 1080,    0,  720, 1920, 1080 },		// no view size yet
+	};
+
+	for (size_t Index = 0; Index < sizeof(Cases) / sizeof(*Cases); Index++)
+	{
+		uint32_t Width = Cases[Index].CaptureWidth;
+		uint32_t Height = Cases[Index].CaptureHeight;
+		View_GetEncodeSize(Cases[Index].ViewWidth, Cases[Index].ViewHeight, &Width, &Height);
+		TEST_CHECK(Width == Cases[Index].Width);
+		TEST_CHECK(Height == Cases[Index].Height);
+	}
+}
+
+static void Test_RandomSizes(void)
+{
+	uint64_t Random = 48;
+	for (uint32_t Iteration = 0; Iteration < 200000; Iteration++)
+	{
+		uint32_t CaptureWidth = 2 + Test_RandomRange(&Random, 8192);
+		uint32_t CaptureHeight = 2 + Test_RandomRange(&Random, Iteration % 4 == 0 ? 16 : 8192);
+		uint32_t ViewWidth = 1 + Test_RandomRange(&Random, 4096);
+		uint32_t ViewHeight = 1 + Test_RandomRange(&Random, 4096);
+
+		uint32_t Width = CaptureWidth;
+		uint32_t Height = CaptureHeight;
+		View_GetEncodeSize(ViewWidth, ViewHeight, &Width, &Height);
+
+		if (Width == CaptureWidth)
+		{
+			// not scaled
+			TEST_CHECK(Height == CaptureHeight);
+			continue;
+		}
+
+		TEST_CHECK(Width % 2 == 0 && Height % 2 == 0);
+		TEST_CHECK(Width < CaptureWidth && Height <= CaptureHeight);
+		TEST_CHECK(Height >= VIEW_MIN_HEIGHT);
+		TEST_CHECK(Width >= VIEW_MIN_WIDTH);
+
+		// fits window, unless VIEW_MIN_WIDTH made it larger
+		TEST_CHECK(Width <= ViewWidth || Width <= VIEW_MIN_WIDTH + 1);
+		TEST_CHECK(Height <= ViewHeight || Width <= VIEW_MIN_WIDTH + 1 || Height == VIEW_MIN_HEIGHT);
+
+		// aspect ratio within rounding to even size, except height clamped to minimum
+		if (Height != VIEW_MIN_HEIGHT)
+		{
+			uint64_t Exact = (uint64_t)Width * CaptureHeight;
+			uint64_t Scaled = (uint64_t)Height * CaptureWidth;
+			TEST_CHECK(Scaled <= Exact && Exact - Scaled < 2ull * CaptureWidth);
+		}
+	}
+}
+
+static void Test_Viewport(void)
+{
+	// centered on desktop
+	ViewRect Rect;
+	View_GetViewport(0x8000, 0x8000, 1280, 720, 3840, 2160, &Rect);
+	TEST_CHECK(Rect.Left == 1280 && Rect.Top == 720 && Rect.Right == 2560 && Rect.Bottom == 1440);
+
+	// pushed inside by top left & bottom right edge
+	View_GetViewport(0, 0, 1280, 720, 3840, 2160, &Rect);
+	TEST_CHECK(Rect.Left == 0 && Rect.Top == 0 && Rect.Right == 1280 && Rect.Bottom == 720);
+	View_GetViewport(0xffff, 0xffff, 1280, 720, 3840, 2160, &Rect);
+	TEST_CHECK(Rect.Left == 2560 && Rect.Top == 1440 && Rect.Right == 3840 && Rect.Bottom == 2160);
+
+	// smaller than minimum, and larger than desktop
+	View_GetViewport(0x8000, 0x8000, 100, 100, 3840, 2160, &Rect);
+	TEST_CHECK(Rect.Right - Rect.Left == VIEW_VIEWPORT_MIN_WIDTH && Rect.Bottom - Rect.Top == VIEW_VIEWPORT_MIN_HEIGHT);
+	View_GetViewport(0x8000, 0x8000, 5000, 5000, 1921, 1081, &Rect);
+	TEST_CHECK(Rect.Left == 0 && Rect.Top == 0 && Rect.Right == 1920 && Rect.Bottom == 1080);
+
+	uint64_t Random = 49;
+	for (uint32_t Iteration = 0; Iteration < 200000; Iteration++)
+	{
+		uint32_t DesktopWidth = 2 + Test_RandomRange(&Random, 8192);
+		uint32_t DesktopHeight = 2 + Test_RandomRange(&Random, 8192);
+		uint32_t Width = Test_RandomRange(&Random, 10000);
+		uint32_t Height = Test_RandomRange(&Random, 10000);
+		uint32_t CenterX = Test_RandomRange(&Random, 0x10000);
+		uint32_t CenterY = Test_RandomRange(&Random, 0x10000);
+
+		View_GetViewport(CenterX, CenterY, Width, Height, DesktopWidth, DesktopHeight, &Rect);
+
+		int32_t RectWidth = Rect.Right - Rect.Left;
+		int32_t RectHeight = Rect.Bottom - Rect.Top;
+		TEST_CHECK(Rect.Left >= 0 && Rect.Top >= 0);
+		TEST_CHECK(Rect.Right <= (int32_t)DesktopWidth && Rect.Bottom <= (int32_t)DesktopHeight);
+		TEST_CHECK(RectWidth >= 2 && RectHeight >= 2);
+		TEST_CHECK(RectWidth % 2 == 0 && RectHeight % 2 == 0);
+		TEST_CHECK(RectWidth >= (int32_t)((DesktopWidth < VIEW_VIEWPORT_MIN_WIDTH ? DesktopWidth : VIEW_VIEWPORT_MIN_WIDTH) & ~1));
+		TEST_CHECK(RectHeight >= (int32_t)((DesktopHeight < VIEW_VIEWPORT_MIN_HEIGHT ? DesktopHeight : VIEW_VIEWPORT_MIN_HEIGHT) & ~1));
+
+		// center moves only when edge of desktop is in the way
+		int32_t X = (int32_t)(((uint64_t)CenterX * DesktopWidth) >> 16);
+		int32_t Y = (int32_t)(((uint64_t)CenterY * DesktopHeight) >> 16);
+		if (Rect.Left != 0 && Rect.Right != (int32_t)DesktopWidth)
+		{
+			TEST_CHECK(Rect.Left + RectWidth / 2 == X);
+		}
+		if (Rect.Top != 0 && Rect.Bottom != (int32_t)DesktopHeight)
+		{
+			TEST_CHECK(Rect.Top + RectHeight / 2 == Y);
+		}
+	}
+}
+
+static void Test_Outline(void)
+{
+	// 1920x1080 desktop in 256x144 thumbnail
+	ViewRect Viewport = { 640, 360, 1280, 720 };
+	ViewRect Rect;
+	View_GetOutline(&Viewport, 1920, 1080, 256, 144, &Rect);
+	TEST_CHECK(Rect.Left == 85 && Rect.Top == 48 && Rect.Right == 171 && Rect.Bottom == 96);
+
+	// whole desktop
+	Viewport = (ViewRect){ 0, 0, 1920, 1080 };
+	View_GetOutline(&Viewport, 1920, 1080, 256, 144, &Rect);
+	TEST_CHECK(Rect.Left == 0 && Rect.Top == 0 && Rect.Right == 256 && Rect.Bottom == 144);
+
+	// desktop smaller than thumbnail scales viewport past bottom right edge
+	Viewport = (ViewRect){ 0, 0, 40, 30 };
+	View_GetOutline(&Viewport, 40, 30, 200, 100, &Rect);
+	TEST_CHECK(Rect.Left == 0 && Rect.Top == 0 && Rect.Right == 200 && Rect.Bottom == 100);
+
+	uint64_t Random = 50;
+	for (uint32_t Iteration = 0; Iteration < 200000; Iteration++)
+	{
+		uint32_t DesktopWidth = Test_RandomRange(&Random, 0x10000);
+		uint32_t DesktopHeight = Test_RandomRange(&Random, 0x10000);
+		uint32_t Width = 1 + Test_RandomRange(&Random, 256);
+		uint32_t Height = 1 + Test_RandomRange(&Random, 256);
+
+		View_GetViewport(Test_RandomRange(&Random, 0x10000), Test_RandomRange(&Random, 0x10000), Test_RandomRange(&Random, 0x10000), Test_RandomRange(&Random, 0x10000), DesktopWidth, DesktopHeight, &Viewport);
+		View_GetOutline(&Viewport, DesktopWidth, DesktopHeight, Width, Height, &Rect);
+
+		TEST_CHECK(Rect.Left >= 0 && Rect.Top >= 0);
+		TEST_CHECK(Rect.Left < Rect.Right && Rect.Top < Rect.Bottom);
+		TEST_CHECK(Rect.Right <= (int32_t)Width && Rect.Bottom <= (int32_t)Height);
+	}
+}
+
+static void Test_CaptureSize(void)
+{
+	uint32_t Width, Height;
+	TEST_CHECK(View_GetCaptureSize(1920, 1080, NULL, &Width, &Height) && Width == 1920 && Height == 1080);
+	TEST_CHECK(View_GetCaptureSize(1366, 767, NULL, &Width, &Height) && Width == 1366 && Height == 766);
+	TEST_CHECK(!View_GetCaptureSize(1, 1080, NULL, &Width, &Height));
+
+	// window shrank, texture is still previous size
+	ViewRect Window = { 100, 200, 901, 801 };
+	TEST_CHECK(View_GetCaptureSize(1920, 1080, &Window, &Width, &Height) && Width == 800 && Height == 600);
+
+	// window grew, texture is smaller until frame pool is recreated
+	Window = (ViewRect){ -8, -8, 2000, 1200 };
+	TEST_CHECK(View_GetCaptureSize(1280, 720, &Window, &Width, &Height) && Width == 1280 && Height == 720);
+
+	// minimized
+	Window = (ViewRect){ -32000, -32000, -32000, -32000 };
+	TEST_CHECK(!View_GetCaptureSize(1280, 720, &Window, &Width, &Height));
+	Window = (ViewRect){ 10, 10, 0, 0 };
+	TEST_CHECK(!View_GetCaptureSize(1280, 720, &Window, &Width, &Height));
+
+	// viewport keeps its size through resolution changes, as long as desktop is larger than it
+	static const uint32_t Resolutions[][2] = { { 1920, 1080 }, { 2560, 1440 }, { 1280, 1024 }, { 3840, 2160 }, { 1921, 1201 }, { 1024, 768 } };
+	for (size_t Index = 0; Index < sizeof(Resolutions) / sizeof(*Resolutions); Index++)
+	{
+		TEST_CHECK(View_GetCaptureSize(Resolutions[Index][0], Resolutions[Index][1], NULL, &Width, &Height));
+
+		ViewRect Rect;
+		View_GetViewport(0x4000, 0xc000, 1280, 720, Width, Height, &Rect);
+		if (Width >= 1280 && Height >= 720)
+		{
+			TEST_CHECK(Rect.Right - Rect.Left == 1280 && Rect.Bottom - Rect.Top == 720);
+		}
+		else
+		{
+			TEST_CHECK(Rect.Right - Rect.Left == (int32_t)Width && Rect.Bottom - Rect.Top == 720);
+		}
+	}
+
+	uint64_t Random = 51;
+	for (uint32_t Iteration = 0; Iteration < 200000; Iteration++)
+	{
+		uint32_t TextureWidth = Test_RandomRange(&Random, 8192);
+		uint32_t TextureHeight = Test_RandomRange(&Random, 8192);
+		int32_t Left = (int32_t)Test_RandomRange(&Random, 8192) - 4096;
+		int32_t Top = (int32_t)Test_RandomRange(&Random, 8192) - 4096;
+		Window = (ViewRect){ Left, Top, Left + (int32_t)Test_RandomRange(&Random, 8192) - 16, Top + (int32_t)Test_RandomRange(&Random, 8192) - 16 };
+
+		bool IsWindow = Iteration % 2 == 0;
+		if (View_GetCaptureSize(TextureWidth, TextureHeight, IsWindow ? &Window : NULL, &Width, &Height))
+		{
+			TEST_CHECK(Width >= 2 && Height >= 2 && Width % 2 == 0 && Height % 2 == 0);
+			TEST_CHECK(Width <= TextureWidth && Height <= TextureHeight);
+			TEST_CHECK(!IsWindow || ((int64_t)Width <= Window.Right - Window.Left && (int64_t)Height <= Window.Bottom - Window.Top));
+		}
+		else
+		{
+			TEST_CHECK(Width < 2 || Height < 2);
+		}
+	}
+}
+
+static void Bench_Sizes(void)
+{
+	static const uint32_t Captures[][2] = { { 1920, 1080 }, { 2560, 1440 }, { 3840, 2160 }, { 5120, 1440 } };
+
+	for (size_t Index = 0; Index < sizeof(Captures) / sizeof(*Captures); Index++)
+	{
+		uint32_t CaptureWidth = Captures[Index][0];
+		uint32_t CaptureHeight = Captures[Index][1];
+
+		uint32_t Calls = 0;
+		uint64_t Sum = 0;
+		double Best;
+		TEST_BENCH(0.2, Best,
+			Calls = 0;
+			for (uint32_t ViewWidth = 200; ViewWidth < CaptureWidth; ViewWidth += 7)
+			{
+				uint32_t ViewHeight = ViewWidth * 9 / 16 + ViewWidth % 97;
+
+				uint32_t Width = CaptureWidth;
+				uint32_t Height = CaptureHeight;
+				View_GetEncodeSize(ViewWidth, ViewHeight, &Width, &Height);
+
+				ViewRect Rect;
+				View_GetViewport(ViewWidth * 17, ViewHeight * 31, ViewWidth, ViewHeight, CaptureWidth, CaptureHeight, &Rect);
+				Sum += Width + Height + Rect.Left + Rect.Top;
+				Calls++;
+			});
+		TEST_CHECK(Sum != 0);
+
+		printf("%ux%u: %.1f ns per encode size & viewport\n", CaptureWidth, CaptureHeight, Best * 1e9 / Calls);
+	}
+}
+
+int main(int ArgCount, char** Args)
+{
+	if (Test_IsBench(ArgCount, Args))
+	{
+		Bench_Sizes();
+		return Test_Finish("ViewSize bench");
+	}
+
+	Test_KnownSizes();
+	Test_RandomSizes();
+	Test_Viewport();
+	Test_Outline();
+	Test_CaptureSize();
+	return Test_Finish("ViewSize");
+}